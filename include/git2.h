@@ -18,6 +18,7 @@
 #include "git2/cherrypick.h"
 #include "git2/clone.h"
 #include "git2/commit.h"
+#include "git2/commit_graph.h"
 #include "git2/common.h"
 #include "git2/config.h"
 #include "git2/describe.h"
@@ -40,6 +41,7 @@
 #include "git2/pack.h"
 #include "git2/patch.h"
 #include "git2/pathspec.h"
+#include "git2/profile.h"
 #include "git2/proxy.h"
 #include "git2/rebase.h"
 #include "git2/refdb.h"
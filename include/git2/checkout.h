@@ -292,6 +292,12 @@ typedef struct git_checkout_options {
 	/** Optional callback to notify the consumer of performance data. */
 	git_checkout_perfdata_cb perfdata_cb;
 	void *perfdata_payload;
+
+	/** Number of threads to write files with.  Directories are still
+	 *  created and callbacks called on the calling thread, in order.
+	 *  The default of 0 (like 1) writes every file on the calling thread.
+	 */
+	unsigned int threads;
 } git_checkout_options;
 
 #define GIT_CHECKOUT_OPTIONS_VERSION 1
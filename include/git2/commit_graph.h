@@ -0,0 +1,43 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_git_commit_graph_h__
+#define INCLUDE_git_commit_graph_h__
+
+#include "common.h"
+#include "types.h"
+
+/**
+ * @file git2/commit_graph.h
+ * @brief Git commit-graph routines
+ * @defgroup git_commit_graph Git commit-graph routines
+ * @ingroup Git
+ * @{
+ */
+GIT_BEGIN_DECL
+
+/**
+ * Write a commit-graph file for the repository.
+ *
+ * The commit-graph (`objects/info/commit-graph`, in the format used by
+ * git) holds the parents, commit time, root tree and generation number
+ * of every commit reachable from `HEAD` and the references of the
+ * repository. Revision walks, merge-base computations and
+ * `git_graph_descendant_of` consult it instead of inflating and parsing
+ * each commit.
+ *
+ * The file is a snapshot: commits created afterwards are still found
+ * through the object database, so it only needs to be rewritten to
+ * speed up access to them.
+ *
+ * @param repo the repository to write the commit-graph for
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_commit_graph_write(git_repository *repo);
+
+/** @} */
+GIT_END_DECL
+#endif
@@ -153,6 +153,54 @@ typedef enum {
  */
 GIT_EXTERN(int) git_libgit2_features(void);
 
+/**
+ * Counters of the work done by the library since it was loaded, across
+ * all repositories.  They help sizing the caches and memory windows;
+ * see `GIT_OPT_GET_STATS`.
+ */
+typedef struct {
+	unsigned int version;
+
+	/** Lookups in the object caches which found the object */
+	size_t cache_hits;
+	/** Lookups in the object caches which did not */
+	size_t cache_misses;
+	/** Objects evicted from the object caches to stay under their limit */
+	size_t cache_evictions;
+	/** Bytes taken by the objects in the object caches now */
+	size_t cache_memory;
+
+	/** Delta bases found in the delta base cache of a packfile */
+	size_t pack_cache_hits;
+	/** Delta bases looked up there but not found */
+	size_t pack_cache_misses;
+
+	/** Memory windows mapped over packfiles */
+	size_t mwindow_maps;
+	/** Memory windows unmapped */
+	size_t mwindow_unmaps;
+	/** Bytes of packfiles mapped now, and at most */
+	size_t mwindow_mapped, mwindow_peak_mapped;
+	/** Memory windows open now, and at most */
+	size_t mwindow_open, mwindow_peak_open;
+
+	/** Bytes of objects and deltas inflated by zlib */
+	size_t inflated_bytes;
+} git_stats;
+
+#define GIT_STATS_VERSION 1
+#define GIT_STATS_INIT {GIT_STATS_VERSION}
+
+/**
+ * Initializes a `git_stats` with default values. Equivalent to
+ * creating an instance with GIT_STATS_INIT.
+ *
+ * @param stats the `git_stats` struct to initialize.
+ * @param version Version the struct; pass `GIT_STATS_VERSION`
+ * @return Zero on success; -1 on failure.
+ */
+GIT_EXTERN(int) git_stats_init(git_stats *stats, unsigned int version);
+
 /**
  * Global library options
  *
@@ -183,6 +231,19 @@ typedef enum {
 	GIT_OPT_GET_WINDOWS_SHAREMODE,
 	GIT_OPT_SET_WINDOWS_SHAREMODE,
 	GIT_OPT_ENABLE_STRICT_HASH_VERIFICATION,
+	GIT_OPT_GET_INDEXER_THREADS,
+	GIT_OPT_SET_INDEXER_THREADS,
+	GIT_OPT_GET_INDEX_THREADS,
+	GIT_OPT_SET_INDEX_THREADS,
+	GIT_OPT_GET_WORKDIR_STAT_THREADS,
+	GIT_OPT_SET_WORKDIR_STAT_THREADS,
+	GIT_OPT_GET_PACK_CACHE_MAX_SIZE,
+	GIT_OPT_SET_PACK_CACHE_MAX_SIZE,
+	GIT_OPT_GET_CACHE_STATS,
+	GIT_OPT_GET_STATS,
+	GIT_OPT_ENABLE_ODB_PREFETCH,
+	GIT_OPT_ENABLE_MWINDOW_WHOLE_PACK,
+	GIT_OPT_ENABLE_PACKED_REFS_MMAP,
 } git_libgit2_opt_t;
 
 /**
@@ -345,6 +406,103 @@ typedef enum {
  *		> additional checksum calculation on each object. This defaults
  *		> to enabled.
  *
+ *	* opts(GIT_OPT_GET_INDEXER_THREADS, unsigned int *threads)
+ *
+ *		> Get the number of threads new indexers use to resolve deltas.
+ *
+ *	* opts(GIT_OPT_SET_INDEXER_THREADS, unsigned int threads)
+ *
+ *		> Set the number of threads new indexers (including the ones
+ *		> used when fetching or cloning) use to resolve deltas. When
+ *		> set to 0, the number of CPUs is autodetected. This defaults
+ *		> to 1, which resolves deltas on the calling thread.
+ *
+ *	* opts(GIT_OPT_GET_INDEX_THREADS, unsigned int *threads)
+ *
+ *		> Get the number of threads used to load index files.
+ *
+ *	* opts(GIT_OPT_SET_INDEX_THREADS, unsigned int threads)
+ *
+ *		> Set the number of threads used to parse the entries of an
+ *		> index file which carries an index entry offset table. Such
+ *		> a table is written along with large indexes. When set to 0,
+ *		> the number of CPUs is autodetected. This defaults to 1, which
+ *		> parses the entries on the calling thread.
+ *
+ *	* opts(GIT_OPT_GET_WORKDIR_STAT_THREADS, unsigned int *threads)
+ *
+ *		> Get the number of threads used to stat the files of the index
+ *		> when comparing it to the working directory.
+ *
+ *	* opts(GIT_OPT_SET_WORKDIR_STAT_THREADS, unsigned int threads)
+ *
+ *		> Set the number of threads used to stat the files of the index
+ *		> ahead of reading the working directory, in status, diff and
+ *		> checkout. This helps on filesystems where a stat is slow,
+ *		> such as network filesystems. When set to 0, the number of
+ *		> CPUs is autodetected. This defaults to 1, which stats each
+ *		> file on the calling thread as its directory is read.
+ *
+ *	* opts(GIT_OPT_GET_PACK_CACHE_MAX_SIZE, size_t *bytes)
+ *
+ *		> Get the maximum memory used to cache delta bases per packfile.
+ *
+ *	* opts(GIT_OPT_SET_PACK_CACHE_MAX_SIZE, size_t bytes)
+ *
+ *		> Set the maximum memory each packfile uses to cache the delta
+ *		> bases it inflated, so that reading other objects which are
+ *		> deltas against them doesn't inflate them again. Bases which
+ *		> took the longest delta chains to produce are kept longest.
+ *		> This defaults to 16MB; 0 disables the cache.
+ *
+ *	* opts(GIT_OPT_GET_CACHE_STATS, size_t *hits, size_t *misses, size_t *evictions)
+ *
+ *		> Get the number of lookups in the object caches of all
+ *		> repositories which found the object and which didn't, and
+ *		> the number of objects evicted to stay under the limit set
+ *		> with `GIT_OPT_SET_CACHE_MAX_SIZE`, since the library was
+ *		> loaded.
+ *
+ *	* opts(GIT_OPT_GET_STATS, git_stats *stats)
+ *
+ *		> Fill a `git_stats` (initialized with `GIT_STATS_INIT`) with
+ *		> the counters of the object and delta base caches, memory
+ *		> windows and zlib since the library was loaded. This is safe
+ *		> to call while other threads use the library.
+ *
+ *	* opts(GIT_OPT_ENABLE_ODB_PREFETCH, int enabled)
+ *
+ *		> Read the subtrees of the trees being walked by
+ *		> `git_tree_walk()`, the packbuilder and tree iterators on a
+ *		> background thread, so that reading them overlaps with
+ *		> parsing the trees before them. This helps when the objects
+ *		> are not in the filesystem cache, or come from a slow custom
+ *		> odb backend. This defaults to disabled, and requires
+ *		> threading to be enabled.
+ *
+ *	* opts(GIT_OPT_ENABLE_MWINDOW_WHOLE_PACK, int enabled)
+ *
+ *		> Map each packfile whole when it is opened, instead of
+ *		> mapping windows of it as they are needed. Reads then never
+ *		> wait for a window to be mapped or look one up, and the
+ *		> kernel is told that the pack is read at random. The
+ *		> mapped limit does not apply to these maps, which stay
+ *		> until the pack is closed, so this only makes sense with
+ *		> a large address space; it requires a 64-bit build. Packs
+ *		> which are already open keep their windows. This defaults
+ *		> to disabled.
+ *
+ *	* opts(GIT_OPT_ENABLE_PACKED_REFS_MMAP, int enabled)
+ *
+ *		> Look up references in the `packed-refs` file by mapping it
+ *		> and searching it where it lies, instead of parsing all of
+ *		> it into memory whenever it changes. Iterators read the
+ *		> references from the map as they go. This needs the file to
+ *		> say that it is sorted, like the ones written by git and
+ *		> libgit2 do; other files are parsed as usual. Deleting a
+ *		> packed reference or packing references still parses the
+ *		> whole file. This defaults to disabled.
+ *
  * @param option Option key
  * @param ... value to set the option
  * @return 0 on success, <0 on failure
@@ -132,6 +132,8 @@ typedef enum {
 
 	GIT_IDXENTRY_UNPACKED          =  (1 << 8),
 	GIT_IDXENTRY_NEW_SKIP_WORKTREE =  (1 << 9),
+	/** unchanged since the token of the filesystem monitor */
+	GIT_IDXENTRY_FSMONITOR_VALID   =  (1 << 10),
 } git_idxentry_extended_flag_t;
 
 /** Capabilities of system that affect index actions. */
@@ -35,6 +35,21 @@ GIT_EXTERN(int) git_indexer_new(
 		git_transfer_progress_cb progress_cb,
 		void *progress_cb_payload);
 
+/**
+ * Set number of threads to spawn when resolving deltas
+ *
+ * Deltas are resolved in `git_indexer_commit`, which is where most
+ * of the time is spent when indexing large packfiles. By default
+ * the number of threads set with `GIT_OPT_SET_INDEXER_THREADS` is
+ * used, which is a single thread unless changed; when set to 0,
+ * libgit2 will autodetect the number of CPUs.
+ *
+ * @param idx the indexer
+ * @param n Number of threads to spawn
+ * @return number of actual threads to be used
+ */
+GIT_EXTERN(unsigned int) git_indexer_set_threads(git_indexer *idx, unsigned int n);
+
 /**
  * Add data to the indexer
  *
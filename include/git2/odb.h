@@ -99,6 +99,37 @@ GIT_EXTERN(void) git_odb_free(git_odb *db);
  */
 GIT_EXTERN(int) git_odb_read(git_odb_object **out, git_odb *db, const git_oid *id);
 
+/**
+ * Callback for `git_odb_read_many()`.  The object is NULL when it is
+ * not in the database; it is freed when the callback returns unless
+ * the callback keeps it with `git_odb_object_dup()`.
+ */
+typedef int (*git_odb_read_many_cb)(
+	const git_oid *id, git_odb_object *object, void *payload);
+
+/**
+ * Read many objects from the database.
+ *
+ * This is quicker than calling `git_odb_read()` for each of them:
+ * every backend is asked for all the objects that are still missing
+ * at once, and the packfile backend reads them in the order they are
+ * stored, so that the parts of the packfiles it maps and the delta
+ * bases it inflates are reused across the objects.
+ *
+ * The callback is called once for each id, in no particular order.
+ *
+ * @param db database to search for the objects in.
+ * @param ids identities of the objects to read.
+ * @param count number of ids.
+ * @param cb function to call with each object.
+ * @param payload payload to pass to the callback.
+ * @return 0 on success, the non-zero value returned by the
+ *  callback, or an error code
+ */
+GIT_EXTERN(int) git_odb_read_many(
+	git_odb *db, const git_oid *ids, size_t count,
+	git_odb_read_many_cb cb, void *payload);
+
 /**
  * Read an object from the database, given a prefix
  * of its identifier.
@@ -387,6 +418,21 @@ GIT_EXTERN(int) git_odb_write_pack(
 	git_transfer_progress_cb progress_cb,
 	void *progress_payload);
 
+/**
+ * Write a `multi-pack-index` file covering all the packfiles of the
+ * object database.
+ *
+ * The multi-pack-index (in the format used by git) merges the indexes of
+ * many packfiles, so that finding an object in them takes a single
+ * lookup instead of one per packfile. Packfiles added afterwards are
+ * still searched individually until it is rewritten.
+ *
+ * @param db object database where the multi-pack-index will be written
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_odb_write_multi_pack_index(
+	git_odb *db);
+
 /**
  * Determine the object-ID (sha1 hash) of a data buffer
  *
@@ -536,6 +582,20 @@ GIT_EXTERN(size_t) git_odb_num_backends(git_odb *odb);
  */
 GIT_EXTERN(int) git_odb_get_backend(git_odb_backend **out, git_odb *odb, size_t pos);
 
+/**
+ * Get the number of times an ODB backend was asked for an object
+ *
+ * This counts the reads, header reads and existence checks, including
+ * the ones for a prefix, passed to the backend at `pos` since it was
+ * added.  Objects found in the object cache don't reach the backends.
+ *
+ * @param out pointer where to store the number of lookups
+ * @param odb object database
+ * @param pos index into object database backend list
+ * @return 0 on success; GIT_ENOTFOUND if pos is invalid
+ */
+GIT_EXTERN(int) git_odb_get_backend_lookups(size_t *out, git_odb *odb, size_t pos);
+
 /** @} */
 GIT_END_DECL
 #endif
@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_git_profile_h__
+#define INCLUDE_git_profile_h__
+
+#include "common.h"
+#include "types.h"
+#include "buffer.h"
+
+/**
+ * @file git2/profile.h
+ * @brief Git profiling routines
+ * @defgroup git_profile Git profiling routines
+ * @ingroup Git
+ * @{
+ *
+ * Operations such as clone, fetch, checkout, status, diff, merge and
+ * revision walks are divided into regions, which are timed when a
+ * profiling callback is set.  Regions nest: a checkout contains the
+ * diff it computes, which contains the reads of the directories it
+ * looks at.  The callback is called when a region is left, so inner
+ * regions are reported before the region they are part of.
+ */
+GIT_BEGIN_DECL
+
+/** A region of work which was timed */
+typedef struct {
+	/** Name of the region, such as "checkout" or "checkout.write" */
+	const char *name;
+
+	/** Number of regions this one is nested in, on the same thread */
+	unsigned int depth;
+
+	/** Identifies the thread which did the work */
+	size_t thread;
+
+	/** When the region was entered, in seconds since an arbitrary point */
+	double start;
+
+	/** How long the region took, in seconds */
+	double elapsed;
+
+	/**
+	 * Number of items processed in the region (files written, deltas
+	 * found, commits walked...), or 0 if it doesn't process any.
+	 */
+	size_t count;
+} git_profile_region;
+
+/**
+ * Callback for a timed region.  It is called on the thread which did
+ * the work, so it has to be thread-safe when libgit2 is used on
+ * several threads.
+ */
+typedef void (*git_profile_cb)(
+	const git_profile_region *region, void *payload);
+
+/**
+ * Sets the callback to which timed regions are reported.  Pass NULL to
+ * stop profiling; regions cost nothing but a check when no callback is
+ * set.
+ *
+ * @param cb Function to call with each region that was left
+ * @param payload Payload to pass to the callback
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_profile_set(git_profile_cb cb, void *payload);
+
+/**
+ * Appends a region to a buffer as an event of the trace event format
+ * used by Chrome's `about:tracing` and other flame chart viewers, with
+ * a trailing comma.  Wrapping all the events of a profile in `[` and
+ * `]` makes a trace file they can load.
+ *
+ * @param out Buffer to append the event to
+ * @param region The region to format
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_profile_region_format(
+	git_buf *out, const git_profile_region *region);
+
+/** @} */
+GIT_END_DECL
+#endif
@@ -0,0 +1,102 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_sys_git_fsmonitor_h__
+#define INCLUDE_sys_git_fsmonitor_h__
+
+#include "git2/common.h"
+#include "git2/types.h"
+#include "git2/buffer.h"
+
+/**
+ * @file git2/sys/fsmonitor.h
+ * @brief Git filesystem monitor integration
+ * @defgroup git_fsmonitor Git filesystem monitor integration
+ * @ingroup Git
+ * @{
+ *
+ * A filesystem monitor (such as watchman) knows which files of the
+ * working directory were changed since some point in time.  When one
+ * is set on a repository, the index remembers which of its entries
+ * still match the working directory, along with a token describing
+ * when that was true (this is stored as the `FSMN` extension, which
+ * git understands too).  Status and checkout then only need to look at
+ * the files the monitor reports instead of `lstat`ing every entry.
+ */
+GIT_BEGIN_DECL
+
+typedef struct git_fsmonitor git_fsmonitor;
+
+/**
+ * Callback to report a path which changed.  The path is relative to
+ * the working directory; if it ends in a '/', everything beneath that
+ * directory may have changed.
+ */
+typedef int (*git_fsmonitor_changed_cb)(const char *path, void *payload);
+
+/** A filesystem monitor */
+struct git_fsmonitor {
+	unsigned int version;
+
+	/**
+	 * Report the paths which changed since `token` by calling `changed`
+	 * for each of them, and put a token describing the current point in
+	 * time into `new_token`.  Reporting a path which didn't change is
+	 * fine, but missing one which did is not.
+	 *
+	 * `token` is NULL when there is no token yet, in which case only
+	 * `new_token` has to be filled.  If the monitor can't tell what
+	 * changed since `token` (for example because it was restarted), it
+	 * should still fill `new_token` but return `GIT_PASSTHROUGH`; every
+	 * path is then considered to have changed.  Any other error is
+	 * passed on to the caller.
+	 */
+	int (*query)(
+		git_fsmonitor *fsmonitor,
+		git_buf *new_token,
+		const char *token,
+		git_fsmonitor_changed_cb changed,
+		void *payload);
+
+	/**
+	 * Frees the monitor (including the `git_fsmonitor` itself), when
+	 * the repository it is set on is freed or it is replaced.
+	 */
+	void (*free)(git_fsmonitor *fsmonitor);
+};
+
+#define GIT_FSMONITOR_VERSION 1
+#define GIT_FSMONITOR_INIT {GIT_FSMONITOR_VERSION}
+
+/**
+ * Initializes a `git_fsmonitor` with default values. Equivalent to
+ * creating an instance with GIT_FSMONITOR_INIT.
+ *
+ * @param fsmonitor the `git_fsmonitor` struct to initialize.
+ * @param version Version the struct; pass `GIT_FSMONITOR_VERSION`
+ * @return Zero on success; -1 on failure.
+ */
+GIT_EXTERN(int) git_fsmonitor_init(
+	git_fsmonitor *fsmonitor,
+	unsigned int version);
+
+/**
+ * Set the filesystem monitor of a repository
+ *
+ * The repository takes ownership of the monitor, and frees the one it
+ * had before, if any.  Pass NULL to stop using a monitor.
+ *
+ * @param repo A repository object
+ * @param fsmonitor The monitor to use, or NULL
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_repository_set_fsmonitor(
+	git_repository *repo,
+	git_fsmonitor *fsmonitor);
+
+/** @} */
+GIT_END_DECL
+#endif
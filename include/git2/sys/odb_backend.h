@@ -21,6 +21,15 @@
  */
 GIT_BEGIN_DECL
 
+/**
+ * Callback for each object found by the `read_many` function of a
+ * backend.  `pos` is the position of its id in the array the backend
+ * was given, and the data becomes owned by libgit2, so it should be
+ * allocated with `git_odb_backend_malloc`.
+ */
+typedef int (*git_odb_backend_read_cb)(
+	size_t pos, void *data, size_t len, git_otype type, void *payload);
+
 /**
  * An instance for a custom backend
  */
@@ -94,6 +103,25 @@ struct git_odb_backend {
 	 */
 	int (* freshen)(git_odb_backend *, const git_oid *);
 
+	/**
+	 * If the backend stores objects in packfiles, write a
+	 * multi-pack-index covering all of them so that lookups search a
+	 * single index instead of one per packfile.
+	 */
+	int (* writemidx)(git_odb_backend *);
+
+	/**
+	 * Reads many objects at once, calling `cb` for those the backend
+	 * has, in whichever order is cheapest, and skipping the others.  A
+	 * non-zero return from `cb` must stop the read and be returned.
+	 * Backends which read objects more quickly together than one at a
+	 * time should implement this; `read` is called for each object
+	 * otherwise.
+	 */
+	int (* read_many)(
+		git_odb_backend *, const git_oid *ids, size_t count,
+		git_odb_backend_read_cb cb, void *payload);
+
 	/**
 	 * Frees any resources held by the odb (including the `git_odb_backend`
 	 * itself). An odb backend implementation must provide this function.
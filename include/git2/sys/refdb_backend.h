@@ -56,6 +56,20 @@ struct git_reference_iterator {
 		git_reference_iterator *iter);
 };
 
+/**
+ * A locked reference to unlock along with others; see
+ * `git_refdb_backend.unlock_many`.  The fields are what `unlock` is
+ * given for the reference.
+ */
+typedef struct {
+	void *payload;
+	int success;
+	int update_reflog;
+	const git_reference *ref;
+	const git_signature *sig;
+	const char *message;
+} git_refdb_update;
+
 /** An instance for a custom backend */
 struct git_refdb_backend {
 	unsigned int version;
@@ -167,6 +181,18 @@ struct git_refdb_backend {
 	 */
 	int (*unlock)(git_refdb_backend *backend, void *payload, int success, int update_reflog,
 		      const git_reference *ref, const git_signature *sig, const char *message);
+
+	/**
+	 * Unlock several references at once, each as `unlock` would. The
+	 * updates come sorted by reference name. This lets a backend apply
+	 * them together, e.g. rewriting its packed references only once.
+	 * All of the references must be unlocked; once one of them fails,
+	 * the ones after it are discarded, and the first error is returned.
+	 *
+	 * A refdb implementation may provide this function; if it is not
+	 * provided, `unlock` is called for each reference.
+	 */
+	int (*unlock_many)(git_refdb_backend *backend, git_refdb_update *updates, size_t count);
 };
 
 #define GIT_REFDB_BACKEND_VERSION 1
@@ -199,6 +225,22 @@ GIT_EXTERN(int) git_refdb_backend_fs(
 	git_refdb_backend **backend_out,
 	git_repository *repo);
 
+/**
+ * Constructor for a refdb backend which keeps references and reflogs in
+ * a stack of reftables under `$GIT_DIR/reftable`
+ *
+ * This is never chosen for you; set it on the repository's refdb with
+ * `git_refdb_set_backend`.  Reference namespaces and per-worktree
+ * references are not supported.
+ *
+ * @param backend_out Output pointer to the git_refdb_backend object
+ * @param repo Git repository to access
+ * @return 0 on success, <0 error code on failure
+ */
+GIT_EXTERN(int) git_refdb_backend_reftable(
+	git_refdb_backend **backend_out,
+	git_repository *repo);
+
 /**
  * Sets the custom backend to an existing reference DB
  *
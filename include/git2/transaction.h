@@ -36,6 +36,11 @@ GIT_EXTERN(int) git_transaction_new(git_transaction **out, git_repository *repo)
  * Lock the specified reference. This is the first step to updating a
  * reference.
  *
+ * The lock is taken right away, so references are locked in the order
+ * in which this is called. Callers which lock several references and
+ * may run alongside others doing the same should lock them in the
+ * order of their names; only the commit sorts them by itself.
+ *
  * @param tx the transaction
  * @param refname the reference to lock
  * @return 0 or an error message
@@ -11,6 +11,7 @@
 #include "filebuf.h"
 #include "attrcache.h"
 #include "git2/blob.h"
+#include "git2/odb.h"
 #include "git2/tree.h"
 #include "index.h"
 #include <ctype.h>
@@ -168,10 +169,13 @@ int git_attr_file__load(
 	/* write cache breakers */
 	if (nonexistent)
 		file->nonexistent = 1;
-	else if (source == GIT_ATTR_FILE__FROM_INDEX)
+	else if (source == GIT_ATTR_FILE__FROM_INDEX) {
 		git_oid_cpy(&file->cache_data.oid, git_blob_id(blob));
-	else if (source == GIT_ATTR_FILE__FROM_FILE)
+		git_oid_cpy(&file->id, git_blob_id(blob));
+		file->has_id = 1;
+	} else if (source == GIT_ATTR_FILE__FROM_FILE) {
 		git_futils_filestamp_set_from_stat(&file->cache_data.stamp, &st);
+	}
 	/* else always cacheable */
 
 	*out = file;
@@ -183,6 +187,49 @@ cleanup:
 	return error;
 }
 
+int git_attr_file__id(git_oid *out, git_attr_file *file)
+{
+	git_futils_filestamp stamp;
+	git_oid id;
+	int error = 0;
+
+	memset(out, 0, sizeof(git_oid));
+
+	if (file->nonexistent || file->source == GIT_ATTR_FILE__IN_MEMORY)
+		return 0;
+
+	if (git_mutex_lock(&file->lock) < 0) {
+		giterr_set(GITERR_OS, "failed to lock attribute file");
+		return -1;
+	}
+
+	if (file->has_id) {
+		git_oid_cpy(out, &file->id);
+		goto done;
+	}
+
+	/* only hash the file if it is still what we parsed */
+	git_futils_filestamp_set(&stamp, &file->cache_data.stamp);
+
+	if ((error = git_odb_hashfile(&id, file->entry->fullpath, GIT_OBJ_BLOB)) < 0) {
+		if (error == GIT_ENOTFOUND) {
+			giterr_clear();
+			error = 0;
+		}
+		goto done;
+	}
+
+	if (git_futils_filestamp_check(&stamp, file->entry->fullpath) == 0) {
+		git_oid_cpy(&file->id, &id);
+		file->has_id = 1;
+		git_oid_cpy(out, &id);
+	}
+
+done:
+	git_mutex_unlock(&file->lock);
+	return error;
+}
+
 int git_attr_file__out_of_date(
 	git_repository *repo,
 	git_attr_session *attr_session,
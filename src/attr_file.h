@@ -87,7 +87,9 @@ typedef struct {
 	git_vector rules;			/* vector of <rule*> or <fnmatch*> */
 	git_pool pool;
 	unsigned int nonexistent:1;
+	unsigned int has_id:1;
 	int session_key;
+	git_oid id; /* blob id of the contents; see `git_attr_file__id` */
 	union {
 		git_oid oid;
 		git_futils_filestamp stamp;
@@ -161,6 +163,13 @@ int git_attr_file__load_standalone(
 int git_attr_file__out_of_date(
 	git_repository *repo, git_attr_session *session, git_attr_file *file);
 
+/*
+ * The blob id of the contents the rules were parsed from.  Files read
+ * from the working directory are only hashed when this is first asked
+ * for; if the file has changed since it was parsed, the id is zeroed.
+ */
+int git_attr_file__id(git_oid *out, git_attr_file *file);
+
 int git_attr_file__parse_buffer(
 	git_repository *repo, git_attr_file *attrs, const char *data);
 
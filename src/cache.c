@@ -30,6 +30,39 @@ static size_t git_cache__max_object_size[8] = {
 	0      /* GIT_OBJ_REF_DELTA */
 };
 
+/* Looks at this many entries to pick each one to evict */
+#define GIT_CACHE_EVICT_SAMPLES 5
+
+typedef struct {
+	git_atomic_ssize hits;
+	git_atomic_ssize misses;
+	git_atomic_ssize evictions;
+} cache_counters;
+
+/*
+ * Counted for all caches, but split like the shards so that threads
+ * looking up different objects don't all update the same counters.
+ */
+static cache_counters git_cache__counters[GIT_CACHE_SHARDS];
+
+GIT_INLINE(cache_counters *) cache_counters_for(const git_oid *oid)
+{
+	return &git_cache__counters[oid->id[GIT_OID_RAWSZ - 1] % GIT_CACHE_SHARDS];
+}
+
+void git_cache_stats(size_t *hits, size_t *misses, size_t *evictions)
+{
+	size_t i;
+
+	*hits = *misses = *evictions = 0;
+
+	for (i = 0; i < GIT_CACHE_SHARDS; i++) {
+		*hits += (size_t)git_cache__counters[i].hits.val;
+		*misses += (size_t)git_cache__counters[i].misses.val;
+		*evictions += (size_t)git_cache__counters[i].evictions.val;
+	}
+}
+
 int git_cache_set_max_object_size(git_otype type, size_t size)
 {
 	if (type < 0 || (size_t)type >= ARRAY_SIZE(git_cache__max_object_size)) {
@@ -41,105 +74,231 @@ int git_cache_set_max_object_size(git_otype type, size_t size)
 	return 0;
 }
 
+static ssize_t cache_used_memory(git_cache *cache)
+{
+	ssize_t used_memory = 0;
+	size_t i;
+
+	for (i = 0; i < GIT_CACHE_SHARDS; i++)
+		used_memory += cache->shards[i].used_memory;
+
+	return used_memory;
+}
+
 void git_cache_dump_stats(git_cache *cache)
 {
 	git_cached_obj *object;
+	size_t i;
 
 	if (git_cache_size(cache) == 0)
 		return;
 
 	printf("Cache %p: %"PRIuZ" items cached, %"PRIdZ" bytes\n",
-		cache, git_cache_size(cache), cache->used_memory);
-
-	git_oidmap_foreach_value(cache->map, object, {
-		char oid_str[9];
-		printf(" %s%c %s (%"PRIuZ")\n",
-			git_object_type2string(object->type),
-			object->flags == GIT_CACHE_STORE_PARSED ? '*' : ' ',
-			git_oid_tostr(oid_str, sizeof(oid_str), &object->oid),
-			object->size
-		);
-	});
+		cache, git_cache_size(cache), cache_used_memory(cache));
+
+	for (i = 0; i < GIT_CACHE_SHARDS; i++) {
+		git_oidmap_foreach_value(cache->shards[i].map, object, {
+			char oid_str[9];
+			printf(" %s%c %s (%"PRIuZ")\n",
+				git_object_type2string(object->type),
+				object->flags == GIT_CACHE_STORE_PARSED ? '*' : ' ',
+				git_oid_tostr(oid_str, sizeof(oid_str), &object->oid),
+				object->size
+			);
+		});
+	}
 }
 
 int git_cache_init(git_cache *cache)
 {
+	size_t i;
+
 	memset(cache, 0, sizeof(*cache));
-	cache->map = git_oidmap_alloc();
-	GITERR_CHECK_ALLOC(cache->map);
-	if (git_rwlock_init(&cache->lock)) {
-		giterr_set(GITERR_OS, "failed to initialize cache rwlock");
-		return -1;
+
+	for (i = 0; i < GIT_CACHE_SHARDS; i++) {
+		git_cache_shard *shard = &cache->shards[i];
+
+		shard->map = git_oidmap_alloc();
+		GITERR_CHECK_ALLOC(shard->map);
+
+		if (git_rwlock_init(&shard->lock)) {
+			giterr_set(GITERR_OS, "failed to initialize cache rwlock");
+			return -1;
+		}
 	}
+
 	return 0;
 }
 
 /* called with lock */
-static void clear_cache(git_cache *cache)
+static void clear_shard(git_cache_shard *shard)
 {
 	git_cached_obj *evict = NULL;
 
-	if (git_cache_size(cache) == 0)
+	if (git_oidmap_size(shard->map) == 0)
 		return;
 
-	git_oidmap_foreach_value(cache->map, evict, {
+	git_oidmap_foreach_value(shard->map, evict, {
 		git_cached_obj_decref(evict);
 	});
 
-	git_oidmap_clear(cache->map);
-	git_atomic_ssize_add(&git_cache__current_storage, -cache->used_memory);
-	cache->used_memory = 0;
+	git_oidmap_clear(shard->map);
+	git_atomic_ssize_add(&git_cache__current_storage, -shard->used_memory);
+	shard->used_memory = 0;
 }
 
 void git_cache_clear(git_cache *cache)
 {
-	if (git_rwlock_wrlock(&cache->lock) < 0)
-		return;
+	size_t i;
 
-	clear_cache(cache);
+	for (i = 0; i < GIT_CACHE_SHARDS; i++) {
+		git_cache_shard *shard = &cache->shards[i];
 
-	git_rwlock_wrunlock(&cache->lock);
+		if (git_rwlock_wrlock(&shard->lock) < 0)
+			continue;
+
+		clear_shard(shard);
+
+		git_rwlock_wrunlock(&shard->lock);
+	}
 }
 
 void git_cache_free(git_cache *cache)
 {
+	size_t i;
+
 	git_cache_clear(cache);
-	git_oidmap_free(cache->map);
-	git_rwlock_free(&cache->lock);
+
+	for (i = 0; i < GIT_CACHE_SHARDS; i++) {
+		git_oidmap_free(cache->shards[i].map);
+		git_rwlock_free(&cache->shards[i].lock);
+	}
+
 	git__memzero(cache, sizeof(*cache));
 }
 
+/*
+ * Whether `candidate` is a better entry to evict than `victim`: objects
+ * nobody but the cache holds on to go first, then the least used ones,
+ * then the largest ones.
+ */
+static bool cache_prefer_evicting(git_cached_obj *candidate, git_cached_obj *victim)
+{
+	bool candidate_idle = (candidate->refcount.val == 1);
+	bool victim_idle = (victim->refcount.val == 1);
+
+	if (candidate_idle != victim_idle)
+		return candidate_idle;
+
+	if (candidate->uses.val != victim->uses.val)
+		return candidate->uses.val < victim->uses.val;
+
+	return candidate->size > victim->size;
+}
+
+/*
+ * Called with lock.  Halve the uses of every entry once the shard
+ * admitted twice as many objects as it holds, so that the ones which
+ * are no longer looked up don't stay forever.
+ */
+static void cache_age_entries(git_cache_shard *shard)
+{
+	git_cached_obj *entry;
+
+	if (++shard->admitted < max(git_oidmap_size(shard->map), 32) * 2)
+		return;
+
+	git_oidmap_foreach_value(shard->map, entry, {
+		git_atomic_set(&entry->uses, entry->uses.val / 2);
+	});
+
+	shard->admitted = 0;
+}
+
 /* Called with lock */
-static void cache_evict_entries(git_cache *cache)
+static void cache_evict_entries(git_cache_shard *shard, cache_counters *counters)
 {
 	uint32_t seed = rand();
 	size_t evict_count = 8;
 	ssize_t evicted_memory = 0;
 
-	/* do not infinite loop if there's not enough entries to evict  */
-	if (evict_count > git_cache_size(cache)) {
-		clear_cache(cache);
+	if (git_oidmap_size(shard->map) == 0)
 		return;
-	}
+
+	/* keep the better half of a small shard rather than clearing it */
+	if (evict_count > git_oidmap_size(shard->map) / 2)
+		evict_count = max(git_oidmap_size(shard->map) / 2, 1);
+
+	git_atomic_ssize_add(&counters->evictions, evict_count);
 
 	while (evict_count > 0) {
-		khiter_t pos = seed++ % git_oidmap_end(cache->map);
+		git_cached_obj *victim = NULL;
+		khiter_t victim_pos = 0;
+		size_t samples = 0;
+
+		while (samples < GIT_CACHE_EVICT_SAMPLES) {
+			khiter_t pos = seed++ % git_oidmap_end(shard->map);
+			git_cached_obj *candidate;
 
-		if (git_oidmap_has_data(cache->map, pos)) {
-			git_cached_obj *evict = git_oidmap_value_at(cache->map, pos);
+			if (!git_oidmap_has_data(shard->map, pos))
+				continue;
 
-			evict_count--;
-			evicted_memory += evict->size;
-			git_cached_obj_decref(evict);
+			candidate = git_oidmap_value_at(shard->map, pos);
+			samples++;
 
-			git_oidmap_delete_at(cache->map, pos);
+			if (!victim || cache_prefer_evicting(candidate, victim)) {
+				victim = candidate;
+				victim_pos = pos;
+			}
 		}
+
+		evict_count--;
+		evicted_memory += victim->size;
+		git_cached_obj_decref(victim);
+
+		git_oidmap_delete_at(shard->map, victim_pos);
 	}
 
-	cache->used_memory -= evicted_memory;
+	shard->used_memory -= evicted_memory;
 	git_atomic_ssize_add(&git_cache__current_storage, -evicted_memory);
 }
 
+/*
+ * Called with lock.  Whether `entry` was stored recently; if not, it is
+ * remembered for next time.  The raw and the parsed object are told
+ * apart, so that looking an object up once, which stores both, is not
+ * enough for it to be admitted.
+ */
+static bool cache_seen(git_cache_shard *shard, git_cached_obj *entry)
+{
+	const unsigned char *id = entry->oid.id;
+	uint32_t hashes[2];
+	bool seen = true;
+	size_t i;
+
+	hashes[0] = ((id[4] << 8) | id[5]) ^ entry->flags;
+	hashes[1] = ((id[6] << 8) | id[7]) ^ (entry->flags << 4);
+
+	for (i = 0; i < ARRAY_SIZE(hashes); i++) {
+		uint32_t bit = hashes[i] % GIT_CACHE_SEEN_BITS;
+		uint32_t mask = 1u << (bit % 32);
+
+		if (shard->seen[bit / 32] & mask)
+			continue;
+
+		seen = false;
+		shard->seen[bit / 32] |= mask;
+		shard->seen_count++;
+	}
+
+	if (shard->seen_count >= GIT_CACHE_SEEN_BITS / 2) {
+		memset(shard->seen, 0, sizeof(shard->seen));
+		shard->seen_count = 0;
+	}
+
+	return seen;
+}
+
 static bool cache_should_store(git_otype object_type, size_t object_size)
 {
 	size_t max_size = git_cache__max_object_size[object_type];
@@ -148,35 +307,42 @@ static bool cache_should_store(git_otype object_type, size_t object_size)
 
 static void *cache_get(git_cache *cache, const git_oid *oid, unsigned int flags)
 {
+	git_cache_shard *shard = git_cache_shard_for(cache, oid);
+	cache_counters *counters = cache_counters_for(oid);
 	khiter_t pos;
 	git_cached_obj *entry = NULL;
 
-	if (!git_cache__enabled || git_rwlock_rdlock(&cache->lock) < 0)
+	if (!git_cache__enabled || git_rwlock_rdlock(&shard->lock) < 0)
 		return NULL;
 
-	pos = git_oidmap_lookup_index(cache->map, oid);
-	if (git_oidmap_valid_index(cache->map, pos)) {
-		entry = git_oidmap_value_at(cache->map, pos);
+	pos = git_oidmap_lookup_index(shard->map, oid);
+	if (git_oidmap_valid_index(shard->map, pos)) {
+		entry = git_oidmap_value_at(shard->map, pos);
 
 		if (flags && entry->flags != flags) {
 			entry = NULL;
 		} else {
 			git_cached_obj_incref(entry);
+			git_atomic_inc(&entry->uses);
 		}
 	}
 
-	git_rwlock_rdunlock(&cache->lock);
+	git_rwlock_rdunlock(&shard->lock);
+
+	git_atomic_ssize_add(entry ? &counters->hits : &counters->misses, 1);
 
 	return entry;
 }
 
 static void *cache_store(git_cache *cache, git_cached_obj *entry)
 {
+	git_cache_shard *shard = git_cache_shard_for(cache, &entry->oid);
 	khiter_t pos;
+	bool full;
 
 	git_cached_obj_incref(entry);
 
-	if (!git_cache__enabled && cache->used_memory > 0) {
+	if (!git_cache__enabled && cache_used_memory(cache) > 0) {
 		git_cache_clear(cache);
 		return entry;
 	}
@@ -184,29 +350,35 @@ static void *cache_store(git_cache *cache, git_cached_obj *entry)
 	if (!cache_should_store(entry->type, entry->size))
 		return entry;
 
-	if (git_rwlock_wrlock(&cache->lock) < 0)
+	if (git_rwlock_wrlock(&shard->lock) < 0)
 		return entry;
 
-	/* soften the load on the cache */
-	if (git_cache__current_storage.val > git_cache__max_storage)
-		cache_evict_entries(cache);
-
-	pos = git_oidmap_lookup_index(cache->map, &entry->oid);
+	full = (git_cache__current_storage.val > git_cache__max_storage);
+	pos = git_oidmap_lookup_index(shard->map, &entry->oid);
 
 	/* not found */
-	if (!git_oidmap_valid_index(cache->map, pos)) {
+	if (!git_oidmap_valid_index(shard->map, pos)) {
 		int rval;
 
-		git_oidmap_insert(cache->map, &entry->oid, entry, &rval);
+		/* once full, only make room for objects stored before */
+		if (full && !cache_seen(shard, entry))
+			goto done;
+
+		/* soften the load on the cache */
+		if (full)
+			cache_evict_entries(shard, cache_counters_for(&entry->oid));
+
+		git_oidmap_insert(shard->map, &entry->oid, entry, &rval);
 		if (rval >= 0) {
 			git_cached_obj_incref(entry);
-			cache->used_memory += entry->size;
+			shard->used_memory += entry->size;
 			git_atomic_ssize_add(&git_cache__current_storage, (ssize_t)entry->size);
+			cache_age_entries(shard);
 		}
 	}
 	/* found */
 	else {
-		git_cached_obj *stored_entry = git_oidmap_value_at(cache->map, pos);
+		git_cached_obj *stored_entry = git_oidmap_value_at(shard->map, pos);
 
 		if (stored_entry->flags == entry->flags) {
 			git_cached_obj_decref(entry);
@@ -214,17 +386,19 @@ static void *cache_store(git_cache *cache, git_cached_obj *entry)
 			entry = stored_entry;
 		} else if (stored_entry->flags == GIT_CACHE_STORE_RAW &&
 			entry->flags == GIT_CACHE_STORE_PARSED) {
+			git_atomic_set(&entry->uses, stored_entry->uses.val);
 			git_cached_obj_decref(stored_entry);
 			git_cached_obj_incref(entry);
 
-			git_oidmap_set_key_at(cache->map, pos, &entry->oid);
-			git_oidmap_set_value_at(cache->map, pos, entry);
+			git_oidmap_set_key_at(shard->map, pos, &entry->oid);
+			git_oidmap_set_value_at(shard->map, pos, entry);
 		} else {
 			/* NO OP */
 		}
 	}
 
-	git_rwlock_wrunlock(&cache->lock);
+done:
+	git_rwlock_wrunlock(&shard->lock);
 	return entry;
 }
 
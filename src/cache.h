@@ -28,12 +28,37 @@ typedef struct {
 	uint16_t   flags; /* GIT_CACHE_STORE value */
 	size_t     size;
 	git_atomic refcount;
+	git_atomic uses;  /* times it was found in the cache, halved as it ages */
 } git_cached_obj;
 
+/*
+ * The cache is split into shards by object id, each with its own map
+ * and lock, so that threads looking up or storing different objects
+ * rarely wait on each other.  Shards evict their own entries once the
+ * objects cached by all caches take up more than
+ * `git_cache__max_storage`, picking the least used of a few entries
+ * at a time.
+ */
+#define GIT_CACHE_SHARDS 32
+
+/*
+ * Once the cache is full, an object is only admitted when it is stored
+ * for the second time in a while; the objects stored once are
+ * remembered in a small bitmap, which is reset when half full.
+ */
+#define GIT_CACHE_SEEN_BITS 1024
+
 typedef struct {
 	git_oidmap *map;
 	git_rwlock  lock;
 	ssize_t     used_memory;
+	uint32_t    seen[GIT_CACHE_SEEN_BITS / 32];
+	size_t      seen_count;
+	size_t      admitted;
+} git_cache_shard;
+
+typedef struct {
+	git_cache_shard shards[GIT_CACHE_SHARDS];
 } git_cache;
 
 extern bool git_cache__enabled;
@@ -42,6 +67,8 @@ extern git_atomic_ssize git_cache__current_storage;
 
 int git_cache_set_max_object_size(git_otype type, size_t size);
 
+void git_cache_stats(size_t *hits, size_t *misses, size_t *evictions);
+
 int git_cache_init(git_cache *cache);
 void git_cache_free(git_cache *cache);
 void git_cache_clear(git_cache *cache);
@@ -53,9 +80,24 @@ git_odb_object *git_cache_get_raw(git_cache *cache, const git_oid *oid);
 git_object *git_cache_get_parsed(git_cache *cache, const git_oid *oid);
 void *git_cache_get_any(git_cache *cache, const git_oid *oid);
 
+/*
+ * The map hashes the first bytes of the id, so shard by the last one
+ * to keep the entries of a shard spread over its buckets.
+ */
+GIT_INLINE(git_cache_shard *) git_cache_shard_for(
+	git_cache *cache, const git_oid *oid)
+{
+	return &cache->shards[oid->id[GIT_OID_RAWSZ - 1] % GIT_CACHE_SHARDS];
+}
+
 GIT_INLINE(size_t) git_cache_size(git_cache *cache)
 {
-	return (size_t)git_oidmap_size(cache->map);
+	size_t i, size = 0;
+
+	for (i = 0; i < GIT_CACHE_SHARDS; i++)
+		size += (size_t)git_oidmap_size(cache->shards[i].map);
+
+	return size;
 }
 
 GIT_INLINE(void) git_cached_obj_incref(void *_obj)
@@ -34,6 +34,9 @@
 #include "attr.h"
 #include "pool.h"
 #include "strmap.h"
+#include "fsmonitor.h"
+#include "trace.h"
+#include "profile.h"
 
 /* See docs/checkout-internals.md for more information */
 
@@ -1469,6 +1472,49 @@ static void checkout_stream_free(git_writestream *s)
 	GIT_UNUSED(s);
 }
 
+/* Open `path` to write a blob with the given mode to */
+static int blob_content_open(
+	const checkout_data *data, const char *path, mode_t entry_filemode)
+{
+	int flags = data->opts.file_open_flags;
+	mode_t file_mode = data->opts.file_mode ?
+		data->opts.file_mode : entry_filemode;
+	mode_t mode;
+	int fd;
+
+	if (flags <= 0)
+		flags = O_CREAT | O_TRUNC | O_WRONLY;
+	if (!(mode = file_mode))
+		mode = GIT_FILEMODE_BLOB;
+
+	if ((fd = p_open(path, flags, mode)) < 0)
+		giterr_set(GITERR_OS, "could not open '%s' for writing", path);
+
+	return fd;
+}
+
+/* Write the blob through the filters to `fd`, which gets closed */
+static int blob_content_stream(
+	int fd, git_filter_list *fl, git_blob *blob, const char *path)
+{
+	struct checkout_stream writer;
+	int error;
+
+	memset(&writer, 0, sizeof(struct checkout_stream));
+	writer.base.write = checkout_stream_write;
+	writer.base.close = checkout_stream_close;
+	writer.base.free = checkout_stream_free;
+	writer.path = path;
+	writer.fd = fd;
+	writer.open = 1;
+
+	error = git_filter_list_stream_blob(fl, blob, &writer.base);
+
+	assert(writer.open == 0);
+
+	return error;
+}
+
 static int blob_content_to_file(
 	checkout_data *data,
 	struct stat *st,
@@ -1477,12 +1523,7 @@ static int blob_content_to_file(
 	const char *hint_path,
 	mode_t entry_filemode)
 {
-	int flags = data->opts.file_open_flags;
-	mode_t file_mode = data->opts.file_mode ?
-		data->opts.file_mode : entry_filemode;
 	git_filter_options filter_opts = GIT_FILTER_OPTIONS_INIT;
-	struct checkout_stream writer;
-	mode_t mode;
 	git_filter_list *fl = NULL;
 	int fd;
 	int error = 0;
@@ -1493,15 +1534,8 @@ static int blob_content_to_file(
 	if ((error = mkpath2file(data, path, data->opts.dir_mode)) < 0)
 		return error;
 
-	if (flags <= 0)
-		flags = O_CREAT | O_TRUNC | O_WRONLY;
-	if (!(mode = file_mode))
-		mode = GIT_FILEMODE_BLOB;
-
-	if ((fd = p_open(path, flags, mode)) < 0) {
-		giterr_set(GITERR_OS, "could not open '%s' for writing", path);
+	if ((fd = blob_content_open(data, path, entry_filemode)) < 0)
 		return fd;
-	}
 
 	filter_opts.attr_session = &data->attr_session;
 	filter_opts.temp_buf = &data->tmp;
@@ -1514,18 +1548,7 @@ static int blob_content_to_file(
 		return error;
 	}
 
-	/* setup the writer */
-	memset(&writer, 0, sizeof(struct checkout_stream));
-	writer.base.write = checkout_stream_write;
-	writer.base.close = checkout_stream_close;
-	writer.base.free = checkout_stream_free;
-	writer.path = path;
-	writer.fd = fd;
-	writer.open = 1;
-
-	error = git_filter_list_stream_blob(fl, blob, &writer.base);
-
-	assert(writer.open == 0);
+	error = blob_content_stream(fd, fl, blob, path);
 
 	git_filter_list_free(fl);
 
@@ -1848,14 +1871,418 @@ static int checkout_deferred_remove(git_repository *repo, const char *path)
 #endif
 }
 
+/*
+ * Writing files on several threads.
+ *
+ * The main thread walks the deltas in order: it creates the leading
+ * directories and loads the filters of each file, then queues it for the
+ * workers, which read the blob, run it through the filters and write it
+ * out.  Files are retired in the order they were queued: the main thread
+ * updates the index and reports progress for them, so callbacks are
+ * never called concurrently and in the same order as when writing them
+ * one by one.  Anything which isn't a plain file with only the built-in
+ * filters, or which changes how later files are filtered, is written by
+ * the main thread once the files queued before it are retired.
+ */
+
+/* Files queued per worker before we wait for the oldest to be written */
+#define CHECKOUT_PARALLEL_WINDOW 64
+
+typedef struct {
+	const git_diff_file *file;
+	char *path;
+	git_filter_list *fl;
+	struct stat st;
+	size_t stat_calls;
+	int error;
+	git_error_state error_state;
+	bool written;
+} checkout_parallel_item;
+
+typedef struct {
+	checkout_data *data;
+	git_thread *threads;
+	size_t nthreads;
+	git_mutex lock;
+	git_cond queued_cond;
+	git_cond written_cond;
+	checkout_parallel_item *items;
+	size_t window;
+	size_t queued;
+	size_t next;
+	size_t retired;
+	bool failed;
+	bool shutdown;
+} checkout_parallel;
+
+#ifdef GIT_THREADS
+
+static void checkout_parallel_write(
+	checkout_parallel *pc, checkout_parallel_item *item)
+{
+	git_blob *blob = NULL;
+	int fd, error;
+
+	if ((error = git_blob_lookup(&blob, pc->data->repo, &item->file->id)) < 0)
+		goto done;
+
+	if ((fd = blob_content_open(pc->data, item->path, item->file->mode)) < 0) {
+		error = fd;
+		goto done;
+	}
+
+	if ((error = blob_content_stream(fd, item->fl, blob, item->path)) < 0)
+		goto done;
+
+	item->stat_calls++;
+
+	if ((error = p_stat(item->path, &item->st)) < 0) {
+		giterr_set(GITERR_OS, "failed to stat '%s'", item->path);
+		goto done;
+	}
+
+	item->st.st_mode = item->file->mode;
+
+done:
+	git_blob_free(blob);
+
+	if (error < 0)
+		item->error = giterr_state_capture(&item->error_state, error);
+}
+
+static void *checkout_parallel_worker(void *arg)
+{
+	checkout_parallel *pc = arg;
+	checkout_parallel_item *item;
+	bool failed;
+
+	git_mutex_lock(&pc->lock);
+
+	while (true) {
+		while (pc->next == pc->queued && !pc->shutdown)
+			git_cond_wait(&pc->queued_cond, &pc->lock);
+
+		if (pc->next == pc->queued)
+			break;
+
+		item = &pc->items[pc->next++ % pc->window];
+		failed = pc->failed;
+		git_mutex_unlock(&pc->lock);
+
+		/* once a file failed, the ones after it are not written */
+		if (!failed)
+			checkout_parallel_write(pc, item);
+
+		git_mutex_lock(&pc->lock);
+		item->written = true;
+
+		if (item->error < 0)
+			pc->failed = true;
+
+		git_cond_broadcast(&pc->written_cond);
+	}
+
+	git_mutex_unlock(&pc->lock);
+	return NULL;
+}
+
+static void checkout_parallel_item_clear(checkout_parallel_item *item)
+{
+	git_filter_list_free(item->fl);
+	git__free(item->path);
+	giterr_state_free(&item->error_state);
+	memset(item, 0, sizeof(*item));
+}
+
+/* Finish up a file the workers wrote, like `checkout_blob` does */
+static int checkout_parallel_item_finish(
+	checkout_data *data, checkout_parallel_item *item)
+{
+	bool written = true;
+	int error = 0;
+
+	data->perfdata.stat_calls += item->stat_calls;
+
+	if (item->error < 0) {
+		giterr_state_restore(&item->error_state);
+		error = item->error;
+
+		/* as in `checkout_write_content` */
+		if ((data->strategy & GIT_CHECKOUT_ALLOW_CONFLICTS) != 0 &&
+			(error == GIT_ENOTFOUND || error == GIT_EEXISTS)) {
+			giterr_clear();
+			written = false;
+			error = 0;
+		}
+	}
+
+	if (!error && written &&
+		(data->strategy & GIT_CHECKOUT_DONT_UPDATE_INDEX) == 0)
+		error = checkout_update_index(data, item->file, &item->st);
+
+	if (!error) {
+		data->completed_steps++;
+		report_progress(data, item->file->path);
+	}
+
+	checkout_parallel_item_clear(item);
+	return error;
+}
+
+/*
+ * Retire the files which were written, in order, waiting for them until
+ * at most `max_pending` files are left in the queue.
+ */
+static int checkout_parallel_retire(checkout_parallel *pc, size_t max_pending)
+{
+	checkout_parallel_item *item;
+	int error = 0;
+
+	git_mutex_lock(&pc->lock);
+
+	while (pc->retired < pc->queued) {
+		item = &pc->items[pc->retired % pc->window];
+
+		if (!item->written) {
+			if (pc->queued - pc->retired <= max_pending)
+				break;
+
+			git_cond_wait(&pc->written_cond, &pc->lock);
+			continue;
+		}
+
+		pc->retired++;
+		git_mutex_unlock(&pc->lock);
+
+		error = checkout_parallel_item_finish(pc->data, item);
+
+		git_mutex_lock(&pc->lock);
+
+		if (error < 0) {
+			pc->failed = true;
+			break;
+		}
+	}
+
+	git_mutex_unlock(&pc->lock);
+	return error;
+}
+
+static int checkout_parallel_queue(
+	checkout_parallel *pc,
+	const git_diff_file *file,
+	const char *path,
+	git_filter_list *fl)
+{
+	checkout_parallel_item *item;
+	int error;
+
+	if ((error = checkout_parallel_retire(pc, pc->window - 1)) < 0) {
+		git_filter_list_free(fl);
+		return error;
+	}
+
+	item = &pc->items[pc->queued % pc->window];
+	item->file = file;
+	item->fl = fl;
+
+	if ((item->path = git__strdup(path)) == NULL) {
+		checkout_parallel_item_clear(item);
+		return -1;
+	}
+
+	git_mutex_lock(&pc->lock);
+	pc->queued++;
+	git_cond_signal(&pc->queued_cond);
+	git_mutex_unlock(&pc->lock);
+
+	return 0;
+}
+
+static bool checkout_parallel_can_filter(git_filter_list *fl)
+{
+	size_t builtin;
+
+	if (!fl)
+		return true;
+
+	builtin = git_filter_list_contains(fl, GIT_FILTER_CRLF) +
+		git_filter_list_contains(fl, GIT_FILTER_IDENT);
+
+	return (git_filter_list_length(fl) == builtin);
+}
+
+static bool checkout_is_gitattributes(const char *path)
+{
+	const char *filename = strrchr(path, '/');
+
+	filename = filename ? filename + 1 : path;
+	return (strcmp(filename, GIT_ATTR_FILE) == 0);
+}
+
+static int checkout_parallel_blob(
+	checkout_parallel *pc,
+	const git_diff_file *file)
+{
+	checkout_data *data = pc->data;
+	git_filter_options filter_opts = GIT_FILTER_OPTIONS_INIT;
+	git_filter_list *fl = NULL;
+	git_buf *fullpath;
+	int error;
+
+	if (!S_ISREG(file->mode) || checkout_is_gitattributes(file->path) ||
+		strcmp(file->path, ".gitmodules") == 0)
+		goto write_here;
+
+	if (checkout_target_fullpath(&fullpath, data, file->path) < 0)
+		return -1;
+
+	/* errors are reported when we write the file ourselves */
+	if (mkpath2file(data, fullpath->ptr, data->opts.dir_mode) < 0) {
+		giterr_clear();
+		goto write_here;
+	}
+
+	if (!data->opts.disable_filters) {
+		/* unlike `blob_content_to_file`, leave the temporary buffer
+		 * unset: the workers can't share one
+		 */
+		filter_opts.attr_session = &data->attr_session;
+
+		/* the workers read the blob, only its id is needed here */
+		if (git_filter_list__load_for_id(&fl, data->repo, &file->id,
+				fullpath->ptr, GIT_FILTER_TO_WORKTREE, &filter_opts) < 0) {
+			giterr_clear();
+			goto write_here;
+		}
+
+		if (!checkout_parallel_can_filter(fl)) {
+			git_filter_list_free(fl);
+			goto write_here;
+		}
+	}
+
+	return checkout_parallel_queue(pc, file, fullpath->ptr, fl);
+
+write_here:
+	if ((error = checkout_parallel_retire(pc, 0)) < 0 ||
+		(error = checkout_blob(data, file)) < 0)
+		return error;
+
+	data->completed_steps++;
+	report_progress(data, file->path);
+	return 0;
+}
+
+static int checkout_parallel_init(checkout_parallel *pc, checkout_data *data)
+{
+	size_t i;
+
+	memset(pc, 0, sizeof(*pc));
+
+	if (data->opts.threads < 2 ||
+		(data->strategy & GIT_CHECKOUT_UPDATE_ONLY) != 0 ||
+		should_remove_existing(data))
+		return 0;
+
+	pc->data = data;
+	pc->window = data->opts.threads * CHECKOUT_PARALLEL_WINDOW;
+
+	pc->items = git__calloc(pc->window, sizeof(checkout_parallel_item));
+	pc->threads = git__mallocarray(data->opts.threads, sizeof(git_thread));
+
+	if (!pc->items || !pc->threads) {
+		git__free(pc->items);
+		git__free(pc->threads);
+		pc->threads = NULL;
+		giterr_set_oom();
+		return -1;
+	}
+
+	git_mutex_init(&pc->lock);
+	git_cond_init(&pc->queued_cond);
+	git_cond_init(&pc->written_cond);
+
+	for (i = 0; i < data->opts.threads; i++) {
+		if (git_thread_create(&pc->threads[i], checkout_parallel_worker, pc)) {
+			giterr_set(GITERR_THREAD, "unable to create thread");
+			return -1;
+		}
+
+		pc->nthreads++;
+	}
+
+	return 0;
+}
+
+static void checkout_parallel_free(checkout_parallel *pc)
+{
+	size_t i;
+
+	if (!pc->threads)
+		return;
+
+	git_mutex_lock(&pc->lock);
+	pc->shutdown = true;
+	git_cond_broadcast(&pc->queued_cond);
+	git_mutex_unlock(&pc->lock);
+
+	for (i = 0; i < pc->nthreads; i++)
+		git_thread_join(&pc->threads[i], NULL);
+
+	/* files we didn't get to after an error */
+	for (; pc->retired < pc->queued; pc->retired++)
+		checkout_parallel_item_clear(&pc->items[pc->retired % pc->window]);
+
+	git_cond_free(&pc->written_cond);
+	git_cond_free(&pc->queued_cond);
+	git_mutex_free(&pc->lock);
+	git__free(pc->threads);
+	git__free(pc->items);
+}
+
+#else
+
+static int checkout_parallel_blob(
+	checkout_parallel *pc, const git_diff_file *file)
+{
+	GIT_UNUSED(pc); GIT_UNUSED(file);
+	assert(false);
+	return -1;
+}
+
+static int checkout_parallel_retire(checkout_parallel *pc, size_t max_pending)
+{
+	GIT_UNUSED(pc); GIT_UNUSED(max_pending);
+	return 0;
+}
+
+static int checkout_parallel_init(checkout_parallel *pc, checkout_data *data)
+{
+	GIT_UNUSED(data);
+	memset(pc, 0, sizeof(*pc));
+	return 0;
+}
+
+static void checkout_parallel_free(checkout_parallel *pc)
+{
+	GIT_UNUSED(pc);
+}
+
+#endif
+
 static int checkout_create_the_new(
 	unsigned int *actions,
 	checkout_data *data)
 {
+	checkout_parallel pc;
 	int error = 0;
 	git_diff_delta *delta;
 	size_t i;
 
+	if ((error = checkout_parallel_init(&pc, data)) < 0)
+		goto done;
+
 	git_vector_foreach(&data->diff->deltas, i, delta) {
 		if (actions[i] & CHECKOUT_ACTION__DEFER_REMOVE) {
 			/* this had a blocker directory that should only be removed iff
@@ -1863,20 +2290,32 @@ static int checkout_create_the_new(
 			 */
 			if ((error = checkout_deferred_remove(
 					data->repo, delta->old_file.path)) < 0)
-				return error;
+				goto done;
 		}
 
 		if (actions[i] & CHECKOUT_ACTION__UPDATE_BLOB) {
+			if (pc.nthreads) {
+				if ((error = checkout_parallel_blob(&pc, &delta->new_file)) < 0)
+					goto done;
+
+				continue;
+			}
+
 			error = checkout_blob(data, &delta->new_file);
 			if (error < 0)
-				return error;
+				goto done;
 
 			data->completed_steps++;
 			report_progress(data, delta->new_file.path);
 		}
 	}
 
-	return 0;
+	if (pc.nthreads)
+		error = checkout_parallel_retire(&pc, 0);
+
+done:
+	checkout_parallel_free(&pc);
+	return error;
 }
 
 static int checkout_create_submodules(
@@ -2509,12 +2948,16 @@ int git_checkout_iterator(
 	git_diff_options diff_opts = GIT_DIFF_OPTIONS_INIT;
 	uint32_t *actions = NULL;
 	size_t *counts = NULL;
+	double phase;
+	git_profile_frame region, write_region;
 
 	/* initialize structures and options */
 	error = checkout_data_init(&data, target, opts);
 	if (error < 0)
 		return error;
 
+	git_profile_enter(&region, "checkout");
+
 	diff_opts.flags =
 		GIT_DIFF_INCLUDE_UNMODIFIED |
 		GIT_DIFF_INCLUDE_UNREADABLE |
@@ -2538,6 +2981,16 @@ int git_checkout_iterator(
 	workdir_opts.start = data.pfx;
 	workdir_opts.end = data.pfx;
 
+	/* let the filesystem monitor spare us looking at unchanged files */
+	if (index && !data.opts.target_directory) {
+		if ((error = git_fsmonitor__refresh(index, data.repo)) < 0)
+			goto cleanup;
+		else if (error > 0)
+			workdir_opts.flags |= GIT_ITERATOR_USE_FSMONITOR;
+
+		error = 0;
+	}
+
 	if ((error = git_iterator_reset_range(target, data.pfx, data.pfx)) < 0 ||
 		(error = git_iterator_for_workdir_ext(
 			&workdir, data.repo, data.opts.target_directory, index, NULL,
@@ -2570,10 +3023,17 @@ int git_checkout_iterator(
 	/* Generate baseline-to-target diff which will include an entry for
 	 * every possible update that might need to be made.
 	 */
+	phase = git_trace_start(GIT_TRACE_DEBUG);
+
 	if ((error = git_diff__from_iterators(
 			&data.diff, data.repo, baseline, target, &diff_opts)) < 0)
 		goto cleanup;
 
+	git_trace_timed(GIT_TRACE_DEBUG, phase,
+		"checkout: diffed baseline to target: %"PRIuZ" deltas",
+		git_diff_num_deltas(data.diff));
+	phase = git_trace_start(GIT_TRACE_DEBUG);
+
 	/* Loop through diff (and working directory iterator) building a list of
 	 * actions to be taken, plus look for conflicts and send notifications,
 	 * then loop through conflicts.
@@ -2587,11 +3047,19 @@ int git_checkout_iterator(
 		counts[CHECKOUT_ACTION__UPDATE_SUBMODULE] +
 		counts[CHECKOUT_ACTION__UPDATE_CONFLICT];
 
+	git_trace_timed(GIT_TRACE_DEBUG, phase,
+		"checkout: planned %"PRIuZ" removals, %"PRIuZ" updates, %"PRIuZ" conflicts",
+		counts[CHECKOUT_ACTION__REMOVE] + counts[CHECKOUT_ACTION__REMOVE_CONFLICT],
+		counts[CHECKOUT_ACTION__UPDATE_BLOB] + counts[CHECKOUT_ACTION__UPDATE_SUBMODULE],
+		counts[CHECKOUT_ACTION__UPDATE_CONFLICT]);
+
 	report_progress(&data, NULL); /* establish 0 baseline */
 
 	/* To deal with some order dependencies, perform remaining checkout
 	 * in three passes: removes, then update blobs, then update submodules.
 	 */
+	phase = git_trace_start(GIT_TRACE_DEBUG);
+
 	if (counts[CHECKOUT_ACTION__REMOVE] > 0 &&
 		(error = checkout_remove_the_old(actions, &data)) < 0)
 		goto cleanup;
@@ -2600,10 +3068,23 @@ int git_checkout_iterator(
 		(error = checkout_remove_conflicts(&data)) < 0)
 		goto cleanup;
 
-	if (counts[CHECKOUT_ACTION__UPDATE_BLOB] > 0 &&
-		(error = checkout_create_the_new(actions, &data)) < 0)
+	git_trace_timed(GIT_TRACE_DEBUG, phase, "checkout: removed %"PRIuZ" files",
+		counts[CHECKOUT_ACTION__REMOVE] + counts[CHECKOUT_ACTION__REMOVE_CONFLICT]);
+	phase = git_trace_start(GIT_TRACE_DEBUG);
+	git_profile_enter(&write_region, "checkout.write");
+
+	error = counts[CHECKOUT_ACTION__UPDATE_BLOB] > 0 ?
+		checkout_create_the_new(actions, &data) : 0;
+
+	git_profile_leave(&write_region, counts[CHECKOUT_ACTION__UPDATE_BLOB]);
+
+	if (error < 0)
 		goto cleanup;
 
+	git_trace_timed(GIT_TRACE_DEBUG, phase, "checkout: wrote %"PRIuZ" files",
+		counts[CHECKOUT_ACTION__UPDATE_BLOB]);
+	phase = git_trace_start(GIT_TRACE_DEBUG);
+
 	if (counts[CHECKOUT_ACTION__UPDATE_SUBMODULE] > 0 &&
 		(error = checkout_create_submodules(actions, &data)) < 0)
 		goto cleanup;
@@ -2612,10 +3093,20 @@ int git_checkout_iterator(
 		(error = checkout_create_conflicts(&data)) < 0)
 		goto cleanup;
 
+	git_trace_timed(GIT_TRACE_DEBUG, phase,
+		"checkout: updated %"PRIuZ" submodules and %"PRIuZ" conflicts",
+		counts[CHECKOUT_ACTION__UPDATE_SUBMODULE],
+		counts[CHECKOUT_ACTION__UPDATE_CONFLICT]);
+	phase = git_trace_start(GIT_TRACE_DEBUG);
+
 	if (data.index != git_iterator_index(target) &&
 		(error = checkout_extensions_update_index(&data)) < 0)
 		goto cleanup;
 
+	git_trace_timed(GIT_TRACE_DEBUG, phase,
+		"checkout: updated the index: %"PRIuZ" entries",
+		data.index ? git_index_entrycount(data.index) : 0);
+
 	assert(data.completed_steps == data.total_steps);
 
 	if (data.opts.perfdata_cb)
@@ -2626,6 +3117,8 @@ cleanup:
 		(data.strategy & CHECKOUT_INDEX_DONT_WRITE_MASK) == 0)
 		error = git_index_write(data.index);
 
+	git_profile_leave(&region, data.total_steps);
+
 	git_diff_free(data.diff);
 	git_iterator_free(workdir);
 	git_iterator_free(baseline);
@@ -24,6 +24,7 @@
 #include "path.h"
 #include "repository.h"
 #include "odb.h"
+#include "profile.h"
 
 static int clone_local_into(git_repository *repo, git_remote *remote, const git_fetch_options *fetch_opts, const git_checkout_options *co_opts, const char *branch, int link);
 
@@ -394,6 +395,7 @@ int git_clone(
 	git_clone_options options = GIT_CLONE_OPTIONS_INIT;
 	uint32_t rmdir_flags = GIT_RMDIR_REMOVE_FILES;
 	git_repository_create_cb repository_cb;
+	git_profile_frame region;
 
 	assert(out && url && local_path);
 
@@ -421,6 +423,8 @@ int git_clone(
 	if ((error = repository_cb(&repo, local_path, options.bare, options.repository_cb_payload)) < 0)
 		return error;
 
+	git_profile_enter(&region, "clone");
+
 	if (!(error = create_and_configure_origin(&origin, repo, url, &options))) {
 		int clone_local = git_clone__should_clone_local(url, options.local);
 		int link = options.local != GIT_CLONE_LOCAL_NO_LINKS;
@@ -451,6 +455,8 @@ int git_clone(
 		giterr_state_restore(&last_error);
 	}
 
+	git_profile_leave(&region, 0);
+
 	*out = repo;
 	return error;
 }
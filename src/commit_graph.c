@@ -0,0 +1,871 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "commit_graph.h"
+
+#include "git2/commit.h"
+#include "git2/commit_graph.h"
+#include "git2/refs.h"
+
+#include "array.h"
+#include "commit_list.h"
+#include "filebuf.h"
+#include "odb.h"
+#include "oidmap.h"
+#include "repository.h"
+#include "sha1_lookup.h"
+#include "vector.h"
+
+#define GIT_COMMIT_GRAPH_SIGNATURE 0x43475048 /* "CGPH" */
+#define GIT_COMMIT_GRAPH_VERSION 1
+#define GIT_COMMIT_GRAPH_OBJECT_ID_VERSION 1
+
+#define COMMIT_GRAPH_OID_FANOUT_ID 0x4f494446 /* "OIDF" */
+#define COMMIT_GRAPH_OID_LOOKUP_ID 0x4f49444c /* "OIDL" */
+#define COMMIT_GRAPH_COMMIT_DATA_ID 0x43444154 /* "CDAT" */
+#define COMMIT_GRAPH_EXTRA_EDGE_LIST_ID 0x45444745 /* "EDGE" */
+
+#define COMMIT_GRAPH_COMMIT_DATA_SIZE (GIT_OID_RAWSZ + 4 * sizeof(uint32_t))
+#define COMMIT_GRAPH_CHUNK_ENTRY_SIZE (sizeof(uint32_t) + sizeof(uint64_t))
+
+#define COMMIT_GRAPH_OCTOPUS_EDGES 0x80000000
+#define COMMIT_GRAPH_LAST_EDGE 0x80000000
+#define COMMIT_GRAPH_GENERATION_MAX 0x3FFFFFFF
+#define COMMIT_GRAPH_TIME_MASK 0x3FFFFFFFFULL
+
+struct git_commit_graph_header {
+	uint32_t signature;
+	uint8_t version;
+	uint8_t object_id_version;
+	uint8_t chunks;
+	uint8_t base_graph_files;
+};
+
+struct git_commit_graph_chunk {
+	git_off_t offset;
+	size_t length;
+};
+
+static int commit_graph_error(const char *message)
+{
+	giterr_set(GITERR_ODB, "invalid commit-graph file - %s", message);
+	return -1;
+}
+
+static int commit_graph_parse_oid_fanout(
+		git_commit_graph_file *file,
+		const unsigned char *data,
+		struct git_commit_graph_chunk *chunk_oid_fanout)
+{
+	uint32_t i, nr;
+
+	if (chunk_oid_fanout->offset == 0)
+		return commit_graph_error("missing OID Fanout chunk");
+	if (chunk_oid_fanout->length == 0)
+		return commit_graph_error("empty OID Fanout chunk");
+	if (chunk_oid_fanout->length != 256 * 4)
+		return commit_graph_error("OID Fanout chunk has wrong length");
+
+	file->oid_fanout = (const uint32_t *)(data + chunk_oid_fanout->offset);
+	nr = 0;
+	for (i = 0; i < 256; ++i) {
+		uint32_t n = ntohl(file->oid_fanout[i]);
+		if (n < nr)
+			return commit_graph_error("index is non-monotonic");
+		nr = n;
+	}
+	file->num_commits = nr;
+	return 0;
+}
+
+static int commit_graph_parse_oid_lookup(
+		git_commit_graph_file *file,
+		const unsigned char *data,
+		struct git_commit_graph_chunk *chunk_oid_lookup)
+{
+	if (chunk_oid_lookup->offset == 0)
+		return commit_graph_error("missing OID Lookup chunk");
+	if (chunk_oid_lookup->length == 0)
+		return commit_graph_error("empty OID Lookup chunk");
+	if (chunk_oid_lookup->length != file->num_commits * GIT_OID_RAWSZ)
+		return commit_graph_error("OID Lookup chunk has wrong length");
+
+	file->oid_lookup = (const git_oid *)(data + chunk_oid_lookup->offset);
+	return 0;
+}
+
+static int commit_graph_parse_commit_data(
+		git_commit_graph_file *file,
+		const unsigned char *data,
+		struct git_commit_graph_chunk *chunk_commit_data)
+{
+	if (chunk_commit_data->offset == 0)
+		return commit_graph_error("missing Commit Data chunk");
+	if (chunk_commit_data->length == 0)
+		return commit_graph_error("empty Commit Data chunk");
+	if (chunk_commit_data->length != file->num_commits * COMMIT_GRAPH_COMMIT_DATA_SIZE)
+		return commit_graph_error("Commit Data chunk has wrong length");
+
+	file->commit_data = data + chunk_commit_data->offset;
+	return 0;
+}
+
+static int commit_graph_parse_extra_edge_list(
+		git_commit_graph_file *file,
+		const unsigned char *data,
+		struct git_commit_graph_chunk *chunk_extra_edge_list)
+{
+	if (chunk_extra_edge_list->length == 0)
+		return 0;
+	if (chunk_extra_edge_list->length % 4 != 0)
+		return commit_graph_error("malformed Extra Edge List chunk");
+
+	file->extra_edge_list = (const uint32_t *)(data + chunk_extra_edge_list->offset);
+	file->num_extra_edge_list = chunk_extra_edge_list->length / 4;
+	return 0;
+}
+
+int git_commit_graph_parse(
+		git_commit_graph_file *file,
+		const unsigned char *data,
+		size_t size)
+{
+	struct git_commit_graph_header *hdr;
+	const unsigned char *chunk_hdr;
+	struct git_commit_graph_chunk *last_chunk;
+	uint32_t i;
+	git_off_t last_chunk_offset, chunk_offset, trailer_offset;
+	struct git_commit_graph_chunk chunk_oid_fanout = {0}, chunk_oid_lookup = {0},
+				      chunk_commit_data = {0}, chunk_extra_edge_list = {0},
+				      chunk_unsupported = {0};
+	int error;
+
+	assert(file);
+
+	if (size < sizeof(struct git_commit_graph_header) + GIT_OID_RAWSZ)
+		return commit_graph_error("commit-graph is too short");
+
+	hdr = ((struct git_commit_graph_header *)data);
+
+	if (hdr->signature != htonl(GIT_COMMIT_GRAPH_SIGNATURE) ||
+	    hdr->version != GIT_COMMIT_GRAPH_VERSION ||
+	    hdr->object_id_version != GIT_COMMIT_GRAPH_OBJECT_ID_VERSION)
+		return commit_graph_error("unsupported commit-graph version");
+	if (hdr->chunks == 0)
+		return commit_graph_error("no chunks in commit-graph");
+	if (hdr->base_graph_files != 0)
+		return commit_graph_error("split commit-graphs are not supported");
+
+	/*
+	 * The very first chunk's offset should be after the header, all the chunk
+	 * headers, and a special zero chunk.
+	 */
+	last_chunk_offset = sizeof(struct git_commit_graph_header) +
+		(1 + hdr->chunks) * COMMIT_GRAPH_CHUNK_ENTRY_SIZE;
+	trailer_offset = size - GIT_OID_RAWSZ;
+	if (trailer_offset < last_chunk_offset)
+		return commit_graph_error("wrong commit-graph size");
+	git_oid_cpy(&file->checksum, (git_oid *)(data + trailer_offset));
+
+	chunk_hdr = data + sizeof(struct git_commit_graph_header);
+	last_chunk = NULL;
+	for (i = 0; i < hdr->chunks; ++i, chunk_hdr += COMMIT_GRAPH_CHUNK_ENTRY_SIZE) {
+		chunk_offset = ((git_off_t)ntohl(*((uint32_t *)(chunk_hdr + 4)))) << 32 |
+			((git_off_t)ntohl(*((uint32_t *)(chunk_hdr + 8))));
+		if (chunk_offset < last_chunk_offset)
+			return commit_graph_error("chunks are non-monotonic");
+		if (chunk_offset >= trailer_offset)
+			return commit_graph_error("chunks extend beyond the trailer");
+		if (last_chunk != NULL)
+			last_chunk->length = (size_t)(chunk_offset - last_chunk_offset);
+		last_chunk_offset = chunk_offset;
+
+		switch (ntohl(*((uint32_t *)(chunk_hdr + 0)))) {
+		case COMMIT_GRAPH_OID_FANOUT_ID:
+			chunk_oid_fanout.offset = last_chunk_offset;
+			last_chunk = &chunk_oid_fanout;
+			break;
+
+		case COMMIT_GRAPH_OID_LOOKUP_ID:
+			chunk_oid_lookup.offset = last_chunk_offset;
+			last_chunk = &chunk_oid_lookup;
+			break;
+
+		case COMMIT_GRAPH_COMMIT_DATA_ID:
+			chunk_commit_data.offset = last_chunk_offset;
+			last_chunk = &chunk_commit_data;
+			break;
+
+		case COMMIT_GRAPH_EXTRA_EDGE_LIST_ID:
+			chunk_extra_edge_list.offset = last_chunk_offset;
+			last_chunk = &chunk_extra_edge_list;
+			break;
+
+		default:
+			chunk_unsupported.offset = last_chunk_offset;
+			last_chunk = &chunk_unsupported;
+		}
+	}
+	last_chunk->length = (size_t)(trailer_offset - last_chunk_offset);
+
+	if ((error = commit_graph_parse_oid_fanout(file, data, &chunk_oid_fanout)) < 0 ||
+	    (error = commit_graph_parse_oid_lookup(file, data, &chunk_oid_lookup)) < 0 ||
+	    (error = commit_graph_parse_commit_data(file, data, &chunk_commit_data)) < 0 ||
+	    (error = commit_graph_parse_extra_edge_list(file, data, &chunk_extra_edge_list)) < 0)
+		return error;
+
+	return 0;
+}
+
+int git_commit_graph_open(git_commit_graph_file **file_out, const char *path)
+{
+	git_commit_graph_file *file;
+	git_file fd = -1;
+	size_t cgraph_size;
+	struct stat st;
+	int error;
+
+	fd = git_futils_open_ro(path);
+	if (fd < 0)
+		return fd;
+
+	if (p_fstat(fd, &st) < 0) {
+		p_close(fd);
+		giterr_set(GITERR_ODB, "commit-graph file not found - '%s'", path);
+		return GIT_ENOTFOUND;
+	}
+
+	if (!S_ISREG(st.st_mode) || !git__is_sizet(st.st_size)) {
+		p_close(fd);
+		giterr_set(GITERR_ODB, "invalid commit-graph file '%s'", path);
+		return GIT_ENOTFOUND;
+	}
+	cgraph_size = (size_t)st.st_size;
+
+	file = git__calloc(1, sizeof(git_commit_graph_file));
+	GITERR_CHECK_ALLOC(file);
+
+	git_atomic_set(&file->refcount, 1);
+	git_futils_filestamp_set_from_stat(&file->stamp, &st);
+
+	error = git_futils_mmap_ro(&file->graph_map, fd, 0, cgraph_size);
+	p_close(fd);
+	if (error < 0) {
+		git__free(file);
+		return error;
+	}
+
+	if ((error = git_commit_graph_parse(file, file->graph_map.data, cgraph_size)) < 0) {
+		git_commit_graph_free(file);
+		return error;
+	}
+
+	*file_out = file;
+	return 0;
+}
+
+int git_commit_graph_needs_refresh(
+		const git_commit_graph_file *file,
+		const char *path)
+{
+	git_futils_filestamp stamp;
+
+	git_futils_filestamp_set(&stamp, &file->stamp);
+	return git_futils_filestamp_check(&stamp, path) != 0;
+}
+
+static int git_commit_graph_entry_get_byindex(
+		git_commit_graph_entry *e,
+		const git_commit_graph_file *file,
+		size_t pos)
+{
+	const unsigned char *commit_data;
+
+	assert(e && file);
+
+	if (pos >= file->num_commits) {
+		giterr_set(GITERR_INVALID, "commit index %"PRIuZ" does not exist", pos);
+		return GIT_ENOTFOUND;
+	}
+
+	commit_data = file->commit_data + pos * COMMIT_GRAPH_COMMIT_DATA_SIZE;
+	git_oid_cpy(&e->tree_oid, (const git_oid *)commit_data);
+	e->parent_indices[0] = ntohl(*((uint32_t *)(commit_data + GIT_OID_RAWSZ)));
+	e->parent_indices[1] = ntohl(
+			*((uint32_t *)(commit_data + GIT_OID_RAWSZ + sizeof(uint32_t))));
+	e->parent_count = (e->parent_indices[0] != GIT_COMMIT_GRAPH_MISSING_PARENT)
+			+ (e->parent_indices[1] != GIT_COMMIT_GRAPH_MISSING_PARENT);
+	e->generation = ntohl(*((uint32_t *)(commit_data + GIT_OID_RAWSZ + 2 * sizeof(uint32_t))));
+	e->commit_time = ntohl(*((uint32_t *)(commit_data + GIT_OID_RAWSZ + 3 * sizeof(uint32_t))));
+
+	e->commit_time |= ((git_time_t)e->generation & 0x3) << 32;
+	e->generation >>= 2;
+
+	if (e->parent_indices[1] & COMMIT_GRAPH_OCTOPUS_EDGES) {
+		size_t extra_edge_list_pos = e->parent_indices[1] & ~COMMIT_GRAPH_OCTOPUS_EDGES;
+		e->extra_parents_index = extra_edge_list_pos;
+		e->parent_count = 1;
+
+		while (extra_edge_list_pos < file->num_extra_edge_list) {
+			e->parent_count++;
+
+			if (ntohl(file->extra_edge_list[extra_edge_list_pos]) & COMMIT_GRAPH_LAST_EDGE)
+				break;
+
+			extra_edge_list_pos++;
+		}
+
+		if (extra_edge_list_pos >= file->num_extra_edge_list)
+			return commit_graph_error("extra edge list is truncated");
+	}
+
+	if ((e->parent_count > 0 && e->parent_indices[0] >= file->num_commits) ||
+	    (e->parent_count == 2 && e->parent_indices[1] >= file->num_commits))
+		return commit_graph_error("parent index is out of bounds");
+
+	git_oid_cpy(&e->sha1, &file->oid_lookup[pos]);
+	return 0;
+}
+
+int git_commit_graph_entry_find(
+		git_commit_graph_entry *e,
+		const git_commit_graph_file *file,
+		const git_oid *short_oid,
+		size_t len)
+{
+	int pos, found = 0;
+	uint32_t hi, lo;
+	const git_oid *current = NULL;
+
+	assert(e && file && short_oid);
+
+	hi = ntohl(file->oid_fanout[(int)short_oid->id[0]]);
+	lo = ((short_oid->id[0] == 0x0) ? 0 : ntohl(file->oid_fanout[(int)short_oid->id[0] - 1]));
+
+	pos = sha1_position(file->oid_lookup, GIT_OID_RAWSZ, lo, hi, short_oid->id);
+
+	if (pos >= 0) {
+		/* An object matching exactly the oid was found */
+		found = 1;
+		current = file->oid_lookup + pos;
+	} else {
+		/* No object was found */
+		/* pos refers to the object with the "closest" oid to short_oid */
+		pos = -1 - pos;
+		if (pos < (int)file->num_commits) {
+			current = file->oid_lookup + pos;
+
+			if (!git_oid_ncmp(short_oid, current, len))
+				found = 1;
+		}
+	}
+
+	if (found && len != GIT_OID_HEXSZ && pos + 1 < (int)file->num_commits) {
+		/* Check for ambiguousity */
+		const git_oid *next = current + 1;
+
+		if (!git_oid_ncmp(short_oid, next, len)) {
+			found = 2;
+		}
+	}
+
+	if (!found)
+		return git_odb__error_notfound(
+				"failed to find offset for commit-graph index entry", short_oid, len);
+	if (found > 1)
+		return git_odb__error_ambiguous(
+				"found multiple offsets for commit-graph index entry");
+
+	return git_commit_graph_entry_get_byindex(e, file, pos);
+}
+
+int git_commit_graph_entry_parent(
+		git_commit_graph_entry *parent,
+		const git_commit_graph_file *file,
+		const git_commit_graph_entry *entry,
+		size_t n)
+{
+	assert(parent && file);
+
+	if (n >= entry->parent_count) {
+		giterr_set(GITERR_INVALID, "parent index %"PRIuZ" does not exist", n);
+		return GIT_ENOTFOUND;
+	}
+
+	if (n == 0 || (n == 1 && entry->parent_count == 2))
+		return git_commit_graph_entry_get_byindex(parent, file, entry->parent_indices[n]);
+
+	return git_commit_graph_entry_get_byindex(
+			parent,
+			file,
+			ntohl(file->extra_edge_list[entry->extra_parents_index + n - 1])
+					& ~COMMIT_GRAPH_LAST_EDGE);
+}
+
+void git_commit_graph_incref(git_commit_graph_file *file)
+{
+	git_atomic_inc(&file->refcount);
+}
+
+void git_commit_graph_free(git_commit_graph_file *file)
+{
+	if (!file || git_atomic_dec(&file->refcount) > 0)
+		return;
+
+	if (file->graph_map.data)
+		git_futils_mmap_free(&file->graph_map);
+	git__free(file);
+}
+
+/*
+ * Writing
+ */
+
+struct packed_commit {
+	size_t index;
+	git_oid sha1;
+	git_oid tree_oid;
+	uint64_t commit_time;
+	uint32_t generation;
+	git_array_t(git_oid) parents;
+	git_array_t(size_t) parent_indices;
+};
+
+typedef git_array_t(git_oid) oid_stack;
+
+static void packed_commit_free(struct packed_commit *p)
+{
+	if (!p)
+		return;
+
+	git_array_clear(p->parents);
+	git_array_clear(p->parent_indices);
+	git__free(p);
+}
+
+static int packed_commit_cmp(const void *a_, const void *b_)
+{
+	const struct packed_commit *a = a_;
+	const struct packed_commit *b = b_;
+	return git_oid_cmp(&a->sha1, &b->sha1);
+}
+
+static int push_tip(oid_stack *pending, git_reference *ref)
+{
+	git_object *commit;
+	git_oid *id;
+	int error;
+
+	if ((error = git_reference_peel(&commit, ref, GIT_OBJ_COMMIT)) < 0) {
+		/* tags pointing at trees or blobs and unborn branches */
+		if (error == GIT_ENOTFOUND || error == GIT_EPEEL ||
+		    error == GIT_EINVALIDSPEC) {
+			giterr_clear();
+			return 0;
+		}
+		return error;
+	}
+
+	id = git_array_alloc(*pending);
+	if (id)
+		git_oid_cpy(id, git_object_id(commit));
+	git_object_free(commit);
+
+	GITERR_CHECK_ALLOC(id);
+	return 0;
+}
+
+static int collect_tips(oid_stack *pending, git_repository *repo)
+{
+	git_reference_iterator *iter = NULL;
+	git_reference *ref = NULL;
+	int error;
+
+	if ((error = git_reference_lookup(&ref, repo, GIT_HEAD_FILE)) == 0)
+		error = push_tip(pending, ref);
+	else if (error == GIT_ENOTFOUND) {
+		giterr_clear();
+		error = 0;
+	}
+	git_reference_free(ref);
+
+	if (error < 0 || (error = git_reference_iterator_new(&iter, repo)) < 0)
+		return error;
+
+	while ((error = git_reference_next(&ref, iter)) == 0) {
+		error = push_tip(pending, ref);
+		git_reference_free(ref);
+
+		if (error < 0)
+			break;
+	}
+
+	if (error == GIT_ITEROVER)
+		error = 0;
+
+	git_reference_iterator_free(iter);
+	return error;
+}
+
+/*
+ * The commit time as git reads it into the commit-graph, which is not
+ * always what the signature parser makes of the committer.
+ */
+static uint64_t commit_graph_time(const git_commit *commit)
+{
+	const char *line = git_commit_raw_header(commit), *eol;
+	int64_t time;
+
+	while (git__prefixcmp(line, "committer ") != 0) {
+		if ((line = strchr(line, '\n')) == NULL)
+			return 0;
+		line++;
+	}
+
+	if ((eol = strchr(line, '\n')) == NULL)
+		eol = line + strlen(line);
+
+	time = git_commit_list_committer_time(line, eol);
+	return time < 0 ? 0 : (uint64_t)time;
+}
+
+/*
+ * Load every commit reachable from the tips in `pending` into `commits`,
+ * along with the information the commit-graph needs.
+ */
+static int collect_commits(
+		git_vector *commits,
+		git_oidmap *commit_map,
+		git_repository *repo,
+		oid_stack *pending)
+{
+	git_commit *commit = NULL;
+	struct packed_commit *packed;
+	git_oid *id, current;
+	size_t i;
+	int error = 0;
+
+	while ((id = git_array_pop(*pending)) != NULL) {
+		git_oid_cpy(&current, id);
+
+		if (git_oidmap_exists(commit_map, &current))
+			continue;
+
+		if ((error = git_commit_lookup(&commit, repo, &current)) < 0)
+			break;
+
+		packed = git__calloc(1, sizeof(struct packed_commit));
+		GITERR_CHECK_ALLOC(packed);
+
+		git_oid_cpy(&packed->sha1, &current);
+		git_oid_cpy(&packed->tree_oid, git_commit_tree_id(commit));
+		packed->commit_time = commit_graph_time(commit);
+
+		for (i = 0; i < git_commit_parentcount(commit); i++) {
+			const git_oid *parent_id = git_commit_parent_id(commit, i);
+			git_oid *parent = git_array_alloc(packed->parents);
+
+			if (!parent || (!git_oidmap_exists(commit_map, parent_id) &&
+					(id = git_array_alloc(*pending)) == NULL)) {
+				packed_commit_free(packed);
+				git_commit_free(commit);
+				giterr_set_oom();
+				return -1;
+			}
+
+			git_oid_cpy(parent, parent_id);
+			if (!git_oidmap_exists(commit_map, parent_id))
+				git_oid_cpy(id, parent_id);
+		}
+
+		git_commit_free(commit);
+
+		if ((error = git_vector_insert(commits, packed)) < 0) {
+			packed_commit_free(packed);
+			break;
+		}
+
+		git_oidmap_insert(commit_map, &packed->sha1, packed, &error);
+		if (error < 0)
+			break;
+		error = 0;
+	}
+
+	return error;
+}
+
+static int compute_generations(git_vector *commits, git_oidmap *commit_map)
+{
+	git_array_t(struct packed_commit *) stack = GIT_ARRAY_INIT;
+	struct packed_commit *packed, **top, **slot;
+	size_t i, j;
+	khiter_t pos;
+
+	/* Resolve the parents into positions within the (sorted) file */
+	git_vector_foreach(commits, i, packed) {
+		packed->index = i;
+	}
+
+	git_vector_foreach(commits, i, packed) {
+		git_oid *parent;
+
+		git_array_foreach(packed->parents, j, parent) {
+			size_t *parent_index = git_array_alloc(packed->parent_indices);
+			GITERR_CHECK_ALLOC(parent_index);
+
+			pos = git_oidmap_lookup_index(commit_map, parent);
+			assert(git_oidmap_valid_index(commit_map, pos));
+			*parent_index = ((struct packed_commit *)git_oidmap_value_at(commit_map, pos))->index;
+		}
+	}
+
+	/*
+	 * The generation of a commit is one more than the largest of its
+	 * parents'. Avoid recursing, as histories can be arbitrarily deep.
+	 */
+	git_vector_foreach(commits, i, packed) {
+		if (packed->generation)
+			continue;
+
+		slot = git_array_alloc(stack);
+		GITERR_CHECK_ALLOC(slot);
+		*slot = packed;
+
+		while ((top = git_array_last(stack)) != NULL) {
+			struct packed_commit *current = *top;
+			uint32_t generation = 0;
+			bool ready = true;
+			size_t *parent_index;
+
+			git_array_foreach(current->parent_indices, j, parent_index) {
+				struct packed_commit *parent = git_vector_get(commits, *parent_index);
+
+				if (!parent->generation) {
+					slot = git_array_alloc(stack);
+					if (!slot) {
+						git_array_clear(stack);
+						giterr_set_oom();
+						return -1;
+					}
+					*slot = parent;
+					ready = false;
+				} else if (parent->generation > generation) {
+					generation = parent->generation;
+				}
+			}
+
+			if (!ready)
+				continue;
+
+			if (!current->generation)
+				current->generation = min(generation + 1, COMMIT_GRAPH_GENERATION_MAX);
+			(void)git_array_pop(stack);
+		}
+	}
+
+	git_array_clear(stack);
+	return 0;
+}
+
+static int write_chunk_header(git_filebuf *file, uint32_t id, uint64_t offset)
+{
+	uint32_t word[3];
+
+	word[0] = htonl(id);
+	word[1] = htonl((uint32_t)(offset >> 32));
+	word[2] = htonl((uint32_t)(offset & 0xffffffff));
+
+	return git_filebuf_write(file, word, sizeof(word));
+}
+
+static int write_commit_graph(
+		git_filebuf *file,
+		git_vector *commits)
+{
+	struct git_commit_graph_header hdr = {0};
+	struct packed_commit *packed;
+	git_array_t(uint32_t) extra_edges = GIT_ARRAY_INIT;
+	uint32_t fanout[256] = {0}, word;
+	uint64_t offset;
+	size_t i, j, num_commits = git_vector_length(commits);
+	git_oid checksum;
+	int error = 0;
+
+	/* Figure out the octopus edges first, we need to know the chunk sizes */
+	git_vector_foreach(commits, i, packed) {
+		if (git_array_size(packed->parent_indices) <= 2)
+			continue;
+
+		for (j = 1; j < git_array_size(packed->parent_indices); j++) {
+			uint32_t *edge = git_array_alloc(extra_edges);
+			GITERR_CHECK_ALLOC(edge);
+
+			*edge = (uint32_t)*git_array_get(packed->parent_indices, j);
+			if (j + 1 == git_array_size(packed->parent_indices))
+				*edge |= COMMIT_GRAPH_LAST_EDGE;
+		}
+	}
+
+	hdr.signature = htonl(GIT_COMMIT_GRAPH_SIGNATURE);
+	hdr.version = GIT_COMMIT_GRAPH_VERSION;
+	hdr.object_id_version = GIT_COMMIT_GRAPH_OBJECT_ID_VERSION;
+	hdr.chunks = git_array_size(extra_edges) ? 4 : 3;
+
+	if ((error = git_filebuf_write(file, &hdr, sizeof(hdr))) < 0)
+		goto done;
+
+	offset = sizeof(hdr) + (hdr.chunks + 1) * COMMIT_GRAPH_CHUNK_ENTRY_SIZE;
+	if ((error = write_chunk_header(file, COMMIT_GRAPH_OID_FANOUT_ID, offset)) < 0)
+		goto done;
+
+	offset += sizeof(fanout);
+	if ((error = write_chunk_header(file, COMMIT_GRAPH_OID_LOOKUP_ID, offset)) < 0)
+		goto done;
+
+	offset += num_commits * GIT_OID_RAWSZ;
+	if ((error = write_chunk_header(file, COMMIT_GRAPH_COMMIT_DATA_ID, offset)) < 0)
+		goto done;
+
+	offset += num_commits * COMMIT_GRAPH_COMMIT_DATA_SIZE;
+	if (git_array_size(extra_edges)) {
+		if ((error = write_chunk_header(file, COMMIT_GRAPH_EXTRA_EDGE_LIST_ID, offset)) < 0)
+			goto done;
+
+		offset += git_array_size(extra_edges) * sizeof(uint32_t);
+	}
+
+	if ((error = write_chunk_header(file, 0, offset)) < 0)
+		goto done;
+
+	/* OID Fanout */
+	git_vector_foreach(commits, i, packed) {
+		fanout[packed->sha1.id[0]]++;
+	}
+	for (i = 0, word = 0; i < 256; i++) {
+		word += fanout[i];
+		fanout[i] = htonl(word);
+	}
+	if ((error = git_filebuf_write(file, fanout, sizeof(fanout))) < 0)
+		goto done;
+
+	/* OID Lookup */
+	git_vector_foreach(commits, i, packed) {
+		if ((error = git_filebuf_write(file, &packed->sha1, GIT_OID_RAWSZ)) < 0)
+			goto done;
+	}
+
+	/* Commit Data */
+	j = 0;
+	git_vector_foreach(commits, i, packed) {
+		size_t parent_count = git_array_size(packed->parent_indices);
+		uint64_t commit_time = packed->commit_time & COMMIT_GRAPH_TIME_MASK;
+		uint32_t data[4];
+
+		data[0] = htonl(parent_count > 0 ?
+			(uint32_t)*git_array_get(packed->parent_indices, 0) :
+			GIT_COMMIT_GRAPH_MISSING_PARENT);
+
+		if (parent_count > 2) {
+			data[1] = htonl(COMMIT_GRAPH_OCTOPUS_EDGES | (uint32_t)j);
+			j += parent_count - 1;
+		} else {
+			data[1] = htonl(parent_count > 1 ?
+				(uint32_t)*git_array_get(packed->parent_indices, 1) :
+				GIT_COMMIT_GRAPH_MISSING_PARENT);
+		}
+
+		data[2] = htonl((packed->generation << 2) | (uint32_t)(commit_time >> 32));
+		data[3] = htonl((uint32_t)(commit_time & 0xffffffff));
+
+		if ((error = git_filebuf_write(file, &packed->tree_oid, GIT_OID_RAWSZ)) < 0 ||
+		    (error = git_filebuf_write(file, data, sizeof(data))) < 0)
+			goto done;
+	}
+
+	/* Extra Edge List */
+	for (i = 0; i < git_array_size(extra_edges); i++) {
+		word = htonl(*git_array_get(extra_edges, i));
+		if ((error = git_filebuf_write(file, &word, sizeof(word))) < 0)
+			goto done;
+	}
+
+	/* And the checksum of everything before it */
+	if ((error = git_filebuf_hash(&checksum, file)) < 0)
+		goto done;
+
+	error = git_filebuf_write(file, &checksum, GIT_OID_RAWSZ);
+
+done:
+	git_array_clear(extra_edges);
+	return error;
+}
+
+int git_commit_graph__write(git_repository *repo, const char *objects_dir)
+{
+	git_vector commits = GIT_VECTOR_INIT;
+	git_oidmap *commit_map = NULL;
+	oid_stack pending = GIT_ARRAY_INIT;
+	git_filebuf file = GIT_FILEBUF_INIT;
+	git_buf path = GIT_BUF_INIT;
+	struct packed_commit *packed;
+	size_t i;
+	int error;
+
+	commit_map = git_oidmap_alloc();
+	GITERR_CHECK_ALLOC(commit_map);
+
+	if ((error = git_vector_init(&commits, 0, packed_commit_cmp)) < 0 ||
+	    (error = collect_tips(&pending, repo)) < 0 ||
+	    (error = collect_commits(&commits, commit_map, repo, &pending)) < 0)
+		goto done;
+
+	git_vector_sort(&commits);
+
+	if ((error = compute_generations(&commits, commit_map)) < 0)
+		goto done;
+
+	if ((error = git_buf_joinpath(&path, objects_dir, GIT_COMMIT_GRAPH_FILE)) < 0 ||
+	    (error = git_futils_mkpath2file(path.ptr, GIT_OBJECT_DIR_MODE)) < 0)
+		goto done;
+
+	if ((error = git_filebuf_open(&file, path.ptr,
+			GIT_FILEBUF_HASH_CONTENTS |
+			(git_repository__fsync_gitdir ? GIT_FILEBUF_FSYNC : 0),
+			GIT_OBJECT_FILE_MODE)) < 0)
+		goto done;
+
+	if ((error = write_commit_graph(&file, &commits)) < 0)
+		goto done;
+
+	error = git_filebuf_commit(&file);
+
+done:
+	git_filebuf_cleanup(&file);
+	git_buf_free(&path);
+	git_vector_foreach(&commits, i, packed) {
+		packed_commit_free(packed);
+	}
+	git_vector_free(&commits);
+	git_oidmap_free(commit_map);
+	git_array_clear(pending);
+	return error;
+}
+
+int git_commit_graph_write(git_repository *repo)
+{
+	git_buf objects_dir = GIT_BUF_INIT;
+	int error;
+
+	assert(repo);
+
+	if ((error = git_repository_item_path(&objects_dir, repo,
+			GIT_REPOSITORY_ITEM_OBJECTS)) == 0)
+		error = git_commit_graph__write(repo, objects_dir.ptr);
+
+	git_buf_free(&objects_dir);
+	return error;
+}
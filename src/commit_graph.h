@@ -0,0 +1,140 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#ifndef INCLUDE_commit_graph_h__
+#define INCLUDE_commit_graph_h__
+
+#include "common.h"
+
+#include "git2/types.h"
+#include "git2/oid.h"
+
+#include "map.h"
+#include "fileops.h"
+
+#define GIT_COMMIT_GRAPH_FILE "info/commit-graph"
+
+/*
+ * Generation number of a commit which is not part of the commit-graph.
+ * Generation numbers in the file itself are always at least 1.
+ */
+#define GIT_COMMIT_GRAPH_GENERATION_UNKNOWN 0
+
+/* Parent index of a commit which doesn't have that many parents. */
+#define GIT_COMMIT_GRAPH_MISSING_PARENT 0x70000000
+
+/**
+ * A commit-graph file.
+ *
+ * This file contains metadata about commits, particularly the generation
+ * number for each one. This can help speed up graph operations without
+ * requiring a full graph traversal.
+ *
+ * Support for this feature was added in git 2.19.
+ */
+typedef struct git_commit_graph_file {
+	git_atomic refcount;
+	git_map graph_map;
+
+	/* The OID Fanout table. */
+	const uint32_t *oid_fanout;
+	/* The total number of commits in the graph. */
+	uint32_t num_commits;
+
+	/* The OID Lookup table. */
+	const git_oid *oid_lookup;
+
+	/*
+	 * The Commit Data table. Each entry contains the OID of the commit
+	 * followed by two 8-byte fields in network byte order:
+	 * - The indices of the first two parents (32 bits each).
+	 * - The generation number (first 30 bits) and commit time in seconds
+	 *   since UNIX epoch (34 bits).
+	 */
+	const unsigned char *commit_data;
+
+	/*
+	 * The Extra Edge List table. Each 4-byte entry is a network byte order
+	 * index of one of the parents of an octopus merge, with the high bit
+	 * set on the last parent of each commit.
+	 */
+	const uint32_t *extra_edge_list;
+	size_t num_extra_edge_list;
+
+	/* The trailer of the file. Contains the SHA1-checksum of the whole file. */
+	git_oid checksum;
+
+	/* The stat information of the file when it was opened. */
+	git_futils_filestamp stamp;
+} git_commit_graph_file;
+
+/**
+ * An entry in the commit-graph file. Provides a subset of the information
+ * that can be obtained from the commit header.
+ */
+typedef struct git_commit_graph_entry {
+	/* The generation number of the commit within the graph */
+	uint32_t generation;
+
+	/* Time in seconds from UNIX epoch. */
+	git_time_t commit_time;
+
+	/* The number of parents of the commit. */
+	size_t parent_count;
+
+	/*
+	 * The indices of the parent commits within the Commit Data table. The value
+	 * of `GIT_COMMIT_GRAPH_MISSING_PARENT` indicates that no parent is in that
+	 * position.
+	 */
+	size_t parent_indices[2];
+
+	/* The index within the Extra Edge List of any parent after the first two. */
+	size_t extra_parents_index;
+
+	/* The SHA-1 hash of the root tree of the commit. */
+	git_oid tree_oid;
+
+	/* The SHA-1 hash of the requested commit. */
+	git_oid sha1;
+} git_commit_graph_entry;
+
+int git_commit_graph_open(git_commit_graph_file **file_out, const char *path);
+int git_commit_graph_parse(
+		git_commit_graph_file *file,
+		const unsigned char *data,
+		size_t size);
+
+/*
+ * Returns 1 if the commit-graph file at `path` differs from the one which
+ * was read into `file`, 0 if it's unchanged.
+ */
+int git_commit_graph_needs_refresh(
+		const git_commit_graph_file *file,
+		const char *path);
+
+int git_commit_graph_entry_find(
+		git_commit_graph_entry *e,
+		const git_commit_graph_file *file,
+		const git_oid *short_oid,
+		size_t len);
+int git_commit_graph_entry_parent(
+		git_commit_graph_entry *parent,
+		const git_commit_graph_file *file,
+		const git_commit_graph_entry *entry,
+		size_t n);
+
+void git_commit_graph_incref(git_commit_graph_file *file);
+void git_commit_graph_free(git_commit_graph_file *file);
+
+/*
+ * Write a commit-graph file containing all the commits reachable from
+ * the references in `repo` into `objects_dir`.
+ */
+int git_commit_graph__write(git_repository *repo, const char *objects_dir);
+
+#endif
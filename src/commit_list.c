@@ -105,6 +105,33 @@ git_commit_list_node *git_commit_list_pop(git_commit_list **stack)
 	return item;
 }
 
+/*
+ * Read the commit time from a committer line the way git does, so that
+ * the walks agree with git and with the commit-graph: it is the number
+ * after the first '>', or 0 if there is none there.
+ */
+int64_t git_commit_list_committer_time(const char *line, const char *eol)
+{
+	const char *date;
+	int64_t time;
+
+	if ((date = memchr(line, '>', eol - line)) == NULL)
+		return 0;
+
+	while (++date < eol && *date == ' ')
+		/* skip the spaces */;
+
+	if (date == eol || !git__isdigit(*date))
+		return 0;
+
+	if (git__strntol64(&time, date, eol - date, NULL, 10) < 0) {
+		giterr_clear();
+		return 0;
+	}
+
+	return time;
+}
+
 static int commit_quick_parse(
 	git_revwalk *walk,
 	git_commit_list_node *commit,
@@ -115,7 +142,6 @@ static int commit_quick_parse(
 	const uint8_t *buffer_end = buffer + buffer_len;
 	const uint8_t *parents_start, *committer_start;
 	int i, parents = 0;
-	int64_t commit_time;
 
 	buffer += strlen("tree ") + GIT_OID_HEXSZ + 1;
 
@@ -144,49 +170,65 @@ static int commit_quick_parse(
 
 	commit->out_degree = (unsigned short)parents;
 
-	if ((committer_start = buffer = memchr(buffer, '\n', buffer_end - buffer)) == NULL)
+	if ((buffer = memchr(buffer, '\n', buffer_end - buffer)) == NULL)
 		return commit_error(commit, "object is corrupted");
 
-	buffer++;
+	committer_start = ++buffer;
 
 	if ((buffer = memchr(buffer, '\n', buffer_end - buffer)) == NULL)
 		return commit_error(commit, "object is corrupted");
 
-	/* Skip trailing spaces */
-	while (buffer > committer_start && git__isspace(*buffer))
-		buffer--;
+	commit->time = git_commit_list_committer_time(
+		(const char *)committer_start, (const char *)buffer);
+	commit->parsed = 1;
+	return 0;
+}
 
-	/* Seek for the beginning of the pack of digits */
-	while (buffer > committer_start && git__isdigit(*buffer))
-		buffer--;
+static int commit_graph_parse(
+	git_revwalk *walk,
+	git_commit_list_node *commit,
+	const git_commit_graph_entry *entry)
+{
+	git_commit_graph_entry parent;
+	size_t i;
+	int error;
 
-	/* Skip potential timezone offset */
-	if ((buffer > committer_start) && (*buffer == '+' || *buffer == '-')) {
-		buffer--;
+	commit->parents = alloc_parents(walk, commit, entry->parent_count);
+	GITERR_CHECK_ALLOC(commit->parents);
 
-		while (buffer > committer_start && git__isspace(*buffer))
-			buffer--;
+	for (i = 0; i < entry->parent_count; ++i) {
+		if ((error = git_commit_graph_entry_parent(
+				&parent, walk->commit_graph, entry, i)) < 0)
+			return error;
 
-		while (buffer > committer_start && git__isdigit(*buffer))
-			buffer--;
+		commit->parents[i] = git_revwalk__commit_lookup(walk, &parent.sha1);
+		if (commit->parents[i] == NULL)
+			return -1;
 	}
 
-	if ((buffer == committer_start) || (git__strtol64(&commit_time, (char *)(buffer + 1), NULL, 10) < 0))
-		return commit_error(commit, "cannot parse commit time");
-
-	commit->time = commit_time;
+	commit->out_degree = (unsigned short)entry->parent_count;
+	commit->time = entry->commit_time;
+	commit->generation = entry->generation;
 	commit->parsed = 1;
 	return 0;
 }
 
 int git_commit_list_parse(git_revwalk *walk, git_commit_list_node *commit)
 {
+	git_commit_graph_entry entry;
 	git_odb_object *obj;
 	int error;
 
 	if (commit->parsed)
 		return 0;
 
+	if (walk->commit_graph &&
+		git_commit_graph_entry_find(
+			&entry, walk->commit_graph, &commit->oid, GIT_OID_HEXSZ) == 0)
+		return commit_graph_parse(walk, commit, &entry);
+
+	giterr_clear();
+
 	if ((error = git_odb_read(&obj, walk->odb, &commit->oid)) < 0)
 		return error;
 
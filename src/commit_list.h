@@ -26,6 +26,7 @@
 typedef struct git_commit_list_node {
 	git_oid oid;
 	int64_t time;
+	uint32_t generation; /* from the commit-graph, if the commit is in it */
 	unsigned int seen:1,
 			 uninteresting:1,
 			 topo_delay:1,
@@ -50,6 +51,7 @@ void git_commit_list_free(git_commit_list **list_p);
 git_commit_list *git_commit_list_insert(git_commit_list_node *item, git_commit_list **list_p);
 git_commit_list *git_commit_list_insert_by_date(git_commit_list_node *item, git_commit_list **list_p);
 int git_commit_list_parse(git_revwalk *walk, git_commit_list_node *commit);
+int64_t git_commit_list_committer_time(const char *line, const char *eol);
 git_commit_list_node *git_commit_list_pop(git_commit_list **stack);
 
 #endif
@@ -58,6 +58,12 @@ static git_cvar_map _cvar_map_safecrlf[] = {
 	{GIT_CVAR_STRING, "warn", GIT_SAFE_CRLF_WARN}
 };
 
+static git_cvar_map _cvar_map_untrackedcache[] = {
+	{GIT_CVAR_FALSE, NULL, GIT_UNTRACKEDCACHE_FALSE},
+	{GIT_CVAR_TRUE, NULL, GIT_UNTRACKEDCACHE_TRUE},
+	{GIT_CVAR_STRING, "keep", GIT_UNTRACKEDCACHE_KEEP}
+};
+
 /*
  * Generic map for integer values
  */
@@ -80,6 +86,7 @@ static struct map_data _cvar_maps[] = {
 	{"core.protecthfs", NULL, 0, GIT_PROTECTHFS_DEFAULT },
 	{"core.protectntfs", NULL, 0, GIT_PROTECTNTFS_DEFAULT },
 	{"core.fsyncobjectfiles", NULL, 0, GIT_FSYNCOBJECTFILES_DEFAULT },
+	{"core.untrackedcache", _cvar_map_untrackedcache, ARRAY_SIZE(_cvar_map_untrackedcache), GIT_UNTRACKEDCACHE_DEFAULT },
 };
 
 int git_config__cvar(int *out, git_config *config, git_cvar_cached cvar)
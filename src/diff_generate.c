@@ -17,6 +17,8 @@
 #include "index.h"
 #include "odb.h"
 #include "submodule.h"
+#include "fsmonitor.h"
+#include "profile.h"
 
 #define DIFF_FLAG_IS_SET(DIFF,FLAG) \
 	(((DIFF)->base.opts.flags & (FLAG)) != 0)
@@ -834,6 +836,13 @@ static int maybe_modified(
 			modified_uncertain = true;
 		}
 
+
+		/* the filesystem monitor will tell us when it changes again */
+		else if ((info->new_iter->flags & GIT_ITERATOR_USE_FSMONITOR) != 0 &&
+			git_iterator_type(info->old_iter) == GIT_ITERATOR_TYPE_INDEX &&
+			git_iterator_index(info->old_iter) == index)
+			git_fsmonitor__mark_valid(index, oitem);
+
 	/* if mode is GITLINK and submodules are ignored, then skip */
 	} else if (S_ISGITLINK(nmode) &&
 			 DIFF_FLAG_IS_SET(diff, GIT_DIFF_IGNORE_SUBMODULES)) {
@@ -1192,6 +1201,7 @@ int git_diff__from_iterators(
 {
 	git_diff_generated *diff;
 	diff_in_progress info;
+	git_profile_frame region;
 	int error = 0;
 
 	*out = NULL;
@@ -1199,6 +1209,8 @@ int git_diff__from_iterators(
 	diff = diff_generated_alloc(repo, old_iter, new_iter);
 	GITERR_CHECK_ALLOC(diff);
 
+	git_profile_enter(&region, "diff");
+
 	info.repo = repo;
 	info.old_iter = old_iter;
 	info.new_iter = new_iter;
@@ -1254,6 +1266,8 @@ int git_diff__from_iterators(
 		old_iter->stat_calls + new_iter->stat_calls;
 
 cleanup:
+	git_profile_leave(&region, diff->base.deltas.length);
+
 	if (!error)
 		*out = &diff->base;
 	else
@@ -1374,6 +1388,7 @@ int git_diff_index_to_workdir(
 	const git_diff_options *opts)
 {
 	git_diff *diff = NULL;
+	unsigned int workdir_flags = GIT_ITERATOR_DONT_AUTOEXPAND;
 	int error = 0;
 
 	assert(out && repo);
@@ -1383,16 +1398,29 @@ int git_diff_index_to_workdir(
 	if (!index && (error = diff_load_index(&index, repo)) < 0)
 		return error;
 
+	/* the untracked cache doesn't know about ignored files */
+	if (!opts || (opts->flags & GIT_DIFF_INCLUDE_IGNORED) == 0)
+		workdir_flags |= GIT_ITERATOR_USE_UNTRACKED_CACHE;
+
+	if ((error = git_fsmonitor__refresh(index, repo)) < 0)
+		return error;
+	else if (error > 0)
+		workdir_flags |= GIT_ITERATOR_USE_FSMONITOR;
+
+	error = 0;
+
 	DIFF_FROM_ITERATORS(
 		git_iterator_for_index(&a, repo, index, &a_opts),
 		GIT_ITERATOR_INCLUDE_CONFLICTS,
 
 		git_iterator_for_workdir(&b, repo, index, NULL, &b_opts),
-		GIT_ITERATOR_DONT_AUTOEXPAND
+		workdir_flags
 	);
 
 	if (!error && (diff->opts.flags & GIT_DIFF_UPDATE_INDEX) != 0 &&
-		((git_diff_generated *)diff)->index_updated)
+		(((git_diff_generated *)diff)->index_updated ||
+		 (index->untracked && index->untracked->dirty) ||
+		 index->fsmonitor_dirty))
 		error = git_index_write(index);
 
 	if (!error)
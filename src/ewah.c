@@ -0,0 +1,296 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "ewah.h"
+
+#define BITS_IN_WORD 64
+#define WORD_ONES (~(uint64_t)0)
+
+#define RLW_RUNNING_BITS 32
+#define RLW_LITERAL_BITS 31
+#define RLW_LARGEST_RUNNING_COUNT ((((uint64_t)1) << RLW_RUNNING_BITS) - 1)
+#define RLW_LARGEST_LITERAL_COUNT ((((uint64_t)1) << RLW_LITERAL_BITS) - 1)
+
+static int bitmap_grow(git_bitmap *bitmap, size_t word_alloc)
+{
+	uint64_t *words;
+
+	if (word_alloc <= bitmap->word_alloc)
+		return 0;
+
+	if (word_alloc < bitmap->word_alloc * 2)
+		word_alloc = bitmap->word_alloc * 2;
+
+	words = git__reallocarray(bitmap->words, word_alloc, sizeof(uint64_t));
+	GITERR_CHECK_ALLOC(words);
+
+	memset(words + bitmap->word_alloc, 0,
+		(word_alloc - bitmap->word_alloc) * sizeof(uint64_t));
+
+	bitmap->words = words;
+	bitmap->word_alloc = word_alloc;
+	return 0;
+}
+
+int git_bitmap_set(git_bitmap *bitmap, size_t pos)
+{
+	size_t block = pos / BITS_IN_WORD;
+
+	if (bitmap_grow(bitmap, block + 1) < 0)
+		return -1;
+
+	bitmap->words[block] |= ((uint64_t)1) << (pos % BITS_IN_WORD);
+	return 0;
+}
+
+bool git_bitmap_get(const git_bitmap *bitmap, size_t pos)
+{
+	size_t block = pos / BITS_IN_WORD;
+
+	return block < bitmap->word_alloc &&
+		(bitmap->words[block] & (((uint64_t)1) << (pos % BITS_IN_WORD))) != 0;
+}
+
+int git_bitmap_or(git_bitmap *dst, const git_bitmap *src)
+{
+	size_t i;
+
+	if (bitmap_grow(dst, src->word_alloc) < 0)
+		return -1;
+
+	for (i = 0; i < src->word_alloc; i++)
+		dst->words[i] |= src->words[i];
+
+	return 0;
+}
+
+void git_bitmap_and_not(git_bitmap *dst, const git_bitmap *src)
+{
+	size_t i, count = min(dst->word_alloc, src->word_alloc);
+
+	for (i = 0; i < count; i++)
+		dst->words[i] &= ~src->words[i];
+}
+
+size_t git_bitmap_popcount(const git_bitmap *bitmap)
+{
+	size_t i, count = 0;
+	uint64_t word;
+
+	for (i = 0; i < bitmap->word_alloc; i++) {
+		for (word = bitmap->words[i]; word; word &= word - 1)
+			count++;
+	}
+
+	return count;
+}
+
+int git_bitmap_foreach(
+	const git_bitmap *bitmap, git_bitmap_foreach_cb cb, void *payload)
+{
+	size_t i, offset;
+	uint64_t word;
+	int error;
+
+	for (i = 0; i < bitmap->word_alloc; i++) {
+		word = bitmap->words[i];
+
+		for (offset = 0; word; offset++, word >>= 1) {
+			if (!(word & 1))
+				continue;
+
+			if ((error = cb(i * BITS_IN_WORD + offset, payload)) != 0)
+				return giterr_set_after_callback(error);
+		}
+	}
+
+	return 0;
+}
+
+void git_bitmap_free(git_bitmap *bitmap)
+{
+	if (!bitmap)
+		return;
+
+	git__free(bitmap->words);
+	bitmap->words = NULL;
+	bitmap->word_alloc = 0;
+}
+
+GIT_INLINE(uint64_t) ewah_word(const git_ewah *ewah, size_t n)
+{
+	const unsigned char *p = ewah->buffer + n * sizeof(uint64_t);
+
+	return ((uint64_t)ntohl(*((uint32_t *)p)) << 32) |
+		ntohl(*((uint32_t *)(p + 4)));
+}
+
+static int ewah_error(void)
+{
+	giterr_set(GITERR_ODB, "invalid ewah bitmap - run-length words are corrupted");
+	return -1;
+}
+
+int git_ewah_parse(
+	git_ewah *ewah, size_t *consumed, const unsigned char *data, size_t len)
+{
+	size_t words, total;
+
+	if (len < 2 * sizeof(uint32_t))
+		return ewah_error();
+
+	ewah->bit_size = ntohl(*((uint32_t *)data));
+	words = ntohl(*((uint32_t *)(data + 4)));
+
+	GITERR_CHECK_ALLOC_MULTIPLY(&total, words, sizeof(uint64_t));
+	GITERR_CHECK_ALLOC_ADD(&total, total, 3 * sizeof(uint32_t));
+
+	if (total > len)
+		return ewah_error();
+
+	ewah->buffer = data + 2 * sizeof(uint32_t);
+	ewah->buffer_size = words;
+
+	*consumed = total;
+	return 0;
+}
+
+static int ewah_apply(git_bitmap *dst, const git_ewah *ewah, bool xor)
+{
+	size_t pos = 0, block = 0, i;
+
+	while (pos < ewah->buffer_size) {
+		uint64_t rlw = ewah_word(ewah, pos++);
+		bool run_bit = (rlw & 1) != 0;
+		size_t run_len = (size_t)((rlw >> 1) & RLW_LARGEST_RUNNING_COUNT);
+		size_t literals = (size_t)(rlw >> (1 + RLW_RUNNING_BITS));
+
+		if (literals > ewah->buffer_size - pos)
+			return ewah_error();
+
+		if (run_bit && run_len) {
+			if (bitmap_grow(dst, block + run_len) < 0)
+				return -1;
+
+			for (i = 0; i < run_len; i++) {
+				if (xor)
+					dst->words[block + i] ^= WORD_ONES;
+				else
+					dst->words[block + i] = WORD_ONES;
+			}
+		}
+
+		block += run_len;
+
+		if (literals && bitmap_grow(dst, block + literals) < 0)
+			return -1;
+
+		for (i = 0; i < literals; i++) {
+			if (xor)
+				dst->words[block + i] ^= ewah_word(ewah, pos + i);
+			else
+				dst->words[block + i] |= ewah_word(ewah, pos + i);
+		}
+
+		block += literals;
+		pos += literals;
+	}
+
+	return 0;
+}
+
+int git_ewah_or(git_bitmap *dst, const git_ewah *ewah)
+{
+	return ewah_apply(dst, ewah, false);
+}
+
+int git_ewah_xor(git_bitmap *dst, const git_ewah *ewah)
+{
+	return ewah_apply(dst, ewah, true);
+}
+
+static int buf_put_be32(git_buf *out, uint32_t value)
+{
+	value = htonl(value);
+	return git_buf_put(out, (const char *)&value, sizeof(value));
+}
+
+static void set_be64(git_buf *out, size_t offset, uint64_t value)
+{
+	uint32_t *p = (uint32_t *)(out->ptr + offset);
+
+	p[0] = htonl((uint32_t)(value >> 32));
+	p[1] = htonl((uint32_t)(value & 0xffffffff));
+}
+
+int git_ewah_serialize(git_buf *out, const git_bitmap *bitmap)
+{
+	size_t words = bitmap->word_alloc, i = 0, header, rlw_offset, count = 0;
+	size_t last_rlw = 0;
+	uint32_t bit_size = 0;
+	uint64_t last;
+
+	/* Trailing empty words carry no information */
+	while (words && bitmap->words[words - 1] == 0)
+		words--;
+
+	if (words) {
+		bit_size = (uint32_t)((words - 1) * BITS_IN_WORD);
+		for (last = bitmap->words[words - 1]; last; last >>= 1)
+			bit_size++;
+	}
+
+	header = out->size;
+	if (buf_put_be32(out, bit_size) < 0 || buf_put_be32(out, 0) < 0)
+		return -1;
+
+	do {
+		uint64_t run_len = 0, literals = 0, run_bit = 0, rlw;
+
+		if (i < words && (bitmap->words[i] == 0 || bitmap->words[i] == WORD_ONES)) {
+			uint64_t fill = bitmap->words[i];
+
+			run_bit = (fill == WORD_ONES);
+			while (i < words && bitmap->words[i] == fill &&
+				run_len < RLW_LARGEST_RUNNING_COUNT) {
+				run_len++;
+				i++;
+			}
+		}
+
+		while (i + literals < words &&
+			bitmap->words[i + literals] != 0 &&
+			bitmap->words[i + literals] != WORD_ONES &&
+			literals < RLW_LARGEST_LITERAL_COUNT)
+			literals++;
+
+		rlw = run_bit | (run_len << 1) | (literals << (1 + RLW_RUNNING_BITS));
+
+		rlw_offset = out->size;
+		if (git_buf_put(out, (const char *)&rlw, sizeof(rlw)) < 0)
+			return -1;
+		set_be64(out, rlw_offset, rlw);
+		last_rlw = count++;
+
+		for (; literals; literals--, i++, count++) {
+			size_t offset = out->size;
+
+			if (git_buf_put(out, (const char *)&bitmap->words[i], sizeof(uint64_t)) < 0)
+				return -1;
+			set_be64(out, offset, bitmap->words[i]);
+		}
+	} while (i < words);
+
+	if (!git__is_uint32(count)) {
+		giterr_set(GITERR_INVALID, "bitmap is too large");
+		return -1;
+	}
+
+	*((uint32_t *)(out->ptr + header + sizeof(uint32_t))) = htonl((uint32_t)count);
+
+	return buf_put_be32(out, (uint32_t)last_rlw);
+}
@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_ewah_h__
+#define INCLUDE_ewah_h__
+
+#include "common.h"
+
+#include "buffer.h"
+
+/**
+ * An uncompressed, growable bitmap. Bits which were never set read as
+ * zero, so two bitmaps of different lengths can be combined freely.
+ */
+typedef struct {
+	uint64_t *words;
+	size_t word_alloc;
+} git_bitmap;
+
+#define GIT_BITMAP_INIT {0}
+
+typedef int (*git_bitmap_foreach_cb)(size_t pos, void *payload);
+
+extern int git_bitmap_set(git_bitmap *bitmap, size_t pos);
+extern bool git_bitmap_get(const git_bitmap *bitmap, size_t pos);
+
+/* dst |= src */
+extern int git_bitmap_or(git_bitmap *dst, const git_bitmap *src);
+
+/* dst &= ~src */
+extern void git_bitmap_and_not(git_bitmap *dst, const git_bitmap *src);
+
+extern size_t git_bitmap_popcount(const git_bitmap *bitmap);
+
+/* Call `cb` for the position of each set bit, in increasing order */
+extern int git_bitmap_foreach(
+	const git_bitmap *bitmap, git_bitmap_foreach_cb cb, void *payload);
+
+extern void git_bitmap_free(git_bitmap *bitmap);
+
+/**
+ * A view over an EWAH-compressed bitmap in the serialized format used by
+ * git's `.bitmap` files: the bit size, the number of 64-bit words and the
+ * words themselves, followed by the position of the last run-length
+ * word, all in network byte order.
+ *
+ * A run-length word holds the bit value of the run in its lowest bit,
+ * the number of words in the run in the next 32 bits and the number of
+ * literal words which follow it in the upper 31 bits.
+ */
+typedef struct {
+	const unsigned char *buffer;
+	size_t buffer_size; /* in words */
+	uint32_t bit_size;
+} git_ewah;
+
+/**
+ * Point `ewah` at the compressed bitmap at the start of `data`. The
+ * number of bytes it spans is stored in `consumed`.
+ */
+extern int git_ewah_parse(
+	git_ewah *ewah, size_t *consumed, const unsigned char *data, size_t len);
+
+/* dst |= ewah */
+extern int git_ewah_or(git_bitmap *dst, const git_ewah *ewah);
+
+/* dst ^= ewah */
+extern int git_ewah_xor(git_bitmap *dst, const git_ewah *ewah);
+
+/* Append the compressed and serialized form of `bitmap` to `out` */
+extern int git_ewah_serialize(git_buf *out, const git_bitmap *bitmap);
+
+#endif
@@ -572,6 +572,44 @@ int git_filebuf_printf(git_filebuf *file, const char *format, ...)
 	return res;
 }
 
+int git_filebuf_close_fd(git_filebuf *file)
+{
+	/* only a lock which nothing was written to can be reopened */
+	assert(file && file->path_original && file->buf_pos == 0 &&
+		!file->compute_digest && !file->z_buf);
+
+	if (!file->fd_is_open)
+		return 0;
+
+	file->fd_is_open = false;
+
+	if (p_close(file->fd) < 0) {
+		giterr_set(GITERR_OS, "failed to close file at '%s'", file->path_lock);
+		return -1;
+	}
+
+	file->fd = -1;
+	return 0;
+}
+
+int git_filebuf_reopen(git_filebuf *file)
+{
+	assert(file && file->path_lock);
+
+	if (file->fd_is_open)
+		return 0;
+
+	file->fd = p_open(file->path_lock, O_WRONLY | O_TRUNC | O_BINARY | O_CLOEXEC);
+
+	if (file->fd < 0) {
+		giterr_set(GITERR_OS, "failed to reopen locked file '%s'", file->path_lock);
+		return -1;
+	}
+
+	file->fd_is_open = true;
+	return 0;
+}
+
 int git_filebuf_stats(time_t *mtime, size_t *size, git_filebuf *file)
 {
 	int res;
@@ -91,4 +91,13 @@ int git_filebuf_hash(git_oid *oid, git_filebuf *file);
 int git_filebuf_flush(git_filebuf *file);
 int git_filebuf_stats(time_t *mtime, size_t *size, git_filebuf *file);
 
+/*
+ * Close the file descriptor of a lock which nothing was written to yet,
+ * so that a caller can hold more locks than it may have open files.
+ * The lock stays in place; `git_filebuf_reopen` must be called before
+ * the buffer is written or committed.
+ */
+int git_filebuf_close_fd(git_filebuf *file);
+int git_filebuf_reopen(git_filebuf *file);
+
 #endif
@@ -490,6 +490,18 @@ int git_filter_list__load_ext(
 	const char *path,
 	git_filter_mode_t mode,
 	git_filter_options *filter_opts)
+{
+	return git_filter_list__load_for_id(filters, repo,
+		blob ? git_blob_id(blob) : NULL, path, mode, filter_opts);
+}
+
+int git_filter_list__load_for_id(
+	git_filter_list **filters,
+	git_repository *repo,
+	const git_oid *blob_id, /* can be NULL */
+	const char *path,
+	git_filter_mode_t mode,
+	git_filter_options *filter_opts)
 {
 	int error = 0;
 	git_filter_list *fl = NULL;
@@ -508,8 +520,8 @@ int git_filter_list__load_ext(
 	src.mode = mode;
 	src.flags = filter_opts->flags;
 
-	if (blob)
-		git_oid_cpy(&src.oid, git_blob_id(blob));
+	if (blob_id)
+		git_oid_cpy(&src.oid, blob_id);
 
 	git_vector_foreach(&filter_registry.filters, idx, fdef) {
 		const char **values = NULL;
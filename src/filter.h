@@ -45,6 +45,15 @@ extern int git_filter_list__load_ext(
 	git_filter_mode_t mode,
 	git_filter_options *filter_opts);
 
+/* Like `git_filter_list__load_ext`, without having to read the blob */
+extern int git_filter_list__load_for_id(
+	git_filter_list **filters,
+	git_repository *repo,
+	const git_oid *blob_id, /* can be NULL */
+	const char *path,
+	git_filter_mode_t mode,
+	git_filter_options *filter_opts);
+
 /*
  * Available filters
  */
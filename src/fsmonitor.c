@@ -0,0 +1,284 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "fsmonitor.h"
+
+#include "ewah.h"
+#include "index.h"
+#include "repository.h"
+
+#define FSMONITOR_VERSION_TIMESTAMP 1
+#define FSMONITOR_VERSION_TOKEN 2
+
+int git_fsmonitor_init(git_fsmonitor *fsmonitor, unsigned int version)
+{
+	GIT_INIT_STRUCTURE_FROM_TEMPLATE(
+		fsmonitor, version, git_fsmonitor, GIT_FSMONITOR_INIT);
+	return 0;
+}
+
+int git_repository_set_fsmonitor(git_repository *repo, git_fsmonitor *fsmonitor)
+{
+	assert(repo);
+
+	if (fsmonitor)
+		GITERR_CHECK_VERSION(fsmonitor, GIT_FSMONITOR_VERSION, "git_fsmonitor");
+
+	if (repo->fsmonitor && repo->fsmonitor != fsmonitor)
+		repo->fsmonitor->free(repo->fsmonitor);
+
+	repo->fsmonitor = fsmonitor;
+	return 0;
+}
+
+static void set_valid(git_index *index, bool valid)
+{
+	git_index_entry *entry;
+	size_t i;
+
+	git_vector_foreach(&index->entries, i, entry) {
+		if (valid)
+			entry->flags_extended |= GIT_IDXENTRY_FSMONITOR_VALID;
+		else
+			entry->flags_extended &= ~GIT_IDXENTRY_FSMONITOR_VALID;
+	}
+}
+
+static void invalidate(git_index *index, git_index_entry *entry)
+{
+	if (entry->flags_extended & GIT_IDXENTRY_FSMONITOR_VALID) {
+		entry->flags_extended &= ~GIT_IDXENTRY_FSMONITOR_VALID;
+		index->fsmonitor_dirty = 1;
+	}
+}
+
+static int invalidate_path(const char *path, void *payload)
+{
+	git_index *index = payload;
+	git_index_entry *entry;
+	size_t len = strlen(path), pos;
+	int (*strncomp)(const char *, const char *, size_t) =
+		index->ignore_case ? git__strncasecmp : git__strncmp;
+
+	if (len && path[len - 1] == '/')
+		len--;
+
+	/* the path itself, or everything beneath it if it is a directory */
+	git_index__find_pos(&pos, index, path, len, 0);
+
+	while ((entry = git_vector_get(&index->entries, pos++)) != NULL &&
+		strncomp(entry->path, path, len) == 0) {
+		if (entry->path[len] != '\0' && entry->path[len] != '/')
+			continue;
+
+		invalidate(index, entry);
+	}
+
+	return 0;
+}
+
+int git_fsmonitor__refresh(git_index *index, git_repository *repo)
+{
+	git_fsmonitor *fsmonitor = repo->fsmonitor;
+	git_index_entry *entry;
+	git_buf token = GIT_BUF_INIT;
+	size_t i;
+	int error;
+
+	if (!fsmonitor)
+		return 0;
+
+	error = fsmonitor->query(fsmonitor, &token,
+		index->fsmonitor_token, invalidate_path, index);
+
+	/* everything may have changed, look at all of it again */
+	if (error == GIT_PASSTHROUGH || (!error && !index->fsmonitor_token)) {
+		giterr_clear();
+		git_vector_foreach(&index->entries, i, entry)
+			invalidate(index, entry);
+		error = 0;
+	}
+
+	if (error < 0) {
+		git_buf_free(&token);
+		return error;
+	}
+
+	/*
+	 * Hooks hand out a new token on every query; only write it when
+	 * the index has none yet or when the flags of the entries change,
+	 * since an older token merely reports more paths next time.
+	 */
+	if (!index->fsmonitor_token)
+		index->fsmonitor_dirty = 1;
+
+	git__free(index->fsmonitor_token);
+	index->fsmonitor_token = git__strdup(git_buf_cstr(&token));
+	git_buf_free(&token);
+	GITERR_CHECK_ALLOC(index->fsmonitor_token);
+
+	return 1;
+}
+
+void git_fsmonitor__mark_valid(git_index *index, const git_index_entry *entry)
+{
+	git_index_entry *e = (git_index_entry *)entry;
+
+	if ((e->flags_extended & GIT_IDXENTRY_FSMONITOR_VALID) == 0) {
+		e->flags_extended |= GIT_IDXENTRY_FSMONITOR_VALID;
+		index->fsmonitor_dirty = 1;
+	}
+}
+
+static int clear_valid(size_t pos, void *payload)
+{
+	git_index_entry *entry = git_vector_get((git_vector *)payload, pos);
+
+	entry->flags_extended &= ~GIT_IDXENTRY_FSMONITOR_VALID;
+	return 0;
+}
+
+static uint32_t read_be32(const char *buffer)
+{
+	uint32_t value;
+	memcpy(&value, buffer, sizeof(value));
+	return ntohl(value);
+}
+
+static uint64_t read_be64(const char *buffer)
+{
+	return ((uint64_t)read_be32(buffer) << 32) | read_be32(buffer + 4);
+}
+
+/*
+ * The extension holds a version, the token (or, in version 1, the
+ * time in nanoseconds) and a bitmap of the entries which may not
+ * match the working directory.
+ */
+int git_fsmonitor__read(git_index *index, const char *buffer, size_t buffer_size)
+{
+	const char *end = buffer + buffer_size, *nul;
+	git_bitmap dirty = GIT_BITMAP_INIT;
+	git_ewah ewah;
+	size_t consumed;
+	uint32_t version, ewah_size;
+	char *token = NULL, timestamp[32];
+	int error = -1;
+
+	if (buffer_size < 4)
+		goto invalid;
+
+	version = read_be32(buffer);
+	buffer += 4;
+
+	if (version == FSMONITOR_VERSION_TIMESTAMP) {
+		if (end - buffer < 8)
+			goto invalid;
+
+		p_snprintf(timestamp, sizeof(timestamp),
+			"%"PRIu64, read_be64(buffer));
+		buffer += 8;
+
+		token = git__strdup(timestamp);
+		GITERR_CHECK_ALLOC(token);
+	} else if (version == FSMONITOR_VERSION_TOKEN) {
+		if ((nul = memchr(buffer, '\0', end - buffer)) == NULL)
+			goto invalid;
+
+		token = git__strndup(buffer, nul - buffer);
+		GITERR_CHECK_ALLOC(token);
+
+		buffer = nul + 1;
+	} else {
+		goto invalid;
+	}
+
+	if (end - buffer < 4)
+		goto invalid;
+
+	ewah_size = read_be32(buffer);
+	buffer += 4;
+
+	if (ewah_size != (size_t)(end - buffer) ||
+		git_ewah_parse(&ewah, &consumed, (const unsigned char *)buffer,
+			ewah_size) < 0 ||
+		ewah.bit_size > index->entries.length)
+		goto invalid;
+
+	if ((error = git_ewah_or(&dirty, &ewah)) < 0)
+		goto done;
+
+	set_valid(index, true);
+	git_bitmap_foreach(&dirty, clear_valid, &index->entries);
+
+	git__free(index->fsmonitor_token);
+	index->fsmonitor_token = token;
+	token = NULL;
+
+	error = 0;
+	goto done;
+
+invalid:
+	giterr_set(GITERR_INDEX, "invalid fsmonitor extension");
+	error = -1;
+
+done:
+	git_bitmap_free(&dirty);
+	git__free(token);
+	return error;
+}
+
+int git_fsmonitor__write(git_buf *out, git_index *index)
+{
+	git_bitmap dirty = GIT_BITMAP_INIT;
+	git_vector case_sorted, *entries = &index->entries;
+	git_index_entry *entry;
+	uint32_t value;
+	size_t i, ewah_start;
+	int error = 0;
+
+	assert(index->fsmonitor_token);
+
+	/* the bitmap refers to the entries in the order they are written */
+	if (index->ignore_case) {
+		if (git_vector_dup(&case_sorted, &index->entries, git_index_entry_cmp) < 0)
+			return -1;
+
+		git_vector_sort(&case_sorted);
+		entries = &case_sorted;
+	}
+
+	git_vector_foreach(entries, i, entry) {
+		if ((entry->flags_extended & GIT_IDXENTRY_FSMONITOR_VALID) == 0 &&
+			(error = git_bitmap_set(&dirty, i)) < 0)
+			goto done;
+	}
+
+	value = htonl(FSMONITOR_VERSION_TOKEN);
+	git_buf_put(out, (char *)&value, sizeof(value));
+	git_buf_put(out, index->fsmonitor_token, strlen(index->fsmonitor_token) + 1);
+
+	/* leave room for the size of the bitmap */
+	ewah_start = out->size + sizeof(value);
+	git_buf_put(out, (char *)&value, sizeof(value));
+
+	if (git_buf_oom(out) ||
+		(error = git_ewah_serialize(out, &dirty)) < 0) {
+		error = -1;
+		goto done;
+	}
+
+	value = htonl((uint32_t)(out->size - ewah_start));
+	memcpy(out->ptr + ewah_start - sizeof(value), &value, sizeof(value));
+
+done:
+	if (entries != &index->entries)
+		git_vector_free(&case_sorted);
+
+	git_bitmap_free(&dirty);
+	return error;
+}
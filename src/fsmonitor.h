@@ -0,0 +1,33 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_fsmonitor_h__
+#define INCLUDE_fsmonitor_h__
+
+#include "common.h"
+
+#include "buffer.h"
+#include "git2/index.h"
+#include "git2/sys/fsmonitor.h"
+
+/*
+ * Ask the filesystem monitor of `repo` what changed since the token of
+ * `index` and clear `GIT_IDXENTRY_FSMONITOR_VALID` on those entries.
+ * Returns 1 when the entries which keep the flag can be trusted to
+ * match the working directory, 0 when there is no monitor, or an error.
+ */
+extern int git_fsmonitor__refresh(git_index *index, git_repository *repo);
+
+/* Remember that `entry` was found to match the working directory */
+extern void git_fsmonitor__mark_valid(
+	git_index *index, const git_index_entry *entry);
+
+/* Read and write the `FSMN` index extension */
+extern int git_fsmonitor__read(
+	git_index *index, const char *buffer, size_t buffer_size);
+extern int git_fsmonitor__write(git_buf *out, git_index *index);
+
+#endif
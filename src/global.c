@@ -10,6 +10,7 @@
 #include "hash.h"
 #include "sysdir.h"
 #include "filter.h"
+#include "zstream.h"
 #include "merge_driver.h"
 #include "openssl_stream.h"
 #include "thread-utils.h"
@@ -43,8 +44,11 @@ static void git__global_state_cleanup(git_global_st *st)
 	if (!st)
 		return;
 
-	git__free(st->error_t.message);
+	git_buf_free(&st->error_buf);
 	st->error_t.message = NULL;
+
+	git_zstream__inflater_free(st->inflater);
+	st->inflater = NULL;
 }
 
 static int init_common(void)
@@ -18,6 +18,13 @@ typedef struct {
 	git_buf error_buf;
 	char oid_fmt[GIT_OID_HEXSZ+1];
 
+	/* The number of profiling regions this thread is in */
+	unsigned int profile_depth;
+
+	/* The inflate stream this thread reuses to read objects */
+	struct z_stream_s *inflater;
+	bool inflater_busy;
+
 	/* On Windows, this is the current child thread that was started by
 	 * `git_thread_create`.  This is used to set the thread's exit code
 	 * when terminated by `git_thread_exit`.  It is unused on POSIX.
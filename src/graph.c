@@ -174,6 +174,94 @@ on_error:
 	return -1;
 }
 
+/*
+ * Use the generation numbers from the commit-graph to look for `ancestor`
+ * only among the commits which could possibly reach it: a commit's
+ * generation is always larger than that of any of its parents. Returns
+ * GIT_PASSTHROUGH when either commit is not in the commit-graph.
+ */
+static int descendant_of_by_generation(
+	git_repository *repo, const git_oid *commit, const git_oid *ancestor)
+{
+	git_revwalk *walk;
+	git_commit_list_node *one, *two, *node;
+	git_commit_list *stack = NULL;
+	unsigned int i;
+	int error, found = 0;
+
+	if ((error = git_revwalk_new(&walk, repo)) < 0)
+		return error;
+
+	error = GIT_PASSTHROUGH;
+
+	if (!walk->commit_graph)
+		goto done;
+
+	one = git_revwalk__commit_lookup(walk, commit);
+	two = git_revwalk__commit_lookup(walk, ancestor);
+	if (!one || !two) {
+		error = -1;
+		goto done;
+	}
+
+	if (git_commit_list_parse(walk, one) < 0 ||
+		git_commit_list_parse(walk, two) < 0 ||
+		one->generation == GIT_COMMIT_GRAPH_GENERATION_UNKNOWN ||
+		two->generation == GIT_COMMIT_GRAPH_GENERATION_UNKNOWN) {
+		giterr_clear();
+		goto done;
+	}
+
+	if (one->generation <= two->generation) {
+		error = 0;
+		goto done;
+	}
+
+	one->seen = 1;
+	if (git_commit_list_insert(one, &stack) == NULL) {
+		error = -1;
+		goto done;
+	}
+
+	while (!found && (node = git_commit_list_pop(&stack)) != NULL) {
+		if ((error = git_commit_list_parse(walk, node)) < 0)
+			goto done;
+
+		for (i = 0; i < node->out_degree; i++) {
+			git_commit_list_node *p = node->parents[i];
+
+			if (p == two) {
+				found = 1;
+				break;
+			}
+
+			if (p->seen)
+				continue;
+			p->seen = 1;
+
+			if ((error = git_commit_list_parse(walk, p)) < 0)
+				goto done;
+
+			/* Nothing at or below the ancestor's generation can reach it */
+			if (p->generation != GIT_COMMIT_GRAPH_GENERATION_UNKNOWN &&
+				p->generation <= two->generation)
+				continue;
+
+			if (git_commit_list_insert(p, &stack) == NULL) {
+				error = -1;
+				goto done;
+			}
+		}
+	}
+
+	error = found;
+
+done:
+	git_commit_list_free(&stack);
+	git_revwalk_free(walk);
+	return error;
+}
+
 int git_graph_descendant_of(git_repository *repo, const git_oid *commit, const git_oid *ancestor)
 {
 	git_oid merge_base;
@@ -182,6 +270,9 @@ int git_graph_descendant_of(git_repository *repo, const git_oid *commit, const g
 	if (git_oid_equal(commit, ancestor))
 		return 0;
 
+	if ((error = descendant_of_by_generation(repo, commit, ancestor)) != GIT_PASSTHROUGH)
+		return error;
+
 	error = git_merge_base(&merge_base, repo, commit, ancestor);
 	/* No merge-base found, it's not a descendant */
 	if (error == GIT_ENOTFOUND)
@@ -17,6 +17,7 @@
 #define GIT_IGNORE_INTERNAL		"[internal]exclude"
 
 #define GIT_IGNORE_DEFAULT_RULES ".\n..\n.git\n"
+#define GIT_IGNORE_DEFAULT_RULE_COUNT 3
 
 /**
  * A negative ignore pattern can negate a positive one without
@@ -424,6 +425,41 @@ void git_ignore__free(git_ignores *ignores)
 	git_buf_free(&ignores->dir);
 }
 
+git_attr_file *git_ignore__dir_file(git_ignores *ign)
+{
+	git_attr_file *file = git_vector_last(&ign->ign_path);
+	const char *relpath = ign->dir.ptr + ign->dir_root, *end;
+	size_t dirlen, pathlen = ign->dir.size - ign->dir_root;
+
+	if (!file)
+		return NULL;
+
+	/* as in `git_ignore__pop_dir`, check that the last file we pushed
+	 * is the one in the directory we are looking at, since it doesn't
+	 * get pushed if it could not be loaded.
+	 */
+	end = strrchr(file->entry->path, '/');
+	dirlen = end ? (size_t)(end - file->entry->path) + 1 : 0;
+
+	if (pathlen != dirlen || memcmp(relpath, file->entry->path, dirlen))
+		return NULL;
+
+	return file;
+}
+
+void git_ignore__global_files(
+	git_attr_file **info_exclude, git_attr_file **excludes_file, git_ignores *ign)
+{
+	/* these are pushed in this order by `git_ignore__for_path` */
+	*info_exclude = git_vector_get(&ign->ign_global, 0);
+	*excludes_file = git_vector_get(&ign->ign_global, 1);
+}
+
+bool git_ignore__has_internal_rules(git_ignores *ign)
+{
+	return ign->ign_internal->rules.length > GIT_IGNORE_DEFAULT_RULE_COUNT;
+}
+
 static bool ignore_lookup_in_rules(
 	int *ignored, git_attr_file *file, git_attr_path *path)
 {
@@ -44,6 +44,18 @@ extern int git_ignore__pop_dir(git_ignores *ign);
 
 extern void git_ignore__free(git_ignores *ign);
 
+/* The ignore file of the directory pushed last, or NULL if it wasn't loaded */
+extern git_attr_file *git_ignore__dir_file(git_ignores *ign);
+
+/* The ignore files that live outside of the working directory, that is
+ * `info/exclude` and `core.excludesfile`.  Either may be NULL.
+ */
+extern void git_ignore__global_files(
+	git_attr_file **info_exclude, git_attr_file **excludes_file, git_ignores *ign);
+
+/* Whether rules were added to the defaults with `git_ignore_add_rule` */
+extern bool git_ignore__has_internal_rules(git_ignores *ign);
+
 enum {
 	GIT_IGNORE_UNCHECKED = -2,
 	GIT_IGNORE_NOTFOUND = -1,
@@ -20,6 +20,9 @@
 #include "idxmap.h"
 #include "diff.h"
 #include "varint.h"
+#include "fsmonitor.h"
+#include "trace.h"
+#include "profile.h"
 
 #include "git2/odb.h"
 #include "git2/oid.h"
@@ -69,6 +72,22 @@ static const unsigned int INDEX_HEADER_SIG = 0x44495243;
 static const char INDEX_EXT_TREECACHE_SIG[] = {'T', 'R', 'E', 'E'};
 static const char INDEX_EXT_UNMERGED_SIG[] = {'R', 'E', 'U', 'C'};
 static const char INDEX_EXT_CONFLICT_NAME_SIG[] = {'N', 'A', 'M', 'E'};
+static const char INDEX_EXT_END_OF_INDEX_ENTRY_SIG[] = {'E', 'O', 'I', 'E'};
+static const char INDEX_EXT_ENTRY_OFFSET_TABLE_SIG[] = {'I', 'E', 'O', 'T'};
+static const char INDEX_EXT_UNTRACKED_CACHE_SIG[] = {'U', 'N', 'T', 'R'};
+static const char INDEX_EXT_FSMONITOR_SIG[] = {'F', 'S', 'M', 'N'};
+
+static const uint32_t INDEX_EXT_ENTRY_OFFSET_TABLE_VERSION = 1;
+static const size_t INDEX_EXT_END_OF_INDEX_ENTRY_SIZE = 4 + GIT_OID_RAWSZ;
+
+/*
+ * Number of entries in each block of the index entry offset table. We
+ * only write the table (and the end of index entry marker pointing to
+ * it) once there are at least two blocks for readers to split up.
+ */
+#define INDEX_ENTRY_BLOCK_SIZE 10000
+
+unsigned int git_index__default_threads = 1;
 
 #define INDEX_OWNER(idx) ((git_repository *)(GIT_REFCOUNT_OWNER(idx)))
 
@@ -505,6 +524,7 @@ static int index_remove_entry(git_index *index, size_t pos)
 
 	if (entry != NULL) {
 		git_tree_cache_invalidate_path(index->tree, entry->path);
+		git_untracked_cache_invalidate_path(index->untracked, entry->path);
 		DELETE_IN_MAP(index, entry);
 	}
 
@@ -530,6 +550,12 @@ int git_index_clear(git_index *index)
 	index->tree = NULL;
 	git_pool_clear(&index->tree_pool);
 
+	git_untracked_cache_free(index->untracked);
+	index->untracked = NULL;
+
+	git__free(index->fsmonitor_token);
+	index->fsmonitor_token = NULL;
+
 	git_idxmap_clear(index->entries_map);
 	while (!error && index->entries.length > 0)
 		error = index_remove_entry(index, index->entries.length - 1);
@@ -629,6 +655,8 @@ int git_index_read(git_index *index, int force)
 	int error = 0, updated;
 	git_buf buffer = GIT_BUF_INIT;
 	git_futils_filestamp stamp = index->stamp;
+	git_profile_frame region;
+	double start;
 
 	if (!index->index_file_path)
 		return create_index_error(-1,
@@ -653,9 +681,12 @@ int git_index_read(git_index *index, int force)
 	if (!updated && !force)
 		return 0;
 
+	start = git_trace_start(GIT_TRACE_DEBUG);
+	git_profile_enter(&region, "index.read");
+
 	error = git_futils_readbuffer(&buffer, index->index_file_path);
 	if (error < 0)
-		return error;
+		goto done;
 
 	index->tree = NULL;
 	git_pool_clear(&index->tree_pool);
@@ -665,9 +696,15 @@ int git_index_read(git_index *index, int force)
 	if (!error)
 		error = parse_index(index, buffer.ptr, buffer.size);
 
-	if (!error)
+	if (!error) {
 		git_futils_filestamp_set(&index->stamp, &stamp);
+		git_trace_timed(GIT_TRACE_DEBUG, start,
+			"index: read '%s': %"PRIuZ" entries, %"PRIuZ" bytes",
+			index->index_file_path, index->entries.length, buffer.size);
+	}
 
+done:
+	git_profile_leave(&region, index->entries.length);
 	git_buf_free(&buffer);
 	return error;
 }
@@ -1304,6 +1341,9 @@ static int index_insert(
 	/* this entry is now up-to-date and should not be checked for raciness */
 	entry->flags_extended |= GIT_IDXENTRY_UPTODATE;
 
+	/* but it has not been compared to the working directory yet */
+	entry->flags_extended &= ~GIT_IDXENTRY_FSMONITOR_VALID;
+
 	git_vector_sort(&index->entries);
 
 	/* look if an entry with this path already exists, either staged, or (if
@@ -1360,6 +1400,10 @@ static int index_insert(
 		if (error == 0) {
 			INSERT_IN_MAP(index, entry, &error);
 		}
+
+		/* a new path may turn an untracked directory into a tracked one */
+		if (error == 0)
+			git_untracked_cache_invalidate_path(index->untracked, entry->path);
 	}
 
 	if (error < 0) {
@@ -2295,8 +2339,14 @@ static size_t index_entry_size(size_t path_len, size_t varint_len, uint32_t flag
 	}
 }
 
-static size_t read_entry(
+/*
+ * Read a single entry from `buffer`. For compressed (v4) indexes,
+ * `last` is the path of the previous entry, or NULL when the entry
+ * starts a block of the entry offset table and thus stands alone.
+ */
+static int read_entry(
 	git_index_entry **out,
+	size_t *out_size,
 	git_index *index,
 	const void *buffer,
 	size_t buffer_size,
@@ -2310,7 +2360,7 @@ static size_t read_entry(
 	char *tmp_path = NULL;
 
 	if (INDEX_FOOTER_SIZE + minimal_entry_size > buffer_size)
-		return 0;
+		return -1;
 
 	/* buffer is not guaranteed to be aligned */
 	memcpy(&source, buffer, sizeof(struct entry_short));
@@ -2352,7 +2402,7 @@ static size_t read_entry(
 
 			path_end = memchr(path_ptr, '\0', buffer_size);
 			if (path_end == NULL)
-				return 0;
+				return -1;
 
 			path_length = path_end - path_ptr;
 		}
@@ -2363,35 +2413,41 @@ static size_t read_entry(
 		size_t varint_len;
 		size_t strip_len = git_decode_varint((const unsigned char *)path_ptr,
 						     &varint_len);
-		size_t last_len = strlen(last);
-		size_t prefix_len = last_len - strip_len;
-		size_t suffix_len = strlen(path_ptr + varint_len);
-		size_t path_len;
+		size_t last_len = last ? strlen(last) : 0;
+		size_t prefix_len, suffix_len, path_len;
 
-		if (varint_len == 0)
+		if (varint_len == 0 || (last && strip_len > last_len))
 			return index_error_invalid("incorrect prefix length");
 
+		/* the first entry of a block does not share a prefix */
+		prefix_len = last ? last_len - strip_len : 0;
+		suffix_len = strlen(path_ptr + varint_len);
+
 		GITERR_CHECK_ALLOC_ADD(&path_len, prefix_len, suffix_len);
 		GITERR_CHECK_ALLOC_ADD(&path_len, path_len, 1);
 		tmp_path = git__malloc(path_len);
 		GITERR_CHECK_ALLOC(tmp_path);
 
-		memcpy(tmp_path, last, prefix_len);
+		if (prefix_len)
+			memcpy(tmp_path, last, prefix_len);
 		memcpy(tmp_path + prefix_len, path_ptr + varint_len, suffix_len + 1);
 		entry_size = index_entry_size(suffix_len, varint_len, entry.flags);
 		entry.path = tmp_path;
 	}
 
-	if (INDEX_FOOTER_SIZE + entry_size > buffer_size)
-		return 0;
+	if (INDEX_FOOTER_SIZE + entry_size > buffer_size) {
+		git__free(tmp_path);
+		return -1;
+	}
 
 	if (index_entry_dup(out, index, &entry) < 0) {
 		git__free(tmp_path);
-		return 0;
+		return -1;
 	}
 
 	git__free(tmp_path);
-	return entry_size;
+	*out_size = entry_size;
+	return 0;
 }
 
 static int read_header(struct index_header *dest, const void *buffer)
@@ -2439,6 +2495,14 @@ static size_t read_extension(git_index *index, const char *buffer, size_t buffer
 		} else if (memcmp(dest.signature, INDEX_EXT_CONFLICT_NAME_SIG, 4) == 0) {
 			if (read_conflict_names(index, buffer + 8, dest.extension_size) < 0)
 				return 0;
+		} else if (memcmp(dest.signature, INDEX_EXT_UNTRACKED_CACHE_SIG, 4) == 0) {
+			/* like git, carry on without the cache if we can't read it */
+			if (git_untracked_cache_read(&index->untracked,
+					buffer + 8, dest.extension_size) < 0)
+				giterr_clear();
+		} else if (memcmp(dest.signature, INDEX_EXT_FSMONITOR_SIG, 4) == 0) {
+			if (git_fsmonitor__read(index, buffer + 8, dest.extension_size) < 0)
+				giterr_clear();
 		}
 		/* else, unsupported extension. We cannot parse this, but we can skip
 		 * it by returning `total_size */
@@ -2451,6 +2515,343 @@ static size_t read_extension(git_index *index, const char *buffer, size_t buffer
 	return total_size;
 }
 
+#ifdef GIT_THREADS
+
+struct index_entry_block {
+	size_t offset;
+	size_t nr;
+	size_t first;
+};
+
+/*
+ * Look for an end of index entry extension, which has to be the last
+ * one in the file. It records where the entries end and a hash over the
+ * headers of the extensions in between, so we know we are not looking
+ * at some other extension's payload. Returns the offset of the first
+ * extension, or 0 if there is no (valid) marker.
+ */
+static size_t read_end_of_index_entry(const char *buffer, size_t buffer_size)
+{
+	struct index_extension ext;
+	const char *eoie;
+	size_t eoie_offset, extensions_offset, offset;
+	uint32_t raw_offset;
+	git_hash_ctx ctx;
+	git_oid expected, actual;
+	int error;
+
+	if (buffer_size < INDEX_HEADER_SIZE + sizeof(struct index_extension) +
+		INDEX_EXT_END_OF_INDEX_ENTRY_SIZE + INDEX_FOOTER_SIZE)
+		return 0;
+
+	eoie_offset = buffer_size - INDEX_FOOTER_SIZE -
+		INDEX_EXT_END_OF_INDEX_ENTRY_SIZE - sizeof(struct index_extension);
+	eoie = buffer + eoie_offset;
+
+	memcpy(&ext, eoie, sizeof(struct index_extension));
+	if (memcmp(ext.signature, INDEX_EXT_END_OF_INDEX_ENTRY_SIG, 4) != 0 ||
+		ntohl(ext.extension_size) != INDEX_EXT_END_OF_INDEX_ENTRY_SIZE)
+		return 0;
+
+	memcpy(&raw_offset, eoie + sizeof(struct index_extension), sizeof(raw_offset));
+	extensions_offset = ntohl(raw_offset);
+
+	if (extensions_offset < INDEX_HEADER_SIZE || extensions_offset > eoie_offset)
+		return 0;
+
+	git_oid_fromraw(&expected, (const unsigned char *)eoie +
+		sizeof(struct index_extension) + sizeof(raw_offset));
+
+	if (git_hash_ctx_init(&ctx) < 0) {
+		giterr_clear();
+		return 0;
+	}
+
+	for (offset = extensions_offset, error = 0; !error && offset < eoie_offset; ) {
+		size_t ext_size;
+
+		if (eoie_offset - offset < sizeof(struct index_extension)) {
+			error = -1;
+			break;
+		}
+
+		memcpy(&ext, buffer + offset, sizeof(struct index_extension));
+		ext_size = ntohl(ext.extension_size);
+
+		if ((error = git_hash_update(&ctx, buffer + offset,
+				sizeof(struct index_extension))) < 0 ||
+			ext_size > eoie_offset - offset - sizeof(struct index_extension))
+			error = -1;
+
+		offset += sizeof(struct index_extension) + ext_size;
+	}
+
+	if (!error)
+		error = git_hash_final(&actual, &ctx);
+
+	git_hash_ctx_cleanup(&ctx);
+
+	if (error < 0 || git_oid__cmp(&expected, &actual) != 0) {
+		giterr_clear();
+		return 0;
+	}
+
+	return extensions_offset;
+}
+
+/*
+ * Read the index entry offset table, which lives among the extensions
+ * starting at `extensions_offset`. The blocks it describes are only
+ * used if they account for every entry in order, so that parsing them
+ * separately gives the same result as parsing the index front to back.
+ */
+static int read_entry_offset_table(
+	struct index_entry_block **out,
+	size_t *out_nr,
+	const char *buffer,
+	size_t buffer_size,
+	size_t extensions_offset,
+	size_t entry_count)
+{
+	struct index_extension ext;
+	struct index_entry_block *blocks;
+	const char *data = NULL;
+	size_t offset = extensions_offset, ext_size = 0, nr, first, i;
+	uint32_t raw[2];
+
+	*out = NULL;
+	*out_nr = 0;
+
+	while (offset + sizeof(struct index_extension) <= buffer_size - INDEX_FOOTER_SIZE) {
+		memcpy(&ext, buffer + offset, sizeof(struct index_extension));
+		ext_size = ntohl(ext.extension_size);
+		offset += sizeof(struct index_extension);
+
+		if (ext_size > buffer_size - INDEX_FOOTER_SIZE - offset)
+			return 0;
+
+		if (memcmp(ext.signature, INDEX_EXT_ENTRY_OFFSET_TABLE_SIG, 4) == 0) {
+			data = buffer + offset;
+			break;
+		}
+
+		offset += ext_size;
+	}
+
+	if (!data || ext_size < sizeof(uint32_t) ||
+		(ext_size - sizeof(uint32_t)) % sizeof(raw) != 0)
+		return 0;
+
+	memcpy(&raw[0], data, sizeof(uint32_t));
+	if (ntohl(raw[0]) != INDEX_EXT_ENTRY_OFFSET_TABLE_VERSION)
+		return 0;
+
+	data += sizeof(uint32_t);
+	nr = (ext_size - sizeof(uint32_t)) / sizeof(raw);
+
+	if (nr < 2)
+		return 0;
+
+	blocks = git__mallocarray(nr, sizeof(struct index_entry_block));
+	GITERR_CHECK_ALLOC(blocks);
+
+	for (i = 0, first = 0; i < nr; i++) {
+		memcpy(raw, data + i * sizeof(raw), sizeof(raw));
+
+		blocks[i].offset = ntohl(raw[0]);
+		blocks[i].nr = ntohl(raw[1]);
+		blocks[i].first = first;
+
+		if ((i == 0 && blocks[i].offset != INDEX_HEADER_SIZE) ||
+			(i > 0 && blocks[i].offset <= blocks[i - 1].offset) ||
+			blocks[i].offset >= extensions_offset ||
+			!blocks[i].nr || blocks[i].nr > entry_count - first) {
+			git__free(blocks);
+			return 0;
+		}
+
+		first += blocks[i].nr;
+	}
+
+	if (first != entry_count) {
+		git__free(blocks);
+		return 0;
+	}
+
+	*out = blocks;
+	*out_nr = nr;
+	return 0;
+}
+
+struct parse_entries_params {
+	git_thread thread;
+	git_index *index;
+	const char *buffer;
+	size_t buffer_size;
+	size_t entries_end;
+	struct index_entry_block *blocks;
+	size_t nblocks, first_block, last_block;
+	git_index_entry **entries;
+	int error;
+};
+
+static void *threaded_parse_entries(void *payload)
+{
+	struct parse_entries_params *params = payload;
+	bool compressed = params->index->version >= INDEX_VERSION_NUMBER_COMP;
+	size_t i, j;
+
+	for (i = params->first_block; i < params->last_block; i++) {
+		struct index_entry_block *block = &params->blocks[i];
+		size_t offset = block->offset, end, entry_size;
+		const char *last = NULL;
+
+		end = (i + 1 < params->nblocks) ?
+			params->blocks[i + 1].offset : params->entries_end;
+
+		for (j = 0; j < block->nr; j++) {
+			git_index_entry *entry;
+
+			if (offset >= end ||
+				read_entry(&entry, &entry_size, params->index,
+					params->buffer + offset,
+					params->buffer_size - offset, last) < 0) {
+				params->error = -1;
+				return NULL;
+			}
+
+			params->entries[block->first + j] = entry;
+			offset += entry_size;
+
+			if (compressed)
+				last = entry->path;
+		}
+
+		if (offset != end) {
+			params->error = -1;
+			return NULL;
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Parse the entries on several threads if the index tells us where its
+ * blocks of entries start. The entries are inserted into the map on the
+ * calling thread, which computes the file's checksum in the meantime.
+ * Sets `entries_end` to 0 when the entries need to be parsed serially.
+ */
+static int parse_entries_threaded(
+	size_t *entries_end,
+	git_oid *checksum,
+	git_index *index,
+	const char *buffer,
+	size_t buffer_size,
+	size_t entry_count)
+{
+	struct parse_entries_params *params = NULL;
+	struct index_entry_block *blocks = NULL;
+	git_index_entry **entries = NULL;
+	git_repository *repo = INDEX_OWNER(index);
+	size_t extensions_offset, nblocks, nthreads, started = 0, i;
+	unsigned int nr_threads = git_index__default_threads;
+	int protect, error = 0;
+
+	*entries_end = 0;
+
+	if (!nr_threads)
+		nr_threads = git_online_cpus();
+
+	if (nr_threads < 2 ||
+		(extensions_offset = read_end_of_index_entry(buffer, buffer_size)) == 0)
+		return 0;
+
+	if ((error = read_entry_offset_table(&blocks, &nblocks,
+			buffer, buffer_size, extensions_offset, entry_count)) < 0 || !blocks)
+		return error;
+
+	/*
+	 * Validating paths looks up configuration of the repository, which
+	 * must not be loaded from the workers. Make sure it's cached.
+	 */
+	if (repo &&
+		(git_repository__cvar(&protect, repo, GIT_CVAR_PROTECTHFS) < 0 ||
+		 git_repository__cvar(&protect, repo, GIT_CVAR_PROTECTNTFS) < 0)) {
+		giterr_clear();
+		goto done;
+	}
+
+	nthreads = min(nr_threads, nblocks);
+
+	entries = git__calloc(entry_count, sizeof(git_index_entry *));
+	params = git__calloc(nthreads, sizeof(struct parse_entries_params));
+
+	if (!entries || !params) {
+		giterr_set_oom();
+		error = -1;
+		goto done;
+	}
+
+	for (i = 0; i < nthreads; i++) {
+		params[i].index = index;
+		params[i].buffer = buffer;
+		params[i].buffer_size = buffer_size;
+		params[i].entries_end = extensions_offset;
+		params[i].blocks = blocks;
+		params[i].nblocks = nblocks;
+		params[i].first_block = nblocks * i / nthreads;
+		params[i].last_block = nblocks * (i + 1) / nthreads;
+		params[i].entries = entries;
+
+		if (git_thread_create(&params[i].thread, threaded_parse_entries, &params[i])) {
+			giterr_set(GITERR_THREAD, "unable to create thread");
+			error = -1;
+			break;
+		}
+
+		started++;
+	}
+
+	git_hash_buf(checksum, buffer, buffer_size - INDEX_FOOTER_SIZE);
+
+	for (i = 0; i < started; i++) {
+		git_thread_join(&params[i].thread, NULL);
+
+		if (!error && params[i].error < 0)
+			error = index_error_invalid("invalid entry");
+	}
+
+	for (i = 0; !error && i < entry_count; i++) {
+		if ((error = git_vector_insert(&index->entries, entries[i])) < 0)
+			break;
+
+		INSERT_IN_MAP(index, entries[i], &error);
+
+		if (error < 0) {
+			git_vector_pop(&index->entries);
+			break;
+		}
+
+		entries[i] = NULL;
+		error = 0;
+	}
+
+	if (!error)
+		*entries_end = extensions_offset;
+
+	for (i = 0; i < entry_count; i++)
+		index_entry_free(entries[i]);
+
+done:
+	git__free(params);
+	git__free(entries);
+	git__free(blocks);
+	return error;
+}
+
+#endif
+
 static int parse_index(git_index *index, const char *buffer, size_t buffer_size)
 {
 	int error = 0;
@@ -2459,6 +2860,11 @@ static int parse_index(git_index *index, const char *buffer, size_t buffer_size)
 	git_oid checksum_calculated, checksum_expected;
 	const char *last = NULL;
 	const char *empty = "";
+	const char *index_start = buffer;
+	size_t index_size = buffer_size;
+#ifdef GIT_THREADS
+	size_t entries_end;
+#endif
 
 #define seek_forward(_increase) { \
 	if (_increase >= buffer_size) { \
@@ -2471,10 +2877,6 @@ static int parse_index(git_index *index, const char *buffer, size_t buffer_size)
 	if (buffer_size < INDEX_HEADER_SIZE + INDEX_FOOTER_SIZE)
 		return index_error_invalid("insufficient buffer space");
 
-	/* Precalculate the SHA1 of the files's contents -- we'll match it to
-	 * the provided SHA1 in the footer */
-	git_hash_buf(&checksum_calculated, buffer, buffer_size - INDEX_FOOTER_SIZE);
-
 	/* Parse header */
 	if ((error = read_header(&header, buffer)) < 0)
 		return error;
@@ -2492,13 +2894,27 @@ static int parse_index(git_index *index, const char *buffer, size_t buffer_size)
 	else
 		git_idxmap_resize(index->entries_map, header.entry_count);
 
+#ifdef GIT_THREADS
+	if ((error = parse_entries_threaded(&entries_end, &checksum_calculated,
+			index, index_start, index_size, header.entry_count)) < 0)
+		goto done;
+
+	if (entries_end) {
+		seek_forward(entries_end - INDEX_HEADER_SIZE);
+		goto extensions;
+	}
+#endif
+
+	/* Precalculate the SHA1 of the files's contents -- we'll match it to
+	 * the provided SHA1 in the footer */
+	git_hash_buf(&checksum_calculated, index_start, index_size - INDEX_FOOTER_SIZE);
+
 	/* Parse all the entries */
 	for (i = 0; i < header.entry_count && buffer_size > INDEX_FOOTER_SIZE; ++i) {
 		git_index_entry *entry;
-		size_t entry_size = read_entry(&entry, index, buffer, buffer_size, last);
+		size_t entry_size;
 
-		/* 0 bytes read means an object corruption */
-		if (entry_size == 0) {
+		if (read_entry(&entry, &entry_size, index, buffer, buffer_size, last) < 0) {
 			error = index_error_invalid("invalid entry");
 			goto done;
 		}
@@ -2527,6 +2943,9 @@ static int parse_index(git_index *index, const char *buffer, size_t buffer_size)
 		goto done;
 	}
 
+#ifdef GIT_THREADS
+extensions:
+#endif
 	/* There's still space for some extensions! */
 	while (buffer_size > INDEX_FOOTER_SIZE) {
 		size_t extension_size;
@@ -2589,7 +3008,17 @@ static bool is_index_extended(git_index *index)
 	return (extended > 0);
 }
 
-static int write_disk_entry(git_filebuf *file, git_index_entry *entry, const char *last)
+/*
+ * Write a single entry. For compressed (v4) indexes, `last` is the
+ * path the entry may share a prefix with and `last_len` the length of
+ * the previous path, which is what readers strip the prefix from.
+ */
+static int write_disk_entry(
+	size_t *out_size,
+	git_filebuf *file,
+	git_index_entry *entry,
+	const char *last,
+	size_t last_len)
 {
 	void *mem = NULL;
 	struct entry_short *ondisk;
@@ -2612,7 +3041,7 @@ static int write_disk_entry(git_filebuf *file, git_index_entry *entry, const cha
 			++same_len;
 		}
 		path_len -= same_len;
-		varint_len = git_encode_varint(NULL, 0, same_len);
+		varint_len = git_encode_varint(NULL, 0, last_len - same_len);
 	}
 
 	disk_size = index_entry_size(path_len, varint_len, entry->flags);
@@ -2620,6 +3049,7 @@ static int write_disk_entry(git_filebuf *file, git_index_entry *entry, const cha
 	if (git_filebuf_reserve(file, &mem, disk_size) < 0)
 		return -1;
 
+	*out_size = disk_size;
 	ondisk = (struct entry_short *)mem;
 
 	memset(ondisk, 0x0, disk_size);
@@ -2663,7 +3093,7 @@ static int write_disk_entry(git_filebuf *file, git_index_entry *entry, const cha
 
 	if (last) {
 		varint_len = git_encode_varint((unsigned char *) path,
-					  disk_size, same_len);
+					  disk_size, last_len - same_len);
 		assert(varint_len > 0);
 		path += varint_len;
 		disk_size -= varint_len;
@@ -2687,13 +3117,23 @@ static int write_disk_entry(git_filebuf *file, git_index_entry *entry, const cha
 	return 0;
 }
 
-static int write_entries(git_index *index, git_filebuf *file)
+/*
+ * Write all entries and return the offset at which they end. If an
+ * `offset_table` is given, the entries are split into blocks which
+ * can be parsed independently, and the blocks are added to the table.
+ */
+static int write_entries(
+	size_t *entries_end,
+	git_index *index,
+	git_filebuf *file,
+	git_buf *offset_table)
 {
 	int error = 0;
-	size_t i;
+	size_t i, entry_size, last_len = 0, offset = INDEX_HEADER_SIZE;
 	git_vector case_sorted, *entries;
 	git_index_entry *entry;
 	const char *last = NULL;
+	bool compressed = index->version >= INDEX_VERSION_NUMBER_COMP;
 
 	/* If index->entries is sorted case-insensitively, then we need
 	 * to re-sort it case-sensitively before writing */
@@ -2705,23 +3145,54 @@ static int write_entries(git_index *index, git_filebuf *file)
 		entries = &index->entries;
 	}
 
-	if (index->version >= INDEX_VERSION_NUMBER_COMP)
+	if (compressed)
 		last = "";
 
 	git_vector_foreach(entries, i, entry) {
-		if ((error = write_disk_entry(file, entry, last)) < 0)
+		if (offset_table && (i % INDEX_ENTRY_BLOCK_SIZE) == 0) {
+			uint32_t block[2];
+
+			block[0] = htonl((uint32_t)offset);
+			block[1] = htonl((uint32_t)min(entries->length - i, INDEX_ENTRY_BLOCK_SIZE));
+
+			if ((error = git_buf_put(offset_table, (char *)block, sizeof(block))) < 0)
+				break;
+
+			/*
+			 * Don't share a prefix with the previous block, but
+			 * still strip all of its path for serial readers.
+			 */
+			if (compressed)
+				last = "";
+		}
+
+		if ((error = write_disk_entry(&entry_size, file, entry, last, last_len)) < 0)
 			break;
-		if (index->version >= INDEX_VERSION_NUMBER_COMP)
+
+		offset += entry_size;
+
+		if (compressed) {
 			last = entry->path;
+			last_len = ((struct entry_internal *)entry)->pathlen;
+		}
 	}
 
 	if (index->ignore_case)
 		git_vector_free(&case_sorted);
 
+	*entries_end = offset;
 	return error;
 }
 
-static int write_extension(git_filebuf *file, struct index_extension *header, git_buf *data)
+/*
+ * Write an extension; if `eoie` is given, its header is added to the
+ * hash which goes into the end of index entry extension.
+ */
+static int write_extension(
+	git_filebuf *file,
+	git_hash_ctx *eoie,
+	struct index_extension *header,
+	git_buf *data)
 {
 	struct index_extension ondisk;
 
@@ -2729,6 +3200,9 @@ static int write_extension(git_filebuf *file, struct index_extension *header, gi
 	memcpy(&ondisk, header, 4);
 	ondisk.extension_size = htonl(header->extension_size);
 
+	if (eoie && git_hash_update(eoie, &ondisk, sizeof(struct index_extension)) < 0)
+		return -1;
+
 	git_filebuf_write(file, &ondisk, sizeof(struct index_extension));
 	return git_filebuf_write(file, data->ptr, data->size);
 }
@@ -2762,7 +3236,7 @@ on_error:
 	return error;
 }
 
-static int write_name_extension(git_index *index, git_filebuf *file)
+static int write_name_extension(git_index *index, git_filebuf *file, git_hash_ctx *eoie)
 {
 	git_buf name_buf = GIT_BUF_INIT;
 	git_vector *out = &index->names;
@@ -2780,7 +3254,7 @@ static int write_name_extension(git_index *index, git_filebuf *file)
 	memcpy(&extension.signature, INDEX_EXT_CONFLICT_NAME_SIG, 4);
 	extension.extension_size = (uint32_t)name_buf.size;
 
-	error = write_extension(file, &extension, &name_buf);
+	error = write_extension(file, eoie, &extension, &name_buf);
 
 	git_buf_free(&name_buf);
 
@@ -2810,7 +3284,7 @@ static int create_reuc_extension_data(git_buf *reuc_buf, git_index_reuc_entry *r
 	return 0;
 }
 
-static int write_reuc_extension(git_index *index, git_filebuf *file)
+static int write_reuc_extension(git_index *index, git_filebuf *file, git_hash_ctx *eoie)
 {
 	git_buf reuc_buf = GIT_BUF_INIT;
 	git_vector *out = &index->reuc;
@@ -2828,7 +3302,7 @@ static int write_reuc_extension(git_index *index, git_filebuf *file)
 	memcpy(&extension.signature, INDEX_EXT_UNMERGED_SIG, 4);
 	extension.extension_size = (uint32_t)reuc_buf.size;
 
-	error = write_extension(file, &extension, &reuc_buf);
+	error = write_extension(file, eoie, &extension, &reuc_buf);
 
 	git_buf_free(&reuc_buf);
 
@@ -2836,7 +3310,7 @@ done:
 	return error;
 }
 
-static int write_tree_extension(git_index *index, git_filebuf *file)
+static int write_tree_extension(git_index *index, git_filebuf *file, git_hash_ctx *eoie)
 {
 	struct index_extension extension;
 	git_buf buf = GIT_BUF_INIT;
@@ -2852,13 +3326,90 @@ static int write_tree_extension(git_index *index, git_filebuf *file)
 	memcpy(&extension.signature, INDEX_EXT_TREECACHE_SIG, 4);
 	extension.extension_size = (uint32_t)buf.size;
 
-	error = write_extension(file, &extension, &buf);
+	error = write_extension(file, eoie, &extension, &buf);
 
 	git_buf_free(&buf);
 
 	return error;
 }
 
+static int write_untracked_extension(git_index *index, git_filebuf *file, git_hash_ctx *eoie)
+{
+	struct index_extension extension;
+	git_buf buf = GIT_BUF_INIT;
+	int error;
+
+	if ((error = git_untracked_cache_write(&buf, index->untracked)) < 0)
+		return error;
+
+	memset(&extension, 0x0, sizeof(struct index_extension));
+	memcpy(&extension.signature, INDEX_EXT_UNTRACKED_CACHE_SIG, 4);
+	extension.extension_size = (uint32_t)buf.size;
+
+	error = write_extension(file, eoie, &extension, &buf);
+
+	git_buf_free(&buf);
+
+	return error;
+}
+
+static int write_fsmonitor_extension(git_index *index, git_filebuf *file, git_hash_ctx *eoie)
+{
+	struct index_extension extension;
+	git_buf buf = GIT_BUF_INIT;
+	int error;
+
+	if ((error = git_fsmonitor__write(&buf, index)) < 0)
+		return error;
+
+	memset(&extension, 0x0, sizeof(struct index_extension));
+	memcpy(&extension.signature, INDEX_EXT_FSMONITOR_SIG, 4);
+	extension.extension_size = (uint32_t)buf.size;
+
+	error = write_extension(file, eoie, &extension, &buf);
+
+	git_buf_free(&buf);
+
+	return error;
+}
+
+static int write_entry_offset_table_extension(
+	git_filebuf *file, git_hash_ctx *eoie, git_buf *offset_table)
+{
+	struct index_extension extension;
+
+	memset(&extension, 0x0, sizeof(struct index_extension));
+	memcpy(&extension.signature, INDEX_EXT_ENTRY_OFFSET_TABLE_SIG, 4);
+	extension.extension_size = (uint32_t)offset_table->size;
+
+	return write_extension(file, eoie, &extension, offset_table);
+}
+
+static int write_end_of_index_entry_extension(
+	git_filebuf *file, git_hash_ctx *eoie, size_t entries_end)
+{
+	struct index_extension extension;
+	git_buf buf = GIT_BUF_INIT;
+	uint32_t offset = htonl((uint32_t)entries_end);
+	git_oid hash;
+	int error;
+
+	if ((error = git_hash_final(&hash, eoie)) < 0 ||
+		(error = git_buf_put(&buf, (char *)&offset, sizeof(offset))) < 0 ||
+		(error = git_buf_put(&buf, (char *)hash.id, GIT_OID_RAWSZ)) < 0)
+		goto done;
+
+	memset(&extension, 0x0, sizeof(struct index_extension));
+	memcpy(&extension.signature, INDEX_EXT_END_OF_INDEX_ENTRY_SIG, 4);
+	extension.extension_size = (uint32_t)INDEX_EXT_END_OF_INDEX_ENTRY_SIZE;
+
+	error = write_extension(file, NULL, &extension, &buf);
+
+done:
+	git_buf_free(&buf);
+	return error;
+}
+
 static void clear_uptodate(git_index *index)
 {
 	git_index_entry *entry;
@@ -2872,8 +3423,12 @@ static int write_index(git_oid *checksum, git_index *index, git_filebuf *file)
 {
 	git_oid hash_final;
 	struct index_header header;
-	bool is_extended;
+	bool is_extended, write_offsets;
 	uint32_t index_version_number;
+	git_buf offset_table = GIT_BUF_INIT;
+	git_hash_ctx eoie_ctx, *eoie = NULL;
+	size_t entries_end;
+	int error = -1;
 
 	assert(index && file);
 
@@ -2888,23 +3443,57 @@ static int write_index(git_oid *checksum, git_index *index, git_filebuf *file)
 	header.version = htonl(index_version_number);
 	header.entry_count = htonl((uint32_t)index->entries.length);
 
+	/*
+	 * Large indexes get an entry offset table so their entries can be
+	 * parsed on several threads, and an end of index entry marker so
+	 * readers can find the table without going through the entries.
+	 */
+	write_offsets = index->entries.length >= 2 * INDEX_ENTRY_BLOCK_SIZE;
+
+	if (write_offsets) {
+		uint32_t version = htonl(INDEX_EXT_ENTRY_OFFSET_TABLE_VERSION);
+
+		if (git_hash_ctx_init(&eoie_ctx) < 0)
+			return -1;
+		eoie = &eoie_ctx;
+
+		if (git_buf_put(&offset_table, (char *)&version, sizeof(version)) < 0)
+			goto done;
+	}
+
 	if (git_filebuf_write(file, &header, sizeof(struct index_header)) < 0)
-		return -1;
+		goto done;
 
-	if (write_entries(index, file) < 0)
-		return -1;
+	if (write_entries(&entries_end, index, file, eoie ? &offset_table : NULL) < 0)
+		goto done;
+
+	/* write the entry offset table first, it's needed to read the entries */
+	if (eoie && write_entry_offset_table_extension(file, eoie, &offset_table) < 0)
+		goto done;
 
 	/* write the tree cache extension */
-	if (index->tree != NULL && write_tree_extension(index, file) < 0)
-		return -1;
+	if (index->tree != NULL && write_tree_extension(index, file, eoie) < 0)
+		goto done;
 
 	/* write the rename conflict extension */
-	if (index->names.length > 0 && write_name_extension(index, file) < 0)
-		return -1;
+	if (index->names.length > 0 && write_name_extension(index, file, eoie) < 0)
+		goto done;
 
 	/* write the reuc extension */
-	if (index->reuc.length > 0 && write_reuc_extension(index, file) < 0)
-		return -1;
+	if (index->reuc.length > 0 && write_reuc_extension(index, file, eoie) < 0)
+		goto done;
+
+	/* write the untracked cache extension */
+	if (index->untracked != NULL && write_untracked_extension(index, file, eoie) < 0)
+		goto done;
+
+	/* write the filesystem monitor extension */
+	if (index->fsmonitor_token != NULL && write_fsmonitor_extension(index, file, eoie) < 0)
+		goto done;
+
+	/* the end of index entry extension has to come last */
+	if (eoie && write_end_of_index_entry_extension(file, eoie, entries_end) < 0)
+		goto done;
 
 	/* get out the hash for all the contents we've appended to the file */
 	git_filebuf_hash(&hash_final, file);
@@ -2912,12 +3501,18 @@ static int write_index(git_oid *checksum, git_index *index, git_filebuf *file)
 
 	/* write it at the end of the file */
 	if (git_filebuf_write(file, hash_final.id, GIT_OID_RAWSZ) < 0)
-		return -1;
+		goto done;
 
 	/* file entries are no longer up to date */
 	clear_uptodate(index);
+	error = 0;
 
-	return 0;
+done:
+	if (eoie) {
+		git_hash_ctx_cleanup(eoie);
+	}
+	git_buf_free(&offset_table);
+	return error;
 }
 
 int git_index_entry_stage(const git_index_entry *entry)
@@ -3003,6 +3598,8 @@ int git_index_read_tree(git_index *index, const git_tree *tree)
 	index->tree = NULL;
 	git_pool_clear(&index->tree_pool);
 
+	git_untracked_cache_clear(index->untracked);
+
 	git_vector_sort(&index->entries);
 
 	if ((error = git_tree_walk(tree, GIT_TREEWALK_POST, read_tree_cb, &data)) < 0)
@@ -3131,6 +3728,9 @@ static int git_index_read_iterator(
 		if (dup_entry && !remove_entry && index->tree)
 			git_tree_cache_invalidate_path(index->tree, dup_entry->path);
 
+		if (dup_entry && !remove_entry)
+			git_untracked_cache_invalidate_path(index->untracked, dup_entry->path);
+
 		if (add_entry) {
 			if ((error = git_vector_insert(&new_entries, add_entry)) == 0)
 				INSERT_IN_MAP_EX(index, new_entries_map, add_entry, &error);
@@ -3167,6 +3767,8 @@ static int git_index_read_iterator(
 		if (index->tree)
 			git_tree_cache_invalidate_path(index->tree, entry->path);
 
+		git_untracked_cache_invalidate_path(index->untracked, entry->path);
+
 		index_entry_free(entry);
 	}
 
@@ -3543,14 +4145,22 @@ int git_indexwriter_commit(git_indexwriter *writer)
 {
 	int error;
 	git_oid checksum = {{ 0 }};
+	git_profile_frame region;
+	double start;
 
 	if (!writer->should_write)
 		return 0;
 
+	start = git_trace_start(GIT_TRACE_DEBUG);
+
 	git_vector_sort(&writer->index->entries);
 	git_vector_sort(&writer->index->reuc);
 
-	if ((error = write_index(&checksum, writer->index, &writer->file)) < 0) {
+	git_profile_enter(&region, "index.write");
+	error = write_index(&checksum, writer->index, &writer->file);
+	git_profile_leave(&region, writer->index->entries.length);
+
+	if (error < 0) {
 		git_indexwriter_cleanup(writer);
 		return error;
 	}
@@ -3567,6 +4177,15 @@ int git_indexwriter_commit(git_indexwriter *writer)
 	writer->index->on_disk = 1;
 	git_oid_cpy(&writer->index->checksum, &checksum);
 
+	if (writer->index->untracked)
+		writer->index->untracked->dirty = 0;
+
+	writer->index->fsmonitor_dirty = 0;
+
+	git_trace_timed(GIT_TRACE_DEBUG, start,
+		"index: wrote '%s': %"PRIuZ" entries",
+		writer->index->index_file_path, writer->index->entries.length);
+
 	git_index_free(writer->index);
 	writer->index = NULL;
 
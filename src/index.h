@@ -14,6 +14,7 @@
 #include "vector.h"
 #include "idxmap.h"
 #include "tree-cache.h"
+#include "untracked-cache.h"
 #include "git2/odb.h"
 #include "git2/index.h"
 
@@ -41,6 +42,11 @@ struct git_index {
 	git_tree_cache *tree;
 	git_pool tree_pool;
 
+	git_untracked_cache *untracked;
+
+	char *fsmonitor_token;
+	unsigned int fsmonitor_dirty:1;
+
 	git_vector names;
 	git_vector reuc;
 
@@ -120,6 +126,9 @@ extern int git_index__fill(git_index *index, const git_vector *source_entries);
 
 extern void git_index__set_ignore_case(git_index *index, bool ignore_case);
 
+/* Number of threads used to parse index entries; 0 means one per CPU */
+extern unsigned int git_index__default_threads;
+
 extern unsigned int git_index__create_mode(unsigned int mode);
 
 GIT_INLINE(const git_futils_filestamp *) git_index__filestamp(git_index *index)
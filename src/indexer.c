@@ -19,11 +19,15 @@
 #include "oidmap.h"
 #include "zstream.h"
 #include "object.h"
-
-extern git_mutex git__mwindow_mutex;
+#include "offmap.h"
+#include "thread-utils.h"
+#include "profile.h"
 
 #define UINT31_MAX (0x7FFFFFFF)
 
+/* Default number of threads for resolving deltas, see GIT_OPT_SET_INDEXER_THREADS */
+unsigned int git_indexer__default_threads = 1;
+
 struct entry {
 	git_oid oid;
 	uint32_t crc;
@@ -51,6 +55,7 @@ struct git_indexer {
 	git_oid hash;
 	git_transfer_progress_cb progress_cb;
 	void *progress_payload;
+	unsigned int nr_threads;
 	char objbuf[8*1024];
 
 	/* Needed to look up objects which we want to inject to fix a thin pack */
@@ -64,6 +69,7 @@ struct git_indexer {
 
 struct delta_info {
 	git_off_t delta_off;
+	git_off_t delta_end;
 };
 
 const git_oid *git_indexer_hash(const git_indexer *idx)
@@ -123,6 +129,7 @@ int git_indexer_new(
 	idx->progress_cb = progress_cb;
 	idx->progress_payload = progress_payload;
 	idx->mode = mode ? mode : GIT_PACK_FILE_MODE;
+	idx->nr_threads = git_indexer__default_threads;
 	git_hash_ctx_init(&idx->hash_ctx);
 	git_hash_ctx_init(&idx->trailer);
 
@@ -144,6 +151,9 @@ int git_indexer_new(
 	if (error < 0)
 		goto cleanup;
 
+	/* the pack is written and then read from front to back */
+	idx->pack->mwf.advice = GIT_MADV_SEQUENTIAL;
+
 	idx->pack->mwf.fd = fd;
 	if ((error = git_mwindow_file_register(&idx->pack->mwf)) < 0)
 		goto cleanup;
@@ -172,6 +182,20 @@ void git_indexer__set_fsync(git_indexer *idx, int do_fsync)
 	idx->do_fsync = !!do_fsync;
 }
 
+unsigned int git_indexer_set_threads(git_indexer *idx, unsigned int n)
+{
+	assert(idx);
+
+#ifdef GIT_THREADS
+	idx->nr_threads = n;
+#else
+	GIT_UNUSED(n);
+	assert(1 == idx->nr_threads);
+#endif
+
+	return idx->nr_threads;
+}
+
 /* Try to store the delta so we can try to resolve it later */
 static int store_delta(git_indexer *idx)
 {
@@ -180,6 +204,7 @@ static int store_delta(git_indexer *idx)
 	delta = git__calloc(1, sizeof(struct delta_info));
 	GITERR_CHECK_ALLOC(delta);
 	delta->delta_off = idx->entry_start;
+	delta->delta_end = idx->off;
 
 	if (git_vector_insert(&idx->deltas, delta) < 0)
 		return -1;
@@ -841,12 +866,408 @@ static int fix_thin_pack(git_indexer *idx, git_transfer_progress *stats)
 	return 0;
 }
 
+#ifdef GIT_THREADS
+
+/* Upper bound on the number of deltas of one chain handed out at once */
+#define RESOLVE_BATCH_SIZE 64
+
+/*
+ * A delta scheduled for resolution by the worker threads. The workers
+ * only ever read from the pack and fill in the result fields here; the
+ * main thread takes care of storing the results in the indexer.
+ */
+struct delta_work {
+	size_t pos; /* position in idx->deltas */
+	git_off_t delta_off;
+	git_off_t delta_end;
+	git_off_t chain_base; /* offset of the object the chain is based on */
+	git_oid oid;
+	uint32_t crc;
+	unsigned int resolved :1;
+};
+
+struct resolve_params {
+	git_indexer *idx;
+	struct delta_work *work;
+
+	/* start of each batch in `work`, followed by the end of the list */
+	size_t *batches;
+	size_t nbatches;
+	git_atomic next_batch;
+
+	git_mutex mutex;
+	git_cond cond;
+	size_t resolved;
+	size_t active_threads;
+	int cancelled;
+};
+
+static int delta_work_cmp(const void *a, const void *b, void *payload)
+{
+	const struct delta_work *wa = a, *wb = b;
+
+	GIT_UNUSED(payload);
+
+	if (wa->chain_base != wb->chain_base)
+		return wa->chain_base < wb->chain_base ? -1 : 1;
+	if (wa->delta_off != wb->delta_off)
+		return wa->delta_off < wb->delta_off ? -1 : 1;
+	return 0;
+}
+
+/*
+ * Figure out which object each pending delta is ultimately based on,
+ * so that we can hand whole chains to the same thread and have it hit
+ * the delta base cache instead of inflating the bases over and over.
+ * `work` must be sorted by offset, so that the bases of OFS deltas
+ * (which always come earlier in the pack) have been looked at first.
+ */
+static int find_chain_bases(git_indexer *idx, struct delta_work *work, size_t nwork)
+{
+	git_offmap *pending;
+	git_mwindow *w = NULL;
+	size_t i, size;
+	khiter_t k;
+	int error = 0;
+
+	pending = git_offmap_alloc();
+	GITERR_CHECK_ALLOC(pending);
+
+	for (i = 0; i < nwork; i++) {
+		git_offmap_insert(pending, work[i].delta_off, &work[i], &error);
+		if (error < 0) {
+			giterr_set_oom();
+			goto cleanup;
+		}
+	}
+
+	error = 0;
+
+	for (i = 0; i < nwork; i++) {
+		git_off_t curpos = work[i].delta_off, base_off;
+		git_otype type;
+
+		work[i].chain_base = work[i].delta_off;
+
+		if (git_packfile_unpack_header(&size, &type, &idx->pack->mwf, &w, &curpos) < 0) {
+			giterr_clear();
+			continue;
+		}
+
+		base_off = get_delta_base(idx->pack, &w, &curpos, type, work[i].delta_off);
+		git_mwindow_close(&w);
+
+		/* unknown bases get reported when we try to unpack the delta */
+		if (base_off <= 0) {
+			giterr_clear();
+			continue;
+		}
+
+		k = git_offmap_lookup_index(pending, base_off);
+		if (git_offmap_valid_index(pending, k))
+			work[i].chain_base = ((struct delta_work *)git_offmap_value_at(pending, k))->chain_base;
+		else
+			work[i].chain_base = base_off;
+	}
+
+cleanup:
+	git_offmap_free(pending);
+	return error;
+}
+
+static int resolve_delta(git_indexer *idx, struct delta_work *work)
+{
+	git_rawobj obj = {NULL};
+	git_off_t curpos = work->delta_off;
+	int error;
+
+	if ((error = git_packfile_unpack(&obj, idx->pack, &curpos)) < 0)
+		return error;
+
+	/*
+	 * Don't trust `curpos` for the size of the entry, as it's left
+	 * untouched when the object itself comes from the delta base
+	 * cache, which happens when another thread resolved a delta
+	 * based on it first.
+	 */
+	if ((error = git_odb__hashobj(&work->oid, &obj)) == 0)
+		error = crc_object(&work->crc, &idx->pack->mwf,
+			work->delta_off, work->delta_end - work->delta_off);
+
+	git__free(obj.data);
+
+	if (!error)
+		work->resolved = 1;
+
+	return error;
+}
+
+static void *threaded_resolve_deltas(void *arg)
+{
+	struct resolve_params *params = arg;
+	size_t batch, i;
+	int cancelled = 0;
+
+	while (!cancelled &&
+	       (batch = (size_t)git_atomic_inc(&params->next_batch) - 1) < params->nbatches) {
+		for (i = params->batches[batch]; i < params->batches[batch + 1]; i++) {
+			/* failures are retried in the next round, just like the serial code */
+			int resolved = !resolve_delta(params->idx, &params->work[i]);
+
+			if (!resolved)
+				giterr_clear();
+
+			git_mutex_lock(&params->mutex);
+			params->resolved += resolved;
+			cancelled = params->cancelled;
+			git_cond_signal(&params->cond);
+			git_mutex_unlock(&params->mutex);
+
+			if (cancelled)
+				break;
+		}
+	}
+
+	git_mutex_lock(&params->mutex);
+	params->active_threads--;
+	git_cond_signal(&params->cond);
+	git_mutex_unlock(&params->mutex);
+
+	return NULL;
+}
+
+static int prepare_delta_work(
+	struct resolve_params *params,
+	size_t *nwork_out,
+	git_indexer *idx)
+{
+	struct delta_work *work;
+	struct delta_info *delta;
+	size_t i, nwork = 0, nbatches = 0, batch_len = 0;
+
+	git_vector_foreach(&idx->deltas, i, delta) {
+		if (delta)
+			nwork++;
+	}
+
+	*nwork_out = nwork;
+	if (!nwork)
+		return 0;
+
+	params->work = work = git__calloc(nwork, sizeof(struct delta_work));
+	GITERR_CHECK_ALLOC(work);
+
+	params->batches = git__mallocarray(nwork + 1, sizeof(size_t));
+	GITERR_CHECK_ALLOC(params->batches);
+
+	nwork = 0;
+	git_vector_foreach(&idx->deltas, i, delta) {
+		if (!delta)
+			continue;
+
+		work[nwork].pos = i;
+		work[nwork].delta_off = delta->delta_off;
+		work[nwork].delta_end = delta->delta_end;
+		nwork++;
+	}
+
+	if (find_chain_bases(idx, work, nwork) < 0)
+		return -1;
+
+	git__qsort_r(work, nwork, sizeof(struct delta_work), delta_work_cmp, NULL);
+
+	for (i = 0; i < nwork; i++, batch_len++) {
+		if (i == 0 || batch_len == RESOLVE_BATCH_SIZE ||
+		    work[i].chain_base != work[i - 1].chain_base) {
+			params->batches[nbatches++] = i;
+			batch_len = 0;
+		}
+	}
+
+	params->batches[nbatches] = nwork;
+	params->nbatches = nbatches;
+
+	return 0;
+}
+
+/*
+ * Store the deltas which the workers managed to resolve and take them
+ * off the list of pending deltas.
+ */
+static int save_resolved_deltas(
+	size_t *saved_out,
+	git_indexer *idx,
+	struct delta_work *work,
+	size_t nwork)
+{
+	struct entry *entry;
+	struct git_pack_entry *pentry;
+	size_t i, saved = 0;
+
+	for (i = 0; i < nwork; i++) {
+		if (!work[i].resolved)
+			continue;
+
+		entry = git__calloc(1, sizeof(*entry));
+		GITERR_CHECK_ALLOC(entry);
+
+		pentry = git__calloc(1, sizeof(struct git_pack_entry));
+		if (!pentry) {
+			git__free(entry);
+			return -1;
+		}
+
+		git_oid_cpy(&entry->oid, &work[i].oid);
+		git_oid_cpy(&pentry->sha1, &work[i].oid);
+		entry->crc = work[i].crc;
+
+		if (save_entry(idx, entry, pentry, work[i].delta_off) < 0) {
+			git__free(pentry);
+			git__free(entry);
+			return -1;
+		}
+
+		git__free(git_vector_get(&idx->deltas, work[i].pos));
+		git_vector_set(NULL, &idx->deltas, work[i].pos, NULL);
+		saved++;
+	}
+
+	*saved_out = saved;
+	return 0;
+}
+
+/*
+ * Run one pass over the pending deltas on the worker threads. Deltas
+ * whose bases we haven't seen yet (REF deltas against other deltas)
+ * fail to resolve and are left for the next pass.
+ */
+static int resolve_deltas_round(
+	size_t *pending_out,
+	size_t *saved_out,
+	git_indexer *idx,
+	git_thread *threads,
+	git_transfer_progress *stats)
+{
+	struct resolve_params params;
+	unsigned int indexed_objects, indexed_deltas;
+	size_t i, nwork, nthreads, started, reported;
+	int error;
+
+	memset(&params, 0, sizeof(params));
+	params.idx = idx;
+
+	*saved_out = 0;
+
+	if ((error = prepare_delta_work(&params, &nwork, idx)) < 0 || !nwork)
+		goto done;
+
+	git_mutex_init(&params.mutex);
+	git_cond_init(&params.cond);
+
+	nthreads = min(idx->nr_threads, params.nbatches);
+	indexed_objects = stats->indexed_objects;
+	indexed_deltas = stats->indexed_deltas;
+
+	git_mutex_lock(&params.mutex);
+	for (started = 0; started < nthreads; started++) {
+		if (git_thread_create(&threads[started], threaded_resolve_deltas, &params)) {
+			giterr_set(GITERR_THREAD, "unable to create thread");
+			params.cancelled = 1;
+			error = -1;
+			break;
+		}
+		params.active_threads++;
+	}
+
+	/*
+	 * Report progress from this thread as the workers resolve
+	 * deltas, so that the callback is never called concurrently.
+	 */
+	reported = 0;
+	while (params.active_threads || reported != params.resolved) {
+		if (reported != params.resolved && !params.cancelled) {
+			reported = params.resolved;
+			git_mutex_unlock(&params.mutex);
+
+			stats->indexed_objects = indexed_objects + (unsigned int)reported;
+			stats->indexed_deltas = indexed_deltas + (unsigned int)reported;
+			if ((error = do_progress_callback(idx, stats)) > 0)
+				error = 0;
+
+			git_mutex_lock(&params.mutex);
+			if (error < 0)
+				params.cancelled = 1;
+			continue;
+		}
+
+		if (params.cancelled && !params.active_threads)
+			break;
+
+		git_cond_wait(&params.cond, &params.mutex);
+	}
+	git_mutex_unlock(&params.mutex);
+
+	for (i = 0; i < started; i++)
+		git_thread_join(&threads[i], NULL);
+
+	git_cond_free(&params.cond);
+	git_mutex_free(&params.mutex);
+
+	if (error < 0 ||
+	    (error = save_resolved_deltas(saved_out, idx, params.work, nwork)) < 0)
+		goto done;
+
+	stats->indexed_objects = indexed_objects + (unsigned int)*saved_out;
+	stats->indexed_deltas = indexed_deltas + (unsigned int)*saved_out;
+
+done:
+	*pending_out = nwork;
+	git__free(params.work);
+	git__free(params.batches);
+	return error;
+}
+
+static int resolve_deltas_threaded(git_indexer *idx, git_transfer_progress *stats)
+{
+	git_thread *threads;
+	size_t pending, saved;
+	int error = 0;
+
+	threads = git__mallocarray(idx->nr_threads, sizeof(git_thread));
+	GITERR_CHECK_ALLOC(threads);
+
+	while (idx->deltas.length > 0) {
+		if ((error = resolve_deltas_round(&pending, &saved, idx, threads, stats)) < 0)
+			break;
+
+		/* if none were actually pending, we're done */
+		if (!pending)
+			break;
+
+		if (!saved && (error = fix_thin_pack(idx, stats)) < 0)
+			break;
+	}
+
+	git__free(threads);
+	return error;
+}
+
+#endif
+
 static int resolve_deltas(git_indexer *idx, git_transfer_progress *stats)
 {
 	unsigned int i;
 	struct delta_info *delta;
 	int progressed = 0, non_null = 0, progress_cb_result;
 
+	if (!idx->nr_threads)
+		idx->nr_threads = git_online_cpus();
+
+#ifdef GIT_THREADS
+	if (idx->nr_threads > 1)
+		return resolve_deltas_threaded(idx, stats);
+#endif
+
 	while (idx->deltas.length > 0) {
 		progressed = 0;
 		non_null = 0;
@@ -940,6 +1361,7 @@ int git_indexer_commit(git_indexer *idx, git_transfer_progress *stats)
 	git_oid trailer_hash, file_hash;
 	git_filebuf index_file = {0};
 	void *packfile_trailer;
+	git_profile_frame region;
 
 	if (!idx->parsed_header) {
 		giterr_set(GITERR_INDEXER, "incomplete pack header");
@@ -971,7 +1393,11 @@ int git_indexer_commit(git_indexer *idx, git_transfer_progress *stats)
 	/* Freeze the number of deltas */
 	stats->total_deltas = stats->total_objects - stats->indexed_objects;
 
-	if ((error = resolve_deltas(idx, stats)) < 0)
+	git_profile_enter(&region, "indexer.resolve_deltas");
+	error = resolve_deltas(idx, stats);
+	git_profile_leave(&region, stats->indexed_deltas);
+
+	if (error < 0)
 		return error;
 
 	if (stats->indexed_objects != stats->total_objects) {
@@ -1132,13 +1558,10 @@ void git_indexer_free(git_indexer *idx)
 
 	git_vector_free_deep(&idx->deltas);
 
-	if (!git_mutex_lock(&git__mwindow_mutex)) {
-		if (!idx->pack_committed)
-			git_packfile_close(idx->pack, true);
+	if (!idx->pack_committed)
+		git_packfile_close(idx->pack, true);
 
-		git_packfile_free(idx->pack);
-		git_mutex_unlock(&git__mwindow_mutex);
-	}
+	git_packfile_free(idx->pack);
 
 	git_hash_ctx_cleanup(&idx->trailer);
 	git_hash_ctx_cleanup(&idx->hash_ctx);
@@ -11,6 +11,8 @@
 
 #include "git2/indexer.h"
 
+extern unsigned int git_indexer__default_threads;
+
 extern void git_indexer__set_fsync(git_indexer *idx, int do_fsync);
 
 #endif
@@ -9,6 +9,8 @@
 
 #include "tree.h"
 #include "index.h"
+#include "odb_prefetch.h"
+#include "trace.h"
 
 #define GIT_ITERATOR_FIRST_ACCESS   (1 << 15)
 #define GIT_ITERATOR_HONOR_IGNORES  (1 << 16)
@@ -24,6 +26,8 @@
 #define iterator__honor_ignores(I)     iterator__flag(I,HONOR_IGNORES)
 #define iterator__ignore_dot_git(I)    iterator__flag(I,IGNORE_DOT_GIT)
 
+unsigned int git_iterator__stat_threads = 1;
+
 
 static void iterator_set_ignore_case(git_iterator *iter, bool ignore_case)
 {
@@ -453,6 +457,9 @@ typedef struct {
 
 	/* a pool of entries to reduce the number of allocations */
 	git_pool entry_pool;
+
+	/* reads the subtrees of each frame ahead of it, unless disabled */
+	git_odb_prefetch *prefetch;
 } tree_iterator;
 
 GIT_INLINE(tree_iterator_frame *) tree_iterator_parent_frame(
@@ -558,6 +565,8 @@ static int tree_iterator_frame_init(
 	memset(new_frame, 0x0, sizeof(tree_iterator_frame));
 	new_frame->tree = dup;
 
+	git_odb_prefetch_subtrees(iter->prefetch, dup);
+
 	if (frame_entry &&
 		(error = tree_iterator_compute_path(&new_frame->path, frame_entry)) < 0)
 		goto done;
@@ -927,6 +936,7 @@ static void tree_iterator_free(git_iterator *i)
 
 	tree_iterator_clear(iter);
 
+	git_odb_prefetch_free(iter->prefetch);
 	git_tree_free(iter->root);
 	git_buf_free(&iter->entry_path);
 }
@@ -961,8 +971,16 @@ int git_iterator_for_tree(
 
 	if ((error = iterator_init_common(&iter->base,
 			git_tree_owner(tree), NULL, options)) < 0 ||
-		(error = git_tree_dup(&iter->root, tree)) < 0 ||
-		(error = tree_iterator_init(iter)) < 0)
+		(error = git_tree_dup(&iter->root, tree)) < 0)
+		goto on_error;
+
+	/* iterations limited to some paths don't look at most subtrees */
+	if (!iter->base.start && !iter->base.end &&
+		!iter->base.pathlist.length &&
+		(error = git_odb_prefetch_new(&iter->prefetch, iter->base.repo)) < 0)
+		goto on_error;
+
+	if ((error = tree_iterator_init(iter)) < 0)
 		goto on_error;
 
 	*out = &iter->base;
@@ -1014,6 +1032,7 @@ typedef struct {
 	struct stat st;
 	size_t path_len;
 	iterator_pathlist_search_t match;
+	int is_ignored;
 	char path[GIT_FLEX_ARRAY];
 } filesystem_iterator_entry;
 
@@ -1040,6 +1059,15 @@ typedef struct {
 	git_array_t(filesystem_iterator_frame) frames;
 	git_ignores ignores;
 
+	/* the untracked cache of the index, if we use it */
+	git_untracked_cache *untracked;
+	time_t untracked_start;
+
+	/* stat data of the entries of `index_snapshot` (in the same order),
+	 * looked up on several threads; a zero mode means we don't have it.
+	 */
+	git_index_entry *prefetched;
+
 	/* info about the current entry */
 	git_index_entry entry;
 	git_buf current_path;
@@ -1285,6 +1313,7 @@ static filesystem_iterator_entry *filesystem_iterator_entry_init(
 
 	entry->path_len = path_len;
 	entry->match = pathlist_match;
+	entry->is_ignored = GIT_IGNORE_UNCHECKED;
 	memcpy(entry->path, path, path_len);
 	memcpy(&entry->st, statbuf, sizeof(struct stat));
 
@@ -1297,60 +1326,161 @@ static filesystem_iterator_entry *filesystem_iterator_entry_init(
 	return entry;
 }
 
-static int filesystem_iterator_frame_push(
+/*
+ * Add the item at `path` (relative to the root, without a trailing
+ * slash) to the frame.  `out` is set to NULL if it is skipped.
+ */
+static int filesystem_iterator_frame_insert(
+	filesystem_iterator_entry **out,
 	filesystem_iterator *iter,
-	filesystem_iterator_entry *frame_entry)
+	filesystem_iterator_frame *frame,
+	const char *path,
+	size_t path_len,
+	struct stat *statbuf,
+	iterator_pathlist_search_t pathlist_match,
+	bool dir_expected)
 {
-	filesystem_iterator_frame *new_frame = NULL;
-	git_path_diriter diriter = GIT_PATH_DIRITER_INIT;
-	git_buf root = GIT_BUF_INIT;
-	const char *path;
 	filesystem_iterator_entry *entry;
-	struct stat statbuf;
-	size_t path_len;
 	int error;
 
-	if (iter->frames.size == FILESYSTEM_MAX_DEPTH) {
-		giterr_set(GITERR_REPOSITORY,
-			"directory nesting too deep (%"PRIuZ")", iter->frames.size);
-		return -1;
+	*out = NULL;
+
+	/* Ignore wacky things in the filesystem */
+	if (!S_ISDIR(statbuf->st_mode) &&
+		!S_ISREG(statbuf->st_mode) &&
+		!S_ISLNK(statbuf->st_mode) &&
+		statbuf->st_mode != GIT_FILEMODE_UNREADABLE)
+		return 0;
+
+	if (filesystem_iterator_is_dot_git(iter, path, path_len))
+		return 0;
+
+	/* convert submodules to GITLINK and remove trailing slashes */
+	if (S_ISDIR(statbuf->st_mode)) {
+		bool submodule = false;
+
+		if ((error = filesystem_iterator_is_submodule(&submodule,
+				iter, path, path_len)) < 0)
+			return error;
+
+		if (submodule)
+			statbuf->st_mode = GIT_FILEMODE_COMMIT;
 	}
 
-	new_frame = git_array_alloc(iter->frames);
-	GITERR_CHECK_ALLOC(new_frame);
+	/* Ensure that the pathlist entry lines up with what we expected */
+	else if (dir_expected)
+		return 0;
 
-	memset(new_frame, 0, sizeof(filesystem_iterator_frame));
+	entry = filesystem_iterator_entry_init(frame,
+		path, path_len, statbuf, pathlist_match);
+	GITERR_CHECK_ALLOC(entry);
 
-	if (frame_entry)
-		git_buf_joinpath(&root, iter->root, frame_entry->path);
-	else
-		git_buf_puts(&root, iter->root);
+	if ((error = git_vector_insert(&frame->entries, entry)) < 0)
+		return error;
 
-	if (git_buf_oom(&root)) {
-		error = -1;
-		goto done;
+	*out = entry;
+	return 0;
+}
+
+GIT_INLINE(bool) filesystem_iterator_fsmonitor_valid(
+	filesystem_iterator *iter, const git_index_entry *entry)
+{
+	return iterator__flag(&iter->base, USE_FSMONITOR) &&
+		(entry->flags_extended & GIT_IDXENTRY_FSMONITOR_VALID) != 0 &&
+		(S_ISREG(entry->mode) || S_ISLNK(entry->mode));
+}
+
+static void filesystem_iterator_stat_from_entry(
+	struct stat *st, const git_index_entry *entry)
+{
+	memset(st, 0, sizeof(*st));
+	st->st_mode = entry->mode;
+	st->st_ctime = entry->ctime.seconds;
+	st->st_ctime_nsec = entry->ctime.nanoseconds;
+	st->st_mtime = entry->mtime.seconds;
+	st->st_mtime_nsec = entry->mtime.nanoseconds;
+	st->st_dev = entry->dev;
+	st->st_ino = entry->ino;
+	st->st_uid = entry->uid;
+	st->st_gid = entry->gid;
+	st->st_size = entry->file_size;
+}
+
+/*
+ * Files which the filesystem monitor saw unchanged still have the stat
+ * data recorded in the index, and the ones we prefetched have theirs
+ * already looked up, so we can take it from there.
+ */
+static bool filesystem_iterator_index_stat(
+	struct stat *st,
+	filesystem_iterator *iter,
+	const char *path,
+	size_t path_len)
+{
+	const git_index_entry *entry;
+	size_t pos;
+
+	if ((!iterator__flag(&iter->base, USE_FSMONITOR) && !iter->prefetched) ||
+		git_index_snapshot_find(&pos, &iter->index_snapshot,
+			iter->base.entry_srch, path, path_len, 0) < 0)
+		return false;
+
+	entry = git_vector_get(&iter->index_snapshot, pos);
+
+	if (filesystem_iterator_fsmonitor_valid(iter, entry)) {
+		filesystem_iterator_stat_from_entry(st, entry);
+		return true;
 	}
 
-	new_frame->path_len = frame_entry ? frame_entry->path_len : 0;
+	if (iter->prefetched && iter->prefetched[pos].mode) {
+		filesystem_iterator_stat_from_entry(st, &iter->prefetched[pos]);
+		return true;
+	}
+
+	return false;
+}
+
+static int filesystem_iterator_diriter_stat(
+	struct stat *st,
+	filesystem_iterator *iter,
+	git_path_diriter *diriter)
+{
+	int error;
+
+	iter->base.stat_calls++;
+
+	if ((error = git_path_diriter_stat(st, diriter)) < 0) {
+		if (error == GIT_ENOTFOUND)
+			return error;
+
+		/* treat the file as unreadable */
+		memset(st, 0, sizeof(*st));
+		st->st_mode = GIT_FILEMODE_UNREADABLE;
+	}
+
+	return 0;
+}
+
+static int filesystem_iterator_frame_read(
+	filesystem_iterator *iter,
+	filesystem_iterator_entry *frame_entry,
+	filesystem_iterator_frame *new_frame,
+	const char *root)
+{
+	git_path_diriter diriter = GIT_PATH_DIRITER_INIT;
+	const char *path;
+	filesystem_iterator_entry *entry;
+	struct stat statbuf;
+	size_t path_len;
+	int error;
 
 	/* Any error here is equivalent to the dir not existing, skip over it */
 	if ((error = git_path_diriter_init(
-			&diriter, root.ptr, iter->dirload_flags)) < 0) {
+			&diriter, root, iter->dirload_flags)) < 0) {
 		error = GIT_ENOTFOUND;
 		goto done;
 	}
 
-	if ((error = git_vector_init(&new_frame->entries, 64,
-			iterator__ignore_case(&iter->base) ?
-			filesystem_iterator_entry_cmp_icase :
-			filesystem_iterator_entry_cmp)) < 0)
-		goto done;
-
-	git_pool_init(&new_frame->entry_pool, 1);
-
-	/* check if this directory is ignored */
-	filesystem_iterator_frame_push_ignores(iter, frame_entry, new_frame);
-
 	while ((error = git_path_diriter_next(&diriter)) == 0) {
 		iterator_pathlist_search_t pathlist_match = ITERATOR_PATHLIST_FULL;
 		bool dir_expected = false;
@@ -1373,69 +1503,408 @@ static int filesystem_iterator_frame_push(
 			iter, frame_entry, path, path_len))
 			continue;
 
-		/* TODO: don't need to stat if assume unchanged for this path and
-		 * we have an index, we can just copy the data out of it.
-		 */
+		if (filesystem_iterator_index_stat(
+				&statbuf, iter, path, path_len))
+			error = 0;
+		else
+			error = filesystem_iterator_diriter_stat(&statbuf, iter, &diriter);
+
+		/* file was removed between readdir and lstat */
+		if (error == GIT_ENOTFOUND)
+			continue;
+
+		if ((error = filesystem_iterator_frame_insert(&entry, iter, new_frame,
+				path, path_len, &statbuf, pathlist_match, dir_expected)) < 0)
+			goto done;
+	}
+
+	if (error == GIT_ITEROVER)
+		error = 0;
+
+done:
+	git_path_diriter_free(&diriter);
+	return error;
+}
+
+/*
+ * Look up the directory of the frame in the untracked cache, along with
+ * the stat data and .gitignore to compare it against.  `out` is set to
+ * NULL if the directory can't be cached.
+ */
+static int filesystem_iterator_frame_untracked(
+	git_untracked_cache_dir **out,
+	git_untracked_cache_stat *st_out,
+	filesystem_iterator *iter,
+	filesystem_iterator_entry *frame_entry,
+	const char *root)
+{
+	git_untracked_cache_dir *dir;
+	git_attr_file *ignore_file;
+	git_oid ignore_id;
+	struct stat st;
+
+	*out = NULL;
+
+	if (frame_entry)
+		memcpy(&st, &frame_entry->st, sizeof(st));
+	else if (p_stat(root, &st) < 0)
+		return 0;
+
+	/* we can only compare against the ignore file if it was loaded */
+	if (!S_ISDIR(st.st_mode) ||
+		(ignore_file = git_ignore__dir_file(&iter->ignores)) == NULL)
+		return 0;
+
+	if (git_attr_file__id(&ignore_id, ignore_file) < 0)
+		return -1;
+
+	dir = git_untracked_cache_dir_lookup(iter->untracked,
+		frame_entry ? frame_entry->path : "",
+		frame_entry ? frame_entry->path_len : 0);
+	GITERR_CHECK_ALLOC(dir);
+
+	/* the ignore rules changed for this directory and all below it */
+	if (!git_oid_equal(&dir->exclude_id, &ignore_id)) {
+		git_untracked_cache_dir_invalidate(iter->untracked, dir, true);
+		git_oid_cpy(&dir->exclude_id, &ignore_id);
+		iter->untracked->dirty = 1;
+	}
+
+	git_untracked_cache_stat_init(st_out, &st);
+
+	*out = dir;
+	return 0;
+}
+
+static int filesystem_iterator_frame_load_entry(
+	filesystem_iterator *iter,
+	filesystem_iterator_frame *frame,
+	git_buf *path,
+	int is_ignored)
+{
+	filesystem_iterator_entry *entry;
+	struct stat statbuf;
+	int error;
 
-		if ((error = git_path_diriter_stat(&statbuf, &diriter)) < 0) {
-			/* file was removed between readdir and lstat */
+	if (!filesystem_iterator_index_stat(&statbuf, iter,
+			path->ptr + iter->root_len, path->size - iter->root_len)) {
+		iter->base.stat_calls++;
+
+		if ((error = git_path_lstat(path->ptr, &statbuf)) < 0) {
+			giterr_clear();
+
+			/* file was removed since the index or the cache was written */
 			if (error == GIT_ENOTFOUND)
-				continue;
+				return 0;
 
 			/* treat the file as unreadable */
 			memset(&statbuf, 0, sizeof(statbuf));
 			statbuf.st_mode = GIT_FILEMODE_UNREADABLE;
-
-			error = 0;
 		}
+	}
 
-		iter->base.stat_calls++;
+	if ((error = filesystem_iterator_frame_insert(&entry, iter, frame,
+			path->ptr + iter->root_len, path->size - iter->root_len,
+			&statbuf, ITERATOR_PATHLIST_FULL, false)) < 0)
+		return error;
 
-		/* Ignore wacky things in the filesystem */
-		if (!S_ISDIR(statbuf.st_mode) &&
-			!S_ISREG(statbuf.st_mode) &&
-			!S_ISLNK(statbuf.st_mode) &&
-			statbuf.st_mode != GIT_FILEMODE_UNREADABLE)
-			continue;
+	if (entry)
+		entry->is_ignored = is_ignored;
 
-		if (filesystem_iterator_is_dot_git(iter, path, path_len))
-			continue;
+	return 0;
+}
+
+/*
+ * Fill the frame from the untracked cache instead of reading the
+ * directory: the tracked items come from the index and the others from
+ * the names recorded in the cache, whose ignore state we already know.
+ */
+static int filesystem_iterator_frame_load_untracked(
+	filesystem_iterator *iter,
+	filesystem_iterator_frame *new_frame,
+	const char *prefix,
+	git_untracked_cache_dir *dir)
+{
+	const git_index_entry *index_entry;
+	git_buf path = GIT_BUF_INIT;
+	size_t prefix_len = new_frame->path_len, base_len, name_len, pos, i;
+	const char *name, *slash;
+	int error = 0;
+
+	git_buf_puts(&path, iter->root);
+	git_buf_put(&path, prefix, prefix_len);
+	base_len = path.size;
+
+	if (git_buf_oom(&path))
+		return -1;
+
+	git_index_snapshot_find(&pos, &iter->index_snapshot,
+		iter->base.entry_srch, prefix, prefix_len, 0);
+
+	while ((index_entry = git_vector_get(&iter->index_snapshot, pos)) != NULL &&
+		iter->base.strncomp(index_entry->path, prefix, prefix_len) == 0) {
+		name = index_entry->path + prefix_len;
+
+		if ((slash = strchr(name, '/')) != NULL) {
+			name_len = slash - name;
 
-		/* convert submodules to GITLINK and remove trailing slashes */
-		if (S_ISDIR(statbuf.st_mode)) {
-			bool submodule = false;
+			/* skip the rest of the directory by looking up the path
+			 * that sorts right after it: '0' follows '/' */
+			git_buf_truncate(&path, base_len);
+			git_buf_put(&path, name, name_len);
 
-			if ((error = filesystem_iterator_is_submodule(&submodule,
-					iter, path, path_len)) < 0)
+			if ((error = git_buf_putc(&path, '0')) < 0)
 				goto done;
 
-			if (submodule)
-				statbuf.st_mode = GIT_FILEMODE_COMMIT;
+			git_index_snapshot_find(&pos, &iter->index_snapshot,
+				iter->base.entry_srch, path.ptr + iter->root_len,
+				path.size - iter->root_len, 0);
+
+			git_buf_truncate(&path, path.size - 1);
+		} else {
+			name_len = strlen(name);
+
+			/* skip the other stages of a conflict */
+			do {
+				pos++;
+			} while ((index_entry = git_vector_get(
+					&iter->index_snapshot, pos)) != NULL &&
+				strcmp(index_entry->path + prefix_len, name) == 0);
+
+			git_buf_truncate(&path, base_len);
+
+			if ((error = git_buf_put(&path, name, name_len)) < 0)
+				goto done;
 		}
 
-		/* Ensure that the pathlist entry lines up with what we expected */
-		else if (dir_expected)
+		if ((error = filesystem_iterator_frame_load_entry(
+				iter, new_frame, &path, GIT_IGNORE_UNCHECKED)) < 0)
+			goto done;
+	}
+
+	git_vector_foreach(&dir->untracked, i, name) {
+		name_len = strlen(name);
+
+		if (name_len && name[name_len - 1] == '/')
+			name_len--;
+
+		git_buf_truncate(&path, base_len);
+
+		if ((error = git_buf_put(&path, name, name_len)) < 0 ||
+			(error = filesystem_iterator_frame_load_entry(
+				iter, new_frame, &path, GIT_IGNORE_FALSE)) < 0)
+			goto done;
+	}
+
+	/* sort the two lists together; the cache should not list a
+	 * tracked item, but be safe */
+	git_vector_uniq(&new_frame->entries, NULL);
+
+done:
+	git_buf_free(&path);
+	return error;
+}
+
+static bool filesystem_iterator_is_tracked(
+	filesystem_iterator *iter, filesystem_iterator_entry *entry)
+{
+	const git_index_entry *index_entry;
+	size_t len = entry->path_len, pos;
+	bool is_dir = (len && entry->path[len - 1] == '/');
+
+	if (is_dir)
+		len--;
+
+	/* a file or a submodule */
+	git_index_snapshot_find(&pos, &iter->index_snapshot,
+		iter->base.entry_srch, entry->path, len, 0);
+
+	if ((index_entry = git_vector_get(&iter->index_snapshot, pos)) != NULL &&
+		iter->base.strncomp(index_entry->path, entry->path, len) == 0 &&
+		index_entry->path[len] == '\0')
+		return true;
+
+	if (!is_dir)
+		return false;
+
+	/* a directory with tracked files in it */
+	git_index_snapshot_find(&pos, &iter->index_snapshot,
+		iter->base.entry_srch, entry->path, len + 1, 0);
+
+	return ((index_entry = git_vector_get(&iter->index_snapshot, pos)) != NULL &&
+		iter->base.strncomp(index_entry->path, entry->path, len + 1) == 0);
+}
+
+GIT_INLINE(git_dir_flag) entry_dir_flag(unsigned int mode)
+{
+#if defined(GIT_WIN32) && !defined(__MINGW32__)
+	return mode ?
+		(S_ISDIR(mode) ? GIT_DIR_FLAG_TRUE : GIT_DIR_FLAG_FALSE) :
+		GIT_DIR_FLAG_UNKNOWN;
+#else
+	GIT_UNUSED(mode);
+	return GIT_DIR_FLAG_UNKNOWN;
+#endif
+}
+
+static int filesystem_iterator_lookup_ignored(
+	filesystem_iterator *iter,
+	filesystem_iterator_frame *frame,
+	const char *path,
+	unsigned int mode)
+{
+	int is_ignored;
+
+	if (git_ignore__lookup(&is_ignored,
+			&iter->ignores, path, entry_dir_flag(mode)) < 0) {
+		giterr_clear();
+		is_ignored = GIT_IGNORE_NOTFOUND;
+	}
+
+	/* use ignore from containing frame stack */
+	if (is_ignored <= GIT_IGNORE_NOTFOUND)
+		is_ignored = frame->is_ignored;
+
+	return is_ignored;
+}
+
+/*
+ * Record the untracked items that we just read in the cache.  We work
+ * out whether they are ignored now, which saves doing it later on.
+ */
+static int filesystem_iterator_frame_record_untracked(
+	filesystem_iterator *iter,
+	filesystem_iterator_frame *new_frame,
+	git_untracked_cache_dir *dir,
+	const git_untracked_cache_stat *st)
+{
+	git_vector untracked = GIT_VECTOR_INIT, subdirs = GIT_VECTOR_INIT;
+	filesystem_iterator_entry *entry;
+	const char *name;
+	size_t i;
+	int error = 0;
+
+	/*
+	 * Changes made within the second that the directory was last
+	 * modified in may not show in its mtime; wait until it's older.
+	 */
+	if ((time_t)st->mtime.seconds >= iter->untracked_start) {
+		git_untracked_cache_dir_invalidate(iter->untracked, dir, false);
+		return 0;
+	}
+
+	git_vector_foreach(&new_frame->entries, i, entry) {
+		name = entry->path + new_frame->path_len;
+
+		if (S_ISDIR(entry->st.st_mode) &&
+			(error = git_vector_insert(&subdirs, (char *)name)) < 0)
+			goto done;
+
+		if (filesystem_iterator_is_tracked(iter, entry))
 			continue;
 
-		entry = filesystem_iterator_entry_init(new_frame,
-			path, path_len, &statbuf, pathlist_match);
-		GITERR_CHECK_ALLOC(entry);
+		entry->is_ignored = filesystem_iterator_lookup_ignored(
+			iter, new_frame, entry->path,
+			git_futils_canonical_mode(entry->st.st_mode));
 
-		git_vector_insert(&new_frame->entries, entry);
+		if (entry->is_ignored != GIT_IGNORE_TRUE &&
+			(error = git_vector_insert(&untracked, (char *)name)) < 0)
+			goto done;
 	}
 
-	if (error == GIT_ITEROVER)
-		error = 0;
+	error = git_untracked_cache_dir_update(
+		iter->untracked, dir, st, &dir->exclude_id, &untracked, &subdirs);
 
-	/* sort now that directory suffix is added */
-	git_vector_sort(&new_frame->entries);
+done:
+	git_vector_free(&untracked);
+	git_vector_free(&subdirs);
+	return error;
+}
+
+static int filesystem_iterator_frame_push(
+	filesystem_iterator *iter,
+	filesystem_iterator_entry *frame_entry)
+{
+	filesystem_iterator_frame *new_frame = NULL;
+	git_untracked_cache_dir *untracked_dir = NULL;
+	git_untracked_cache_stat untracked_stat;
+	git_buf root = GIT_BUF_INIT;
+	double start = git_trace_start(GIT_TRACE_TRACE);
+	int error;
+
+	if (iter->frames.size == FILESYSTEM_MAX_DEPTH) {
+		giterr_set(GITERR_REPOSITORY,
+			"directory nesting too deep (%"PRIuZ")", iter->frames.size);
+		return -1;
+	}
+
+	new_frame = git_array_alloc(iter->frames);
+	GITERR_CHECK_ALLOC(new_frame);
+
+	memset(new_frame, 0, sizeof(filesystem_iterator_frame));
+
+	if ((error = git_vector_init(&new_frame->entries, 64,
+			iterator__ignore_case(&iter->base) ?
+			filesystem_iterator_entry_cmp_icase :
+			filesystem_iterator_entry_cmp)) < 0) {
+		git_array_pop(iter->frames);
+		return error;
+	}
+
+	git_pool_init(&new_frame->entry_pool, 1);
+
+	if (frame_entry)
+		git_buf_joinpath(&root, iter->root, frame_entry->path);
+	else
+		git_buf_puts(&root, iter->root);
+
+	new_frame->path_len = frame_entry ? frame_entry->path_len : 0;
+
+	/* check if this directory is ignored */
+	filesystem_iterator_frame_push_ignores(iter, frame_entry, new_frame);
+
+	if (git_buf_oom(&root)) {
+		error = -1;
+		goto done;
+	}
+
+	if (iter->untracked &&
+		(error = filesystem_iterator_frame_untracked(&untracked_dir,
+			&untracked_stat, iter, frame_entry, root.ptr)) < 0)
+		goto done;
+
+	if (untracked_dir && git_untracked_cache_dir_is_valid(
+			untracked_dir, &untracked_stat, &untracked_dir->exclude_id)) {
+		error = filesystem_iterator_frame_load_untracked(iter, new_frame,
+			frame_entry ? frame_entry->path : "", untracked_dir);
+	} else {
+		if ((error = filesystem_iterator_frame_read(
+				iter, frame_entry, new_frame, root.ptr)) < 0)
+			goto done;
+
+		/* sort now that directory suffix is added */
+		git_vector_sort(&new_frame->entries);
+
+		if (untracked_dir)
+			error = filesystem_iterator_frame_record_untracked(
+				iter, new_frame, untracked_dir, &untracked_stat);
+	}
 
 done:
-	if (error < 0)
+	if (error < 0) {
+		if (frame_entry)
+			filesystem_iterator_frame_pop_ignores(iter);
+
+		git_pool_clear(&new_frame->entry_pool);
+		git_vector_free(&new_frame->entries);
 		git_array_pop(iter->frames);
+	} else {
+		git_trace_timed(GIT_TRACE_TRACE, start,
+			"iterator: read directory '%s': %"PRIuZ" entries",
+			root.ptr, new_frame->entries.length);
+	}
 
 	git_buf_free(&root);
-	git_path_diriter_free(&diriter);
 	return error;
 }
 
@@ -1471,7 +1940,7 @@ static void filesystem_iterator_set_current(
 
 	iter->entry.path = entry->path;
 
-	iter->current_is_ignored = GIT_IGNORE_UNCHECKED;
+	iter->current_is_ignored = entry->is_ignored;
 }
 
 static int filesystem_iterator_current(
@@ -1605,34 +2074,11 @@ int git_iterator_current_workdir_path(git_buf **out, git_iterator *i)
 	return 0;
 }
 
-GIT_INLINE(git_dir_flag) entry_dir_flag(git_index_entry *entry)
-{
-#if defined(GIT_WIN32) && !defined(__MINGW32__)
-	return (entry && entry->mode) ?
-		(S_ISDIR(entry->mode) ? GIT_DIR_FLAG_TRUE : GIT_DIR_FLAG_FALSE) :
-		GIT_DIR_FLAG_UNKNOWN;
-#else
-	GIT_UNUSED(entry);
-	return GIT_DIR_FLAG_UNKNOWN;
-#endif
-}
-
 static void filesystem_iterator_update_ignored(filesystem_iterator *iter)
 {
-	filesystem_iterator_frame *frame;
-	git_dir_flag dir_flag = entry_dir_flag(&iter->entry);
-
-	if (git_ignore__lookup(&iter->current_is_ignored,
-			&iter->ignores, iter->entry.path, dir_flag) < 0) {
-		giterr_clear();
-		iter->current_is_ignored = GIT_IGNORE_NOTFOUND;
-	}
-
-	/* use ignore from containing frame stack */
-	if (iter->current_is_ignored <= GIT_IGNORE_NOTFOUND) {
-		frame = filesystem_iterator_current_frame(iter);
-		iter->current_is_ignored = frame->is_ignored;
-	}
+	iter->current_is_ignored = filesystem_iterator_lookup_ignored(iter,
+		filesystem_iterator_current_frame(iter),
+		iter->entry.path, iter->entry.mode);
 }
 
 GIT_INLINE(bool) filesystem_iterator_current_is_ignored(
@@ -1764,11 +2210,179 @@ static void filesystem_iterator_clear(filesystem_iterator *iter)
 	git_array_clear(iter->frames);
 	git_ignore__free(&iter->ignores);
 
+	git_untracked_cache_free(iter->untracked);
+	iter->untracked = NULL;
+
+	git__free(iter->prefetched);
+	iter->prefetched = NULL;
+
 	git_buf_free(&iter->tmp_buf);
 
 	iterator_clear(&iter->base);
 }
 
+static int filesystem_iterator_init_untracked(filesystem_iterator *iter)
+{
+	git_untracked_cache *cache;
+	int error;
+
+	/* the cache describes a complete scan of the working directory
+	 * against the index; it doesn't know about folding case either.
+	 */
+	if (iter->base.type != GIT_ITERATOR_TYPE_WORKDIR || !iter->index ||
+		!iterator__honor_ignores(&iter->base) ||
+		iter->base.start_len || iter->base.end_len ||
+		iter->base.pathlist.length ||
+		iterator__ignore_case(&iter->base) ||
+		iterator__flag(&iter->base, PRECOMPOSE_UNICODE))
+		return 0;
+
+	if ((error = git_untracked_cache_for_index(
+			&cache, iter->index, iter->base.repo)) < 0 || !cache)
+		return error;
+
+	if ((error = git_untracked_cache_validate(
+			cache, iter->base.repo, &iter->ignores)) <= 0) {
+		git_untracked_cache_free(cache);
+		return error;
+	}
+
+	iter->untracked = cache;
+	iter->untracked_start = time(NULL);
+	return 0;
+}
+
+/* Don't bother starting a thread for fewer entries than this */
+#define FILESYSTEM_ITERATOR_PREFETCH_MIN 500
+
+#ifdef GIT_THREADS
+
+typedef struct {
+	git_thread thread;
+	filesystem_iterator *iter;
+	size_t start;
+	size_t end;
+	size_t stat_calls;
+} filesystem_iterator_prefetch_params;
+
+static void *filesystem_iterator_prefetch_stats(void *arg)
+{
+	filesystem_iterator_prefetch_params *params = arg;
+	filesystem_iterator *iter = params->iter;
+	const git_index_entry *entry;
+	git_index_entry *out;
+	git_buf path = GIT_BUF_INIT;
+	struct stat st;
+	size_t i;
+
+	for (i = params->start; i < params->end; i++) {
+		entry = git_vector_get(&iter->index_snapshot, i);
+
+		if (GIT_IDXENTRY_STAGE(entry) != 0 ||
+			filesystem_iterator_fsmonitor_valid(iter, entry))
+			continue;
+
+		git_buf_clear(&path);
+		git_buf_puts(&path, iter->root);
+		git_buf_puts(&path, entry->path);
+
+		/* whatever we don't have is looked up when it's read */
+		if (git_buf_oom(&path))
+			break;
+
+		params->stat_calls++;
+
+		if (p_lstat(path.ptr, &st) < 0)
+			continue;
+
+		out = &iter->prefetched[i];
+		out->ctime.seconds = st.st_ctime;
+		out->ctime.nanoseconds = st.st_ctime_nsec;
+		out->mtime.seconds = st.st_mtime;
+		out->mtime.nanoseconds = st.st_mtime_nsec;
+		out->dev = st.st_dev;
+		out->ino = st.st_ino;
+		out->mode = st.st_mode;
+		out->uid = st.st_uid;
+		out->gid = st.st_gid;
+		out->file_size = st.st_size;
+	}
+
+	git_buf_free(&path);
+	return NULL;
+}
+
+/*
+ * On filesystems where a stat is slow, looking the files up one by one
+ * as we read each directory dominates the time it takes to compare the
+ * index to the working directory.  Look up the files of the index ahead
+ * of time instead, each thread taking a contiguous (so directory-ordered)
+ * range of entries; reading the directories then uses these results.
+ */
+static int filesystem_iterator_init_prefetch(filesystem_iterator *iter)
+{
+	filesystem_iterator_prefetch_params *params;
+	size_t entries = iter->index_snapshot.length, nthreads, started = 0, i;
+	unsigned int nr_threads = git_iterator__stat_threads;
+
+	if (iter->base.type != GIT_ITERATOR_TYPE_WORKDIR || !iter->index ||
+		iter->base.start_len || iter->base.end_len ||
+		iter->base.pathlist.length)
+		return 0;
+
+	if (!nr_threads)
+		nr_threads = git_online_cpus();
+
+	nthreads = min(nr_threads, entries / FILESYSTEM_ITERATOR_PREFETCH_MIN);
+
+	if (nthreads < 2)
+		return 0;
+
+	iter->prefetched = git__calloc(entries, sizeof(git_index_entry));
+	GITERR_CHECK_ALLOC(iter->prefetched);
+
+	params = git__calloc(nthreads, sizeof(filesystem_iterator_prefetch_params));
+	GITERR_CHECK_ALLOC(params);
+
+	for (i = 0; i < nthreads; i++) {
+		params[i].iter = iter;
+		params[i].start = entries * i / nthreads;
+		params[i].end = entries * (i + 1) / nthreads;
+	}
+
+	/* the last range is ours; the ones of threads we can't start are
+	 * simply looked up when their directories are read.
+	 */
+	for (i = 0; i < nthreads - 1; i++) {
+		if (git_thread_create(&params[i].thread,
+				filesystem_iterator_prefetch_stats, &params[i]))
+			break;
+
+		started++;
+	}
+
+	filesystem_iterator_prefetch_stats(&params[nthreads - 1]);
+	iter->base.stat_calls += params[nthreads - 1].stat_calls;
+
+	for (i = 0; i < started; i++) {
+		git_thread_join(&params[i].thread, NULL);
+		iter->base.stat_calls += params[i].stat_calls;
+	}
+
+	git__free(params);
+	return 0;
+}
+
+#else
+
+static int filesystem_iterator_init_prefetch(filesystem_iterator *iter)
+{
+	GIT_UNUSED(iter);
+	return 0;
+}
+
+#endif
+
 static int filesystem_iterator_init(filesystem_iterator *iter)
 {
 	int error;
@@ -1778,6 +2392,13 @@ static int filesystem_iterator_init(filesystem_iterator *iter)
 			".gitignore", &iter->ignores)) < 0)
 		return error;
 
+	if (iterator__flag(&iter->base, USE_UNTRACKED_CACHE) &&
+		(error = filesystem_iterator_init_untracked(iter)) < 0)
+		return error;
+
+	if ((error = filesystem_iterator_init_prefetch(iter)) < 0)
+		return error;
+
 	if ((error = filesystem_iterator_frame_push(iter, NULL)) < 0)
 		return error;
 
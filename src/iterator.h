@@ -39,6 +39,10 @@ typedef enum {
 	GIT_ITERATOR_DONT_PRECOMPOSE_UNICODE = (1u << 5),
 	/** include conflicts */
 	GIT_ITERATOR_INCLUDE_CONFLICTS = (1u << 6),
+	/** use and update the untracked cache of the index (workdir only) */
+	GIT_ITERATOR_USE_UNTRACKED_CACHE = (1u << 7),
+	/** trust the index for entries the filesystem monitor saw unchanged */
+	GIT_ITERATOR_USE_FSMONITOR = (1u << 8),
 } git_iterator_flag_t;
 
 typedef enum {
@@ -98,6 +102,13 @@ struct git_iterator {
 	unsigned int flags;
 };
 
+/*
+ * Number of threads workdir iterators use to look up the stat data of
+ * the files in the index before reading the working directory; 1 (the
+ * default) stats every file when its directory is read.
+ */
+extern unsigned int git_iterator__stat_threads;
+
 extern int git_iterator_for_nothing(
 	git_iterator **out,
 	git_iterator_options *options);
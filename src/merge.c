@@ -34,6 +34,7 @@
 #include "merge_driver.h"
 #include "oidmap.h"
 #include "array.h"
+#include "profile.h"
 
 #include "git2/types.h"
 #include "git2/repository.h"
@@ -2053,7 +2054,8 @@ int git_merge__iterators(
 	git_merge_file_options file_opts = GIT_MERGE_FILE_OPTIONS_INIT;
 	git_merge_diff *conflict;
 	git_vector changes;
-	size_t i;
+	git_profile_frame region;
+	size_t i, considered = 0;
 	int error = 0;
 
 	assert(out && repo);
@@ -2080,6 +2082,8 @@ int git_merge__iterators(
 	diff_list = git_merge_diff_list__alloc(repo);
 	GITERR_CHECK_ALLOC(diff_list);
 
+	git_profile_enter(&region, "merge");
+
 	ancestor_iter = iterator_given_or_empty(&empty_ancestor, ancestor_iter);
 	our_iter = iterator_given_or_empty(&empty_ours, our_iter);
 	theirs_iter = iterator_given_or_empty(&empty_theirs, theirs_iter);
@@ -2091,6 +2095,7 @@ int git_merge__iterators(
 
 	memcpy(&changes, &diff_list->conflicts, sizeof(git_vector));
 	git_vector_clear(&diff_list->conflicts);
+	considered = changes.length;
 
 	git_vector_foreach(&changes, i, conflict) {
 		int resolved = 0;
@@ -2114,6 +2119,8 @@ int git_merge__iterators(
 		(opts.flags & GIT_MERGE_SKIP_REUC));
 
 done:
+	git_profile_leave(&region, considered);
+
 	if (!given_opts || !given_opts->metric)
 		git__free(opts.metric);
 
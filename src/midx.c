@@ -0,0 +1,745 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "midx.h"
+
+#include "array.h"
+#include "filebuf.h"
+#include "mwindow.h"
+#include "odb.h"
+#include "pack.h"
+#include "path.h"
+#include "repository.h"
+#include "sha1_lookup.h"
+
+#define GIT_MIDX_SIGNATURE 0x4d494458 /* "MIDX" */
+#define GIT_MIDX_VERSION 1
+#define GIT_MIDX_OBJECT_ID_VERSION 1
+
+#define MIDX_PACKFILE_NAMES_ID 0x504e414d /* "PNAM" */
+#define MIDX_OID_FANOUT_ID 0x4f494446 /* "OIDF" */
+#define MIDX_OID_LOOKUP_ID 0x4f49444c /* "OIDL" */
+#define MIDX_OBJECT_OFFSETS_ID 0x4f4f4646 /* "OOFF" */
+#define MIDX_OBJECT_LARGE_OFFSETS_ID 0x4c4f4646 /* "LOFF" */
+
+#define MIDX_OBJECT_OFFSET_SIZE (2 * sizeof(uint32_t))
+#define MIDX_CHUNK_ENTRY_SIZE (sizeof(uint32_t) + sizeof(uint64_t))
+#define MIDX_LARGE_OFFSET 0x80000000
+
+struct git_midx_header {
+	uint32_t signature;
+	uint8_t version;
+	uint8_t object_id_version;
+	uint8_t chunks;
+	uint8_t base_midx_files;
+	uint32_t packfiles;
+};
+
+struct git_midx_chunk {
+	git_off_t offset;
+	size_t length;
+};
+
+static int midx_error(const char *message)
+{
+	giterr_set(GITERR_ODB, "invalid multi-pack-index file - %s", message);
+	return -1;
+}
+
+static int midx_parse_packfile_names(
+		git_midx_file *idx,
+		const unsigned char *data,
+		uint32_t packfiles,
+		struct git_midx_chunk *chunk)
+{
+	const char *name, *prev = NULL, *end;
+	size_t len;
+	uint32_t i;
+
+	if (chunk->offset == 0)
+		return midx_error("missing Packfile Names chunk");
+
+	if (git_vector_init(&idx->packfile_names, packfiles, git__strcmp_cb) < 0)
+		return -1;
+
+	name = (const char *)(data + chunk->offset);
+	end = name + chunk->length;
+
+	for (i = 0; i < packfiles; i++) {
+		if ((len = p_strnlen(name, end - name)) == (size_t)(end - name))
+			return midx_error("unterminated packfile name");
+		if (len <= strlen(".idx") || git__suffixcmp(name, ".idx") != 0)
+			return midx_error("non-.idx packfile name");
+		if (strchr(name, '/') != NULL || strchr(name, '\\') != NULL)
+			return midx_error("non-local packfile");
+		if (prev && strcmp(prev, name) >= 0)
+			return midx_error("packfile names are not sorted");
+
+		if (git_vector_insert(&idx->packfile_names, (char *)name) < 0)
+			return -1;
+
+		prev = name;
+		name += len + 1;
+	}
+
+	git_vector_sort(&idx->packfile_names);
+	idx->num_packfiles = packfiles;
+	return 0;
+}
+
+static int midx_parse_oid_fanout(
+		git_midx_file *idx,
+		const unsigned char *data,
+		struct git_midx_chunk *chunk)
+{
+	uint32_t i, nr;
+
+	if (chunk->offset == 0)
+		return midx_error("missing OID Fanout chunk");
+	if (chunk->length != 256 * 4)
+		return midx_error("OID Fanout chunk has wrong length");
+
+	idx->oid_fanout = (const uint32_t *)(data + chunk->offset);
+	nr = 0;
+	for (i = 0; i < 256; ++i) {
+		uint32_t n = ntohl(idx->oid_fanout[i]);
+		if (n < nr)
+			return midx_error("index is non-monotonic");
+		nr = n;
+	}
+	idx->num_objects = nr;
+	return 0;
+}
+
+static int midx_parse_oid_lookup(
+		git_midx_file *idx,
+		const unsigned char *data,
+		struct git_midx_chunk *chunk)
+{
+	if (chunk->offset == 0)
+		return midx_error("missing OID Lookup chunk");
+	if (chunk->length != idx->num_objects * GIT_OID_RAWSZ)
+		return midx_error("OID Lookup chunk has wrong length");
+
+	idx->oid_lookup = (const git_oid *)(data + chunk->offset);
+	return 0;
+}
+
+static int midx_parse_object_offsets(
+		git_midx_file *idx,
+		const unsigned char *data,
+		struct git_midx_chunk *chunk)
+{
+	if (chunk->offset == 0)
+		return midx_error("missing Object Offsets chunk");
+	if (chunk->length != idx->num_objects * MIDX_OBJECT_OFFSET_SIZE)
+		return midx_error("Object Offsets chunk has wrong length");
+
+	idx->object_offsets = data + chunk->offset;
+	return 0;
+}
+
+static int midx_parse_object_large_offsets(
+		git_midx_file *idx,
+		const unsigned char *data,
+		struct git_midx_chunk *chunk)
+{
+	if (chunk->length == 0)
+		return 0;
+	if (chunk->length % 8 != 0)
+		return midx_error("malformed Object Large Offsets chunk");
+
+	idx->object_large_offsets = data + chunk->offset;
+	idx->num_object_large_offsets = chunk->length / 8;
+	return 0;
+}
+
+int git_midx_parse(
+		git_midx_file *idx,
+		const unsigned char *data,
+		size_t size)
+{
+	struct git_midx_header *hdr;
+	const unsigned char *chunk_hdr;
+	struct git_midx_chunk *last_chunk;
+	uint32_t i;
+	git_off_t last_chunk_offset, chunk_offset, trailer_offset;
+	struct git_midx_chunk chunk_packfile_names = {0}, chunk_oid_fanout = {0},
+			      chunk_oid_lookup = {0}, chunk_object_offsets = {0},
+			      chunk_object_large_offsets = {0}, chunk_unsupported = {0};
+	int error;
+
+	assert(idx);
+
+	if (size < sizeof(struct git_midx_header) + GIT_OID_RAWSZ)
+		return midx_error("multi-pack-index is too short");
+
+	hdr = ((struct git_midx_header *)data);
+
+	if (hdr->signature != htonl(GIT_MIDX_SIGNATURE) ||
+	    hdr->version != GIT_MIDX_VERSION ||
+	    hdr->object_id_version != GIT_MIDX_OBJECT_ID_VERSION)
+		return midx_error("unsupported multi-pack-index version");
+	if (hdr->chunks == 0)
+		return midx_error("no chunks in multi-pack-index");
+	if (hdr->base_midx_files != 0)
+		return midx_error("chained multi-pack-indexes are not supported");
+
+	/*
+	 * The very first chunk's offset should be after the header, all the chunk
+	 * headers, and a special zero chunk.
+	 */
+	last_chunk_offset = sizeof(struct git_midx_header) +
+		(1 + hdr->chunks) * MIDX_CHUNK_ENTRY_SIZE;
+	trailer_offset = size - GIT_OID_RAWSZ;
+	if (trailer_offset < last_chunk_offset)
+		return midx_error("wrong index size");
+	git_oid_cpy(&idx->checksum, (git_oid *)(data + trailer_offset));
+
+	chunk_hdr = data + sizeof(struct git_midx_header);
+	last_chunk = NULL;
+	for (i = 0; i < hdr->chunks; ++i, chunk_hdr += MIDX_CHUNK_ENTRY_SIZE) {
+		chunk_offset = ((git_off_t)ntohl(*((uint32_t *)(chunk_hdr + 4)))) << 32 |
+			((git_off_t)ntohl(*((uint32_t *)(chunk_hdr + 8))));
+		if (chunk_offset < last_chunk_offset)
+			return midx_error("chunks are non-monotonic");
+		if (chunk_offset >= trailer_offset)
+			return midx_error("chunks extend beyond the trailer");
+		if (last_chunk != NULL)
+			last_chunk->length = (size_t)(chunk_offset - last_chunk_offset);
+		last_chunk_offset = chunk_offset;
+
+		switch (ntohl(*((uint32_t *)(chunk_hdr + 0)))) {
+		case MIDX_PACKFILE_NAMES_ID:
+			chunk_packfile_names.offset = last_chunk_offset;
+			last_chunk = &chunk_packfile_names;
+			break;
+
+		case MIDX_OID_FANOUT_ID:
+			chunk_oid_fanout.offset = last_chunk_offset;
+			last_chunk = &chunk_oid_fanout;
+			break;
+
+		case MIDX_OID_LOOKUP_ID:
+			chunk_oid_lookup.offset = last_chunk_offset;
+			last_chunk = &chunk_oid_lookup;
+			break;
+
+		case MIDX_OBJECT_OFFSETS_ID:
+			chunk_object_offsets.offset = last_chunk_offset;
+			last_chunk = &chunk_object_offsets;
+			break;
+
+		case MIDX_OBJECT_LARGE_OFFSETS_ID:
+			chunk_object_large_offsets.offset = last_chunk_offset;
+			last_chunk = &chunk_object_large_offsets;
+			break;
+
+		default:
+			chunk_unsupported.offset = last_chunk_offset;
+			last_chunk = &chunk_unsupported;
+		}
+	}
+	last_chunk->length = (size_t)(trailer_offset - last_chunk_offset);
+
+	if ((error = midx_parse_packfile_names(
+			idx, data, ntohl(hdr->packfiles), &chunk_packfile_names)) < 0 ||
+	    (error = midx_parse_oid_fanout(idx, data, &chunk_oid_fanout)) < 0 ||
+	    (error = midx_parse_oid_lookup(idx, data, &chunk_oid_lookup)) < 0 ||
+	    (error = midx_parse_object_offsets(idx, data, &chunk_object_offsets)) < 0 ||
+	    (error = midx_parse_object_large_offsets(idx, data, &chunk_object_large_offsets)) < 0)
+		return error;
+
+	return 0;
+}
+
+int git_midx_open(git_midx_file **idx_out, const char *path)
+{
+	git_midx_file *idx;
+	git_file fd = -1;
+	size_t idx_size;
+	struct stat st;
+	int error;
+
+	fd = git_futils_open_ro(path);
+	if (fd < 0)
+		return fd;
+
+	if (p_fstat(fd, &st) < 0) {
+		p_close(fd);
+		giterr_set(GITERR_ODB, "multi-pack-index file not found - '%s'", path);
+		return GIT_ENOTFOUND;
+	}
+
+	if (!S_ISREG(st.st_mode) || !git__is_sizet(st.st_size)) {
+		p_close(fd);
+		giterr_set(GITERR_ODB, "invalid multi-pack-index '%s'", path);
+		return GIT_ENOTFOUND;
+	}
+	idx_size = (size_t)st.st_size;
+
+	idx = git__calloc(1, sizeof(git_midx_file));
+	GITERR_CHECK_ALLOC(idx);
+
+	git_futils_filestamp_set_from_stat(&idx->stamp, &st);
+
+	error = git_futils_mmap_ro(&idx->index_map, fd, 0, idx_size);
+	p_close(fd);
+	if (error < 0) {
+		git__free(idx);
+		return error;
+	}
+
+	if ((error = git_midx_parse(idx, idx->index_map.data, idx_size)) < 0) {
+		git_midx_free(idx);
+		return error;
+	}
+
+	*idx_out = idx;
+	return 0;
+}
+
+int git_midx_needs_refresh(const git_midx_file *idx, const char *path)
+{
+	git_futils_filestamp stamp;
+
+	git_futils_filestamp_set(&stamp, &idx->stamp);
+	return git_futils_filestamp_check(&stamp, path) != 0;
+}
+
+static int midx_entry_get_byindex(
+		git_midx_entry *e,
+		const git_midx_file *idx,
+		size_t pos)
+{
+	const unsigned char *object_offset;
+	uint32_t pack_index;
+	git_off_t offset;
+
+	object_offset = idx->object_offsets + pos * MIDX_OBJECT_OFFSET_SIZE;
+	pack_index = ntohl(*((uint32_t *)object_offset));
+	offset = ntohl(*((uint32_t *)(object_offset + 4)));
+
+	if (pack_index >= idx->num_packfiles)
+		return midx_error("pack index is out of bounds");
+
+	if (offset & MIDX_LARGE_OFFSET) {
+		const unsigned char *large_offset;
+		size_t large_pos = (size_t)(offset & ~MIDX_LARGE_OFFSET);
+
+		if (large_pos >= idx->num_object_large_offsets)
+			return midx_error("large offset is out of bounds");
+
+		large_offset = idx->object_large_offsets + large_pos * 8;
+		offset = ((git_off_t)ntohl(*((uint32_t *)large_offset))) << 32 |
+			ntohl(*((uint32_t *)(large_offset + 4)));
+	}
+
+	e->pack_index = pack_index;
+	e->offset = offset;
+	git_oid_cpy(&e->sha1, &idx->oid_lookup[pos]);
+	return 0;
+}
+
+int git_midx_entry_find(
+		git_midx_entry *e,
+		const git_midx_file *idx,
+		const git_oid *short_oid,
+		size_t len)
+{
+	int pos, found = 0;
+	uint32_t hi, lo;
+	const git_oid *current = NULL;
+
+	assert(e && idx && short_oid);
+
+	hi = ntohl(idx->oid_fanout[(int)short_oid->id[0]]);
+	lo = ((short_oid->id[0] == 0x0) ? 0 : ntohl(idx->oid_fanout[(int)short_oid->id[0] - 1]));
+
+	pos = sha1_position(idx->oid_lookup, GIT_OID_RAWSZ, lo, hi, short_oid->id);
+
+	if (pos >= 0) {
+		/* An object matching exactly the oid was found */
+		found = 1;
+		current = idx->oid_lookup + pos;
+	} else {
+		/* No object was found */
+		/* pos refers to the object with the "closest" oid to short_oid */
+		pos = -1 - pos;
+		if (pos < (int)idx->num_objects) {
+			current = idx->oid_lookup + pos;
+
+			if (!git_oid_ncmp(short_oid, current, len))
+				found = 1;
+		}
+	}
+
+	if (found && len != GIT_OID_HEXSZ && pos + 1 < (int)idx->num_objects) {
+		/* Check for ambiguousity */
+		const git_oid *next = current + 1;
+
+		if (!git_oid_ncmp(short_oid, next, len))
+			found = 2;
+	}
+
+	if (!found)
+		return git_odb__error_notfound(
+				"failed to find offset for multi-pack index entry", short_oid, len);
+	if (found > 1)
+		return git_odb__error_ambiguous(
+				"found multiple offsets for multi-pack index entry");
+
+	return midx_entry_get_byindex(e, idx, pos);
+}
+
+static const char *packfile_basename(const char *path)
+{
+	const char *slash = strrchr(path, '/');
+	return slash ? slash + 1 : path;
+}
+
+bool git_midx_contains_pack(const git_midx_file *idx, const char *path)
+{
+	git_buf name = GIT_BUF_INIT;
+	const char *base = packfile_basename(path);
+	size_t base_len = strlen(base), pos;
+	bool found;
+
+	if (base_len > strlen(".pack") && !git__suffixcmp(base, ".pack"))
+		base_len -= strlen(".pack");
+	else if (base_len > strlen(".idx") && !git__suffixcmp(base, ".idx"))
+		base_len -= strlen(".idx");
+
+	if (git_buf_put(&name, base, base_len) < 0 ||
+	    git_buf_puts(&name, ".idx") < 0) {
+		giterr_clear();
+		return false;
+	}
+
+	found = !git_vector_bsearch(
+		&pos, (git_vector *)&idx->packfile_names, name.ptr);
+
+	git_buf_free(&name);
+	return found;
+}
+
+void git_midx_free(git_midx_file *idx)
+{
+	if (!idx)
+		return;
+
+	git_vector_free(&idx->packfile_names);
+	if (idx->index_map.data)
+		git_futils_mmap_free(&idx->index_map);
+	git__free(idx);
+}
+
+/*
+ * Writing
+ */
+
+struct midx_pack {
+	char *name;
+	struct git_pack_file *p;
+};
+
+struct midx_object {
+	git_oid id;
+	uint32_t pack_index;
+	git_time_t pack_mtime;
+	git_off_t offset;
+};
+
+typedef git_array_t(struct midx_object) midx_object_array;
+
+static int midx_pack_cmp(const void *a_, const void *b_)
+{
+	const struct midx_pack *a = a_, *b = b_;
+	return strcmp(a->name, b->name);
+}
+
+/*
+ * Sort by id and, when several packs contain the same object, put the
+ * copy which lives in the most recent pack first: that is the one which
+ * is kept, as the pack backend would find it first too.
+ */
+static int midx_object_cmp(const void *a_, const void *b_, void *payload)
+{
+	const struct midx_object *a = a_, *b = b_;
+	int cmp;
+
+	GIT_UNUSED(payload);
+
+	if ((cmp = git_oid__cmp(&a->id, &b->id)) != 0)
+		return cmp;
+	if (a->pack_mtime != b->pack_mtime)
+		return a->pack_mtime > b->pack_mtime ? -1 : 1;
+	return (int)a->pack_index - (int)b->pack_index;
+}
+
+static int midx_load_pack__cb(void *data, git_buf *path)
+{
+	git_vector *packs = data;
+	struct midx_pack *pack;
+	struct git_pack_file *p;
+	int error;
+
+	if (git_buf_len(path) <= strlen(".idx") ||
+	    git__suffixcmp(path->ptr, ".idx") != 0)
+		return 0; /* not an index */
+
+	/* ignore missing .pack file as git does */
+	if ((error = git_mwindow_get_pack(&p, path->ptr)) == GIT_ENOTFOUND) {
+		giterr_clear();
+		return 0;
+	} else if (error < 0)
+		return error;
+
+	pack = git__calloc(1, sizeof(struct midx_pack));
+	GITERR_CHECK_ALLOC(pack);
+
+	pack->p = p;
+	pack->name = git__strdup(packfile_basename(path->ptr));
+
+	if (!pack->name || git_vector_insert(packs, pack) < 0) {
+		git_mwindow_put_pack(p);
+		git__free(pack->name);
+		git__free(pack);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int midx_collect_objects(midx_object_array *objects, git_vector *packs)
+{
+	struct midx_pack *pack;
+	struct midx_object *object;
+	uint32_t n, count;
+	size_t i;
+	int error;
+
+	git_vector_foreach(packs, i, pack) {
+		if ((error = git_pack_entry_count(&count, pack->p)) < 0)
+			return error;
+
+		for (n = 0; n < count; n++) {
+			object = git_array_alloc(*objects);
+			GITERR_CHECK_ALLOC(object);
+
+			object->pack_index = (uint32_t)i;
+			object->pack_mtime = pack->p->mtime;
+
+			if ((error = git_pack_nth_entry_oid(&object->id, pack->p, n)) < 0 ||
+			    (error = git_pack_nth_entry_offset(&object->offset, pack->p, n)) < 0)
+				return error;
+		}
+	}
+
+	if (git_array_size(*objects))
+		git__qsort_r(objects->ptr, git_array_size(*objects),
+			sizeof(struct midx_object), midx_object_cmp, NULL);
+
+	return 0;
+}
+
+static int write_chunk_header(git_filebuf *file, uint32_t id, uint64_t offset)
+{
+	uint32_t word[3];
+
+	word[0] = htonl(id);
+	word[1] = htonl((uint32_t)(offset >> 32));
+	word[2] = htonl((uint32_t)(offset & 0xffffffff));
+
+	return git_filebuf_write(file, word, sizeof(word));
+}
+
+static int write_midx(
+		git_filebuf *file,
+		git_vector *packs,
+		midx_object_array *objects)
+{
+	struct git_midx_header hdr = {0};
+	git_array_t(struct midx_object *) unique = GIT_ARRAY_INIT;
+	git_array_t(uint64_t) large_offsets = GIT_ARRAY_INIT;
+	struct midx_object *object, **slot;
+	struct midx_pack *pack;
+	uint32_t fanout[256] = {0}, word, data[2];
+	uint64_t offset, *large;
+	size_t i, names_len = 0, padding;
+	git_oid checksum;
+	static const char zeroes[4] = {0};
+	int error = 0;
+
+	/* Drop the duplicates, keeping the preferred copy of each object */
+	for (i = 0; i < git_array_size(*objects); i++) {
+		object = git_array_get(*objects, i);
+
+		if (git_array_size(unique) &&
+		    git_oid__cmp(&(*git_array_last(unique))->id, &object->id) == 0)
+			continue;
+
+		slot = git_array_alloc(unique);
+		GITERR_CHECK_ALLOC(slot);
+		*slot = object;
+
+		if (object->offset >= MIDX_LARGE_OFFSET) {
+			large = git_array_alloc(large_offsets);
+			GITERR_CHECK_ALLOC(large);
+			*large = (uint64_t)object->offset;
+		}
+	}
+
+	git_vector_foreach(packs, i, pack) {
+		names_len += strlen(pack->name) + 1;
+	}
+	padding = (4 - (names_len % 4)) % 4;
+
+	hdr.signature = htonl(GIT_MIDX_SIGNATURE);
+	hdr.version = GIT_MIDX_VERSION;
+	hdr.object_id_version = GIT_MIDX_OBJECT_ID_VERSION;
+	hdr.chunks = git_array_size(large_offsets) ? 5 : 4;
+	hdr.packfiles = htonl((uint32_t)git_vector_length(packs));
+
+	if ((error = git_filebuf_write(file, &hdr, sizeof(hdr))) < 0)
+		goto done;
+
+	offset = sizeof(hdr) + (hdr.chunks + 1) * MIDX_CHUNK_ENTRY_SIZE;
+	if ((error = write_chunk_header(file, MIDX_PACKFILE_NAMES_ID, offset)) < 0)
+		goto done;
+
+	offset += names_len + padding;
+	if ((error = write_chunk_header(file, MIDX_OID_FANOUT_ID, offset)) < 0)
+		goto done;
+
+	offset += sizeof(fanout);
+	if ((error = write_chunk_header(file, MIDX_OID_LOOKUP_ID, offset)) < 0)
+		goto done;
+
+	offset += git_array_size(unique) * GIT_OID_RAWSZ;
+	if ((error = write_chunk_header(file, MIDX_OBJECT_OFFSETS_ID, offset)) < 0)
+		goto done;
+
+	offset += git_array_size(unique) * MIDX_OBJECT_OFFSET_SIZE;
+	if (git_array_size(large_offsets)) {
+		if ((error = write_chunk_header(file, MIDX_OBJECT_LARGE_OFFSETS_ID, offset)) < 0)
+			goto done;
+
+		offset += git_array_size(large_offsets) * sizeof(uint64_t);
+	}
+
+	if ((error = write_chunk_header(file, 0, offset)) < 0)
+		goto done;
+
+	/* Packfile Names */
+	git_vector_foreach(packs, i, pack) {
+		if ((error = git_filebuf_write(file, pack->name, strlen(pack->name) + 1)) < 0)
+			goto done;
+	}
+	if (padding && (error = git_filebuf_write(file, zeroes, padding)) < 0)
+		goto done;
+
+	/* OID Fanout */
+	for (i = 0; i < git_array_size(unique); i++)
+		fanout[(*git_array_get(unique, i))->id.id[0]]++;
+	for (i = 0, word = 0; i < 256; i++) {
+		word += fanout[i];
+		fanout[i] = htonl(word);
+	}
+	if ((error = git_filebuf_write(file, fanout, sizeof(fanout))) < 0)
+		goto done;
+
+	/* OID Lookup */
+	for (i = 0; i < git_array_size(unique); i++) {
+		object = *git_array_get(unique, i);
+		if ((error = git_filebuf_write(file, &object->id, GIT_OID_RAWSZ)) < 0)
+			goto done;
+	}
+
+	/* Object Offsets */
+	word = 0;
+	for (i = 0; i < git_array_size(unique); i++) {
+		object = *git_array_get(unique, i);
+
+		data[0] = htonl(object->pack_index);
+		if (object->offset >= MIDX_LARGE_OFFSET)
+			data[1] = htonl(MIDX_LARGE_OFFSET | word++);
+		else
+			data[1] = htonl((uint32_t)object->offset);
+
+		if ((error = git_filebuf_write(file, data, sizeof(data))) < 0)
+			goto done;
+	}
+
+	/* Object Large Offsets */
+	for (i = 0; i < git_array_size(large_offsets); i++) {
+		large = git_array_get(large_offsets, i);
+		data[0] = htonl((uint32_t)(*large >> 32));
+		data[1] = htonl((uint32_t)(*large & 0xffffffff));
+
+		if ((error = git_filebuf_write(file, data, sizeof(data))) < 0)
+			goto done;
+	}
+
+	/* And the checksum of everything before it */
+	if ((error = git_filebuf_hash(&checksum, file)) < 0)
+		goto done;
+
+	error = git_filebuf_write(file, &checksum, GIT_OID_RAWSZ);
+
+done:
+	git_array_clear(unique);
+	git_array_clear(large_offsets);
+	return error;
+}
+
+int git_midx_write(const char *pack_dir)
+{
+	git_vector packs = GIT_VECTOR_INIT;
+	midx_object_array objects = GIT_ARRAY_INIT;
+	git_filebuf file = GIT_FILEBUF_INIT;
+	git_buf path = GIT_BUF_INIT;
+	struct midx_pack *pack;
+	size_t i;
+	int error;
+
+	assert(pack_dir);
+
+	if ((error = git_vector_init(&packs, 0, midx_pack_cmp)) < 0 ||
+	    (error = git_buf_sets(&path, pack_dir)) < 0 ||
+	    (error = git_path_direach(&path, 0, midx_load_pack__cb, &packs)) < 0)
+		goto done;
+
+	git_vector_sort(&packs);
+
+	if ((error = midx_collect_objects(&objects, &packs)) < 0)
+		goto done;
+
+	if ((error = git_buf_joinpath(&path, pack_dir, GIT_MIDX_FILE)) < 0 ||
+	    (error = git_filebuf_open(&file, path.ptr,
+			GIT_FILEBUF_HASH_CONTENTS |
+			(git_repository__fsync_gitdir ? GIT_FILEBUF_FSYNC : 0),
+			GIT_PACK_FILE_MODE)) < 0)
+		goto done;
+
+	if ((error = write_midx(&file, &packs, &objects)) < 0)
+		goto done;
+
+	error = git_filebuf_commit(&file);
+
+done:
+	git_filebuf_cleanup(&file);
+	git_buf_free(&path);
+	git_vector_foreach(&packs, i, pack) {
+		git_mwindow_put_pack(pack->p);
+		git__free(pack->name);
+		git__free(pack);
+	}
+	git_vector_free(&packs);
+	git_array_clear(objects);
+	return error;
+}
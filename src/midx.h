@@ -0,0 +1,112 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#ifndef INCLUDE_midx_h__
+#define INCLUDE_midx_h__
+
+#include "common.h"
+
+#include "git2/types.h"
+#include "git2/oid.h"
+
+#include "map.h"
+#include "fileops.h"
+#include "vector.h"
+
+#define GIT_MIDX_FILE "multi-pack-index"
+
+/**
+ * A multi-pack-index file.
+ *
+ * This file contains a merged index for multiple independent .pack files.
+ * This can help speed up locating objects without requiring a binary
+ * search on each of the .idx files of the packfiles.
+ *
+ * Support for this feature was added in git 2.21.
+ */
+typedef struct git_midx_file {
+	git_map index_map;
+
+	/* The number of packfiles covered by the index. */
+	uint32_t num_packfiles;
+
+	/*
+	 * The names of the index files of the packfiles (`pack-*.idx`),
+	 * pointing into the mapped file. Sorted by name; the position of a
+	 * name is the pack index used by the other tables.
+	 */
+	git_vector packfile_names;
+
+	/* The OID Fanout table. */
+	const uint32_t *oid_fanout;
+	/* The total number of objects in the index. */
+	uint32_t num_objects;
+
+	/* The OID Lookup table. */
+	const git_oid *oid_lookup;
+
+	/*
+	 * The Object Offsets table. Each entry holds the pack index of the
+	 * object and its offset in that pack, 4 bytes each in network byte
+	 * order. Offsets with the high bit set refer to the Object Large
+	 * Offsets table instead.
+	 */
+	const unsigned char *object_offsets;
+
+	/* The Object Large Offsets table, 8 bytes per entry. */
+	const unsigned char *object_large_offsets;
+	size_t num_object_large_offsets;
+
+	/* The trailer of the file. Contains the SHA1-checksum of the whole file. */
+	git_oid checksum;
+
+	/* The stat information of the file when it was opened. */
+	git_futils_filestamp stamp;
+} git_midx_file;
+
+/* An entry in the multi-pack-index file. */
+typedef struct git_midx_entry {
+	/* The position of the pack in `packfile_names`. */
+	size_t pack_index;
+	/* The offset of the object in that pack. */
+	git_off_t offset;
+	/* The SHA-1 hash of the requested object. */
+	git_oid sha1;
+} git_midx_entry;
+
+int git_midx_open(git_midx_file **idx_out, const char *path);
+int git_midx_parse(
+		git_midx_file *idx,
+		const unsigned char *data,
+		size_t size);
+
+/*
+ * Returns 1 if the multi-pack-index at `path` differs from the one which
+ * was read into `idx`, 0 if it's unchanged.
+ */
+int git_midx_needs_refresh(const git_midx_file *idx, const char *path);
+
+int git_midx_entry_find(
+		git_midx_entry *e,
+		const git_midx_file *idx,
+		const git_oid *short_oid,
+		size_t len);
+
+/*
+ * Whether the pack at `path` (either its `.pack` or its `.idx` file) is
+ * covered by `idx`.
+ */
+bool git_midx_contains_pack(const git_midx_file *idx, const char *path);
+
+void git_midx_free(git_midx_file *idx);
+
+/*
+ * Write a multi-pack-index covering every pack in `pack_dir`.
+ */
+int git_midx_write(const char *pack_dir);
+
+#endif
@@ -25,6 +25,9 @@
 size_t git_mwindow__window_size = DEFAULT_WINDOW_SIZE;
 size_t git_mwindow__mapped_limit = DEFAULT_MAPPED_LIMIT;
 
+/* Map packfiles whole as they are opened, see GIT_OPT_ENABLE_MWINDOW_WHOLE_PACK */
+bool git_mwindow__whole_pack = false;
+
 /* Whenever you want to read or modify this, grab git__mwindow_mutex */
 static git_mwindow_ctl mem_ctl;
 
@@ -110,34 +113,54 @@ void git_mwindow_put_pack(struct git_pack_file *pack)
 	assert(git_strmap_valid_index(git__pack_cache, pos));
 
 	count = git_atomic_dec(&pack->refcount);
-	if (count == 0) {
+	if (count == 0)
 		git_strmap_delete_at(git__pack_cache, pos);
-		git_packfile_free(pack);
-	}
 
 	git_mutex_unlock(&git__mwindow_mutex);
-	return;
+
+	/* nobody can find the pack anymore, so free it outside of the lock */
+	if (count == 0)
+		git_packfile_free(pack);
 }
 
-void git_mwindow_free_all(git_mwindow_file *mwf)
+/*
+ * Locking: `git__mwindow_mutex` protects `mem_ctl` (the list of files
+ * and the accounting of what is mapped) and the pack cache, while the
+ * lock of each file protects its list of windows. A window can only be
+ * unmapped while nobody uses it, so the holder of a cursor reads from
+ * its window without taking any lock, and releases it with an atomic
+ * decrement. A window is only ever taken into use under the lock of
+ * its file.
+ *
+ * The global lock is taken before the lock of a file, and no thread
+ * holds the locks of two files at once.
+ */
+
+/*
+ * Whether a window is in use, read with a barrier so that whatever its
+ * last user did with it is done before we close it.
+ */
+GIT_INLINE(bool) window_in_use(git_mwindow *w)
 {
-	if (git_mutex_lock(&git__mwindow_mutex)) {
-		giterr_set(GITERR_THREAD, "unable to lock mwindow mutex");
-		return;
-	}
+	return git_atomic_add(&w->inuse_cnt, 0) != 0;
+}
 
-	git_mwindow_free_all_locked(mwf);
+/* Unmap a window which was taken off its file, under the global lock */
+static void close_window(git_mwindow_ctl *ctl, git_mwindow *w)
+{
+	if (w->whole)
+		ctl->mapped_whole -= w->window_map.len;
+	else
+		ctl->mapped -= w->window_map.len;
+	ctl->open_windows--;
+	ctl->munmap_calls++;
 
-	git_mutex_unlock(&git__mwindow_mutex);
+	git_futils_mmap_free(&w->window_map);
+	git__free(w);
 }
 
-/*
- * Free all the windows in a sequence, typically because we're done
- * with the file
- */
-void git_mwindow_free_all_locked(git_mwindow_file *mwf)
+static void free_windows(git_mwindow_ctl *ctl, git_mwindow_file *mwf)
 {
-	git_mwindow_ctl *ctl = &mem_ctl;
 	size_t i;
 
 	/*
@@ -157,16 +180,59 @@ void git_mwindow_free_all_locked(git_mwindow_file *mwf)
 
 	while (mwf->windows) {
 		git_mwindow *w = mwf->windows;
-		assert(w->inuse_cnt == 0);
+		assert(!window_in_use(w));
 
-		ctl->mapped -= w->window_map.len;
-		ctl->open_windows--;
+		mwf->windows = w->next;
+		close_window(ctl, w);
+	}
 
-		git_futils_mmap_free(&w->window_map);
+	if (mwf->whole) {
+		close_window(ctl, mwf->whole);
+		mwf->whole = NULL;
+	}
+}
 
-		mwf->windows = w->next;
-		git__free(w);
+/*
+ * Free all the windows in a sequence, typically because we're done
+ * with the file
+ */
+void git_mwindow_free_all(git_mwindow_file *mwf)
+{
+	if (git_mutex_lock(&git__mwindow_mutex)) {
+		giterr_set(GITERR_THREAD, "unable to lock mwindow mutex");
+		return;
+	}
+
+	if (git_mutex_lock(&mwf->lock)) {
+		git_mutex_unlock(&git__mwindow_mutex);
+		giterr_set(GITERR_THREAD, "unable to lock mwindow file mutex");
+		return;
 	}
+
+	free_windows(&mem_ctl, mwf);
+
+	git_mutex_unlock(&mwf->lock);
+	git_mutex_unlock(&git__mwindow_mutex);
+}
+
+int git_mwindow_stats(git_stats *stats)
+{
+	git_mwindow_ctl *ctl = &mem_ctl;
+
+	if (git_mutex_lock(&git__mwindow_mutex)) {
+		giterr_set(GITERR_THREAD, "unable to lock mwindow mutex");
+		return -1;
+	}
+
+	stats->mwindow_maps = ctl->mmap_calls;
+	stats->mwindow_unmaps = ctl->munmap_calls;
+	stats->mwindow_mapped = ctl->mapped + ctl->mapped_whole;
+	stats->mwindow_peak_mapped = ctl->peak_mapped;
+	stats->mwindow_open = ctl->open_windows;
+	stats->mwindow_peak_open = ctl->peak_open_windows;
+
+	git_mutex_unlock(&git__mwindow_mutex);
+	return 0;
 }
 
 /*
@@ -180,52 +246,96 @@ int git_mwindow_contains(git_mwindow *win, git_off_t offset)
 }
 
 /*
- * Find the least-recently-used window in a file
+ * Find the least-recently-used window in a file. Called with the
+ * lock of the file held.
  */
 static void git_mwindow_scan_lru(
 	git_mwindow_file *mwf,
 	git_mwindow **lru_w,
-	git_mwindow **lru_l)
+	git_mwindow **lru_l,
+	size_t *lru_used)
 {
 	git_mwindow *w, *w_l;
 
 	for (w_l = NULL, w = mwf->windows; w; w = w->next) {
-		if (!w->inuse_cnt) {
+		if (!window_in_use(w)) {
 			/*
 			 * If the current one is more recent than the last one,
 			 * store it in the output parameter. If lru_w is NULL,
 			 * it's the first loop, so store it as well.
 			 */
-			if (!*lru_w || w->last_used < (*lru_w)->last_used) {
+			if (!*lru_w || w->last_used < *lru_used) {
 				*lru_w = w;
 				*lru_l = w_l;
+				*lru_used = w->last_used;
 			}
 		}
 		w_l = w;
 	}
 }
 
+/*
+ * Look for a window older than `lru_w` in `mwf`, returning whether
+ * there was one. When `lru_w` is in another file, it's compared by
+ * the age we saw while holding the lock of its file.
+ */
+static bool scan_file_lru(
+	git_mwindow_file *mwf,
+	git_mwindow **lru_w,
+	git_mwindow **lru_l,
+	size_t *lru_used)
+{
+	git_mwindow *last = *lru_w;
+
+	if (git_mutex_lock(&mwf->lock) < 0)
+		return false;
+
+	git_mwindow_scan_lru(mwf, lru_w, lru_l, lru_used);
+	git_mutex_unlock(&mwf->lock);
+
+	return *lru_w != last;
+}
+
 /*
  * Close the least recently used window. You should check to see if
  * the file descriptors need closing from time to time. Called under
- * lock from new_window.
+ * the global lock from new_window.
+ *
+ * Windows are only added and closed under the global lock, so the
+ * window found while looking through the files one at a time is still
+ * there when its file is locked again to close it; it may have been
+ * taken into use in the meantime, though.
  */
 static int git_mwindow_close_lru(git_mwindow_file *mwf)
 {
 	git_mwindow_ctl *ctl = &mem_ctl;
 	size_t i;
-	git_mwindow *lru_w = NULL, *lru_l = NULL, **list = &mwf->windows;
+	git_mwindow *lru_w = NULL, *lru_l = NULL;
+	git_mwindow_file *lru_f = NULL, *cur;
+	size_t lru_used = 0;
 
 	/* FIXME: Does this give us any advantage? */
-	if(mwf->windows)
-		git_mwindow_scan_lru(mwf, &lru_w, &lru_l);
+	if (scan_file_lru(mwf, &lru_w, &lru_l, &lru_used))
+		lru_f = mwf;
+
+	git_vector_foreach(&ctl->windowfiles, i, cur) {
+		if (cur != mwf && scan_file_lru(cur, &lru_w, &lru_l, &lru_used))
+			lru_f = cur;
+	}
+
+	if (lru_f && git_mutex_lock(&lru_f->lock) == 0) {
+		if (!window_in_use(lru_w)) {
+			if (lru_l)
+				lru_l->next = lru_w->next;
+			else
+				lru_f->windows = lru_w->next;
+		} else {
+			lru_w = NULL;
+		}
 
-	for (i = 0; i < ctl->windowfiles.length; ++i) {
-		git_mwindow *last = lru_w;
-		git_mwindow_file *cur = git_vector_get(&ctl->windowfiles, i);
-		git_mwindow_scan_lru(cur, &lru_w, &lru_l);
-		if (lru_w != last)
-			list = &cur->windows;
+		git_mutex_unlock(&lru_f->lock);
+	} else {
+		lru_w = NULL;
 	}
 
 	if (!lru_w) {
@@ -233,21 +343,24 @@ static int git_mwindow_close_lru(git_mwindow_file *mwf)
 		return -1;
 	}
 
-	ctl->mapped -= lru_w->window_map.len;
-	git_futils_mmap_free(&lru_w->window_map);
+	close_window(ctl, lru_w);
+	return 0;
+}
 
-	if (lru_l)
-		lru_l->next = lru_w->next;
-	else
-		*list = lru_w->next;
+/* Count a window which was just mapped, under the global lock */
+static void count_window(git_mwindow_ctl *ctl)
+{
+	ctl->mmap_calls++;
+	ctl->open_windows++;
 
-	git__free(lru_w);
-	ctl->open_windows--;
+	if (ctl->mapped + ctl->mapped_whole > ctl->peak_mapped)
+		ctl->peak_mapped = ctl->mapped + ctl->mapped_whole;
 
-	return 0;
+	if (ctl->open_windows > ctl->peak_open_windows)
+		ctl->peak_open_windows = ctl->open_windows;
 }
 
-/* This gets called under lock from git_mwindow_open */
+/* This gets called under the global lock */
 static git_mwindow *new_window(
 	git_mwindow_file *mwf,
 	git_file fd,
@@ -281,6 +394,8 @@ static git_mwindow *new_window(
 	 * window to close and are above the limit, we still mmap the new
 	 * window.
 	 */
+	if (git_mwindow__mapped_limit < ctl->mapped)
+		giterr_clear();
 
 	if (git_futils_mmap_ro(&w->window_map, fd, w->offset, (size_t)len) < 0) {
 		/*
@@ -292,23 +407,101 @@ static git_mwindow *new_window(
 			/* nop */;
 
 		if (git_futils_mmap_ro(&w->window_map, fd, w->offset, (size_t)len) < 0) {
+			ctl->mapped -= (size_t)len;
 			git__free(w);
 			return NULL;
 		}
 	}
 
-	ctl->mmap_calls++;
-	ctl->open_windows++;
+	/* the windowed mode maps files the way it always has */
+	if (git_mwindow__whole_pack)
+		p_madvise(&w->window_map, mwf->advice);
+
+	count_window(ctl);
+	return w;
+}
 
-	if (ctl->mapped > ctl->peak_mapped)
-		ctl->peak_mapped = ctl->mapped;
+static git_mwindow *find_window(
+	git_mwindow_file *mwf, git_off_t offset, size_t extra)
+{
+	git_mwindow *w;
 
-	if (ctl->open_windows > ctl->peak_open_windows)
-		ctl->peak_open_windows = ctl->open_windows;
+	for (w = mwf->windows; w; w = w->next) {
+		if (git_mwindow_contains(w, offset) &&
+			git_mwindow_contains(w, offset + extra))
+			break;
+	}
 
 	return w;
 }
 
+/*
+ * Find a window of `mwf` which contains `offset` and take it into use,
+ * mapping a new one if there is none.
+ */
+static git_mwindow *use_window(
+	git_mwindow_file *mwf, git_off_t offset, size_t extra)
+{
+	git_mwindow *w;
+	bool mapped = false;
+
+	if (git_mutex_lock(&mwf->lock)) {
+		giterr_set(GITERR_THREAD, "unable to lock mwindow file mutex");
+		return NULL;
+	}
+
+	if ((w = find_window(mwf, offset, extra)) != NULL)
+		goto found;
+
+	git_mutex_unlock(&mwf->lock);
+
+	/*
+	 * Windows are only mapped and closed under the global lock, so
+	 * once we hold it, what we find in the file stays there and
+	 * nobody else maps it. The file is not locked while new_window
+	 * closes windows, which may be its own.
+	 */
+	if (git_mutex_lock(&git__mwindow_mutex)) {
+		giterr_set(GITERR_THREAD, "unable to lock mwindow mutex");
+		return NULL;
+	}
+
+	if (git_mutex_lock(&mwf->lock) == 0) {
+		w = find_window(mwf, offset, extra);
+		git_mutex_unlock(&mwf->lock);
+	}
+
+	if (!w && (w = new_window(mwf, mwf->fd, mwf->size, offset)) != NULL)
+		mapped = true;
+
+	if (w && git_mutex_lock(&mwf->lock)) {
+		giterr_set(GITERR_THREAD, "unable to lock mwindow file mutex");
+
+		if (mapped)
+			close_window(&mem_ctl, w);
+		w = NULL;
+	}
+
+	if (w == NULL) {
+		git_mutex_unlock(&git__mwindow_mutex);
+		return NULL;
+	}
+
+	if (mapped) {
+		w->next = mwf->windows;
+		mwf->windows = w;
+	}
+
+	git_mutex_unlock(&git__mwindow_mutex);
+
+found:
+	w->last_used = (size_t)git_atomic_ssize_add(&mem_ctl.used_ctr, 1);
+	git_atomic_inc(&w->inuse_cnt);
+
+	git_mutex_unlock(&mwf->lock);
+	return w;
+}
+
 /*
  * Open a new window, closing the least recenty used until we have
  * enough space. Don't forget to add it to your list
@@ -320,53 +513,28 @@ unsigned char *git_mwindow_open(
 	size_t extra,
 	unsigned int *left)
 {
-	git_mwindow_ctl *ctl = &mem_ctl;
 	git_mwindow *w = *cursor;
 
-	if (git_mutex_lock(&git__mwindow_mutex)) {
-		giterr_set(GITERR_THREAD, "unable to lock mwindow mutex");
-		return NULL;
-	}
-
+	/* the window of the cursor is ours, so it is read without a lock */
 	if (!w || !(git_mwindow_contains(w, offset) && git_mwindow_contains(w, offset + extra))) {
-		if (w) {
-			w->inuse_cnt--;
-		}
-
-		for (w = mwf->windows; w; w = w->next) {
-			if (git_mwindow_contains(w, offset) &&
-				git_mwindow_contains(w, offset + extra))
-				break;
-		}
+		git_mwindow_close(cursor);
 
-		/*
-		 * If there isn't a suitable window, we need to create a new
-		 * one.
-		 */
-		if (!w) {
-			w = new_window(mwf, mwf->fd, mwf->size, offset);
-			if (w == NULL) {
-				git_mutex_unlock(&git__mwindow_mutex);
+		/* a whole file's window is never closed, so it isn't counted */
+		if ((w = mwf->whole) == NULL ||
+			!git_mwindow_contains(w, offset + extra)) {
+			if ((w = use_window(mwf, offset, extra)) == NULL)
 				return NULL;
-			}
-			w->next = mwf->windows;
-			mwf->windows = w;
 		}
-	}
 
-	/* If we changed w, store it in the cursor */
-	if (w != *cursor) {
-		w->last_used = ctl->used_ctr++;
-		w->inuse_cnt++;
 		*cursor = w;
 	}
 
 	offset -= w->offset;
 
+	/* a whole file may be larger than what fits in left */
 	if (left)
-		*left = (unsigned int)(w->window_map.len - offset);
+		*left = (unsigned int)min(w->window_map.len - offset, UINT_MAX);
 
-	git_mutex_unlock(&git__mwindow_mutex);
 	return (unsigned char *) w->window_map.data + offset;
 }
 
@@ -411,17 +579,64 @@ void git_mwindow_file_deregister(git_mwindow_file *mwf)
 	git_mutex_unlock(&git__mwindow_mutex);
 }
 
+/*
+ * Map all of a file in one window, which serves every read until the
+ * file is closed, when GIT_OPT_ENABLE_MWINDOW_WHOLE_PACK asks for it.
+ * The file must not grow anymore. If the file can't be mapped in one
+ * go, it is read through windows as usual.
+ */
+int git_mwindow_file_map_whole(git_mwindow_file *mwf)
+{
+	git_mwindow_ctl *ctl = &mem_ctl;
+	git_mwindow *w;
+
+	if (!git_mwindow__whole_pack || mwf->size <= 0 ||
+		!git__is_sizet(mwf->size))
+		return 0;
+
+	if (git_mutex_lock(&git__mwindow_mutex)) {
+		giterr_set(GITERR_THREAD, "unable to lock mwindow mutex");
+		return -1;
+	}
+
+	if (mwf->whole) {
+		git_mutex_unlock(&git__mwindow_mutex);
+		return 0;
+	}
+
+	w = git__calloc(1, sizeof(git_mwindow));
+	if (w == NULL) {
+		git_mutex_unlock(&git__mwindow_mutex);
+		return -1;
+	}
+
+	if (git_futils_mmap_ro(&w->window_map, mwf->fd, 0, (size_t)mwf->size) < 0) {
+		git_mutex_unlock(&git__mwindow_mutex);
+		git__free(w);
+		giterr_clear();
+		return 0;
+	}
+
+	w->whole = true;
+	p_madvise(&w->window_map, mwf->advice);
+
+	/* it can never be closed to make room, so the limit ignores it */
+	ctl->mapped_whole += w->window_map.len;
+	count_window(ctl);
+
+	/* readers look at this without a lock */
+	git__swap(mwf->whole, w);
+
+	git_mutex_unlock(&git__mwindow_mutex);
+	return 0;
+}
+
 void git_mwindow_close(git_mwindow **window)
 {
 	git_mwindow *w = *window;
 	if (w) {
-		if (git_mutex_lock(&git__mwindow_mutex)) {
-			giterr_set(GITERR_THREAD, "unable to lock mwindow mutex");
-			return;
-		}
-
-		w->inuse_cnt--;
-		git_mutex_unlock(&git__mwindow_mutex);
+		if (!w->whole)
+			git_atomic_dec(&w->inuse_cnt);
 		*window = NULL;
 	}
 }
@@ -18,32 +18,41 @@ typedef struct git_mwindow {
 	git_map window_map;
 	git_off_t offset;
 	size_t last_used;
-	size_t inuse_cnt;
+	git_atomic inuse_cnt;
+	bool whole; /* maps all of the file and stays until it's closed */
 } git_mwindow;
 
 typedef struct git_mwindow_file {
+	git_mutex lock; /* protects the windows of this file */
 	git_mwindow *windows;
+	git_mwindow *whole; /* set by git_mwindow_file_map_whole */
 	int fd;
 	git_off_t size;
+	int advice; /* how the file is read, a GIT_MADV_ value */
 } git_mwindow_file;
 
 typedef struct git_mwindow_ctl {
-	size_t mapped;
+	size_t mapped; /* by windows, which count against the limit */
+	size_t mapped_whole; /* by whole files, which can't be closed */
 	unsigned int open_windows;
 	unsigned int mmap_calls;
+	unsigned int munmap_calls;
 	unsigned int peak_open_windows;
 	size_t peak_mapped;
-	size_t used_ctr;
+	git_atomic_ssize used_ctr;
 	git_vector windowfiles;
 } git_mwindow_ctl;
 
+extern bool git_mwindow__whole_pack;
+
 int git_mwindow_contains(git_mwindow *win, git_off_t offset);
 void git_mwindow_free_all(git_mwindow_file *mwf); /* locks */
-void git_mwindow_free_all_locked(git_mwindow_file *mwf); /* run under lock */
 unsigned char *git_mwindow_open(git_mwindow_file *mwf, git_mwindow **cursor, git_off_t offset, size_t extra, unsigned int *left);
 int git_mwindow_file_register(git_mwindow_file *mwf);
+int git_mwindow_file_map_whole(git_mwindow_file *mwf);
 void git_mwindow_file_deregister(git_mwindow_file *mwf);
 void git_mwindow_close(git_mwindow **w_cursor);
+int git_mwindow_stats(git_stats *stats); /* locks */
 
 extern int git_mwindow_global_init(void);
 
@@ -15,6 +15,7 @@
 #include "delta.h"
 #include "filter.h"
 #include "repository.h"
+#include "trace.h"
 
 #include "git2/odb_backend.h"
 #include "git2/oid.h"
@@ -39,8 +40,12 @@ typedef struct
 	int priority;
 	bool is_alternate;
 	ino_t disk_inode;
+	git_atomic_ssize lookups;
 } backend_internal;
 
+#define odb_count_lookup(internal) \
+	git_atomic_ssize_add(&(internal)->lookups, 1)
+
 static git_cache *odb_cache(git_odb *odb)
 {
 	if (odb->rc.owner != NULL) {
@@ -422,6 +427,14 @@ int git_odb_new(git_odb **out)
 		return -1;
 	}
 
+	if (git_mutex_init(&db->lock) < 0) {
+		giterr_set(GITERR_OS, "failed to initialize odb mutex");
+		git_cache_free(&db->own_cache);
+		git_vector_free(&db->backends);
+		git__free(db);
+		return -1;
+	}
+
 	*out = db;
 	GIT_REFCOUNT_INC(db);
 	return 0;
@@ -440,7 +453,7 @@ static int add_backend_internal(
 	/* Check if the backend is already owned by another ODB */
 	assert(!backend->odb || backend->odb == odb);
 
-	internal = git__malloc(sizeof(backend_internal));
+	internal = git__calloc(1, sizeof(backend_internal));
 	GITERR_CHECK_ALLOC(internal);
 
 	internal->backend = backend;
@@ -498,6 +511,22 @@ int git_odb_get_backend(git_odb_backend **out, git_odb *odb, size_t pos)
 	return GIT_ENOTFOUND;
 }
 
+int git_odb_get_backend_lookups(size_t *out, git_odb *odb, size_t pos)
+{
+	backend_internal *internal;
+
+	assert(out && odb);
+	internal = git_vector_get(&odb->backends, pos);
+
+	if (internal) {
+		*out = (size_t)internal->lookups.val;
+		return 0;
+	}
+
+	giterr_set(GITERR_ODB, "no ODB backend loaded at index %" PRIuZ, pos);
+	return GIT_ENOTFOUND;
+}
+
 int git_odb__add_default_backends(
 	git_odb *db, const char *objects_dir,
 	bool as_alternates, int alternate_depth)
@@ -532,6 +561,11 @@ int git_odb__add_default_backends(
 	}
 #endif
 
+	if (!as_alternates && !db->objects_dir) {
+		db->objects_dir = git__strdup(objects_dir);
+		GITERR_CHECK_ALLOC(db->objects_dir);
+	}
+
 	/* add the loose object backend */
 	if (git_odb_backend_loose(&loose, objects_dir, -1, db->do_fsync, 0, 0) < 0 ||
 		add_backend_internal(db, loose, GIT_LOOSE_PRIORITY, as_alternates, inode) < 0)
@@ -641,6 +675,68 @@ int git_odb__set_caps(git_odb *odb, int caps)
 	return 0;
 }
 
+int git_odb__foreach_pack(git_odb *odb, git_pack_file_cb cb, void *payload)
+{
+	backend_internal *internal;
+	size_t i;
+	int error;
+
+	assert(odb && cb);
+
+	git_vector_foreach(&odb->backends, i, internal) {
+		if (internal->is_alternate)
+			continue;
+
+		error = git_pack_backend__foreach_pack(internal->backend, cb, payload);
+
+		if (error != 0 && error != GIT_PASSTHROUGH)
+			return error;
+	}
+
+	return 0;
+}
+
+int git_odb__get_commit_graph(git_commit_graph_file **out, git_odb *odb)
+{
+	git_buf path = GIT_BUF_INIT;
+	git_commit_graph_file *file = NULL;
+	int error = 0;
+
+	assert(out && odb);
+
+	*out = NULL;
+
+	if (!odb->objects_dir)
+		return 0;
+
+	if (git_buf_joinpath(&path, odb->objects_dir, GIT_COMMIT_GRAPH_FILE) < 0)
+		return -1;
+
+	if (git_mutex_lock(&odb->lock) < 0) {
+		giterr_set(GITERR_ODB, "failed to acquire the odb lock");
+		git_buf_free(&path);
+		return -1;
+	}
+
+	if (odb->commit_graph &&
+		git_commit_graph_needs_refresh(odb->commit_graph, path.ptr)) {
+		git_commit_graph_free(odb->commit_graph);
+		odb->commit_graph = NULL;
+	}
+
+	if (!odb->commit_graph && git_path_isfile(path.ptr)) {
+		if ((error = git_commit_graph_open(&file, path.ptr)) == 0)
+			odb->commit_graph = file;
+	}
+
+	if ((*out = odb->commit_graph) != NULL)
+		git_commit_graph_incref(odb->commit_graph);
+
+	git_mutex_unlock(&odb->lock);
+	git_buf_free(&path);
+	return error;
+}
+
 static void odb_free(git_odb *db)
 {
 	size_t i;
@@ -656,6 +752,9 @@ static void odb_free(git_odb *db)
 
 	git_vector_free(&db->backends);
 	git_cache_free(&db->own_cache);
+	git_commit_graph_free(db->commit_graph);
+	git__free(db->objects_dir);
+	git_mutex_free(&db->lock);
 
 	git__memzero(db, sizeof(*db));
 	git__free(db);
@@ -684,8 +783,10 @@ static int odb_exists_1(
 		if (only_refreshed && !b->refresh)
 			continue;
 
-		if (b->exists != NULL)
+		if (b->exists != NULL) {
+			odb_count_lookup(internal);
 			found = (bool)b->exists(b, id);
+		}
 	}
 
 	return (int)found;
@@ -767,6 +868,7 @@ static int odb_exists_prefix_1(git_oid *out, git_odb *db,
 		if (!b->exists_prefix)
 			continue;
 
+		odb_count_lookup(internal);
 		error = b->exists_prefix(&found, b, key, len);
 		if (error == GIT_ENOTFOUND || error == GIT_PASSTHROUGH)
 			continue;
@@ -913,6 +1015,7 @@ static int odb_read_header_1(
 	size_t i;
 	git_otype ht;
 	bool passthrough = false;
+	double start;
 	int error;
 
 	if (!only_refreshed && (ht = odb_hardcoded_type(id)) != GIT_OBJ_BAD) {
@@ -933,6 +1036,8 @@ static int odb_read_header_1(
 			continue;
 		}
 
+		odb_count_lookup(internal);
+		start = git_trace_start(GIT_TRACE_TRACE);
 		error = b->read_header(len_p, type_p, b, id);
 
 		switch (error) {
@@ -941,6 +1046,11 @@ static int odb_read_header_1(
 			break;
 		case GIT_ENOTFOUND:
 			break;
+		case 0:
+			git_trace_timed(GIT_TRACE_TRACE, start,
+				"odb: read header of %s from backend %"PRIuZ": %s, %"PRIuZ" bytes",
+				git_oid_tostr_s(id), i, git_object_type2string(*type_p), *len_p);
+			return 0;
 		default:
 			return error;
 		}
@@ -1002,6 +1112,7 @@ static int odb_read_1(git_odb_object **out, git_odb *db, const git_oid *id,
 	git_odb_object *object;
 	git_oid hashed;
 	bool found = false;
+	double start;
 	int error = 0;
 
 	if (!only_refreshed && odb_read_hardcoded(&raw, id) == 0)
@@ -1015,6 +1126,8 @@ static int odb_read_1(git_odb_object **out, git_odb *db, const git_oid *id,
 			continue;
 
 		if (b->read != NULL) {
+			odb_count_lookup(internal);
+			start = git_trace_start(GIT_TRACE_TRACE);
 			error = b->read(&raw.data, &raw.len, &raw.type, b, id);
 			if (error == GIT_PASSTHROUGH || error == GIT_ENOTFOUND)
 				continue;
@@ -1022,6 +1135,9 @@ static int odb_read_1(git_odb_object **out, git_odb *db, const git_oid *id,
 			if (error < 0)
 				return error;
 
+			git_trace_timed(GIT_TRACE_TRACE, start,
+				"odb: read %s from backend %"PRIuZ": %s, %"PRIuZ" bytes",
+				git_oid_tostr_s(id), i, git_object_type2string(raw.type), raw.len);
 			found = true;
 		}
 	}
@@ -1072,6 +1188,193 @@ int git_odb_read(git_odb_object **out, git_odb *db, const git_oid *id)
 	return error;
 }
 
+typedef struct {
+	git_odb *db;
+	const git_oid *ids;
+	bool *found;
+	size_t count;
+	git_odb_read_many_cb cb;
+	void *payload;
+} odb_read_many_state;
+
+/* Hands a raw object to the caller of `git_odb_read_many`, taking over its data */
+static int odb_read_many_deliver(
+	odb_read_many_state *state, const git_oid *id, git_rawobj *raw)
+{
+	git_odb_object *object;
+	git_oid hashed;
+	int error;
+
+	if (git_odb__strict_hash_verification) {
+		if ((error = git_odb_hash(&hashed, raw->data, raw->len, raw->type)) < 0 ||
+			(!git_oid_equal(id, &hashed) &&
+			 (error = git_odb__error_mismatch(id, &hashed)) < 0)) {
+			git__free(raw->data);
+			return error;
+		}
+	}
+
+	if ((object = odb_object__alloc(id, raw)) == NULL) {
+		git__free(raw->data);
+		return -1;
+	}
+
+	object = git_cache_store_raw(odb_cache(state->db), object);
+	error = state->cb(id, object, state->payload);
+	git_odb_object_free(object);
+
+	return giterr_set_after_callback_function(error, "git_odb_read_many");
+}
+
+static int odb_read_many_found(
+	size_t pos, void *data, size_t len, git_otype type, void *payload)
+{
+	odb_read_many_state *state = payload;
+	git_rawobj raw;
+
+	if (pos >= state->count || state->found[pos]) {
+		git__free(data);
+		giterr_set(GITERR_ODB, "backend returned an object which was not asked for");
+		return -1;
+	}
+
+	raw.data = data;
+	raw.len = len;
+	raw.type = type;
+	state->found[pos] = true;
+
+	return odb_read_many_deliver(state, &state->ids[pos], &raw);
+}
+
+/*
+ * Asks each backend in turn for the ids none of the backends before it
+ * had, and leaves the ones which weren't found at the start of `ids`.
+ */
+static int odb_read_many_1(
+	odb_read_many_state *state, git_oid *ids, size_t *count,
+	bool only_refreshed)
+{
+	git_odb *db = state->db;
+	git_rawobj raw;
+	size_t i, j, missing;
+	int error = 0;
+
+	for (i = 0; i < db->backends.length && *count > 0; ++i) {
+		backend_internal *internal = git_vector_get(&db->backends, i);
+		git_odb_backend *b = internal->backend;
+
+		if (only_refreshed && !b->refresh)
+			continue;
+
+		state->ids = ids;
+		state->count = *count;
+		memset(state->found, 0, *count * sizeof(bool));
+
+		if (b->read_many != NULL) {
+			git_atomic_ssize_add(&internal->lookups, *count);
+			error = b->read_many(b, ids, *count, odb_read_many_found, state);
+			if (error == GIT_PASSTHROUGH)
+				error = 0;
+		} else if (b->read != NULL) {
+			for (j = 0; j < *count && !error; j++) {
+				odb_count_lookup(internal);
+				error = b->read(&raw.data, &raw.len, &raw.type, b, &ids[j]);
+
+				if (error == GIT_PASSTHROUGH || error == GIT_ENOTFOUND) {
+					error = 0;
+					continue;
+				}
+
+				if (error == 0) {
+					state->found[j] = true;
+					error = odb_read_many_deliver(state, &ids[j], &raw);
+				}
+			}
+		}
+
+		if (error)
+			return error;
+
+		for (j = 0, missing = 0; j < *count; j++) {
+			if (!state->found[j])
+				git_oid_cpy(&ids[missing++], &ids[j]);
+		}
+
+		*count = missing;
+	}
+
+	return 0;
+}
+
+int git_odb_read_many(
+	git_odb *db, const git_oid *ids, size_t count,
+	git_odb_read_many_cb cb, void *payload)
+{
+	odb_read_many_state state = {0};
+	git_oid *missing = NULL;
+	git_odb_object *object;
+	git_rawobj raw;
+	size_t i, cached = 0, missing_count = 0;
+	double start;
+	int error = 0;
+
+	assert(db && (ids || !count) && cb);
+
+	start = git_trace_start(GIT_TRACE_DEBUG);
+
+	state.db = db;
+	state.cb = cb;
+	state.payload = payload;
+
+	missing = git__calloc(count ? count : 1, sizeof(git_oid));
+	state.found = git__calloc(count ? count : 1, sizeof(bool));
+
+	if (!missing || !state.found) {
+		error = -1;
+		goto done;
+	}
+
+	for (i = 0; i < count; i++) {
+		if ((object = git_cache_get_raw(odb_cache(db), &ids[i])) != NULL) {
+			error = cb(&ids[i], object, payload);
+			git_odb_object_free(object);
+
+			if ((error = giterr_set_after_callback_function(
+					error, "git_odb_read_many")) != 0)
+				goto done;
+
+			cached++;
+		} else if (odb_read_hardcoded(&raw, &ids[i]) == 0) {
+			if ((error = odb_read_many_deliver(&state, &ids[i], &raw)) != 0)
+				goto done;
+		} else {
+			git_oid_cpy(&missing[missing_count++], &ids[i]);
+		}
+	}
+
+	if ((error = odb_read_many_1(&state, missing, &missing_count, false)) != 0)
+		goto done;
+
+	if (missing_count > 0 && !git_odb_refresh(db) &&
+		(error = odb_read_many_1(&state, missing, &missing_count, true)) != 0)
+		goto done;
+
+	for (i = 0; i < missing_count; i++) {
+		if ((error = giterr_set_after_callback_function(
+				cb(&missing[i], NULL, payload), "git_odb_read_many")) != 0)
+			goto done;
+	}
+
+	git_trace_timed(GIT_TRACE_DEBUG, start,
+		"odb: read %"PRIuZ" objects, %"PRIuZ" from the cache, %"PRIuZ" missing",
+		count, cached, missing_count);
+
+done:
+	git__free(state.found);
+	git__free(missing);
+	return error;
+}
+
 static int odb_otype_fast(git_otype *type_p, git_odb *db, const git_oid *id)
 {
 	git_odb_object *object;
@@ -1115,6 +1418,8 @@ static int read_prefix_1(git_odb_object **out, git_odb *db,
 
 		if (b->read_prefix != NULL) {
 			git_oid full_oid;
+
+			odb_count_lookup(internal);
 			error = b->read_prefix(&full_oid, &raw.data, &raw.len, &raw.type, b, key, len);
 
 			if (error == GIT_ENOTFOUND || error == GIT_PASSTHROUGH) {
@@ -1432,6 +1737,35 @@ int git_odb_write_pack(struct git_odb_writepack **out, git_odb *db, git_transfer
 	return error;
 }
 
+int git_odb_write_multi_pack_index(git_odb *db)
+{
+	size_t i, writes = 0;
+	int error = GIT_ERROR;
+
+	assert(db);
+
+	for (i = 0; i < db->backends.length && error < 0; ++i) {
+		backend_internal *internal = git_vector_get(&db->backends, i);
+		git_odb_backend *b = internal->backend;
+
+		/* we don't write in alternates! */
+		if (internal->is_alternate)
+			continue;
+
+		if (b->writemidx != NULL) {
+			++writes;
+			error = b->writemidx(b);
+		}
+	}
+
+	if (error == GIT_PASSTHROUGH)
+		error = 0;
+	if (error < 0 && !writes)
+		error = git_odb__error_unsupported_in_backend("write multi-pack-index");
+
+	return error;
+}
+
 void *git_odb_backend_malloc(git_odb_backend *backend, size_t len)
 {
 	GIT_UNUSED(backend);
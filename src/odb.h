@@ -17,6 +17,7 @@
 #include "cache.h"
 #include "posix.h"
 #include "filter.h"
+#include "commit_graph.h"
 
 #define GIT_OBJECTS_DIR "objects/"
 #define GIT_OBJECT_DIR_MODE 0777
@@ -40,8 +41,11 @@ struct git_odb_object {
 /* EXPORT */
 struct git_odb {
 	git_refcount rc;
+	git_mutex lock; /* protects commit_graph */
 	git_vector backends;
 	git_cache own_cache;
+	char *objects_dir; /* the non-alternate objects directory, if any */
+	git_commit_graph_file *commit_graph;
 	unsigned int do_fsync :1;
 };
 
@@ -128,6 +132,29 @@ int git_odb__read_header_or_object(
 /* freshen an entry in the object database */
 int git_odb__freshen(git_odb *db, const git_oid *id);
 
+/*
+ * Get the commit-graph of the main objects directory. `out` is set to
+ * NULL when there is no commit-graph file; otherwise the caller owns a
+ * reference and must release it with `git_commit_graph_free`.
+ */
+int git_odb__get_commit_graph(git_commit_graph_file **out, git_odb *odb);
+
+struct git_pack_file;
+typedef int (*git_pack_file_cb)(struct git_pack_file *p, void *payload);
+
+/*
+ * Call `cb` for each packfile of a pack backend; returns GIT_PASSTHROUGH
+ * when `backend` was not created by `git_odb_backend_pack`.
+ */
+int git_pack_backend__foreach_pack(
+	git_odb_backend *backend, git_pack_file_cb cb, void *payload);
+
+/*
+ * Call `cb` for each packfile in the object database, leaving out
+ * alternates. Stops and returns the value when `cb` returns non-zero.
+ */
+int git_odb__foreach_pack(git_odb *odb, git_pack_file_cb cb, void *payload);
+
 /* fully free the object; internal method, DO NOT EXPORT */
 void git_odb_object__free(void *object);
 
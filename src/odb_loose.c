@@ -16,6 +16,7 @@
 #include "delta.h"
 #include "filebuf.h"
 #include "object.h"
+#include "zstream.h"
 
 #include "git2/odb_backend.h"
 #include "git2/types.h"
@@ -173,13 +174,6 @@ static size_t get_object_header(obj_hdr *hdr, unsigned char *data)
  *
  ***********************************************************/
 
-static void init_stream(z_stream *s, void *out, size_t len)
-{
-	memset(s, 0, sizeof(*s));
-	s->next_out = out;
-	s->avail_out = (uInt)len;
-}
-
 static void set_stream_input(z_stream *s, void *in, size_t len)
 {
 	s->next_in = in;
@@ -193,34 +187,35 @@ static void set_stream_output(z_stream *s, void *out, size_t len)
 }
 
 
-static int start_inflate(z_stream *s, git_buf *obj, void *out, size_t len)
+static int start_inflate(z_stream **s, git_buf *obj, void *out, size_t len)
 {
-	int status;
-
-	init_stream(s, out, len);
-	set_stream_input(s, obj->ptr, git_buf_len(obj));
+	if (git_zstream__inflater_get(s) < 0)
+		return Z_MEM_ERROR;
 
-	if ((status = inflateInit(s)) < Z_OK)
-		return status;
+	set_stream_output(*s, out, len);
+	set_stream_input(*s, obj->ptr, git_buf_len(obj));
 
-	return inflate(s, 0);
+	return inflate(*s, 0);
 }
 
 static void abort_inflate(z_stream *s)
 {
-	inflateEnd(s);
+	git_zstream__inflater_put(s);
 }
 
 static int finish_inflate(z_stream *s)
 {
 	int status = Z_OK;
+	uInt avail_in;
 
 	while (status == Z_OK)
 		status = inflate(s, Z_FINISH);
 
-	inflateEnd(s);
+	avail_in = s->avail_in;
+	git_zstream__count_inflated(s->total_out);
+	git_zstream__inflater_put(s);
 
-	if ((status != Z_STREAM_END) || (s->avail_in != 0)) {
+	if ((status != Z_STREAM_END) || (avail_in != 0)) {
 		giterr_set(GITERR_ZLIB, "failed to finish zlib inflation; stream aborted prematurely");
 		return -1;
 	}
@@ -238,29 +233,25 @@ static int is_zlib_compressed_data(unsigned char *data)
 
 static int inflate_buffer(void *in, size_t inlen, void *out, size_t outlen)
 {
-	z_stream zs;
+	z_stream *zs;
+	size_t total_out;
 	int status = Z_OK;
 
-	memset(&zs, 0x0, sizeof(zs));
-
-	zs.next_out = out;
-	zs.avail_out = (uInt)outlen;
-
-	zs.next_in = in;
-	zs.avail_in = (uInt)inlen;
-
-	if (inflateInit(&zs) < Z_OK) {
-		giterr_set(GITERR_ZLIB, "failed to inflate buffer");
+	if (git_zstream__inflater_get(&zs) < 0)
 		return -1;
-	}
+
+	set_stream_output(zs, out, outlen);
+	set_stream_input(zs, in, inlen);
 
 	while (status == Z_OK)
-		status = inflate(&zs, Z_FINISH);
+		status = inflate(zs, Z_FINISH);
 
-	inflateEnd(&zs);
+	total_out = zs->total_out;
+	git_zstream__inflater_put(zs);
+	git_zstream__count_inflated(total_out);
 
-	if (status != Z_STREAM_END /* || zs.avail_in != 0 */ ||
-		zs.total_out != outlen)
+	if (status != Z_STREAM_END /* || zs->avail_in != 0 */ ||
+		total_out != outlen)
 	{
 		giterr_set(GITERR_ZLIB, "failed to inflate buffer; stream aborted prematurely");
 		return -1;
@@ -281,7 +272,7 @@ static void *inflate_tail(z_stream *s, void *hb, size_t used, obj_hdr *hdr)
 	 */
 	if (GIT_ADD_SIZET_OVERFLOW(&alloc_size, hdr->size, 1) ||
 		(buf = git__malloc(alloc_size)) == NULL) {
-		inflateEnd(s);
+		git_zstream__inflater_put(s);
 		return NULL;
 	}
 	tail = s->total_out - used;
@@ -296,7 +287,7 @@ static void *inflate_tail(z_stream *s, void *hb, size_t used, obj_hdr *hdr)
 	 * inflate the remainder of the object data, if any
 	 */
 	if (hdr->size < used)
-		inflateEnd(s);
+		git_zstream__inflater_put(s);
 	else {
 		set_stream_output(s, buf + used, hdr->size - used);
 		if (finish_inflate(s)) {
@@ -355,7 +346,7 @@ static int inflate_packlike_loose_disk_obj(git_rawobj *out, git_buf *obj)
 static int inflate_disk_obj(git_rawobj *out, git_buf *obj)
 {
 	unsigned char head[64], *buf;
-	z_stream zs;
+	z_stream *zs = NULL;
 	obj_hdr hdr;
 	size_t used;
 
@@ -373,7 +364,7 @@ static int inflate_disk_obj(git_rawobj *out, git_buf *obj)
 		(used = get_object_header(&hdr, head)) == 0 ||
 		!git_object_typeisloose(hdr.type))
 	{
-		abort_inflate(&zs);
+		abort_inflate(zs);
 		giterr_set(GITERR_ODB, "failed to inflate disk object");
 		return -1;
 	}
@@ -382,7 +373,7 @@ static int inflate_disk_obj(git_rawobj *out, git_buf *obj)
 	 * allocate a buffer and inflate the object data into it
 	 * (including the initial sequence in the head buffer).
 	 */
-	if ((buf = inflate_tail(&zs, head, used, &hdr)) == NULL)
+	if ((buf = inflate_tail(zs, head, used, &hdr)) == NULL)
 		return -1;
 	buf[hdr.size] = '\0';
 
@@ -431,9 +422,9 @@ static int read_loose(git_rawobj *out, git_buf *loc)
 
 static int read_header_loose(git_rawobj *out, git_buf *loc)
 {
-	int error = 0, z_return = Z_ERRNO, read_bytes;
+	int error = 0, z_return = Z_OK, read_bytes;
 	git_file fd;
-	z_stream zs;
+	z_stream *zs;
 	obj_hdr header_obj;
 	unsigned char raw_buffer[16], inflated_buffer[64];
 
@@ -447,14 +438,17 @@ static int read_header_loose(git_rawobj *out, git_buf *loc)
 	if ((fd = git_futils_open_ro(loc->ptr)) < 0)
 		return fd;
 
-	init_stream(&zs, inflated_buffer, sizeof(inflated_buffer));
+	if (git_zstream__inflater_get(&zs) < 0) {
+		p_close(fd);
+		return -1;
+	}
 
-	z_return = inflateInit(&zs);
+	set_stream_output(zs, inflated_buffer, sizeof(inflated_buffer));
 
 	while (z_return == Z_OK) {
 		if ((read_bytes = p_read(fd, raw_buffer, sizeof(raw_buffer))) > 0) {
-			set_stream_input(&zs, raw_buffer, read_bytes);
-			z_return = inflate(&zs, 0);
+			set_stream_input(zs, raw_buffer, read_bytes);
+			z_return = inflate(zs, 0);
 		} else
 			z_return = Z_STREAM_END;
 	}
@@ -470,7 +464,7 @@ static int read_header_loose(git_rawobj *out, git_buf *loc)
 		out->type = header_obj.type;
 	}
 
-	finish_inflate(&zs);
+	finish_inflate(zs);
 	p_close(fd);
 
 	return error;
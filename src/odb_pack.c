@@ -16,6 +16,7 @@
 #include "odb.h"
 #include "delta.h"
 #include "sha1_lookup.h"
+#include "midx.h"
 #include "mwindow.h"
 #include "pack.h"
 
@@ -29,6 +30,18 @@ struct pack_backend {
 	git_vector packs;
 	struct git_pack_file *last_found;
 	char *pack_folder;
+
+	/*
+	 * The multi-pack-index of the pack folder, if any, and the packs it
+	 * covers, in the order of its pack indices. Those packs are not in
+	 * `packs`, which only holds the ones that must be searched one by one.
+	 */
+	git_midx_file *midx;
+	git_vector midx_packs;
+
+	/* The pack folder as it was when it was last read */
+	git_futils_filestamp pack_folder_stamp;
+	bool pack_folder_racy;
 };
 
 struct pack_writepack {
@@ -73,6 +86,11 @@ struct pack_writepack {
  *	 |		such as the full path, the size, and the modification time.
  *	 |		We don't actually open the packfile to check for internal consistency.
  *	|
+ *	|-# refresh_multi_pack_index
+ *	| Load the `multi-pack-index` of the pack folder, if there is one,
+ *	| along with every pack it covers. Those packs are kept apart from
+ *	| the others and `packfile_load__cb` skips them.
+ *	|
  *	|-# packfile_sort__cb
  *		Sort all the preloaded packs according to some specific criteria:
  *		we prioritize the "newer" packs because it's more likely they
@@ -90,7 +108,9 @@ struct pack_writepack {
  * | that have been loaded for our ODB.
  * |
  * |-# pack_entry_find
- *	| Iterate through all the packs that have been preloaded
+ *	| Look the OID up in the multi-pack-index, if there is one: a
+ *	| single binary search for all the packs it covers. Otherwise,
+ *	| iterate through all the other packs that have been preloaded
  *	| (starting by the pack where the latest object was found)
  *	| to try to find the OID in one of them.
  *	|
@@ -214,6 +234,9 @@ static int packfile_load__cb(void *data, git_buf *path)
 			return 0;
 	}
 
+	if (backend->midx && git_midx_contains_pack(backend->midx, path_str))
+		return 0;
+
 	error = git_mwindow_get_pack(&pack, path->ptr);
 
 	/* ignore missing .pack file as git does */
@@ -229,6 +252,123 @@ static int packfile_load__cb(void *data, git_buf *path)
 
 }
 
+static void remove_multi_pack_index(struct pack_backend *backend)
+{
+	struct git_pack_file *p;
+	size_t i;
+
+	git_vector_foreach(&backend->midx_packs, i, p) {
+		if (p == backend->last_found)
+			backend->last_found = NULL;
+		git_mwindow_put_pack(p);
+	}
+
+	git_vector_clear(&backend->midx_packs);
+	git_midx_free(backend->midx);
+	backend->midx = NULL;
+}
+
+static int load_multi_pack_index(struct pack_backend *backend, const char *path)
+{
+	git_buf idx_path = GIT_BUF_INIT;
+	struct git_pack_file *p;
+	const char *name;
+	size_t i;
+	int error;
+
+	/* like git, carry on without a broken multi-pack-index */
+	if ((error = git_midx_open(&backend->midx, path)) < 0) {
+		giterr_clear();
+		return 0;
+	}
+
+	git_vector_foreach(&backend->midx->packfile_names, i, name) {
+		if ((error = git_buf_joinpath(&idx_path, backend->pack_folder, name)) < 0)
+			break;
+
+		if ((error = git_mwindow_get_pack(&p, idx_path.ptr)) < 0) {
+			/* a pack went away, the index is stale */
+			if (error == GIT_ENOTFOUND) {
+				giterr_clear();
+				error = 0;
+				remove_multi_pack_index(backend);
+			}
+			break;
+		}
+
+		if ((error = git_vector_insert(&backend->midx_packs, p)) < 0) {
+			git_mwindow_put_pack(p);
+			break;
+		}
+	}
+
+	git_buf_free(&idx_path);
+
+	if (error < 0) {
+		remove_multi_pack_index(backend);
+		return error;
+	}
+
+	if (!backend->midx)
+		return 0;
+
+	/* packs loaded before the index was written are now covered by it */
+	for (i = backend->packs.length; i > 0; i--) {
+		p = git_vector_get(&backend->packs, i - 1);
+
+		if (!git_midx_contains_pack(backend->midx, p->pack_name))
+			continue;
+
+		if (p == backend->last_found)
+			backend->last_found = NULL;
+		git_vector_remove(&backend->packs, i - 1);
+		git_mwindow_put_pack(p);
+	}
+
+	return 0;
+}
+
+static int refresh_multi_pack_index(struct pack_backend *backend)
+{
+	git_buf path = GIT_BUF_INIT;
+	int error = 0;
+
+	if (git_buf_joinpath(&path, backend->pack_folder, GIT_MIDX_FILE) < 0)
+		return -1;
+
+	if (backend->midx) {
+		if (!git_midx_needs_refresh(backend->midx, path.ptr))
+			goto done;
+
+		remove_multi_pack_index(backend);
+	}
+
+	if (git_path_exists(path.ptr))
+		error = load_multi_pack_index(backend, path.ptr);
+
+done:
+	git_buf_free(&path);
+	return error;
+}
+
+static int pack_entry_find_midx(
+	struct git_pack_entry *e,
+	struct pack_backend *backend,
+	const git_oid *short_oid,
+	size_t len)
+{
+	git_midx_entry midx_entry;
+	struct git_pack_file *p;
+	int error;
+
+	if ((error = git_midx_entry_find(&midx_entry, backend->midx, short_oid, len)) < 0)
+		return error;
+
+	p = git_vector_get(&backend->midx_packs, midx_entry.pack_index);
+
+	return git_pack_entry_find_at(e, p, &midx_entry.sha1, midx_entry.offset);
+}
+
 static int pack_entry_find_inner(
 	struct git_pack_entry *e,
 	struct pack_backend *backend,
@@ -241,6 +381,12 @@ static int pack_entry_find_inner(
 		git_pack_entry_find(e, last_found, oid, GIT_OID_HEXSZ) == 0)
 		return 0;
 
+	if (backend->midx &&
+		pack_entry_find_midx(e, backend, oid, GIT_OID_HEXSZ) == 0) {
+		backend->last_found = e->p;
+		return 0;
+	}
+
 	for (i = 0; i < backend->packs.length; ++i) {
 		struct git_pack_file *p;
 
@@ -294,6 +440,19 @@ static int pack_entry_find_prefix(
 		}
 	}
 
+	if (backend->midx) {
+		error = pack_entry_find_midx(e, backend, short_oid, len);
+		if (error == GIT_EAMBIGUOUS)
+			return error;
+		if (!error) {
+			if (found && git_oid_cmp(&e->sha1, &found_full_oid))
+				return git_odb__error_ambiguous("found multiple pack entries");
+			git_oid_cpy(&found_full_oid, &e->sha1);
+			found = true;
+			backend->last_found = e->p;
+		}
+	}
+
 	for (i = 0; i < backend->packs.length; ++i) {
 		struct git_pack_file *p;
 
@@ -341,6 +500,20 @@ static int pack_backend__refresh(git_odb_backend *backend_)
 	if (p_stat(backend->pack_folder, &st) < 0 || !S_ISDIR(st.st_mode))
 		return git_odb__error_notfound("failed to refresh packfiles", NULL, 0);
 
+	/*
+	 * Looking for objects which don't exist refreshes the backend every
+	 * time, so only read the folder again when it changed.  A folder
+	 * which changed in the second it was read in may change again with
+	 * the same timestamp, so it is always read again the next time.
+	 */
+	if (!backend->pack_folder_racy &&
+		git_futils_filestamp_check(
+			&backend->pack_folder_stamp, backend->pack_folder) == 0)
+		return 0;
+
+	if ((error = refresh_multi_pack_index(backend)) < 0)
+		goto done;
+
 	git_buf_sets(&path, backend->pack_folder);
 
 	/* reload all packs */
@@ -349,6 +522,14 @@ static int pack_backend__refresh(git_odb_backend *backend_)
 	git_buf_free(&path);
 	git_vector_sort(&backend->packs);
 
+done:
+	if (error < 0) {
+		git_futils_filestamp_set(&backend->pack_folder_stamp, NULL);
+	} else {
+		git_futils_filestamp_set_from_stat(&backend->pack_folder_stamp, &st);
+		backend->pack_folder_racy = (st.st_mtime >= time(NULL) - 1);
+	}
+
 	return error;
 }
 
@@ -408,6 +589,70 @@ static int pack_backend__read(
 	return 0;
 }
 
+struct pack_read_request {
+	struct git_pack_file *p;
+	git_off_t offset;
+	size_t pos;
+};
+
+static int pack_read_request_cmp(const void *a_, const void *b_, void *payload)
+{
+	const struct pack_read_request *a = a_, *b = b_;
+
+	GIT_UNUSED(payload);
+
+	if (a->p != b->p)
+		return ((uintptr_t)a->p < (uintptr_t)b->p) ? -1 : 1;
+
+	return (a->offset < b->offset) ? -1 : (a->offset > b->offset);
+}
+
+/*
+ * Objects are unpacked in the order they are stored, so that a batch
+ * reads each pack front to back: the windows which were mapped for an
+ * object are still open for the next one, and the bases of deltas
+ * (which come before them in the pack) are in the delta base cache
+ * when the deltas are read.
+ */
+static int pack_backend__read_many(
+	git_odb_backend *_backend, const git_oid *ids, size_t count,
+	git_odb_backend_read_cb cb, void *payload)
+{
+	struct pack_backend *backend = (struct pack_backend *)_backend;
+	struct pack_read_request *requests;
+	struct git_pack_entry e;
+	git_rawobj raw;
+	size_t i, found = 0;
+	int error = 0;
+
+	requests = git__calloc(count ? count : 1, sizeof(struct pack_read_request));
+	GITERR_CHECK_ALLOC(requests);
+
+	for (i = 0; i < count; i++) {
+		if (pack_entry_find(&e, backend, &ids[i]) < 0)
+			continue;
+
+		requests[found].p = e.p;
+		requests[found].offset = e.offset;
+		requests[found].pos = i;
+		found++;
+	}
+
+	giterr_clear();
+	git__qsort_r(requests, found, sizeof(struct pack_read_request),
+		pack_read_request_cmp, NULL);
+
+	for (i = 0; i < found; i++) {
+		if ((error = git_packfile_unpack(
+				&raw, requests[i].p, &requests[i].offset)) < 0 ||
+			(error = cb(requests[i].pos, raw.data, raw.len, raw.type, payload)) != 0)
+			break;
+	}
+
+	git__free(requests);
+	return error;
+}
+
 static int pack_backend__read_prefix(
 	git_oid *out_oid,
 	void **buffer_p,
@@ -477,6 +722,11 @@ static int pack_backend__foreach(git_odb_backend *_backend, git_odb_foreach_cb c
 	if ((error = pack_backend__refresh(_backend)) < 0)
 		return error;
 
+	git_vector_foreach(&backend->midx_packs, i, p) {
+		if ((error = git_pack_foreach_entry(p, cb, data)) < 0)
+			return error;
+	}
+
 	git_vector_foreach(&backend->packs, i, p) {
 		if ((error = git_pack_foreach_entry(p, cb, data)) < 0)
 			return error;
@@ -485,6 +735,26 @@ static int pack_backend__foreach(git_odb_backend *_backend, git_odb_foreach_cb c
 	return 0;
 }
 
+static int pack_backend__writemidx(git_odb_backend *_backend)
+{
+	struct pack_backend *backend;
+	int error;
+
+	assert(_backend);
+
+	backend = (struct pack_backend *)_backend;
+
+	if (backend->pack_folder == NULL) {
+		giterr_set(GITERR_ODB, "cannot write multi-pack-index: no pack folder");
+		return -1;
+	}
+
+	if ((error = git_midx_write(backend->pack_folder)) < 0)
+		return error;
+
+	return pack_backend__refresh(_backend);
+}
+
 static int pack_backend__writepack_append(struct git_odb_writepack *_writepack, const void *data, size_t size, git_transfer_progress *stats)
 {
 	struct pack_writepack *writepack = (struct pack_writepack *)_writepack;
@@ -556,16 +826,47 @@ static void pack_backend__free(git_odb_backend *_backend)
 
 	backend = (struct pack_backend *)_backend;
 
+	remove_multi_pack_index(backend);
+
 	for (i = 0; i < backend->packs.length; ++i) {
 		struct git_pack_file *p = git_vector_get(&backend->packs, i);
 		git_mwindow_put_pack(p);
 	}
 
+	git_vector_free(&backend->midx_packs);
 	git_vector_free(&backend->packs);
 	git__free(backend->pack_folder);
 	git__free(backend);
 }
 
+int git_pack_backend__foreach_pack(
+	git_odb_backend *_backend, git_pack_file_cb cb, void *payload)
+{
+	struct pack_backend *backend;
+	struct git_pack_file *p;
+	size_t i;
+	int error;
+
+	assert(_backend && cb);
+
+	if (_backend->free != &pack_backend__free)
+		return GIT_PASSTHROUGH;
+
+	backend = (struct pack_backend *)_backend;
+
+	git_vector_foreach(&backend->midx_packs, i, p) {
+		if ((error = cb(p, payload)) != 0)
+			return error;
+	}
+
+	git_vector_foreach(&backend->packs, i, p) {
+		if ((error = cb(p, payload)) != 0)
+			return error;
+	}
+
+	return 0;
+}
+
 static int pack_backend__alloc(struct pack_backend **out, size_t initial_size)
 {
 	struct pack_backend *backend = git__calloc(1, sizeof(struct pack_backend));
@@ -587,6 +888,8 @@ static int pack_backend__alloc(struct pack_backend **out, size_t initial_size)
 	backend->parent.foreach = &pack_backend__foreach;
 	backend->parent.writepack = &pack_backend__writepack;
 	backend->parent.freshen = &pack_backend__freshen;
+	backend->parent.writemidx = &pack_backend__writemidx;
+	backend->parent.read_many = &pack_backend__read_many;
 	backend->parent.free = &pack_backend__free;
 
 	*out = backend;
@@ -0,0 +1,215 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "odb_prefetch.h"
+
+#include "array.h"
+#include "repository.h"
+#include "tree.h"
+
+bool git_odb__prefetch_enabled = false;
+
+/* Ids handed to `git_odb_read_many` at once */
+#define PREFETCH_BATCH 64
+
+/* A walk which got that far ahead of the reader can read objects itself */
+#define PREFETCH_MAX_QUEUED 4096
+
+struct git_odb_prefetch {
+	git_odb *odb;
+	git_thread thread;
+	git_mutex lock;
+	git_cond queued_cond;
+	git_cond read_cond;
+	git_array_t(git_oid) queue;
+	size_t next;
+	bool reading;
+	bool shutdown;
+};
+
+#ifdef GIT_THREADS
+
+static int prefetch_read_cb(
+	const git_oid *id, git_odb_object *object, void *payload)
+{
+	GIT_UNUSED(id);
+	GIT_UNUSED(object);
+	GIT_UNUSED(payload);
+
+	return 0;
+}
+
+static void *prefetch_worker(void *arg)
+{
+	git_odb_prefetch *prefetch = arg;
+	git_oid batch[PREFETCH_BATCH];
+	size_t count;
+
+	git_mutex_lock(&prefetch->lock);
+
+	while (true) {
+		while (prefetch->next == git_array_size(prefetch->queue) &&
+			!prefetch->shutdown)
+			git_cond_wait(&prefetch->queued_cond, &prefetch->lock);
+
+		if (prefetch->shutdown)
+			break;
+
+		count = min(PREFETCH_BATCH,
+			git_array_size(prefetch->queue) - prefetch->next);
+		memcpy(batch, &prefetch->queue.ptr[prefetch->next],
+			count * sizeof(git_oid));
+
+		prefetch->next += count;
+		if (prefetch->next == git_array_size(prefetch->queue))
+			prefetch->next = prefetch->queue.size = 0;
+
+		prefetch->reading = true;
+		git_mutex_unlock(&prefetch->lock);
+
+		/* the walk reads whatever we failed to read itself */
+		if (git_odb_read_many(prefetch->odb, batch, count,
+				prefetch_read_cb, NULL) < 0)
+			giterr_clear();
+
+		git_mutex_lock(&prefetch->lock);
+		prefetch->reading = false;
+		git_cond_broadcast(&prefetch->read_cond);
+	}
+
+	git_mutex_unlock(&prefetch->lock);
+	return NULL;
+}
+
+int git_odb_prefetch_new(git_odb_prefetch **out, git_repository *repo)
+{
+	git_odb_prefetch *prefetch;
+
+	*out = NULL;
+
+	if (!git_odb__prefetch_enabled)
+		return 0;
+
+	prefetch = git__calloc(1, sizeof(git_odb_prefetch));
+	GITERR_CHECK_ALLOC(prefetch);
+
+	if (git_repository_odb(&prefetch->odb, repo) < 0) {
+		git__free(prefetch);
+		return -1;
+	}
+
+	git_mutex_init(&prefetch->lock);
+	git_cond_init(&prefetch->queued_cond);
+	git_cond_init(&prefetch->read_cond);
+
+	if (git_thread_create(&prefetch->thread, prefetch_worker, prefetch)) {
+		giterr_set(GITERR_THREAD, "unable to create thread");
+		git_cond_free(&prefetch->read_cond);
+		git_cond_free(&prefetch->queued_cond);
+		git_mutex_free(&prefetch->lock);
+		git_odb_free(prefetch->odb);
+		git__free(prefetch);
+		return -1;
+	}
+
+	*out = prefetch;
+	return 0;
+}
+
+void git_odb_prefetch_subtrees(
+	git_odb_prefetch *prefetch, const git_tree *tree)
+{
+	const git_tree_entry *entry;
+	git_oid *id;
+	size_t i, queued = 0;
+
+	if (!prefetch)
+		return;
+
+	git_mutex_lock(&prefetch->lock);
+
+	git_array_foreach(tree->entries, i, entry) {
+		if (!git_tree_entry__is_tree(entry))
+			continue;
+
+		if (git_array_size(prefetch->queue) - prefetch->next >=
+				PREFETCH_MAX_QUEUED ||
+			(id = git_array_alloc(prefetch->queue)) == NULL)
+			break;
+
+		git_oid_cpy(id, entry->oid);
+		queued++;
+	}
+
+	if (queued)
+		git_cond_signal(&prefetch->queued_cond);
+
+	git_mutex_unlock(&prefetch->lock);
+}
+
+void git_odb_prefetch_wait(git_odb_prefetch *prefetch)
+{
+	if (!prefetch)
+		return;
+
+	git_mutex_lock(&prefetch->lock);
+
+	while (prefetch->next < git_array_size(prefetch->queue) ||
+		prefetch->reading)
+		git_cond_wait(&prefetch->read_cond, &prefetch->lock);
+
+	git_mutex_unlock(&prefetch->lock);
+}
+
+void git_odb_prefetch_free(git_odb_prefetch *prefetch)
+{
+	if (!prefetch)
+		return;
+
+	git_mutex_lock(&prefetch->lock);
+	prefetch->shutdown = true;
+	git_cond_signal(&prefetch->queued_cond);
+	git_mutex_unlock(&prefetch->lock);
+
+	git_thread_join(&prefetch->thread, NULL);
+
+	git_cond_free(&prefetch->read_cond);
+	git_cond_free(&prefetch->queued_cond);
+	git_mutex_free(&prefetch->lock);
+	git_array_clear(prefetch->queue);
+	git_odb_free(prefetch->odb);
+	git__free(prefetch);
+}
+
+#else
+
+int git_odb_prefetch_new(git_odb_prefetch **out, git_repository *repo)
+{
+	GIT_UNUSED(repo);
+
+	*out = NULL;
+	return 0;
+}
+
+void git_odb_prefetch_subtrees(
+	git_odb_prefetch *prefetch, const git_tree *tree)
+{
+	GIT_UNUSED(prefetch);
+	GIT_UNUSED(tree);
+}
+
+void git_odb_prefetch_wait(git_odb_prefetch *prefetch)
+{
+	GIT_UNUSED(prefetch);
+}
+
+void git_odb_prefetch_free(git_odb_prefetch *prefetch)
+{
+	GIT_UNUSED(prefetch);
+}
+
+#endif
@@ -0,0 +1,41 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_odb_prefetch_h__
+#define INCLUDE_odb_prefetch_h__
+
+#include "common.h"
+
+#include "git2/types.h"
+
+/**
+ * A prefetcher reads the trees a walk is about to look at on a
+ * background thread, while the walk parses the ones it already has,
+ * so that they are in the object cache by the time they are looked up.
+ * Blobs are not read ahead as they are not kept in the cache.
+ */
+typedef struct git_odb_prefetch git_odb_prefetch;
+
+extern bool git_odb__prefetch_enabled;
+
+/**
+ * Start a prefetcher for the objects of a repository.  `out` is set
+ * to NULL when prefetching is disabled; the other functions do nothing
+ * when given a NULL prefetcher.
+ */
+extern int git_odb_prefetch_new(git_odb_prefetch **out, git_repository *repo);
+
+/** Queue the subtrees of a tree to be read. */
+extern void git_odb_prefetch_subtrees(
+	git_odb_prefetch *prefetch, const git_tree *tree);
+
+/** Wait until all the queued objects were read. */
+extern void git_odb_prefetch_wait(git_odb_prefetch *prefetch);
+
+/** Stop the prefetcher, dropping the objects which weren't read yet. */
+extern void git_odb_prefetch_free(git_odb_prefetch *prefetch);
+
+#endif
@@ -0,0 +1,898 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "pack-bitmap.h"
+
+#include "git2/commit.h"
+#include "git2/tree.h"
+
+#include "array.h"
+#include "filebuf.h"
+#include "oidarray.h"
+#include "oidmap.h"
+#include "repository.h"
+
+#define BITMAP_SIGNATURE "BITM"
+#define BITMAP_VERSION 1
+
+#define BITMAP_OPT_FULL_DAG 1
+#define BITMAP_OPT_HASH_CACHE 4
+
+/* signature, version, options, entry count and the pack checksum */
+#define BITMAP_HEADER_SIZE (4 + 2 + 2 + 4 + GIT_OID_RAWSZ)
+/* index position, xor offset and flags */
+#define BITMAP_ENTRY_HEADER_SIZE (4 + 1 + 1)
+
+#define BITMAP_MAX_XOR_OFFSET 160
+
+/*
+ * Besides the tips of the history, store the bitmap of one commit in
+ * every so many, so that a commit is never too far away from a bitmap.
+ */
+#define BITMAP_COMMIT_INTERVAL 100
+
+enum {
+	BITMAP_COMMITS = 0,
+	BITMAP_TREES,
+	BITMAP_BLOBS,
+	BITMAP_TAGS,
+	BITMAP_TYPES
+};
+
+struct stored_bitmap {
+	git_oid id;
+	uint32_t index_pos;
+	git_ewah ewah;
+	struct stored_bitmap *xor_base;
+	git_bitmap bitmap;
+	unsigned int resolved:1;
+};
+
+struct git_pack_bitmap {
+	struct git_pack_file *pack;
+	git_map map;
+
+	uint32_t num_objects;
+	uint32_t *pack_order; /* pack position -> index position */
+	uint32_t *pack_positions; /* index position -> pack position */
+
+	git_bitmap types[BITMAP_TYPES];
+
+	struct stored_bitmap *entries;
+	size_t num_entries;
+	git_oidmap *commits; /* commit id -> stored_bitmap */
+
+	const unsigned char *hashes; /* name hash cache, in index order */
+};
+
+static int bitmap_error(const char *message)
+{
+	giterr_set(GITERR_ODB, "invalid pack bitmap - %s", message);
+	return -1;
+}
+
+static int offset_cmp(const void *a_, const void *b_, void *payload)
+{
+	const git_off_t *offsets = payload;
+	git_off_t a = offsets[*(const uint32_t *)a_], b = offsets[*(const uint32_t *)b_];
+
+	return (a < b) ? -1 : (a > b);
+}
+
+/* Map the positions of the objects in the index to the ones in the pack */
+static int build_pack_order(git_pack_bitmap *bitmap)
+{
+	git_off_t *offsets;
+	uint32_t i, n = bitmap->num_objects;
+	int error = 0;
+
+	offsets = git__calloc(n ? n : 1, sizeof(git_off_t));
+	GITERR_CHECK_ALLOC(offsets);
+
+	bitmap->pack_order = git__calloc(n ? n : 1, sizeof(uint32_t));
+	bitmap->pack_positions = git__calloc(n ? n : 1, sizeof(uint32_t));
+	if (!bitmap->pack_order || !bitmap->pack_positions) {
+		git__free(offsets);
+		giterr_set_oom();
+		return -1;
+	}
+
+	for (i = 0; i < n; i++) {
+		if ((error = git_pack_nth_entry_offset(&offsets[i], bitmap->pack, i)) < 0)
+			goto done;
+
+		bitmap->pack_order[i] = i;
+	}
+
+	git__qsort_r(bitmap->pack_order, n, sizeof(uint32_t), offset_cmp, offsets);
+
+	for (i = 0; i < n; i++)
+		bitmap->pack_positions[bitmap->pack_order[i]] = i;
+
+done:
+	git__free(offsets);
+	return error;
+}
+
+static int bitmap_alloc(git_pack_bitmap **out, struct git_pack_file *pack)
+{
+	git_pack_bitmap *bitmap;
+	git_oid checksum;
+	int error;
+
+	/* make sure the index is loaded */
+	if ((error = git_pack_checksum(&checksum, pack)) < 0)
+		return error;
+
+	bitmap = git__calloc(1, sizeof(git_pack_bitmap));
+	GITERR_CHECK_ALLOC(bitmap);
+
+	bitmap->pack = pack;
+	bitmap->num_objects = pack->num_objects;
+
+	bitmap->commits = git_oidmap_alloc();
+	if (!bitmap->commits) {
+		git__free(bitmap);
+		giterr_set_oom();
+		return -1;
+	}
+
+	if ((error = build_pack_order(bitmap)) < 0) {
+		git_pack_bitmap_free(bitmap);
+		return error;
+	}
+
+	*out = bitmap;
+	return 0;
+}
+
+static int bitmap_parse(git_pack_bitmap *bitmap, const unsigned char *data, size_t size)
+{
+	const unsigned char *end;
+	git_oid checksum;
+	git_ewah ewah;
+	uint16_t options;
+	uint32_t i, nr;
+	size_t consumed;
+	int error;
+
+	if (size < BITMAP_HEADER_SIZE + GIT_OID_RAWSZ)
+		return bitmap_error("file is too short");
+
+	if (memcmp(data, BITMAP_SIGNATURE, 4) != 0 ||
+		ntohs(*((uint16_t *)(data + 4))) != BITMAP_VERSION)
+		return bitmap_error("unsupported bitmap version");
+
+	options = ntohs(*((uint16_t *)(data + 6)));
+	if (!(options & BITMAP_OPT_FULL_DAG))
+		return bitmap_error("bitmaps which are not closed under reachability are not supported");
+
+	nr = ntohl(*((uint32_t *)(data + 8)));
+
+	if ((error = git_pack_checksum(&checksum, bitmap->pack)) < 0)
+		return error;
+
+	if (git_oid__cmp(&checksum, (const git_oid *)(data + 12)) != 0)
+		return bitmap_error("bitmap does not match its packfile");
+
+	end = data + size - GIT_OID_RAWSZ;
+	data += BITMAP_HEADER_SIZE;
+
+	for (i = 0; i < BITMAP_TYPES; i++) {
+		if ((error = git_ewah_parse(&ewah, &consumed, data, end - data)) < 0 ||
+			(error = git_ewah_or(&bitmap->types[i], &ewah)) < 0)
+			return error;
+
+		data += consumed;
+	}
+
+	bitmap->entries = git__calloc(nr ? nr : 1, sizeof(struct stored_bitmap));
+	GITERR_CHECK_ALLOC(bitmap->entries);
+
+	for (i = 0; i < nr; i++) {
+		struct stored_bitmap *entry = &bitmap->entries[i];
+		uint8_t xor_offset;
+
+		if ((size_t)(end - data) < BITMAP_ENTRY_HEADER_SIZE)
+			return bitmap_error("truncated bitmap entry");
+
+		entry->index_pos = ntohl(*((uint32_t *)data));
+		xor_offset = data[4];
+		data += BITMAP_ENTRY_HEADER_SIZE;
+
+		if ((error = git_ewah_parse(&entry->ewah, &consumed, data, end - data)) < 0)
+			return error;
+		data += consumed;
+
+		if (entry->index_pos >= bitmap->num_objects)
+			return bitmap_error("bitmap entry is out of bounds");
+
+		if (xor_offset > BITMAP_MAX_XOR_OFFSET || xor_offset > i)
+			return bitmap_error("bitmap entry has an invalid xor offset");
+
+		if (xor_offset)
+			entry->xor_base = &bitmap->entries[i - xor_offset];
+
+		if ((error = git_pack_nth_entry_oid(&entry->id, bitmap->pack, entry->index_pos)) < 0)
+			return error;
+
+		git_oidmap_insert(bitmap->commits, &entry->id, entry, &error);
+		if (error < 0) {
+			giterr_set_oom();
+			return -1;
+		}
+
+		bitmap->num_entries++;
+	}
+
+	if (options & BITMAP_OPT_HASH_CACHE) {
+		if ((size_t)(end - data) < bitmap->num_objects * sizeof(uint32_t))
+			return bitmap_error("truncated name hash cache");
+
+		bitmap->hashes = data;
+	}
+
+	return 0;
+}
+
+int git_pack_bitmap_open(git_pack_bitmap **out, struct git_pack_file *pack)
+{
+	git_pack_bitmap *bitmap = NULL;
+	git_buf path = GIT_BUF_INIT;
+	git_file fd = -1;
+	struct stat st;
+	size_t name_len;
+	int error;
+
+	assert(out && pack);
+
+	*out = NULL;
+
+	name_len = strlen(pack->pack_name);
+	if (git__suffixcmp(pack->pack_name, ".pack") != 0 ||
+		git_buf_put(&path, pack->pack_name, name_len - strlen(".pack")) < 0 ||
+		git_buf_puts(&path, ".bitmap") < 0)
+		return -1;
+
+	if (!git_path_isfile(path.ptr)) {
+		giterr_set(GITERR_ODB, "no bitmap index for '%s'", pack->pack_name);
+		error = GIT_ENOTFOUND;
+		goto done;
+	}
+
+	if ((error = bitmap_alloc(&bitmap, pack)) < 0)
+		goto done;
+
+	if ((fd = git_futils_open_ro(path.ptr)) < 0) {
+		error = fd;
+		goto done;
+	}
+
+	if (p_fstat(fd, &st) < 0 || !git__is_sizet(st.st_size)) {
+		giterr_set(GITERR_OS, "unable to stat bitmap index '%s'", path.ptr);
+		error = -1;
+		goto done;
+	}
+
+	if ((error = git_futils_mmap_ro(&bitmap->map, fd, 0, (size_t)st.st_size)) < 0 ||
+		(error = bitmap_parse(bitmap, bitmap->map.data, (size_t)st.st_size)) < 0)
+		goto done;
+
+	*out = bitmap;
+
+done:
+	if (fd >= 0)
+		p_close(fd);
+	if (error < 0)
+		git_pack_bitmap_free(bitmap);
+	git_buf_free(&path);
+	return error;
+}
+
+static int find_bitmap_cb(struct git_pack_file *p, void *payload)
+{
+	git_pack_bitmap **out = payload;
+	int error;
+
+	if ((error = git_pack_bitmap_open(out, p)) == GIT_ENOTFOUND) {
+		giterr_clear();
+		return 0;
+	}
+
+	/* a broken bitmap is no reason to fail, we can still walk */
+	if (error < 0) {
+		giterr_clear();
+		return 0;
+	}
+
+	return 1;
+}
+
+int git_pack_bitmap_find(git_pack_bitmap **out, git_odb *odb)
+{
+	int error;
+
+	assert(out && odb);
+
+	*out = NULL;
+
+	if ((error = git_odb__foreach_pack(odb, find_bitmap_cb, out)) < 0)
+		return error;
+
+	if (!*out) {
+		giterr_set(GITERR_ODB, "no packfile with a bitmap index");
+		return GIT_ENOTFOUND;
+	}
+
+	return 0;
+}
+
+static int bitmap_position(uint32_t *out, git_pack_bitmap *bitmap, const git_oid *id)
+{
+	uint32_t index_pos;
+	int error;
+
+	if ((error = git_pack_entry_position(&index_pos, bitmap->pack, id)) < 0)
+		return error;
+
+	*out = bitmap->pack_positions[index_pos];
+	return 0;
+}
+
+static int stored_bitmap_get(const git_bitmap **out, struct stored_bitmap *stored)
+{
+	const git_bitmap *base;
+
+	if (!stored->resolved) {
+		if (stored->xor_base) {
+			if (stored_bitmap_get(&base, stored->xor_base) < 0 ||
+				git_bitmap_or(&stored->bitmap, base) < 0 ||
+				git_ewah_xor(&stored->bitmap, &stored->ewah) < 0)
+				goto on_error;
+		} else if (git_ewah_or(&stored->bitmap, &stored->ewah) < 0) {
+			goto on_error;
+		}
+
+		stored->resolved = 1;
+	}
+
+	*out = &stored->bitmap;
+	return 0;
+
+on_error:
+	git_bitmap_free(&stored->bitmap);
+	return -1;
+}
+
+/*
+ * A tree's bit is only set once all of its entries are, so there is no
+ * need to look into trees which are already in the bitmap.
+ */
+static int fill_tree(
+	git_bitmap *out,
+	git_pack_bitmap *bitmap,
+	git_repository *repo,
+	const git_oid *id)
+{
+	git_tree *tree;
+	uint32_t pos;
+	size_t i;
+	int error;
+
+	if ((error = bitmap_position(&pos, bitmap, id)) < 0)
+		return error;
+
+	if (git_bitmap_get(out, pos))
+		return 0;
+
+	if ((error = git_tree_lookup(&tree, repo, id)) < 0)
+		return error;
+
+	for (i = 0; i < git_tree_entrycount(tree); i++) {
+		const git_tree_entry *entry = git_tree_entry_byindex(tree, i);
+		const git_oid *entry_id = git_tree_entry_id(entry);
+
+		switch (git_tree_entry_type(entry)) {
+		case GIT_OBJ_TREE:
+			error = fill_tree(out, bitmap, repo, entry_id);
+			break;
+		case GIT_OBJ_BLOB:
+			if ((error = bitmap_position(&pos, bitmap, entry_id)) == 0)
+				error = git_bitmap_set(out, pos);
+			break;
+		default:
+			/* it's a submodule or something unknown, we don't want it */
+			;
+		}
+
+		if (error < 0)
+			goto done;
+	}
+
+	if ((error = bitmap_position(&pos, bitmap, id)) == 0)
+		error = git_bitmap_set(out, pos);
+
+done:
+	git_tree_free(tree);
+	return error;
+}
+
+int git_pack_bitmap_reachable(
+	git_bitmap *out,
+	git_pack_bitmap *bitmap,
+	git_repository *repo,
+	const git_oid *id)
+{
+	git_array_oid_t pending = GIT_ARRAY_INIT, trees = GIT_ARRAY_INIT;
+	const git_bitmap *stored;
+	git_commit *commit;
+	git_oid current, *slot;
+	uint32_t pos;
+	khiter_t k;
+	size_t i;
+	int error = 0;
+
+	assert(out && bitmap && repo && id);
+
+	slot = git_array_alloc(pending);
+	GITERR_CHECK_ALLOC(slot);
+	git_oid_cpy(slot, id);
+
+	/*
+	 * First find the commits which are not covered by a stored bitmap
+	 * yet, so that the bitmaps of their ancestors are in `out` before we
+	 * look at the trees.
+	 */
+	while ((slot = git_array_pop(pending)) != NULL) {
+		git_oid_cpy(&current, slot);
+
+		if ((error = bitmap_position(&pos, bitmap, &current)) < 0)
+			goto done;
+
+		if (git_bitmap_get(out, pos))
+			continue;
+
+		k = git_oidmap_lookup_index(bitmap->commits, &current);
+		if (git_oidmap_valid_index(bitmap->commits, k)) {
+			if ((error = stored_bitmap_get(&stored,
+					git_oidmap_value_at(bitmap->commits, k))) < 0 ||
+				(error = git_bitmap_or(out, stored)) < 0)
+				goto done;
+
+			continue;
+		}
+
+		if ((error = git_bitmap_set(out, pos)) < 0 ||
+			(error = git_commit_lookup(&commit, repo, &current)) < 0)
+			goto done;
+
+		if ((slot = git_array_alloc(trees)) != NULL)
+			git_oid_cpy(slot, git_commit_tree_id(commit));
+
+		for (i = 0; slot && i < git_commit_parentcount(commit); i++) {
+			if ((slot = git_array_alloc(pending)) != NULL)
+				git_oid_cpy(slot, git_commit_parent_id(commit, i));
+		}
+
+		git_commit_free(commit);
+
+		if (!slot) {
+			giterr_set_oom();
+			error = -1;
+			goto done;
+		}
+	}
+
+	git_array_foreach(trees, i, slot) {
+		if ((error = fill_tree(out, bitmap, repo, slot)) < 0)
+			goto done;
+	}
+
+done:
+	git_array_clear(pending);
+	git_array_clear(trees);
+	return error;
+}
+
+int git_pack_bitmap_object(
+	git_oid *id,
+	uint32_t *name_hash,
+	git_pack_bitmap *bitmap,
+	size_t pos)
+{
+	uint32_t index_pos;
+	int error;
+
+	assert(id && name_hash && bitmap);
+
+	if (pos >= bitmap->num_objects)
+		return bitmap_error("object position is out of bounds");
+
+	index_pos = bitmap->pack_order[pos];
+
+	if ((error = git_pack_nth_entry_oid(id, bitmap->pack, index_pos)) < 0)
+		return error;
+
+	*name_hash = bitmap->hashes ?
+		ntohl(*((uint32_t *)(bitmap->hashes + index_pos * sizeof(uint32_t)))) : 0;
+	return 0;
+}
+
+void git_pack_bitmap_free(git_pack_bitmap *bitmap)
+{
+	size_t i;
+
+	if (!bitmap)
+		return;
+
+	for (i = 0; i < bitmap->num_entries; i++)
+		git_bitmap_free(&bitmap->entries[i].bitmap);
+
+	for (i = 0; i < BITMAP_TYPES; i++)
+		git_bitmap_free(&bitmap->types[i]);
+
+	if (bitmap->map.data)
+		git_futils_mmap_free(&bitmap->map);
+
+	git_oidmap_free(bitmap->commits);
+	git__free(bitmap->entries);
+	git__free(bitmap->pack_order);
+	git__free(bitmap->pack_positions);
+	git__free(bitmap);
+}
+
+/*
+ * Writing
+ */
+
+struct bitmap_commit {
+	git_oid id;
+	git_array_t(struct bitmap_commit *) parents;
+	size_t children;
+	unsigned int visited:1,
+		selected:1;
+};
+
+struct topo_frame {
+	struct bitmap_commit *commit;
+	size_t next_parent;
+};
+
+static void bitmap_commits_free(git_vector *commits)
+{
+	struct bitmap_commit *c;
+	size_t i;
+
+	git_vector_foreach(commits, i, c) {
+		git_array_clear(c->parents);
+		git__free(c);
+	}
+
+	git_vector_free(commits);
+}
+
+/* Load the commits of the pack along with their parents within it */
+static int load_commits(
+	git_vector *commits, git_oidmap *map, git_packbuilder *pb)
+{
+	struct bitmap_commit *c, *parent, **slot;
+	git_commit *commit;
+	khiter_t k;
+	size_t i, j;
+	int error;
+
+	for (i = 0; i < pb->nr_objects; i++) {
+		git_pobject *po = pb->object_list + i;
+
+		if (po->type != GIT_OBJ_COMMIT)
+			continue;
+
+		c = git__calloc(1, sizeof(struct bitmap_commit));
+		GITERR_CHECK_ALLOC(c);
+		git_oid_cpy(&c->id, &po->id);
+
+		if ((error = git_vector_insert(commits, c)) < 0) {
+			git__free(c);
+			return error;
+		}
+
+		git_oidmap_insert(map, &c->id, c, &error);
+		if (error < 0) {
+			giterr_set_oom();
+			return -1;
+		}
+	}
+
+	git_vector_foreach(commits, i, c) {
+		if ((error = git_commit_lookup(&commit, pb->repo, &c->id)) < 0)
+			return error;
+
+		for (j = 0; j < git_commit_parentcount(commit); j++) {
+			k = git_oidmap_lookup_index(map, git_commit_parent_id(commit, j));
+			if (!git_oidmap_valid_index(map, k)) {
+				char oid[GIT_OID_HEXSZ + 1];
+
+				git_oid_tostr(oid, sizeof(oid), git_commit_parent_id(commit, j));
+				giterr_set(GITERR_ODB,
+					"cannot write bitmap: commit %s is not in the pack", oid);
+				git_commit_free(commit);
+				return GIT_ENOTFOUND;
+			}
+
+			parent = git_oidmap_value_at(map, k);
+			parent->children++;
+
+			if ((slot = git_array_alloc(c->parents)) == NULL) {
+				git_commit_free(commit);
+				giterr_set_oom();
+				return -1;
+			}
+			*slot = parent;
+		}
+
+		git_commit_free(commit);
+	}
+
+	return 0;
+}
+
+/*
+ * Pick the commits to store a bitmap for, in an order where parents come
+ * before their children so that each bitmap can be built on top of the
+ * ones of its ancestors.
+ */
+static int select_commits(git_vector *selected, git_vector *commits)
+{
+	git_array_t(struct topo_frame) stack = GIT_ARRAY_INIT;
+	struct bitmap_commit *c, *tip;
+	struct topo_frame *frame;
+	size_t i, count = 0;
+	int error = 0;
+
+	git_vector_foreach(commits, i, tip) {
+		if (tip->visited)
+			continue;
+
+		if ((frame = git_array_alloc(stack)) == NULL)
+			goto oom;
+		frame->commit = tip;
+		frame->next_parent = 0;
+		tip->visited = 1;
+
+		while ((frame = git_array_last(stack)) != NULL) {
+			c = frame->commit;
+
+			if (frame->next_parent < git_array_size(c->parents)) {
+				struct bitmap_commit *parent =
+					*git_array_get(c->parents, frame->next_parent);
+
+				frame->next_parent++;
+
+				if (parent->visited)
+					continue;
+
+				parent->visited = 1;
+				if ((frame = git_array_alloc(stack)) == NULL)
+					goto oom;
+				frame->commit = parent;
+				frame->next_parent = 0;
+				continue;
+			}
+
+			(void)git_array_pop(stack);
+
+			if (c->children == 0 || ++count % BITMAP_COMMIT_INTERVAL == 0) {
+				c->selected = 1;
+				if ((error = git_vector_insert(selected, c)) < 0)
+					goto done;
+			}
+		}
+	}
+
+done:
+	git_array_clear(stack);
+	return error;
+
+oom:
+	git_array_clear(stack);
+	giterr_set_oom();
+	return -1;
+}
+
+static int build_type_bitmaps(
+	git_pack_bitmap *bitmap, git_buf *hashes, git_packbuilder *pb)
+{
+	git_pobject *po;
+	git_oid id;
+	uint32_t i, hash;
+	khiter_t k;
+	int type, error;
+
+	for (i = 0; i < bitmap->num_objects; i++) {
+		if ((error = git_pack_nth_entry_oid(&id, bitmap->pack, i)) < 0)
+			return error;
+
+		k = git_oidmap_lookup_index(pb->object_ix, &id);
+		if (!git_oidmap_valid_index(pb->object_ix, k))
+			return bitmap_error("packfile does not match the packbuilder");
+
+		po = git_oidmap_value_at(pb->object_ix, k);
+
+		switch (po->type) {
+		case GIT_OBJ_COMMIT: type = BITMAP_COMMITS; break;
+		case GIT_OBJ_TREE: type = BITMAP_TREES; break;
+		case GIT_OBJ_BLOB: type = BITMAP_BLOBS; break;
+		case GIT_OBJ_TAG: type = BITMAP_TAGS; break;
+		default:
+			return bitmap_error("unexpected object type in packfile");
+		}
+
+		if ((error = git_bitmap_set(&bitmap->types[type], bitmap->pack_positions[i])) < 0)
+			return error;
+
+		hash = htonl(po->hash);
+		if ((error = git_buf_put(hashes, (const char *)&hash, sizeof(hash))) < 0)
+			return error;
+	}
+
+	return 0;
+}
+
+static int write_bitmap_file(
+	const char *path,
+	git_pack_bitmap *bitmap,
+	git_buf *hashes,
+	bool do_fsync)
+{
+	git_filebuf file = GIT_FILEBUF_INIT;
+	git_buf buf = GIT_BUF_INIT;
+	git_oid checksum;
+	uint16_t version = htons(BITMAP_VERSION),
+		options = htons(BITMAP_OPT_FULL_DAG | BITMAP_OPT_HASH_CACHE);
+	uint32_t count;
+	size_t i;
+	int error;
+
+	if ((error = git_pack_checksum(&checksum, bitmap->pack)) < 0)
+		return error;
+
+	count = htonl((uint32_t)bitmap->num_entries);
+
+	git_buf_put(&buf, BITMAP_SIGNATURE, 4);
+	git_buf_put(&buf, (const char *)&version, sizeof(version));
+	git_buf_put(&buf, (const char *)&options, sizeof(options));
+	git_buf_put(&buf, (const char *)&count, sizeof(count));
+	git_buf_put(&buf, (const char *)checksum.id, GIT_OID_RAWSZ);
+
+	for (i = 0; i < BITMAP_TYPES; i++) {
+		if ((error = git_ewah_serialize(&buf, &bitmap->types[i])) < 0)
+			goto done;
+	}
+
+	for (i = 0; i < bitmap->num_entries; i++) {
+		struct stored_bitmap *entry = &bitmap->entries[i];
+		uint32_t index_pos = htonl(entry->index_pos);
+
+		git_buf_put(&buf, (const char *)&index_pos, sizeof(index_pos));
+		git_buf_putc(&buf, 0); /* xor offset */
+		git_buf_putc(&buf, 0); /* flags */
+
+		if ((error = git_ewah_serialize(&buf, &entry->bitmap)) < 0)
+			goto done;
+	}
+
+	git_buf_put(&buf, hashes->ptr, hashes->size);
+
+	if (git_buf_oom(&buf)) {
+		error = -1;
+		goto done;
+	}
+
+	if ((error = git_filebuf_open(&file, path,
+			GIT_FILEBUF_HASH_CONTENTS | (do_fsync ? GIT_FILEBUF_FSYNC : 0),
+			GIT_PACK_FILE_MODE)) < 0 ||
+		(error = git_filebuf_write(&file, buf.ptr, buf.size)) < 0 ||
+		(error = git_filebuf_hash(&checksum, &file)) < 0 ||
+		(error = git_filebuf_write(&file, checksum.id, GIT_OID_RAWSZ)) < 0)
+		goto done;
+
+	error = git_filebuf_commit(&file);
+
+done:
+	git_filebuf_cleanup(&file);
+	git_buf_free(&buf);
+	return error;
+}
+
+int git_pack_bitmap_write(git_packbuilder *pb, const char *pack_dir)
+{
+	git_pack_bitmap *bitmap = NULL;
+	struct git_pack_file *pack = NULL;
+	git_vector commits = GIT_VECTOR_INIT, selected = GIT_VECTOR_INIT;
+	git_oidmap *commit_map = NULL;
+	git_buf path = GIT_BUF_INIT, hashes = GIT_BUF_INIT;
+	struct bitmap_commit *c;
+	char hex[GIT_OID_HEXSZ + 1];
+	size_t i;
+	bool do_fsync;
+	int t, error;
+
+	assert(pb && pack_dir);
+
+	git_oid_tostr(hex, sizeof(hex), &pb->pack_oid);
+
+	if ((error = git_buf_joinpath(&path, pack_dir, "pack-")) < 0 ||
+		(error = git_buf_printf(&path, "%s.idx", hex)) < 0 ||
+		(error = git_packfile_alloc(&pack, path.ptr)) < 0 ||
+		(error = bitmap_alloc(&bitmap, pack)) < 0)
+		goto done;
+
+	if ((commit_map = git_oidmap_alloc()) == NULL) {
+		giterr_set_oom();
+		error = -1;
+		goto done;
+	}
+
+	if ((error = git_vector_init(&commits, 0, NULL)) < 0 ||
+		(error = load_commits(&commits, commit_map, pb)) < 0 ||
+		(error = select_commits(&selected, &commits)) < 0 ||
+		(error = build_type_bitmaps(bitmap, &hashes, pb)) < 0)
+		goto done;
+
+	bitmap->entries = git__calloc(
+		selected.length ? selected.length : 1, sizeof(struct stored_bitmap));
+	if (!bitmap->entries) {
+		giterr_set_oom();
+		error = -1;
+		goto done;
+	}
+
+	git_vector_foreach(&selected, i, c) {
+		struct stored_bitmap *entry = &bitmap->entries[i];
+
+		git_oid_cpy(&entry->id, &c->id);
+		entry->resolved = 1;
+		bitmap->num_entries++;
+
+		if ((error = git_pack_entry_position(&entry->index_pos, pack, &c->id)) < 0)
+			goto done;
+
+		if ((error = git_pack_bitmap_reachable(
+				&entry->bitmap, bitmap, pb->repo, &c->id)) < 0) {
+			if (error == GIT_ENOTFOUND)
+				giterr_set(GITERR_ODB, "cannot write bitmap: "
+					"the pack is not closed under reachability");
+			goto done;
+		}
+
+		git_oidmap_insert(bitmap->commits, &entry->id, entry, &error);
+		if (error < 0) {
+			giterr_set_oom();
+			error = -1;
+			goto done;
+		}
+	}
+
+	do_fsync = (!git_repository__cvar(&t, pb->repo, GIT_CVAR_FSYNCOBJECTFILES) && t);
+
+	git_buf_clear(&path);
+	if ((error = git_buf_joinpath(&path, pack_dir, "pack-")) < 0 ||
+		(error = git_buf_printf(&path, "%s.bitmap", hex)) < 0)
+		goto done;
+
+	error = write_bitmap_file(path.ptr, bitmap, &hashes, do_fsync);
+
+done:
+	bitmap_commits_free(&commits);
+	git_vector_free(&selected);
+	git_oidmap_free(commit_map);
+	git_pack_bitmap_free(bitmap);
+	git_packfile_free(pack);
+	git_buf_free(&hashes);
+	git_buf_free(&path);
+	return error;
+}
@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_pack_bitmap_h__
+#define INCLUDE_pack_bitmap_h__
+
+#include "common.h"
+
+#include "ewah.h"
+#include "pack.h"
+#include "pack-objects.h"
+
+/*
+ * Reachability bitmaps (`pack-*.bitmap`), in the format written by
+ * `git repack -b`.
+ *
+ * Bit `n` of every bitmap refers to the `n`th object of the pack in the
+ * order the objects are stored in the packfile. A bitmap is stored for
+ * a selection of the commits in the pack, with the bits of every object
+ * reachable from the commit set. Since the pack must be closed under
+ * reachability, the objects wanted by a fetch or a push can be computed
+ * by combining the bitmaps of the commits involved instead of walking
+ * their trees.
+ */
+typedef struct git_pack_bitmap git_pack_bitmap;
+
+/*
+ * Load the bitmap index of `pack`. Returns GIT_ENOTFOUND when the pack
+ * has no bitmap. The pack must outlive the bitmap.
+ */
+int git_pack_bitmap_open(git_pack_bitmap **out, struct git_pack_file *pack);
+
+/*
+ * Load the bitmap index of the first local pack in `odb` which has one.
+ * Returns GIT_ENOTFOUND when there is no such pack.
+ */
+int git_pack_bitmap_find(git_pack_bitmap **out, git_odb *odb);
+
+/*
+ * Set the bit of every object reachable from the commit `id` in `out`.
+ * Returns GIT_ENOTFOUND when one of those objects is not in the pack, in
+ * which case `out` is left partially filled.
+ */
+int git_pack_bitmap_reachable(
+	git_bitmap *out,
+	git_pack_bitmap *bitmap,
+	git_repository *repo,
+	const git_oid *id);
+
+/*
+ * Get the id and the name hash (zero when the bitmap has no name hash
+ * cache) of the object at position `pos` of the pack.
+ */
+int git_pack_bitmap_object(
+	git_oid *id,
+	uint32_t *name_hash,
+	git_pack_bitmap *bitmap,
+	size_t pos);
+
+void git_pack_bitmap_free(git_pack_bitmap *bitmap);
+
+/*
+ * Write the bitmap index for the pack which `pb` just wrote into the
+ * directory `pack_dir`. Returns GIT_ENOTFOUND when some object reachable
+ * from the commits in the pack is not in the pack as well.
+ */
+int git_pack_bitmap_write(git_packbuilder *pb, const char *pack_dir);
+
+#endif
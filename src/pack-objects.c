@@ -12,6 +12,7 @@
 #include "iterator.h"
 #include "netops.h"
 #include "pack.h"
+#include "pack-bitmap.h"
 #include "thread-utils.h"
 #include "tree.h"
 #include "util.h"
@@ -89,7 +90,7 @@ static unsigned name_hash(const char *name)
 static int packbuilder_config(git_packbuilder *pb)
 {
 	git_config *config;
-	int ret = 0;
+	int ret = 0, flag;
 	int64_t val;
 
 	if ((ret = git_repository_config_snapshot(&config, pb->repo)) < 0)
@@ -120,6 +121,20 @@ static int packbuilder_config(git_packbuilder *pb)
 
 #undef config_get
 
+#define config_get_bool(KEY,DST,DFLT) do { \
+	ret = git_config_get_bool(&flag, config, KEY); \
+	if (!ret) { \
+		(DST) = !!flag; \
+	} else if (ret == GIT_ENOTFOUND) { \
+	    (DST) = (DFLT); \
+	    ret = 0; \
+	} else if (ret < 0) goto out; } while (0)
+
+	config_get_bool("pack.useBitmaps", pb->use_bitmaps, true);
+	config_get_bool("pack.writeBitmaps", pb->write_bitmaps, false);
+
+#undef config_get_bool
+
 out:
 	git_config_free(config);
 
@@ -202,8 +217,8 @@ static void rehash(git_packbuilder *pb)
 	}
 }
 
-int git_packbuilder_insert(git_packbuilder *pb, const git_oid *oid,
-			   const char *name)
+static int packbuilder_insert(git_packbuilder *pb, const git_oid *oid,
+			      unsigned int hash)
 {
 	git_pobject *po;
 	khiter_t pos;
@@ -242,7 +257,7 @@ int git_packbuilder_insert(git_packbuilder *pb, const git_oid *oid,
 
 	pb->nr_objects++;
 	git_oid_cpy(&po->id, oid);
-	po->hash = name_hash(name);
+	po->hash = hash;
 
 	pos = git_oidmap_put(pb->object_ix, &po->id, &ret);
 	if (ret < 0) {
@@ -273,6 +288,12 @@ int git_packbuilder_insert(git_packbuilder *pb, const git_oid *oid,
 	return 0;
 }
 
+int git_packbuilder_insert(git_packbuilder *pb, const git_oid *oid,
+			   const char *name)
+{
+	return packbuilder_insert(pb, oid, name_hash(name));
+}
+
 static int get_delta(void **out, git_odb *odb, git_pobject *po)
 {
 	git_odb_object *src = NULL, *trg = NULL;
@@ -1408,6 +1429,15 @@ int git_packbuilder_write(
 	git_oid_cpy(&pb->pack_oid, git_indexer_hash(indexer));
 
 	git_indexer_free(indexer);
+
+	/* like git, only packs closed under reachability get a bitmap */
+	if (pb->write_bitmaps && (t = git_pack_bitmap_write(pb, path)) < 0) {
+		if (t != GIT_ENOTFOUND)
+			return t;
+
+		giterr_clear();
+	}
+
 	return 0;
 }
 
@@ -1706,6 +1736,71 @@ cleanup:
 	return error;
 }
 
+struct bitmap_insert_context {
+	git_packbuilder *pb;
+	git_pack_bitmap *bitmap;
+};
+
+static int cb_bitmap_insert(size_t pos, void *payload)
+{
+	struct bitmap_insert_context *ctx = payload;
+	uint32_t hash;
+	git_oid id;
+	int error;
+
+	if ((error = git_pack_bitmap_object(&id, &hash, ctx->bitmap, pos)) < 0)
+		return error;
+
+	return packbuilder_insert(ctx->pb, &id, hash);
+}
+
+/*
+ * Insert the objects which are reachable from the pushed commits but
+ * not from the hidden ones by combining the reachability bitmaps of a
+ * pack. Returns GIT_PASSTHROUGH when there is no usable bitmap, e.g.
+ * because some of the commits are not in the bitmapped pack.
+ */
+static int insert_walk_bitmap(git_packbuilder *pb, git_revwalk *walk)
+{
+	struct bitmap_insert_context ctx;
+	git_pack_bitmap *bitmap = NULL;
+	git_bitmap wants = GIT_BITMAP_INIT, haves = GIT_BITMAP_INIT;
+	git_commit_list *list;
+	int error;
+
+	if (!pb->use_bitmaps || walk->hide_cb)
+		return GIT_PASSTHROUGH;
+
+	if ((error = git_pack_bitmap_find(&bitmap, pb->odb)) < 0)
+		goto done;
+
+	for (list = walk->user_input; list; list = list->next) {
+		if ((error = git_pack_bitmap_reachable(
+				list->item->uninteresting ? &haves : &wants,
+				bitmap, pb->repo, &list->item->oid)) < 0)
+			goto done;
+	}
+
+	git_bitmap_and_not(&wants, &haves);
+
+	ctx.pb = pb;
+	ctx.bitmap = bitmap;
+
+	if ((error = git_bitmap_foreach(&wants, cb_bitmap_insert, &ctx)) == GIT_ENOTFOUND)
+		error = -1;
+
+done:
+	if (error == GIT_ENOTFOUND) {
+		giterr_clear();
+		error = GIT_PASSTHROUGH;
+	}
+
+	git_bitmap_free(&wants);
+	git_bitmap_free(&haves);
+	git_pack_bitmap_free(bitmap);
+	return error;
+}
+
 int git_packbuilder_insert_walk(git_packbuilder *pb, git_revwalk *walk)
 {
 	int error;
@@ -1714,6 +1809,9 @@ int git_packbuilder_insert_walk(git_packbuilder *pb, git_revwalk *walk)
 
 	assert(pb && walk);
 
+	if ((error = insert_walk_bitmap(pb, walk)) != GIT_PASSTHROUGH)
+		return error;
+
 	if ((error = mark_edges_uninteresting(pb, walk->user_input)) < 0)
 		return error;
 
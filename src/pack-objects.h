@@ -95,6 +95,9 @@ struct git_packbuilder {
 
 	unsigned int nr_threads; /* nr of threads to use */
 
+	bool use_bitmaps; /* count objects with the bitmap index of a pack */
+	bool write_bitmaps; /* write a bitmap index along with the pack */
+
 	git_packbuilder_progress progress_cb;
 	void *progress_cb_payload;
 	double last_progress_report_time; /* the time progress was last reported */
@@ -13,6 +13,10 @@
 #include "mwindow.h"
 #include "fileops.h"
 #include "oid.h"
+#include "zstream.h"
+#include "trace.h"
+
+#include "git2/object.h"
 
 #include <zlib.h>
 
@@ -50,7 +54,12 @@ static int packfile_error(const char *message)
  * Delta base cache
  ********************/
 
-static git_pack_cache_entry *new_cache_object(git_rawobj *source)
+size_t git_pack__cache_memory_limit = GIT_PACK_CACHE_MEMORY_LIMIT;
+git_atomic_ssize git_pack__cache_hits = {0};
+git_atomic_ssize git_pack__cache_misses = {0};
+
+static git_pack_cache_entry *new_cache_object(
+	git_rawobj *source, git_off_t offset, unsigned int depth)
 {
 	git_pack_cache_entry *e = git__calloc(1, sizeof(git_pack_cache_entry));
 	if (!e)
@@ -58,6 +67,8 @@ static git_pack_cache_entry *new_cache_object(git_rawobj *source)
 
 	git_atomic_inc(&e->refcount);
 	memcpy(&e->raw, source, sizeof(git_rawobj));
+	e->offset = offset;
+	e->depth = depth;
 
 	return e;
 }
@@ -85,6 +96,9 @@ static void cache_free(git_pack_cache *cache)
 		git_offmap_free(cache->entries);
 		cache->entries = NULL;
 	}
+
+	cache->hand = NULL;
+	cache->memory_used = 0;
 }
 
 static int cache_init(git_pack_cache *cache)
@@ -92,8 +106,6 @@ static int cache_init(git_pack_cache *cache)
 	cache->entries = git_offmap_alloc();
 	GITERR_CHECK_ALLOC(cache->entries);
 
-	cache->memory_limit = GIT_PACK_CACHE_MEMORY_LIMIT;
-
 	if (git_mutex_init(&cache->lock)) {
 		giterr_set(GITERR_OS, "failed to initialize pack cache mutex");
 
@@ -106,6 +118,16 @@ static int cache_init(git_pack_cache *cache)
 	return 0;
 }
 
+/*
+ * Getting a base back costs inflating the object at the start of its
+ * chain and every delta up to it; per byte of cache it takes up, that
+ * is its depth in the chain.
+ */
+GIT_INLINE(unsigned int) cache_entry_credit(git_pack_cache_entry *entry)
+{
+	return min(entry->depth + 1, GIT_PACK_CACHE_MAX_CREDIT);
+}
+
 static git_pack_cache_entry *cache_get(git_pack_cache *cache, git_off_t offset)
 {
 	khiter_t k;
@@ -118,33 +140,77 @@ static git_pack_cache_entry *cache_get(git_pack_cache *cache, git_off_t offset)
 	if (git_offmap_valid_index(cache->entries, k)) { /* found it */
 		entry = git_offmap_value_at(cache->entries, k);
 		git_atomic_inc(&entry->refcount);
-		entry->last_usage = cache->use_ctr++;
+		entry->credit = cache_entry_credit(entry);
 	}
 	git_mutex_unlock(&cache->lock);
 
+	git_atomic_ssize_add(
+		entry ? &git_pack__cache_hits : &git_pack__cache_misses, 1);
+
 	return entry;
 }
 
 /* Run with the cache lock held */
-static void free_lowest_entry(git_pack_cache *cache)
+static void cache_unlink(git_pack_cache *cache, git_pack_cache_entry *entry)
 {
-	git_off_t offset;
-	git_pack_cache_entry *entry;
+	if (entry->next == entry) {
+		cache->hand = NULL;
+	} else {
+		entry->prev->next = entry->next;
+		entry->next->prev = entry->prev;
 
-	git_offmap_foreach(cache->entries, offset, entry, {
-		if (entry && entry->refcount.val == 0) {
-			cache->memory_used -= entry->raw.len;
-			git_offmap_delete(cache->entries, offset);
-			free_cache_object(entry);
+		if (cache->hand == entry)
+			cache->hand = entry->next;
+	}
+
+	cache->memory_used -= entry->raw.len;
+	git_offmap_delete(cache->entries, entry->offset);
+	free_cache_object(entry);
+}
+
+/*
+ * Run with the cache lock held.  Move the hand until `needed` bytes
+ * fit under the limit.  Entries which are in use are skipped; once the
+ * hand went around often enough to take the credit of every entry,
+ * give up rather than wait for them.
+ */
+static int cache_make_room(git_pack_cache *cache, size_t needed)
+{
+	size_t limit = git_pack__cache_memory_limit;
+	size_t steps = git_offmap_num_entries(cache->entries) *
+		(GIT_PACK_CACHE_MAX_CREDIT + 1);
+
+	if (needed > limit)
+		return -1;
+
+	while (cache->memory_used + needed > limit) {
+		git_pack_cache_entry *entry = cache->hand;
+
+		if (!entry || !steps--)
+			return -1;
+
+		cache->hand = entry->next;
+
+		if (entry->refcount.val != 0)
+			continue;
+
+		if (entry->credit) {
+			entry->credit--;
+			continue;
 		}
-	});
+
+		cache_unlink(cache, entry);
+	}
+
+	return 0;
 }
 
 static int cache_add(
 		git_pack_cache_entry **cached_out,
 		git_pack_cache *cache,
 		git_rawobj *base,
-		git_off_t offset)
+		git_off_t offset,
+		unsigned int depth)
 {
 	git_pack_cache_entry *entry;
 	int error, exists = 0;
@@ -153,28 +219,38 @@ static int cache_add(
 	if (base->len > GIT_PACK_CACHE_SIZE_LIMIT)
 		return -1;
 
-	entry = new_cache_object(base);
+	entry = new_cache_object(base, offset, depth);
 	if (entry) {
 		if (git_mutex_lock(&cache->lock) < 0) {
 			giterr_set(GITERR_OS, "failed to lock cache");
 			git__free(entry);
 			return -1;
 		}
-		/* Add it to the cache if nobody else has */
-		exists = git_offmap_exists(cache->entries, offset);
+		/* Add it to the cache if nobody else has, and there is room */
+		exists = git_offmap_exists(cache->entries, offset) ||
+			cache_make_room(cache, base->len) < 0;
 		if (!exists) {
-			while (cache->memory_used + base->len > cache->memory_limit)
-				free_lowest_entry(cache);
-
 			k = git_offmap_put(cache->entries, offset, &error);
 			assert(error != 0);
 			git_offmap_set_value_at(cache->entries, k, entry);
 			cache->memory_used += entry->raw.len;
 
+			/* new entries go just behind the hand */
+			entry->credit = cache_entry_credit(entry);
+			if (cache->hand) {
+				entry->next = cache->hand;
+				entry->prev = cache->hand->prev;
+				entry->prev->next = entry;
+				cache->hand->prev = entry;
+			} else {
+				entry->next = entry->prev = entry;
+				cache->hand = entry;
+			}
+
 			*cached_out = entry;
 		}
 		git_mutex_unlock(&cache->lock);
-		/* Somebody beat us to adding it into the cache */
+		/* Somebody beat us to adding it into the cache, or it won't fit */
 		if (exists) {
 			git__free(entry);
 			return -1;
@@ -237,6 +313,10 @@ static int pack_index_check(const char *path, struct git_pack_file *p)
 	if (error < 0)
 		return error;
 
+	/* lookups bisect all over the index */
+	if (git_mwindow__whole_pack)
+		p_madvise(&p->index_map, GIT_MADV_WILLNEED);
+
 	hdr = idx_map = p->index_map.data;
 
 	if (hdr->idx_signature == htonl(PACK_IDX_SIGNATURE)) {
@@ -625,14 +705,17 @@ int git_packfile_unpack(
 	git_off_t *obj_offset)
 {
 	git_mwindow *w_curs = NULL;
-	git_off_t curpos = *obj_offset;
+	git_off_t curpos = *obj_offset, offset = *obj_offset;
 	int error, free_base = 0;
 	git_dependency_chain chain = GIT_ARRAY_INIT;
 	struct pack_chain_elem *elem = NULL, *stack;
 	git_pack_cache_entry *cached = NULL;
 	struct pack_chain_elem small_stack[SMALL_STACK_SIZE];
 	size_t stack_size = 0, elem_pos, alloclen;
+	unsigned int depth = 0;
 	git_otype base_type;
+	double start = git_trace_start(GIT_TRACE_TRACE);
+	bool base_cached;
 
 	/*
 	 * TODO: optionally check the CRC on the packfile
@@ -648,11 +731,13 @@ int git_packfile_unpack(
 
 	/* let's point to the right stack */
 	stack = chain.ptr ? chain.ptr : small_stack;
+	base_cached = (cached != NULL);
 
 	elem_pos = stack_size;
 	if (cached) {
 		memcpy(obj, &cached->raw, sizeof(git_rawobj));
 		base_type = obj->type;
+		depth = cached->depth;
 		elem_pos--;	/* stack_size includes the base, which isn't actually there */
 	} else {
 		elem = &stack[--elem_pos];
@@ -709,7 +794,7 @@ int git_packfile_unpack(
 		 * long as it's not already the cached one.
 		 */
 		if (!cached)
-			free_base = !!cache_add(&cached, &p->bases, obj, elem->base_key);
+			free_base = !!cache_add(&cached, &p->bases, obj, elem->base_key, depth);
 
 		elem = &stack[elem_pos - 1];
 		curpos = elem->offset;
@@ -727,6 +812,7 @@ int git_packfile_unpack(
 
 		error = git_delta_apply(&obj->data, &obj->len, base.data, base.len, delta.data, delta.len);
 		obj->type = base_type;
+		depth++;
 
 		/*
 		 * We usually don't want to free the base at this
@@ -756,6 +842,11 @@ cleanup:
 		git__free(obj->data);
 		if (cached)
 			git_atomic_dec(&cached->refcount);
+	} else {
+		git_trace_timed(GIT_TRACE_TRACE, start,
+			"pack: unpacked %s at %"PRId64" of '%s': %"PRIuZ" deltas on a %s base",
+			git_object_type2string(obj->type), (int64_t)offset,
+			p->pack_name, stack_size - 1, base_cached ? "cached" : "inflated");
 	}
 
 	if (elem)
@@ -819,6 +910,7 @@ ssize_t git_packfile_stream_read(git_packfile_stream *obj, void *buffer, size_t
 
 	obj->curpos += obj->zstream.next_in - in;
 	written = len - obj->zstream.avail_out;
+	git_zstream__count_inflated(written);
 
 	if (st != Z_OK && st != Z_STREAM_END) {
 		giterr_set(GITERR_ZLIB, "error reading from the zlib stream");
@@ -850,55 +942,53 @@ static int packfile_unpack_compressed(
 	size_t size,
 	git_otype type)
 {
-	size_t buf_size;
+	size_t buf_size, total_out;
 	int st;
-	z_stream stream;
+	z_stream *stream;
 	unsigned char *buffer, *in;
 
 	GITERR_CHECK_ALLOC_ADD(&buf_size, size, 1);
-	buffer = git__calloc(1, buf_size);
+	buffer = git__malloc(buf_size);
 	GITERR_CHECK_ALLOC(buffer);
 
-	memset(&stream, 0, sizeof(stream));
-	stream.next_out = buffer;
-	stream.avail_out = (uInt)buf_size;
-	stream.zalloc = use_git_alloc;
-	stream.zfree = use_git_free;
-
-	st = inflateInit(&stream);
-	if (st != Z_OK) {
+	if (git_zstream__inflater_get(&stream) < 0) {
 		git__free(buffer);
-		giterr_set(GITERR_ZLIB, "failed to init zlib stream on unpack");
-
 		return -1;
 	}
 
+	stream->next_out = buffer;
+	stream->avail_out = (uInt)buf_size;
+
 	do {
-		in = pack_window_open(p, w_curs, *curpos, &stream.avail_in);
-		stream.next_in = in;
-		st = inflate(&stream, Z_FINISH);
+		in = pack_window_open(p, w_curs, *curpos, &stream->avail_in);
+		stream->next_in = in;
+		st = inflate(stream, Z_FINISH);
 		git_mwindow_close(w_curs);
 
-		if (!stream.avail_out)
+		if (!stream->avail_out)
 			break; /* the payload is larger than it should be */
 
 		if (st == Z_BUF_ERROR && in == NULL) {
-			inflateEnd(&stream);
+			git_zstream__inflater_put(stream);
 			git__free(buffer);
 			return GIT_EBUFS;
 		}
 
-		*curpos += stream.next_in - in;
+		*curpos += stream->next_in - in;
 	} while (st == Z_OK || st == Z_BUF_ERROR);
 
-	inflateEnd(&stream);
+	total_out = stream->total_out;
+	git_zstream__inflater_put(stream);
+	git_zstream__count_inflated(total_out);
 
-	if ((st != Z_STREAM_END) || stream.total_out != size) {
+	if ((st != Z_STREAM_END) || total_out != size) {
 		git__free(buffer);
 		giterr_set(GITERR_ZLIB, "error inflating zlib stream");
 		return -1;
 	}
 
+	buffer[size] = '\0';
+
 	obj->type = type;
 	obj->len = size;
 	obj->data = buffer;
@@ -987,7 +1077,7 @@ git_off_t get_delta_base(
 void git_packfile_close(struct git_pack_file *p, bool unlink_packfile)
 {
 	if (p->mwf.fd >= 0) {
-		git_mwindow_free_all_locked(&p->mwf);
+		git_mwindow_free_all(&p->mwf);
 		p_close(p->mwf.fd);
 		p->mwf.fd = -1;
 	}
@@ -1010,6 +1100,7 @@ void git_packfile_free(struct git_pack_file *p)
 	git__free(p->bad_object_sha1);
 
 	git_mutex_free(&p->lock);
+	git_mutex_free(&p->mwf.lock);
 	git_mutex_free(&p->bases.lock);
 	git__free(p);
 }
@@ -1080,6 +1171,9 @@ static int packfile_open(struct git_pack_file *p)
 	if (git_oid__cmp(&sha1, (git_oid *)idx_sha1) != 0)
 		goto cleanup;
 
+	if (git_mwindow_file_map_whole(&p->mwf) < 0)
+		goto cleanup;
+
 	git_mutex_unlock(&p->lock);
 	return 0;
 
@@ -1155,6 +1249,7 @@ int git_packfile_alloc(struct git_pack_file **pack_out, const char *path)
 	 */
 	p->mwf.fd = -1;
 	p->mwf.size = st.st_size;
+	p->mwf.advice = GIT_MADV_RANDOM;
 	p->pack_local = 1;
 	p->mtime = (git_time_t)st.st_mtime;
 	p->index_version = -1;
@@ -1165,7 +1260,16 @@ int git_packfile_alloc(struct git_pack_file **pack_out, const char *path)
 		return -1;
 	}
 
+	if (git_mutex_init(&p->mwf.lock)) {
+		giterr_set(GITERR_OS, "failed to initialize packfile mutex");
+		git_mutex_free(&p->lock);
+		git__free(p);
+		return -1;
+	}
+
 	if (cache_init(&p->bases) < 0) {
+		git_mutex_free(&p->mwf.lock);
+		git_mutex_free(&p->lock);
 		git__free(p);
 		return -1;
 	}
@@ -1403,3 +1507,134 @@ int git_pack_entry_find(
 	git_oid_cpy(&e->sha1, &found_oid);
 	return 0;
 }
+
+int git_pack_entry_find_at(
+		struct git_pack_entry *e,
+		struct git_pack_file *p,
+		const git_oid *oid,
+		git_off_t offset)
+{
+	unsigned i;
+	int error;
+
+	assert(e && p && oid);
+
+	for (i = 0; i < p->num_bad_objects; i++)
+		if (git_oid__cmp(oid, &p->bad_object_sha1[i]) == 0)
+			return packfile_error("bad object found in packfile");
+
+	/* make sure the packfile still exists on disk */
+	if (p->mwf.fd == -1 && (error = packfile_open(p)) < 0)
+		return error;
+
+	e->offset = offset;
+	e->p = p;
+
+	git_oid_cpy(&e->sha1, oid);
+	return 0;
+}
+
+static const unsigned char *pack_index_oids(
+	unsigned int *stride, struct git_pack_file *p)
+{
+	const unsigned char *index = p->index_map.data;
+
+	index += 4 * 256;
+
+	if (p->index_version > 1) {
+		*stride = GIT_OID_RAWSZ;
+		index += 8;
+	} else {
+		*stride = GIT_OID_RAWSZ + 4;
+		index += 4;
+	}
+
+	return index;
+}
+
+int git_pack_entry_count(uint32_t *count_out, struct git_pack_file *p)
+{
+	int error;
+
+	if ((error = pack_index_open(p)) < 0)
+		return error;
+
+	*count_out = p->num_objects;
+	return 0;
+}
+
+int git_pack_nth_entry_oid(git_oid *oid_out, struct git_pack_file *p, uint32_t n)
+{
+	const unsigned char *index;
+	unsigned int stride;
+	int error;
+
+	if ((error = pack_index_open(p)) < 0)
+		return error;
+
+	if (n >= p->num_objects) {
+		giterr_set(GITERR_ODB, "pack entry %u does not exist", n);
+		return GIT_ENOTFOUND;
+	}
+
+	index = pack_index_oids(&stride, p);
+	git_oid_fromraw(oid_out, index + n * stride);
+	return 0;
+}
+
+int git_pack_nth_entry_offset(git_off_t *offset_out, struct git_pack_file *p, uint32_t n)
+{
+	int error;
+
+	if ((error = pack_index_open(p)) < 0)
+		return error;
+
+	if (n >= p->num_objects) {
+		giterr_set(GITERR_ODB, "pack entry %u does not exist", n);
+		return GIT_ENOTFOUND;
+	}
+
+	if ((*offset_out = nth_packed_object_offset(p, n)) < 0) {
+		giterr_set(GITERR_ODB, "packfile index is corrupt");
+		return -1;
+	}
+
+	return 0;
+}
+
+int git_pack_entry_position(uint32_t *pos_out, struct git_pack_file *p, const git_oid *id)
+{
+	const uint32_t *level1_ofs;
+	const unsigned char *index;
+	unsigned int hi, lo, stride;
+	int pos, error;
+
+	if ((error = pack_index_open(p)) < 0)
+		return error;
+
+	level1_ofs = p->index_map.data;
+	if (p->index_version > 1)
+		level1_ofs += 2;
+
+	index = pack_index_oids(&stride, p);
+	hi = ntohl(level1_ofs[(int)id->id[0]]);
+	lo = ((id->id[0] == 0x0) ? 0 : ntohl(level1_ofs[(int)id->id[0] - 1]));
+
+	if ((pos = sha1_position(index, stride, lo, hi, id->id)) < 0)
+		return git_odb__error_notfound("failed to find pack entry", id, GIT_OID_HEXSZ);
+
+	*pos_out = (uint32_t)pos;
+	return 0;
+}
+
+int git_pack_checksum(git_oid *out, struct git_pack_file *p)
+{
+	int error;
+
+	if ((error = pack_index_open(p)) < 0)
+		return error;
+
+	git_oid_fromraw(out,
+		((unsigned char *)p->index_map.data) + p->index_map.len - 2 * GIT_OID_RAWSZ);
+	return 0;
+}
@@ -57,7 +57,10 @@ struct git_pack_idx_header {
 };
 
 typedef struct git_pack_cache_entry {
-	size_t last_usage; /* enough? */
+	struct git_pack_cache_entry *prev, *next; /* position on the clock */
+	git_off_t offset;
+	unsigned int depth; /* number of deltas applied to get `raw` */
+	unsigned int credit; /* sweeps of the clock hand before eviction */
 	git_atomic refcount;
 	git_rawobj raw;
 } git_pack_cache_entry;
@@ -76,11 +79,22 @@ typedef git_array_t(struct pack_chain_elem) git_dependency_chain;
 
 #define GIT_PACK_CACHE_MEMORY_LIMIT 16 * 1024 * 1024
 #define GIT_PACK_CACHE_SIZE_LIMIT 1024 * 1024 /* don't bother caching anything over 1MB */
+#define GIT_PACK_CACHE_MAX_CREDIT 16
+
+extern size_t git_pack__cache_memory_limit;
+extern git_atomic_ssize git_pack__cache_hits;
+extern git_atomic_ssize git_pack__cache_misses;
 
+/*
+ * The delta base cache evicts with a clock whose hand skips an entry as
+ * many times as it has credit.  An entry gets one credit per object
+ * which had to be inflated to produce it, each time it is added or
+ * used, so bases at the end of long delta chains, which are the most
+ * expensive to get again, are kept longest.
+ */
 typedef struct {
 	size_t memory_used;
-	size_t memory_limit;
-	size_t use_ctr;
+	git_pack_cache_entry *hand;
 	git_mutex lock;
 	git_offmap *entries;
 } git_pack_cache;
@@ -164,4 +178,26 @@ int git_pack_foreach_entry(
 		git_odb_foreach_cb cb,
 		void *data);
 
+/*
+ * Fill `e` with the object `oid` which an external index (such as a
+ * multi-pack-index) says lives at `offset` in `p`.
+ */
+int git_pack_entry_find_at(
+		struct git_pack_entry *e,
+		struct git_pack_file *p,
+		const git_oid *oid,
+		git_off_t offset);
+
+/*
+ * Positions are the ones in the pack index, where the entries are
+ * sorted by object id.
+ */
+int git_pack_entry_count(uint32_t *count_out, struct git_pack_file *p);
+int git_pack_nth_entry_oid(git_oid *oid_out, struct git_pack_file *p, uint32_t n);
+int git_pack_nth_entry_offset(git_off_t *offset_out, struct git_pack_file *p, uint32_t n);
+int git_pack_entry_position(uint32_t *pos_out, struct git_pack_file *p, const git_oid *id);
+
+/* The checksum of the packfile, as recorded in its index */
+int git_pack_checksum(git_oid *out, struct git_pack_file *p);
+
 #endif
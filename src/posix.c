@@ -269,4 +269,13 @@ int p_munmap(git_map *map)
 	return 0;
 }
 
+int p_madvise(git_map *map, int advice)
+{
+	/* the data has already been read */
+	GIT_UNUSED(map);
+	GIT_UNUSED(advice);
+
+	return 0;
+}
+
 #endif
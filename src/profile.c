@@ -0,0 +1,59 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "profile.h"
+
+#include "buffer.h"
+
+struct git_profile_data git_profile__data = {0};
+
+int git_profile_set(git_profile_cb callback, void *payload)
+{
+	git_profile__data.callback = NULL;
+	GIT_MEMORY_BARRIER;
+
+	git_profile__data.payload = payload;
+	git_profile__data.callback = callback;
+	GIT_MEMORY_BARRIER;
+
+	return 0;
+}
+
+void git_profile__report(git_profile_frame *frame, size_t count)
+{
+	git_profile_cb callback = git_profile__data.callback;
+	git_profile_region region;
+
+	/* profiling was turned off while in the region */
+	if (callback == NULL)
+		return;
+
+	region.name = frame->name;
+	region.depth = frame->depth;
+#ifdef GIT_THREADS
+	region.thread = git_thread_currentid();
+#else
+	region.thread = 0;
+#endif
+	region.start = frame->start;
+	region.elapsed = git__timer() - frame->start;
+	region.count = count;
+
+	callback(&region, git_profile__data.payload);
+}
+
+int git_profile_region_format(git_buf *out, const git_profile_region *region)
+{
+	assert(out && region);
+
+	/* the trace event format counts in microseconds */
+	return git_buf_printf(out,
+		"{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+		"\"pid\":0,\"tid\":%"PRIuZ",\"args\":{\"count\":%"PRIuZ"}},\n",
+		region->name, region->start * 1000000, region->elapsed * 1000000,
+		region->thread, region->count);
+}
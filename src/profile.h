@@ -0,0 +1,56 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_profile_h__
+#define INCLUDE_profile_h__
+
+#include "common.h"
+
+#include "git2/profile.h"
+#include "global.h"
+
+struct git_profile_data {
+	git_profile_cb callback;
+	void *payload;
+};
+
+extern struct git_profile_data git_profile__data;
+
+/*
+ * A region which is being timed.  Every `git_profile_enter()` has to be
+ * matched by a `git_profile_leave()` on the same thread, including on
+ * error paths, as the regions of a thread are nested.
+ */
+typedef struct {
+	const char *name;
+	double start;
+	unsigned int depth;
+} git_profile_frame;
+
+extern void git_profile__report(git_profile_frame *frame, size_t count);
+
+GIT_INLINE(void) git_profile_enter(git_profile_frame *frame, const char *name)
+{
+	frame->name = name;
+	frame->start = 0.0;
+
+	if (git_profile__data.callback == NULL)
+		return;
+
+	frame->depth = GIT_GLOBAL->profile_depth++;
+	frame->start = git__timer();
+}
+
+GIT_INLINE(void) git_profile_leave(git_profile_frame *frame, size_t count)
+{
+	if (frame->start == 0.0)
+		return;
+
+	GIT_GLOBAL->profile_depth--;
+	git_profile__report(frame, count);
+}
+
+#endif
@@ -258,3 +258,28 @@ int git_refdb_unlock(git_refdb *db, void *payload, int success, int update_reflo
 
 	return db->backend->unlock(db->backend, payload, success, update_reflog, ref, sig, message);
 }
+
+int git_refdb_unlock_many(git_refdb *db, git_refdb_update *updates, size_t count)
+{
+	int error = 0, unlock_error;
+	size_t i;
+
+	assert(db && (updates || !count));
+
+	if (db->backend->unlock_many)
+		return db->backend->unlock_many(db->backend, updates, count);
+
+	/* once an update fails, the ones after it are dropped */
+	for (i = 0; i < count; i++) {
+		git_refdb_update *update = &updates[i];
+
+		unlock_error = db->backend->unlock(db->backend, update->payload,
+			error < 0 ? false : update->success, update->update_reflog,
+			update->ref, update->sig, update->message);
+
+		if (!error)
+			error = unlock_error;
+	}
+
+	return error;
+}
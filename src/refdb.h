@@ -10,6 +10,7 @@
 #include "common.h"
 
 #include "git2/refdb.h"
+#include "git2/sys/refdb_backend.h"
 #include "repository.h"
 
 struct git_refdb {
@@ -55,5 +56,6 @@ int git_refdb_ensure_log(git_refdb *refdb, const char *refname);
 
 int git_refdb_lock(void **payload, git_refdb *db, const char *refname);
 int git_refdb_unlock(git_refdb *db, void *payload, int success, int update_reflog, const git_reference *ref, const git_signature *sig, const char *message);
+int git_refdb_unlock_many(git_refdb *db, git_refdb_update *updates, size_t count);
 
 #endif
@@ -50,6 +50,25 @@ struct packref {
 	char name[GIT_FLEX_ARRAY];
 };
 
+/*
+ * A sorted packed-refs file, which is searched and iterated where it
+ * lies instead of being loaded into the refcache. Readers hold a
+ * reference, so that the file can change under them.
+ */
+typedef struct {
+	git_refcount rc;
+#ifdef GIT_WIN32
+	git_buf buf;
+#else
+	git_map map;
+#endif
+	const char *start; /* the first reference, past the header */
+	const char *end;
+} packed_snapshot;
+
+/* Read sorted packed-refs files through packed_snapshot */
+bool git_refdb_fs__mmap_packed = false;
+
 typedef struct refdb_fs_backend {
 	git_refdb_backend parent;
 
@@ -60,6 +79,9 @@ typedef struct refdb_fs_backend {
 	char *commonpath;
 
 	git_sortedcache *refcache;
+	git_mutex snapshot_lock;
+	packed_snapshot *snapshot;
+	git_futils_filestamp snapshot_stamp;
 	int peeling_mode;
 	git_iterator_flag_t iterator_flags;
 	uint32_t direach_flags;
@@ -197,6 +219,292 @@ parse_failed:
 	return -1;
 }
 
+/*
+ * Drop the references which packed_reload loaded to rewrite the file,
+ * so that a snapshot is all that stays in memory.
+ */
+static void packed_release(refdb_fs_backend *backend)
+{
+	if (!git_refdb_fs__mmap_packed ||
+		git_sortedcache_wlock(backend->refcache) < 0)
+		return;
+
+	git_sortedcache_clear(backend->refcache, false);
+	git_futils_filestamp_set(&backend->refcache->stamp, NULL);
+	git_sortedcache_wunlock(backend->refcache);
+}
+
+static void packed_snapshot_free(packed_snapshot *snapshot)
+{
+	if (snapshot == NULL)
+		return;
+
+#ifdef GIT_WIN32
+	git_buf_free(&snapshot->buf);
+#else
+	git_futils_mmap_free(&snapshot->map);
+#endif
+	git__free(snapshot);
+}
+
+static void packed_snapshot_release(packed_snapshot *snapshot)
+{
+	if (snapshot)
+		GIT_REFCOUNT_DEC(snapshot, packed_snapshot_free);
+}
+
+static bool has_trait(const char *traits, size_t len, const char *trait)
+{
+	size_t trait_len = strlen(trait);
+
+	for (; len >= trait_len; traits++, len--) {
+		if (!memcmp(traits, trait, trait_len))
+			return true;
+	}
+
+	return false;
+}
+
+/*
+ * Map the packed-refs file. Files which don't say that they are sorted,
+ * or which don't end with a newline, are left to packed_reload.
+ */
+static int packed_snapshot_load(packed_snapshot **out, const char *path)
+{
+	static const char *traits_header = "# pack-refs with: ";
+	packed_snapshot *snapshot;
+	const char *scan, *eof, *eol;
+	struct stat st;
+	int fd, error;
+
+	*out = NULL;
+
+	if ((fd = git_futils_open_ro(path)) < 0) {
+		if (fd == GIT_ENOTFOUND) {
+			giterr_clear();
+			return 0;
+		}
+		return fd;
+	}
+
+	if (p_fstat(fd, &st) < 0) {
+		giterr_set(GITERR_OS, "failed to stat '%s'", path);
+		p_close(fd);
+		return -1;
+	}
+
+	if (st.st_size == 0 || !git__is_sizet(st.st_size)) {
+		p_close(fd);
+		return 0;
+	}
+
+	snapshot = git__calloc(1, sizeof(packed_snapshot));
+	GITERR_CHECK_ALLOC(snapshot);
+
+#ifdef GIT_WIN32
+	/* a mapped file can't be replaced on Windows, so it is read instead */
+	error = git_futils_readbuffer_fd(&snapshot->buf, fd, (size_t)st.st_size);
+	scan = snapshot->buf.ptr;
+	eof = scan + snapshot->buf.size;
+#else
+	error = git_futils_mmap_ro(&snapshot->map, fd, 0, (size_t)st.st_size);
+	scan = snapshot->map.data;
+	eof = scan + snapshot->map.len;
+#endif
+	p_close(fd);
+
+	if (error < 0) {
+		git__free(snapshot);
+		return error;
+	}
+
+	if (eof[-1] != '\n' || (size_t)(eof - scan) < strlen(traits_header) ||
+		memcmp(scan, traits_header, strlen(traits_header)) != 0)
+		goto unsorted;
+
+	/* the traits are separated by spaces, with one at either end */
+	scan += strlen(traits_header) - 1;
+	eol = memchr(scan, '\n', eof - scan);
+	if (!has_trait(scan, eol - scan, " sorted "))
+		goto unsorted;
+
+	scan = eol + 1;
+	while (scan < eof && *scan == '#')
+		scan = memchr(scan, '\n', eof - scan) + 1;
+
+	GIT_REFCOUNT_INC(snapshot);
+	snapshot->start = scan;
+	snapshot->end = eof;
+
+	*out = snapshot;
+	return 0;
+
+unsorted:
+	packed_snapshot_free(snapshot);
+	return 0;
+}
+
+/*
+ * Get the snapshot of the packed-refs file, mapping it again if it has
+ * changed. This gives NULL when snapshots are disabled or the file
+ * can't be searched, in which case the refcache is to be used.
+ */
+static int packed_snapshot_get(packed_snapshot **out, refdb_fs_backend *backend)
+{
+	packed_snapshot *snapshot = NULL;
+	int error;
+
+	*out = NULL;
+
+	if (!git_refdb_fs__mmap_packed || !backend->gitpath)
+		return 0;
+
+	if (git_mutex_lock(&backend->snapshot_lock) < 0) {
+		giterr_set(GITERR_OS, "unable to lock packed-refs snapshot");
+		return -1;
+	}
+
+	error = git_futils_filestamp_check(
+		&backend->snapshot_stamp, git_sortedcache_path(backend->refcache));
+
+	/* a missing file is no different from an empty one */
+	if (error == GIT_ENOTFOUND) {
+		git_futils_filestamp_set(&backend->snapshot_stamp, NULL);
+		error = 0;
+	} else if (error > 0) {
+		error = packed_snapshot_load(
+			&snapshot, git_sortedcache_path(backend->refcache));
+	} else {
+		snapshot = backend->snapshot;
+	}
+
+	if (error < 0)
+		git_futils_filestamp_set(&backend->snapshot_stamp, NULL);
+
+	if (snapshot != backend->snapshot) {
+		packed_snapshot_release(backend->snapshot);
+		backend->snapshot = snapshot;
+	}
+
+	if (backend->snapshot) {
+		GIT_REFCOUNT_INC(backend->snapshot);
+		*out = backend->snapshot;
+	}
+
+	git_mutex_unlock(&backend->snapshot_lock);
+	return error;
+}
+
+typedef struct {
+	const char *name;
+	size_t name_len;
+	git_oid oid;
+	git_oid peel;
+	bool has_peel;
+	const char *next; /* the record after this one */
+} packed_record;
+
+static int packed_record_parse(
+	packed_record *record, packed_snapshot *snapshot, const char *pos)
+{
+	const char *eol = memchr(pos, '\n', snapshot->end - pos);
+
+	/* parse "<OID> <refname>\n" */
+
+	if (eol - pos < GIT_OID_HEXSZ + 2 || pos[GIT_OID_HEXSZ] != ' ' ||
+		git_oid_fromstr(&record->oid, pos) < 0)
+		goto parse_failed;
+
+	record->name = pos + GIT_OID_HEXSZ + 1;
+	record->name_len = eol - record->name;
+	if (eol[-1] == '\r')
+		record->name_len--;
+
+	/* look for optional "^<OID>\n" */
+
+	pos = eol + 1;
+	record->has_peel = (pos < snapshot->end && *pos == '^');
+
+	if (record->has_peel) {
+		if (snapshot->end - pos < GIT_OID_HEXSZ + 2 ||
+			git_oid_fromstr(&record->peel, pos + 1) < 0)
+			goto parse_failed;
+
+		pos = memchr(pos, '\n', snapshot->end - pos) + 1;
+	}
+
+	record->next = pos;
+	return 0;
+
+parse_failed:
+	giterr_set(GITERR_REFERENCE, "corrupted packed references file");
+	return -1;
+}
+
+static int packed_record_cmp(const char *name, const packed_record *record)
+{
+	int cmp = strncmp(name, record->name, record->name_len);
+
+	if (!cmp && name[record->name_len] != '\0')
+		cmp = 1;
+
+	return cmp;
+}
+
+/* Find the start of the line at pos */
+static const char *line_start(const char *start, const char *pos)
+{
+	while (pos > start && pos[-1] != '\n')
+		pos--;
+
+	return pos;
+}
+
+/*
+ * Binary search the snapshot for a reference, or if there is none,
+ * for the first reference that sorts after it.
+ */
+static int packed_snapshot_find(
+	const char **out,
+	packed_record *record,
+	packed_snapshot *snapshot,
+	const char *name)
+{
+	const char *lo = snapshot->start, *hi = snapshot->end;
+	int cmp;
+
+	while (lo < hi) {
+		const char *pos = line_start(lo, lo + (hi - lo) / 2);
+
+		/* lo is always at a reference, so a peel line has one before it */
+		if (*pos == '^')
+			pos = line_start(lo, pos - 1);
+
+		if (packed_record_parse(record, snapshot, pos) < 0)
+			return -1;
+
+		if ((cmp = packed_record_cmp(name, record)) == 0) {
+			*out = pos;
+			return 0;
+		}
+
+		if (cmp < 0)
+			hi = pos;
+		else
+			lo = record->next;
+	}
+
+	*out = lo;
+	return GIT_ENOTFOUND;
+}
+
+static int packed_snapshot_lookup(
+	packed_record *record, packed_snapshot *snapshot, const char *name)
+{
+	const char *pos;
+	return packed_snapshot_find(&pos, record, snapshot, name);
+}
+
 static int loose_parse_oid(
 	git_oid *oid, const char *filename, git_buf *file_content)
 {
@@ -329,19 +637,32 @@ static int refdb_fs_backend__exists(
 {
 	refdb_fs_backend *backend = (refdb_fs_backend *)_backend;
 	git_buf ref_path = GIT_BUF_INIT;
+	packed_snapshot *snapshot;
+	packed_record record;
 	int error;
 
 	assert(backend);
 
-	if ((error = packed_reload(backend)) < 0 ||
-		(error = git_buf_joinpath(&ref_path, backend->gitpath, ref_name)) < 0)
+	if ((error = packed_snapshot_get(&snapshot, backend)) < 0)
 		return error;
 
-	*exists = git_path_isfile(ref_path.ptr) ||
-		(git_sortedcache_lookup(backend->refcache, ref_name) != NULL);
+	if ((!snapshot && (error = packed_reload(backend)) < 0) ||
+		(error = git_buf_joinpath(&ref_path, backend->gitpath, ref_name)) < 0)
+		goto done;
+
+	if (git_path_isfile(ref_path.ptr))
+		*exists = 1;
+	else if (!snapshot)
+		*exists = (git_sortedcache_lookup(backend->refcache, ref_name) != NULL);
+	else if ((error = packed_snapshot_lookup(&record, snapshot, ref_name)) != GIT_ENOTFOUND)
+		*exists = (error == 0);
+	else
+		*exists = error = 0;
 
+done:
+	packed_snapshot_release(snapshot);
 	git_buf_free(&ref_path);
-	return 0;
+	return error;
 }
 
 static const char *loose_parse_symbolic(git_buf *file_content)
@@ -431,6 +752,24 @@ static int packed_lookup(
 {
 	int error = 0;
 	struct packref *entry;
+	packed_snapshot *snapshot;
+	packed_record record;
+
+	if ((error = packed_snapshot_get(&snapshot, backend)) < 0)
+		return error;
+
+	if (snapshot) {
+		if ((error = packed_snapshot_lookup(&record, snapshot, ref_name)) == 0) {
+			*out = git_reference__alloc(ref_name,
+				&record.oid, record.has_peel ? &record.peel : NULL);
+			error = *out ? 0 : -1;
+		} else if (error == GIT_ENOTFOUND) {
+			error = ref_error_notfound(ref_name);
+		}
+
+		packed_snapshot_release(snapshot);
+		return error;
+	}
 
 	if ((error = packed_reload(backend)) < 0)
 		return error;
@@ -486,6 +825,12 @@ typedef struct {
 	git_sortedcache *cache;
 	size_t loose_pos;
 	size_t packed_pos;
+
+	/* the packed references are read from here when it is set */
+	packed_snapshot *snapshot;
+	const char *snapshot_pos;
+	git_buf snapshot_name;
+	size_t glob_prefix_len;
 } refdb_fs_iter;
 
 static void refdb_fs_backend__iterator_free(git_reference_iterator *_iter)
@@ -495,6 +840,8 @@ static void refdb_fs_backend__iterator_free(git_reference_iterator *_iter)
 	git_vector_free(&iter->loose);
 	git_pool_clear(&iter->pool);
 	git_sortedcache_free(iter->cache);
+	packed_snapshot_release(iter->snapshot);
+	git_buf_free(&iter->snapshot_name);
 	git__free(iter);
 }
 
@@ -532,11 +879,14 @@ static int iter_load_loose_paths(refdb_fs_backend *backend, refdb_fs_iter *iter)
 			(iter->glob && p_fnmatch(iter->glob, ref_name, 0) != 0))
 			continue;
 
-		git_sortedcache_rlock(backend->refcache);
-		ref = git_sortedcache_lookup(backend->refcache, ref_name);
-		if (ref)
-			ref->flags |= PACKREF_SHADOWED;
-		git_sortedcache_runlock(backend->refcache);
+		/* the packed references of a snapshot are looked up in iter->loose */
+		if (!iter->snapshot) {
+			git_sortedcache_rlock(backend->refcache);
+			ref = git_sortedcache_lookup(backend->refcache, ref_name);
+			if (ref)
+				ref->flags |= PACKREF_SHADOWED;
+			git_sortedcache_runlock(backend->refcache);
+		}
 
 		ref_dup = git_pool_strdup(&iter->pool, ref_name);
 		if (!ref_dup)
@@ -548,9 +898,71 @@ static int iter_load_loose_paths(refdb_fs_backend *backend, refdb_fs_iter *iter)
 	git_iterator_free(fsit);
 	git_buf_free(&path);
 
+	if (!error && iter->snapshot) {
+		git_vector_set_cmp(&iter->loose, git__strcmp_cb);
+		git_vector_sort(&iter->loose);
+	}
+
 	return error;
 }
 
+/*
+ * Read the next packed reference from the snapshot, skipping the ones
+ * which have a loose reference or don't match the glob.
+ */
+static int iter_next_snapshot(packed_record *record, refdb_fs_iter *iter)
+{
+	packed_snapshot *snapshot = iter->snapshot;
+	size_t pos;
+
+	while (iter->snapshot_pos < snapshot->end) {
+		if (packed_record_parse(record, snapshot, iter->snapshot_pos) < 0 ||
+			git_buf_set(&iter->snapshot_name, record->name, record->name_len) < 0)
+			return -1;
+
+		iter->snapshot_pos = record->next;
+
+		/* the references matching the start of the glob come in a row */
+		if (iter->glob_prefix_len &&
+			strncmp(iter->snapshot_name.ptr, iter->glob, iter->glob_prefix_len) > 0)
+			break;
+
+		if (git_vector_bsearch(&pos, &iter->loose, iter->snapshot_name.ptr) == 0)
+			continue;
+		if (iter->glob && p_fnmatch(iter->glob, iter->snapshot_name.ptr, 0) != 0)
+			continue;
+
+		return 0;
+	}
+
+	iter->snapshot_pos = snapshot->end;
+	return GIT_ITEROVER;
+}
+
+static int iter_seek_snapshot(refdb_fs_iter *iter)
+{
+	packed_record record;
+	int error;
+
+	iter->snapshot_pos = iter->snapshot->start;
+
+	if (!iter->glob)
+		return 0;
+
+	iter->glob_prefix_len = strcspn(iter->glob, "*?[\\");
+
+	if (!iter->glob_prefix_len)
+		return 0;
+
+	if (git_buf_set(&iter->snapshot_name, iter->glob, iter->glob_prefix_len) < 0)
+		return -1;
+
+	error = packed_snapshot_find(&iter->snapshot_pos,
+		&record, iter->snapshot, iter->snapshot_name.ptr);
+
+	return (error == GIT_ENOTFOUND) ? 0 : error;
+}
+
 static int refdb_fs_backend__iterator_next(
 	git_reference **out, git_reference_iterator *_iter)
 {
@@ -568,8 +980,21 @@ static int refdb_fs_backend__iterator_next(
 		giterr_clear();
 	}
 
+	if (iter->snapshot) {
+		packed_record record;
+
+		if ((error = iter_next_snapshot(&record, iter)) < 0)
+			return error;
+
+		*out = git_reference__alloc(iter->snapshot_name.ptr,
+			&record.oid, record.has_peel ? &record.peel : NULL);
+		return (*out != NULL) ? 0 : -1;
+	}
+
 	if (!iter->cache) {
-		if ((error = git_sortedcache_copy(&iter->cache, backend->refcache, 1, NULL, NULL)) < 0)
+		/* packed_release may have dropped the references since */
+		if ((error = packed_reload(backend)) < 0 ||
+			(error = git_sortedcache_copy(&iter->cache, backend->refcache, 1, NULL, NULL)) < 0)
 			return error;
 	}
 
@@ -611,8 +1036,20 @@ static int refdb_fs_backend__iterator_next_name(
 		giterr_clear();
 	}
 
+	if (iter->snapshot) {
+		packed_record record;
+
+		if ((error = iter_next_snapshot(&record, iter)) < 0)
+			return error;
+
+		*out = iter->snapshot_name.ptr;
+		return 0;
+	}
+
 	if (!iter->cache) {
-		if ((error = git_sortedcache_copy(&iter->cache, backend->refcache, 1, NULL, NULL)) < 0)
+		/* packed_release may have dropped the references since */
+		if ((error = packed_reload(backend)) < 0 ||
+			(error = git_sortedcache_copy(&iter->cache, backend->refcache, 1, NULL, NULL)) < 0)
 			return error;
 	}
 
@@ -641,16 +1078,22 @@ static int refdb_fs_backend__iterator(
 	int error;
 	refdb_fs_iter *iter;
 	refdb_fs_backend *backend = (refdb_fs_backend *)_backend;
+	packed_snapshot *snapshot;
 
 	assert(backend);
 
-	if ((error = packed_reload(backend)) < 0)
+	if ((error = packed_snapshot_get(&snapshot, backend)) < 0 ||
+		(!snapshot && (error = packed_reload(backend)) < 0))
 		return error;
 
 	iter = git__calloc(1, sizeof(refdb_fs_iter));
-	GITERR_CHECK_ALLOC(iter);
+	if (!iter) {
+		packed_snapshot_release(snapshot);
+		return -1;
+	}
 
 	git_pool_init(&iter->pool, 1);
+	iter->snapshot = snapshot;
 
 	if (git_vector_init(&iter->loose, 8, NULL) < 0)
 		goto fail;
@@ -663,7 +1106,8 @@ static int refdb_fs_backend__iterator(
 	iter->parent.next_name = refdb_fs_backend__iterator_next_name;
 	iter->parent.free = refdb_fs_backend__iterator_free;
 
-	if (iter_load_loose_paths(backend, iter) < 0)
+	if (iter_load_loose_paths(backend, iter) < 0 ||
+		(iter->snapshot && iter_seek_snapshot(iter) < 0))
 		goto fail;
 
 	*out = (git_reference_iterator *)iter;
@@ -691,34 +1135,99 @@ static bool ref_is_available(
 	return true;
 }
 
+/*
+ * Look for packed references which new_ref is a directory of, or which
+ * are a directory of new_ref, without going through all of them.
+ */
+static int snapshot_path_available(
+	packed_snapshot *snapshot, const char *new_ref, const char *old_ref)
+{
+	git_buf name = GIT_BUF_INIT;
+	packed_record record;
+	const char *pos, *slash;
+	int error = 0;
+
+	for (slash = strchr(new_ref, '/'); slash; slash = strchr(slash + 1, '/')) {
+		if ((error = git_buf_set(&name, new_ref, slash - new_ref)) < 0)
+			goto done;
+
+		error = packed_snapshot_lookup(&record, snapshot, name.ptr);
+
+		if (error == 0 && (old_ref == NULL || strcmp(old_ref, name.ptr)))
+			goto collides;
+		if (error != GIT_ENOTFOUND)
+			goto done;
+	}
+
+	git_buf_clear(&name);
+
+	if ((error = git_buf_printf(&name, "%s/", new_ref)) < 0)
+		goto done;
+
+	if ((error = packed_snapshot_find(&pos, &record, snapshot, name.ptr)) == 0)
+		goto collides;
+	if (error != GIT_ENOTFOUND)
+		goto done;
+
+	for (error = 0; pos < snapshot->end; pos = record.next) {
+		if ((error = packed_record_parse(&record, snapshot, pos)) < 0)
+			goto done;
+
+		if (record.name_len < name.size ||
+			memcmp(record.name, name.ptr, name.size) != 0)
+			break;
+
+		if (old_ref == NULL || packed_record_cmp(old_ref, &record) != 0)
+			goto collides;
+	}
+
+	goto done;
+
+collides:
+	giterr_set(GITERR_REFERENCE,
+		"path to reference '%s' collides with existing one", new_ref);
+	error = -1;
+
+done:
+	git_buf_free(&name);
+	return error;
+}
+
 static int reference_path_available(
 	refdb_fs_backend *backend,
 	const char *new_ref,
 	const char* old_ref,
 	int force)
 {
+	packed_snapshot *snapshot;
 	size_t i;
 	int error;
 
-	if ((error = packed_reload(backend)) < 0)
+	if ((error = packed_snapshot_get(&snapshot, backend)) < 0 ||
+		(!snapshot && (error = packed_reload(backend)) < 0))
 		return error;
 
 	if (!force) {
 		int exists;
 
 		if ((error = refdb_fs_backend__exists(
-			&exists, (git_refdb_backend *)backend, new_ref)) < 0) {
-			return error;
-		}
+			&exists, (git_refdb_backend *)backend, new_ref)) < 0)
+			goto done;
 
 		if (exists) {
 			giterr_set(GITERR_REFERENCE,
 				"failed to write reference '%s': a reference with "
 				"that name already exists.", new_ref);
-			return GIT_EEXISTS;
+			error = GIT_EEXISTS;
+			goto done;
 		}
 	}
 
+	if (snapshot) {
+		error = snapshot_path_available(snapshot, new_ref, old_ref);
+		goto done;
+	}
+
 	git_sortedcache_rlock(backend->refcache);
 
 	for (i = 0; i < git_sortedcache_entrycount(backend->refcache); ++i) {
@@ -733,9 +1242,165 @@ static int reference_path_available(
 	}
 
 	git_sortedcache_runlock(backend->refcache);
+
+done:
+	packed_snapshot_release(snapshot);
+	return error;
+}
+
+/* The packed references in order, from the snapshot or the refcache */
+typedef struct {
+	packed_snapshot *snapshot;
+	packed_record record;
+	const char *pos;
+	git_sortedcache *cache;
+	size_t idx;
+
+	const char *name;
+	size_t name_len;
+} packed_cursor;
+
+static int packed_cursor_next(packed_cursor *cursor)
+{
+	struct packref *ref;
+	int error;
+
+	if (cursor->snapshot) {
+		if (cursor->pos >= cursor->snapshot->end)
+			return GIT_ITEROVER;
+
+		if ((error = packed_record_parse(
+				&cursor->record, cursor->snapshot, cursor->pos)) < 0)
+			return error;
+
+		cursor->name = cursor->record.name;
+		cursor->name_len = cursor->record.name_len;
+		cursor->pos = cursor->record.next;
+		return 0;
+	}
+
+	if ((ref = git_sortedcache_entry(cursor->cache, cursor->idx)) == NULL)
+		return GIT_ITEROVER;
+
+	cursor->name = ref->name;
+	cursor->name_len = strlen(ref->name);
+	cursor->idx++;
 	return 0;
 }
 
+static int name_cmp(const char *a, size_t a_len, const char *b, size_t b_len)
+{
+	int cmp = memcmp(a, b, min(a_len, b_len));
+
+	if (!cmp)
+		cmp = (a_len < b_len) ? -1 : (a_len > b_len);
+
+	return cmp;
+}
+
+typedef struct {
+	const char *name;
+	size_t name_len;
+	bool update;
+} path_entry;
+
+/*
+ * Check that none of the references written by the updates, which come
+ * sorted by name, collide with a packed reference. This goes through
+ * both in one pass. The names which are a prefix of the current one
+ * are kept on a stack, and one of them is a directory of the current
+ * name if a '/' follows it there.
+ */
+static int updates_path_available(
+	refdb_fs_backend *backend, git_refdb_update *updates, size_t count)
+{
+	git_array_t(path_entry) stack = GIT_ARRAY_INIT;
+	packed_cursor cursor = {0};
+	path_entry entry, *top;
+	const char *collision = NULL;
+	size_t i = 0, j;
+	int error, cmp;
+
+	if ((error = packed_snapshot_get(&cursor.snapshot, backend)) < 0 ||
+		(!cursor.snapshot && (error = packed_reload(backend)) < 0))
+		return error;
+
+	if (cursor.snapshot) {
+		cursor.pos = cursor.snapshot->start;
+	} else {
+		cursor.cache = backend->refcache;
+		git_sortedcache_rlock(cursor.cache);
+	}
+
+	if ((error = packed_cursor_next(&cursor)) < 0 && error != GIT_ITEROVER)
+		goto done;
+
+	while (!collision && (i < count || error != GIT_ITEROVER)) {
+		if (i == count)
+			cmp = 1;
+		else if (error == GIT_ITEROVER)
+			cmp = -1;
+		else
+			cmp = name_cmp(updates[i].ref->name, strlen(updates[i].ref->name),
+				cursor.name, cursor.name_len);
+
+		/* a deleted reference is still there when the others are written */
+		if (cmp < 0 || (cmp == 0 && updates[i].success != 1)) {
+			git_refdb_update *update = &updates[i++];
+
+			if (update->success != 1)
+				continue;
+
+			entry.name = update->ref->name;
+			entry.name_len = strlen(update->ref->name);
+			entry.update = true;
+		} else {
+			entry.name = cursor.name;
+			entry.name_len = cursor.name_len;
+			entry.update = false;
+
+			if ((error = packed_cursor_next(&cursor)) < 0 && error != GIT_ITEROVER)
+				goto done;
+
+			if (cmp == 0)
+				continue;
+		}
+
+		while ((top = git_array_last(stack)) != NULL &&
+			(top->name_len > entry.name_len ||
+			 memcmp(top->name, entry.name, top->name_len) != 0))
+			git_array_pop(stack);
+
+		git_array_foreach(stack, j, top) {
+			if (top->update != entry.update && entry.name[top->name_len] == '/') {
+				collision = entry.update ? entry.name : top->name;
+				break;
+			}
+		}
+
+		if ((top = git_array_alloc(stack)) == NULL) {
+			error = -1;
+			goto done;
+		}
+		*top = entry;
+	}
+
+	error = 0;
+
+	if (collision) {
+		giterr_set(GITERR_REFERENCE,
+			"path to reference '%s' collides with existing one", collision);
+		error = -1;
+	}
+
+done:
+	if (cursor.cache)
+		git_sortedcache_runlock(cursor.cache);
+	packed_snapshot_release(cursor.snapshot);
+	git_array_clear(stack);
+	return error;
+}
+
 static int loose_lock(git_filebuf *file, refdb_fs_backend *backend, const char *name)
 {
 	int error, filebuf_flags;
@@ -808,6 +1473,13 @@ static int refdb_fs_backend__lock(void **out, git_refdb_backend *_backend, const
 		return error;
 	}
 
+	/* a transaction may lock more references than we may open files */
+	if ((error = git_filebuf_close_fd(lock)) < 0) {
+		git_filebuf_cleanup(lock);
+		git__free(lock);
+		return error;
+	}
+
 	*out = lock;
 	return 0;
 }
@@ -836,6 +1508,11 @@ static int refdb_fs_backend__unlock(git_refdb_backend *backend, void *payload, i
 
 	if (success == 2)
 		error = refdb_fs_backend__delete_tail(backend, lock, ref->name, NULL, NULL);
+	else if (success &&
+		((error = reference_path_available(
+			(refdb_fs_backend *)backend, ref->name, NULL, true)) < 0 ||
+		 (error = git_filebuf_reopen(lock)) < 0))
+		git_filebuf_cleanup(lock);
 	else if (success)
 		error = refdb_fs_backend__write_tail(backend, ref, lock, update_reflog, sig, message, NULL, NULL);
 	else
@@ -1296,6 +1973,91 @@ static int refdb_fs_backend__delete(
 	return refdb_fs_backend__delete_tail(_backend, &file, ref_name, old_id, old_target);
 }
 
+/* Remove the loose file of a reference, if it has one */
+static int loose_delete(bool *deleted, refdb_fs_backend *backend, const char *ref_name)
+{
+	git_buf loose_path = GIT_BUF_INIT;
+	int error;
+
+	*deleted = false;
+
+	if (git_buf_joinpath(&loose_path, backend->gitpath, ref_name) < 0)
+		return -1;
+
+	error = p_unlink(loose_path.ptr);
+	if (error < 0 && errno == ENOENT)
+		error = 0;
+	else if (error == 0)
+		*deleted = true;
+
+	git_buf_free(&loose_path);
+	return error;
+}
+
+/*
+ * Remove references from packed-refs, writing it out once if any of
+ * them were there. `removed` is how many were.
+ */
+static int packed_delete(
+	size_t *removed, refdb_fs_backend *backend, const char **names, size_t count)
+{
+	packed_snapshot *snapshot;
+	packed_record record;
+	size_t i, pack_pos, found = 0;
+	int error = 0;
+
+	*removed = 0;
+
+	/* only load the packed references if one of these is among them */
+	if ((error = packed_snapshot_get(&snapshot, backend)) < 0)
+		return error;
+
+	if (snapshot) {
+		for (i = 0; i < count && !found; i++) {
+			if ((error = packed_snapshot_lookup(&record, snapshot, names[i])) == 0)
+				found++;
+			else if (error != GIT_ENOTFOUND)
+				break;
+		}
+		packed_snapshot_release(snapshot);
+
+		if (error < 0 && error != GIT_ENOTFOUND)
+			return error;
+		if (!found)
+			return 0;
+	}
+
+	if ((error = packed_reload(backend)) < 0)
+		return error;
+
+	if ((error = git_sortedcache_wlock(backend->refcache)) < 0)
+		goto done;
+
+	for (i = 0; i < count; i++) {
+		if ((error = git_sortedcache_lookup_index(
+				&pack_pos, backend->refcache, names[i])) == GIT_ENOTFOUND)
+			continue;
+
+		if (error < 0 ||
+			(error = git_sortedcache_remove(backend->refcache, pack_pos)) < 0)
+			break;
+
+		(*removed)++;
+	}
+
+	git_sortedcache_wunlock(backend->refcache);
+
+	if (error == GIT_ENOTFOUND)
+		error = 0;
+
+	if (!error && *removed)
+		error = packed_write(backend);
+
+done:
+	packed_release(backend);
+	return error;
+}
+
 static int refdb_fs_backend__delete_tail(
 	git_refdb_backend *_backend,
 	git_filebuf *file,
@@ -1303,10 +2065,9 @@ static int refdb_fs_backend__delete_tail(
 	const git_oid *old_id, const char *old_target)
 {
 	refdb_fs_backend *backend = (refdb_fs_backend *)_backend;
-	git_buf loose_path = GIT_BUF_INIT;
-	size_t pack_pos;
+	size_t removed;
 	int error = 0, cmp = 0;
-	bool loose_deleted = 0;
+	bool loose_deleted;
 
 	error = cmp_old_ref(&cmp, _backend, ref_name, old_id, old_target);
 	if (error < 0)
@@ -1319,42 +2080,72 @@ static int refdb_fs_backend__delete_tail(
 	}
 
 	/* If a loose reference exists, remove it from the filesystem */
-	if (git_buf_joinpath(&loose_path, backend->gitpath, ref_name) < 0)
-		return -1;
-
-
-	error = p_unlink(loose_path.ptr);
-	if (error < 0 && errno == ENOENT)
-		error = 0;
-	else if (error < 0)
-		goto cleanup;
-	else if (error == 0)
-		loose_deleted = 1;
-
-	if ((error = packed_reload(backend)) < 0)
+	if ((error = loose_delete(&loose_deleted, backend, ref_name)) < 0)
 		goto cleanup;
 
 	/* If a packed reference exists, remove it from the packfile and repack */
-	if ((error = git_sortedcache_wlock(backend->refcache)) < 0)
-		goto cleanup;
+	if ((error = packed_delete(&removed, backend, &ref_name, 1)) == 0 &&
+		!removed && !loose_deleted)
+		error = ref_error_notfound(ref_name);
 
-	if (!(error = git_sortedcache_lookup_index(
-			&pack_pos, backend->refcache, ref_name)))
-		error = git_sortedcache_remove(backend->refcache, pack_pos);
+cleanup:
+	git_filebuf_cleanup(file);
 
-	git_sortedcache_wunlock(backend->refcache);
+	return error;
+}
 
-	if (error == GIT_ENOTFOUND) {
-		error = loose_deleted ? 0 : ref_error_notfound(ref_name);
-		goto cleanup;
+/*
+ * Unlock the references of a transaction. The loose ones are written
+ * one by one, but those which are deleted are taken out of packed-refs
+ * together, so that it's only written once.
+ */
+static int refdb_fs_backend__unlock_many(
+	git_refdb_backend *_backend, git_refdb_update *updates, size_t count)
+{
+	refdb_fs_backend *backend = (refdb_fs_backend *)_backend;
+	git_vector deleted = GIT_VECTOR_INIT;
+	size_t i, removed;
+	int error, exists;
+	bool loose_deleted;
+
+	/* when this fails, all of the locks are discarded below */
+	error = updates_path_available(backend, updates, count);
+
+	for (i = 0; i < count; i++) {
+		git_refdb_update *update = &updates[i];
+		git_filebuf *lock = update->payload;
+
+		if (error < 0 || !update->success) {
+			git_filebuf_cleanup(lock);
+		} else if (update->success == 2) {
+			if ((error = refdb_fs_backend__exists(&exists, _backend, update->ref->name)) == 0 &&
+				!exists)
+				error = ref_error_notfound(update->ref->name);
+
+			if (!error &&
+				(error = loose_delete(&loose_deleted, backend, update->ref->name)) == 0)
+				error = git_vector_insert(&deleted, (char *)update->ref->name);
+
+			git_filebuf_cleanup(lock);
+		} else if ((error = git_filebuf_reopen(lock)) < 0) {
+			git_filebuf_cleanup(lock);
+		} else {
+			error = refdb_fs_backend__write_tail(_backend, update->ref, lock,
+				update->update_reflog, update->sig, update->message, NULL, NULL);
+		}
+
+		git__free(lock);
 	}
 
-	error = packed_write(backend);
+	if (deleted.length) {
+		int packed_error = packed_delete(&removed, backend,
+			(const char **)deleted.contents, deleted.length);
 
-cleanup:
-	git_buf_free(&loose_path);
-	git_filebuf_cleanup(file);
+		if (!error)
+			error = packed_error;
+	}
 
+	git_vector_free(&deleted);
 	return error;
 }
 
@@ -1434,6 +2225,7 @@ static int refdb_fs_backend__compress(git_refdb_backend *_backend)
 	    (error = packed_write(backend)) < 0) /* write back to disk */
 		return error;
 
+	packed_release(backend);
 	return 0;
 }
 
@@ -1444,6 +2236,8 @@ static void refdb_fs_backend__free(git_refdb_backend *_backend)
 	assert(backend);
 
 	git_sortedcache_free(backend->refcache);
+	packed_snapshot_release(backend->snapshot);
+	git_mutex_free(&backend->snapshot_lock);
 	git__free(backend->gitpath);
 	git__free(backend->commonpath);
 	git__free(backend);
@@ -2024,6 +2818,12 @@ int git_refdb_backend_fs(
 
 	git_buf_free(&gitpath);
 
+	if (git_mutex_init(&backend->snapshot_lock) < 0) {
+		giterr_set(GITERR_OS, "failed to initialize packed-refs snapshot lock");
+		git_sortedcache_free(backend->refcache);
+		goto fail;
+	}
+
 	if (!git_repository__cvar(&t, backend->repo, GIT_CVAR_IGNORECASE) && t) {
 		backend->iterator_flags |= GIT_ITERATOR_IGNORE_CASE;
 		backend->direach_flags  |= GIT_PATH_DIR_IGNORE_CASE;
@@ -2045,6 +2845,7 @@ int git_refdb_backend_fs(
 	backend->parent.compress = &refdb_fs_backend__compress;
 	backend->parent.lock = &refdb_fs_backend__lock;
 	backend->parent.unlock = &refdb_fs_backend__unlock;
+	backend->parent.unlock_many = &refdb_fs_backend__unlock_many;
 	backend->parent.has_log = &refdb_reflog_fs__has_log;
 	backend->parent.ensure_log = &refdb_reflog_fs__ensure_log;
 	backend->parent.free = &refdb_fs_backend__free;
@@ -0,0 +1,1962 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "reftable.h"
+
+#include "refs.h"
+#include "repository.h"
+#include "fileops.h"
+#include "filebuf.h"
+#include "pool.h"
+#include "reflog.h"
+#include "refdb.h"
+
+#include <git2/tag.h>
+#include <git2/object.h>
+#include <git2/refdb.h>
+#include <git2/sys/refdb_backend.h>
+#include <git2/sys/refs.h>
+#include <git2/sys/reflog.h>
+
+/*
+ * A reference database in a stack of reftables, as git keeps it in
+ * `$GIT_DIR/reftable`.  `tables.list` names the tables, oldest first;
+ * a reference or reflog entry in a table overrides those of the tables
+ * before it, and is deleted by a deletion record.
+ *
+ * Changes are made by writing a new table and appending it to the list
+ * while holding `tables.list.lock`, so the references which are updated
+ * together change all at once.  The references which a transaction
+ * locks go into a single table, which is written as the last of them is
+ * unlocked.  After each change the newest tables are merged while they
+ * are not much smaller than the table before them, which keeps the
+ * stack logarithmic in the number of changes.
+ */
+
+/* The tables of the repository, oldest first.  Readers hold a reference. */
+typedef struct {
+	git_refcount rc;
+	git_vector tables;
+} reftable_stack;
+
+/* A table being put together, along with the lock of the stack */
+typedef struct {
+	git_filebuf lock;
+	reftable_stack *stack;
+	git_pool pool;
+
+	/*
+	 * The records of the new table.  Reflog entries with no update
+	 * index are added to their reflog in the order they come.
+	 */
+	git_vector refs;
+	git_vector logs;
+
+	bool compact_all;
+	bool failed;
+} reftable_addition;
+
+typedef struct {
+	git_refdb_backend parent;
+
+	git_repository *repo;
+	char *path;
+	char *list_path;
+	int fsync;
+
+	git_mutex lock;
+	reftable_stack *stack;
+	git_futils_filestamp stamp;
+
+	/* the table for the references locked by a transaction */
+	reftable_addition *transaction;
+	size_t transaction_locks;
+} refdb_reftable;
+
+static void stack_free(reftable_stack *stack)
+{
+	git_reftable *table;
+	size_t i;
+
+	git_vector_foreach(&stack->tables, i, table)
+		git_reftable_free(table);
+
+	git_vector_free(&stack->tables);
+	git__free(stack);
+}
+
+static void stack_release(reftable_stack *stack)
+{
+	if (stack)
+		GIT_REFCOUNT_DEC(stack, stack_free);
+}
+
+static int stack_new(reftable_stack **out)
+{
+	reftable_stack *stack = git__calloc(1, sizeof(reftable_stack));
+	GITERR_CHECK_ALLOC(stack);
+
+	if (git_vector_init(&stack->tables, 0, NULL) < 0) {
+		git__free(stack);
+		return -1;
+	}
+
+	GIT_REFCOUNT_INC(stack);
+	*out = stack;
+	return 0;
+}
+
+static uint64_t stack_next_update_index(reftable_stack *stack)
+{
+	git_reftable *last = git_vector_last(&stack->tables);
+
+	return last ? last->max_update_index + 1 : 1;
+}
+
+static git_reftable *stack_find(reftable_stack *stack, const char *name)
+{
+	git_reftable *table;
+	size_t i;
+
+	if (!stack)
+		return NULL;
+
+	git_vector_foreach(&stack->tables, i, table) {
+		if (!strcmp(table->name, name))
+			return table;
+	}
+
+	return NULL;
+}
+
+/*
+ * Read the list of tables, keeping those which we've read already.
+ * A table can be merged away between our reading the list and the
+ * table, in which case the list has changed and we read it again.
+ */
+static int stack_load(reftable_stack **out, refdb_reftable *backend)
+{
+	git_buf list = GIT_BUF_INIT, path = GIT_BUF_INIT;
+	reftable_stack *stack = NULL;
+	git_reftable *table;
+	char *line, *next;
+	int error, retries = 0;
+
+retry:
+	stack_release(stack);
+	if ((error = stack_new(&stack)) < 0)
+		goto done;
+
+	if ((error = git_futils_readbuffer(&list, backend->list_path)) < 0) {
+		/* there are no tables until there are references */
+		if (error == GIT_ENOTFOUND) {
+			giterr_clear();
+			error = 0;
+		}
+		goto done;
+	}
+
+	for (next = list.ptr; (line = git__strsep(&next, "\n")) != NULL; ) {
+		if (!*line)
+			continue;
+
+		if ((table = stack_find(backend->stack, line)) != NULL) {
+			GIT_REFCOUNT_INC(table);
+		} else {
+			if ((error = git_buf_joinpath(&path, backend->path, line)) < 0)
+				goto done;
+
+			error = git_reftable_open(&table, path.ptr, line);
+
+			if (error == GIT_ENOTFOUND && retries++ < 5)
+				goto retry;
+			if (error < 0)
+				goto done;
+		}
+
+		if ((error = git_vector_insert(&stack->tables, table)) < 0) {
+			git_reftable_free(table);
+			goto done;
+		}
+	}
+
+done:
+	git_buf_free(&list);
+	git_buf_free(&path);
+
+	if (error < 0) {
+		stack_release(stack);
+		return error;
+	}
+
+	*out = stack;
+	return 0;
+}
+
+/* Get the stack, reading the list of tables again if it has changed */
+static int stack_get(reftable_stack **out, refdb_reftable *backend, bool force)
+{
+	reftable_stack *stack;
+	int error = 0, changed;
+
+	if (git_mutex_lock(&backend->lock) < 0) {
+		giterr_set(GITERR_OS, "failed to lock reftable stack");
+		return -1;
+	}
+
+	changed = git_futils_filestamp_check(&backend->stamp, backend->list_path);
+
+	if (changed == GIT_ENOTFOUND)
+		changed = !backend->stack || backend->stack->tables.length;
+
+	if (force || changed || !backend->stack) {
+		if ((error = stack_load(&stack, backend)) < 0) {
+			git_futils_filestamp_set(&backend->stamp, NULL);
+			goto done;
+		}
+
+		stack_release(backend->stack);
+		backend->stack = stack;
+	}
+
+	GIT_REFCOUNT_INC(backend->stack);
+	*out = backend->stack;
+
+done:
+	git_mutex_unlock(&backend->lock);
+	return error;
+}
+
+static int ref_error_notfound(const char *name)
+{
+	giterr_set(GITERR_REFERENCE, "reference '%s' not found", name);
+	return GIT_ENOTFOUND;
+}
+
+static git_reference *ref_from_record(const git_reftable_ref *record)
+{
+	if (record->type == GIT_REFTABLE_REF_SYMBOLIC)
+		return git_reference__alloc_symbolic(record->name, record->target);
+
+	return git_reference__alloc(record->name, &record->id,
+		record->type == GIT_REFTABLE_REF_PEELED ? &record->peel : NULL);
+}
+
+/* Find the newest record of a reference, which is what it is now */
+static int stack_lookup(
+	git_reference **out, reftable_stack *stack, const char *name)
+{
+	git_reftable_cursor cursor = GIT_REFTABLE_CURSOR_INIT;
+	git_reftable_ref *record;
+	size_t i = stack->tables.length;
+	int error = GIT_ENOTFOUND;
+
+	while (i-- > 0) {
+		if ((error = git_reftable_seek_ref(&cursor,
+				git_vector_get(&stack->tables, i), name)) < 0 ||
+			(error = git_reftable_next_ref(&record, &cursor)) < 0) {
+			if (error == GIT_ITEROVER)
+				continue;
+			goto done;
+		}
+
+		if (strcmp(record->name, name))
+			continue;
+
+		if (record->type == GIT_REFTABLE_REF_DELETION)
+			break;
+
+		if (out) {
+			*out = ref_from_record(record);
+			GITERR_CHECK_ALLOC(*out);
+		}
+
+		error = 0;
+		goto done;
+	}
+
+	error = ref_error_notfound(name);
+
+done:
+	git_reftable_cursor_free(&cursor);
+	return error;
+}
+
+/*
+ * The references of several tables, as the newest of them has them.
+ * Unless `deletions` is set, deleted references are left out.
+ */
+typedef struct {
+	git_reftable_cursor *cursors;
+	git_reftable_ref **heads;
+	size_t count;
+
+	git_buf prefix;
+	bool deletions;
+
+	git_reftable_ref current;
+	git_buf name;
+	git_buf target;
+} merged_refs;
+
+static int merged_advance(merged_refs *merged, size_t i)
+{
+	int error = git_reftable_next_ref(&merged->heads[i], &merged->cursors[i]);
+
+	if (error == GIT_ITEROVER) {
+		merged->heads[i] = NULL;
+		error = 0;
+	}
+
+	return error;
+}
+
+static int merged_init(
+	merged_refs *merged,
+	git_reftable **tables,
+	size_t count,
+	const char *prefix,
+	bool deletions)
+{
+	size_t i;
+	int error;
+
+	memset(merged, 0, sizeof(*merged));
+	git_buf_init(&merged->prefix, 0);
+	git_buf_init(&merged->name, 0);
+	git_buf_init(&merged->target, 0);
+
+	merged->cursors = git__calloc(count ? count : 1, sizeof(git_reftable_cursor));
+	GITERR_CHECK_ALLOC(merged->cursors);
+	merged->heads = git__calloc(count ? count : 1, sizeof(git_reftable_ref *));
+	GITERR_CHECK_ALLOC(merged->heads);
+
+	merged->count = count;
+	merged->deletions = deletions;
+
+	if ((error = git_buf_puts(&merged->prefix, prefix)) < 0)
+		return error;
+
+	for (i = 0; i < count; i++) {
+		if ((error = git_reftable_seek_ref(
+				&merged->cursors[i], tables[i], prefix)) < 0 ||
+			(error = merged_advance(merged, i)) < 0)
+			return error;
+	}
+
+	return 0;
+}
+
+static int merged_next(git_reftable_ref **out, merged_refs *merged)
+{
+	git_reftable_ref *head;
+	size_t i, best;
+	int error;
+
+	for (;;) {
+		/* the first name of all, from the newest table which has it */
+		for (best = i = merged->count; i-- > 0; ) {
+			if (merged->heads[i] && (best == merged->count ||
+				strcmp(merged->heads[i]->name, merged->heads[best]->name) < 0))
+				best = i;
+		}
+
+		if (best == merged->count)
+			return GIT_ITEROVER;
+
+		head = merged->heads[best];
+
+		if (git__prefixcmp(head->name, merged->prefix.ptr))
+			return GIT_ITEROVER;
+
+		/* keep it, as the cursors move on */
+		memcpy(&merged->current, head, sizeof(git_reftable_ref));
+		if ((error = git_buf_sets(&merged->name, head->name)) < 0 ||
+			(error = git_buf_sets(&merged->target, head->target ? head->target : "")) < 0)
+			return error;
+
+		merged->current.name = merged->name.ptr;
+		if (head->target)
+			merged->current.target = merged->target.ptr;
+
+		for (i = 0; i < merged->count; i++) {
+			if (merged->heads[i] && (i == best ||
+				!strcmp(merged->heads[i]->name, merged->name.ptr)) &&
+				(error = merged_advance(merged, i)) < 0)
+				return error;
+		}
+
+		if (merged->current.type != GIT_REFTABLE_REF_DELETION ||
+			merged->deletions)
+			break;
+	}
+
+	*out = &merged->current;
+	return 0;
+}
+
+static void merged_free(merged_refs *merged)
+{
+	size_t i;
+
+	for (i = 0; merged->cursors && i < merged->count; i++)
+		git_reftable_cursor_free(&merged->cursors[i]);
+
+	git__free(merged->cursors);
+	git__free(merged->heads);
+	git_buf_free(&merged->prefix);
+	git_buf_free(&merged->name);
+	git_buf_free(&merged->target);
+}
+
+/*
+ * Read the entries of a reflog, newest first, into the pool.  Deleted
+ * entries are left out, but not the marker of an empty reflog.
+ */
+static int stack_read_log(
+	git_vector *out, reftable_stack *stack, const char *name, git_pool *pool)
+{
+	git_reftable_cursor cursor = GIT_REFTABLE_CURSOR_INIT;
+	git_reftable_log *record, *copy, *prev = NULL;
+	size_t i = stack->tables.length, j;
+	int error = 0;
+
+	git_vector_set_cmp(out, git_reftable_log_cmp);
+
+	while (i-- > 0) {
+		if ((error = git_reftable_seek_log(&cursor,
+				git_vector_get(&stack->tables, i), name)) < 0)
+			goto done;
+
+		while ((error = git_reftable_next_log(&record, &cursor)) == 0 &&
+			!strcmp(record->name, name)) {
+			copy = git_pool_mallocz(pool, sizeof(git_reftable_log));
+			GITERR_CHECK_ALLOC(copy);
+
+			memcpy(copy, record, sizeof(git_reftable_log));
+			copy->name = git_pool_strdup(pool, record->name);
+			GITERR_CHECK_ALLOC(copy->name);
+
+			if (record->type == GIT_REFTABLE_LOG_UPDATE) {
+				copy->who_name = git_pool_strdup(pool, record->who_name);
+				copy->who_email = git_pool_strdup(pool, record->who_email);
+				copy->message = git_pool_strdup(pool, record->message);
+				GITERR_CHECK_ALLOC(copy->message);
+			}
+
+			if ((error = git_vector_insert(out, copy)) < 0)
+				goto done;
+		}
+
+		if (error < 0 && error != GIT_ITEROVER)
+			goto done;
+	}
+
+	error = 0;
+
+	/* newer tables come first, and override the entries of older ones */
+	git_vector_sort(out);
+
+	for (i = j = 0; i < out->length; i++) {
+		record = git_vector_get(out, i);
+
+		if (prev && prev->update_index == record->update_index)
+			continue;
+
+		prev = record;
+		if (record->type == GIT_REFTABLE_LOG_UPDATE)
+			out->contents[j++] = record;
+	}
+	out->length = j;
+
+done:
+	git_reftable_cursor_free(&cursor);
+	return error;
+}
+
+/* The marker of a reflog without entries, which git writes as well */
+static bool log_is_marker(const git_reftable_log *log)
+{
+	return git_oid_iszero(&log->old_id) && git_oid_iszero(&log->new_id);
+}
+
+static int stack_has_log(int *out, reftable_stack *stack, const char *name)
+{
+	git_vector logs = GIT_VECTOR_INIT;
+	git_pool pool;
+	int error;
+
+	git_pool_init(&pool, 1);
+
+	if ((error = stack_read_log(&logs, stack, name, &pool)) == 0)
+		*out = logs.length > 0;
+
+	git_vector_free(&logs);
+	git_pool_clear(&pool);
+	return error;
+}
+
+static int refdb_reftable__exists(
+	int *exists,
+	git_refdb_backend *_backend,
+	const char *ref_name)
+{
+	refdb_reftable *backend = (refdb_reftable *)_backend;
+	reftable_stack *stack;
+	int error;
+
+	assert(backend);
+
+	if ((error = stack_get(&stack, backend, false)) < 0)
+		return error;
+
+	error = stack_lookup(NULL, stack, ref_name);
+	stack_release(stack);
+
+	*exists = (error == 0);
+
+	if (error == GIT_ENOTFOUND) {
+		giterr_clear();
+		error = 0;
+	}
+
+	return error;
+}
+
+static int refdb_reftable__lookup(
+	git_reference **out,
+	git_refdb_backend *_backend,
+	const char *ref_name)
+{
+	refdb_reftable *backend = (refdb_reftable *)_backend;
+	reftable_stack *stack;
+	int error;
+
+	assert(backend);
+
+	if ((error = stack_get(&stack, backend, false)) < 0)
+		return error;
+
+	error = stack_lookup(out, stack, ref_name);
+	stack_release(stack);
+
+	return error;
+}
+
+typedef struct {
+	git_reference_iterator parent;
+
+	char *glob;
+	reftable_stack *stack;
+	merged_refs refs;
+} refdb_reftable_iter;
+
+static void refdb_reftable__iterator_free(git_reference_iterator *_iter)
+{
+	refdb_reftable_iter *iter = (refdb_reftable_iter *)_iter;
+
+	merged_free(&iter->refs);
+	stack_release(iter->stack);
+	git__free(iter->glob);
+	git__free(iter);
+}
+
+static int iter_next(git_reftable_ref **out, refdb_reftable_iter *iter)
+{
+	int error;
+
+	while ((error = merged_next(out, &iter->refs)) == 0) {
+		if (!iter->glob || p_fnmatch(iter->glob, (*out)->name, 0) == 0)
+			break;
+	}
+
+	return error;
+}
+
+static int refdb_reftable__iterator_next(
+	git_reference **out, git_reference_iterator *_iter)
+{
+	refdb_reftable_iter *iter = (refdb_reftable_iter *)_iter;
+	git_reftable_ref *record;
+	int error;
+
+	if ((error = iter_next(&record, iter)) < 0)
+		return error;
+
+	*out = ref_from_record(record);
+	GITERR_CHECK_ALLOC(*out);
+
+	return 0;
+}
+
+static int refdb_reftable__iterator_next_name(
+	const char **out, git_reference_iterator *_iter)
+{
+	refdb_reftable_iter *iter = (refdb_reftable_iter *)_iter;
+	git_reftable_ref *record;
+	int error;
+
+	if ((error = iter_next(&record, iter)) < 0)
+		return error;
+
+	*out = record->name;
+	return 0;
+}
+
+static int refdb_reftable__iterator(
+	git_reference_iterator **out, git_refdb_backend *_backend, const char *glob)
+{
+	refdb_reftable *backend = (refdb_reftable *)_backend;
+	refdb_reftable_iter *iter;
+	git_buf prefix = GIT_BUF_INIT;
+	size_t literal;
+	int error;
+
+	assert(backend);
+
+	iter = git__calloc(1, sizeof(refdb_reftable_iter));
+	GITERR_CHECK_ALLOC(iter);
+
+	/* only what's under refs/ is listed; a glob can narrow that down */
+	literal = glob ? strcspn(glob, "?*[\\") : 0;
+
+	if (literal > strlen(GIT_REFS_DIR))
+		error = git_buf_put(&prefix, glob, literal);
+	else
+		error = git_buf_puts(&prefix, GIT_REFS_DIR);
+
+	if (error < 0 ||
+		(glob && (iter->glob = git__strdup(glob)) == NULL) ||
+		(error = stack_get(&iter->stack, backend, false)) < 0 ||
+		(error = merged_init(&iter->refs,
+			(git_reftable **)iter->stack->tables.contents,
+			iter->stack->tables.length, prefix.ptr, false)) < 0)
+		goto on_error;
+
+	git_buf_free(&prefix);
+
+	iter->parent.next = refdb_reftable__iterator_next;
+	iter->parent.next_name = refdb_reftable__iterator_next_name;
+	iter->parent.free = refdb_reftable__iterator_free;
+
+	*out = (git_reference_iterator *)iter;
+	return 0;
+
+on_error:
+	git_buf_free(&prefix);
+	refdb_reftable__iterator_free((git_reference_iterator *)iter);
+	return error < 0 ? error : -1;
+}
+
+/*
+ * A reference can't be named like the directory of another one, nor
+ * lie in the directory named like another one.
+ */
+static int path_available(
+	reftable_stack *stack, const char *new_ref, const char *old_ref)
+{
+	git_buf name = GIT_BUF_INIT;
+	merged_refs children = { 0 };
+	git_reftable_ref *child;
+	const char *slash;
+	int error = 0;
+
+	for (slash = strchr(new_ref, '/'); slash; slash = strchr(slash + 1, '/')) {
+		if ((error = git_buf_set(&name, new_ref, slash - new_ref)) < 0)
+			goto done;
+
+		error = stack_lookup(NULL, stack, name.ptr);
+
+		if (error == 0 && (old_ref == NULL || strcmp(old_ref, name.ptr)))
+			goto collides;
+		if (error != GIT_ENOTFOUND)
+			goto done;
+	}
+
+	giterr_clear();
+	git_buf_clear(&name);
+
+	if ((error = git_buf_printf(&name, "%s/", new_ref)) < 0 ||
+		(error = merged_init(&children,
+			(git_reftable **)stack->tables.contents,
+			stack->tables.length, name.ptr, false)) < 0)
+		goto done;
+
+	while ((error = merged_next(&child, &children)) == 0) {
+		if (old_ref == NULL || strcmp(old_ref, child->name))
+			goto collides;
+	}
+
+	if (error == GIT_ITEROVER)
+		error = 0;
+
+	goto done;
+
+collides:
+	giterr_set(GITERR_REFERENCE,
+		"path to reference '%s' collides with existing one", new_ref);
+	error = -1;
+
+done:
+	merged_free(&children);
+	git_buf_free(&name);
+	return error;
+}
+
+static void addition_free(reftable_addition *add)
+{
+	git_filebuf_cleanup(&add->lock);
+	stack_release(add->stack);
+	git_vector_free(&add->refs);
+	git_vector_free(&add->logs);
+	git_pool_clear(&add->pool);
+	git__free(add);
+}
+
+/*
+ * Lock the stack for a change, and read it as it is now.  If `join` is
+ * set, the change goes into the table of the transaction, if one is
+ * under way; other changes have to wait for it.
+ */
+static int addition_begin(
+	reftable_addition **out, refdb_reftable *backend, bool join)
+{
+	reftable_addition *add;
+	int error, flags = 0;
+
+	if (join && backend->transaction) {
+		*out = backend->transaction;
+		return 0;
+	}
+
+	add = git__calloc(1, sizeof(reftable_addition));
+	GITERR_CHECK_ALLOC(add);
+
+	git_pool_init(&add->pool, 1);
+
+	if (backend->fsync)
+		flags |= GIT_FILEBUF_FSYNC;
+
+	if ((error = git_vector_init(&add->refs, 0, git_reftable_ref_cmp)) < 0 ||
+		(error = git_vector_init(&add->logs, 0, git_reftable_log_cmp)) < 0 ||
+		(error = git_futils_mkdir(backend->path, 0777, GIT_MKDIR_PATH)) < 0 ||
+		(error = git_filebuf_open(&add->lock, backend->list_path,
+			flags, GIT_REFTABLE_FILE_MODE)) < 0 ||
+		(error = stack_get(&add->stack, backend, true)) < 0) {
+		addition_free(add);
+		return error;
+	}
+
+	*out = add;
+	return 0;
+}
+
+static int addition_ref(
+	git_reftable_ref **out, reftable_addition *add, const char *name)
+{
+	git_reftable_ref *ref;
+
+	ref = git_pool_mallocz(&add->pool, sizeof(git_reftable_ref));
+	GITERR_CHECK_ALLOC(ref);
+
+	ref->name = git_pool_strdup(&add->pool, name);
+	GITERR_CHECK_ALLOC(ref->name);
+
+	*out = ref;
+	return git_vector_insert(&add->refs, ref);
+}
+
+static int addition_log(
+	reftable_addition *add,
+	const char *name,
+	const git_oid *old_id,
+	const git_oid *new_id,
+	const git_signature *who,
+	const char *message)
+{
+	git_reftable_log *log;
+
+	log = git_pool_mallocz(&add->pool, sizeof(git_reftable_log));
+	GITERR_CHECK_ALLOC(log);
+
+	log->name = git_pool_strdup(&add->pool, name);
+	log->type = GIT_REFTABLE_LOG_UPDATE;
+	git_oid_cpy(&log->old_id, old_id);
+	git_oid_cpy(&log->new_id, new_id);
+	log->who_name = git_pool_strdup(&add->pool, who ? who->name : "");
+	log->who_email = git_pool_strdup(&add->pool, who ? who->email : "");
+	log->message = git_pool_strdup_safe(&add->pool, message);
+
+	if (!log->name || !log->who_name || !log->who_email)
+		return -1;
+
+	if (who)
+		memcpy(&log->when, &who->when, sizeof(git_time));
+
+	return git_vector_insert(&add->logs, log);
+}
+
+/* Delete all of a reflog, returning its entries, newest first */
+static int addition_drop_log(
+	git_vector *dropped, reftable_addition *add, const char *name)
+{
+	git_vector entries = GIT_VECTOR_INIT;
+	git_reftable_log *entry, *tombstone;
+	size_t i;
+	int error;
+
+	if ((error = stack_read_log(&entries, add->stack, name, &add->pool)) < 0)
+		goto done;
+
+	git_vector_foreach(&entries, i, entry) {
+		tombstone = git_pool_mallocz(&add->pool, sizeof(git_reftable_log));
+		GITERR_CHECK_ALLOC(tombstone);
+
+		tombstone->name = entry->name;
+		tombstone->update_index = entry->update_index;
+		tombstone->type = GIT_REFTABLE_LOG_DELETION;
+
+		if ((error = git_vector_insert(&add->logs, tombstone)) < 0)
+			goto done;
+	}
+
+	if (dropped)
+		git_vector_swap(dropped, &entries);
+
+done:
+	git_vector_free(&entries);
+	return error;
+}
+
+/* Write the reflog of `name` again, as it was before */
+static int addition_copy_log(
+	reftable_addition *add, const char *name, git_vector *entries)
+{
+	git_reftable_log *entry;
+	git_signature who = { 0 };
+	size_t i = entries->length;
+	int error;
+
+	while (i-- > 0) {
+		entry = git_vector_get(entries, i);
+
+		who.name = (char *)entry->who_name;
+		who.email = (char *)entry->who_email;
+		memcpy(&who.when, &entry->when, sizeof(git_time));
+
+		if ((error = addition_log(add, name, &entry->old_id, &entry->new_id,
+				&who, entry->message)) < 0)
+			return error;
+	}
+
+	return 0;
+}
+
+static int reftable_name(git_buf *out, uint64_t min, uint64_t max)
+{
+	return git_buf_printf(out, "0x%06x%06x-0x%06x%06x-%08x.ref",
+		(unsigned int)(min >> 24), (unsigned int)(min & 0xffffff),
+		(unsigned int)(max >> 24), (unsigned int)(max & 0xffffff),
+		(unsigned int)rand());
+}
+
+/* Write out a table, and read it back as one of the stack */
+static int write_table(
+	git_reftable **out,
+	refdb_reftable *backend,
+	uint64_t min,
+	uint64_t max,
+	git_vector *refs,
+	git_vector *logs)
+{
+	git_filebuf file = GIT_FILEBUF_INIT;
+	git_buf data = GIT_BUF_INIT, name = GIT_BUF_INIT, path = GIT_BUF_INIT;
+	int error, flags = GIT_FILEBUF_DO_NOT_BUFFER;
+
+	if (backend->fsync)
+		flags |= GIT_FILEBUF_FSYNC;
+
+	if ((error = git_reftable_write(&data, GIT_REFTABLE_BLOCK_SIZE,
+			min, max, refs, logs)) < 0 ||
+		(error = reftable_name(&name, min, max)) < 0 ||
+		(error = git_buf_joinpath(&path, backend->path, name.ptr)) < 0 ||
+		(error = git_filebuf_open(&file, path.ptr, flags, GIT_REFTABLE_FILE_MODE)) < 0 ||
+		(error = git_filebuf_write(&file, data.ptr, data.size)) < 0 ||
+		(error = git_filebuf_commit(&file)) < 0)
+		goto done;
+
+	error = git_reftable_parse(out, &data, name.ptr);
+
+done:
+	git_filebuf_cleanup(&file);
+	git_buf_free(&data);
+	git_buf_free(&name);
+	git_buf_free(&path);
+	return error;
+}
+
+/*
+ * Merge the tables from `start` on into one.  What is deleted goes away
+ * only when they are the whole stack; otherwise it must stay deleted.
+ */
+static int merge_tables(
+	git_reftable **out,
+	refdb_reftable *backend,
+	git_vector *tables,
+	size_t start)
+{
+	git_reftable_cursor cursor = GIT_REFTABLE_CURSOR_INIT;
+	git_vector refs = GIT_VECTOR_INIT, logs = GIT_VECTOR_INIT;
+	merged_refs merged = { 0 };
+	git_reftable_ref *ref, *ref_copy;
+	git_reftable_log *log, *log_copy, *prev;
+	git_reftable *first, *last;
+	git_pool pool;
+	size_t i, j;
+	bool base = (start == 0);
+	int error;
+
+	git_pool_init(&pool, 1);
+	git_vector_set_cmp(&logs, git_reftable_log_cmp);
+
+	if ((error = merged_init(&merged, (git_reftable **)tables->contents + start,
+			tables->length - start, "", !base)) < 0)
+		goto done;
+
+	while ((error = merged_next(&ref, &merged)) == 0) {
+		ref_copy = git_pool_mallocz(&pool, sizeof(git_reftable_ref));
+		GITERR_CHECK_ALLOC(ref_copy);
+
+		memcpy(ref_copy, ref, sizeof(git_reftable_ref));
+		ref_copy->name = git_pool_strdup(&pool, ref->name);
+		ref_copy->target = git_pool_strdup_safe(&pool, ref->target);
+
+		if (!ref_copy->name || (error = git_vector_insert(&refs, ref_copy)) < 0)
+			goto done;
+	}
+
+	if (error != GIT_ITEROVER)
+		goto done;
+
+	for (i = tables->length; i-- > start; ) {
+		if ((error = git_reftable_seek_log(&cursor, git_vector_get(tables, i), "")) < 0)
+			goto done;
+
+		while ((error = git_reftable_next_log(&log, &cursor)) == 0) {
+			log_copy = git_pool_mallocz(&pool, sizeof(git_reftable_log));
+			GITERR_CHECK_ALLOC(log_copy);
+
+			memcpy(log_copy, log, sizeof(git_reftable_log));
+			log_copy->name = git_pool_strdup(&pool, log->name);
+			log_copy->who_name = git_pool_strdup_safe(&pool, log->who_name);
+			log_copy->who_email = git_pool_strdup_safe(&pool, log->who_email);
+			log_copy->message = git_pool_strdup_safe(&pool, log->message);
+
+			if (!log_copy->name || (error = git_vector_insert(&logs, log_copy)) < 0)
+				goto done;
+		}
+
+		if (error != GIT_ITEROVER)
+			goto done;
+	}
+
+	/* the newest table comes first for each entry, and wins */
+	git_vector_sort(&logs);
+
+	for (i = j = 0, prev = NULL; i < logs.length; i++) {
+		log = git_vector_get(&logs, i);
+
+		if (prev && !git_reftable_log_cmp(prev, log))
+			continue;
+
+		prev = log;
+		if (!base || log->type != GIT_REFTABLE_LOG_DELETION)
+			logs.contents[j++] = log;
+	}
+	logs.length = j;
+
+	first = git_vector_get(tables, start);
+	last = git_vector_last(tables);
+
+	error = write_table(out, backend, first->min_update_index,
+		last->max_update_index, &refs, &logs);
+
+done:
+	git_reftable_cursor_free(&cursor);
+	merged_free(&merged);
+	git_vector_free(&refs);
+	git_vector_free(&logs);
+	git_pool_clear(&pool);
+	return error;
+}
+
+/*
+ * Merge the newest tables while the one before them is less than twice
+ * their size, so that each table is more than twice the size of all the
+ * ones after it.
+ */
+static size_t compaction_start(git_vector *tables, bool all)
+{
+	git_reftable *table;
+	size_t start = tables->length - 1, size;
+
+	if (all)
+		return 0;
+
+	table = git_vector_get(tables, start);
+	size = table->data.size;
+
+	while (start > 0) {
+		table = git_vector_get(tables, start - 1);
+
+		if (table->data.size > 2 * size)
+			break;
+
+		size += table->data.size;
+		start--;
+	}
+
+	return start;
+}
+
+static int log_name_cmp(const void *a, const void *b)
+{
+	const git_reftable_log *log_a = a, *log_b = b;
+
+	return strcmp(log_a->name, log_b->name);
+}
+
+/* Put the records in order, and give the new reflog entries their update index */
+static int addition_prepare(uint64_t *max, reftable_addition *add, uint64_t update_index)
+{
+	git_reftable_ref *ref;
+	git_reftable_log *log;
+	const char *name = NULL;
+	uint64_t count = 0;
+	size_t i, j;
+
+	*max = update_index;
+
+	git_vector_foreach(&add->refs, i, ref)
+		ref->update_index = update_index;
+
+	/* the sort is stable, so the entries of each reflog stay in order */
+	git_vector_set_cmp(&add->logs, log_name_cmp);
+	git_vector_sort(&add->logs);
+
+	git_vector_foreach(&add->logs, i, log) {
+		if (log->update_index)
+			continue;
+
+		if (!name || strcmp(name, log->name)) {
+			name = log->name;
+			count = 0;
+		}
+
+		log->update_index = update_index + count++;
+		*max = max(*max, log->update_index);
+	}
+
+	git_vector_set_cmp(&add->logs, git_reftable_log_cmp);
+	git_vector_sort(&add->logs);
+
+	for (i = j = 0; i < add->logs.length; i++) {
+		if (j && !git_reftable_log_cmp(add->logs.contents[j - 1], add->logs.contents[i]))
+			j--;
+		add->logs.contents[j++] = add->logs.contents[i];
+	}
+	add->logs.length = j;
+
+	/* the last change of a reference is the one which counts */
+	git_vector_sort(&add->refs);
+
+	for (i = j = 0; i < add->refs.length; i++) {
+		if (j && !git_reftable_ref_cmp(add->refs.contents[j - 1], add->refs.contents[i]))
+			j--;
+		add->refs.contents[j++] = add->refs.contents[i];
+	}
+	add->refs.length = j;
+
+	return 0;
+}
+
+static int addition_commit(reftable_addition *add, refdb_reftable *backend)
+{
+	git_vector merged = GIT_VECTOR_INIT;
+	git_buf path = GIT_BUF_INIT;
+	reftable_stack *stack = NULL;
+	git_reftable *table = NULL;
+	uint64_t update_index, max;
+	size_t start, i;
+	int error = 0;
+
+	if (!add->refs.length && !add->logs.length &&
+		(!add->compact_all || add->stack->tables.length < 2))
+		goto done;
+
+	if ((error = stack_new(&stack)) < 0)
+		goto done;
+
+	git_vector_foreach(&add->stack->tables, i, table) {
+		GIT_REFCOUNT_INC(table);
+		if ((error = git_vector_insert(&stack->tables, table)) < 0)
+			goto done;
+	}
+	table = NULL;
+
+	if (add->refs.length || add->logs.length) {
+		update_index = stack_next_update_index(add->stack);
+
+		if ((error = addition_prepare(&max, add, update_index)) < 0 ||
+			(error = write_table(&table, backend, update_index, max,
+				&add->refs, &add->logs)) < 0 ||
+			(error = git_vector_insert(&stack->tables, table)) < 0)
+			goto done;
+		table = NULL;
+	}
+
+	start = compaction_start(&stack->tables, add->compact_all);
+
+	if (start < stack->tables.length - 1) {
+		if ((error = merge_tables(&table, backend, &stack->tables, start)) < 0)
+			goto done;
+
+		/* the tables which were merged go once the list doesn't name them */
+		for (i = start; i < stack->tables.length; i++) {
+			if ((error = git_vector_insert(&merged, git_vector_get(&stack->tables, i))) < 0)
+				goto done;
+		}
+
+		stack->tables.length = start;
+
+		if ((error = git_vector_insert(&stack->tables, table)) < 0)
+			goto done;
+		table = NULL;
+	}
+
+	git_vector_foreach(&stack->tables, i, table) {
+		if ((error = git_filebuf_printf(&add->lock, "%s\n", table->name)) < 0)
+			goto done;
+	}
+	table = NULL;
+
+	if ((error = git_filebuf_commit(&add->lock)) < 0)
+		goto done;
+
+	/* readers get the new stack without reading it back */
+	if (git_mutex_lock(&backend->lock) < 0) {
+		giterr_set(GITERR_OS, "failed to lock reftable stack");
+		error = -1;
+		goto done;
+	}
+
+	git_futils_filestamp_check(&backend->stamp, backend->list_path);
+	stack_release(backend->stack);
+	backend->stack = stack;
+	stack = NULL;
+
+	git_mutex_unlock(&backend->lock);
+
+	git_vector_foreach(&merged, i, table) {
+		if (git_buf_joinpath(&path, backend->path, table->name) < 0 ||
+			(p_unlink(path.ptr) < 0 && errno != ENOENT))
+			giterr_clear();
+	}
+	table = NULL;
+
+done:
+	git_reftable_free(table);
+	git_vector_foreach(&merged, i, table)
+		git_reftable_free(table);
+	git_vector_free(&merged);
+	stack_release(stack);
+	git_buf_free(&path);
+	addition_free(add);
+	return error;
+}
+
+/* Write out a change, unless it's part of a transaction which does that */
+static int addition_finish(reftable_addition *add, refdb_reftable *backend, int error)
+{
+	if (add == backend->transaction) {
+		if (error < 0)
+			add->failed = true;
+		return error;
+	}
+
+	if (error < 0) {
+		addition_free(add);
+		return error;
+	}
+
+	return addition_commit(add, backend);
+}
+
+/* We only write if it's under heads/, remotes/ or notes/ or if it already has a log */
+static int should_write_reflog(
+	int *write, refdb_reftable *backend, reftable_stack *stack, const char *name)
+{
+	int error, logall, has_log = 0;
+
+	error = git_repository__cvar(&logall, backend->repo, GIT_CVAR_LOGALLREFUPDATES);
+	if (error < 0)
+		return error;
+
+	/* Defaults to the opposite of the repo being bare */
+	if (logall == GIT_LOGALLREFUPDATES_UNSET)
+		logall = !git_repository_is_bare(backend->repo);
+
+	if (!logall) {
+		*write = 0;
+	} else if (!git__prefixcmp(name, GIT_REFS_HEADS_DIR) ||
+		   !git__strcmp(name, GIT_HEAD_FILE) ||
+		   !git__prefixcmp(name, GIT_REFS_REMOTES_DIR) ||
+		   !git__prefixcmp(name, GIT_REFS_NOTES_DIR)) {
+		*write = 1;
+	} else {
+		if ((error = stack_has_log(&has_log, stack, name)) < 0)
+			return error;
+		*write = has_log;
+	}
+
+	return 0;
+}
+
+static int addition_reflog(
+	reftable_addition *add,
+	refdb_reftable *backend,
+	const git_reference *ref,
+	const git_oid *old,
+	const git_oid *new,
+	const git_signature *who,
+	const char *message)
+{
+	git_oid old_id = {{0}}, new_id = {{0}};
+	git_repository *repo = backend->repo;
+	int error, is_symbolic;
+
+	is_symbolic = ref->type == GIT_REF_SYMBOLIC;
+
+	/* "normal" symbolic updates do not write */
+	if (is_symbolic &&
+	    strcmp(ref->name, GIT_HEAD_FILE) &&
+	    !(old && new))
+		return 0;
+
+	if (old) {
+		git_oid_cpy(&old_id, old);
+	} else {
+		error = git_reference_name_to_id(&old_id, repo, ref->name);
+		if (error < 0 && error != GIT_ENOTFOUND)
+			return error;
+	}
+
+	if (new) {
+		git_oid_cpy(&new_id, new);
+	} else if (!is_symbolic) {
+		git_oid_cpy(&new_id, git_reference_target(ref));
+	} else {
+		error = git_reference_name_to_id(&new_id, repo, git_reference_symbolic_target(ref));
+		if (error < 0 && error != GIT_ENOTFOUND)
+			return error;
+		/* detaching HEAD does not create an entry */
+		if (error == GIT_ENOTFOUND)
+			return 0;
+	}
+
+	giterr_clear();
+
+	return addition_log(add, ref->name, &old_id, &new_id, who, message);
+}
+
+/*
+ * If a branch is updated directly and HEAD points to it, then HEAD's
+ * reflog gets the update too; see the loose backend for the whole story.
+ */
+static int maybe_append_head(
+	reftable_addition *add,
+	refdb_reftable *backend,
+	const git_reference *ref,
+	const git_signature *who,
+	const char *message)
+{
+	git_reference *tmp = NULL, *peeled = NULL;
+	git_oid old_id;
+	const char *name;
+	int error;
+
+	if (ref->type == GIT_REF_SYMBOLIC)
+		return 0;
+
+	/* if we can't resolve, we use {0}*40 as old id */
+	if (git_reference_name_to_id(&old_id, backend->repo, ref->name) < 0)
+		memset(&old_id, 0, sizeof(old_id));
+
+	if ((error = git_reference_lookup(&tmp, backend->repo, GIT_HEAD_FILE)) < 0)
+		return error == GIT_ENOTFOUND ? 0 : error;
+
+	/* Go down the symref chain until we find the branch */
+	while (git_reference_type(tmp) == GIT_REF_SYMBOLIC) {
+		error = git_reference_lookup(&peeled, backend->repo, git_reference_symbolic_target(tmp));
+		if (error < 0)
+			break;
+
+		git_reference_free(tmp);
+		tmp = peeled;
+	}
+
+	if (error == GIT_ENOTFOUND) {
+		error = 0;
+		name = git_reference_symbolic_target(tmp);
+	} else if (error < 0) {
+		goto cleanup;
+	} else {
+		name = git_reference_name(tmp);
+	}
+
+	if (strcmp(name, ref->name) || !strcmp(ref->name, GIT_HEAD_FILE))
+		goto cleanup;
+
+	giterr_clear();
+	error = addition_log(add, GIT_HEAD_FILE, &old_id, git_reference_target(ref), who, message);
+
+cleanup:
+	git_reference_free(tmp);
+	return error;
+}
+
+/* Annotated tags are written along with what they point to */
+static int find_peel(git_oid *out, refdb_reftable *backend, const git_oid *id)
+{
+	git_object *tag, *peeled = NULL;
+	git_odb *odb;
+	git_otype type;
+	size_t len;
+	int error;
+
+	if ((error = git_repository_odb__weakptr(&odb, backend->repo)) < 0)
+		return error;
+
+	if (git_odb_read_header(&len, &type, odb, id) < 0 || type != GIT_OBJ_TAG) {
+		giterr_clear();
+		return GIT_ENOTFOUND;
+	}
+
+	if ((error = git_object_lookup(&tag, backend->repo, id, GIT_OBJ_TAG)) < 0)
+		return error;
+
+	/* a tag of a tag is peeled all the way, as git does it */
+	if ((error = git_object_peel(&peeled, tag, GIT_OBJ_ANY)) == 0)
+		git_oid_cpy(out, git_object_id(peeled));
+
+	git_object_free(peeled);
+	git_object_free(tag);
+
+	return error;
+}
+
+static int cmp_old_ref(
+	const git_reference *old_ref, const git_oid *old_id, const char *old_target)
+{
+	/* It "matches" if there is no old value to compare against */
+	if (!old_id && !old_target)
+		return 0;
+
+	if (!old_ref)
+		return -1;
+
+	/* If the types don't match, there's no way the values do */
+	if (old_id)
+		return old_ref->type == GIT_REF_OID ?
+			git_oid_cmp(old_id, &old_ref->target.oid) : -1;
+
+	return old_ref->type == GIT_REF_SYMBOLIC ?
+		git__strcmp(old_target, old_ref->target.symbolic) : 1;
+}
+
+static int addition_write(
+	reftable_addition *add,
+	refdb_reftable *backend,
+	const git_reference *ref,
+	int force,
+	int update_reflog,
+	const git_signature *who,
+	const char *message,
+	const git_oid *old_id,
+	const char *old_target)
+{
+	git_reference *old = NULL;
+	git_reftable_ref *record;
+	int error, should_write;
+
+	if ((error = path_available(add->stack, ref->name, NULL)) < 0)
+		return error;
+
+	if ((error = stack_lookup(&old, add->stack, ref->name)) < 0) {
+		if (error != GIT_ENOTFOUND)
+			return error;
+		giterr_clear();
+	}
+
+	if (!force && old) {
+		giterr_set(GITERR_REFERENCE,
+			"failed to write reference '%s': a reference with "
+			"that name already exists.", ref->name);
+		error = GIT_EEXISTS;
+		goto done;
+	}
+
+	if (cmp_old_ref(old, old_id, old_target)) {
+		giterr_set(GITERR_REFERENCE, "old reference value does not match");
+		error = GIT_EMODIFIED;
+		goto done;
+	}
+
+	/* Don't update if we have the same value */
+	if (old && (ref->type == GIT_REF_OID ?
+		!cmp_old_ref(old, &ref->target.oid, NULL) :
+		!cmp_old_ref(old, NULL, ref->target.symbolic))) {
+		error = 0;
+		goto done;
+	}
+
+	if ((error = addition_ref(&record, add, ref->name)) < 0)
+		goto done;
+
+	if (ref->type == GIT_REF_SYMBOLIC) {
+		record->type = GIT_REFTABLE_REF_SYMBOLIC;
+		record->target = git_pool_strdup(&add->pool, ref->target.symbolic);
+		GITERR_CHECK_ALLOC(record->target);
+	} else {
+		git_oid_cpy(&record->id, &ref->target.oid);
+		record->type = GIT_REFTABLE_REF_ID;
+
+		if ((error = find_peel(&record->peel, backend, &record->id)) == 0)
+			record->type = GIT_REFTABLE_REF_PEELED;
+		else if (error != GIT_ENOTFOUND)
+			goto done;
+	}
+
+	error = 0;
+
+	if (update_reflog && who) {
+		if ((error = should_write_reflog(&should_write, backend, add->stack, ref->name)) < 0)
+			goto done;
+
+		if (should_write &&
+			((error = addition_reflog(add, backend, ref, NULL, NULL, who, message)) < 0 ||
+			 (error = maybe_append_head(add, backend, ref, who, message)) < 0))
+			goto done;
+	}
+
+done:
+	git_reference_free(old);
+	return error;
+}
+
+static int addition_delete(
+	reftable_addition *add,
+	const char *ref_name,
+	const git_oid *old_id,
+	const char *old_target)
+{
+	git_reference *old;
+	git_reftable_ref *record;
+	int error;
+
+	if ((error = stack_lookup(&old, add->stack, ref_name)) < 0)
+		return error;
+
+	if (cmp_old_ref(old, old_id, old_target)) {
+		giterr_set(GITERR_REFERENCE, "old reference value does not match");
+		error = GIT_EMODIFIED;
+	} else if ((error = addition_ref(&record, add, ref_name)) == 0) {
+		record->type = GIT_REFTABLE_REF_DELETION;
+		error = addition_drop_log(NULL, add, ref_name);
+	}
+
+	git_reference_free(old);
+	return error;
+}
+
+static int refdb_reftable__write(
+	git_refdb_backend *_backend,
+	const git_reference *ref,
+	int force,
+	const git_signature *who,
+	const char *message,
+	const git_oid *old_id,
+	const char *old_target)
+{
+	refdb_reftable *backend = (refdb_reftable *)_backend;
+	reftable_addition *add;
+	int error;
+
+	assert(backend);
+
+	if ((error = addition_begin(&add, backend, false)) < 0)
+		return error;
+
+	error = addition_write(add, backend, ref, force, true,
+		who, message, old_id, old_target);
+
+	return addition_finish(add, backend, error);
+}
+
+static int refdb_reftable__delete(
+	git_refdb_backend *_backend,
+	const char *ref_name,
+	const git_oid *old_id, const char *old_target)
+{
+	refdb_reftable *backend = (refdb_reftable *)_backend;
+	reftable_addition *add;
+	int error;
+
+	assert(backend && ref_name);
+
+	if ((error = addition_begin(&add, backend, false)) < 0)
+		return error;
+
+	error = addition_delete(add, ref_name, old_id, old_target);
+
+	return addition_finish(add, backend, error);
+}
+
+static int refdb_reftable__rename(
+	git_reference **out,
+	git_refdb_backend *_backend,
+	const char *old_name,
+	const char *new_name,
+	int force,
+	const git_signature *who,
+	const char *message)
+{
+	refdb_reftable *backend = (refdb_reftable *)_backend;
+	reftable_addition *add;
+	git_reference *old = NULL, *new = NULL;
+	git_reftable_ref *record;
+	git_vector entries = GIT_VECTOR_INIT;
+	int error, exists;
+
+	assert(backend);
+
+	if ((error = addition_begin(&add, backend, false)) < 0)
+		return error;
+
+	if ((error = path_available(add->stack, new_name, old_name)) < 0 ||
+		(error = stack_lookup(&old, add->stack, old_name)) < 0)
+		goto done;
+
+	if (!force && strcmp(old_name, new_name)) {
+		exists = stack_lookup(NULL, add->stack, new_name) == 0;
+		giterr_clear();
+
+		if (exists) {
+			giterr_set(GITERR_REFERENCE,
+				"failed to write reference '%s': a reference with "
+				"that name already exists.", new_name);
+			error = GIT_EEXISTS;
+			goto done;
+		}
+	}
+
+	if ((new = git_reference__set_name(old, new_name)) == NULL) {
+		error = -1;
+		goto done;
+	}
+	old = NULL;
+
+	/* the reflog goes along with the reference */
+	if ((error = addition_ref(&record, add, old_name)) < 0 ||
+		(error = addition_drop_log(&entries, add, old_name)) < 0 ||
+		(error = addition_drop_log(NULL, add, new_name)) < 0 ||
+		(error = addition_copy_log(add, new_name, &entries)) < 0 ||
+		(error = addition_reflog(add, backend, new,
+			git_reference_target(new), NULL, who, message)) < 0)
+		goto done;
+
+	record->type = GIT_REFTABLE_REF_DELETION;
+
+	if ((error = addition_ref(&record, add, new_name)) < 0)
+		goto done;
+
+	if (new->type == GIT_REF_SYMBOLIC) {
+		record->type = GIT_REFTABLE_REF_SYMBOLIC;
+		record->target = git_pool_strdup(&add->pool, new->target.symbolic);
+		GITERR_CHECK_ALLOC(record->target);
+	} else {
+		record->type = GIT_REFTABLE_REF_ID;
+		git_oid_cpy(&record->id, &new->target.oid);
+
+		if ((error = find_peel(&record->peel, backend, &record->id)) == 0)
+			record->type = GIT_REFTABLE_REF_PEELED;
+		else if (error != GIT_ENOTFOUND)
+			goto done;
+
+		error = 0;
+	}
+
+done:
+	git_vector_free(&entries);
+	git_reference_free(old);
+
+	if ((error = addition_finish(add, backend, error)) < 0 || out == NULL) {
+		git_reference_free(new);
+		return error;
+	}
+
+	*out = new;
+	return 0;
+}
+
+static int refdb_reftable__compress(git_refdb_backend *_backend)
+{
+	refdb_reftable *backend = (refdb_reftable *)_backend;
+	reftable_addition *add;
+	int error;
+
+	assert(backend);
+
+	if ((error = addition_begin(&add, backend, false)) < 0)
+		return error;
+
+	add->compact_all = true;
+	return addition_finish(add, backend, 0);
+}
+
+/*
+ * All the references which a transaction locks go into a single table,
+ * which is written when the last of them is unlocked, unless one of them
+ * failed to be updated.
+ */
+static int refdb_reftable__lock(void **out, git_refdb_backend *_backend, const char *refname)
+{
+	refdb_reftable *backend = (refdb_reftable *)_backend;
+	reftable_addition *add;
+	int error;
+
+	GIT_UNUSED(refname);
+
+	if ((error = addition_begin(&add, backend, true)) < 0)
+		return error;
+
+	backend->transaction = add;
+	backend->transaction_locks++;
+
+	*out = add;
+	return 0;
+}
+
+static int refdb_reftable__unlock(git_refdb_backend *_backend, void *payload, int success, int update_reflog,
+				  const git_reference *ref, const git_signature *sig, const char *message)
+{
+	refdb_reftable *backend = (refdb_reftable *)_backend;
+	reftable_addition *add = payload;
+	int error = 0;
+
+	assert(add == backend->transaction);
+
+	if (success == 2)
+		error = addition_delete(add, ref->name, NULL, NULL);
+	else if (success)
+		error = addition_write(add, backend, ref, true, update_reflog,
+			sig, message, NULL, NULL);
+
+	if (error < 0)
+		add->failed = true;
+
+	if (--backend->transaction_locks)
+		return error;
+
+	backend->transaction = NULL;
+
+	if (add->failed) {
+		addition_free(add);
+		return error;
+	}
+
+	return addition_commit(add, backend);
+}
+
+static void refdb_reftable__free(git_refdb_backend *_backend)
+{
+	refdb_reftable *backend = (refdb_reftable *)_backend;
+
+	assert(backend);
+
+	if (backend->transaction)
+		addition_free(backend->transaction);
+
+	stack_release(backend->stack);
+	git_mutex_free(&backend->lock);
+	git__free(backend->path);
+	git__free(backend->list_path);
+	git__free(backend);
+}
+
+static int refdb_reftable__has_log(git_refdb_backend *_backend, const char *name)
+{
+	refdb_reftable *backend = (refdb_reftable *)_backend;
+	reftable_stack *stack;
+	int error, has_log = 0;
+
+	assert(backend && name);
+
+	if ((error = stack_get(&stack, backend, false)) < 0)
+		return error;
+
+	error = stack_has_log(&has_log, stack, name);
+	stack_release(stack);
+
+	return error < 0 ? error : has_log;
+}
+
+static int refdb_reftable__ensure_log(git_refdb_backend *_backend, const char *name)
+{
+	refdb_reftable *backend = (refdb_reftable *)_backend;
+	reftable_addition *add;
+	git_oid zero = {{0}};
+	int error, has_log;
+
+	assert(backend && name);
+
+	if ((error = addition_begin(&add, backend, false)) < 0)
+		return error;
+
+	if ((error = stack_has_log(&has_log, add->stack, name)) == 0 && !has_log)
+		error = addition_log(add, name, &zero, &zero, NULL, NULL);
+
+	return addition_finish(add, backend, error);
+}
+
+static int reflog_alloc(git_reflog **reflog, const char *name)
+{
+	git_reflog *log;
+
+	*reflog = NULL;
+
+	log = git__calloc(1, sizeof(git_reflog));
+	GITERR_CHECK_ALLOC(log);
+
+	log->ref_name = git__strdup(name);
+	GITERR_CHECK_ALLOC(log->ref_name);
+
+	if (git_vector_init(&log->entries, 0, NULL) < 0) {
+		git__free(log->ref_name);
+		git__free(log);
+		return -1;
+	}
+
+	*reflog = log;
+
+	return 0;
+}
+
+static int reflog_entry_from_record(git_reflog_entry **out, const git_reftable_log *record)
+{
+	git_reflog_entry *entry;
+
+	entry = git__calloc(1, sizeof(git_reflog_entry));
+	GITERR_CHECK_ALLOC(entry);
+
+	git_oid_cpy(&entry->oid_old, &record->old_id);
+	git_oid_cpy(&entry->oid_cur, &record->new_id);
+
+	if ((entry->committer = git__calloc(1, sizeof(git_signature))) == NULL ||
+		(entry->committer->name = git__strdup(record->who_name)) == NULL ||
+		(entry->committer->email = git__strdup(record->who_email)) == NULL ||
+		(record->message && *record->message &&
+		 (entry->msg = git__strdup(record->message)) == NULL)) {
+		git_reflog_entry__free(entry);
+		return -1;
+	}
+
+	memcpy(&entry->committer->when, &record->when, sizeof(git_time));
+
+	*out = entry;
+	return 0;
+}
+
+static int refdb_reftable__reflog_read(git_reflog **out, git_refdb_backend *_backend, const char *name)
+{
+	refdb_reftable *backend = (refdb_reftable *)_backend;
+	reftable_stack *stack = NULL;
+	git_vector records = GIT_VECTOR_INIT;
+	git_reftable_log *record;
+	git_reflog_entry *entry;
+	git_reflog *log = NULL;
+	git_pool pool;
+	size_t i;
+	int error;
+
+	assert(out && backend && name);
+
+	git_pool_init(&pool, 1);
+
+	if ((error = reflog_alloc(&log, name)) < 0 ||
+		(error = stack_get(&stack, backend, false)) < 0 ||
+		(error = stack_read_log(&records, stack, name, &pool)) < 0)
+		goto done;
+
+	/* the reflog has its oldest entry first */
+	i = records.length;
+	while (i-- > 0) {
+		record = git_vector_get(&records, i);
+
+		if (log_is_marker(record))
+			continue;
+
+		if ((error = reflog_entry_from_record(&entry, record)) < 0)
+			goto done;
+
+		if ((error = git_vector_insert(&log->entries, entry)) < 0) {
+			git_reflog_entry__free(entry);
+			goto done;
+		}
+	}
+
+	*out = log;
+	log = NULL;
+
+done:
+	git_reflog_free(log);
+	git_vector_free(&records);
+	git_pool_clear(&pool);
+	stack_release(stack);
+	return error;
+}
+
+static int refdb_reftable__reflog_write(git_refdb_backend *_backend, git_reflog *reflog)
+{
+	refdb_reftable *backend = (refdb_reftable *)_backend;
+	reftable_addition *add;
+	git_reflog_entry *entry;
+	git_oid zero = {{0}};
+	size_t i;
+	int error;
+
+	assert(backend && reflog);
+
+	if ((error = addition_begin(&add, backend, true)) < 0)
+		return error;
+
+	if ((error = addition_drop_log(NULL, add, reflog->ref_name)) < 0)
+		goto done;
+
+	git_vector_foreach(&reflog->entries, i, entry) {
+		if ((error = addition_log(add, reflog->ref_name, &entry->oid_old,
+				&entry->oid_cur, entry->committer, entry->msg)) < 0)
+			goto done;
+	}
+
+	/* an empty reflog is still there */
+	if (!reflog->entries.length)
+		error = addition_log(add, reflog->ref_name, &zero, &zero, NULL, NULL);
+
+done:
+	return addition_finish(add, backend, error);
+}
+
+static int refdb_reftable__reflog_rename(git_refdb_backend *_backend, const char *old_name, const char *new_name)
+{
+	refdb_reftable *backend = (refdb_reftable *)_backend;
+	reftable_addition *add;
+	git_vector entries = GIT_VECTOR_INIT;
+	int error;
+
+	assert(backend && old_name && new_name);
+
+	if ((error = addition_begin(&add, backend, false)) < 0)
+		return error;
+
+	if ((error = addition_drop_log(&entries, add, old_name)) == 0 &&
+		(error = addition_drop_log(NULL, add, new_name)) == 0)
+		error = addition_copy_log(add, new_name, &entries);
+
+	git_vector_free(&entries);
+	return addition_finish(add, backend, error);
+}
+
+static int refdb_reftable__reflog_delete(git_refdb_backend *_backend, const char *name)
+{
+	refdb_reftable *backend = (refdb_reftable *)_backend;
+	reftable_addition *add;
+	int error;
+
+	assert(backend && name);
+
+	if ((error = addition_begin(&add, backend, false)) < 0)
+		return error;
+
+	error = addition_drop_log(NULL, add, name);
+	return addition_finish(add, backend, error);
+}
+
+int git_refdb_backend_reftable(
+	git_refdb_backend **backend_out,
+	git_repository *repository)
+{
+	int t = 0;
+	git_buf path = GIT_BUF_INIT;
+	refdb_reftable *backend;
+
+	assert(backend_out && repository);
+
+	if (!repository->commondir) {
+		giterr_set(GITERR_REFERENCE, "reftables need a repository on disk");
+		return -1;
+	}
+
+	backend = git__calloc(1, sizeof(refdb_reftable));
+	GITERR_CHECK_ALLOC(backend);
+
+	backend->repo = repository;
+
+	if (git_buf_joinpath(&path, repository->commondir, GIT_REFTABLE_DIR) < 0)
+		goto fail;
+	backend->path = git_buf_detach(&path);
+
+	if (git_buf_joinpath(&path, backend->path, GIT_REFTABLE_LIST_FILE) < 0)
+		goto fail;
+	backend->list_path = git_buf_detach(&path);
+
+	if (git_mutex_init(&backend->lock) < 0) {
+		giterr_set(GITERR_OS, "failed to initialize reftable stack lock");
+		goto fail;
+	}
+
+	if ((!git_repository__cvar(&t, backend->repo, GIT_CVAR_FSYNCOBJECTFILES) && t) ||
+		git_repository__fsync_gitdir)
+		backend->fsync = 1;
+
+	backend->parent.exists = &refdb_reftable__exists;
+	backend->parent.lookup = &refdb_reftable__lookup;
+	backend->parent.iterator = &refdb_reftable__iterator;
+	backend->parent.write = &refdb_reftable__write;
+	backend->parent.del = &refdb_reftable__delete;
+	backend->parent.rename = &refdb_reftable__rename;
+	backend->parent.compress = &refdb_reftable__compress;
+	backend->parent.lock = &refdb_reftable__lock;
+	backend->parent.unlock = &refdb_reftable__unlock;
+	backend->parent.has_log = &refdb_reftable__has_log;
+	backend->parent.ensure_log = &refdb_reftable__ensure_log;
+	backend->parent.free = &refdb_reftable__free;
+	backend->parent.reflog_read = &refdb_reftable__reflog_read;
+	backend->parent.reflog_write = &refdb_reftable__reflog_write;
+	backend->parent.reflog_rename = &refdb_reftable__reflog_rename;
+	backend->parent.reflog_delete = &refdb_reftable__reflog_delete;
+
+	*backend_out = (git_refdb_backend *)backend;
+	return 0;
+
+fail:
+	git_buf_free(&path);
+	git__free(backend->path);
+	git__free(backend->list_path);
+	git__free(backend);
+	return -1;
+}
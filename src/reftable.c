@@ -0,0 +1,1125 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "reftable.h"
+
+#include "array.h"
+#include "fileops.h"
+#include "zstream.h"
+
+#define REFTABLE_VERSION 1
+#define REFTABLE_HEADER_SIZE 24
+#define REFTABLE_FOOTER_SIZE 68
+#define REFTABLE_BLOCK_HEADER_SIZE 4
+#define REFTABLE_MAX_BLOCK_LEN ((1 << 24) - 1)
+
+/* how often a record is written with its whole name */
+#define REFTABLE_RESTART_INTERVAL 16
+
+#define REFTABLE_BLOCK_REF 'r'
+#define REFTABLE_BLOCK_LOG 'g'
+#define REFTABLE_BLOCK_INDEX 'i'
+
+static void put_be(unsigned char *out, uint64_t value, size_t len)
+{
+	while (len--) {
+		out[len] = value & 0xff;
+		value >>= 8;
+	}
+}
+
+static uint64_t get_be(const unsigned char *in, size_t len)
+{
+	uint64_t value = 0;
+
+	while (len--)
+		value = (value << 8) | *in++;
+
+	return value;
+}
+
+static int corrupt_table(git_reftable *table, const char *what)
+{
+	giterr_set(GITERR_REFERENCE, "corrupt reftable '%s': %s", table->name, what);
+	return -1;
+}
+
+/*
+ * Variable-length integers, in the encoding of packfile offsets: seven
+ * bits per byte, most significant first, with the redundancy removed.
+ */
+static int put_varint(git_buf *out, uint64_t value)
+{
+	unsigned char varint[10];
+	size_t pos = sizeof(varint) - 1;
+
+	varint[pos] = value & 0x7f;
+	while (value >>= 7)
+		varint[--pos] = 0x80 | (--value & 0x7f);
+
+	return git_buf_put(out, (const char *)varint + pos, sizeof(varint) - pos);
+}
+
+static int get_varint(
+	uint64_t *out, const unsigned char **pos, const unsigned char *end)
+{
+	const unsigned char *p = *pos;
+	uint64_t value;
+
+	if (p >= end)
+		return -1;
+
+	value = *p & 0x7f;
+	while (*p++ & 0x80) {
+		if (p >= end || value >= (UINT64_MAX >> 7))
+			return -1;
+		value = ((value + 1) << 7) | (*p & 0x7f);
+	}
+
+	*out = value;
+	*pos = p;
+	return 0;
+}
+
+static int get_string(
+	git_buf *out, const unsigned char **pos, const unsigned char *end)
+{
+	uint64_t len;
+
+	if (get_varint(&len, pos, end) < 0 || len > (uint64_t)(end - *pos))
+		return -1;
+
+	git_buf_clear(out);
+	if (git_buf_put(out, (const char *)*pos, (size_t)len) < 0)
+		return -1;
+
+	*pos += len;
+	return 0;
+}
+
+static int key_cmp(const char *a, size_t a_len, const char *b, size_t b_len)
+{
+	int cmp = memcmp(a, b, min(a_len, b_len));
+
+	if (cmp)
+		return cmp;
+
+	return (a_len > b_len) - (a_len < b_len);
+}
+
+/*
+ * Time zones are written the way git prints them, so that -0130 is
+ * stored as -130.
+ */
+static int16_t tz_to_hhmm(int offset)
+{
+	int sign = offset < 0 ? -1 : 1;
+
+	offset *= sign;
+	return (int16_t)(sign * ((offset / 60) * 100 + offset % 60));
+}
+
+static int tz_from_hhmm(int16_t hhmm)
+{
+	int sign = hhmm < 0 ? -1 : 1, value = hhmm * sign;
+
+	return sign * ((value / 100) * 60 + value % 100);
+}
+
+int git_reftable_parse(git_reftable **out, git_buf *data, const char *name)
+{
+	git_reftable *table;
+	const unsigned char *start, *footer;
+	uint64_t positions[5], footer_pos, ref_end;
+	size_t i;
+
+	table = git__calloc(1, sizeof(git_reftable));
+	GITERR_CHECK_ALLOC(table);
+
+	GIT_REFCOUNT_INC(table);
+	git_buf_swap(&table->data, data);
+
+	if ((table->name = git__strdup(name)) == NULL)
+		goto on_error;
+
+	start = (const unsigned char *)table->data.ptr;
+
+	if (table->data.size < REFTABLE_HEADER_SIZE + REFTABLE_FOOTER_SIZE) {
+		corrupt_table(table, "file is too short");
+		goto on_error;
+	}
+
+	if (memcmp(start, "REFT", 4) != 0 || start[4] != REFTABLE_VERSION) {
+		giterr_set(GITERR_REFERENCE,
+			"unsupported reftable '%s': not a version %d table",
+			name, REFTABLE_VERSION);
+		goto on_error;
+	}
+
+	footer_pos = table->data.size - REFTABLE_FOOTER_SIZE;
+	footer = start + footer_pos;
+
+	if (memcmp(footer, start, REFTABLE_HEADER_SIZE) != 0 ||
+		crc32(0, footer, REFTABLE_FOOTER_SIZE - 4) !=
+		get_be(footer + REFTABLE_FOOTER_SIZE - 4, 4)) {
+		corrupt_table(table, "bad footer");
+		goto on_error;
+	}
+
+	table->block_size = (uint32_t)get_be(start + 5, 3);
+	table->min_update_index = get_be(start + 8, 8);
+	table->max_update_index = get_be(start + 16, 8);
+
+	/*
+	 * The positions of the reference index, the object blocks and
+	 * their index, the log blocks and their index, in that order.
+	 */
+	for (i = 0; i < 5; i++) {
+		positions[i] = get_be(footer + REFTABLE_HEADER_SIZE + i * 8, 8);
+
+		if (positions[i] > footer_pos) {
+			corrupt_table(table, "bad footer");
+			goto on_error;
+		}
+	}
+	positions[1] >>= 5;
+
+	/* the first block holds references, if there are any */
+	if (footer_pos > REFTABLE_HEADER_SIZE &&
+		start[REFTABLE_HEADER_SIZE] == REFTABLE_BLOCK_REF) {
+		ref_end = footer_pos;
+
+		for (i = 0; i < 4; i++) {
+			if (positions[i] && positions[i] < ref_end)
+				ref_end = positions[i];
+		}
+
+		table->ref_end = (size_t)ref_end;
+	}
+
+	if (positions[3] || (footer_pos > REFTABLE_HEADER_SIZE &&
+		start[REFTABLE_HEADER_SIZE] == REFTABLE_BLOCK_LOG)) {
+		table->log_start = (size_t)positions[3];
+		table->log_end = (size_t)(positions[4] ? positions[4] : footer_pos);
+	}
+
+	if (positions[4]) {
+		table->log_index = (size_t)positions[4];
+		table->index_end = (size_t)footer_pos;
+	}
+
+	*out = table;
+	return 0;
+
+on_error:
+	git_reftable_free(table);
+	return -1;
+}
+
+int git_reftable_open(git_reftable **out, const char *path, const char *name)
+{
+	git_buf data = GIT_BUF_INIT;
+	int error;
+
+	if ((error = git_futils_readbuffer(&data, path)) < 0)
+		return error;
+
+	error = git_reftable_parse(out, &data, name);
+	git_buf_free(&data);
+
+	return error;
+}
+
+static void reftable_free(git_reftable *table)
+{
+	git_buf_free(&table->data);
+	git__free(table->name);
+	git__free(table);
+}
+
+void git_reftable_free(git_reftable *table)
+{
+	if (table == NULL)
+		return;
+
+	GIT_REFCOUNT_DEC(table, reftable_free);
+}
+
+static int inflate_block(
+	git_reftable_cursor *cursor, size_t off, size_t header, size_t len)
+{
+	git_reftable *table = cursor->table;
+	const unsigned char *in = (const unsigned char *)table->data.ptr + off;
+	z_stream *stream;
+	size_t head = header + REFTABLE_BLOCK_HEADER_SIZE;
+	int st;
+
+	git_buf_clear(&cursor->inflated);
+	if (git_buf_grow(&cursor->inflated, len) < 0)
+		return -1;
+
+	memcpy(cursor->inflated.ptr, in, head);
+
+	if (git_zstream__inflater_get(&stream) < 0)
+		return -1;
+
+	stream->next_in = (Bytef *)in + head;
+	stream->avail_in = (uInt)(cursor->table->log_end - off - head);
+	stream->next_out = (Bytef *)cursor->inflated.ptr + head;
+	stream->avail_out = (uInt)(len - head);
+
+	st = inflate(stream, Z_FINISH);
+
+	cursor->next_block = off + head + stream->total_in;
+	cursor->inflated.size = head + stream->total_out;
+	git_zstream__inflater_put(stream);
+	git_zstream__count_inflated(cursor->inflated.size - head);
+
+	if (st != Z_STREAM_END || cursor->inflated.size != len)
+		return corrupt_table(table, "bad log block");
+
+	cursor->block = (const unsigned char *)cursor->inflated.ptr;
+	return 0;
+}
+
+/* Open the block at `off`, or return GIT_ITEROVER if it's of another type */
+static int open_block(git_reftable_cursor *cursor, size_t off)
+{
+	git_reftable *table = cursor->table;
+	const unsigned char *start = (const unsigned char *)table->data.ptr;
+	size_t header = off ? 0 : REFTABLE_HEADER_SIZE, end, len, next;
+	int error;
+
+	cursor->block = NULL;
+	cursor->pos = cursor->restarts = 0;
+	cursor->pending = false;
+
+	if (cursor->block_type == REFTABLE_BLOCK_REF)
+		end = table->ref_end;
+	else if (cursor->block_type == REFTABLE_BLOCK_LOG)
+		end = table->log_end;
+	else
+		end = table->index_end;
+
+	if (off >= end || end - off < header + REFTABLE_BLOCK_HEADER_SIZE ||
+		start[off + header] != cursor->block_type)
+		return GIT_ITEROVER;
+
+	len = (size_t)get_be(start + off + header + 1, 3);
+
+	if (len < header + REFTABLE_BLOCK_HEADER_SIZE + 2)
+		return corrupt_table(table, "bad block length");
+
+	if (cursor->block_type == REFTABLE_BLOCK_LOG) {
+		if ((error = inflate_block(cursor, off, header, len)) < 0)
+			return error;
+	} else {
+		if (len > end - off)
+			return corrupt_table(table, "bad block length");
+
+		/* skip what pads the block to its size */
+		next = off + len;
+		if (table->block_size && next < end && start[next] == 0)
+			next = min(end, (next / table->block_size + 1) * table->block_size);
+
+		cursor->block = start + off;
+		cursor->next_block = next;
+	}
+
+	cursor->block_len = len;
+	cursor->restart_count = (size_t)get_be(cursor->block + len - 2, 2);
+
+	if (!cursor->restart_count ||
+		cursor->restart_count * 3 + 2 > len - header - REFTABLE_BLOCK_HEADER_SIZE) {
+		cursor->block = NULL;
+		return corrupt_table(table, "bad restart points");
+	}
+
+	cursor->restarts = len - 2 - cursor->restart_count * 3;
+	cursor->first = cursor->pos = header + REFTABLE_BLOCK_HEADER_SIZE;
+	git_buf_clear(&cursor->key);
+
+	return 0;
+}
+
+static int read_ref_value(
+	git_reftable_cursor *cursor,
+	unsigned int type,
+	const unsigned char **pos,
+	const unsigned char *end)
+{
+	git_reftable_ref *ref = &cursor->record.ref;
+	uint64_t delta;
+
+	if (get_varint(&delta, pos, end) < 0)
+		return -1;
+
+	ref->name = cursor->key.ptr;
+	ref->update_index = cursor->table->min_update_index + delta;
+	ref->type = type;
+	ref->target = NULL;
+
+	switch (type) {
+	case GIT_REFTABLE_REF_DELETION:
+		return 0;
+	case GIT_REFTABLE_REF_ID:
+	case GIT_REFTABLE_REF_PEELED:
+		if ((size_t)(end - *pos) < GIT_OID_RAWSZ * type)
+			return -1;
+
+		git_oid_fromraw(&ref->id, *pos);
+		*pos += GIT_OID_RAWSZ;
+
+		if (type == GIT_REFTABLE_REF_PEELED) {
+			git_oid_fromraw(&ref->peel, *pos);
+			*pos += GIT_OID_RAWSZ;
+		}
+		return 0;
+	case GIT_REFTABLE_REF_SYMBOLIC:
+		if (get_string(&cursor->str[0], pos, end) < 0)
+			return -1;
+
+		ref->target = cursor->str[0].ptr;
+		return 0;
+	default:
+		return -1;
+	}
+}
+
+static int read_log_value(
+	git_reftable_cursor *cursor,
+	unsigned int type,
+	const unsigned char **pos,
+	const unsigned char *end)
+{
+	git_reftable_log *log = &cursor->record.log;
+	size_t name_len = cursor->key.size - 9;
+	uint64_t time;
+
+	if (cursor->key.size < 9 || cursor->key.ptr[name_len] != '\0')
+		return -1;
+
+	log->name = cursor->key.ptr;
+	log->update_index = UINT64_MAX -
+		get_be((const unsigned char *)cursor->key.ptr + name_len + 1, 8);
+	log->type = type;
+
+	if (type == GIT_REFTABLE_LOG_DELETION)
+		return 0;
+	if (type != GIT_REFTABLE_LOG_UPDATE ||
+		(size_t)(end - *pos) < 2 * GIT_OID_RAWSZ)
+		return -1;
+
+	git_oid_fromraw(&log->old_id, *pos);
+	git_oid_fromraw(&log->new_id, *pos + GIT_OID_RAWSZ);
+	*pos += 2 * GIT_OID_RAWSZ;
+
+	if (get_string(&cursor->str[0], pos, end) < 0 ||
+		get_string(&cursor->str[1], pos, end) < 0 ||
+		get_varint(&time, pos, end) < 0 ||
+		end - *pos < 2)
+		return -1;
+
+	log->when.time = (git_time_t)time;
+	log->when.offset = tz_from_hhmm((int16_t)get_be(*pos, 2));
+	*pos += 2;
+
+	if (get_string(&cursor->str[2], pos, end) < 0)
+		return -1;
+
+	/* messages end with a newline, which ours don't */
+	if (git_buf_len(&cursor->str[2]) &&
+		cursor->str[2].ptr[cursor->str[2].size - 1] == '\n')
+		git_buf_truncate(&cursor->str[2], cursor->str[2].size - 1);
+
+	log->who_name = cursor->str[0].ptr;
+	log->who_email = cursor->str[1].ptr;
+	log->message = cursor->str[2].ptr;
+	return 0;
+}
+
+static int read_index_value(
+	git_reftable_cursor *cursor,
+	unsigned int type,
+	const unsigned char **pos,
+	const unsigned char *end)
+{
+	if (type != 0)
+		return -1;
+
+	return get_varint(&cursor->record.block_position, pos, end);
+}
+
+/* Read the record at the current position of the current block */
+static int read_record(git_reftable_cursor *cursor)
+{
+	const unsigned char *pos = cursor->block + cursor->pos;
+	const unsigned char *end = cursor->block + cursor->restarts;
+	uint64_t prefix, suffix;
+	unsigned int type;
+	int error;
+
+	if (get_varint(&prefix, &pos, end) < 0 ||
+		get_varint(&suffix, &pos, end) < 0)
+		goto corrupt;
+
+	type = suffix & 0x7;
+	suffix >>= 3;
+
+	if (prefix > cursor->key.size || suffix > (uint64_t)(end - pos))
+		goto corrupt;
+
+	git_buf_truncate(&cursor->key, (size_t)prefix);
+	if (git_buf_put(&cursor->key, (const char *)pos, (size_t)suffix) < 0)
+		return -1;
+	pos += suffix;
+
+	if (cursor->block_type == REFTABLE_BLOCK_REF)
+		error = read_ref_value(cursor, type, &pos, end);
+	else if (cursor->block_type == REFTABLE_BLOCK_LOG)
+		error = read_log_value(cursor, type, &pos, end);
+	else
+		error = read_index_value(cursor, type, &pos, end);
+
+	if (error < 0)
+		goto corrupt;
+
+	cursor->pos = pos - cursor->block;
+	return 0;
+
+corrupt:
+	/* don't read on past a broken record */
+	cursor->block = NULL;
+	return corrupt_table(cursor->table, "bad record");
+}
+
+static int next_record(git_reftable_cursor *cursor)
+{
+	int error;
+
+	if (cursor->pending) {
+		cursor->pending = false;
+		return 0;
+	}
+
+	while (cursor->block && cursor->pos >= cursor->restarts) {
+		if ((error = open_block(cursor, cursor->next_block)) < 0)
+			return error;
+	}
+
+	if (!cursor->block)
+		return GIT_ITEROVER;
+
+	return read_record(cursor);
+}
+
+static int read_restart(git_reftable_cursor *cursor, size_t idx)
+{
+	size_t off = (size_t)get_be(cursor->block + cursor->restarts + idx * 3, 3);
+
+	if (off < cursor->first || off >= cursor->restarts) {
+		cursor->block = NULL;
+		return corrupt_table(cursor->table, "bad restart points");
+	}
+
+	cursor->pos = off;
+	git_buf_clear(&cursor->key);
+
+	return read_record(cursor);
+}
+
+/*
+ * Move to the first record whose key is `key` or sorts after it,
+ * starting with the current block.
+ */
+static int seek_key(git_reftable_cursor *cursor, const char *key, size_t key_len)
+{
+	size_t lo, hi, mid;
+	int error;
+
+	while (cursor->block) {
+		/* find the last restart point that isn't past the key */
+		for (lo = 0, hi = cursor->restart_count; hi - lo > 1; ) {
+			mid = lo + (hi - lo) / 2;
+
+			if ((error = read_restart(cursor, mid)) < 0)
+				return error;
+
+			if (key_cmp(cursor->key.ptr, cursor->key.size, key, key_len) <= 0)
+				lo = mid;
+			else
+				hi = mid;
+		}
+
+		if ((error = read_restart(cursor, lo)) < 0)
+			return error;
+
+		for (;;) {
+			if (key_cmp(cursor->key.ptr, cursor->key.size, key, key_len) >= 0) {
+				cursor->pending = true;
+				return 0;
+			}
+
+			if (cursor->pos >= cursor->restarts)
+				break;
+
+			if ((error = read_record(cursor)) < 0)
+				return error;
+		}
+
+		/* everything in this block sorts before the key */
+		if ((error = open_block(cursor, cursor->next_block)) < 0)
+			return error == GIT_ITEROVER ? 0 : error;
+	}
+
+	return 0;
+}
+
+static void cursor_reset(
+	git_reftable_cursor *cursor, git_reftable *table, char block_type)
+{
+	cursor->table = table;
+	cursor->block_type = block_type;
+	cursor->block = NULL;
+	cursor->pos = cursor->restarts = 0;
+	cursor->pending = false;
+}
+
+int git_reftable_seek_ref(
+	git_reftable_cursor *cursor, git_reftable *table, const char *name)
+{
+	size_t name_len = strlen(name), lo = 0, hi, mid;
+	int error;
+
+	cursor_reset(cursor, table, REFTABLE_BLOCK_REF);
+
+	if (!table->ref_end)
+		return 0;
+
+	/* reference blocks are aligned, so they can be searched by their first names */
+	if (table->block_size) {
+		hi = (table->ref_end + table->block_size - 1) / table->block_size;
+
+		while (hi - lo > 1) {
+			mid = lo + (hi - lo) / 2;
+
+			if ((error = open_block(cursor, mid * table->block_size)) < 0 ||
+				(error = read_record(cursor)) < 0)
+				return error == GIT_ITEROVER ?
+					corrupt_table(table, "unaligned blocks") : error;
+
+			if (key_cmp(cursor->key.ptr, cursor->key.size, name, name_len) <= 0)
+				lo = mid;
+			else
+				hi = mid;
+		}
+	}
+
+	if ((error = open_block(cursor, lo * table->block_size)) < 0)
+		return error == GIT_ITEROVER ? 0 : error;
+
+	return seek_key(cursor, name, name_len);
+}
+
+/*
+ * Find the log block which holds `key`, or what comes after it, by
+ * going down the levels of the log index; each index record holds the
+ * last key of the block it points to.
+ */
+static int seek_log_index(
+	size_t *out, git_reftable_cursor *cursor, const char *key, size_t key_len)
+{
+	git_reftable *table = cursor->table;
+	const unsigned char *start = (const unsigned char *)table->data.ptr;
+	size_t position = table->log_index;
+	int error;
+
+	do {
+		cursor_reset(cursor, table, REFTABLE_BLOCK_INDEX);
+
+		if ((error = open_block(cursor, position)) < 0 ||
+			(error = seek_key(cursor, key, key_len)) < 0)
+			return error == GIT_ITEROVER ?
+				corrupt_table(table, "bad log index") : error;
+
+		/* every block sorts before the key */
+		if (!cursor->block)
+			return 0;
+
+		cursor->pending = false;
+
+		/* the levels of the index are written from the bottom up */
+		if (cursor->record.block_position >= position)
+			return corrupt_table(table, "bad log index");
+
+		position = (size_t)cursor->record.block_position;
+	} while (start[position + (position ? 0 : REFTABLE_HEADER_SIZE)] ==
+		REFTABLE_BLOCK_INDEX);
+
+	*out = position;
+	return 1;
+}
+
+int git_reftable_seek_log(
+	git_reftable_cursor *cursor, git_reftable *table, const char *name)
+{
+	size_t name_len = strlen(name), position = table->log_start;
+	int error;
+
+	cursor_reset(cursor, table, REFTABLE_BLOCK_LOG);
+
+	if (table->log_end == table->log_start)
+		return 0;
+
+	/* the entries of a reflog come right after its name */
+	if (table->log_index) {
+		error = seek_log_index(&position, cursor, name, name_len + 1);
+		cursor_reset(cursor, table, REFTABLE_BLOCK_LOG);
+
+		if (error <= 0)
+			return error;
+	}
+
+	if ((error = open_block(cursor, position)) < 0)
+		return error == GIT_ITEROVER ? 0 : error;
+
+	return seek_key(cursor, name, name_len + 1);
+}
+
+int git_reftable_next_ref(git_reftable_ref **out, git_reftable_cursor *cursor)
+{
+	int error;
+
+	assert(cursor->block_type == REFTABLE_BLOCK_REF);
+
+	if ((error = next_record(cursor)) < 0)
+		return error;
+
+	*out = &cursor->record.ref;
+	return 0;
+}
+
+int git_reftable_next_log(git_reftable_log **out, git_reftable_cursor *cursor)
+{
+	int error;
+
+	assert(cursor->block_type == REFTABLE_BLOCK_LOG);
+
+	if ((error = next_record(cursor)) < 0)
+		return error;
+
+	*out = &cursor->record.log;
+	return 0;
+}
+
+void git_reftable_cursor_free(git_reftable_cursor *cursor)
+{
+	size_t i;
+
+	git_buf_free(&cursor->inflated);
+	git_buf_free(&cursor->key);
+
+	for (i = 0; i < ARRAY_SIZE(cursor->str); i++)
+		git_buf_free(&cursor->str[i]);
+
+	cursor->block = NULL;
+}
+
+int git_reftable_ref_cmp(const void *a, const void *b)
+{
+	const git_reftable_ref *ref_a = a, *ref_b = b;
+
+	return strcmp(ref_a->name, ref_b->name);
+}
+
+int git_reftable_log_cmp(const void *a, const void *b)
+{
+	const git_reftable_log *log_a = a, *log_b = b;
+	int cmp = strcmp(log_a->name, log_b->name);
+
+	if (cmp)
+		return cmp;
+
+	/* newest first */
+	return (log_a->update_index < log_b->update_index) -
+		(log_a->update_index > log_b->update_index);
+}
+
+/* The last key of a block which was written, and where the block starts */
+typedef struct {
+	size_t key_start;
+	size_t key_len;
+	uint64_t position;
+} index_entry;
+
+typedef git_array_t(index_entry) index_entry_array;
+
+typedef struct {
+	git_buf *out;
+	uint32_t block_size;
+	char block_type;
+
+	/* the block being written, after a copy of the file header if it's the first */
+	git_buf block;
+	size_t header;
+	git_array_t(uint32_t) restarts;
+	size_t entries;
+
+	git_buf last_key;
+	git_buf log_key;
+	git_buf record;
+	git_buf value;
+
+	/* the log and index blocks written so far, for the index above them */
+	index_entry_array index;
+	git_buf index_keys;
+} table_writer;
+
+static void writer_start_block(table_writer *w)
+{
+	unsigned char block_header[REFTABLE_BLOCK_HEADER_SIZE] = { 0 };
+
+	block_header[0] = w->block_type;
+
+	git_buf_truncate(&w->block, w->header);
+	git_buf_put(&w->block, (const char *)block_header, sizeof(block_header));
+	git_array_clear(w->restarts);
+	w->entries = 0;
+	git_buf_clear(&w->last_key);
+}
+
+static int writer_flush(table_writer *w)
+{
+	unsigned char *data;
+	uint32_t *restart;
+	size_t i, head = w->header + REFTABLE_BLOCK_HEADER_SIZE, len;
+	int error;
+
+	if (!w->entries)
+		return 0;
+
+	git_array_foreach(w->restarts, i, restart) {
+		unsigned char be[3];
+
+		put_be(be, *restart, 3);
+		git_buf_put(&w->block, (const char *)be, 3);
+	}
+
+	if (git_buf_grow_by(&w->block, 2) < 0)
+		return -1;
+
+	put_be((unsigned char *)w->block.ptr + w->block.size, w->restarts.size, 2);
+	w->block.size += 2;
+
+	if ((len = w->block.size) > REFTABLE_MAX_BLOCK_LEN) {
+		giterr_set(GITERR_REFERENCE, "reftable block is too large");
+		return -1;
+	}
+
+	data = (unsigned char *)w->block.ptr;
+	put_be(data + w->header + 1, len, 3);
+
+	if (w->block_type != REFTABLE_BLOCK_REF) {
+		index_entry *entry = git_array_alloc(w->index);
+		GITERR_CHECK_ALLOC(entry);
+
+		/* the first block starts at the top, with the file header */
+		entry->position = w->header ? 0 : w->out->size;
+		entry->key_start = w->index_keys.size;
+		entry->key_len = w->last_key.size;
+
+		if ((error = git_buf_put(&w->index_keys, w->last_key.ptr, w->last_key.size)) < 0)
+			return error;
+	}
+
+	if (w->block_type != REFTABLE_BLOCK_LOG) {
+		if ((error = git_buf_put(w->out, w->block.ptr + w->header, len - w->header)) < 0)
+			return error;
+
+		while (w->block_size && w->out->size % w->block_size)
+			if ((error = git_buf_putc(w->out, '\0')) < 0)
+				return error;
+	} else {
+		if ((error = git_buf_put(w->out, w->block.ptr + w->header,
+				REFTABLE_BLOCK_HEADER_SIZE)) < 0 ||
+			(error = git_zstream_deflatebuf(w->out,
+				w->block.ptr + head, len - head)) < 0)
+			return error;
+	}
+
+	/* only the first block holds the file header */
+	w->header = 0;
+	writer_start_block(w);
+
+	return 0;
+}
+
+static int writer_add(
+	table_writer *w, const char *key, size_t key_len, unsigned int type)
+{
+	size_t prefix = 0, restarts, needed;
+	bool restart;
+	int error;
+
+	restart = (w->entries % REFTABLE_RESTART_INTERVAL) == 0;
+
+	if (!restart) {
+		while (prefix < key_len && prefix < w->last_key.size &&
+			key[prefix] == w->last_key.ptr[prefix])
+			prefix++;
+	}
+
+	git_buf_clear(&w->record);
+	put_varint(&w->record, prefix);
+	put_varint(&w->record, ((uint64_t)(key_len - prefix) << 3) | type);
+	git_buf_put(&w->record, key + prefix, key_len - prefix);
+	git_buf_put(&w->record, w->value.ptr, w->value.size);
+
+	if (git_buf_oom(&w->record))
+		return -1;
+
+	restarts = w->restarts.size + (restart ? 1 : 0);
+	needed = w->block.size + w->record.size + restarts * 3 + 2;
+
+	/* start a new block if this one is full */
+	if (w->block_size && needed > w->block_size && w->entries) {
+		if ((error = writer_flush(w)) < 0)
+			return error;
+
+		return writer_add(w, key, key_len, type);
+	}
+
+	if (w->block_size && needed > w->block_size &&
+		w->block_type != REFTABLE_BLOCK_LOG) {
+		giterr_set(GITERR_REFERENCE,
+			"reference '%s' is too large for a reftable block", key);
+		return -1;
+	}
+
+	if (restart) {
+		uint32_t *off = git_array_alloc(w->restarts);
+		GITERR_CHECK_ALLOC(off);
+		*off = (uint32_t)w->block.size;
+	}
+
+	if ((error = git_buf_put(&w->block, w->record.ptr, w->record.size)) < 0 ||
+		(error = git_buf_set(&w->last_key, key, key_len)) < 0)
+		return error;
+
+	w->entries++;
+	return 0;
+}
+
+static int writer_add_ref(
+	table_writer *w, const git_reftable_ref *ref, uint64_t min_update_index)
+{
+	git_buf_clear(&w->value);
+	put_varint(&w->value, ref->update_index - min_update_index);
+
+	switch (ref->type) {
+	case GIT_REFTABLE_REF_DELETION:
+		break;
+	case GIT_REFTABLE_REF_ID:
+	case GIT_REFTABLE_REF_PEELED:
+		git_buf_put(&w->value, (const char *)ref->id.id, GIT_OID_RAWSZ);
+		if (ref->type == GIT_REFTABLE_REF_PEELED)
+			git_buf_put(&w->value, (const char *)ref->peel.id, GIT_OID_RAWSZ);
+		break;
+	case GIT_REFTABLE_REF_SYMBOLIC:
+		put_varint(&w->value, strlen(ref->target));
+		git_buf_puts(&w->value, ref->target);
+		break;
+	default:
+		assert(false);
+	}
+
+	if (git_buf_oom(&w->value))
+		return -1;
+
+	return writer_add(w, ref->name, strlen(ref->name), ref->type);
+}
+
+static int writer_add_log(table_writer *w, const git_reftable_log *log)
+{
+	unsigned char be[8];
+	size_t name_len = strlen(log->name), message_len;
+
+	/* the key is the name, then the update index reversed */
+	git_buf_clear(&w->log_key);
+	git_buf_put(&w->log_key, log->name, name_len + 1);
+	put_be(be, UINT64_MAX - log->update_index, 8);
+	git_buf_put(&w->log_key, (const char *)be, 8);
+
+	git_buf_clear(&w->value);
+
+	if (log->type == GIT_REFTABLE_LOG_UPDATE) {
+		message_len = log->message ? strlen(log->message) : 0;
+
+		git_buf_put(&w->value, (const char *)log->old_id.id, GIT_OID_RAWSZ);
+		git_buf_put(&w->value, (const char *)log->new_id.id, GIT_OID_RAWSZ);
+		put_varint(&w->value, strlen(log->who_name));
+		git_buf_puts(&w->value, log->who_name);
+		put_varint(&w->value, strlen(log->who_email));
+		git_buf_puts(&w->value, log->who_email);
+		put_varint(&w->value, log->when.time > 0 ? (uint64_t)log->when.time : 0);
+		put_be(be, (uint16_t)tz_to_hhmm(log->when.offset), 2);
+		git_buf_put(&w->value, (const char *)be, 2);
+		put_varint(&w->value, message_len + (message_len ? 1 : 0));
+		if (message_len) {
+			git_buf_put(&w->value, log->message, message_len);
+			git_buf_putc(&w->value, '\n');
+		}
+	}
+
+	if (git_buf_oom(&w->log_key) || git_buf_oom(&w->value))
+		return -1;
+
+	return writer_add(w, w->log_key.ptr, w->log_key.size, log->type);
+}
+
+/*
+ * Write an index of the blocks written since the index was last
+ * cleared, if there is more than one of them.  An index which doesn't
+ * fit in one block gets an index of its own blocks, until one does.
+ */
+static int writer_write_index(uint64_t *out, table_writer *w)
+{
+	index_entry_array entries = GIT_ARRAY_INIT;
+	git_buf keys = GIT_BUF_INIT;
+	index_entry *entry;
+	size_t i;
+	int error = 0;
+
+	*out = 0;
+
+	while (w->index.size > 1) {
+		entries = w->index;
+		git_array_init(w->index);
+		git_buf_swap(&keys, &w->index_keys);
+		git_buf_clear(&w->index_keys);
+
+		w->block_type = REFTABLE_BLOCK_INDEX;
+		writer_start_block(w);
+
+		git_array_foreach(entries, i, entry) {
+			git_buf_clear(&w->value);
+			if ((error = put_varint(&w->value, entry->position)) < 0 ||
+				(error = writer_add(w, keys.ptr + entry->key_start,
+					entry->key_len, 0)) < 0)
+				goto done;
+		}
+
+		if ((error = writer_flush(w)) < 0)
+			goto done;
+
+		git_array_clear(entries);
+		*out = git_array_get(w->index, w->index.size - 1)->position;
+	}
+
+done:
+	git_array_clear(entries);
+	git_buf_free(&keys);
+	return error;
+}
+
+int git_reftable_write(
+	git_buf *out,
+	uint32_t block_size,
+	uint64_t min_update_index,
+	uint64_t max_update_index,
+	const git_vector *refs,
+	const git_vector *logs)
+{
+	table_writer w = { 0 };
+	unsigned char header[REFTABLE_HEADER_SIZE], footer[REFTABLE_FOOTER_SIZE];
+	const git_reftable_ref *ref, *prev_ref = NULL;
+	const git_reftable_log *log, *prev_log = NULL;
+	uint64_t log_position = 0, log_index_position = 0;
+	size_t i;
+	int error = 0;
+
+	assert(out && min_update_index <= max_update_index);
+
+	memcpy(header, "REFT", 4);
+	header[4] = REFTABLE_VERSION;
+	put_be(header + 5, block_size, 3);
+	put_be(header + 8, min_update_index, 8);
+	put_be(header + 16, max_update_index, 8);
+
+	git_buf_clear(out);
+	if ((error = git_buf_put(out, (const char *)header, sizeof(header))) < 0 ||
+		(error = git_buf_put(&w.block, (const char *)header, sizeof(header))) < 0)
+		goto done;
+
+	w.out = out;
+	w.block_size = block_size;
+	w.header = REFTABLE_HEADER_SIZE;
+	w.block_type = REFTABLE_BLOCK_REF;
+	writer_start_block(&w);
+
+	git_vector_foreach(refs, i, ref) {
+		if ((prev_ref && strcmp(prev_ref->name, ref->name) >= 0) ||
+			ref->update_index < min_update_index ||
+			ref->update_index > max_update_index) {
+			giterr_set(GITERR_REFERENCE, "invalid reftable reference '%s'", ref->name);
+			error = -1;
+			goto done;
+		}
+
+		if ((error = writer_add_ref(&w, ref, min_update_index)) < 0)
+			goto done;
+
+		prev_ref = ref;
+	}
+
+	if ((error = writer_flush(&w)) < 0)
+		goto done;
+
+	if (logs->length) {
+		/* the first block starts at the top, with the file header */
+		log_position = w.header ? 0 : out->size;
+		w.block_type = REFTABLE_BLOCK_LOG;
+		writer_start_block(&w);
+	}
+
+	git_vector_foreach(logs, i, log) {
+		if (prev_log && git_reftable_log_cmp(prev_log, log) >= 0) {
+			giterr_set(GITERR_REFERENCE, "invalid reftable reflog entry for '%s'", log->name);
+			error = -1;
+			goto done;
+		}
+
+		if ((error = writer_add_log(&w, log)) < 0)
+			goto done;
+
+		prev_log = log;
+	}
+
+	if ((error = writer_flush(&w)) < 0 ||
+		(error = writer_write_index(&log_index_position, &w)) < 0)
+		goto done;
+
+	memset(footer, 0, sizeof(footer));
+	memcpy(footer, header, sizeof(header));
+	put_be(footer + REFTABLE_HEADER_SIZE + 3 * 8, log_position, 8);
+	put_be(footer + REFTABLE_HEADER_SIZE + 4 * 8, log_index_position, 8);
+	put_be(footer + REFTABLE_FOOTER_SIZE - 4,
+		crc32(0, footer, REFTABLE_FOOTER_SIZE - 4), 4);
+
+	error = git_buf_put(out, (const char *)footer, sizeof(footer));
+
+done:
+	git_buf_free(&w.block);
+	git_buf_free(&w.last_key);
+	git_buf_free(&w.log_key);
+	git_buf_free(&w.record);
+	git_buf_free(&w.value);
+	git_buf_free(&w.index_keys);
+	git_array_clear(w.restarts);
+	git_array_clear(w.index);
+	return error;
+}
@@ -0,0 +1,174 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_reftable_h__
+#define INCLUDE_reftable_h__
+
+#include "common.h"
+
+#include "git2/oid.h"
+#include "buffer.h"
+#include "vector.h"
+
+/*
+ * Reading and writing single tables in the reftable format, as
+ * described in git's Documentation/technical/reftable.txt.
+ *
+ * A table holds references and reflog entries, sorted by name, in
+ * blocks of records which share the prefix of their names with the
+ * record before them.  Every so often a record starts from scratch
+ * and is listed at the end of its block, so that a block can be
+ * searched without reading all of it.  Reflog blocks are deflated.
+ *
+ * Only version 1 tables (with SHA-1 ids) are handled.  Tables are
+ * written without object blocks or a reference index; those in tables
+ * written by other implementations are skipped.  Reference blocks are
+ * aligned to the block size, and are searched by their first name.
+ * Log blocks are not aligned, so when there is more than one of them
+ * an index of the last key of each block follows them.
+ */
+
+#define GIT_REFTABLE_DIR "reftable"
+#define GIT_REFTABLE_LIST_FILE "tables.list"
+#define GIT_REFTABLE_FILE_MODE 0666
+
+#define GIT_REFTABLE_BLOCK_SIZE 4096
+
+typedef enum {
+	GIT_REFTABLE_REF_DELETION = 0,
+	GIT_REFTABLE_REF_ID = 1,
+	GIT_REFTABLE_REF_PEELED = 2,
+	GIT_REFTABLE_REF_SYMBOLIC = 3,
+} git_reftable_ref_t;
+
+typedef enum {
+	GIT_REFTABLE_LOG_DELETION = 0,
+	GIT_REFTABLE_LOG_UPDATE = 1,
+} git_reftable_log_t;
+
+/*
+ * A reference record.  When it comes from a cursor, the strings belong
+ * to the cursor and are valid until it moves.
+ */
+typedef struct {
+	const char *name;
+	uint64_t update_index;
+	git_reftable_ref_t type;
+	git_oid id;
+	git_oid peel;
+	const char *target;
+} git_reftable_ref;
+
+/*
+ * A reflog record; the newest entry of a reflog is the one with the
+ * highest update index.  The time zone offset is in minutes, as in a
+ * `git_time`.
+ */
+typedef struct {
+	const char *name;
+	uint64_t update_index;
+	git_reftable_log_t type;
+	git_oid old_id;
+	git_oid new_id;
+	const char *who_name;
+	const char *who_email;
+	git_time when;
+	const char *message;
+} git_reftable_log;
+
+typedef struct {
+	git_refcount rc;
+	char *name;
+	git_buf data;
+
+	uint32_t block_size;
+	uint64_t min_update_index;
+	uint64_t max_update_index;
+
+	/* where the reference blocks end, and where the log blocks lie */
+	size_t ref_end;
+	size_t log_start;
+	size_t log_end;
+
+	/* the top block of the log index, which runs to the footer, or 0 */
+	size_t log_index;
+	size_t index_end;
+} git_reftable;
+
+/* Read the table at `path`; `name` is what it is called in the stack */
+extern int git_reftable_open(git_reftable **out, const char *path, const char *name);
+
+/* Read a table from memory, taking over `data` */
+extern int git_reftable_parse(git_reftable **out, git_buf *data, const char *name);
+
+extern void git_reftable_free(git_reftable *table);
+
+typedef struct {
+	git_reftable *table;
+	char block_type;
+
+	/* the current block, which starts with the file header if it's the first */
+	const unsigned char *block;
+	size_t block_len;
+	size_t restarts;
+	size_t restart_count;
+	size_t next_block;
+	git_buf inflated;
+
+	/* the first record of the block, the next one, and one that was read ahead */
+	size_t first;
+	size_t pos;
+	bool pending;
+
+	git_buf key;
+	git_buf str[3];
+	union {
+		git_reftable_ref ref;
+		git_reftable_log log;
+		uint64_t block_position; /* of an index record */
+	} record;
+} git_reftable_cursor;
+
+#define GIT_REFTABLE_CURSOR_INIT { NULL }
+
+/*
+ * Walk the references of a table, starting at the first one whose name
+ * is `name` or sorts after it.
+ */
+extern int git_reftable_seek_ref(
+	git_reftable_cursor *cursor, git_reftable *table, const char *name);
+
+/*
+ * Walk the reflog records of a table, starting with the newest entry of
+ * the reflog of `name`, or what comes after it.
+ */
+extern int git_reftable_seek_log(
+	git_reftable_cursor *cursor, git_reftable *table, const char *name);
+
+/* Get the next record, or GIT_ITEROVER when the table has no more */
+extern int git_reftable_next_ref(git_reftable_ref **out, git_reftable_cursor *cursor);
+extern int git_reftable_next_log(git_reftable_log **out, git_reftable_cursor *cursor);
+
+extern void git_reftable_cursor_free(git_reftable_cursor *cursor);
+
+/* Orders the records as they are written */
+extern int git_reftable_ref_cmp(const void *a, const void *b);
+extern int git_reftable_log_cmp(const void *a, const void *b);
+
+/*
+ * Write a table of the given `git_reftable_ref` and `git_reftable_log`
+ * records, which must be sorted and have no duplicates.  The update
+ * indexes of the references must be in the given range.
+ */
+extern int git_reftable_write(
+	git_buf *out,
+	uint32_t block_size,
+	uint64_t min_update_index,
+	uint64_t max_update_index,
+	const git_vector *refs,
+	const git_vector *logs);
+
+#endif
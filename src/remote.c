@@ -11,6 +11,7 @@
 #include "git2/types.h"
 #include "git2/oid.h"
 #include "git2/net.h"
+#include "git2/transaction.h"
 
 #include "config.h"
 #include "repository.h"
@@ -19,6 +20,7 @@
 #include "refspec.h"
 #include "fetchhead.h"
 #include "push.h"
+#include "profile.h"
 
 #define CONFIG_URL_FMT "remote.%s.url"
 #define CONFIG_PUSHURL_FMT "remote.%s.pushurl"
@@ -868,6 +870,7 @@ int git_remote_download(git_remote *remote, const git_strarray *refspecs, const
 	const git_remote_callbacks *cbs = NULL;
 	const git_strarray *custom_headers = NULL;
 	const git_proxy_options *proxy = NULL;
+	git_profile_frame region;
 
 	assert(remote);
 
@@ -926,10 +929,18 @@ int git_remote_download(git_remote *remote, const git_strarray *refspecs, const
 		remote->push = NULL;
 	}
 
-	if ((error = git_fetch_negotiate(remote, opts)) < 0)
+	git_profile_enter(&region, "fetch.negotiate");
+	error = git_fetch_negotiate(remote, opts);
+	git_profile_leave(&region, remote->refs.length);
+
+	if (error < 0)
 		return error;
 
-	return git_fetch_download_pack(remote, cbs);
+	git_profile_enter(&region, "fetch.download");
+	error = git_fetch_download_pack(remote, cbs);
+	git_profile_leave(&region, remote->stats.received_objects);
+
+	return error;
 
 on_error:
 	git_vector_free(&refs);
@@ -938,7 +949,7 @@ on_error:
 	return error;
 }
 
-int git_remote_fetch(
+static int remote_fetch(
 		git_remote *remote,
 		const git_strarray *refspecs,
 		const git_fetch_options *opts,
@@ -1004,6 +1015,22 @@ int git_remote_fetch(
 	return error;
 }
 
+int git_remote_fetch(
+		git_remote *remote,
+		const git_strarray *refspecs,
+		const git_fetch_options *opts,
+		const char *reflog_message)
+{
+	git_profile_frame region;
+	int error;
+
+	git_profile_enter(&region, "fetch");
+	error = remote_fetch(remote, refspecs, opts, reflog_message);
+	git_profile_leave(&region, remote->stats.received_objects);
+
+	return error;
+}
+
 static int remote_head_for_fetchspec_src(git_remote_head **out, git_vector *update_heads, const char *fetchspec_src)
 {
 	unsigned int i;
@@ -1195,11 +1222,202 @@ static int find_head(const void *_a, const void *_b)
 	return strcmp(a->name, b->name);
 }
 
+typedef enum {
+	TIP_UPDATE, /* whatever the reference is */
+	TIP_CREATE, /* unless the reference exists */
+	TIP_MATCHING, /* unless the reference has changed since */
+	TIP_DELETE,
+} tip_update_t;
+
+typedef struct {
+	char *name;
+	tip_update_t type;
+	git_oid old_id;
+	git_oid new_id;
+	unsigned int skip :1;
+} tip_update;
+
+static int tip_update_cmp(const void *_a, const void *_b)
+{
+	const tip_update *a = _a, *b = _b;
+
+	return strcmp(a->name, b->name);
+}
+
+static void tip_update_free(tip_update *update)
+{
+	if (!update)
+		return;
+
+	git__free(update->name);
+	git__free(update);
+}
+
+static int add_tip_update(
+	git_vector *updates,
+	const char *name,
+	tip_update_t type,
+	const git_oid *old_id,
+	const git_oid *new_id)
+{
+	tip_update *update;
+
+	update = git__calloc(1, sizeof(tip_update));
+	GITERR_CHECK_ALLOC(update);
+
+	update->name = git__strdup(name);
+	update->type = type;
+	git_oid_cpy(&update->old_id, old_id);
+	if (new_id)
+		git_oid_cpy(&update->new_id, new_id);
+
+	if (!update->name || git_vector_insert(updates, update) < 0) {
+		tip_update_free(update);
+		return -1;
+	}
+
+	return 0;
+}
+
+static void free_tip_updates(git_vector *updates)
+{
+	tip_update *update;
+	size_t i;
+
+	git_vector_foreach(updates, i, update)
+		tip_update_free(update);
+
+	git_vector_free(updates);
+}
+
+/* Now that the reference is locked, see whether it is still what we expect */
+static int check_tip_update(tip_update *update, git_repository *repo)
+{
+	git_reference *ref;
+	git_oid current;
+	int error;
+
+	if (update->type == TIP_DELETE) {
+		/* as we want it gone, it being gone already is fine */
+		if ((error = git_reference_lookup(&ref, repo, update->name)) == 0) {
+			update->skip = (git_reference_type(ref) == GIT_REF_SYMBOLIC);
+			if (!update->skip)
+				git_oid_cpy(&update->old_id, git_reference_target(ref));
+			git_reference_free(ref);
+		} else if (error == GIT_ENOTFOUND) {
+			update->skip = 1;
+			error = 0;
+		}
+
+		giterr_clear();
+		return error;
+	}
+
+	error = git_reference_name_to_id(&current, repo, update->name);
+	if (error < 0 && error != GIT_ENOTFOUND)
+		return error;
+
+	if (update->type == TIP_CREATE && !error) {
+		update->skip = 1;
+	} else if (update->type == TIP_MATCHING && !git_oid_iszero(&update->old_id) &&
+		(error || git_oid_cmp(&current, &update->old_id))) {
+		giterr_set(GITERR_REFERENCE, "old reference value does not match");
+		return GIT_EMODIFIED;
+	}
+
+	giterr_clear();
+	return 0;
+}
+
+/*
+ * Update the references in one transaction, so the refdb can write
+ * them together, and tell the callbacks about them once they are
+ * written. The references are locked in the order of their names;
+ * when one is updated more than once, the last update is the one
+ * which counts.
+ */
+static int apply_tip_updates(
+	git_remote *remote,
+	const git_remote_callbacks *callbacks,
+	git_vector *updates,
+	const char *log_message)
+{
+	git_transaction *tx = NULL;
+	tip_update *update;
+	size_t i, j;
+	int error;
+
+	if (!updates->length)
+		return 0;
+
+	git_vector_set_cmp(updates, tip_update_cmp);
+	git_vector_sort(updates);
+
+	for (i = j = 0; i < updates->length; i++) {
+		update = git_vector_get(updates, i);
+
+		if (j && !tip_update_cmp(updates->contents[j - 1], update))
+			tip_update_free(updates->contents[--j]);
+
+		updates->contents[j++] = update;
+	}
+	updates->length = j;
+
+	if ((error = git_transaction_new(&tx, remote->repo)) < 0)
+		return error;
+
+	git_vector_foreach(updates, i, update) {
+		if ((error = git_transaction_lock_ref(tx, update->name)) < 0)
+			goto cleanup;
+	}
+
+	git_vector_foreach(updates, i, update) {
+		if ((error = check_tip_update(update, remote->repo)) < 0)
+			goto cleanup;
+
+		if (update->skip)
+			continue;
+
+		if (update->type == TIP_DELETE)
+			error = git_transaction_remove(tx, update->name);
+		else
+			error = git_transaction_set_target(tx, update->name,
+				&update->new_id, NULL, log_message);
+
+		if (error < 0)
+			goto cleanup;
+	}
+
+	if ((error = git_transaction_commit(tx)) < 0)
+		goto cleanup;
+
+	git_vector_foreach(updates, i, update) {
+		if (update->skip)
+			continue;
+
+		if (update->type == TIP_DELETE &&
+			(error = git_reflog_delete(remote->repo, update->name)) < 0)
+			goto cleanup;
+
+		if (callbacks && callbacks->update_tips &&
+			(error = callbacks->update_tips(update->name,
+				&update->old_id, &update->new_id, callbacks->payload)) < 0)
+			goto cleanup;
+	}
+
+	error = 0;
+
+cleanup:
+	git_transaction_free(tx);
+	return error;
+}
+
 int git_remote_prune(git_remote *remote, const git_remote_callbacks *callbacks)
 {
 	size_t i, j;
 	git_vector remote_refs = GIT_VECTOR_INIT;
 	git_vector candidates = GIT_VECTOR_INIT;
+	git_vector deletions = GIT_VECTOR_INIT;
 	const git_refspec *spec;
 	const char *refname;
 	int error;
@@ -1259,39 +1477,17 @@ int git_remote_prune(git_remote *remote, const git_remote_callbacks *callbacks)
 	 * not want to remove them.
 	 */
 	git_vector_foreach(&candidates, i, refname) {
-		git_reference *ref;
-		git_oid id;
-
 		if (refname == NULL)
 			continue;
 
-		error = git_reference_lookup(&ref, remote->repo, refname);
-		/* as we want it gone, let's not consider this an error */
-		if (error == GIT_ENOTFOUND)
-			continue;
-
-		if (error < 0)
-			goto cleanup;
-
-		if (git_reference_type(ref) == GIT_REF_SYMBOLIC) {
-			git_reference_free(ref);
-			continue;
-		}
-
-		git_oid_cpy(&id, git_reference_target(ref));
-		error = git_reference_delete(ref);
-		git_reference_free(ref);
-		if (error < 0)
-			goto cleanup;
-
-		if (callbacks && callbacks->update_tips)
-			error = callbacks->update_tips(refname, &id, &zero_id, callbacks->payload);
-
-		if (error < 0)
+		if ((error = add_tip_update(&deletions, refname, TIP_DELETE, &zero_id, NULL)) < 0)
 			goto cleanup;
 	}
 
+	error = apply_tip_updates(remote, callbacks, &deletions, NULL);
+
 cleanup:
+	free_tip_updates(&deletions);
 	git_vector_free(&remote_refs);
 	git_vector_free_deep(&candidates);
 	return error;
@@ -1299,12 +1495,11 @@ cleanup:
 
 static int update_tips_for_spec(
 		git_remote *remote,
-		const git_remote_callbacks *callbacks,
+		git_vector *updates,
 		int update_fetchhead,
 		git_remote_autotag_option_t tagopt,
 		git_refspec *spec,
-		git_vector *refs,
-		const char *log_message)
+		git_vector *refs)
 {
 	int error = 0, autotag;
 	unsigned int i = 0;
@@ -1312,7 +1507,6 @@ static int update_tips_for_spec(
 	git_oid old;
 	git_odb *odb;
 	git_remote_head *head;
-	git_reference *ref;
 	git_refspec tagspec;
 	git_vector update_heads;
 
@@ -1394,21 +1588,9 @@ static int update_tips_for_spec(
 			continue;
 
 		/* In autotag mode, don't overwrite any locally-existing tags */
-		error = git_reference_create(&ref, remote->repo, refname.ptr, &head->oid, !autotag, 
-				log_message);
-
-		if (error == GIT_EEXISTS)
-			continue;
-
-		if (error < 0)
+		if (add_tip_update(updates, refname.ptr,
+				autotag ? TIP_CREATE : TIP_UPDATE, &old, &head->oid) < 0)
 			goto on_error;
-
-		git_reference_free(ref);
-
-		if (callbacks && callbacks->update_tips != NULL) {
-			if (callbacks->update_tips(refname.ptr, &old, &head->oid, callbacks->payload) < 0)
-				goto on_error;
-		}
 	}
 
 	if (update_fetchhead &&
@@ -1485,13 +1667,11 @@ static int next_head(const git_remote *remote, git_vector *refs,
 	return GIT_ITEROVER;
 }
 
-static int opportunistic_updates(const git_remote *remote, const git_remote_callbacks *callbacks,
-				 git_vector *refs, const char *msg)
+static int opportunistic_updates(const git_remote *remote, git_vector *updates, git_vector *refs)
 {
 	size_t i, j, k;
 	git_refspec *spec;
 	git_remote_head *head;
-	git_reference *ref;
 	git_buf refname = GIT_BUF_INIT;
 	int error = 0;
 
@@ -1519,18 +1699,8 @@ static int opportunistic_updates(const git_remote *remote, const git_remote_call
 			continue;
 
 		/* If we did find a current reference, make sure we haven't lost a race */
-		if (error)
-			error = git_reference_create(&ref, remote->repo, refname.ptr, &head->oid, true, msg);
-		else
-			error = git_reference_create_matching(&ref, remote->repo, refname.ptr, &head->oid, true, &old, msg);
-		git_reference_free(ref);
-		if (error < 0)
+		if ((error = add_tip_update(updates, refname.ptr, TIP_MATCHING, &old, &head->oid)) < 0)
 			goto cleanup;
-
-		if (callbacks && callbacks->update_tips != NULL) {
-			if (callbacks->update_tips(refname.ptr, &old, &head->oid, callbacks->payload) < 0)
-				goto cleanup;
-		}
 	}
 
 	if (error == GIT_ITEROVER)
@@ -1541,6 +1711,10 @@ cleanup:
 	return error;
 }
 
+/*
+ * The references are updated together once we know all of them, so a
+ * fetch which changes many of them writes them out at once.
+ */
 int git_remote_update_tips(
 		git_remote *remote,
 		const git_remote_callbacks *callbacks,
@@ -1550,6 +1724,7 @@ int git_remote_update_tips(
 {
 	git_refspec *spec, tagspec;
 	git_vector refs = GIT_VECTOR_INIT;
+	git_vector updates = GIT_VECTOR_INIT;
 	git_remote_autotag_option_t tagopt;
 	int error;
 	size_t i;
@@ -1572,7 +1747,7 @@ int git_remote_update_tips(
 		tagopt = download_tags;
 
 	if (tagopt == GIT_REMOTE_DOWNLOAD_TAGS_ALL) {
-		if ((error = update_tips_for_spec(remote, callbacks, update_fetchhead, tagopt, &tagspec, &refs, reflog_message)) < 0)
+		if ((error = update_tips_for_spec(remote, &updates, update_fetchhead, tagopt, &tagspec, &refs)) < 0)
 			goto out;
 	}
 
@@ -1580,15 +1755,19 @@ int git_remote_update_tips(
 		if (spec->push)
 			continue;
 
-		if ((error = update_tips_for_spec(remote, callbacks, update_fetchhead, tagopt, spec, &refs, reflog_message)) < 0)
+		if ((error = update_tips_for_spec(remote, &updates, update_fetchhead, tagopt, spec, &refs)) < 0)
 			goto out;
 	}
 
 	/* only try to do opportunisitic updates if the refpec lists differ */
-	if (remote->passed_refspecs)
-		error = opportunistic_updates(remote, callbacks, &refs, reflog_message);
+	if (remote->passed_refspecs &&
+	    (error = opportunistic_updates(remote, &updates, &refs)) < 0)
+		goto out;
+
+	error = apply_tip_updates(remote, callbacks, &updates, reflog_message);
 
 out:
+	free_tip_updates(&updates);
 	git_vector_free(&refs);
 	git_refspec__free(&tagspec);
 	return error;
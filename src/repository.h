@@ -15,6 +15,7 @@
 #include "git2/repository.h"
 #include "git2/object.h"
 #include "git2/config.h"
+#include "git2/sys/fsmonitor.h"
 
 #include "array.h"
 #include "cache.h"
@@ -51,6 +52,7 @@ typedef enum {
 	GIT_CVAR_PROTECTHFS,    /* core.protectHFS */
 	GIT_CVAR_PROTECTNTFS,   /* core.protectNTFS */
 	GIT_CVAR_FSYNCOBJECTFILES, /* core.fsyncObjectFiles */
+	GIT_CVAR_UNTRACKEDCACHE, /* core.untrackedCache */
 	GIT_CVAR_CACHE_MAX
 } git_cvar_cached;
 
@@ -113,6 +115,11 @@ typedef enum {
 	GIT_PROTECTNTFS_DEFAULT = GIT_CVAR_FALSE,
 	/* core.fsyncObjectFiles */
 	GIT_FSYNCOBJECTFILES_DEFAULT = GIT_CVAR_FALSE,
+	/* core.untrackedCache: false, true, 'keep' */
+	GIT_UNTRACKEDCACHE_FALSE = 0,
+	GIT_UNTRACKEDCACHE_TRUE = 1,
+	GIT_UNTRACKEDCACHE_KEEP = 2,
+	GIT_UNTRACKEDCACHE_DEFAULT = GIT_UNTRACKEDCACHE_KEEP,
 } git_cvar_value;
 
 /* internal repository init flags */
@@ -132,6 +139,7 @@ struct git_repository {
 	git_cache objects;
 	git_attr_cache *attrcache;
 	git_diff_driver_registry *diff_drivers;
+	git_fsmonitor *fsmonitor;
 
 	char *gitlink;
 	char *gitdir;
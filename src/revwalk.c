@@ -14,6 +14,72 @@
 #include "git2/revparse.h"
 #include "merge.h"
 #include "vector.h"
+#include "profile.h"
+
+/*
+ * The lists the walk keeps for itself come and go with every commit it
+ * looks at, so their cells are taken from the walk's pool and recycled
+ * rather than allocated one at a time.
+ */
+static git_commit_list *walk_list_insert(
+	git_revwalk *walk, git_commit_list_node *item, git_commit_list **list_p)
+{
+	git_commit_list *new_list = walk->free_list;
+
+	if (new_list != NULL)
+		walk->free_list = new_list->next;
+	else if ((new_list = git_pool_malloc(&walk->list_pool, 1)) == NULL)
+		return NULL;
+
+	new_list->item = item;
+	new_list->next = *list_p;
+	*list_p = new_list;
+	return new_list;
+}
+
+static git_commit_list *walk_list_insert_by_date(
+	git_revwalk *walk, git_commit_list_node *item, git_commit_list **list_p)
+{
+	git_commit_list **pp = list_p;
+	git_commit_list *p;
+
+	while ((p = *pp) != NULL) {
+		if (git_commit_list_time_cmp(p->item, item) > 0)
+			break;
+
+		pp = &p->next;
+	}
+
+	return walk_list_insert(walk, item, pp);
+}
+
+static git_commit_list_node *walk_list_pop(git_revwalk *walk, git_commit_list **stack)
+{
+	git_commit_list *top = *stack;
+
+	if (top == NULL)
+		return NULL;
+
+	*stack = top->next;
+	top->next = walk->free_list;
+	walk->free_list = top;
+	return top->item;
+}
+
+static void walk_list_free(git_revwalk *walk, git_commit_list **list_p)
+{
+	git_commit_list *last = *list_p;
+
+	if (last == NULL)
+		return;
+
+	while (last->next)
+		last = last->next;
+
+	last->next = walk->free_list;
+	walk->free_list = *list_p;
+	*list_p = NULL;
+}
 
 git_commit_list_node *git_revwalk__commit_lookup(
 	git_revwalk *walk, const git_oid *oid)
@@ -46,7 +112,6 @@ static int push_commit(git_revwalk *walk, const git_oid *oid, int uninteresting,
 	int error;
 	git_object *obj, *oobj;
 	git_commit_list_node *commit;
-	git_commit_list *list;
 
 	if ((error = git_object_lookup(&oobj, walk->repo, oid, GIT_OBJ_ANY)) < 0)
 		return error;
@@ -82,14 +147,11 @@ static int push_commit(git_revwalk *walk, const git_oid *oid, int uninteresting,
 		walk->did_push = 1;
 
 	commit->uninteresting = uninteresting;
-	list = walk->user_input;
-	if (git_commit_list_insert(commit, &list) == NULL) {
+	if (walk_list_insert(walk, commit, &walk->user_input) == NULL) {
 		giterr_set_oom();
 		return -1;
 	}
 
-	walk->user_input = list;
-
 	return 0;
 }
 
@@ -224,7 +286,7 @@ static int revwalk_enqueue_timesort(git_revwalk *walk, git_commit_list_node *com
 
 static int revwalk_enqueue_unsorted(git_revwalk *walk, git_commit_list_node *commit)
 {
-	return git_commit_list_insert(commit, &walk->iterator_rand) ? 0 : -1;
+	return walk_list_insert(walk, commit, &walk->iterator_rand) ? 0 : -1;
 }
 
 static int revwalk_next_timesort(git_commit_list_node **object_out, git_revwalk *walk)
@@ -247,7 +309,7 @@ static int revwalk_next_unsorted(git_commit_list_node **object_out, git_revwalk
 {
 	git_commit_list_node *next;
 
-	while ((next = git_commit_list_pop(&walk->iterator_rand)) != NULL) {
+	while ((next = walk_list_pop(walk, &walk->iterator_rand)) != NULL) {
 		/* Some commits might become uninteresting after being added to the list */
 		if (!next->uninteresting) {
 			*object_out = next;
@@ -263,7 +325,7 @@ static int revwalk_next_toposort(git_commit_list_node **object_out, git_revwalk
 {
 	git_commit_list_node *next;
 
-	while ((next = git_commit_list_pop(&walk->iterator_topo)) != NULL) {
+	while ((next = walk_list_pop(walk, &walk->iterator_topo)) != NULL) {
 		/* Some commits might become uninteresting after being added to the list */
 		if (!next->uninteresting) {
 			*object_out = next;
@@ -277,21 +339,21 @@ static int revwalk_next_toposort(git_commit_list_node **object_out, git_revwalk
 
 static int revwalk_next_reverse(git_commit_list_node **object_out, git_revwalk *walk)
 {
-	*object_out = git_commit_list_pop(&walk->iterator_reverse);
+	*object_out = walk_list_pop(walk, &walk->iterator_reverse);
 	return *object_out ? 0 : GIT_ITEROVER;
 }
 
-static void mark_parents_uninteresting(git_commit_list_node *commit)
+static void mark_parents_uninteresting(git_revwalk *walk, git_commit_list_node *commit)
 {
 	unsigned short i;
 	git_commit_list *parents = NULL;
 
 	for (i = 0; i < commit->out_degree; i++)
-		git_commit_list_insert(commit->parents[i], &parents);
+		walk_list_insert(walk, commit->parents[i], &parents);
 
 
 	while (parents) {
-		commit = git_commit_list_pop(&parents);
+		commit = walk_list_pop(walk, &parents);
 
 		while (commit) {
 			if (commit->uninteresting)
@@ -307,7 +369,7 @@ static void mark_parents_uninteresting(git_commit_list_node *commit)
 				break;
 
 			for (i = 0; i < commit->out_degree; i++)
-				git_commit_list_insert(commit->parents[i], &parents);
+				walk_list_insert(walk, commit->parents[i], &parents);
 			commit = commit->parents[0];
 		}
 	}
@@ -341,10 +403,10 @@ static int add_parents_to_list(git_revwalk *walk, git_commit_list_node *commit,
 				return error;
 
 			if (p->parents)
-				mark_parents_uninteresting(p);
+				mark_parents_uninteresting(walk, p);
 
 			p->seen = 1;
-			git_commit_list_insert_by_date(p, list);
+			walk_list_insert_by_date(walk, p, list);
 		}
 
 		return 0;
@@ -366,7 +428,7 @@ static int add_parents_to_list(git_revwalk *walk, git_commit_list_node *commit,
 
 		if (!p->seen) {
 			p->seen = 1;
-			git_commit_list_insert_by_date(p, list);
+			walk_list_insert_by_date(walk, p, list);
 		}
 
 		if (walk->first_parent)
@@ -422,13 +484,13 @@ static int limit_list(git_commit_list **out, git_revwalk *walk, git_commit_list
 	git_commit_list **p = &newlist;
 
 	while (list) {
-		git_commit_list_node *commit = git_commit_list_pop(&list);
+		git_commit_list_node *commit = walk_list_pop(walk, &list);
 
 		if ((error = add_parents_to_list(walk, commit, &list)) < 0)
 			return error;
 
 		if (commit->uninteresting) {
-			mark_parents_uninteresting(commit);
+			mark_parents_uninteresting(walk, commit);
 
 			slop = still_interesting(list, time, slop);
 			if (slop)
@@ -441,10 +503,10 @@ static int limit_list(git_commit_list **out, git_revwalk *walk, git_commit_list
 				continue;
 
 		time = commit->time;
-		p = &git_commit_list_insert(commit, p)->next;
+		p = &walk_list_insert(walk, commit, p)->next;
 	}
 
-	git_commit_list_free(&list);
+	walk_list_free(walk, &list);
 	*out = newlist;
 	return 0;
 }
@@ -524,7 +586,7 @@ static int sort_in_topological_order(git_commit_list **out, git_revwalk *walk, g
 		/* All the children of 'item' have been emitted (since we got to it via the priority queue) */
 		next->in_degree = 0;
 
-		pptr = &git_commit_list_insert(next, pptr)->next;
+		pptr = &walk_list_insert(walk, next, pptr)->next;
 	}
 
 	*out = newlist;
@@ -535,7 +597,7 @@ cleanup:
 	return error;
 }
 
-static int prepare_walk(git_revwalk *walk)
+static int prepare_walk_1(git_revwalk *walk)
 {
 	int error;
 	git_commit_list *list, *commits = NULL;
@@ -553,11 +615,11 @@ static int prepare_walk(git_revwalk *walk)
 			return error;
 
 		if (commit->uninteresting)
-			mark_parents_uninteresting(commit);
+			mark_parents_uninteresting(walk, commit);
 
 		if (!commit->seen) {
 			commit->seen = 1;
-			git_commit_list_insert(commit, &commits);
+			walk_list_insert(walk, commit, &commits);
 		}
 	}
 
@@ -566,7 +628,7 @@ static int prepare_walk(git_revwalk *walk)
 
 	if (walk->sorting & GIT_SORT_TOPOLOGICAL) {
 		error = sort_in_topological_order(&walk->iterator_topo, walk, commits);
-		git_commit_list_free(&commits);
+		walk_list_free(walk, &commits);
 
 		if (error < 0)
 			return error;
@@ -576,7 +638,7 @@ static int prepare_walk(git_revwalk *walk)
 		for (list = commits; list && !error; list = list->next)
 			error = walk->enqueue(walk, list->item);
 
-		git_commit_list_free(&commits);
+		walk_list_free(walk, &commits);
 
 		if (error < 0)
 			return error;
@@ -588,7 +650,7 @@ static int prepare_walk(git_revwalk *walk)
 	if (walk->sorting & GIT_SORT_REVERSE) {
 
 		while ((error = walk->get_next(&next, walk)) == 0)
-			if (git_commit_list_insert(next, &walk->iterator_reverse) == NULL)
+			if (walk_list_insert(walk, next, &walk->iterator_reverse) == NULL)
 				return -1;
 
 		if (error != GIT_ITEROVER)
@@ -601,6 +663,18 @@ static int prepare_walk(git_revwalk *walk)
 	return 0;
 }
 
+static int prepare_walk(git_revwalk *walk)
+{
+	git_profile_frame region;
+	int error;
+
+	git_profile_enter(&region, "revwalk.prepare");
+	error = prepare_walk_1(walk);
+	git_profile_leave(&region, git_oidmap_size(walk->commits));
+
+	return error;
+}
+
 
 int git_revwalk_new(git_revwalk **revwalk_out, git_repository *repo)
 {
@@ -614,6 +688,7 @@ int git_revwalk_new(git_revwalk **revwalk_out, git_repository *repo)
 		return -1;
 
 	git_pool_init(&walk->commit_pool, COMMIT_ALLOC);
+	git_pool_init(&walk->list_pool, sizeof(git_commit_list));
 	walk->get_next = &revwalk_next_unsorted;
 	walk->enqueue = &revwalk_enqueue_unsorted;
 
@@ -624,6 +699,10 @@ int git_revwalk_new(git_revwalk **revwalk_out, git_repository *repo)
 		return -1;
 	}
 
+	/* the commit-graph is only an accelerator; walk without it on error */
+	if (git_odb__get_commit_graph(&walk->commit_graph, walk->odb) < 0)
+		giterr_clear();
+
 	*revwalk_out = walk;
 	return 0;
 }
@@ -634,10 +713,12 @@ void git_revwalk_free(git_revwalk *walk)
 		return;
 
 	git_revwalk_reset(walk);
+	git_commit_graph_free(walk->commit_graph);
 	git_odb_free(walk->odb);
 
 	git_oidmap_free(walk->commits);
 	git_pool_clear(&walk->commit_pool);
+	git_pool_clear(&walk->list_pool);
 	git_pqueue_free(&walk->iterator_time);
 	git__free(walk);
 }
@@ -713,10 +794,10 @@ void git_revwalk_reset(git_revwalk *walk)
 		});
 
 	git_pqueue_clear(&walk->iterator_time);
-	git_commit_list_free(&walk->iterator_topo);
-	git_commit_list_free(&walk->iterator_rand);
-	git_commit_list_free(&walk->iterator_reverse);
-	git_commit_list_free(&walk->user_input);
+	walk_list_free(walk, &walk->iterator_topo);
+	walk_list_free(walk, &walk->iterator_rand);
+	walk_list_free(walk, &walk->iterator_reverse);
+	walk_list_free(walk, &walk->user_input);
 	walk->first_parent = 0;
 	walk->walking = 0;
 	walk->did_push = walk->did_hide = 0;
@@ -15,16 +15,22 @@
 #include "pqueue.h"
 #include "pool.h"
 #include "vector.h"
+#include "commit_graph.h"
 
 #include "oidmap.h"
 
 struct git_revwalk {
 	git_repository *repo;
 	git_odb *odb;
+	git_commit_graph_file *commit_graph;
 
 	git_oidmap *commits;
 	git_pool commit_pool;
 
+	/* cells of the lists below; popped cells go back on the free list */
+	git_pool list_pool;
+	git_commit_list *free_list;
+
 	git_commit_list *iterator_topo;
 	git_commit_list *iterator_rand;
 	git_commit_list *iterator_reverse;
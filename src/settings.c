@@ -17,7 +17,14 @@
 #include "global.h"
 #include "object.h"
 #include "odb.h"
+#include "odb_prefetch.h"
 #include "refs.h"
+#include "indexer.h"
+#include "index.h"
+#include "iterator.h"
+#include "mwindow.h"
+#include "pack.h"
+#include "zstream.h"
 #include "transports/smart.h"
 
 void git_libgit2_version(int *major, int *minor, int *rev)
@@ -48,6 +55,7 @@ int git_libgit2_features(void)
 /* Declarations for tuneable settings */
 extern size_t git_mwindow__window_size;
 extern size_t git_mwindow__mapped_limit;
+extern bool git_refdb_fs__mmap_packed;
 
 static int config_level_to_sysdir(int config_level)
 {
@@ -87,6 +95,29 @@ const char *git_libgit2__ssl_ciphers(void)
 	return git__ssl_ciphers;
 }
 
+int git_stats_init(git_stats *stats, unsigned int version)
+{
+	GIT_INIT_STRUCTURE_FROM_TEMPLATE(
+		stats, version, git_stats, GIT_STATS_INIT);
+	return 0;
+}
+
+static int get_stats(git_stats *stats)
+{
+	GITERR_CHECK_VERSION(stats, GIT_STATS_VERSION, "git_stats");
+
+	git_cache_stats(
+		&stats->cache_hits, &stats->cache_misses, &stats->cache_evictions);
+	stats->cache_memory = (size_t)git_cache__current_storage.val;
+
+	stats->pack_cache_hits = (size_t)git_pack__cache_hits.val;
+	stats->pack_cache_misses = (size_t)git_pack__cache_misses.val;
+
+	stats->inflated_bytes = (size_t)git_zstream__inflated.val;
+
+	return git_mwindow_stats(stats);
+}
+
 int git_libgit2_opts(int key, ...)
 {
 	int error = 0;
@@ -249,6 +280,99 @@ int git_libgit2_opts(int key, ...)
 		git_odb__strict_hash_verification = (va_arg(ap, int) != 0);
 		break;
 
+	case GIT_OPT_GET_INDEXER_THREADS:
+		*(va_arg(ap, unsigned int *)) = git_indexer__default_threads;
+		break;
+
+	case GIT_OPT_SET_INDEXER_THREADS:
+#ifdef GIT_THREADS
+		git_indexer__default_threads = va_arg(ap, unsigned int);
+#else
+		if (va_arg(ap, unsigned int) != 1) {
+			giterr_set(GITERR_INVALID, "cannot set indexer threads: threading is not enabled");
+			error = -1;
+		}
+#endif
+		break;
+
+	case GIT_OPT_GET_INDEX_THREADS:
+		*(va_arg(ap, unsigned int *)) = git_index__default_threads;
+		break;
+
+	case GIT_OPT_SET_INDEX_THREADS:
+#ifdef GIT_THREADS
+		git_index__default_threads = va_arg(ap, unsigned int);
+#else
+		if (va_arg(ap, unsigned int) != 1) {
+			giterr_set(GITERR_INVALID, "cannot set index threads: threading is not enabled");
+			error = -1;
+		}
+#endif
+		break;
+
+	case GIT_OPT_GET_WORKDIR_STAT_THREADS:
+		*(va_arg(ap, unsigned int *)) = git_iterator__stat_threads;
+		break;
+
+	case GIT_OPT_SET_WORKDIR_STAT_THREADS:
+#ifdef GIT_THREADS
+		git_iterator__stat_threads = va_arg(ap, unsigned int);
+#else
+		if (va_arg(ap, unsigned int) != 1) {
+			giterr_set(GITERR_INVALID, "cannot set workdir stat threads: threading is not enabled");
+			error = -1;
+		}
+#endif
+		break;
+
+	case GIT_OPT_GET_PACK_CACHE_MAX_SIZE:
+		*(va_arg(ap, size_t *)) = git_pack__cache_memory_limit;
+		break;
+
+	case GIT_OPT_SET_PACK_CACHE_MAX_SIZE:
+		git_pack__cache_memory_limit = va_arg(ap, size_t);
+		break;
+
+	case GIT_OPT_GET_CACHE_STATS:
+		{
+			size_t *hits = va_arg(ap, size_t *);
+			size_t *misses = va_arg(ap, size_t *);
+			size_t *evictions = va_arg(ap, size_t *);
+
+			git_cache_stats(hits, misses, evictions);
+		}
+		break;
+
+	case GIT_OPT_GET_STATS:
+		error = get_stats(va_arg(ap, git_stats *));
+		break;
+
+	case GIT_OPT_ENABLE_ODB_PREFETCH:
+#ifdef GIT_THREADS
+		git_odb__prefetch_enabled = (va_arg(ap, int) != 0);
+#else
+		if (va_arg(ap, int) != 0) {
+			giterr_set(GITERR_INVALID, "cannot enable prefetching: threading is not enabled");
+			error = -1;
+		}
+#endif
+		break;
+
+	case GIT_OPT_ENABLE_MWINDOW_WHOLE_PACK:
+#ifdef GIT_ARCH_64
+		git_mwindow__whole_pack = (va_arg(ap, int) != 0);
+#else
+		if (va_arg(ap, int) != 0) {
+			giterr_set(GITERR_INVALID, "cannot map whole packfiles: the address space is too small");
+			error = -1;
+		}
+#endif
+		break;
+
+	case GIT_OPT_ENABLE_PACKED_REFS_MMAP:
+		git_refdb_fs__mmap_packed = (va_arg(ap, int) != 0);
+		break;
+
 	default:
 		giterr_set(GITERR_INVALID, "invalid option key");
 		error = -1;
@@ -20,6 +20,7 @@
 #include "git2/diff.h"
 #include "diff.h"
 #include "diff_generate.h"
+#include "profile.h"
 
 static unsigned int index_delta2status(const git_diff_delta *head2idx)
 {
@@ -173,7 +174,7 @@ static int status_collect(
 	if (!status_is_included(status, head2idx, idx2wd))
 		return 0;
 
-	status_entry = git__malloc(sizeof(git_status_entry));
+	status_entry = git_pool_malloc(&status->entries, 1);
 	GITERR_CHECK_ALLOC(status_entry);
 
 	status_entry->status = status_compute(status, head2idx, idx2wd);
@@ -232,6 +233,9 @@ static git_status_list *git_status_list_alloc(git_index *index)
 		return NULL;
 	}
 
+	/* the entries all live as long as the list, so free them together */
+	git_pool_init(&status->entries, sizeof(git_status_entry));
+
 	return status;
 }
 
@@ -271,6 +275,7 @@ int git_status_list_new(
 		opts ? opts->show : GIT_STATUS_SHOW_INDEX_AND_WORKDIR;
 	int error = 0;
 	unsigned int flags = opts ? opts->flags : GIT_STATUS_OPT_DEFAULTS;
+	git_profile_frame region = {0};
 
 	*out = NULL;
 
@@ -296,6 +301,8 @@ int git_status_list_new(
 	status = git_status_list_alloc(index);
 	GITERR_CHECK_ALLOC(status);
 
+	git_profile_enter(&region, "status");
+
 	if (opts) {
 		memcpy(&status->opts, opts, sizeof(git_status_options));
 		memcpy(&diffopt.pathspec, &opts->pathspec, sizeof(diffopt.pathspec));
@@ -369,8 +376,11 @@ int git_status_list_new(
 		  GIT_STATUS_OPT_SORT_CASE_INSENSITIVELY)) != 0)
 		git_vector_sort(&status->paired);
 
+	git_profile_leave(&region, status->paired.length);
+
 done:
 	if (error < 0) {
+		git_profile_leave(&region, 0);
 		git_status_list_free(status);
 		status = NULL;
 	}
@@ -405,7 +415,8 @@ void git_status_list_free(git_status_list *status)
 	git_diff_free(status->head2idx);
 	git_diff_free(status->idx2wd);
 
-	git_vector_free_deep(&status->paired);
+	git_vector_free(&status->paired);
+	git_pool_clear(&status->entries);
 
 	git__memzero(status, sizeof(*status));
 	git__free(status);
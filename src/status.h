@@ -10,6 +10,7 @@
 #include "common.h"
 
 #include "diff.h"
+#include "pool.h"
 #include "git2/status.h"
 #include "git2/diff.h"
 
@@ -20,6 +21,7 @@ struct git_status_list {
 	git_diff *idx2wd;
 
 	git_vector paired;
+	git_pool entries;
 };
 
 #endif
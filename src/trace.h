@@ -39,13 +39,28 @@ GIT_INLINE(void) git_trace__write_fmt(
 }
 
 #define git_trace_level()		(git_trace__data.level)
+#define git_trace_enabled(l)	(git_trace__data.level >= l && \
+								 git_trace__data.callback != NULL)
 #define git_trace(l, ...)		{ \
-									if (git_trace__data.level >= l && \
-										git_trace__data.callback != NULL) { \
+									if (git_trace_enabled(l)) { \
 										git_trace__write_fmt(l, __VA_ARGS__); \
 									} \
 								}
 
+/*
+ * To trace how long something took, take the time with
+ * `git_trace_start()` before doing it, then pass that to
+ * `git_trace_timed()`, which appends the milliseconds elapsed to the
+ * message.  Neither looks at the clock unless tracing at that level.
+ */
+#define git_trace_start(l)		(git_trace_enabled(l) ? git__timer() : 0.0)
+#define git_trace_timed(l, start, fmt, ...) { \
+									if ((start) > 0.0) { \
+										git_trace(l, fmt " (%.3f ms)", __VA_ARGS__, \
+											(git__timer() - (start)) * 1000); \
+									} \
+								}
+
 #else
 
 GIT_INLINE(void) git_trace__null(
@@ -56,8 +71,18 @@ GIT_INLINE(void) git_trace__null(
 	GIT_UNUSED(fmt);
 }
 
+/* The arguments are never evaluated, so they may be costly to compute */
 #define git_trace_level()		((void)0)
-#define git_trace			git_trace__null
+#define git_trace_enabled(l)	0
+#define git_trace(l, ...)		{ \
+									if (0) \
+										git_trace__null(l, __VA_ARGS__); \
+								}
+#define git_trace_start(l)		0.0
+#define git_trace_timed(l, start, ...) { \
+									if (0 && (start) > 0.0) \
+										git_trace__null(l, __VA_ARGS__); \
+								}
 
 #endif
 
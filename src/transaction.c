@@ -287,10 +287,16 @@ int git_transaction_set_reflog(git_transaction *tx, const char *refname, const g
 	return 0;
 }
 
-static int update_target(git_refdb *db, transaction_node *node)
+static int node_cmp(const void *a, const void *b)
+{
+	const transaction_node *node_a = a, *node_b = b;
+
+	return strcmp(node_a->name, node_b->name);
+}
+
+static int fill_update(git_refdb_update *update, transaction_node *node)
 {
 	git_reference *ref;
-	int error, update_reflog;
 
 	if (node->ref_type == GIT_REF_OID) {
 		ref = git_reference__alloc(node->name, &node->target.id, NULL);
@@ -301,27 +307,32 @@ static int update_target(git_refdb *db, transaction_node *node)
 	}
 
 	GITERR_CHECK_ALLOC(ref);
-	update_reflog = node->reflog == NULL;
+
+	update->payload = node->payload;
+	update->ref = ref;
 
 	if (node->remove) {
-		error =  git_refdb_unlock(db, node->payload, 2, false, ref, NULL, NULL);
-	} else if (node->ref_type == GIT_REF_OID) {
-		error = git_refdb_unlock(db, node->payload, true, update_reflog, ref, node->sig, node->message);
-	} else if (node->ref_type == GIT_REF_SYMBOLIC) {
-		error = git_refdb_unlock(db, node->payload, true, update_reflog, ref, node->sig, node->message);
+		update->success = 2;
 	} else {
-		abort();
+		update->success = true;
+		update->update_reflog = node->reflog == NULL;
+		update->sig = node->sig;
+		update->message = node->message;
 	}
 
-	git_reference_free(ref);
-	node->committed = true;
-
-	return error;
+	return 0;
 }
 
+/*
+ * The references are updated in the order of their names, and handed
+ * to the backend all at once, so that it can write them together.
+ */
 int git_transaction_commit(git_transaction *tx)
 {
 	transaction_node *node;
+	git_vector nodes = GIT_VECTOR_INIT;
+	git_refdb_update *updates = NULL;
+	size_t i, count = 0;
 	int error = 0;
 
 	assert(tx);
@@ -333,19 +344,54 @@ int git_transaction_commit(git_transaction *tx)
 		return error;
 	}
 
+	if ((error = git_vector_init(&nodes, git_strmap_num_entries(tx->locks), node_cmp)) < 0)
+		return error;
+
 	git_strmap_foreach_value(tx->locks, node, {
+		if ((error = git_vector_insert(&nodes, node)) < 0)
+			goto cleanup;
+	});
+
+	git_vector_sort(&nodes);
+
+	git_vector_foreach(&nodes, i, node) {
 		if (node->reflog) {
 			if ((error = tx->db->backend->reflog_write(tx->db->backend, node->reflog)) < 0)
-				return error;
+				goto cleanup;
 		}
+	}
 
-		if (node->ref_type != GIT_REF_INVALID) {
-			if ((error = update_target(tx->db, node)) < 0)
-				return error;
-		}
-	});
+	updates = git__calloc(nodes.length ? nodes.length : 1, sizeof(git_refdb_update));
+	if (!updates) {
+		error = -1;
+		goto cleanup;
+	}
 
-	return 0;
+	git_vector_foreach(&nodes, i, node) {
+		if (node->ref_type == GIT_REF_INVALID)
+			continue;
+
+		if ((error = fill_update(&updates[count], node)) < 0)
+			goto cleanup;
+
+		count++;
+	}
+
+	/* the backend unlocks all of them, whether they succeed or not */
+	git_vector_foreach(&nodes, i, node) {
+		if (node->ref_type != GIT_REF_INVALID)
+			node->committed = true;
+	}
+
+	error = git_refdb_unlock_many(tx->db, updates, count);
+
+cleanup:
+	for (i = 0; i < count; i++)
+		git_reference_free((git_reference *)updates[i].ref);
+
+	git__free(updates);
+	git_vector_free(&nodes);
+	return error;
 }
 
 void git_transaction_free(git_transaction *tx)
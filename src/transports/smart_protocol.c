@@ -17,6 +17,7 @@
 #include "pack-objects.h"
 #include "remote.h"
 #include "util.h"
+#include "trace.h"
 
 #define NETWORK_XFER_THRESHOLD (100*1024)
 /* The minimal interval between progress updates (in seconds). */
@@ -348,6 +349,7 @@ int git_smart__negotiate_fetch(git_transport *transport, git_repository *repo, c
 	int error = -1, pkt_type;
 	unsigned int i;
 	git_oid oid;
+	double start = git_trace_start(GIT_TRACE_DEBUG), round;
 
 	if ((error = git_pkt_buffer_wants(wants, count, &t->caps, &data)) < 0)
 		return error;
@@ -387,6 +389,8 @@ int git_smart__negotiate_fetch(git_transport *transport, git_repository *repo, c
 				goto on_error;
 			}
 
+			round = git_trace_start(GIT_TRACE_DEBUG);
+
 			if ((error = git_smart__negotiation_step(&t->parent, data.ptr, data.size)) < 0)
 				goto on_error;
 
@@ -394,9 +398,17 @@ int git_smart__negotiate_fetch(git_transport *transport, git_repository *repo, c
 			if (t->caps.multi_ack || t->caps.multi_ack_detailed) {
 				if ((error = store_common(t)) < 0)
 					goto on_error;
+
+				git_trace_timed(GIT_TRACE_DEBUG, round,
+					"fetch: negotiation round %u: %"PRIuZ" in common",
+					i / 20, t->common.length);
 			} else {
 				pkt_type = recv_pkt(NULL, buf);
 
+				git_trace_timed(GIT_TRACE_DEBUG, round,
+					"fetch: negotiation round %u: %s", i / 20,
+					pkt_type == GIT_PKT_ACK ? "ACK" : "no ACK");
+
 				if (pkt_type == GIT_PKT_ACK) {
 					break;
 				} else if (pkt_type == GIT_PKT_NAK) {
@@ -482,6 +494,9 @@ int git_smart__negotiate_fetch(git_transport *transport, git_repository *repo, c
 		error = wait_while_ack(buf);
 	}
 
+	git_trace_timed(GIT_TRACE_DEBUG, start,
+		"fetch: negotiated %"PRIuZ" wants with %u haves", count, i);
+
 	return error;
 
 on_error:
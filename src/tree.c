@@ -13,6 +13,7 @@
 #include "fileops.h"
 #include "tree-cache.h"
 #include "index.h"
+#include "odb_prefetch.h"
 
 #define DEFAULT_TREE_SIZE 16
 #define MAX_FILEMODE_BYTES 6
@@ -976,12 +977,15 @@ static int tree_walk(
 	git_treewalk_cb callback,
 	git_buf *path,
 	void *payload,
-	bool preorder)
+	bool preorder,
+	git_odb_prefetch *prefetch)
 {
 	int error = 0;
 	size_t i;
 	const git_tree_entry *entry;
 
+	git_odb_prefetch_subtrees(prefetch, tree);
+
 	git_array_foreach(tree->entries, i, entry) {
 		if (preorder) {
 			error = callback(path->ptr, entry, payload);
@@ -1010,7 +1014,7 @@ static int tree_walk(
 			if (git_buf_oom(path))
 				error = -1;
 			else
-				error = tree_walk(subtree, callback, path, payload, preorder);
+				error = tree_walk(subtree, callback, path, payload, preorder, prefetch);
 
 			git_tree_free(subtree);
 			if (error != 0)
@@ -1040,15 +1044,21 @@ int git_tree_walk(
 {
 	int error = 0;
 	git_buf root_path = GIT_BUF_INIT;
+	git_odb_prefetch *prefetch;
 
 	if (mode != GIT_TREEWALK_POST && mode != GIT_TREEWALK_PRE) {
 		giterr_set(GITERR_INVALID, "invalid walking mode for tree walk");
 		return -1;
 	}
 
+	if ((error = git_odb_prefetch_new(&prefetch, tree->object.repo)) < 0)
+		return error;
+
 	error = tree_walk(
-		tree, callback, &root_path, payload, (mode == GIT_TREEWALK_PRE));
+		tree, callback, &root_path, payload, (mode == GIT_TREEWALK_PRE),
+		prefetch);
 
+	git_odb_prefetch_free(prefetch);
 	git_buf_free(&root_path);
 
 	return error;
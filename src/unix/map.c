@@ -72,5 +72,29 @@ int p_munmap(git_map *map)
 	return 0;
 }
 
+int p_madvise(git_map *map, int advice)
+{
+	int posix_advice;
+
+	assert(map != NULL);
+
+	switch (advice) {
+	case GIT_MADV_RANDOM:
+		posix_advice = POSIX_MADV_RANDOM;
+		break;
+	case GIT_MADV_SEQUENTIAL:
+		posix_advice = POSIX_MADV_SEQUENTIAL;
+		break;
+	case GIT_MADV_WILLNEED:
+		posix_advice = POSIX_MADV_WILLNEED;
+		break;
+	default:
+		posix_advice = POSIX_MADV_NORMAL;
+		break;
+	}
+
+	return posix_madvise(map->data, map->len, posix_advice) ? -1 : 0;
+}
+
 #endif
 
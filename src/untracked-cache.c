@@ -0,0 +1,889 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "untracked-cache.h"
+
+#include "ewah.h"
+#include "index.h"
+#include "repository.h"
+#include "varint.h"
+
+#ifndef GIT_WIN32
+# include <sys/utsname.h>
+#endif
+
+#define UNTRACKED_STAT_SIZE (9 * sizeof(uint32_t))
+
+struct dir_key {
+	const char *name;
+	size_t len;
+};
+
+static int dir_cmp(const void *a, const void *b)
+{
+	const git_untracked_cache_dir *one = a, *two = b;
+	return strcmp(one->name, two->name);
+}
+
+static int dir_key_cmp(const void *key, const void *array_member)
+{
+	const struct dir_key *k = key;
+	const git_untracked_cache_dir *dir = array_member;
+	int cmp = strncmp(k->name, dir->name, k->len);
+
+	if (!cmp && dir->name[k->len] != '\0')
+		cmp = -1;
+
+	return cmp;
+}
+
+static git_untracked_cache_dir *dir_new(const char *name, size_t name_len)
+{
+	git_untracked_cache_dir *dir;
+	size_t alloc_len;
+
+	if (GIT_ADD_SIZET_OVERFLOW(&alloc_len, sizeof(git_untracked_cache_dir), name_len) ||
+		GIT_ADD_SIZET_OVERFLOW(&alloc_len, alloc_len, 1) ||
+		(dir = git__calloc(1, alloc_len)) == NULL)
+		return NULL;
+
+	if (git_vector_init(&dir->dirs, 0, dir_cmp) < 0) {
+		git__free(dir);
+		return NULL;
+	}
+
+	memcpy(dir->name, name, name_len);
+	dir->name[name_len] = '\0';
+
+	return dir;
+}
+
+static void dir_clear_untracked(git_untracked_cache_dir *dir)
+{
+	size_t i;
+	char *name;
+
+	git_vector_foreach(&dir->untracked, i, name)
+		git__free(name);
+
+	git_vector_free(&dir->untracked);
+}
+
+static void dir_free(git_untracked_cache_dir *dir)
+{
+	git_untracked_cache_dir *child;
+	size_t i;
+
+	if (!dir)
+		return;
+
+	git_vector_foreach(&dir->dirs, i, child)
+		dir_free(child);
+
+	git_vector_free(&dir->dirs);
+	dir_clear_untracked(dir);
+	git__free(dir);
+}
+
+static git_untracked_cache_dir *find_child(
+	git_untracked_cache_dir *dir, const char *name, size_t name_len)
+{
+	struct dir_key key;
+	size_t pos;
+
+	key.name = name;
+	key.len = name_len;
+
+	if (git_vector_bsearch2(&pos, &dir->dirs, dir_key_cmp, &key) < 0)
+		return NULL;
+
+	return git_vector_get(&dir->dirs, pos);
+}
+
+int git_untracked_cache_new(git_untracked_cache **out)
+{
+	git_untracked_cache *cache;
+
+	cache = git__calloc(1, sizeof(git_untracked_cache));
+	GITERR_CHECK_ALLOC(cache);
+
+	cache->dir_flags = GIT_UNTRACKED_CACHE_DIR_FLAGS;
+	cache->exclude_per_dir = git__strdup(GIT_IGNORE_FILE);
+
+	if (!cache->exclude_per_dir) {
+		git__free(cache);
+		return -1;
+	}
+
+	GIT_REFCOUNT_INC(cache);
+
+	*out = cache;
+	return 0;
+}
+
+static void untracked_cache_free(git_untracked_cache *cache)
+{
+	dir_free(cache->root);
+	git_buf_free(&cache->ident);
+	git__free(cache->exclude_per_dir);
+	git__free(cache);
+}
+
+void git_untracked_cache_free(git_untracked_cache *cache)
+{
+	if (cache == NULL)
+		return;
+
+	GIT_REFCOUNT_DEC(cache, untracked_cache_free);
+}
+
+void git_untracked_cache_clear(git_untracked_cache *cache)
+{
+	if (cache == NULL || cache->root == NULL)
+		return;
+
+	dir_free(cache->root);
+	cache->root = NULL;
+	cache->dirty = 1;
+}
+
+void git_untracked_cache_dir_invalidate(
+	git_untracked_cache *cache, git_untracked_cache_dir *dir, bool recursive)
+{
+	git_untracked_cache_dir *child;
+	size_t i;
+
+	if (dir->valid || dir->untracked.length) {
+		dir_clear_untracked(dir);
+		dir->valid = 0;
+		dir->check_only = 0;
+		cache->dirty = 1;
+	}
+
+	if (recursive) {
+		git_vector_foreach(&dir->dirs, i, child)
+			git_untracked_cache_dir_invalidate(cache, child, true);
+	}
+}
+
+void git_untracked_cache_invalidate_path(
+	git_untracked_cache *cache, const char *path)
+{
+	git_untracked_cache_dir *dir;
+	const char *end;
+
+	if (cache == NULL || (dir = cache->root) == NULL)
+		return;
+
+	while (dir != NULL) {
+		git_untracked_cache_dir_invalidate(cache, dir, false);
+
+		if ((end = strchr(path, '/')) == NULL)
+			break;
+
+		dir = find_child(dir, path, end - path);
+		path = end + 1;
+	}
+}
+
+git_untracked_cache_dir *git_untracked_cache_dir_lookup(
+	git_untracked_cache *cache, const char *path, size_t path_len)
+{
+	git_untracked_cache_dir *dir, *child;
+	const char *end;
+
+	if (cache->root == NULL && (cache->root = dir_new("", 0)) == NULL)
+		return NULL;
+
+	dir = cache->root;
+
+	while (path_len) {
+		end = memchr(path, '/', path_len);
+		assert(end);
+
+		if ((child = find_child(dir, path, end - path)) == NULL) {
+			if ((child = dir_new(path, end - path)) == NULL ||
+				git_vector_insert_sorted(&dir->dirs, child, NULL) < 0) {
+				dir_free(child);
+				return NULL;
+			}
+		}
+
+		path_len -= (end - path) + 1;
+		path = end + 1;
+		dir = child;
+	}
+
+	return dir;
+}
+
+void git_untracked_cache_stat_init(
+	git_untracked_cache_stat *out, const struct stat *st)
+{
+	out->ctime.seconds = (int32_t)st->st_ctime;
+	out->mtime.seconds = (int32_t)st->st_mtime;
+#if defined(GIT_USE_NSEC)
+	out->ctime.nanoseconds = st->st_ctime_nsec;
+	out->mtime.nanoseconds = st->st_mtime_nsec;
+#else
+	out->ctime.nanoseconds = 0;
+	out->mtime.nanoseconds = 0;
+#endif
+	out->dev = st->st_dev;
+	out->ino = st->st_ino;
+	out->uid = st->st_uid;
+	out->gid = st->st_gid;
+	out->file_size = (uint32_t)st->st_size;
+}
+
+bool git_untracked_cache_dir_is_valid(
+	const git_untracked_cache_dir *dir,
+	const git_untracked_cache_stat *st,
+	const git_oid *exclude_id)
+{
+	return dir->valid &&
+		git_index_time_eq(&dir->stat.mtime, &st->mtime) &&
+		git_index_time_eq(&dir->stat.ctime, &st->ctime) &&
+		dir->stat.ino == st->ino &&
+		dir->stat.file_size == st->file_size &&
+		git_oid_equal(&dir->exclude_id, exclude_id);
+}
+
+static int remove_unseen(const git_vector *dirs, size_t idx, void *payload)
+{
+	git_untracked_cache_dir *child = git_vector_get(dirs, idx);
+
+	GIT_UNUSED(payload);
+
+	if (child->seen) {
+		child->seen = 0;
+		return 0;
+	}
+
+	dir_free(child);
+	return 1;
+}
+
+int git_untracked_cache_dir_update(
+	git_untracked_cache *cache,
+	git_untracked_cache_dir *dir,
+	const git_untracked_cache_stat *st,
+	const git_oid *exclude_id,
+	const git_vector *untracked,
+	const git_vector *subdirs)
+{
+	git_untracked_cache_dir *child;
+	const char *name;
+	char *dup;
+	size_t i;
+
+	dir_clear_untracked(dir);
+	dir->valid = 0;
+	cache->dirty = 1;
+
+	if (git_vector_init(&dir->untracked, untracked->length, NULL) < 0)
+		return -1;
+
+	git_vector_foreach(untracked, i, name) {
+		if ((dup = git__strdup(name)) == NULL ||
+			git_vector_insert(&dir->untracked, dup) < 0) {
+			git__free(dup);
+			dir_clear_untracked(dir);
+			return -1;
+		}
+	}
+
+	git_vector_foreach(subdirs, i, name) {
+		if ((child = find_child(dir, name, strlen(name) - 1)) != NULL)
+			child->seen = 1;
+	}
+
+	git_vector_remove_matching(&dir->dirs, remove_unseen, NULL);
+
+	memcpy(&dir->stat, st, sizeof(git_untracked_cache_stat));
+	git_oid_cpy(&dir->exclude_id, exclude_id);
+	dir->valid = 1;
+	dir->check_only = 0;
+
+	return 0;
+}
+
+int git_untracked_cache_for_index(
+	git_untracked_cache **out, git_index *index, git_repository *repo)
+{
+	int setting, error;
+
+	*out = NULL;
+
+	if ((error = git_repository__cvar(
+			&setting, repo, GIT_CVAR_UNTRACKEDCACHE)) < 0)
+		return error;
+
+	if (setting == GIT_UNTRACKEDCACHE_FALSE) {
+		git_untracked_cache_free(index->untracked);
+		index->untracked = NULL;
+	} else if (setting == GIT_UNTRACKEDCACHE_TRUE && !index->untracked) {
+		if ((error = git_untracked_cache_new(&index->untracked)) < 0)
+			return error;
+	}
+
+	if ((*out = index->untracked) != NULL)
+		GIT_REFCOUNT_INC(*out);
+
+	return 0;
+}
+
+static int untracked_cache_ident(git_buf *out, git_repository *repo)
+{
+	const char *workdir = git_repository_workdir(repo);
+	size_t workdir_len = strlen(workdir);
+	const char *sysname;
+#ifdef GIT_WIN32
+	sysname = "Windows";
+#else
+	struct utsname uts;
+
+	sysname = (uname(&uts) < 0) ? "" : uts.sysname;
+#endif
+
+	/* git does not have a trailing slash on the working directory */
+	if (workdir_len > 1 && workdir[workdir_len - 1] == '/')
+		workdir_len--;
+
+	/* the ident is stored with its NUL terminator */
+	git_buf_printf(out, "Location %.*s, system %s",
+		(int)workdir_len, workdir, sysname);
+	git_buf_putc(out, '\0');
+
+	return git_buf_oom(out) ? -1 : 0;
+}
+
+static int ignore_file_info(
+	git_untracked_cache_stat *st, git_oid *id, git_attr_file *file)
+{
+	struct stat s;
+
+	memset(st, 0, sizeof(git_untracked_cache_stat));
+	memset(id, 0, sizeof(git_oid));
+
+	if (file == NULL || file->nonexistent)
+		return 0;
+
+	if (git_attr_file__id(id, file) < 0)
+		return -1;
+
+	if (p_stat(file->entry->fullpath, &s) == 0)
+		git_untracked_cache_stat_init(st, &s);
+
+	return 0;
+}
+
+int git_untracked_cache_validate(
+	git_untracked_cache *cache, git_repository *repo, git_ignores *ignores)
+{
+	git_attr_file *info_exclude, *excludes_file;
+	git_oid info_exclude_id, excludes_file_id;
+	git_untracked_cache_stat info_exclude_stat, excludes_file_stat;
+	git_buf ident = GIT_BUF_INIT;
+	int error = 1;
+
+	/* rules given through the API aren't recorded anywhere */
+	if (git_ignore__has_internal_rules(ignores))
+		return 0;
+
+	if (untracked_cache_ident(&ident, repo) < 0)
+		return -1;
+
+	git_ignore__global_files(&info_exclude, &excludes_file, ignores);
+	if (ignore_file_info(&info_exclude_stat, &info_exclude_id, info_exclude) < 0 ||
+		ignore_file_info(&excludes_file_stat, &excludes_file_id, excludes_file) < 0) {
+		error = -1;
+		goto done;
+	}
+
+	if (!cache->ident.size || strcmp(cache->ident.ptr, ident.ptr) != 0 ||
+		cache->dir_flags != GIT_UNTRACKED_CACHE_DIR_FLAGS ||
+		strcmp(cache->exclude_per_dir, GIT_IGNORE_FILE) != 0 ||
+		!git_oid_equal(&cache->info_exclude_id, &info_exclude_id) ||
+		!git_oid_equal(&cache->excludes_file_id, &excludes_file_id)) {
+		char *exclude_per_dir;
+
+		if ((exclude_per_dir = git__strdup(GIT_IGNORE_FILE)) == NULL) {
+			error = -1;
+			goto done;
+		}
+
+		git__free(cache->exclude_per_dir);
+		cache->exclude_per_dir = exclude_per_dir;
+
+		git_buf_swap(&cache->ident, &ident);
+		cache->dir_flags = GIT_UNTRACKED_CACHE_DIR_FLAGS;
+
+		memcpy(&cache->info_exclude_stat, &info_exclude_stat, sizeof(git_untracked_cache_stat));
+		memcpy(&cache->excludes_file_stat, &excludes_file_stat, sizeof(git_untracked_cache_stat));
+		git_oid_cpy(&cache->info_exclude_id, &info_exclude_id);
+		git_oid_cpy(&cache->excludes_file_id, &excludes_file_id);
+
+		git_untracked_cache_clear(cache);
+		cache->dirty = 1;
+	}
+
+done:
+	git_buf_free(&ident);
+	return error;
+}
+
+/*
+ * Reading and writing, in the format of git's `UNTR` extension:
+ *
+ * - the NUL-terminated ident strings, preceded by their total size
+ *   as a varint
+ * - the stat data of `info/exclude` and of `core.excludesfile`, and
+ *   the (network order) 32-bit `dir_flags`
+ * - the ids of `info/exclude` and `core.excludesfile`
+ * - the NUL-terminated name of the per-directory exclude file
+ * - the number of directory blocks as a varint, and that many blocks
+ *   in depth-first order: the number of untracked names and of
+ *   subdirectories as varints, the NUL-terminated directory name and
+ *   the NUL-terminated untracked names
+ * - three EWAH bitmaps, telling which directories are valid, which
+ *   are "check only" and which have a .gitignore id
+ * - the stat data of the valid directories, followed by the
+ *   .gitignore ids
+ * - a NUL byte, unless there were no directories
+ */
+
+struct untracked_read_data {
+	const unsigned char *data;
+	const unsigned char *end;
+	git_vector dirs; /* all directories, in the order they were read */
+};
+
+static int read_varint(
+	size_t *out, const unsigned char **data, const unsigned char *end)
+{
+	size_t len;
+	uintmax_t value;
+
+	/* the buffer ends with a NUL, so a varint can't run over it */
+	if (*data >= end)
+		return -1;
+
+	value = git_decode_varint(*data, &len);
+
+	if (!len || value > SIZE_MAX || (size_t)(end - *data) < len)
+		return -1;
+
+	*out = (size_t)value;
+	*data += len;
+	return 0;
+}
+
+static const char *read_string(
+	const unsigned char **data, const unsigned char *end)
+{
+	const unsigned char *str = *data, *nul;
+
+	if ((nul = memchr(str, '\0', end - str)) == NULL)
+		return NULL;
+
+	*data = nul + 1;
+	return (const char *)str;
+}
+
+static uint32_t read_be32(const unsigned char **data)
+{
+	uint32_t value;
+
+	memcpy(&value, *data, sizeof(uint32_t));
+	*data += sizeof(uint32_t);
+
+	return ntohl(value);
+}
+
+static int read_stat(
+	git_untracked_cache_stat *st,
+	const unsigned char **data,
+	const unsigned char *end)
+{
+	if ((size_t)(end - *data) < UNTRACKED_STAT_SIZE)
+		return -1;
+
+	st->ctime.seconds = (int32_t)read_be32(data);
+	st->ctime.nanoseconds = read_be32(data);
+	st->mtime.seconds = (int32_t)read_be32(data);
+	st->mtime.nanoseconds = read_be32(data);
+	st->dev = read_be32(data);
+	st->ino = read_be32(data);
+	st->uid = read_be32(data);
+	st->gid = read_be32(data);
+	st->file_size = read_be32(data);
+
+	return 0;
+}
+
+static int read_oid(
+	git_oid *oid, const unsigned char **data, const unsigned char *end)
+{
+	if ((size_t)(end - *data) < GIT_OID_RAWSZ)
+		return -1;
+
+	git_oid_fromraw(oid, *data);
+	*data += GIT_OID_RAWSZ;
+
+	return 0;
+}
+
+static int read_dir(
+	git_untracked_cache_dir **out, struct untracked_read_data *rd)
+{
+	git_untracked_cache_dir *dir = NULL, *child;
+	size_t untracked_count, dir_count, i;
+	const char *name;
+	char *dup;
+
+	if (read_varint(&untracked_count, &rd->data, rd->end) < 0 ||
+		read_varint(&dir_count, &rd->data, rd->end) < 0 ||
+		(name = read_string(&rd->data, rd->end)) == NULL)
+		return -1;
+
+	if ((dir = dir_new(name, strlen(name))) == NULL ||
+		git_vector_insert(&rd->dirs, dir) < 0 ||
+		git_vector_init(&dir->untracked, untracked_count, NULL) < 0)
+		goto on_error;
+
+	for (i = 0; i < untracked_count; i++) {
+		if ((name = read_string(&rd->data, rd->end)) == NULL ||
+			(dup = git__strdup(name)) == NULL)
+			goto on_error;
+
+		if (git_vector_insert(&dir->untracked, dup) < 0) {
+			git__free(dup);
+			goto on_error;
+		}
+	}
+
+	for (i = 0; i < dir_count; i++) {
+		if (read_dir(&child, rd) < 0)
+			goto on_error;
+
+		if (git_vector_insert(&dir->dirs, child) < 0) {
+			dir_free(child);
+			goto on_error;
+		}
+	}
+
+	git_vector_sort(&dir->dirs);
+
+	*out = dir;
+	return 0;
+
+on_error:
+	dir_free(dir);
+	return -1;
+}
+
+struct untracked_bit_data {
+	struct untracked_read_data *rd;
+	int error;
+};
+
+static int set_valid(size_t pos, void *payload)
+{
+	struct untracked_bit_data *bd = payload;
+	git_untracked_cache_dir *dir = git_vector_get(&bd->rd->dirs, pos);
+
+	if (!dir || read_stat(&dir->stat, &bd->rd->data, bd->rd->end) < 0)
+		return (bd->error = -1);
+
+	dir->valid = 1;
+	return 0;
+}
+
+static int set_check_only(size_t pos, void *payload)
+{
+	struct untracked_bit_data *bd = payload;
+	git_untracked_cache_dir *dir = git_vector_get(&bd->rd->dirs, pos);
+
+	if (!dir)
+		return (bd->error = -1);
+
+	dir->check_only = 1;
+	return 0;
+}
+
+static int set_exclude_id(size_t pos, void *payload)
+{
+	struct untracked_bit_data *bd = payload;
+	git_untracked_cache_dir *dir = git_vector_get(&bd->rd->dirs, pos);
+
+	if (!dir || read_oid(&dir->exclude_id, &bd->rd->data, bd->rd->end) < 0)
+		return (bd->error = -1);
+
+	return 0;
+}
+
+static int read_bitmap(
+	git_bitmap *out, const unsigned char **data, const unsigned char *end)
+{
+	git_ewah ewah;
+	size_t consumed;
+
+	if (git_ewah_parse(&ewah, &consumed, *data, end - *data) < 0 ||
+		git_ewah_or(out, &ewah) < 0)
+		return -1;
+
+	*data += consumed;
+	return 0;
+}
+
+static int read_dirs(git_untracked_cache *cache, struct untracked_read_data *rd)
+{
+	git_bitmap valid = GIT_BITMAP_INIT, check_only = GIT_BITMAP_INIT,
+		exclude_valid = GIT_BITMAP_INIT;
+	struct untracked_bit_data bd;
+	size_t dir_count;
+	int error = -1;
+
+	/* no directories at all */
+	if (rd->data >= rd->end)
+		return 0;
+
+	if (read_varint(&dir_count, &rd->data, rd->end) < 0 || !dir_count)
+		return -1;
+
+	if (read_dir(&cache->root, rd) < 0 || rd->dirs.length != dir_count)
+		goto done;
+
+	if (read_bitmap(&valid, &rd->data, rd->end) < 0 ||
+		read_bitmap(&check_only, &rd->data, rd->end) < 0 ||
+		read_bitmap(&exclude_valid, &rd->data, rd->end) < 0)
+		goto done;
+
+	bd.rd = rd;
+	bd.error = 0;
+
+	/* invalid directories have no names, whatever the file says */
+	if (git_bitmap_foreach(&valid, set_valid, &bd) < 0 ||
+		git_bitmap_foreach(&check_only, set_check_only, &bd) < 0 ||
+		git_bitmap_foreach(&exclude_valid, set_exclude_id, &bd) < 0 ||
+		bd.error < 0)
+		goto done;
+
+	error = 0;
+
+done:
+	git_bitmap_free(&valid);
+	git_bitmap_free(&check_only);
+	git_bitmap_free(&exclude_valid);
+	return error;
+}
+
+static void drop_invalid_names(git_untracked_cache_dir *dir)
+{
+	git_untracked_cache_dir *child;
+	size_t i;
+
+	if (!dir->valid)
+		dir_clear_untracked(dir);
+
+	git_vector_foreach(&dir->dirs, i, child)
+		drop_invalid_names(child);
+}
+
+int git_untracked_cache_read(
+	git_untracked_cache **out, const char *buffer, size_t buffer_size)
+{
+	git_untracked_cache *cache = NULL;
+	struct untracked_read_data rd = { 0 };
+	const char *exclude_per_dir;
+	size_t ident_len;
+
+	*out = NULL;
+
+	rd.data = (const unsigned char *)buffer;
+	rd.end = rd.data + buffer_size;
+
+	/* everything is followed by a NUL to keep the strings terminated */
+	if (buffer_size <= 1 || rd.end[-1] != '\0')
+		goto corrupted;
+
+	rd.end--;
+
+	if (git_untracked_cache_new(&cache) < 0)
+		return -1;
+
+	if (read_varint(&ident_len, &rd.data, rd.end) < 0 ||
+		(size_t)(rd.end - rd.data) < ident_len ||
+		git_buf_put(&cache->ident, (const char *)rd.data, ident_len) < 0)
+		goto corrupted;
+
+	rd.data += ident_len;
+
+	if (read_stat(&cache->info_exclude_stat, &rd.data, rd.end) < 0 ||
+		read_stat(&cache->excludes_file_stat, &rd.data, rd.end) < 0 ||
+		(size_t)(rd.end - rd.data) < sizeof(uint32_t))
+		goto corrupted;
+
+	cache->dir_flags = read_be32(&rd.data);
+
+	if (read_oid(&cache->info_exclude_id, &rd.data, rd.end) < 0 ||
+		read_oid(&cache->excludes_file_id, &rd.data, rd.end) < 0 ||
+		(exclude_per_dir = read_string(&rd.data, rd.end)) == NULL)
+		goto corrupted;
+
+	git__free(cache->exclude_per_dir);
+	if ((cache->exclude_per_dir = git__strdup(exclude_per_dir)) == NULL)
+		goto on_error;
+
+	if (git_vector_init(&rd.dirs, 16, NULL) < 0)
+		goto on_error;
+
+	if (read_dirs(cache, &rd) < 0 || rd.data != rd.end)
+		goto corrupted;
+
+	if (cache->root)
+		drop_invalid_names(cache->root);
+
+	git_vector_free(&rd.dirs);
+
+	*out = cache;
+	return 0;
+
+corrupted:
+	giterr_set(GITERR_INDEX, "corrupted UNTR extension in index");
+on_error:
+	git_vector_free(&rd.dirs);
+	git_untracked_cache_free(cache);
+	return -1;
+}
+
+struct untracked_write_data {
+	git_buf blocks;
+	git_buf stat;
+	git_buf ids;
+	git_bitmap valid;
+	git_bitmap check_only;
+	git_bitmap exclude_valid;
+	size_t index;
+};
+
+static int put_varint(git_buf *out, size_t value)
+{
+	unsigned char varint[16];
+	int len = git_encode_varint(varint, sizeof(varint), value);
+
+	if (len < 0)
+		return -1;
+
+	return git_buf_put(out, (const char *)varint, len);
+}
+
+static int put_be32(git_buf *out, uint32_t value)
+{
+	value = htonl(value);
+	return git_buf_put(out, (const char *)&value, sizeof(uint32_t));
+}
+
+static int put_stat(git_buf *out, const git_untracked_cache_stat *st)
+{
+	if (put_be32(out, (uint32_t)st->ctime.seconds) < 0 ||
+		put_be32(out, st->ctime.nanoseconds) < 0 ||
+		put_be32(out, (uint32_t)st->mtime.seconds) < 0 ||
+		put_be32(out, st->mtime.nanoseconds) < 0 ||
+		put_be32(out, st->dev) < 0 ||
+		put_be32(out, st->ino) < 0 ||
+		put_be32(out, st->uid) < 0 ||
+		put_be32(out, st->gid) < 0 ||
+		put_be32(out, st->file_size) < 0)
+		return -1;
+
+	return 0;
+}
+
+static int write_dir(struct untracked_write_data *wd, git_untracked_cache_dir *dir)
+{
+	git_untracked_cache_dir *child;
+	const char *name;
+	size_t i, pos = wd->index++;
+
+	if (dir->check_only && git_bitmap_set(&wd->check_only, pos) < 0)
+		return -1;
+
+	if (dir->valid &&
+		(git_bitmap_set(&wd->valid, pos) < 0 ||
+		 put_stat(&wd->stat, &dir->stat) < 0))
+		return -1;
+
+	if (!git_oid_iszero(&dir->exclude_id) &&
+		(git_bitmap_set(&wd->exclude_valid, pos) < 0 ||
+		 git_buf_put(&wd->ids, (const char *)dir->exclude_id.id, GIT_OID_RAWSZ) < 0))
+		return -1;
+
+	if (put_varint(&wd->blocks, dir->valid ? dir->untracked.length : 0) < 0 ||
+		put_varint(&wd->blocks, dir->dirs.length) < 0 ||
+		git_buf_put(&wd->blocks, dir->name, strlen(dir->name) + 1) < 0)
+		return -1;
+
+	if (dir->valid) {
+		git_vector_foreach(&dir->untracked, i, name) {
+			if (git_buf_put(&wd->blocks, name, strlen(name) + 1) < 0)
+				return -1;
+		}
+	}
+
+	git_vector_foreach(&dir->dirs, i, child) {
+		if (write_dir(wd, child) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+int git_untracked_cache_write(git_buf *out, git_untracked_cache *cache)
+{
+	struct untracked_write_data wd = {
+		GIT_BUF_INIT, GIT_BUF_INIT, GIT_BUF_INIT,
+		GIT_BITMAP_INIT, GIT_BITMAP_INIT, GIT_BITMAP_INIT, 0
+	};
+	int error = -1;
+
+	if (put_varint(out, cache->ident.size) < 0 ||
+		git_buf_put(out, cache->ident.ptr, cache->ident.size) < 0 ||
+		put_stat(out, &cache->info_exclude_stat) < 0 ||
+		put_stat(out, &cache->excludes_file_stat) < 0 ||
+		put_be32(out, cache->dir_flags) < 0 ||
+		git_buf_put(out, (const char *)cache->info_exclude_id.id, GIT_OID_RAWSZ) < 0 ||
+		git_buf_put(out, (const char *)cache->excludes_file_id.id, GIT_OID_RAWSZ) < 0 ||
+		git_buf_put(out, cache->exclude_per_dir, strlen(cache->exclude_per_dir) + 1) < 0)
+		return -1;
+
+	if (cache->root == NULL)
+		return put_varint(out, 0);
+
+	if (write_dir(&wd, cache->root) < 0 ||
+		put_varint(out, wd.index) < 0 ||
+		git_buf_put(out, wd.blocks.ptr, wd.blocks.size) < 0 ||
+		git_ewah_serialize(out, &wd.valid) < 0 ||
+		git_ewah_serialize(out, &wd.check_only) < 0 ||
+		git_ewah_serialize(out, &wd.exclude_valid) < 0 ||
+		git_buf_put(out, wd.stat.ptr, wd.stat.size) < 0 ||
+		git_buf_put(out, wd.ids.ptr, wd.ids.size) < 0 ||
+		git_buf_putc(out, '\0') < 0)
+		goto done;
+
+	error = 0;
+
+done:
+	git_buf_free(&wd.blocks);
+	git_buf_free(&wd.stat);
+	git_buf_free(&wd.ids);
+	git_bitmap_free(&wd.valid);
+	git_bitmap_free(&wd.check_only);
+	git_bitmap_free(&wd.exclude_valid);
+	return error;
+}
@@ -0,0 +1,139 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#ifndef INCLUDE_untracked_cache_h__
+#define INCLUDE_untracked_cache_h__
+
+#include "common.h"
+
+#include "buffer.h"
+#include "vector.h"
+#include "ignore.h"
+#include "git2/index.h"
+#include "git2/oid.h"
+
+/*
+ * The `dir_flags` of the scan we record, in terms of git's
+ * `read_directory`: untracked directories are listed by name without
+ * looking at what they contain (`DIR_SHOW_OTHER_DIRECTORIES`).
+ * git itself never scans with only this flag, so it rebuilds a cache
+ * written by us instead of trusting it, and vice versa.
+ */
+#define GIT_UNTRACKED_CACHE_DIR_FLAGS 2
+
+typedef struct {
+	git_index_time ctime;
+	git_index_time mtime;
+	uint32_t dev;
+	uint32_t ino;
+	uint32_t uid;
+	uint32_t gid;
+	uint32_t file_size;
+} git_untracked_cache_stat;
+
+typedef struct git_untracked_cache_dir {
+	git_untracked_cache_stat stat;
+	git_oid exclude_id; /* id of the directory's .gitignore, or zero */
+	git_vector untracked; /* names of untracked items, dirs end in '/' */
+	git_vector dirs; /* subdirectories, sorted by name */
+	unsigned int valid:1,
+		check_only:1,
+		seen:1;
+	char name[GIT_FLEX_ARRAY];
+} git_untracked_cache_dir;
+
+/*
+ * The untracked cache, stored in the index as the `UNTR` extension.
+ * For each directory of the working directory it records the stat data
+ * of the directory and the id of its .gitignore, together with the
+ * names of the items in it which are neither in the index nor ignored.
+ * As long as neither of those change, nor the index entries below the
+ * directory, a scan can take these names instead of reading the
+ * directory and matching every item against the ignore rules.
+ */
+typedef struct {
+	git_refcount rc;
+	git_buf ident;
+	git_untracked_cache_stat info_exclude_stat;
+	git_untracked_cache_stat excludes_file_stat;
+	git_oid info_exclude_id;
+	git_oid excludes_file_id;
+	uint32_t dir_flags;
+	char *exclude_per_dir;
+	git_untracked_cache_dir *root;
+	unsigned int dirty:1;
+} git_untracked_cache;
+
+extern int git_untracked_cache_new(git_untracked_cache **out);
+extern int git_untracked_cache_read(
+	git_untracked_cache **out, const char *buffer, size_t buffer_size);
+extern int git_untracked_cache_write(git_buf *out, git_untracked_cache *cache);
+extern void git_untracked_cache_free(git_untracked_cache *cache);
+
+/* Forget about all directories */
+extern void git_untracked_cache_clear(git_untracked_cache *cache);
+
+/*
+ * Invalidate the directories leading up to `path`, which was added to
+ * or removed from the index. This includes the parents, since a
+ * directory that was untracked may now be tracked or the other way around.
+ */
+extern void git_untracked_cache_invalidate_path(
+	git_untracked_cache *cache, const char *path);
+
+/*
+ * Get the untracked cache to use when scanning the working directory
+ * of `repo` with `index`, honoring `core.untrackedCache`: if it is set
+ * the cache is added to or removed from the index. `out` is set to
+ * NULL when there is no cache; otherwise the caller has to free it.
+ */
+extern int git_untracked_cache_for_index(
+	git_untracked_cache **out, git_index *index, git_repository *repo);
+
+/*
+ * Check that the cache was recorded for this working directory and with
+ * the same global ignore rules, and reset it if not. Returns 1 if the
+ * cache can be used with `ignores`, 0 if it can't (because custom rules
+ * were added with `git_ignore_add_rule`) or an error code.
+ */
+extern int git_untracked_cache_validate(
+	git_untracked_cache *cache, git_repository *repo, git_ignores *ignores);
+
+/*
+ * Look up the directory at `path`, which is either empty for the root or
+ * ends in a '/', adding it (and its parents) if it is not in the cache.
+ */
+extern git_untracked_cache_dir *git_untracked_cache_dir_lookup(
+	git_untracked_cache *cache, const char *path, size_t path_len);
+
+extern void git_untracked_cache_stat_init(
+	git_untracked_cache_stat *out, const struct stat *st);
+
+/* Whether the names recorded for `dir` are still valid */
+extern bool git_untracked_cache_dir_is_valid(
+	const git_untracked_cache_dir *dir,
+	const git_untracked_cache_stat *st,
+	const git_oid *exclude_id);
+
+/*
+ * Record the `untracked` names found in `dir` when it had the given stat
+ * data and .gitignore. Subdirectories which are not in `subdirs` (whose
+ * names end in a '/') no longer exist and are dropped from the cache.
+ */
+extern int git_untracked_cache_dir_update(
+	git_untracked_cache *cache,
+	git_untracked_cache_dir *dir,
+	const git_untracked_cache_stat *st,
+	const git_oid *exclude_id,
+	const git_vector *untracked,
+	const git_vector *subdirs);
+
+/* Forget the names recorded for `dir` and, if requested, its subdirectories */
+extern void git_untracked_cache_dir_invalidate(
+	git_untracked_cache *cache, git_untracked_cache_dir *dir, bool recursive);
+
+#endif
@@ -833,3 +833,72 @@ int git__getenv(git_buf *out, const char *name)
 	return git_buf_puts(out, val);
 }
 #endif
+
+#ifdef GIT_COUNT_ALLOCS
+
+#define ALLOC_COUNT_FILES 1024
+
+/*
+ * The counts are kept by the address of each file name. A header's name
+ * may have a different address in each file which includes it, so the
+ * same name can take more than one slot; git__alloc_counts adds those up.
+ */
+static struct {
+	void * volatile file;
+	git_atomic_ssize count;
+} alloc_counts[ALLOC_COUNT_FILES];
+
+static git_atomic_ssize alloc_counts_dropped;
+
+void git__alloc_count(const char *file)
+{
+	size_t i, pos = ((uintptr_t)file >> 3) % ALLOC_COUNT_FILES;
+
+	for (i = 0; i < ALLOC_COUNT_FILES; i++) {
+		if (alloc_counts[pos].file == NULL)
+			git__compare_and_swap(&alloc_counts[pos].file, NULL, (void *)file);
+
+		if (alloc_counts[pos].file == file) {
+			git_atomic_ssize_add(&alloc_counts[pos].count, 1);
+			return;
+		}
+
+		pos = (pos + 1) % ALLOC_COUNT_FILES;
+	}
+
+	git_atomic_ssize_add(&alloc_counts_dropped, 1);
+}
+
+size_t git__alloc_counts(git_alloc_count *out, size_t max)
+{
+	size_t i, j, n = 0;
+
+	for (i = 0; i < ALLOC_COUNT_FILES; i++) {
+		const char *file = alloc_counts[i].file;
+
+		if (file == NULL)
+			continue;
+
+		for (j = 0; j < n && strcmp(out[j].file, file); j++)
+			/* find the file */;
+
+		if (j == n) {
+			if (n == max)
+				continue;
+
+			out[n].file = file;
+			out[n++].count = 0;
+		}
+
+		out[j].count += (size_t)alloc_counts[i].count.val;
+	}
+
+	if (alloc_counts_dropped.val && n < max) {
+		out[n].file = "(other)";
+		out[n++].count = (size_t)alloc_counts_dropped.val;
+	}
+
+	return n;
+}
+
+#endif
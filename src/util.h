@@ -165,6 +165,39 @@ GIT_INLINE(void *) git__mallocarray(size_t nelem, size_t elsize)
 	return git__reallocarray(NULL, nelem, elsize);
 }
 
+#if defined(GIT_COUNT_ALLOCS)
+
+/*
+ * Count the allocations made from each source file, for the benchmarks.
+ * A function-like macro isn't expanded within itself, so these call the
+ * functions above; the helpers which allocate on behalf of their callers
+ * are counted at the callers.
+ */
+
+typedef struct {
+	const char *file;
+	size_t count;
+} git_alloc_count;
+
+extern void git__alloc_count(const char *file);
+
+/*
+ * Get up to `max` of the counts, with one entry for each file, and
+ * return how many there are. They are not in any particular order.
+ */
+extern size_t git__alloc_counts(git_alloc_count *out, size_t max);
+
+#define git__malloc(len)                      (git__alloc_count(__FILE__), git__malloc(len))
+#define git__calloc(nelem, elsize)            (git__alloc_count(__FILE__), git__calloc(nelem, elsize))
+#define git__strdup(str)                      (git__alloc_count(__FILE__), git__strdup(str))
+#define git__strndup(str, n)                  (git__alloc_count(__FILE__), git__strndup(str, n))
+#define git__substrdup(str, n)                (git__alloc_count(__FILE__), git__substrdup(str, n))
+#define git__realloc(ptr, size)               (git__alloc_count(__FILE__), git__realloc(ptr, size))
+#define git__reallocarray(ptr, nelem, elsize) (git__alloc_count(__FILE__), git__reallocarray(ptr, nelem, elsize))
+#define git__mallocarray(nelem, elsize)       (git__alloc_count(__FILE__), git__mallocarray(nelem, elsize))
+
+#endif
+
 #endif /* !MSVC_CTRDBG */
 
 GIT_INLINE(void) git__free(void *ptr)
@@ -140,4 +140,13 @@ int p_munmap(git_map *map)
 	return error;
 }
 
+int p_madvise(git_map *map, int advice)
+{
+	/* views are read in as they are used; there is nothing to tell */
+	GIT_UNUSED(map);
+	GIT_UNUSED(advice);
+
+	return 0;
+}
+
 #endif
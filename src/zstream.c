@@ -10,10 +10,13 @@
 #include <zlib.h>
 
 #include "buffer.h"
+#include "global.h"
 
 #define ZSTREAM_BUFFER_SIZE (1024 * 1024)
 #define ZSTREAM_BUFFER_MIN_EXTRA 8
 
+git_atomic_ssize git_zstream__inflated = {0};
+
 static int zstream_seterr(git_zstream *zs)
 {
 	if (zs->zerr == Z_OK || zs->zerr == Z_STREAM_END)
@@ -29,6 +32,58 @@ static int zstream_seterr(git_zstream *zs)
 	return -1;
 }
 
+int git_zstream__inflater_get(z_stream **out)
+{
+	git_global_st *global = GIT_GLOBAL;
+	z_stream *stream;
+
+	if (global && global->inflater && !global->inflater_busy &&
+		inflateReset(global->inflater) == Z_OK) {
+		global->inflater_busy = true;
+		*out = global->inflater;
+		return 0;
+	}
+
+	stream = git__calloc(1, sizeof(z_stream));
+	GITERR_CHECK_ALLOC(stream);
+
+	if (inflateInit(stream) != Z_OK) {
+		git__free(stream);
+		giterr_set(GITERR_ZLIB, "failed to init zlib stream");
+		return -1;
+	}
+
+	if (global && !global->inflater) {
+		global->inflater = stream;
+		global->inflater_busy = true;
+	}
+
+	*out = stream;
+	return 0;
+}
+
+void git_zstream__inflater_put(z_stream *stream)
+{
+	git_global_st *global = GIT_GLOBAL;
+
+	if (!stream)
+		return;
+
+	if (global && global->inflater == stream)
+		global->inflater_busy = false;
+	else
+		git_zstream__inflater_free(stream);
+}
+
+void git_zstream__inflater_free(z_stream *stream)
+{
+	if (!stream)
+		return;
+
+	inflateEnd(stream);
+	git__free(stream);
+}
+
 int git_zstream_init(git_zstream *zstream, git_zstream_t type)
 {
 	zstream->type = type;
@@ -124,6 +179,9 @@ int git_zstream_get_output(void *out, size_t *out_len, git_zstream *zstream)
 
 		out_used = (out_queued - zstream->z.avail_out);
 		out_remain -= out_used;
+
+		if (zstream->type == GIT_ZSTREAM_INFLATE)
+			git_zstream__count_inflated(out_used);
 		out = ((char *)out) + out_used;
 
 		in_used = (in_queued - zstream->z.avail_in);
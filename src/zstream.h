@@ -44,4 +44,25 @@ void git_zstream_reset(git_zstream *zstream);
 int git_zstream_deflatebuf(git_buf *out, const void *in, size_t in_len);
 int git_zstream_inflatebuf(git_buf *out, const void *in, size_t in_len);
 
+/*
+ * Get an inflate stream, ready to be given input and output, for
+ * reading a single object.  zlib allocates its state and a 32kB window
+ * whenever a stream is set up, so each thread keeps a stream which is
+ * reset instead; a new one is only set up for a nested read.  Streams
+ * must be given back with `git_zstream__inflater_put`.
+ */
+int git_zstream__inflater_get(z_stream **out);
+void git_zstream__inflater_put(z_stream *stream);
+
+/* Free the stream of a thread as it exits */
+void git_zstream__inflater_free(z_stream *stream);
+
+/* Bytes inflated by zlib, through a `git_zstream` or not */
+extern git_atomic_ssize git_zstream__inflated;
+
+GIT_INLINE(void) git_zstream__count_inflated(size_t len)
+{
+	git_atomic_ssize_add(&git_zstream__inflated, (ssize_t)len);
+}
+
 #endif /* INCLUDE_zstream_h__ */
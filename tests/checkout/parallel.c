@@ -0,0 +1,154 @@
+#include "clar_libgit2.h"
+#include "fileops.h"
+
+#include "git2/checkout.h"
+
+static git_repository *g_repo;
+
+void test_checkout_parallel__cleanup(void)
+{
+	cl_git_sandbox_cleanup();
+}
+
+typedef struct {
+	git_buf progress;
+	git_checkout_perfdata perfdata;
+} checkout_record;
+
+static void progress_cb(
+	const char *path, size_t completed_steps, size_t total_steps, void *payload)
+{
+	checkout_record *record = payload;
+
+	cl_git_pass(git_buf_printf(&record->progress, "%s:%"PRIuZ"/%"PRIuZ"\n",
+		path ? path : "", completed_steps, total_steps));
+}
+
+static void perfdata_cb(const git_checkout_perfdata *perfdata, void *payload)
+{
+	checkout_record *record = payload;
+	memcpy(&record->perfdata, perfdata, sizeof(git_checkout_perfdata));
+}
+
+static void checkout_to(
+	checkout_record *record, const char *target, unsigned int threads)
+{
+	git_checkout_options opts = GIT_CHECKOUT_OPTIONS_INIT;
+	git_buf path = GIT_BUF_INIT;
+	git_object *head;
+
+	memset(record, 0, sizeof(*record));
+
+	cl_git_pass(git_buf_joinpath(&path, clar_sandbox_path(), target));
+
+	opts.checkout_strategy = GIT_CHECKOUT_FORCE | GIT_CHECKOUT_DONT_UPDATE_INDEX;
+	opts.target_directory = path.ptr;
+	opts.progress_cb = progress_cb;
+	opts.progress_payload = record;
+	opts.perfdata_cb = perfdata_cb;
+	opts.perfdata_payload = record;
+	opts.threads = threads;
+
+	cl_git_pass(git_revparse_single(&head, g_repo, "HEAD^{tree}"));
+	cl_git_pass(git_checkout_tree(g_repo, head, &opts));
+	git_object_free(head);
+	git_buf_free(&path);
+}
+
+static int compare_entry(void *payload, git_buf *path)
+{
+	const char *other_root = payload;
+	git_buf other = GIT_BUF_INIT, expected = GIT_BUF_INIT,
+		actual = GIT_BUF_INIT;
+	const char *relative = path->ptr + strlen("serial/");
+
+	cl_git_pass(git_buf_joinpath(&other, other_root, relative));
+
+	if (git_path_isdir(path->ptr)) {
+		cl_assert(git_path_isdir(other.ptr));
+		cl_git_pass(git_path_direach(path, 0, compare_entry, payload));
+	} else {
+		cl_git_pass(git_futils_readbuffer(&expected, path->ptr));
+		cl_git_pass(git_futils_readbuffer(&actual, other.ptr));
+		cl_assert_equal_s(expected.ptr, actual.ptr);
+	}
+
+	git_buf_free(&other);
+	git_buf_free(&expected);
+	git_buf_free(&actual);
+	return 0;
+}
+
+static void assert_same_checkout(unsigned int threads)
+{
+	checkout_record serial, parallel;
+	git_buf path = GIT_BUF_INIT;
+	const char *expected_progress, *actual_progress;
+
+	checkout_to(&serial, "serial", 1);
+	checkout_to(&parallel, "parallel", threads);
+
+	cl_git_pass(git_buf_sets(&path, "serial"));
+	cl_git_pass(git_path_direach(&path, 0, compare_entry, "parallel"));
+
+	/* progress is reported for the same files in the same order */
+	expected_progress = serial.progress.ptr;
+	actual_progress = parallel.progress.ptr;
+	cl_assert(serial.progress.size > 0);
+	cl_assert_equal_s(expected_progress, actual_progress);
+
+	cl_assert_equal_sz(serial.perfdata.mkdir_calls, parallel.perfdata.mkdir_calls);
+	cl_assert_equal_sz(serial.perfdata.stat_calls, parallel.perfdata.stat_calls);
+	cl_assert_equal_sz(serial.perfdata.chmod_calls, parallel.perfdata.chmod_calls);
+
+	git_buf_free(&serial.progress);
+	git_buf_free(&parallel.progress);
+	git_buf_free(&path);
+
+	cl_git_pass(git_futils_rmdir_r("serial", NULL, GIT_RMDIR_REMOVE_FILES));
+	cl_git_pass(git_futils_rmdir_r("parallel", NULL, GIT_RMDIR_REMOVE_FILES));
+}
+
+void test_checkout_parallel__matches_serial_checkout(void)
+{
+	g_repo = cl_git_sandbox_init("testrepo");
+
+	assert_same_checkout(2);
+	assert_same_checkout(8);
+}
+
+void test_checkout_parallel__applies_filters(void)
+{
+	g_repo = cl_git_sandbox_init("crlf");
+	cl_repo_set_bool(g_repo, "core.autocrlf", true);
+
+	assert_same_checkout(4);
+}
+
+void test_checkout_parallel__updates_the_index(void)
+{
+	git_checkout_options opts = GIT_CHECKOUT_OPTIONS_INIT;
+	git_status_list *status;
+	git_object *head;
+	git_index *index;
+
+	g_repo = cl_git_sandbox_init("testrepo");
+
+	cl_git_pass(git_repository_index(&index, g_repo));
+	cl_git_pass(git_index_clear(index));
+	cl_git_pass(git_index_write(index));
+	git_index_free(index);
+
+	opts.checkout_strategy = GIT_CHECKOUT_FORCE;
+	opts.threads = 4;
+
+	cl_git_pass(git_revparse_single(&head, g_repo, "HEAD^{tree}"));
+	cl_git_pass(git_checkout_tree(g_repo, head, &opts));
+	git_object_free(head);
+
+	cl_git_pass(git_status_list_new(&status, g_repo, NULL));
+	cl_assert_equal_sz(0, git_status_list_entrycount(status));
+	git_status_list_free(status);
+
+	cl_assert_equal_file("hey there\n", 0, "testrepo/README");
+}
@@ -0,0 +1,129 @@
+#include "clar_libgit2.h"
+#include "sha1_lookup.h"
+#include "hash.h"
+
+#define ENTRIES 5000
+#define STRIDE 24
+
+static unsigned char g_table[ENTRIES * STRIDE];
+
+static int oid_cmp(const void *a, const void *b)
+{
+	return memcmp(a, b, GIT_OID_RAWSZ);
+}
+
+/* The position a binary search finds, to compare with */
+static int expected_position(const unsigned char *key, unsigned lo, unsigned hi)
+{
+	while (lo < hi) {
+		unsigned mi = lo + (hi - lo) / 2;
+		int cmp = memcmp(g_table + mi * STRIDE, key, GIT_OID_RAWSZ);
+
+		if (!cmp)
+			return mi;
+		else if (cmp > 0)
+			hi = mi;
+		else
+			lo = mi + 1;
+	}
+
+	return -((int)lo)-1;
+}
+
+static void assert_finds_everything(unsigned lo, unsigned hi)
+{
+	unsigned char key[GIT_OID_RAWSZ];
+	unsigned i;
+
+	for (i = lo; i < hi; i++) {
+		memcpy(key, g_table + i * STRIDE, GIT_OID_RAWSZ);
+		cl_assert_equal_i(i, sha1_position(g_table, STRIDE, lo, hi, key));
+
+		/* ids which are not there, right around this one */
+		key[GIT_OID_RAWSZ - 1]++;
+		cl_assert_equal_i(expected_position(key, lo, hi),
+			sha1_position(g_table, STRIDE, lo, hi, key));
+
+		key[GIT_OID_RAWSZ - 1] -= 2;
+		cl_assert_equal_i(expected_position(key, lo, hi),
+			sha1_position(g_table, STRIDE, lo, hi, key));
+	}
+
+	memset(key, 0, sizeof(key));
+	cl_assert_equal_i(expected_position(key, lo, hi),
+		sha1_position(g_table, STRIDE, lo, hi, key));
+
+	memset(key, 0xff, sizeof(key));
+	cl_assert_equal_i(expected_position(key, lo, hi),
+		sha1_position(g_table, STRIDE, lo, hi, key));
+}
+
+static void fill_table(void (*make_id)(unsigned char *id, unsigned i))
+{
+	unsigned i;
+
+	memset(g_table, 0, sizeof(g_table));
+	for (i = 0; i < ENTRIES; i++)
+		make_id(g_table + i * STRIDE, i);
+
+	qsort(g_table, ENTRIES, STRIDE, oid_cmp);
+}
+
+static void hashed_id(unsigned char *id, unsigned i)
+{
+	git_oid oid;
+	cl_git_pass(git_hash_buf(&oid, &i, sizeof(i)));
+	memcpy(id, oid.id, GIT_OID_RAWSZ);
+}
+
+/* Mostly tiny ids with a few huge ones, all but useless to interpolate */
+static void skewed_id(unsigned char *id, unsigned i)
+{
+	if (i % 100 == 0) {
+		memset(id, 0xff, GIT_OID_RAWSZ);
+		id[GIT_OID_RAWSZ - 2] = (unsigned char)(i >> 8);
+		id[GIT_OID_RAWSZ - 1] = (unsigned char)i;
+	} else {
+		id[3] = (unsigned char)(i >> 12);
+		id[GIT_OID_RAWSZ - 2] = (unsigned char)(i >> 8);
+		id[GIT_OID_RAWSZ - 1] = (unsigned char)i;
+	}
+}
+
+/* Ids which only differ past the bytes used to interpolate */
+static void common_prefix_id(unsigned char *id, unsigned i)
+{
+	memset(id, 0x42, GIT_OID_RAWSZ);
+	id[10] = (unsigned char)(i >> 8);
+	id[11] = (unsigned char)i;
+}
+
+void test_core_sha1lookup__finds_hashed_ids(void)
+{
+	fill_table(hashed_id);
+
+	assert_finds_everything(0, ENTRIES);
+	assert_finds_everything(100, 2000);
+	assert_finds_everything(17, 18);
+}
+
+void test_core_sha1lookup__finds_skewed_ids(void)
+{
+	fill_table(skewed_id);
+	assert_finds_everything(0, ENTRIES);
+}
+
+void test_core_sha1lookup__finds_ids_with_common_prefix(void)
+{
+	fill_table(common_prefix_id);
+	assert_finds_everything(0, ENTRIES);
+}
+
+void test_core_sha1lookup__empty_range(void)
+{
+	unsigned char key[GIT_OID_RAWSZ] = { 0 };
+
+	fill_table(hashed_id);
+	cl_assert_equal_i(-1, sha1_position(g_table, STRIDE, 0, 0, key));
+	cl_assert_equal_i(-43, sha1_position(g_table, STRIDE, 42, 42, key));
+}
@@ -0,0 +1,109 @@
+#include "clar_libgit2.h"
+
+static git_repository *g_repo;
+
+void test_core_stats__cleanup(void)
+{
+	git_repository_free(g_repo);
+	g_repo = NULL;
+}
+
+static void get_stats(git_stats *stats)
+{
+	cl_git_pass(git_stats_init(stats, GIT_STATS_VERSION));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_STATS, stats));
+}
+
+void test_core_stats__checks_the_version(void)
+{
+	git_stats stats;
+
+	memset(&stats, 0, sizeof(stats));
+	cl_git_fail(git_libgit2_opts(GIT_OPT_GET_STATS, &stats));
+}
+
+void test_core_stats__counts_reading_a_packed_object(void)
+{
+	git_stats before, after;
+	git_oid oid;
+	git_object *obj;
+
+	cl_git_pass(git_repository_open(&g_repo, cl_fixture("testrepo.git")));
+	get_stats(&before);
+
+	/* a blob stored as a delta in the pack */
+	cl_git_pass(git_oid_fromstr(&oid, "8157f9e57bd9de5ab95b89fb9c7192a5668322f4"));
+	cl_git_pass(git_object_lookup(&obj, g_repo, &oid, GIT_OBJ_BLOB));
+
+	get_stats(&after);
+	cl_assert(after.cache_misses > before.cache_misses);
+	cl_assert(after.mwindow_maps > before.mwindow_maps);
+	cl_assert(after.mwindow_mapped > 0);
+	cl_assert(after.mwindow_peak_mapped >= after.mwindow_mapped);
+	cl_assert(after.mwindow_peak_open >= after.mwindow_open);
+	cl_assert(after.inflated_bytes >= before.inflated_bytes +
+		git_blob_rawsize((git_blob *)obj));
+
+	git_object_free(obj);
+	git_repository_free(g_repo);
+	g_repo = NULL;
+
+	/* the windows are unmapped with the last repository using the pack */
+	get_stats(&before);
+	cl_assert(before.mwindow_unmaps > after.mwindow_unmaps);
+}
+
+void test_core_stats__counts_delta_base_lookups(void)
+{
+	git_stats before, after;
+	git_odb *odb;
+	git_odb_object *obj;
+	git_oid oid;
+
+	cl_git_pass(git_odb_open(&odb, cl_fixture("testrepo.git/objects")));
+	get_stats(&before);
+
+	cl_git_pass(git_oid_fromstr(&oid, "8157f9e57bd9de5ab95b89fb9c7192a5668322f4"));
+	cl_git_pass(git_odb_read(&obj, odb, &oid));
+	git_odb_object_free(obj);
+
+	get_stats(&after);
+	cl_assert(after.pack_cache_misses > before.pack_cache_misses);
+
+	git_odb_free(odb);
+}
+
+void test_core_stats__counts_backend_lookups(void)
+{
+	git_odb *odb;
+	git_odb_object *obj;
+	git_oid oid;
+	size_t i, lookups, total = 0;
+
+	cl_git_pass(git_odb_open(&odb, cl_fixture("testrepo.git/objects")));
+
+	for (i = 0; i < git_odb_num_backends(odb); i++) {
+		cl_git_pass(git_odb_get_backend_lookups(&lookups, odb, i));
+		cl_assert_equal_sz(0, lookups);
+	}
+
+	cl_git_pass(git_oid_fromstr(&oid, "a65fedf39aefe402d3bb6e24df4d4f5fe4547750"));
+	cl_git_pass(git_odb_read(&obj, odb, &oid));
+	git_odb_object_free(obj);
+
+	/* the second read comes from the cache */
+	cl_git_pass(git_odb_read(&obj, odb, &oid));
+	git_odb_object_free(obj);
+
+	for (i = 0; i < git_odb_num_backends(odb); i++) {
+		cl_git_pass(git_odb_get_backend_lookups(&lookups, odb, i));
+		total += lookups;
+	}
+
+	cl_assert(total >= 1 && total <= git_odb_num_backends(odb));
+
+	cl_assert_equal_i(GIT_ENOTFOUND,
+		git_odb_get_backend_lookups(&lookups, odb, git_odb_num_backends(odb)));
+
+	git_odb_free(odb);
+}
@@ -180,4 +180,9 @@ void test_core_structinit__compare(void)
 	CHECK_MACRO_FUNC_INIT_EQUAL( \
 		git_diff_patchid_options, GIT_DIFF_PATCHID_OPTIONS_VERSION, \
 		GIT_DIFF_PATCHID_OPTIONS_INIT, git_diff_patchid_init_options);
+
+	/* stats */
+	CHECK_MACRO_FUNC_INIT_EQUAL( \
+		git_stats, GIT_STATS_VERSION, \
+		GIT_STATS_INIT, git_stats_init);
 }
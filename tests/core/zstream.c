@@ -166,3 +166,45 @@ void test_core_zstream__big_data(void)
 
 	git_buf_free(&in);
 }
+
+static void inflate_with(z_stream *stream, const void *in, size_t in_len)
+{
+	char out[128];
+
+	stream->next_in = (Bytef *)in;
+	stream->avail_in = (uInt)in_len;
+	stream->next_out = (Bytef *)out;
+	stream->avail_out = (uInt)sizeof(out);
+
+	cl_assert_equal_i(Z_STREAM_END, inflate(stream, Z_FINISH));
+	cl_assert_equal_sz(strlen(data) + 1, stream->total_out);
+	cl_assert_equal_s(data, out);
+}
+
+void test_core_zstream__inflater_is_reused(void)
+{
+	git_buf deflated = GIT_BUF_INIT;
+	z_stream *first, *second, *nested;
+
+	cl_git_pass(git_zstream_deflatebuf(&deflated, data, strlen(data) + 1));
+
+	cl_git_pass(git_zstream__inflater_get(&first));
+	inflate_with(first, deflated.ptr, deflated.size);
+
+	/* a stream which is in use is not handed out again */
+	cl_git_pass(git_zstream__inflater_get(&nested));
+	cl_assert(nested != first);
+	inflate_with(nested, deflated.ptr, deflated.size);
+	git_zstream__inflater_put(nested);
+
+	git_zstream__inflater_put(first);
+
+	/* the stream of the thread starts over once it was given back */
+	cl_git_pass(git_zstream__inflater_get(&second));
+	cl_assert(second == first);
+	cl_assert_equal_sz(0, second->total_out);
+	inflate_with(second, deflated.ptr, deflated.size);
+	git_zstream__inflater_put(second);
+
+	git_buf_free(&deflated);
+}
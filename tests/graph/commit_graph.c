@@ -0,0 +1,233 @@
+#include "clar_libgit2.h"
+
+#include "commit_graph.h"
+#include "fileops.h"
+#include "oidarray.h"
+#include "git2/commit_graph.h"
+
+static git_repository *_repo;
+
+void test_graph_commit_graph__initialize(void)
+{
+	_repo = cl_git_sandbox_init("testrepo.git");
+}
+
+void test_graph_commit_graph__cleanup(void)
+{
+	cl_git_sandbox_cleanup();
+	_repo = NULL;
+}
+
+static void commit_graph_path(git_buf *path)
+{
+	cl_git_pass(git_buf_joinpath(path,
+		git_repository_path(_repo), "objects/" GIT_COMMIT_GRAPH_FILE));
+}
+
+static void collect_commits(git_array_oid_t *out)
+{
+	git_revwalk *walk;
+	git_oid id, *slot;
+
+	cl_git_pass(git_revwalk_new(&walk, _repo));
+	cl_git_pass(git_revwalk_push_glob(walk, "*"));
+	cl_git_pass(git_revwalk_push_head(walk));
+	git_revwalk_sorting(walk, GIT_SORT_TOPOLOGICAL | GIT_SORT_TIME);
+
+	while (git_revwalk_next(&id, walk) == 0) {
+		slot = git_array_alloc(*out);
+		cl_assert(slot);
+		git_oid_cpy(slot, &id);
+	}
+
+	git_revwalk_free(walk);
+}
+
+void test_graph_commit_graph__parse_written_file(void)
+{
+	git_buf path = GIT_BUF_INIT;
+	git_commit_graph_file *file;
+	git_commit_graph_entry e, parent;
+	git_commit *commit;
+	git_oid id;
+	size_t i;
+
+	cl_git_pass(git_commit_graph_write(_repo));
+
+	commit_graph_path(&path);
+	cl_git_pass(git_commit_graph_open(&file, path.ptr));
+
+	/* a merge commit */
+	cl_git_pass(git_oid_fromstr(&id, "be3563ae3f795b2b4353bcce3a527ad0a4f7f644"));
+	cl_git_pass(git_commit_lookup(&commit, _repo, &id));
+	cl_git_pass(git_commit_graph_entry_find(&e, file, &id, GIT_OID_HEXSZ));
+	cl_assert_equal_oid(&id, &e.sha1);
+	cl_assert_equal_oid(git_commit_tree_id(commit), &e.tree_oid);
+	cl_assert_equal_i(git_commit_time(commit), e.commit_time);
+	cl_assert_equal_sz(git_commit_parentcount(commit), e.parent_count);
+
+	for (i = 0; i < e.parent_count; i++) {
+		cl_git_pass(git_commit_graph_entry_parent(&parent, file, &e, i));
+		cl_assert_equal_oid(git_commit_parent_id(commit, i), &parent.sha1);
+		cl_assert(parent.generation < e.generation);
+	}
+	cl_git_fail_with(GIT_ENOTFOUND,
+		git_commit_graph_entry_parent(&parent, file, &e, e.parent_count));
+
+	/* abbreviated lookups */
+	cl_git_pass(git_oid_fromstrn(&id, "be3563a", 7));
+	cl_git_pass(git_commit_graph_entry_find(&e, file, &id, 7));
+	cl_assert_equal_oid(git_commit_id(commit), &e.sha1);
+
+	/* a root commit has generation 1 */
+	cl_git_pass(git_oid_fromstr(&id, "8496071c1b46c854b31185ea97743be6a8774479"));
+	cl_git_pass(git_commit_graph_entry_find(&e, file, &id, GIT_OID_HEXSZ));
+	cl_assert_equal_sz(0, e.parent_count);
+	cl_assert_equal_i(1, e.generation);
+
+	/* not a commit */
+	cl_git_pass(git_oid_fromstr(&id, "a8233120f6ad708f843d861ce2b7228ec4e3dec6"));
+	cl_git_fail_with(GIT_ENOTFOUND,
+		git_commit_graph_entry_find(&e, file, &id, GIT_OID_HEXSZ));
+
+	git_commit_free(commit);
+	git_commit_graph_free(file);
+	git_buf_free(&path);
+}
+
+void test_graph_commit_graph__rejects_corrupt_file(void)
+{
+	git_buf path = GIT_BUF_INIT, contents = GIT_BUF_INIT;
+	git_commit_graph_file file;
+
+	cl_git_pass(git_commit_graph_write(_repo));
+
+	commit_graph_path(&path);
+	cl_git_pass(git_futils_readbuffer(&contents, path.ptr));
+
+	memset(&file, 0, sizeof(file));
+	cl_git_pass(git_commit_graph_parse(&file,
+		(const unsigned char *)contents.ptr, contents.size));
+
+	/* truncated in the middle of the chunk table */
+	memset(&file, 0, sizeof(file));
+	cl_git_fail(git_commit_graph_parse(&file,
+		(const unsigned char *)contents.ptr, 30));
+
+	/* bad signature */
+	contents.ptr[0] = 'X';
+	memset(&file, 0, sizeof(file));
+	cl_git_fail(git_commit_graph_parse(&file,
+		(const unsigned char *)contents.ptr, contents.size));
+
+	git_buf_free(&contents);
+	git_buf_free(&path);
+}
+
+/* git reads the date after the first '>' of the committer line */
+static git_time_t committer_date(git_commit *commit)
+{
+	git_buf committer = GIT_BUF_INIT;
+	const char *date;
+	git_time_t time;
+
+	cl_git_pass(git_commit_header_field(&committer, commit, "committer"));
+	cl_assert((date = strchr(committer.ptr, '>')) != NULL);
+	time = (git_time_t)strtoll(date + 1, NULL, 10);
+
+	git_buf_free(&committer);
+	return time;
+}
+
+void test_graph_commit_graph__dates_match_commits(void)
+{
+	git_array_oid_t commits = GIT_ARRAY_INIT;
+	git_buf path = GIT_BUF_INIT;
+	git_commit_graph_file *file;
+	git_commit_graph_entry e;
+	git_commit *commit;
+	git_oid *id;
+	size_t i;
+
+	cl_git_pass(git_commit_graph_write(_repo));
+
+	commit_graph_path(&path);
+	cl_git_pass(git_commit_graph_open(&file, path.ptr));
+
+	collect_commits(&commits);
+	cl_assert(git_array_size(commits) > 0);
+
+	git_array_foreach(commits, i, id) {
+		cl_git_pass(git_commit_lookup(&commit, _repo, id));
+		cl_git_pass(git_commit_graph_entry_find(&e, file, id, GIT_OID_HEXSZ));
+		cl_assert_equal_i(committer_date(commit), e.commit_time);
+		git_commit_free(commit);
+	}
+
+	/*
+	 * The committer's name has angle brackets in it, so git doesn't find
+	 * a date where the signature parser does.
+	 */
+	cl_git_pass(git_oid_fromstr(&e.sha1, "258f0e2a959a364e40ed6603d5d44fbb24765b10"));
+	cl_git_pass(git_commit_lookup(&commit, _repo, &e.sha1));
+	cl_assert_equal_i(1323847743, git_commit_time(commit));
+	git_commit_free(commit);
+
+	cl_git_pass(git_commit_graph_entry_find(&e, file, &e.sha1, GIT_OID_HEXSZ));
+	cl_assert_equal_i(0, e.commit_time);
+
+	git_array_clear(commits);
+	git_commit_graph_free(file);
+	git_buf_free(&path);
+}
+
+void test_graph_commit_graph__walks_match_without_graph(void)
+{
+	git_array_oid_t before = GIT_ARRAY_INIT, after = GIT_ARRAY_INIT;
+	git_oid base;
+	size_t i, j, ahead, behind, ahead_graph, behind_graph;
+	int expected, actual, error_before, error_after;
+	git_oid *one, *two;
+	git_buf path = GIT_BUF_INIT;
+
+	collect_commits(&before);
+
+	cl_git_pass(git_commit_graph_write(_repo));
+	commit_graph_path(&path);
+	cl_assert(git_path_isfile(path.ptr));
+
+	collect_commits(&after);
+
+	cl_assert_equal_sz(git_array_size(before), git_array_size(after));
+	cl_assert(git_array_size(before) > 0);
+
+	for (i = 0; i < git_array_size(before); i++)
+		cl_assert_equal_oid(git_array_get(before, i), git_array_get(after, i));
+
+	git_array_foreach(before, i, one) {
+		for (j = 0; j < git_array_size(before); j++) {
+			two = git_array_get(before, j);
+
+			actual = git_graph_descendant_of(_repo, one, two);
+
+			cl_git_pass(p_rename(path.ptr, "commit-graph.bak"));
+			expected = git_graph_descendant_of(_repo, one, two);
+			cl_git_pass(git_graph_ahead_behind(&ahead, &behind, _repo, one, two));
+			error_before = git_merge_base(&base, _repo, one, two);
+			cl_git_pass(p_rename("commit-graph.bak", path.ptr));
+
+			cl_assert_equal_i(expected, actual);
+
+			cl_git_pass(git_graph_ahead_behind(&ahead_graph, &behind_graph, _repo, one, two));
+			cl_assert_equal_sz(ahead, ahead_graph);
+			cl_assert_equal_sz(behind, behind_graph);
+
+			error_after = git_merge_base(&base, _repo, one, two);
+			cl_assert_equal_i(error_before, error_after);
+		}
+	}
+
+	git_array_clear(before);
+	git_array_clear(after);
+	git_buf_free(&path);
+}
@@ -0,0 +1,184 @@
+#include "clar_libgit2.h"
+#include "index.h"
+#include "fileops.h"
+#include "hash.h"
+
+#define ENTRY_COUNT 25000
+
+static git_index *g_index;
+static unsigned int g_threads;
+
+void test_index_entry_offsets__initialize(void)
+{
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_INDEX_THREADS, &g_threads));
+}
+
+void test_index_entry_offsets__cleanup(void)
+{
+	git_index_free(g_index);
+	g_index = NULL;
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_INDEX_THREADS, g_threads));
+	cl_fixture_cleanup("offsets_index");
+}
+
+static void entry_path(git_buf *path, size_t i)
+{
+	git_buf_clear(path);
+	cl_git_pass(git_buf_printf(path, "dir%02d/subdir%d/file%05d.txt",
+		(int)(i / 1000), (int)(i / 100 % 10), (int)i));
+}
+
+static void write_large_index(unsigned int version)
+{
+	git_index_entry entry;
+	git_buf path = GIT_BUF_INIT;
+	size_t i;
+
+	cl_git_pass(git_index_open(&g_index, "offsets_index"));
+	cl_git_pass(git_index_set_version(g_index, version));
+
+	for (i = 0; i < ENTRY_COUNT; i++) {
+		entry_path(&path, i);
+
+		memset(&entry, 0, sizeof(entry));
+		entry.path = path.ptr;
+		entry.mode = GIT_FILEMODE_BLOB;
+		entry.file_size = (uint32_t)i;
+		entry.id.id[0] = (unsigned char)i;
+		cl_git_pass(git_index_add(g_index, &entry));
+	}
+
+	cl_git_pass(git_index_write(g_index));
+	git_index_free(g_index);
+	g_index = NULL;
+
+	git_buf_free(&path);
+}
+
+static void check_large_index(unsigned int version)
+{
+	const git_index_entry *entry;
+	git_buf path = GIT_BUF_INIT;
+	size_t i;
+
+	cl_git_pass(git_index_open(&g_index, "offsets_index"));
+	cl_assert_equal_i(version, git_index_version(g_index));
+	cl_assert_equal_sz(ENTRY_COUNT, git_index_entrycount(g_index));
+
+	for (i = 0; i < ENTRY_COUNT; i++) {
+		entry_path(&path, i);
+
+		cl_assert((entry = git_index_get_byindex(g_index, i)) != NULL);
+		cl_assert_equal_s(path.ptr, entry->path);
+		cl_assert_equal_i(i, entry->file_size);
+		cl_assert_equal_i((unsigned char)i, entry->id.id[0]);
+		cl_assert(git_index_get_bypath(g_index, path.ptr, 0) == entry);
+	}
+
+	git_index_free(g_index);
+	g_index = NULL;
+
+	git_buf_free(&path);
+}
+
+/* Return the offset of the end of index entry extension */
+static size_t end_of_index_entry(git_buf *contents)
+{
+	size_t eoie_size = 8 + 4 + GIT_OID_RAWSZ;
+	size_t offset;
+
+	cl_assert(contents->size > GIT_OID_RAWSZ + eoie_size);
+
+	offset = contents->size - GIT_OID_RAWSZ - eoie_size;
+	cl_assert(memcmp(contents->ptr + offset, "EOIE", 4) == 0);
+
+	return offset;
+}
+
+static void assert_has_offset_table(void)
+{
+	git_buf contents = GIT_BUF_INIT;
+	uint32_t extensions;
+
+	cl_git_pass(git_futils_readbuffer(&contents, "offsets_index"));
+
+	memcpy(&extensions, contents.ptr + end_of_index_entry(&contents) + 8,
+		sizeof(extensions));
+	extensions = ntohl(extensions);
+
+	/* the offset table is the first extension */
+	cl_assert(extensions < contents.size);
+	cl_assert(memcmp(contents.ptr + extensions, "IEOT", 4) == 0);
+
+	git_buf_free(&contents);
+}
+
+static void roundtrip(unsigned int version)
+{
+	write_large_index(version);
+	assert_has_offset_table();
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_INDEX_THREADS, 1));
+	check_large_index(version);
+
+#ifdef GIT_THREADS
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_INDEX_THREADS, 4));
+	check_large_index(version);
+#endif
+}
+
+void test_index_entry_offsets__v2_roundtrip(void)
+{
+	roundtrip(2);
+}
+
+void test_index_entry_offsets__v4_roundtrip(void)
+{
+	roundtrip(4);
+}
+
+void test_index_entry_offsets__ignores_invalid_end_of_index_entry(void)
+{
+	git_buf contents = GIT_BUF_INIT;
+	git_oid checksum;
+	size_t eoie;
+
+	write_large_index(4);
+
+	/* break the hash of the extension headers, then fix the checksum */
+	cl_git_pass(git_futils_readbuffer(&contents, "offsets_index"));
+	eoie = end_of_index_entry(&contents);
+	contents.ptr[eoie + 12] ^= 0xff;
+
+	cl_git_pass(git_hash_buf(&checksum, contents.ptr, contents.size - GIT_OID_RAWSZ));
+	memcpy(contents.ptr + contents.size - GIT_OID_RAWSZ, checksum.id, GIT_OID_RAWSZ);
+	cl_git_pass(git_futils_writebuffer(&contents, "offsets_index", O_WRONLY | O_TRUNC, 0644));
+
+#ifdef GIT_THREADS
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_INDEX_THREADS, 4));
+#endif
+	check_large_index(4);
+
+	git_buf_free(&contents);
+}
+
+void test_index_entry_offsets__small_index_has_no_offset_table(void)
+{
+	git_index_entry entry;
+	git_buf contents = GIT_BUF_INIT;
+
+	cl_git_pass(git_index_open(&g_index, "offsets_index"));
+
+	memset(&entry, 0, sizeof(entry));
+	entry.path = "file.txt";
+	entry.mode = GIT_FILEMODE_BLOB;
+	cl_git_pass(git_index_add(g_index, &entry));
+	cl_git_pass(git_index_write(g_index));
+
+	cl_git_pass(git_futils_readbuffer(&contents, "offsets_index"));
+	cl_assert(contents.size < GIT_OID_RAWSZ + 32 ||
+		memcmp(contents.ptr + contents.size - GIT_OID_RAWSZ - 32, "EOIE", 4) != 0);
+
+	git_buf_free(&contents);
+}
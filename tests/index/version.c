@@ -64,6 +64,7 @@ void test_index_version__can_write_v4(void)
 	git_index_free(index);
 
 	cl_git_pass(git_repository_index(&index, g_repo));
+	cl_git_pass(git_index_read(index, true));
 	cl_assert(git_index_version(index) == 4);
 
 	for (i = 0; i < ARRAY_SIZE(paths); i++) {
@@ -4,6 +4,10 @@
 #include "path.h"
 #include "remote.h"
 
+#ifndef GIT_WIN32
+# include <sys/resource.h>
+#endif
+
 static const char* tagger_name = "Vicent Marti";
 static const char* tagger_email = "vicent@github.com";
 static const char* tagger_message = "This is my tag.\n\nThere are many tags, but this one is mine\n";
@@ -21,8 +25,19 @@ static void cleanup_local_repo(void *path)
 	cl_fixture_cleanup((char *)path);
 }
 
+#ifndef GIT_WIN32
+static struct rlimit g_nofile;
+static bool g_nofile_lowered;
+#endif
+
 void test_network_fetchlocal__cleanup(void)
 {
+#ifndef GIT_WIN32
+	if (g_nofile_lowered)
+		cl_must_pass(setrlimit(RLIMIT_NOFILE, &g_nofile));
+	g_nofile_lowered = false;
+#endif
+
 	cl_git_sandbox_cleanup();
 }
 
@@ -128,6 +143,99 @@ void assert_ref_exists(git_repository *repo, const char *name)
 	git_reference_free(ref);
 }
 
+void test_network_fetchlocal__prune_more_refs_than_open_files(void)
+{
+#ifndef GIT_WIN32
+	git_repository *repo;
+	git_remote *origin;
+	git_reference *ref;
+	git_strarray refnames = {0};
+	git_buf name = GIT_BUF_INIT;
+	git_oid id;
+	struct rlimit lowered;
+	int i;
+	git_repository *remote_repo = cl_git_sandbox_init("testrepo.git");
+	const char *url = cl_git_path_url(git_repository_path(remote_repo));
+
+	cl_set_cleanup(&cleanup_local_repo, "foo");
+	cl_git_pass(git_repository_init(&repo, "foo", true));
+
+	cl_git_pass(git_remote_create(&origin, repo, GIT_REMOTE_ORIGIN, url));
+	cl_git_pass(git_remote_fetch(origin, NULL, NULL, NULL));
+
+	cl_git_pass(git_oid_fromstr(&id, "a65fedf39aefe402d3bb6e24df4d4f5fe4547750"));
+
+	for (i = 0; i < 400; i++) {
+		git_buf_clear(&name);
+		cl_git_pass(git_buf_printf(&name, "refs/remotes/origin/stale%03d", i));
+		cl_git_pass(git_reference_create(&ref, repo, name.ptr, &id, 0, NULL));
+		git_reference_free(ref);
+	}
+
+	/* every stale reference is locked before any of them is deleted */
+	cl_must_pass(getrlimit(RLIMIT_NOFILE, &g_nofile));
+	if (g_nofile.rlim_cur == RLIM_INFINITY || g_nofile.rlim_cur > 256) {
+		lowered = g_nofile;
+		lowered.rlim_cur = 256;
+		cl_must_pass(setrlimit(RLIMIT_NOFILE, &lowered));
+		g_nofile_lowered = true;
+	}
+
+	cl_git_pass(git_remote_prune(origin, NULL));
+
+	cl_git_pass(git_reference_list(&refnames, repo));
+	cl_assert_equal_i(19, (int)refnames.count);
+	git_strarray_free(&refnames);
+
+	git_buf_free(&name);
+	git_remote_free(origin);
+	git_repository_free(repo);
+#else
+	cl_skip();
+#endif
+}
+
+void test_network_fetchlocal__new_branch_collides_with_packed(void)
+{
+	git_repository *repo;
+	git_remote *origin;
+	git_reference *ref;
+	git_refdb *refdb;
+	git_object *obj;
+	git_repository *remote_repo = cl_git_sandbox_init("testrepo.git");
+	const char *url = cl_git_path_url(git_repository_path(remote_repo));
+
+	cl_set_cleanup(&cleanup_local_repo, "foo");
+	cl_git_pass(git_repository_init(&repo, "foo", true));
+
+	cl_git_pass(git_remote_create(&origin, repo, GIT_REMOTE_ORIGIN, url));
+	cl_git_pass(git_remote_fetch(origin, NULL, NULL, NULL));
+
+	cl_git_pass(git_revparse_single(&obj, remote_repo, "master"));
+	cl_git_pass(git_reference_create(&ref, repo,
+		"refs/remotes/origin/clash", git_object_id(obj), 0, NULL));
+	git_reference_free(ref);
+
+	cl_git_pass(git_repository_refdb(&refdb, repo));
+	cl_git_pass(git_refdb_compress(refdb));
+	git_refdb_free(refdb);
+
+	/* the remote gets a branch beneath the packed one */
+	cl_git_pass(git_branch_create(&ref, remote_repo, "clash/sub", (git_commit *)obj, 0));
+	git_reference_free(ref);
+	git_object_free(obj);
+
+	cl_git_fail(git_remote_fetch(origin, NULL, NULL, NULL));
+
+	cl_git_fail_with(GIT_ENOTFOUND,
+		git_reference_lookup(&ref, repo, "refs/remotes/origin/clash/sub"));
+	cl_git_pass(git_reference_lookup(&ref, repo, "refs/remotes/origin/clash"));
+	git_reference_free(ref);
+
+	git_remote_free(origin);
+	git_repository_free(repo);
+}
+
 void test_network_fetchlocal__prune_overlapping(void)
 {
 	git_repository *repo;
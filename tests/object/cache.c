@@ -14,6 +14,7 @@ void test_object_cache__cleanup(void)
 	g_repo = NULL;
 
 	git_libgit2_opts(GIT_OPT_SET_CACHE_OBJECT_LIMIT, (int)GIT_OBJ_BLOB, (size_t)0);
+	git_libgit2_opts(GIT_OPT_SET_CACHE_MAX_SIZE, (ssize_t)(256 * 1024 * 1024));
 }
 
 static struct {
@@ -140,6 +141,162 @@ void test_object_cache__cache_no_blobs(void)
 	git_odb_free(odb);
 }
 
+void test_object_cache__eviction_keeps_accounts(void)
+{
+	int i, round;
+	ssize_t before, current, max, used_memory;
+	git_oid oid;
+	git_object *obj;
+	git_cached_obj *cached;
+	size_t s;
+
+	git_libgit2_opts(
+		GIT_OPT_SET_CACHE_OBJECT_LIMIT, (int)GIT_OBJ_BLOB, (size_t)32767);
+
+	cl_git_pass(git_repository_open(&g_repo, cl_fixture("testrepo.git")));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_CACHED_MEMORY, &before, &max));
+
+	/* with no room at all, every store evicts from its shard */
+	git_libgit2_opts(GIT_OPT_SET_CACHE_MAX_SIZE, (ssize_t)1);
+
+	for (round = 0; round < 3; round++) {
+		for (i = 0; g_data[i].sha != NULL; ++i) {
+			cl_git_pass(git_oid_fromstr(&oid, g_data[i].sha));
+			cl_git_pass(git_object_lookup(&obj, g_repo, &oid, GIT_OBJ_ANY));
+			git_object_free(obj);
+		}
+	}
+
+	cl_assert(git_cache_size(&g_repo->objects) > 0);
+
+	used_memory = 0;
+	for (s = 0; s < GIT_CACHE_SHARDS; s++) {
+		git_cache_shard *shard = &g_repo->objects.shards[s];
+		ssize_t shard_memory = 0;
+
+		git_oidmap_foreach_value(shard->map, cached, {
+			cl_assert(git_cache_shard_for(&g_repo->objects, &cached->oid) == shard);
+			shard_memory += cached->size;
+		});
+
+		cl_assert_equal_i(shard_memory, shard->used_memory);
+		used_memory += shard_memory;
+	}
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_CACHED_MEMORY, &current, &max));
+	cl_assert_equal_i(before + used_memory, current);
+
+	git_repository_free(g_repo);
+	g_repo = NULL;
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_CACHED_MEMORY, &current, &max));
+	cl_assert_equal_i(before, current);
+}
+
+void test_object_cache__counts_hits_and_misses(void)
+{
+	size_t hits, misses, evictions, new_hits, new_misses, new_evictions;
+	git_oid oid;
+	git_object *obj;
+
+	cl_git_pass(git_repository_open(&g_repo, cl_fixture("testrepo.git")));
+	cl_git_pass(git_oid_fromstr(&oid, "a65fedf39aefe402d3bb6e24df4d4f5fe4547750"));
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_CACHE_STATS,
+		&hits, &misses, &evictions));
+
+	cl_git_pass(git_object_lookup(&obj, g_repo, &oid, GIT_OBJ_ANY));
+	git_object_free(obj);
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_CACHE_STATS,
+		&new_hits, &new_misses, &new_evictions));
+	cl_assert_equal_sz(hits, new_hits);
+	cl_assert(new_misses > misses);
+
+	cl_git_pass(git_object_lookup(&obj, g_repo, &oid, GIT_OBJ_ANY));
+	git_object_free(obj);
+
+	hits = new_hits;
+	misses = new_misses;
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_CACHE_STATS,
+		&new_hits, &new_misses, &new_evictions));
+	cl_assert_equal_sz(hits + 1, new_hits);
+	cl_assert_equal_sz(misses, new_misses);
+	cl_assert_equal_sz(evictions, new_evictions);
+}
+
+static int collect_oid(const git_oid *id, void *payload)
+{
+	git_array_t(git_oid) *oids = payload;
+	git_oid *oid = git_array_alloc(*oids);
+
+	cl_assert(oid);
+	git_oid_cpy(oid, id);
+	return 0;
+}
+
+static void lookup_all(git_oid *oids, size_t count, const git_oid *skip)
+{
+	git_object *obj;
+	size_t i;
+
+	for (i = 0; i < count; i++) {
+		if (skip && git_oid_equal(&oids[i], skip))
+			continue;
+
+		cl_git_pass(git_object_lookup(&obj, g_repo, &oids[i], GIT_OBJ_ANY));
+		git_object_free(obj);
+	}
+}
+
+void test_object_cache__keeps_frequently_used_objects(void)
+{
+	git_array_t(git_oid) oids = GIT_ARRAY_INIT;
+	ssize_t before, after, max;
+	size_t i, hits, misses, evictions, new_evictions;
+	git_oid hot;
+	git_object *obj;
+	git_odb *odb;
+
+	cl_git_pass(git_oid_fromstr(&hot, "f1425cef211cc08caa31e7b545ffb232acb098c3"));
+
+	/* see how much the commits and trees take up in the cache */
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_CACHED_MEMORY, &before, &max));
+	cl_git_pass(git_repository_open(&g_repo, cl_fixture("testrepo.git")));
+	cl_git_pass(git_repository_odb(&odb, g_repo));
+	cl_git_pass(git_odb_foreach(odb, collect_oid, &oids));
+	git_odb_free(odb);
+
+	lookup_all(oids.ptr, oids.size, NULL);
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_CACHED_MEMORY, &after, &max));
+	git_repository_free(g_repo);
+
+	/* and only give it a quarter of that */
+	git_libgit2_opts(GIT_OPT_SET_CACHE_MAX_SIZE, before + (after - before) / 4);
+	cl_git_pass(git_repository_open(&g_repo, cl_fixture("testrepo.git")));
+
+	for (i = 0; i < 100; i++) {
+		cl_git_pass(git_object_lookup(&obj, g_repo, &hot, GIT_OBJ_TREE));
+		git_object_free(obj);
+	}
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_CACHE_STATS,
+		&hits, &misses, &evictions));
+
+	/* objects looked up once and again don't push the hot tree out */
+	lookup_all(oids.ptr, oids.size, &hot);
+	lookup_all(oids.ptr, oids.size, &hot);
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_CACHE_STATS,
+		&hits, &misses, &new_evictions));
+	cl_assert(new_evictions > evictions);
+
+	cl_assert((obj = git_cache_get_parsed(&g_repo->objects, &hot)) != NULL);
+	git_object_free(obj);
+
+	git_array_clear(oids);
+}
+
 static void *cache_parsed(void *arg)
 {
 	int i;
@@ -0,0 +1,93 @@
+#include "clar_libgit2.h"
+#include "fileops.h"
+#include "git2/sys/odb_backend.h"
+
+#define PACK_A "pack-a81e489679b7d3418f9ab594bda8ceb37dd4c695"
+#define ID_A "001d938dbe69b6251f4a03cf374235c72fd0a0d2"
+#define PACK_B "pack-d85f5d483273108c9d8dd0e4728ccf0b2982423a"
+#define ID_B "0266163a49e280c4f5ed1e08facd36a2bd716bcf"
+
+static git_odb *g_odb;
+
+void test_odb_packrefresh__initialize(void)
+{
+	git_odb_backend *backend;
+
+	cl_git_pass(git_futils_mkdir("packrefresh/pack", 0777, GIT_MKDIR_PATH));
+
+	cl_git_pass(git_odb_new(&g_odb));
+	cl_git_pass(git_odb_backend_pack(&backend, "packrefresh"));
+	cl_git_pass(git_odb_add_backend(g_odb, backend, 1));
+}
+
+void test_odb_packrefresh__cleanup(void)
+{
+	git_odb_free(g_odb);
+	cl_fixture_cleanup("packrefresh");
+}
+
+static void add_pack(const char *name)
+{
+	git_buf from = GIT_BUF_INIT, to = GIT_BUF_INIT;
+
+	cl_git_pass(git_buf_printf(&from, "%s/objects/pack/%s.pack",
+		cl_fixture("testrepo.git"), name));
+	cl_git_pass(git_buf_printf(&to, "packrefresh/pack/%s.pack", name));
+	cl_git_pass(git_futils_cp(from.ptr, to.ptr, 0444));
+
+	git_buf_truncate(&from, from.size - strlen("pack"));
+	git_buf_truncate(&to, to.size - strlen("pack"));
+	cl_git_pass(git_buf_puts(&from, "idx"));
+	cl_git_pass(git_buf_puts(&to, "idx"));
+	cl_git_pass(git_futils_cp(from.ptr, to.ptr, 0444));
+
+	git_buf_free(&from);
+	git_buf_free(&to);
+}
+
+/* Make the pack folder look like it was last changed a while ago */
+static void age_pack_folder(int seconds)
+{
+	struct p_timeval times[2];
+
+	times[0].tv_sec = times[1].tv_sec = time(NULL) - seconds;
+	times[0].tv_usec = times[1].tv_usec = 0;
+
+	cl_must_pass(p_utimes("packrefresh/pack", times));
+}
+
+static bool exists(const char *str)
+{
+	git_oid id;
+
+	cl_git_pass(git_oid_fromstr(&id, str));
+	return git_odb_exists(g_odb, &id);
+}
+
+void test_odb_packrefresh__finds_packs_added_right_after_reading(void)
+{
+	cl_assert(!exists(ID_A));
+
+	add_pack(PACK_A);
+	cl_assert(exists(ID_A));
+
+	add_pack(PACK_B);
+	cl_assert(exists(ID_B));
+}
+
+void test_odb_packrefresh__finds_packs_added_later(void)
+{
+	age_pack_folder(60);
+	cl_assert(!exists(ID_A));
+
+	/* the folder is not read again, as it didn't change */
+	cl_assert(!exists(ID_B));
+
+	add_pack(PACK_A);
+	age_pack_folder(30);
+	cl_assert(exists(ID_A));
+	cl_assert(!exists(ID_B));
+
+	add_pack(PACK_B);
+	cl_assert(exists(ID_B));
+}
@@ -0,0 +1,116 @@
+#include "clar_libgit2.h"
+#include "odb_prefetch.h"
+#include "repository.h"
+#include "tree.h"
+
+#define SUBTREES_TREE "ae90f12eea699729ed24555e40b9fd669da12a12"
+#define SUBTREE_AB "f1425cef211cc08caa31e7b545ffb232acb098c3"
+
+static git_repository *_repo;
+
+void test_odb_prefetch__initialize(void)
+{
+#ifndef GIT_THREADS
+	cl_skip();
+#endif
+
+	_repo = cl_git_sandbox_init("testrepo.git");
+	cl_git_pass(git_libgit2_opts(GIT_OPT_ENABLE_ODB_PREFETCH, 1));
+}
+
+void test_odb_prefetch__cleanup(void)
+{
+#ifdef GIT_THREADS
+	cl_git_pass(git_libgit2_opts(GIT_OPT_ENABLE_ODB_PREFETCH, 0));
+	cl_git_sandbox_cleanup();
+#endif
+}
+
+static bool is_cached(const char *str)
+{
+	git_odb_object *object;
+	git_oid id;
+
+	cl_git_pass(git_oid_fromstr(&id, str));
+
+	if ((object = git_cache_get_raw(&_repo->objects, &id)) == NULL)
+		return false;
+
+	git_odb_object_free(object);
+	return true;
+}
+
+void test_odb_prefetch__reads_subtrees_into_the_cache(void)
+{
+	git_odb_prefetch *prefetch;
+	git_tree *tree;
+	git_oid id;
+
+	cl_git_pass(git_oid_fromstr(&id, SUBTREES_TREE));
+	cl_git_pass(git_tree_lookup(&tree, _repo, &id));
+	cl_assert(!is_cached(SUBTREE_AB));
+
+	cl_git_pass(git_odb_prefetch_new(&prefetch, _repo));
+	cl_assert(prefetch != NULL);
+
+	git_odb_prefetch_subtrees(prefetch, tree);
+	git_odb_prefetch_wait(prefetch);
+	cl_assert(is_cached(SUBTREE_AB));
+
+	git_odb_prefetch_free(prefetch);
+	git_tree_free(tree);
+}
+
+void test_odb_prefetch__is_disabled_by_default(void)
+{
+	git_odb_prefetch *prefetch;
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_ENABLE_ODB_PREFETCH, 0));
+	cl_git_pass(git_odb_prefetch_new(&prefetch, _repo));
+	cl_assert(prefetch == NULL);
+
+	/* a NULL prefetcher does nothing */
+	git_odb_prefetch_subtrees(prefetch, NULL);
+	git_odb_prefetch_wait(prefetch);
+	git_odb_prefetch_free(prefetch);
+}
+
+static int count_entries(const char *root, const git_tree_entry *entry, void *payload)
+{
+	GIT_UNUSED(root);
+	GIT_UNUSED(entry);
+
+	(*(size_t *)payload)++;
+	return 0;
+}
+
+void test_odb_prefetch__walks_the_same_entries(void)
+{
+	git_commit *commit;
+	git_tree *tree;
+	git_revwalk *walk;
+	git_oid id;
+	size_t with = 0, without = 0;
+
+	cl_git_pass(git_revwalk_new(&walk, _repo));
+	cl_git_pass(git_revwalk_push_glob(walk, "refs/*"));
+
+	while (git_revwalk_next(&id, walk) == 0) {
+		cl_git_pass(git_commit_lookup(&commit, _repo, &id));
+		cl_git_pass(git_commit_tree(&tree, commit));
+
+		cl_git_pass(git_tree_walk(tree, GIT_TREEWALK_PRE, count_entries, &with));
+
+		cl_git_pass(git_libgit2_opts(GIT_OPT_ENABLE_ODB_PREFETCH, 0));
+		cl_git_pass(git_tree_walk(tree, GIT_TREEWALK_PRE, count_entries, &without));
+		cl_git_pass(git_libgit2_opts(GIT_OPT_ENABLE_ODB_PREFETCH, 1));
+
+		git_tree_free(tree);
+		git_commit_free(commit);
+	}
+
+	cl_assert(with > 0);
+	cl_assert_equal_sz(without, with);
+
+	git_revwalk_free(walk);
+}
@@ -0,0 +1,192 @@
+#include "clar_libgit2.h"
+#include "array.h"
+#include "odb.h"
+#include "backend/backend_helpers.h"
+
+#define MISSING_ID "1234567890123456789012345678901234567890"
+
+typedef git_array_t(git_oid) oid_array;
+
+static git_repository *_repo;
+static git_odb *_odb;
+
+typedef struct {
+	size_t read;
+	size_t missing;
+	int stop_after;
+} read_counts;
+
+void test_odb_readmany__initialize(void)
+{
+	_repo = cl_git_sandbox_init("testrepo.git");
+	cl_git_pass(git_repository_odb(&_odb, _repo));
+}
+
+void test_odb_readmany__cleanup(void)
+{
+	git_odb_free(_odb);
+	_odb = NULL;
+	cl_git_sandbox_cleanup();
+}
+
+static int append_id(const git_oid *id, void *payload)
+{
+	oid_array *ids = payload;
+	git_oid *out = git_array_alloc(*ids);
+
+	GITERR_CHECK_ALLOC(out);
+	git_oid_cpy(out, id);
+	return 0;
+}
+
+static int check_object(const git_oid *id, git_odb_object *object, void *payload)
+{
+	read_counts *counts = payload;
+	git_odb_object *expected;
+
+	if (object == NULL) {
+		counts->missing++;
+		return 0;
+	}
+
+	cl_git_pass(git_odb_read(&expected, _odb, id));
+	cl_assert_equal_oid(id, git_odb_object_id(object));
+	cl_assert_equal_i(git_odb_object_type(expected), git_odb_object_type(object));
+	cl_assert_equal_sz(git_odb_object_size(expected), git_odb_object_size(object));
+	cl_assert(memcmp(git_odb_object_data(expected), git_odb_object_data(object),
+		git_odb_object_size(object)) == 0);
+	git_odb_object_free(expected);
+
+	if (++counts->read == (size_t)counts->stop_after)
+		return -42;
+
+	return 0;
+}
+
+void test_odb_readmany__reads_loose_and_packed_objects(void)
+{
+	oid_array ids = GIT_ARRAY_INIT;
+	read_counts counts = {0};
+
+	cl_git_pass(git_odb_foreach(_odb, append_id, &ids));
+	cl_assert(git_array_size(ids) > 0);
+
+	cl_git_pass(git_odb_read_many(_odb, ids.ptr, git_array_size(ids),
+		check_object, &counts));
+
+	cl_assert_equal_sz(git_array_size(ids), counts.read);
+	cl_assert_equal_sz(0, counts.missing);
+
+	/* the objects are all in the cache the second time around */
+	memset(&counts, 0, sizeof(counts));
+	cl_git_pass(git_odb_read_many(_odb, ids.ptr, git_array_size(ids),
+		check_object, &counts));
+	cl_assert_equal_sz(git_array_size(ids), counts.read);
+
+	git_array_clear(ids);
+}
+
+void test_odb_readmany__reports_missing_objects(void)
+{
+	git_oid ids[4];
+	read_counts counts = {0};
+
+	/* packed, missing, loose, and the hardcoded empty tree */
+	cl_git_pass(git_oid_fromstr(&ids[0], "41bc8c69075bbdb46c5c6f0566cc8cc5b46e8bd9"));
+	cl_git_pass(git_oid_fromstr(&ids[1], MISSING_ID));
+	cl_git_pass(git_oid_fromstr(&ids[2], "a8233120f6ad708f843d861ce2b7228ec4e3dec6"));
+	cl_git_pass(git_oid_fromstr(&ids[3], "4b825dc642cb6eb9a060e54bf8d69288fbee4904"));
+
+	cl_git_pass(git_odb_read_many(_odb, ids, 4, check_object, &counts));
+
+	cl_assert_equal_sz(3, counts.read);
+	cl_assert_equal_sz(1, counts.missing);
+}
+
+void test_odb_readmany__reads_nothing(void)
+{
+	read_counts counts = {0};
+
+	cl_git_pass(git_odb_read_many(_odb, NULL, 0, check_object, &counts));
+	cl_assert_equal_sz(0, counts.read + counts.missing);
+}
+
+void test_odb_readmany__stops_when_the_callback_fails(void)
+{
+	oid_array ids = GIT_ARRAY_INIT;
+	read_counts counts = {0};
+
+	counts.stop_after = 2;
+
+	cl_git_pass(git_odb_foreach(_odb, append_id, &ids));
+	cl_assert_equal_i(-42, git_odb_read_many(_odb, ids.ptr,
+		git_array_size(ids), check_object, &counts));
+	cl_assert_equal_sz(2, counts.read);
+
+	git_array_clear(ids);
+}
+
+typedef struct {
+	size_t calls;
+	size_t ids;
+} read_many_calls;
+
+static read_many_calls _read_many_calls;
+
+static int fake_read_many(
+	git_odb_backend *backend, const git_oid *ids, size_t count,
+	git_odb_backend_read_cb cb, void *payload)
+{
+	void *data;
+	size_t i, len;
+	git_otype type;
+	int error;
+
+	_read_many_calls.calls++;
+	_read_many_calls.ids += count;
+
+	/* give the objects back in reverse, the odb shouldn't mind */
+	for (i = count; i > 0; i--) {
+		error = backend->read(&data, &len, &type, backend, &ids[i - 1]);
+
+		if (error == GIT_ENOTFOUND)
+			continue;
+		if (error < 0 || (error = cb(i - 1, data, len, type, payload)) != 0)
+			return error;
+	}
+
+	return 0;
+}
+
+void test_odb_readmany__uses_the_read_many_of_backends(void)
+{
+	char foo_id[GIT_OID_HEXSZ + 1], bar_id[GIT_OID_HEXSZ + 1];
+	fake_object objs[3] = {{ NULL }};
+	git_odb_backend *backend;
+	git_oid ids[4];
+	read_counts counts = {0};
+
+	cl_git_pass(git_odb_hash(&ids[0], "foo", 3, GIT_OBJ_BLOB));
+	cl_git_pass(git_odb_hash(&ids[1], "bar", 3, GIT_OBJ_BLOB));
+	cl_git_pass(git_oid_fromstr(&ids[2], "a65fedf39aefe402d3bb6e24df4d4f5fe4547750"));
+	cl_git_pass(git_oid_fromstr(&ids[3], MISSING_ID));
+
+	objs[0].oid = git_oid_tostr(foo_id, sizeof(foo_id), &ids[0]);
+	objs[0].content = "foo";
+	objs[1].oid = git_oid_tostr(bar_id, sizeof(bar_id), &ids[1]);
+	objs[1].content = "bar";
+
+	cl_git_pass(build_fake_backend(&backend, objs));
+	backend->read_many = fake_read_many;
+	cl_git_pass(git_odb_add_backend(_odb, backend, 10));
+
+	memset(&_read_many_calls, 0, sizeof(_read_many_calls));
+	cl_git_pass(git_odb_read_many(_odb, ids, 4, check_object, &counts));
+
+	cl_assert_equal_sz(3, counts.read);
+	cl_assert_equal_sz(1, counts.missing);
+
+	/* the backend can't refresh, so it is asked only once */
+	cl_assert_equal_sz(1, _read_many_calls.calls);
+	cl_assert_equal_sz(4, _read_many_calls.ids);
+}
@@ -0,0 +1,206 @@
+#include "clar_libgit2.h"
+
+#include "ewah.h"
+#include "fileops.h"
+#include "pack-bitmap.h"
+#include "pack-objects.h"
+#include "repository.h"
+
+static git_repository *_repo;
+
+void test_pack_bitmap__initialize(void)
+{
+	_repo = cl_git_sandbox_init("testrepo.git");
+}
+
+void test_pack_bitmap__cleanup(void)
+{
+	cl_git_sandbox_cleanup();
+	_repo = NULL;
+}
+
+static void bitmap_path(git_buf *out, const git_oid *pack_id)
+{
+	char hex[GIT_OID_HEXSZ + 1];
+
+	git_oid_tostr(hex, sizeof(hex), pack_id);
+	cl_git_pass(git_buf_printf(out, "%s/objects/pack/pack-%s.bitmap",
+		git_repository_path(_repo), hex));
+}
+
+static void write_pack(git_oid *out, const char *push, const char *hide)
+{
+	git_buf path = GIT_BUF_INIT;
+	git_packbuilder *pb;
+	git_revwalk *walk;
+	git_odb *odb;
+
+	cl_git_pass(git_packbuilder_new(&pb, _repo));
+	cl_git_pass(git_revwalk_new(&walk, _repo));
+
+	if (push)
+		cl_git_pass(git_revwalk_push_ref(walk, push));
+	else
+		cl_git_pass(git_revwalk_push_glob(walk, "*"));
+
+	if (hide)
+		cl_git_pass(git_revwalk_hide_ref(walk, hide));
+
+	cl_git_pass(git_packbuilder_insert_walk(pb, walk));
+
+	cl_git_pass(git_buf_joinpath(&path,
+		git_repository_path(_repo), "objects/pack"));
+	cl_git_pass(git_packbuilder_write(pb, path.ptr, 0, NULL, NULL));
+	git_oid_cpy(out, git_packbuilder_hash(pb));
+
+	cl_git_pass(git_repository_odb__weakptr(&odb, _repo));
+	cl_git_pass(git_odb_refresh(odb));
+
+	git_revwalk_free(walk);
+	git_packbuilder_free(pb);
+	git_buf_free(&path);
+}
+
+static int oid_cmp(const void *a, const void *b)
+{
+	return git_oid_cmp(a, b);
+}
+
+static size_t collect_objects(git_oid **out, const char *push, const char *hide)
+{
+	git_packbuilder *pb;
+	git_revwalk *walk;
+	git_oid *ids;
+	size_t i, count;
+
+	cl_git_pass(git_packbuilder_new(&pb, _repo));
+	cl_git_pass(git_revwalk_new(&walk, _repo));
+
+	cl_git_pass(git_revwalk_push_ref(walk, push));
+	if (hide)
+		cl_git_pass(git_revwalk_hide_ref(walk, hide));
+
+	cl_git_pass(git_packbuilder_insert_walk(pb, walk));
+
+	count = git_packbuilder_object_count(pb);
+	ids = git__calloc(count, sizeof(git_oid));
+	cl_assert(ids);
+
+	for (i = 0; i < count; i++)
+		git_oid_cpy(&ids[i], &pb->object_list[i].id);
+
+	qsort(ids, count, sizeof(git_oid), oid_cmp);
+
+	git_revwalk_free(walk);
+	git_packbuilder_free(pb);
+
+	*out = ids;
+	return count;
+}
+
+void test_pack_bitmap__ewah_roundtrip(void)
+{
+	git_bitmap bitmap = GIT_BITMAP_INIT, read = GIT_BITMAP_INIT;
+	git_buf buf = GIT_BUF_INIT;
+	git_ewah ewah;
+	size_t i, consumed;
+
+	/* a literal, a run of zeroes, a run of ones and a last literal */
+	cl_git_pass(git_bitmap_set(&bitmap, 3));
+	for (i = 64 * 10; i < 64 * 13; i++)
+		cl_git_pass(git_bitmap_set(&bitmap, i));
+	cl_git_pass(git_bitmap_set(&bitmap, 64 * 13 + 5));
+
+	cl_git_pass(git_ewah_serialize(&buf, &bitmap));
+	cl_git_pass(git_ewah_parse(&ewah, &consumed,
+		(const unsigned char *)buf.ptr, buf.size));
+
+	cl_assert_equal_sz(buf.size, consumed);
+	cl_assert_equal_i(64 * 13 + 6, ewah.bit_size);
+
+	cl_git_pass(git_ewah_or(&read, &ewah));
+	cl_assert_equal_sz(git_bitmap_popcount(&bitmap), git_bitmap_popcount(&read));
+
+	for (i = 0; i < 64 * 14; i++)
+		cl_assert_equal_b(git_bitmap_get(&bitmap, i), git_bitmap_get(&read, i));
+
+	/* xor-ing the same bitmap back in clears it */
+	cl_git_pass(git_ewah_xor(&read, &ewah));
+	cl_assert_equal_sz(0, git_bitmap_popcount(&read));
+
+	cl_git_fail(git_ewah_parse(&ewah, &consumed,
+		(const unsigned char *)buf.ptr, buf.size - 1));
+
+	git_bitmap_free(&bitmap);
+	git_bitmap_free(&read);
+	git_buf_free(&buf);
+}
+
+void test_pack_bitmap__bitmap_walk_matches_tree_walk(void)
+{
+	git_buf path = GIT_BUF_INIT;
+	git_oid pack_id, *walked, *bitmapped;
+	size_t walked_count, bitmapped_count;
+	git_pack_bitmap *bitmap;
+	git_odb *odb;
+
+	cl_repo_set_bool(_repo, "pack.writeBitmaps", true);
+	write_pack(&pack_id, NULL, NULL);
+
+	bitmap_path(&path, &pack_id);
+	cl_assert(git_path_exists(path.ptr));
+
+	cl_git_pass(git_repository_odb__weakptr(&odb, _repo));
+	cl_git_pass(git_pack_bitmap_find(&bitmap, odb));
+	git_pack_bitmap_free(bitmap);
+
+	bitmapped_count = collect_objects(&bitmapped, "refs/heads/master", NULL);
+
+	cl_repo_set_bool(_repo, "pack.useBitmaps", false);
+	walked_count = collect_objects(&walked, "refs/heads/master", NULL);
+
+	cl_assert_equal_sz(walked_count, bitmapped_count);
+	cl_assert(!memcmp(walked, bitmapped, walked_count * sizeof(git_oid)));
+
+	git__free(walked);
+	git__free(bitmapped);
+	git_buf_free(&path);
+}
+
+void test_pack_bitmap__hidden_commits_are_excluded(void)
+{
+	git_oid pack_id, *all, *some;
+	size_t all_count, some_count, i, j;
+
+	cl_repo_set_bool(_repo, "pack.writeBitmaps", true);
+	write_pack(&pack_id, NULL, NULL);
+
+	all_count = collect_objects(&all, "refs/heads/master", NULL);
+	some_count = collect_objects(&some, "refs/heads/master", "refs/heads/br2");
+
+	cl_assert(some_count > 0);
+	cl_assert(some_count < all_count);
+
+	for (i = 0, j = 0; i < some_count; i++) {
+		while (j < all_count && git_oid_cmp(&all[j], &some[i]) < 0)
+			j++;
+		cl_assert(j < all_count && git_oid_equal(&all[j], &some[i]));
+	}
+
+	git__free(all);
+	git__free(some);
+}
+
+void test_pack_bitmap__partial_pack_has_no_bitmap(void)
+{
+	git_buf path = GIT_BUF_INIT;
+	git_oid pack_id;
+
+	cl_repo_set_bool(_repo, "pack.writeBitmaps", true);
+	write_pack(&pack_id, "refs/heads/master", "refs/heads/br2");
+
+	bitmap_path(&path, &pack_id);
+	cl_assert(!git_path_exists(path.ptr));
+
+	git_buf_free(&path);
+}
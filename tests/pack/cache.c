@@ -0,0 +1,113 @@
+#include "clar_libgit2.h"
+#include "odb.h"
+#include "pack.h"
+
+#define PACK "testrepo.git/objects/pack/pack-a81e489679b7d3418f9ab594bda8ceb37dd4c695.idx"
+
+static struct git_pack_file *g_pack;
+static git_array_t(git_oid) g_oids;
+static size_t g_limit;
+
+static int collect_oid(const git_oid *id, void *payload)
+{
+	git_oid *oid = git_array_alloc(g_oids);
+
+	GIT_UNUSED(payload);
+
+	cl_assert(oid);
+	git_oid_cpy(oid, id);
+	return 0;
+}
+
+void test_pack_cache__initialize(void)
+{
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_PACK_CACHE_MAX_SIZE, &g_limit));
+	cl_git_pass(git_packfile_alloc(&g_pack, cl_fixture(PACK)));
+	cl_git_pass(git_pack_foreach_entry(g_pack, collect_oid, NULL));
+}
+
+void test_pack_cache__cleanup(void)
+{
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_PACK_CACHE_MAX_SIZE, g_limit));
+	git_packfile_free(g_pack);
+	git_array_clear(g_oids);
+}
+
+/* The entries on the clock are the ones in the map, and add up */
+static void assert_cache_consistent(git_pack_cache *cache)
+{
+	git_pack_cache_entry *entry;
+	size_t count = 0, memory = 0;
+
+	if ((entry = cache->hand) != NULL) {
+		do {
+			cl_assert(entry->next->prev == entry);
+			cl_assert(git_offmap_exists(cache->entries, entry->offset));
+			cl_assert(entry->credit <= GIT_PACK_CACHE_MAX_CREDIT);
+			cl_assert_equal_i(0, entry->refcount.val);
+			memory += entry->raw.len;
+			count++;
+		} while ((entry = entry->next) != cache->hand);
+	}
+
+	cl_assert_equal_sz(git_offmap_num_entries(cache->entries), count);
+	cl_assert_equal_sz(cache->memory_used, memory);
+}
+
+static void unpack_all(size_t limit)
+{
+	struct git_pack_entry e;
+	git_rawobj raw;
+	git_oid id;
+	size_t i;
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_PACK_CACHE_MAX_SIZE, limit));
+
+	for (i = 0; i < git_array_size(g_oids); i++) {
+		git_oid *expected = git_array_get(g_oids, i);
+
+		cl_git_pass(git_pack_entry_find(&e, g_pack, expected, GIT_OID_HEXSZ));
+		cl_git_pass(git_packfile_unpack(&raw, g_pack, &e.offset));
+
+		cl_git_pass(git_odb_hash(&id, raw.data, raw.len, raw.type));
+		cl_assert_equal_oid(expected, &id);
+		git__free(raw.data);
+
+		assert_cache_consistent(&g_pack->bases);
+	}
+
+	cl_assert(g_pack->bases.memory_used <= limit);
+}
+
+void test_pack_cache__stays_within_the_limit(void)
+{
+	unpack_all(16 * 1024);
+	cl_assert(git_offmap_num_entries(g_pack->bases.entries) > 0);
+
+	/* bases cached before the limit was lowered get evicted */
+	unpack_all(2 * 1024);
+	unpack_all(GIT_PACK_CACHE_MEMORY_LIMIT);
+}
+
+void test_pack_cache__can_be_disabled(void)
+{
+	unpack_all(0);
+	cl_assert_equal_sz(0, git_offmap_num_entries(g_pack->bases.entries));
+}
+
+void test_pack_cache__remembers_the_depth_of_bases(void)
+{
+	git_pack_cache_entry *entry;
+	unsigned int deepest = 0;
+
+	unpack_all(GIT_PACK_CACHE_MEMORY_LIMIT);
+
+	git_offmap_foreach_value(g_pack->bases.entries, entry, {
+		cl_assert_equal_i(
+			min(entry->depth + 1, GIT_PACK_CACHE_MAX_CREDIT), entry->credit);
+		deepest = max(deepest, entry->depth);
+	});
+
+	/* the pack has delta chains which are deeper than this */
+	cl_assert(deepest >= GIT_PACK_CACHE_MAX_CREDIT);
+}
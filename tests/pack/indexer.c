@@ -60,6 +60,76 @@ void test_pack_indexer__out_of_order(void)
 	git_indexer_free(idx);
 }
 
+void test_pack_indexer__out_of_order_threaded(void)
+{
+	git_indexer *idx = 0;
+	git_transfer_progress stats = { 0 };
+
+	cl_git_pass(git_indexer_new(&idx, ".", 0, NULL, NULL, NULL));
+	git_indexer_set_threads(idx, 4);
+	cl_git_pass(git_indexer_append(
+		idx, out_of_order_pack, out_of_order_pack_len, &stats));
+	cl_git_pass(git_indexer_commit(idx, &stats));
+
+	cl_assert_equal_i(stats.total_objects, 3);
+	cl_assert_equal_i(stats.received_objects, 3);
+	cl_assert_equal_i(stats.indexed_objects, 3);
+	cl_assert_equal_i(stats.indexed_deltas, 2);
+
+	git_indexer_free(idx);
+}
+
+static void index_fixture_pack(
+	git_buf *idx_out, unsigned int threads, git_transfer_progress *stats)
+{
+	git_indexer *idx = NULL;
+	git_buf pack = GIT_BUF_INIT, path = GIT_BUF_INIT;
+	char hash[GIT_OID_HEXSZ + 1] = {0};
+
+	cl_git_pass(git_futils_readbuffer(&pack, cl_fixture(
+		"testrepo.git/objects/pack/pack-a81e489679b7d3418f9ab594bda8ceb37dd4c695.pack")));
+
+	cl_git_pass(git_indexer_new(&idx, ".", 0, NULL, NULL, NULL));
+	git_indexer_set_threads(idx, threads);
+	cl_git_pass(git_indexer_append(idx, pack.ptr, pack.size, stats));
+	cl_git_pass(git_indexer_commit(idx, stats));
+
+	git_oid_fmt(hash, git_indexer_hash(idx));
+	git_indexer_free(idx);
+
+	cl_git_pass(git_buf_printf(&path, "pack-%s.idx", hash));
+	cl_git_pass(git_futils_readbuffer(idx_out, path.ptr));
+	cl_must_pass(p_unlink(path.ptr));
+
+	git_buf_clear(&path);
+	cl_git_pass(git_buf_printf(&path, "pack-%s.pack", hash));
+	cl_must_pass(p_unlink(path.ptr));
+
+	git_buf_free(&path);
+	git_buf_free(&pack);
+}
+
+void test_pack_indexer__threaded_index_matches_serial(void)
+{
+	git_transfer_progress serial = { 0 }, threaded = { 0 };
+	git_buf expected = GIT_BUF_INIT, actual = GIT_BUF_INIT;
+
+	index_fixture_pack(&expected, 1, &serial);
+	index_fixture_pack(&actual, 8, &threaded);
+
+	cl_assert(serial.total_deltas > 0);
+	cl_assert_equal_i(serial.total_objects, threaded.total_objects);
+	cl_assert_equal_i(serial.indexed_objects, threaded.indexed_objects);
+	cl_assert_equal_i(serial.total_deltas, threaded.total_deltas);
+	cl_assert_equal_i(serial.indexed_deltas, threaded.indexed_deltas);
+
+	cl_assert_equal_sz(expected.size, actual.size);
+	cl_assert(memcmp(expected.ptr, actual.ptr, expected.size) == 0);
+
+	git_buf_free(&expected);
+	git_buf_free(&actual);
+}
+
 void test_pack_indexer__fix_thin(void)
 {
 	git_indexer *idx = NULL;
@@ -0,0 +1,143 @@
+#include "clar_libgit2.h"
+
+#include "midx.h"
+#include "odb.h"
+#include "pack.h"
+#include "repository.h"
+
+static git_repository *_repo;
+
+void test_pack_midx__initialize(void)
+{
+	_repo = cl_git_sandbox_init("testrepo.git");
+}
+
+void test_pack_midx__cleanup(void)
+{
+	cl_git_sandbox_cleanup();
+	_repo = NULL;
+}
+
+static void midx_path(git_buf *path)
+{
+	cl_git_pass(git_buf_joinpath(path,
+		git_repository_path(_repo), "objects/pack/" GIT_MIDX_FILE));
+}
+
+static int check_pack_entry(struct git_pack_file *p, void *payload)
+{
+	git_midx_file *idx = payload;
+	const char *name, *base = strrchr(p->pack_name, '/') + 1;
+	git_midx_entry e;
+	git_off_t offset;
+	git_oid id;
+	uint32_t i, count;
+
+	cl_assert(git_midx_contains_pack(idx, p->pack_name));
+	cl_git_pass(git_pack_entry_count(&count, p));
+
+	for (i = 0; i < count; i++) {
+		cl_git_pass(git_pack_nth_entry_oid(&id, p, i));
+		cl_git_pass(git_pack_nth_entry_offset(&offset, p, i));
+		cl_git_pass(git_midx_entry_find(&e, idx, &id, GIT_OID_HEXSZ));
+
+		cl_assert_equal_oid(&id, &e.sha1);
+
+		/* testrepo's packs don't share any objects */
+		name = git_vector_get(&idx->packfile_names, e.pack_index);
+		cl_assert(!strncmp(name, base, strlen(base) - strlen(".pack")));
+		cl_assert_equal_i(offset, e.offset);
+	}
+
+	return 0;
+}
+
+void test_pack_midx__parse_written_file(void)
+{
+	git_buf path = GIT_BUF_INIT;
+	git_midx_file *idx;
+	git_midx_entry e;
+	git_odb *odb;
+	git_oid id;
+
+	cl_git_pass(git_repository_odb__weakptr(&odb, _repo));
+	cl_git_pass(git_odb_write_multi_pack_index(odb));
+
+	midx_path(&path);
+	cl_git_pass(git_midx_open(&idx, path.ptr));
+	cl_assert_equal_i(3, idx->num_packfiles);
+	cl_assert(!git_midx_contains_pack(idx, "pack-0000000000000000000000000000000000000000.pack"));
+
+	cl_git_pass(git_odb__foreach_pack(odb, check_pack_entry, idx));
+
+	cl_git_pass(git_oid_fromstr(&id, "5001298e0c09ad9c34e4249bc5801c75e9754fa5"));
+	cl_git_pass(git_midx_entry_find(&e, idx, &id, GIT_OID_HEXSZ));
+	cl_git_pass(git_midx_entry_find(&e, idx, &id, 7));
+	cl_assert_equal_oid(&id, &e.sha1);
+
+	cl_git_pass(git_oid_fromstr(&id, "0000000000000000000000000000000000000000"));
+	cl_assert_equal_i(GIT_ENOTFOUND, git_midx_entry_find(&e, idx, &id, GIT_OID_HEXSZ));
+
+	cl_assert(!git_midx_needs_refresh(idx, path.ptr));
+
+	git_midx_free(idx);
+	git_buf_free(&path);
+}
+
+void test_pack_midx__lookup_through_index(void)
+{
+	git_repository *repo;
+	git_odb *odb;
+	git_odb_object *obj;
+	git_object *object;
+	git_oid id, found;
+	size_t len;
+	git_otype type;
+
+	cl_git_pass(git_repository_odb__weakptr(&odb, _repo));
+	cl_git_pass(git_odb_write_multi_pack_index(odb));
+
+	/* a fresh repository picks the index up when loading the packs */
+	cl_git_pass(git_repository_open(&repo, git_repository_path(_repo)));
+	cl_git_pass(git_repository_odb__weakptr(&odb, repo));
+
+	cl_git_pass(git_oid_fromstr(&id, "5001298e0c09ad9c34e4249bc5801c75e9754fa5"));
+	cl_assert(git_odb_exists(odb, &id));
+	cl_git_pass(git_odb_read(&obj, odb, &id));
+	cl_assert_equal_i(GIT_OBJ_COMMIT, git_odb_object_type(obj));
+	git_odb_object_free(obj);
+
+	cl_git_pass(git_odb_read_header(&len, &type, odb, &id));
+	cl_assert_equal_i(GIT_OBJ_COMMIT, type);
+
+	cl_git_pass(git_odb_exists_prefix(&found, odb, &id, 8));
+	cl_assert_equal_oid(&id, &found);
+
+	cl_git_pass(git_revparse_single(&object, repo, "a65fedf"));
+	git_object_free(object);
+
+	cl_git_pass(git_oid_fromstr(&id, "0000000000000000000000000000000000000000"));
+	cl_assert(!git_odb_exists(odb, &id));
+
+	git_repository_free(repo);
+}
+
+void test_pack_midx__corrupt_file_is_ignored(void)
+{
+	git_buf path = GIT_BUF_INIT;
+	git_repository *repo;
+	git_odb *odb;
+	git_oid id;
+
+	midx_path(&path);
+	cl_git_rewritefile(path.ptr, "MIDX and then some garbage");
+
+	cl_git_pass(git_repository_open(&repo, git_repository_path(_repo)));
+	cl_git_pass(git_repository_odb__weakptr(&odb, repo));
+
+	cl_git_pass(git_oid_fromstr(&id, "5001298e0c09ad9c34e4249bc5801c75e9754fa5"));
+	cl_assert(git_odb_exists(odb, &id));
+
+	git_repository_free(repo);
+	git_buf_free(&path);
+}
@@ -0,0 +1,135 @@
+#include "clar_libgit2.h"
+#include "odb.h"
+
+static size_t _window_size;
+static size_t _mapped_limit;
+
+void test_pack_wholepack__initialize(void)
+{
+#ifndef GIT_ARCH_64
+	cl_skip();
+#endif
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_MWINDOW_SIZE, &_window_size));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_MWINDOW_MAPPED_LIMIT, &_mapped_limit));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_ENABLE_CACHING, 0));
+}
+
+void test_pack_wholepack__cleanup(void)
+{
+#ifdef GIT_ARCH_64
+	cl_git_pass(git_libgit2_opts(GIT_OPT_ENABLE_MWINDOW_WHOLE_PACK, 0));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_MWINDOW_SIZE, _window_size));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_MWINDOW_MAPPED_LIMIT, _mapped_limit));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_ENABLE_CACHING, 1));
+#endif
+}
+
+static int read_object(const git_oid *id, void *payload)
+{
+	git_odb_object *object;
+	git_oid actual;
+
+	cl_git_pass(git_odb_read(&object, payload, id));
+	cl_git_pass(git_odb_hash(&actual,
+		git_odb_object_data(object), git_odb_object_size(object),
+		git_odb_object_type(object)));
+	cl_assert_equal_oid(id, &actual);
+	git_odb_object_free(object);
+
+	return 0;
+}
+
+static void get_stats(git_stats *stats)
+{
+	cl_git_pass(git_stats_init(stats, GIT_STATS_VERSION));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_STATS, stats));
+}
+
+static void read_all_objects(git_stats *during)
+{
+	git_repository *repo;
+	git_odb *odb;
+
+	cl_git_pass(git_repository_open(&repo, cl_fixture("testrepo.git")));
+	cl_git_pass(git_repository_odb(&odb, repo));
+
+	cl_git_pass(git_odb_foreach(odb, read_object, odb));
+	cl_git_pass(git_odb_foreach(odb, read_object, odb));
+	get_stats(during);
+
+	git_odb_free(odb);
+	git_repository_free(repo);
+}
+
+void test_pack_wholepack__maps_each_pack_once(void)
+{
+	git_stats before, during, after;
+	size_t alignment;
+
+	/* windows this small would need many maps of each pack */
+	cl_git_pass(git__mmap_alignment(&alignment));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_MWINDOW_SIZE, 2 * alignment));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_ENABLE_MWINDOW_WHOLE_PACK, 1));
+
+	get_stats(&before);
+	read_all_objects(&during);
+	get_stats(&after);
+
+	/* testrepo.git has three packs */
+	cl_assert_equal_sz(before.mwindow_maps + 3, during.mwindow_maps);
+	cl_assert_equal_sz(before.mwindow_open + 3, during.mwindow_open);
+
+	/* and the maps go away with the packs */
+	cl_assert_equal_sz(before.mwindow_unmaps + 3, after.mwindow_unmaps);
+	cl_assert_equal_sz(before.mwindow_open, after.mwindow_open);
+	cl_assert_equal_sz(before.mwindow_mapped, after.mwindow_mapped);
+}
+
+void test_pack_wholepack__does_not_count_against_the_limit(void)
+{
+	git_stats whole, before, after;
+	git_odb *whole_odb, *odb;
+	size_t alignment;
+
+	cl_git_pass(git__mmap_alignment(&alignment));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_MWINDOW_SIZE, 2 * alignment));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_ENABLE_MWINDOW_WHOLE_PACK, 1));
+
+	cl_git_pass(git_odb_open(&whole_odb, cl_fixture("testrepo.git/objects")));
+	cl_git_pass(git_odb_foreach(whole_odb, read_object, whole_odb));
+	get_stats(&whole);
+
+	/*
+	 * the whole packs alone are at the limit, but the windows of the
+	 * next pack fit under it and stay mapped
+	 */
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_MWINDOW_MAPPED_LIMIT, whole.mwindow_mapped));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_ENABLE_MWINDOW_WHOLE_PACK, 0));
+
+	cl_git_pass(git_odb_open(&odb, cl_fixture("binaryunicode/.gitted/objects")));
+	get_stats(&before);
+	cl_git_pass(git_odb_foreach(odb, read_object, odb));
+	cl_git_pass(git_odb_foreach(odb, read_object, odb));
+	get_stats(&after);
+
+	cl_assert(after.mwindow_maps > before.mwindow_maps + 1);
+	cl_assert_equal_sz(before.mwindow_unmaps, after.mwindow_unmaps);
+
+	git_odb_free(odb);
+	git_odb_free(whole_odb);
+}
+
+void test_pack_wholepack__is_disabled_by_default(void)
+{
+	git_stats before, during;
+	size_t alignment;
+
+	cl_git_pass(git__mmap_alignment(&alignment));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_MWINDOW_SIZE, 2 * alignment));
+
+	get_stats(&before);
+	read_all_objects(&during);
+
+	cl_assert(during.mwindow_maps > before.mwindow_maps + 3);
+}
@@ -0,0 +1,114 @@
+#include "clar_libgit2.h"
+#include "helper__perf__allocs.h"
+
+#if defined(GIT_COUNT_ALLOCS)
+
+static git_alloc_count *find_file(git_alloc_count *counts, size_t len, const char *file)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		if (!strcmp(counts[i].file, file))
+			return &counts[i];
+	}
+
+	return NULL;
+}
+
+void perf__allocs__start(perf_allocs *a)
+{
+	a->started_len = git__alloc_counts(a->started, PERF_ALLOCS_FILES);
+}
+
+void perf__allocs__stop(perf_allocs *a)
+{
+	git_alloc_count now[PERF_ALLOCS_FILES], *started, *sum;
+	size_t i, now_len, count;
+
+	now_len = git__alloc_counts(now, PERF_ALLOCS_FILES);
+
+	for (i = 0; i < now_len; i++) {
+		started = find_file(a->started, a->started_len, now[i].file);
+		count = now[i].count - (started ? started->count : 0);
+
+		if (!count)
+			continue;
+
+		if ((sum = find_file(a->sum, a->sum_len, now[i].file)) == NULL) {
+			cl_assert(a->sum_len < PERF_ALLOCS_FILES);
+
+			sum = &a->sum[a->sum_len++];
+			sum->file = now[i].file;
+			sum->count = 0;
+		}
+
+		sum->count += count;
+	}
+}
+
+static int count_cmp(const void *a, const void *b)
+{
+	const git_alloc_count *count_a = a, *count_b = b;
+
+	if (count_a->count != count_b->count)
+		return count_a->count < count_b->count ? 1 : -1;
+
+	return strcmp(count_a->file, count_b->file);
+}
+
+/* Show the paths from the top of the tree */
+static const char *short_path(const char *file)
+{
+	const char *top;
+
+	if ((top = strstr(file, "/src/")) != NULL ||
+		(top = strstr(file, "/tests/")) != NULL)
+		return top + 1;
+
+	return file;
+}
+
+void perf__allocs__report(perf_allocs *a, size_t top, const char *fmt, ...)
+{
+	va_list arglist;
+	size_t i, total = 0;
+
+	qsort(a->sum, a->sum_len, sizeof(git_alloc_count), count_cmp);
+
+	for (i = 0; i < a->sum_len; i++)
+		total += a->sum[i].count;
+
+	printf("%10"PRIuZ" allocations: ", total);
+
+	va_start(arglist, fmt);
+	vprintf(fmt, arglist);
+	va_end(arglist);
+
+	printf("\n");
+
+	for (i = 0; i < a->sum_len && i < top; i++)
+		printf("%10"PRIuZ"   %s\n", a->sum[i].count, short_path(a->sum[i].file));
+}
+
+#else
+
+void perf__allocs__start(perf_allocs *a)
+{
+	GIT_UNUSED(a);
+}
+
+void perf__allocs__stop(perf_allocs *a)
+{
+	GIT_UNUSED(a);
+}
+
+void perf__allocs__report(perf_allocs *a, size_t top, const char *fmt, ...)
+{
+	GIT_UNUSED(a);
+	GIT_UNUSED(top);
+	GIT_UNUSED(fmt);
+
+	printf("%10s  allocations are counted when built with -DCOUNT_ALLOCS=ON\n", "-");
+}
+
+#endif
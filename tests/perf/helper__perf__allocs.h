@@ -0,0 +1,26 @@
+/*
+ * Allocation counts are only kept when libgit2 is built with
+ * -DCOUNT_ALLOCS=ON; otherwise the report says so.
+ */
+
+#define PERF_ALLOCS_FILES 256
+
+struct perf__allocs
+{
+#if defined(GIT_COUNT_ALLOCS)
+	git_alloc_count started[PERF_ALLOCS_FILES];
+	size_t started_len;
+	git_alloc_count sum[PERF_ALLOCS_FILES];
+	size_t sum_len;
+#else
+	int unused;
+#endif
+};
+
+#define PERF_ALLOCS_INIT {0}
+
+typedef struct perf__allocs perf_allocs;
+
+void perf__allocs__start(perf_allocs *a);
+void perf__allocs__stop(perf_allocs *a);
+void perf__allocs__report(perf_allocs *a, size_t top, const char *fmt, ...);
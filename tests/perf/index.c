@@ -0,0 +1,107 @@
+#include "clar_libgit2.h"
+#include "helper__perf__timer.h"
+
+#include "path.h"
+
+/* Set this to run the benchmark, it takes a while */
+#define PERF_INDEX_ENV "GITTEST_PERF_INDEX"
+
+#define ENTRY_COUNT 600000
+#define READ_ROUNDS 5
+
+static git_index *g_index;
+static unsigned int g_threads;
+
+void test_perf_index__initialize(void)
+{
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_INDEX_THREADS, &g_threads));
+}
+
+void test_perf_index__cleanup(void)
+{
+	git_index_free(g_index);
+	g_index = NULL;
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_INDEX_THREADS, g_threads));
+
+	if (git_path_isfile("perf_index"))
+		cl_must_pass(p_unlink("perf_index"));
+}
+
+/* Build an index whose paths look like a deep source tree */
+static void build_index(void)
+{
+	git_index_entry entry;
+	git_buf path = GIT_BUF_INIT;
+	size_t i;
+
+	cl_git_pass(git_index_open(&g_index, "perf_index"));
+
+	for (i = 0; i < ENTRY_COUNT; i++) {
+		git_buf_clear(&path);
+		cl_git_pass(git_buf_printf(&path,
+			"src/module%03d/component%02d/source_file_%06d.c",
+			(int)(i / 5000), (int)(i / 100 % 50), (int)i));
+
+		memset(&entry, 0, sizeof(entry));
+		entry.path = path.ptr;
+		entry.mode = GIT_FILEMODE_BLOB;
+		entry.file_size = (uint32_t)i;
+		cl_git_pass(git_index_add(g_index, &entry));
+	}
+
+	git_buf_free(&path);
+}
+
+static void time_version(unsigned int version)
+{
+	perf_timer t_write = PERF_TIMER_INIT, t_serial = PERF_TIMER_INIT,
+		t_threaded = PERF_TIMER_INIT;
+	git_index *index;
+	struct stat st;
+	size_t i;
+
+	cl_git_pass(git_index_set_version(g_index, version));
+
+	perf__timer__start(&t_write);
+	cl_git_pass(git_index_write(g_index));
+	perf__timer__stop(&t_write);
+
+	cl_must_pass(p_stat("perf_index", &st));
+
+	for (i = 0; i < READ_ROUNDS; i++) {
+		cl_git_pass(git_libgit2_opts(GIT_OPT_SET_INDEX_THREADS, 1));
+		perf__timer__start(&t_serial);
+		cl_git_pass(git_index_open(&index, "perf_index"));
+		perf__timer__stop(&t_serial);
+		git_index_free(index);
+
+#ifdef GIT_THREADS
+		cl_git_pass(git_libgit2_opts(GIT_OPT_SET_INDEX_THREADS, 0));
+		perf__timer__start(&t_threaded);
+		cl_git_pass(git_index_open(&index, "perf_index"));
+		perf__timer__stop(&t_threaded);
+		git_index_free(index);
+#endif
+	}
+
+	perf__timer__report(&t_write, "v%u, %d entries, %"PRIuZ" bytes: write",
+		version, ENTRY_COUNT, (size_t)st.st_size);
+	perf__timer__report(&t_serial, "v%u, %d entries: %d reads on one thread",
+		version, ENTRY_COUNT, READ_ROUNDS);
+#ifdef GIT_THREADS
+	perf__timer__report(&t_threaded, "v%u, %d entries: %d reads on %d threads",
+		version, ENTRY_COUNT, READ_ROUNDS, git_online_cpus());
+#endif
+}
+
+void test_perf_index__read_and_write(void)
+{
+	if (!cl_is_env_set(PERF_INDEX_ENV))
+		cl_skip();
+
+	build_index();
+
+	time_version(2);
+	time_version(4);
+}
@@ -0,0 +1,121 @@
+#include "clar_libgit2.h"
+#include "helper__perf__timer.h"
+
+#include "array.h"
+#include "path.h"
+
+/* Set this to run the benchmark, it takes a while */
+#define PERF_MIDX_ENV "GITTEST_PERF_MIDX"
+
+#define OBJECTS_PER_PACK 100
+#define LOOKUP_ROUNDS 20
+
+static git_repository *g_scratch;
+static git_repository *g_repo;
+static git_array_t(git_oid) g_ids;
+
+void test_perf_midx__initialize(void)
+{
+	if (!cl_is_env_set(PERF_MIDX_ENV))
+		return;
+
+	cl_git_pass(git_repository_init(&g_scratch, "midx_scratch", true));
+	cl_git_pass(git_repository_init(&g_repo, "midx_bench", true));
+}
+
+void test_perf_midx__cleanup(void)
+{
+	git_repository_free(g_scratch);
+	g_scratch = NULL;
+	git_repository_free(g_repo);
+	g_repo = NULL;
+	git_array_clear(g_ids);
+
+	if (git_path_isdir("midx_scratch"))
+		cl_fixture_cleanup("midx_scratch");
+	if (git_path_isdir("midx_bench"))
+		cl_fixture_cleanup("midx_bench");
+}
+
+/* Write a pack of new blobs into the benchmark repository */
+static void add_pack(size_t n)
+{
+	git_buf path = GIT_BUF_INIT, content = GIT_BUF_INIT;
+	git_packbuilder *pb;
+	git_oid *id;
+	size_t i;
+
+	cl_git_pass(git_packbuilder_new(&pb, g_scratch));
+
+	for (i = 0; i < OBJECTS_PER_PACK; i++) {
+		id = git_array_alloc(g_ids);
+		cl_assert(id);
+
+		git_buf_clear(&content);
+		cl_git_pass(git_buf_printf(&content, "pack %"PRIuZ" blob %"PRIuZ"\n", n, i));
+		cl_git_pass(git_blob_create_frombuffer(id, g_scratch, content.ptr, content.size));
+		cl_git_pass(git_packbuilder_insert(pb, id, NULL));
+	}
+
+	cl_git_pass(git_buf_joinpath(&path, git_repository_path(g_repo), "objects/pack"));
+	cl_git_pass(git_packbuilder_write(pb, path.ptr, 0, NULL, NULL));
+
+	git_packbuilder_free(pb);
+	git_buf_free(&content);
+	git_buf_free(&path);
+}
+
+static void time_lookups(perf_timer *t)
+{
+	git_odb *odb;
+	size_t i, round, count = git_array_size(g_ids);
+
+	cl_git_pass(git_repository_odb(&odb, g_repo));
+	cl_git_pass(git_odb_refresh(odb));
+
+	/*
+	 * Jump around the objects so that consecutive lookups don't hit the
+	 * same pack: 7919 is a prime, so this visits all of them.
+	 */
+	perf__timer__start(t);
+	for (round = 0; round < LOOKUP_ROUNDS; round++) {
+		for (i = 0; i < count; i++)
+			cl_assert(git_odb_exists(odb, git_array_get(g_ids, (i * 7919) % count)));
+	}
+	perf__timer__stop(t);
+
+	git_odb_free(odb);
+}
+
+void test_perf_midx__lookup_cost_with_pack_count(void)
+{
+	static const size_t pack_counts[] = { 10, 50, 100, 200 };
+	size_t i, packs = 0;
+	git_odb *odb;
+
+	if (!cl_is_env_set(PERF_MIDX_ENV))
+		cl_skip();
+
+	for (i = 0; i < ARRAY_SIZE(pack_counts); i++) {
+		perf_timer t_packs = PERF_TIMER_INIT, t_midx = PERF_TIMER_INIT;
+
+		while (packs < pack_counts[i])
+			add_pack(packs++);
+
+		time_lookups(&t_packs);
+
+		cl_git_pass(git_repository_odb(&odb, g_repo));
+		cl_git_pass(git_odb_write_multi_pack_index(odb));
+		git_odb_free(odb);
+
+		time_lookups(&t_midx);
+
+		/* the next round adds packs which the index doesn't cover */
+		cl_must_pass(p_unlink("midx_bench/objects/pack/multi-pack-index"));
+
+		perf__timer__report(&t_packs, "%4"PRIuZ" packs, %"PRIuZ" lookups: .idx files",
+			packs, git_array_size(g_ids) * LOOKUP_ROUNDS);
+		perf__timer__report(&t_midx, "%4"PRIuZ" packs, %"PRIuZ" lookups: multi-pack-index",
+			packs, git_array_size(g_ids) * LOOKUP_ROUNDS);
+	}
+}
@@ -0,0 +1,178 @@
+#include "clar_libgit2.h"
+#include "helper__perf__timer.h"
+
+#include "filebuf.h"
+#include "hash.h"
+#include "path.h"
+#include "sha1_lookup.h"
+
+/* Set this to run the benchmark, it takes a while and ~500MB of disk */
+#define PERF_PACK_LOOKUP_ENV "GITTEST_PERF_PACK_LOOKUP"
+
+#define OBJECTS 10000000
+#define LOOKUPS 2000000
+
+static git_repository *g_repo;
+static git_oid *g_ids;
+
+void test_perf_packlookup__initialize(void)
+{
+	if (!cl_is_env_set(PERF_PACK_LOOKUP_ENV))
+		return;
+
+	cl_git_pass(git_repository_init(&g_repo, "packlookup_bench", true));
+}
+
+void test_perf_packlookup__cleanup(void)
+{
+	git_repository_free(g_repo);
+	g_repo = NULL;
+	git__free(g_ids);
+	g_ids = NULL;
+
+	if (git_path_isdir("packlookup_bench"))
+		cl_fixture_cleanup("packlookup_bench");
+}
+
+static int oid_cmp(const void *a, const void *b)
+{
+	return git_oid_cmp(a, b);
+}
+
+static void make_id(git_oid *out, uint32_t n)
+{
+	cl_git_pass(git_hash_buf(out, &n, sizeof(n)));
+}
+
+static void write_u32(git_filebuf *file, uint32_t n)
+{
+	n = htonl(n);
+	cl_git_pass(git_filebuf_write(file, &n, sizeof(n)));
+}
+
+/*
+ * Write a version 2 index of OBJECTS made up ids, and a pack which
+ * only has the header and trailer the pack backend checks; looking up
+ * whether objects exist never reads the objects themselves.
+ */
+static void write_pack(void)
+{
+	git_filebuf file = GIT_FILEBUF_INIT;
+	git_buf path = GIT_BUF_INIT;
+	git_oid checksum;
+	uint32_t i, fanout = 0;
+	unsigned char header[12] = { 'P', 'A', 'C', 'K', 0, 0, 0, 2 };
+
+	g_ids = git__malloc(OBJECTS * sizeof(git_oid));
+	cl_assert(g_ids);
+
+	for (i = 0; i < OBJECTS; i++)
+		make_id(&g_ids[i], i);
+	qsort(g_ids, OBJECTS, sizeof(git_oid), oid_cmp);
+
+	header[8] = (unsigned char)(OBJECTS >> 24);
+	header[9] = (unsigned char)(OBJECTS >> 16);
+	header[10] = (unsigned char)(OBJECTS >> 8);
+	header[11] = (unsigned char)OBJECTS;
+	cl_git_pass(git_hash_buf(&checksum, header, sizeof(header)));
+
+	cl_git_pass(git_buf_printf(&path, "%s/objects/pack/pack-%s.pack",
+		git_repository_path(g_repo), git_oid_tostr_s(&checksum)));
+	cl_git_pass(git_filebuf_open(&file, path.ptr, 0, 0444));
+	cl_git_pass(git_filebuf_write(&file, header, sizeof(header)));
+	cl_git_pass(git_filebuf_write(&file, checksum.id, GIT_OID_RAWSZ));
+	cl_git_pass(git_filebuf_commit(&file));
+
+	git_buf_truncate(&path, path.size - strlen("pack"));
+	cl_git_pass(git_buf_puts(&path, "idx"));
+	cl_git_pass(git_filebuf_open(&file, path.ptr, GIT_FILEBUF_HASH_CONTENTS, 0444));
+
+	cl_git_pass(git_filebuf_write(&file, "\377tOc", 4));
+	write_u32(&file, 2);
+
+	for (i = 0; i < 256; i++) {
+		while (fanout < OBJECTS && g_ids[fanout].id[0] == i)
+			fanout++;
+		write_u32(&file, fanout);
+	}
+
+	for (i = 0; i < OBJECTS; i++)
+		cl_git_pass(git_filebuf_write(&file, g_ids[i].id, GIT_OID_RAWSZ));
+	for (i = 0; i < OBJECTS; i++)
+		write_u32(&file, 0);
+	for (i = 0; i < OBJECTS; i++)
+		write_u32(&file, sizeof(header));
+
+	cl_git_pass(git_filebuf_write(&file, checksum.id, GIT_OID_RAWSZ));
+	cl_git_pass(git_filebuf_hash(&checksum, &file));
+	cl_git_pass(git_filebuf_write(&file, checksum.id, GIT_OID_RAWSZ));
+	cl_git_pass(git_filebuf_commit(&file));
+
+	git_buf_free(&path);
+}
+
+static int bisect(const git_oid *table, unsigned lo, unsigned hi, const git_oid *key)
+{
+	while (lo < hi) {
+		unsigned mi = (lo + hi) / 2;
+		int cmp = git_oid_cmp(&table[mi], key);
+
+		if (!cmp)
+			return mi;
+		if (cmp > 0)
+			hi = mi;
+		else
+			lo = mi + 1;
+	}
+
+	return -((int)lo)-1;
+}
+
+void test_perf_packlookup__exists_in_large_pack(void)
+{
+	perf_timer t_bisect = PERF_TIMER_INIT, t_position = PERF_TIMER_INIT,
+		t_exists = PERF_TIMER_INIT, t_missing = PERF_TIMER_INIT;
+	git_odb *odb;
+	git_oid id;
+	uint32_t i;
+	int found = 0;
+
+	if (!cl_is_env_set(PERF_PACK_LOOKUP_ENV))
+		cl_skip();
+
+	write_pack();
+	cl_git_pass(git_repository_odb(&odb, g_repo));
+
+	/* 7919 is a prime, so consecutive lookups are far apart */
+	perf__timer__start(&t_bisect);
+	for (i = 0; i < LOOKUPS; i++)
+		found += bisect(g_ids, 0, OBJECTS, &g_ids[(i * 7919) % OBJECTS]) >= 0;
+	perf__timer__stop(&t_bisect);
+
+	perf__timer__start(&t_position);
+	for (i = 0; i < LOOKUPS; i++)
+		found += sha1_position(g_ids, sizeof(git_oid), 0, OBJECTS,
+			g_ids[(i * 7919) % OBJECTS].id) >= 0;
+	perf__timer__stop(&t_position);
+
+	cl_assert_equal_i(2 * LOOKUPS, found);
+
+	perf__timer__start(&t_exists);
+	for (i = 0; i < LOOKUPS; i++)
+		cl_assert(git_odb_exists(odb, &g_ids[(i * 7919) % OBJECTS]));
+	perf__timer__stop(&t_exists);
+
+	perf__timer__start(&t_missing);
+	for (i = 0; i < LOOKUPS; i++) {
+		make_id(&id, OBJECTS + i);
+		cl_assert(!git_odb_exists(odb, &id));
+	}
+	perf__timer__stop(&t_missing);
+
+	perf__timer__report(&t_bisect, "%d lookups: binary search", LOOKUPS);
+	perf__timer__report(&t_position, "%d lookups: sha1_position", LOOKUPS);
+	perf__timer__report(&t_exists, "%d lookups: git_odb_exists", LOOKUPS);
+	perf__timer__report(&t_missing, "%d lookups: git_odb_exists, missing", LOOKUPS);
+
+	git_odb_free(odb);
+}
@@ -0,0 +1,119 @@
+#include "clar_libgit2.h"
+#include "helper__perf__timer.h"
+#include "helper__perf__allocs.h"
+
+#include "git2/sys/commit.h"
+#include "path.h"
+
+/* Set this to run the benchmark, it takes a while */
+#define PERF_REVWALK_ENV "GITTEST_PERF_REVWALK"
+
+#define COMMITS 20000
+#define WALKS 5
+
+static git_repository *g_repo;
+
+void test_perf_revwalk__initialize(void)
+{
+	if (!cl_is_env_set(PERF_REVWALK_ENV))
+		return;
+
+	cl_git_pass(git_repository_init(&g_repo, "revwalk_bench", true));
+}
+
+void test_perf_revwalk__cleanup(void)
+{
+	git_repository_free(g_repo);
+	g_repo = NULL;
+
+	if (git_path_isdir("revwalk_bench"))
+		cl_fixture_cleanup("revwalk_bench");
+}
+
+/*
+ * Write a history of COMMITS commits of the empty tree, where every
+ * tenth commit merges in the one from five commits before it, so the
+ * topological sort has work to do.
+ */
+static void write_history(git_oid *head)
+{
+	git_treebuilder *builder;
+	git_signature *sig;
+	git_oid tree, *ids;
+	const git_oid *parents[2];
+	size_t i;
+
+	ids = git__calloc(COMMITS, sizeof(git_oid));
+	cl_assert(ids);
+
+	cl_git_pass(git_treebuilder_new(&builder, g_repo, NULL));
+	cl_git_pass(git_treebuilder_write(&tree, builder));
+	git_treebuilder_free(builder);
+
+	for (i = 0; i < COMMITS; i++) {
+		size_t parent_count = 0;
+
+		cl_git_pass(git_signature_new(&sig, "Perf", "perf@example.com",
+			1500000000 + (git_time_t)i * 60, 0));
+
+		if (i > 0)
+			parents[parent_count++] = &ids[i - 1];
+		if (i >= 5 && i % 10 == 0)
+			parents[parent_count++] = &ids[i - 5];
+
+		cl_git_pass(git_commit_create_from_ids(&ids[i], g_repo, NULL,
+			sig, sig, NULL, "commit\n", &tree, parent_count, parents));
+		git_signature_free(sig);
+	}
+
+	git_oid_cpy(head, &ids[COMMITS - 1]);
+	git__free(ids);
+}
+
+static void time_walks(git_revwalk *walk, const git_oid *head, unsigned int sorting)
+{
+	perf_timer t = PERF_TIMER_INIT;
+	perf_allocs a = PERF_ALLOCS_INIT;
+	git_oid id;
+	size_t count;
+	int i;
+
+	for (i = 0; i < WALKS; i++) {
+		git_revwalk_sorting(walk, sorting);
+		cl_git_pass(git_revwalk_push(walk, head));
+
+		perf__allocs__start(&a);
+		perf__timer__start(&t);
+		for (count = 0; git_revwalk_next(&id, walk) == 0; count++)
+			/* walking */;
+		perf__timer__stop(&t);
+		perf__allocs__stop(&a);
+
+		cl_assert_equal_sz(COMMITS, count);
+		git_revwalk_reset(walk);
+	}
+
+	perf__timer__report(&t, "%d walks of %d commits, sorting %u",
+		WALKS, COMMITS, sorting);
+	perf__allocs__report(&a, 5, "in those walks");
+}
+
+void test_perf_revwalk__sorted_walks(void)
+{
+	git_revwalk *walk;
+	git_oid head;
+
+	if (!cl_is_env_set(PERF_REVWALK_ENV))
+		cl_skip();
+
+	write_history(&head);
+
+	/* the first walks also parse the commits */
+	cl_git_pass(git_revwalk_new(&walk, g_repo));
+	time_walks(walk, &head, GIT_SORT_NONE);
+	time_walks(walk, &head, GIT_SORT_TIME);
+	time_walks(walk, &head, GIT_SORT_TOPOLOGICAL | GIT_SORT_TIME);
+	time_walks(walk, &head, GIT_SORT_TOPOLOGICAL | GIT_SORT_REVERSE);
+
+	git_revwalk_free(walk);
+}
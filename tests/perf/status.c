@@ -0,0 +1,98 @@
+#include "clar_libgit2.h"
+#include "helper__perf__timer.h"
+#include "helper__perf__allocs.h"
+
+#include "path.h"
+
+/* Set this to run the benchmark, it takes a while */
+#define PERF_STATUS_ENV "GITTEST_PERF_STATUS"
+
+#define DIRS 50
+#define FILES_PER_DIR 100
+#define ROUNDS 5
+
+static git_repository *g_repo;
+
+void test_perf_status__initialize(void)
+{
+	if (!cl_is_env_set(PERF_STATUS_ENV))
+		return;
+
+	cl_git_pass(git_repository_init(&g_repo, "status_bench", false));
+}
+
+void test_perf_status__cleanup(void)
+{
+	git_repository_free(g_repo);
+	g_repo = NULL;
+
+	if (git_path_isdir("status_bench"))
+		cl_fixture_cleanup("status_bench");
+}
+
+/* Half of the files are tracked and changed, the others untracked */
+static void write_files(void)
+{
+	git_index *index;
+	git_buf path = GIT_BUF_INIT;
+	int i, j;
+
+	cl_git_pass(git_repository_index(&index, g_repo));
+
+	for (i = 0; i < DIRS; i++) {
+		git_buf_clear(&path);
+		cl_git_pass(git_buf_printf(&path, "status_bench/dir%02d", i));
+		cl_must_pass(p_mkdir(path.ptr, 0777));
+
+		for (j = 0; j < FILES_PER_DIR; j++) {
+			git_buf_clear(&path);
+			cl_git_pass(git_buf_printf(&path,
+				"status_bench/dir%02d/file%03d.txt", i, j));
+			cl_git_mkfile(path.ptr, path.ptr);
+
+			if (j % 2 == 0) {
+				cl_git_pass(git_index_add_bypath(index,
+					path.ptr + strlen("status_bench/")));
+				cl_git_append2file(path.ptr, "changed\n");
+			}
+		}
+	}
+
+	cl_git_pass(git_index_write(index));
+	git_index_free(index);
+	git_buf_free(&path);
+}
+
+void test_perf_status__list(void)
+{
+	git_status_options opts = GIT_STATUS_OPTIONS_INIT;
+	git_status_list *list;
+	perf_timer t = PERF_TIMER_INIT;
+	perf_allocs a = PERF_ALLOCS_INIT;
+	int i;
+
+	if (!cl_is_env_set(PERF_STATUS_ENV))
+		cl_skip();
+
+	write_files();
+
+	opts.flags = GIT_STATUS_OPT_INCLUDE_UNTRACKED |
+		GIT_STATUS_OPT_RECURSE_UNTRACKED_DIRS;
+
+	for (i = 0; i < ROUNDS; i++) {
+		perf__allocs__start(&a);
+		perf__timer__start(&t);
+		cl_git_pass(git_status_list_new(&list, g_repo, &opts));
+		perf__timer__stop(&t);
+		perf__allocs__stop(&a);
+
+		cl_assert_equal_sz(DIRS * FILES_PER_DIR, git_status_list_entrycount(list));
+		git_status_list_free(list);
+	}
+
+	perf__timer__report(&t, "%d status lists of %d entries",
+		ROUNDS, DIRS * FILES_PER_DIR);
+
+	/* the files which allocate the most, to see what's left to pool */
+	perf__allocs__report(&a, 10, "in those status lists");
+}
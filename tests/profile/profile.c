@@ -0,0 +1,127 @@
+#include "clar_libgit2.h"
+#include "fileops.h"
+#include "git2/profile.h"
+
+static git_repository *g_repo;
+
+#define MAX_REGIONS 64
+
+typedef struct {
+	git_profile_region regions[MAX_REGIONS];
+	size_t count;
+} region_list;
+
+static region_list g_regions;
+
+static void collect_region(const git_profile_region *region, void *payload)
+{
+	region_list *list = payload;
+
+	if (list->count < MAX_REGIONS)
+		memcpy(&list->regions[list->count++], region, sizeof(*region));
+}
+
+void test_profile_profile__initialize(void)
+{
+	memset(&g_regions, 0, sizeof(g_regions));
+	g_repo = cl_git_sandbox_init("testrepo");
+}
+
+void test_profile_profile__cleanup(void)
+{
+	cl_git_pass(git_profile_set(NULL, NULL));
+	cl_git_sandbox_cleanup();
+}
+
+static const git_profile_region *find_region(const char *name)
+{
+	size_t i;
+
+	for (i = 0; i < g_regions.count; i++)
+		if (!strcmp(g_regions.regions[i].name, name))
+			return &g_regions.regions[i];
+
+	return NULL;
+}
+
+/* Check out every file of HEAD into an empty directory */
+static void checkout_head(void)
+{
+	git_checkout_options opts = GIT_CHECKOUT_OPTIONS_INIT;
+
+	opts.checkout_strategy = GIT_CHECKOUT_FORCE | GIT_CHECKOUT_DONT_UPDATE_INDEX;
+	opts.target_directory = "profiled";
+
+	cl_git_pass(git_checkout_head(g_repo, &opts));
+	cl_git_pass(git_futils_rmdir_r("profiled", NULL, GIT_RMDIR_REMOVE_FILES));
+}
+
+void test_profile_profile__nothing_is_reported_when_unset(void)
+{
+	checkout_head();
+	cl_assert_equal_sz(0, g_regions.count);
+
+	cl_git_pass(git_profile_set(collect_region, &g_regions));
+	cl_git_pass(git_profile_set(NULL, NULL));
+
+	checkout_head();
+	cl_assert_equal_sz(0, g_regions.count);
+}
+
+void test_profile_profile__reports_nested_regions(void)
+{
+	const git_profile_region *checkout, *write, *diff;
+
+	cl_git_pass(git_profile_set(collect_region, &g_regions));
+	checkout_head();
+
+	cl_assert((checkout = find_region("checkout")) != NULL);
+	cl_assert((write = find_region("checkout.write")) != NULL);
+	cl_assert((diff = find_region("diff")) != NULL);
+
+	/* the outer region is left last */
+	cl_assert_equal_s("checkout", g_regions.regions[g_regions.count - 1].name);
+	cl_assert_equal_i(0, checkout->depth);
+
+	cl_assert_equal_i(1, write->depth);
+	cl_assert_equal_sz(4, write->count);
+	cl_assert_equal_sz(4, checkout->count);
+	cl_assert(write->start >= checkout->start);
+	cl_assert(write->start + write->elapsed <=
+		checkout->start + checkout->elapsed);
+	cl_assert_equal_sz(checkout->thread, write->thread);
+
+	cl_assert_equal_i(1, diff->depth);
+	cl_assert(diff->start + diff->elapsed <= write->start);
+}
+
+void test_profile_profile__reports_status(void)
+{
+	git_status_list *status;
+	const git_profile_region *region;
+
+	cl_git_rewritefile("testrepo/README", "changed\n");
+
+	cl_git_pass(git_profile_set(collect_region, &g_regions));
+	cl_git_pass(git_status_list_new(&status, g_repo, NULL));
+
+	cl_assert((region = find_region("status")) != NULL);
+	cl_assert_equal_i(0, region->depth);
+	cl_assert_equal_sz(git_status_list_entrycount(status), region->count);
+
+	git_status_list_free(status);
+}
+
+void test_profile_profile__formats_trace_events(void)
+{
+	git_profile_region region = { "checkout.write", 1, 42, 1.5, 0.25, 7 };
+	git_buf out = GIT_BUF_INIT;
+
+	cl_git_pass(git_profile_region_format(&out, &region));
+	cl_assert_equal_s(
+		"{\"name\":\"checkout.write\",\"ph\":\"X\",\"ts\":1500000.000,"
+		"\"dur\":250000.000,\"pid\":0,\"tid\":42,\"args\":{\"count\":7}},\n",
+		out.ptr);
+
+	git_buf_free(&out);
+}
@@ -0,0 +1,268 @@
+#include "clar_libgit2.h"
+
+#include "fileops.h"
+#include "git2/refdb.h"
+#include "refs.h"
+#include "vector.h"
+#include "ref_helpers.h"
+
+static git_repository *g_repo;
+
+void test_refs_packedsnapshot__initialize(void)
+{
+	g_repo = cl_git_sandbox_init("testrepo");
+}
+
+void test_refs_packedsnapshot__cleanup(void)
+{
+	cl_git_pass(git_libgit2_opts(GIT_OPT_ENABLE_PACKED_REFS_MMAP, 0));
+	cl_git_sandbox_cleanup();
+}
+
+static void packall(void)
+{
+	git_refdb *refdb;
+
+	cl_git_pass(git_repository_refdb(&refdb, g_repo));
+	cl_git_pass(git_refdb_compress(refdb));
+	git_refdb_free(refdb);
+}
+
+/* Describe the references matching glob, one per line */
+static void list_refs(git_buf *out, const char *glob)
+{
+	git_reference_iterator *iter;
+	git_reference *ref;
+	git_vector lines = GIT_VECTOR_INIT, names = GIT_VECTOR_INIT;
+	const char *name;
+	char *line;
+	size_t i;
+	int error;
+
+	cl_git_pass(git_reference_iterator_glob_new(&iter, g_repo, glob));
+	while ((error = git_reference_next(&ref, iter)) == 0) {
+		char oid[GIT_OID_HEXSZ + 1], peel[GIT_OID_HEXSZ + 1];
+
+		if (git_reference_type(ref) == GIT_REF_SYMBOLIC) {
+			line = git__strdup(git_reference_symbolic_target(ref));
+		} else {
+			git_oid_tostr(oid, sizeof(oid), git_reference_target(ref));
+			git_oid_tostr(peel, sizeof(peel), git_reference_target_peel(ref));
+			line = git__malloc(strlen(ref->name) + 2 * sizeof(oid) + 3);
+			cl_assert(line);
+			sprintf(line, "%s %s %s", ref->name, oid,
+				git_reference_target_peel(ref) ? peel : "-");
+		}
+
+		cl_git_pass(git_vector_insert(&lines, line));
+		git_reference_free(ref);
+	}
+	cl_assert_equal_i(GIT_ITEROVER, error);
+	git_reference_iterator_free(iter);
+
+	/* the names come from a separate pass */
+	cl_git_pass(git_reference_iterator_glob_new(&iter, g_repo, glob));
+	while ((error = git_reference_next_name(&name, iter)) == 0)
+		cl_git_pass(git_vector_insert(&names, git__strdup(name)));
+	cl_assert_equal_i(GIT_ITEROVER, error);
+	git_reference_iterator_free(iter);
+
+	cl_assert_equal_sz(lines.length, names.length);
+
+	git_vector_set_cmp(&lines, git__strcmp_cb);
+	git_vector_sort(&lines);
+
+	git_vector_foreach(&lines, i, line) {
+		git_buf_puts(out, line);
+		git_buf_putc(out, '\n');
+		git__free(line);
+	}
+	git_vector_foreach(&names, i, line)
+		git__free(line);
+
+	git_vector_free(&lines);
+	git_vector_free(&names);
+}
+
+static void assert_same_refs(const char *glob)
+{
+	git_buf without = GIT_BUF_INIT, with = GIT_BUF_INIT;
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_ENABLE_PACKED_REFS_MMAP, 0));
+	list_refs(&without, glob);
+	cl_git_pass(git_libgit2_opts(GIT_OPT_ENABLE_PACKED_REFS_MMAP, 1));
+	list_refs(&with, glob);
+
+	cl_assert(without.size > 0);
+	cl_assert_equal_s(without.ptr, with.ptr);
+
+	git_buf_free(&without);
+	git_buf_free(&with);
+}
+
+void test_refs_packedsnapshot__reads_the_same_references(void)
+{
+	packall();
+
+	assert_same_refs(NULL);
+	assert_same_refs("refs/tags/*");
+	assert_same_refs("refs/heads/packed*");
+	assert_same_refs("*/master");
+}
+
+void test_refs_packedsnapshot__loose_references_shadow_packed_ones(void)
+{
+	git_reference *ref;
+	git_oid id;
+
+	packall();
+
+	cl_git_pass(git_oid_fromstr(&id, "a65fedf39aefe402d3bb6e24df4d4f5fe4547750"));
+	cl_git_pass(git_reference_create(&ref, g_repo, "refs/heads/packed", &id, 1, NULL));
+	cl_assert(!reference_is_packed(ref));
+	git_reference_free(ref);
+
+	assert_same_refs(NULL);
+	assert_same_refs("refs/heads/*");
+}
+
+void test_refs_packedsnapshot__reads_unsorted_files(void)
+{
+	git_reference *ref;
+
+	/* the fixture doesn't say that it is sorted */
+	cl_git_pass(git_libgit2_opts(GIT_OPT_ENABLE_PACKED_REFS_MMAP, 1));
+	cl_git_pass(git_reference_lookup(&ref, g_repo, "refs/tags/packed-tag"));
+	cl_assert(reference_is_packed(ref));
+	git_reference_free(ref);
+
+	assert_same_refs(NULL);
+}
+
+void test_refs_packedsnapshot__notices_changes(void)
+{
+	git_reference *ref;
+	git_buf path = GIT_BUF_INIT;
+
+	packall();
+	cl_git_pass(git_libgit2_opts(GIT_OPT_ENABLE_PACKED_REFS_MMAP, 1));
+
+	cl_git_pass(git_reference_lookup(&ref, g_repo, "refs/heads/packed"));
+	git_reference_free(ref);
+
+	/* another process packs other references, with a peeled tag */
+	cl_git_pass(git_buf_joinpath(&path, git_repository_path(g_repo), GIT_PACKEDREFS_FILE));
+	cl_git_rewritefile(path.ptr,
+		GIT_PACKEDREFS_HEADER "\n"
+		"a65fedf39aefe402d3bb6e24df4d4f5fe4547750 refs/heads/aaa\n"
+		"b25fa35b38051e4ae45d4222e795f9df2e43f1d1 refs/tags/packed-tag\n"
+		"^e90810b8df3e80c413d903f631643c716887138d\n"
+		"763d71aadf09a7951596c9746c024e7eece7c7af refs/tags/zzz\n");
+
+	cl_git_fail_with(GIT_ENOTFOUND, git_reference_lookup(&ref, g_repo, "refs/heads/packed"));
+
+	cl_git_pass(git_reference_lookup(&ref, g_repo, "refs/heads/aaa"));
+	git_reference_free(ref);
+	cl_git_pass(git_reference_lookup(&ref, g_repo, "refs/tags/zzz"));
+	git_reference_free(ref);
+
+	cl_git_pass(git_reference_lookup(&ref, g_repo, "refs/tags/packed-tag"));
+	cl_assert_equal_s("e90810b8df3e80c413d903f631643c716887138d",
+		git_oid_tostr_s(git_reference_target_peel(ref)));
+	git_reference_free(ref);
+
+	assert_same_refs(NULL);
+	git_buf_free(&path);
+}
+
+void test_refs_packedsnapshot__checks_for_colliding_paths(void)
+{
+	git_reference *ref, *renamed;
+	git_oid id;
+
+	packall();
+	cl_git_pass(git_libgit2_opts(GIT_OPT_ENABLE_PACKED_REFS_MMAP, 1));
+	cl_git_pass(git_oid_fromstr(&id, "a65fedf39aefe402d3bb6e24df4d4f5fe4547750"));
+
+	/* a packed reference is in the way, and the other way around */
+	cl_git_fail(git_reference_create(&ref, g_repo, "refs/heads/packed/sub", &id, 0, NULL));
+	cl_git_fail(git_reference_create(&ref, g_repo, "refs/heads/packed/sub", &id, 1, NULL));
+	cl_git_fail(git_reference_create(&ref, g_repo, "refs/heads", &id, 1, NULL));
+	cl_git_fail_with(GIT_EEXISTS,
+		git_reference_create(&ref, g_repo, "refs/heads/packed", &id, 0, NULL));
+
+	/* names which only start the same are fine */
+	cl_git_pass(git_reference_create(&ref, g_repo, "refs/heads/packed-sub", &id, 0, NULL));
+	git_reference_free(ref);
+	cl_git_pass(git_reference_create(&ref, g_repo, "refs/head", &id, 0, NULL));
+	git_reference_free(ref);
+
+	/* and renaming into the directory of the old name */
+	cl_git_pass(git_reference_lookup(&ref, g_repo, "refs/heads/subtrees"));
+	cl_git_pass(git_reference_rename(&renamed, ref, "refs/heads/subtrees/sub", 0, NULL));
+	git_reference_free(renamed);
+	git_reference_free(ref);
+}
+
+void test_refs_packedsnapshot__deletes_references(void)
+{
+	git_reference *ref;
+	git_buf path = GIT_BUF_INIT;
+	struct stat before, after;
+	git_oid id;
+
+	packall();
+	cl_git_pass(git_libgit2_opts(GIT_OPT_ENABLE_PACKED_REFS_MMAP, 1));
+
+	cl_git_pass(git_buf_joinpath(&path, git_repository_path(g_repo), GIT_PACKEDREFS_FILE));
+	cl_must_pass(p_stat(path.ptr, &before));
+
+	/* deleting a loose reference leaves packed-refs alone */
+	cl_git_pass(git_oid_fromstr(&id, "a65fedf39aefe402d3bb6e24df4d4f5fe4547750"));
+	cl_git_pass(git_reference_create(&ref, g_repo, "refs/heads/loose", &id, 0, NULL));
+	cl_git_pass(git_reference_delete(ref));
+	git_reference_free(ref);
+
+	cl_must_pass(p_stat(path.ptr, &after));
+	cl_assert_equal_i(before.st_ino, after.st_ino);
+
+	cl_git_pass(git_reference_lookup(&ref, g_repo, "refs/heads/packed"));
+	cl_git_pass(git_reference_delete(ref));
+	git_reference_free(ref);
+
+	cl_git_fail_with(GIT_ENOTFOUND, git_reference_lookup(&ref, g_repo, "refs/heads/packed"));
+	cl_git_pass(git_reference_lookup(&ref, g_repo, "refs/heads/packed-test"));
+	git_reference_free(ref);
+
+	assert_same_refs(NULL);
+	git_buf_free(&path);
+}
+
+void test_refs_packedsnapshot__parses_only_what_it_reads(void)
+{
+	git_reference *ref;
+	git_buf path = GIT_BUF_INIT, content = GIT_BUF_INIT;
+	int i;
+
+	cl_git_pass(git_buf_puts(&content, GIT_PACKEDREFS_HEADER "\n"));
+	for (i = 0; i < 64; i++)
+		cl_git_pass(git_buf_printf(&content,
+			"a65fedf39aefe402d3bb6e24df4d4f5fe4547750 refs/heads/b%02d\n", i));
+	cl_git_pass(git_buf_puts(&content, "not a reference\n"));
+
+	cl_git_pass(git_buf_joinpath(&path, git_repository_path(g_repo), GIT_PACKEDREFS_FILE));
+	cl_git_rewritefile(path.ptr, content.ptr);
+
+	/* parsing all of the file finds the broken line */
+	cl_git_fail(git_reference_lookup(&ref, g_repo, "refs/heads/b00"));
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_ENABLE_PACKED_REFS_MMAP, 1));
+	cl_git_pass(git_reference_lookup(&ref, g_repo, "refs/heads/b00"));
+	git_reference_free(ref);
+	cl_git_pass(git_reference_lookup(&ref, g_repo, "refs/heads/b31"));
+	git_reference_free(ref);
+	cl_git_fail_with(GIT_ENOTFOUND, git_reference_lookup(&ref, g_repo, "refs/heads/a"));
+
+	git_buf_free(&content);
+	git_buf_free(&path);
+}
@@ -0,0 +1,486 @@
+#include "clar_libgit2.h"
+
+#include "fileops.h"
+#include "reftable.h"
+#include "git2/refdb.h"
+#include "git2/reflog.h"
+#include "git2/transaction.h"
+#include "git2/sys/refdb_backend.h"
+
+static git_repository *g_repo;
+static git_signature *g_sig;
+static git_oid g_ids[4];
+
+static void use_reftable(git_repository *repo)
+{
+	git_refdb *refdb;
+	git_refdb_backend *backend;
+
+	cl_git_pass(git_repository_refdb(&refdb, repo));
+	cl_git_pass(git_refdb_backend_reftable(&backend, repo));
+	cl_git_pass(git_refdb_set_backend(refdb, backend));
+	git_refdb_free(refdb);
+}
+
+void test_refs_reftable__initialize(void)
+{
+	git_reference *ref;
+
+	g_repo = cl_git_sandbox_init("testrepo");
+	use_reftable(g_repo);
+
+	cl_git_pass(git_signature_new(&g_sig, "Someone", "someone@example.com", 1234567890, 60));
+	cl_git_pass(git_oid_fromstr(&g_ids[0], "a65fedf39aefe402d3bb6e24df4d4f5fe4547750"));
+	cl_git_pass(git_oid_fromstr(&g_ids[1], "099fabac3a9ea935598528c27f866e34089c2eff"));
+	cl_git_pass(git_oid_fromstr(&g_ids[2], "be3563ae3f795b2b4353bcce3a527ad0a4f7f644"));
+	cl_git_pass(git_oid_fromstr(&g_ids[3], "b25fa35b38051e4ae45d4222e795f9df2e43f1d1"));
+
+	cl_git_pass(git_reference_symbolic_create(&ref, g_repo, "HEAD", "refs/heads/master", 1, NULL));
+	git_reference_free(ref);
+	cl_git_pass(git_reference_create(&ref, g_repo, "refs/heads/master", &g_ids[0], 0, "initial"));
+	git_reference_free(ref);
+}
+
+void test_refs_reftable__cleanup(void)
+{
+	git_signature_free(g_sig);
+	cl_git_sandbox_cleanup();
+}
+
+static size_t count_tables(void)
+{
+	git_buf path = GIT_BUF_INIT, list = GIT_BUF_INIT;
+	size_t i, count = 0;
+
+	cl_git_pass(git_buf_joinpath(&path, git_repository_commondir(g_repo),
+		GIT_REFTABLE_DIR "/" GIT_REFTABLE_LIST_FILE));
+	cl_git_pass(git_futils_readbuffer(&list, path.ptr));
+
+	for (i = 0; i < list.size; i++)
+		count += list.ptr[i] == '\n';
+
+	git_buf_free(&path);
+	git_buf_free(&list);
+	return count;
+}
+
+static void assert_target(const char *name, const git_oid *id)
+{
+	git_reference *ref;
+
+	cl_git_pass(git_reference_lookup(&ref, g_repo, name));
+	cl_assert_equal_oid(id, git_reference_target(ref));
+	git_reference_free(ref);
+}
+
+void test_refs_reftable__creates_and_looks_up_references(void)
+{
+	git_reference *ref;
+	git_oid id;
+
+	cl_assert(git_path_isfile("testrepo/.git/reftable/tables.list"));
+
+	cl_git_pass(git_reference_name_to_id(&id, g_repo, "HEAD"));
+	cl_assert_equal_oid(&g_ids[0], &id);
+
+	cl_git_pass(git_reference_lookup(&ref, g_repo, "HEAD"));
+	cl_assert_equal_s("refs/heads/master", git_reference_symbolic_target(ref));
+	git_reference_free(ref);
+
+	/* an annotated tag is stored along with what it points to */
+	cl_git_pass(git_reference_create(&ref, g_repo, "refs/tags/annotated", &g_ids[3], 0, NULL));
+	git_reference_free(ref);
+	cl_git_pass(git_reference_lookup(&ref, g_repo, "refs/tags/annotated"));
+	cl_assert_equal_s("e90810b8df3e80c413d903f631643c716887138d",
+		git_oid_tostr_s(git_reference_target_peel(ref)));
+	git_reference_free(ref);
+
+	cl_git_fail_with(GIT_ENOTFOUND, git_reference_lookup(&ref, g_repo, "refs/heads/packed"));
+	cl_git_fail_with(GIT_EEXISTS,
+		git_reference_create(&ref, g_repo, "refs/heads/master", &g_ids[1], 0, NULL));
+	cl_git_fail_with(GIT_EMODIFIED,
+		git_reference_create_matching(&ref, g_repo, "refs/heads/master", &g_ids[1], 1, &g_ids[2], NULL));
+
+	cl_git_pass(git_reference_create_matching(&ref, g_repo, "refs/heads/master", &g_ids[1], 1, &g_ids[0], NULL));
+	git_reference_free(ref);
+	assert_target("refs/heads/master", &g_ids[1]);
+}
+
+void test_refs_reftable__checks_for_colliding_paths(void)
+{
+	git_reference *ref;
+
+	cl_git_fail(git_reference_create(&ref, g_repo, "refs/heads/master/sub", &g_ids[0], 1, NULL));
+	cl_git_fail(git_reference_create(&ref, g_repo, "refs/heads", &g_ids[0], 1, NULL));
+
+	cl_git_pass(git_reference_create(&ref, g_repo, "refs/heads/master-sub", &g_ids[0], 0, NULL));
+	git_reference_free(ref);
+}
+
+static void assert_names(const char *glob, const char *expected)
+{
+	git_reference_iterator *iter;
+	git_buf names = GIT_BUF_INIT;
+	const char *name;
+	int error;
+
+	cl_git_pass(git_reference_iterator_glob_new(&iter, g_repo, glob));
+	while ((error = git_reference_next_name(&name, iter)) == 0)
+		git_buf_printf(&names, "%s\n", name);
+	cl_assert_equal_i(GIT_ITEROVER, error);
+	git_reference_iterator_free(iter);
+
+	cl_assert_equal_s(expected, names.ptr);
+	git_buf_free(&names);
+}
+
+void test_refs_reftable__iterates_over_references(void)
+{
+	git_reference *ref;
+
+	cl_git_pass(git_reference_create(&ref, g_repo, "refs/heads/b", &g_ids[1], 0, NULL));
+	git_reference_free(ref);
+	cl_git_pass(git_reference_create(&ref, g_repo, "refs/tags/v1", &g_ids[2], 0, NULL));
+	git_reference_free(ref);
+	cl_git_pass(git_reference_create(&ref, g_repo, "refs/heads/a", &g_ids[2], 0, NULL));
+	git_reference_free(ref);
+	cl_git_pass(git_reference_symbolic_create(&ref, g_repo, "refs/remotes/origin/HEAD", "refs/remotes/origin/master", 0, NULL));
+	git_reference_free(ref);
+
+	/* a newer table shadows an older one, and hides what it deleted */
+	cl_git_pass(git_reference_lookup(&ref, g_repo, "refs/heads/b"));
+	cl_git_pass(git_reference_delete(ref));
+	git_reference_free(ref);
+
+	assert_names(NULL,
+		"refs/heads/a\nrefs/heads/master\nrefs/remotes/origin/HEAD\nrefs/tags/v1\n");
+	assert_names("refs/heads/*", "refs/heads/a\nrefs/heads/master\n");
+	assert_names("*/HEAD", "refs/remotes/origin/HEAD\n");
+	assert_names("refs/tags/v*", "refs/tags/v1\n");
+}
+
+static void assert_reflog(const char *name, size_t count, const char *last_message)
+{
+	git_reflog *reflog;
+	const git_reflog_entry *entry;
+
+	cl_git_pass(git_reflog_read(&reflog, g_repo, name));
+	cl_assert_equal_sz(count, git_reflog_entrycount(reflog));
+
+	if (count) {
+		entry = git_reflog_entry_byindex(reflog, 0);
+		cl_assert_equal_s(last_message, git_reflog_entry_message(entry));
+	}
+
+	git_reflog_free(reflog);
+}
+
+void test_refs_reftable__writes_reflogs(void)
+{
+	git_reference *ref;
+	git_reflog *reflog;
+	const git_reflog_entry *entry;
+
+	cl_git_pass(git_reference_create(&ref, g_repo, "refs/heads/master", &g_ids[1], 1, "second"));
+	git_reference_free(ref);
+	cl_git_pass(git_reference_create(&ref, g_repo, "refs/heads/master", &g_ids[2], 1, "third"));
+	git_reference_free(ref);
+
+	assert_reflog("refs/heads/master", 3, "third");
+	assert_reflog("HEAD", 3, "third");
+
+	cl_git_pass(git_reflog_read(&reflog, g_repo, "refs/heads/master"));
+	entry = git_reflog_entry_byindex(reflog, 2);
+	cl_assert(git_oid_iszero(git_reflog_entry_id_old(entry)));
+	cl_assert_equal_oid(&g_ids[0], git_reflog_entry_id_new(entry));
+
+	cl_git_pass(git_reflog_append(reflog, &g_ids[0], g_sig, "appended"));
+	cl_git_pass(git_reflog_drop(reflog, 1, 1));
+	cl_git_pass(git_reflog_write(reflog));
+	git_reflog_free(reflog);
+
+	cl_git_pass(git_reflog_read(&reflog, g_repo, "refs/heads/master"));
+	cl_assert_equal_sz(3, git_reflog_entrycount(reflog));
+	entry = git_reflog_entry_byindex(reflog, 0);
+	cl_assert_equal_s("appended", git_reflog_entry_message(entry));
+	cl_assert_equal_s("Someone", git_reflog_entry_committer(entry)->name);
+	cl_assert_equal_i(1234567890, git_reflog_entry_committer(entry)->when.time);
+	cl_assert_equal_i(60, git_reflog_entry_committer(entry)->when.offset);
+	entry = git_reflog_entry_byindex(reflog, 1);
+	cl_assert_equal_s("second", git_reflog_entry_message(entry));
+	git_reflog_free(reflog);
+
+	/* tags only get a reflog if they already have one */
+	cl_git_pass(git_reference_create(&ref, g_repo, "refs/tags/v1", &g_ids[1], 0, "tagged"));
+	git_reference_free(ref);
+	cl_assert_equal_i(0, git_reference_has_log(g_repo, "refs/tags/v1"));
+
+	cl_git_pass(git_reference_ensure_log(g_repo, "refs/tags/v1"));
+	cl_assert_equal_i(1, git_reference_has_log(g_repo, "refs/tags/v1"));
+	assert_reflog("refs/tags/v1", 0, NULL);
+
+	cl_git_pass(git_reference_create(&ref, g_repo, "refs/tags/v1", &g_ids[2], 1, "retagged"));
+	git_reference_free(ref);
+	assert_reflog("refs/tags/v1", 1, "retagged");
+
+	cl_git_pass(git_reflog_delete(g_repo, "refs/heads/master"));
+	cl_assert_equal_i(0, git_reference_has_log(g_repo, "refs/heads/master"));
+	assert_reflog("refs/heads/master", 0, NULL);
+	assert_reflog("HEAD", 3, "third");
+}
+
+void test_refs_reftable__deletes_references(void)
+{
+	git_reference *ref;
+
+	cl_git_pass(git_reference_create(&ref, g_repo, "refs/heads/gone", &g_ids[1], 0, "created"));
+	cl_assert_equal_i(1, git_reference_has_log(g_repo, "refs/heads/gone"));
+	cl_git_pass(git_reference_delete(ref));
+	git_reference_free(ref);
+
+	cl_git_fail_with(GIT_ENOTFOUND, git_reference_lookup(&ref, g_repo, "refs/heads/gone"));
+	cl_assert_equal_i(0, git_reference_has_log(g_repo, "refs/heads/gone"));
+	cl_git_fail_with(GIT_ENOTFOUND, git_reference_remove(g_repo, "refs/heads/gone"));
+
+	/* the name is free again, even for a directory */
+	cl_git_pass(git_reference_create(&ref, g_repo, "refs/heads/gone/sub", &g_ids[2], 0, NULL));
+	git_reference_free(ref);
+	assert_target("refs/heads/gone/sub", &g_ids[2]);
+}
+
+void test_refs_reftable__renames_references(void)
+{
+	git_reference *ref, *renamed;
+
+	cl_git_pass(git_reference_create(&ref, g_repo, "refs/heads/topic", &g_ids[1], 0, "created"));
+	git_reference_free(ref);
+	cl_git_pass(git_reference_create(&ref, g_repo, "refs/heads/other", &g_ids[2], 0, NULL));
+
+	cl_git_fail_with(GIT_EEXISTS, git_reference_rename(&renamed, ref, "refs/heads/topic", 0, NULL));
+	git_reference_free(ref);
+
+	cl_git_pass(git_reference_lookup(&ref, g_repo, "refs/heads/topic"));
+	cl_git_pass(git_reference_rename(&renamed, ref, "refs/heads/topic/moved", 0, "moved"));
+	cl_assert_equal_s("refs/heads/topic/moved", git_reference_name(renamed));
+	git_reference_free(renamed);
+	git_reference_free(ref);
+
+	cl_git_fail_with(GIT_ENOTFOUND, git_reference_lookup(&ref, g_repo, "refs/heads/topic"));
+	assert_target("refs/heads/topic/moved", &g_ids[1]);
+
+	cl_assert_equal_i(0, git_reference_has_log(g_repo, "refs/heads/topic"));
+	assert_reflog("refs/heads/topic/moved", 2, "moved");
+}
+
+void test_refs_reftable__commits_transactions_at_once(void)
+{
+	git_transaction *tx;
+	git_reference *ref;
+	size_t tables = count_tables();
+
+	cl_git_pass(git_transaction_new(&tx, g_repo));
+	cl_git_pass(git_transaction_lock_ref(tx, "refs/heads/master"));
+	cl_git_pass(git_transaction_lock_ref(tx, "refs/heads/new"));
+	cl_git_pass(git_transaction_lock_ref(tx, "HEAD"));
+	cl_git_pass(git_transaction_set_target(tx, "refs/heads/master", &g_ids[1], g_sig, "moved"));
+	cl_git_pass(git_transaction_set_target(tx, "refs/heads/new", &g_ids[2], g_sig, "new"));
+	cl_git_pass(git_transaction_set_symbolic_target(tx, "HEAD", "refs/heads/new", g_sig, NULL));
+
+	/* nothing shows until it is committed */
+	assert_target("refs/heads/master", &g_ids[0]);
+	cl_git_fail_with(GIT_ENOTFOUND, git_reference_lookup(&ref, g_repo, "refs/heads/new"));
+
+	cl_git_pass(git_transaction_commit(tx));
+	git_transaction_free(tx);
+
+	assert_target("refs/heads/master", &g_ids[1]);
+	assert_target("refs/heads/new", &g_ids[2]);
+	cl_git_pass(git_reference_lookup(&ref, g_repo, "HEAD"));
+	cl_assert_equal_s("refs/heads/new", git_reference_symbolic_target(ref));
+	git_reference_free(ref);
+	assert_reflog("refs/heads/new", 1, "new");
+
+	cl_assert(count_tables() <= tables + 1);
+	cl_assert(!git_path_exists("testrepo/.git/reftable/tables.list.lock"));
+}
+
+void test_refs_reftable__abandoned_transactions_change_nothing(void)
+{
+	git_transaction *tx;
+	git_reference *ref;
+
+	cl_git_pass(git_transaction_new(&tx, g_repo));
+	cl_git_pass(git_transaction_lock_ref(tx, "refs/heads/master"));
+	cl_git_pass(git_transaction_lock_ref(tx, "refs/heads/new"));
+	cl_git_pass(git_transaction_set_target(tx, "refs/heads/master", &g_ids[1], NULL, NULL));
+	cl_git_pass(git_transaction_set_target(tx, "refs/heads/new", &g_ids[2], NULL, NULL));
+
+	/* the stack stays locked for others */
+	cl_git_fail_with(GIT_ELOCKED,
+		git_reference_create(&ref, g_repo, "refs/heads/other", &g_ids[2], 0, NULL));
+
+	git_transaction_free(tx);
+
+	assert_target("refs/heads/master", &g_ids[0]);
+	cl_git_fail_with(GIT_ENOTFOUND, git_reference_lookup(&ref, g_repo, "refs/heads/new"));
+	cl_assert(!git_path_exists("testrepo/.git/reftable/tables.list.lock"));
+
+	cl_git_pass(git_reference_create(&ref, g_repo, "refs/heads/other", &g_ids[2], 0, NULL));
+	git_reference_free(ref);
+}
+
+void test_refs_reftable__merges_tables(void)
+{
+	git_reference *ref;
+	git_refdb *refdb;
+	char name[32];
+	int i;
+
+	for (i = 0; i < 200; i++) {
+		cl_git_pass(git_reference_create(&ref, g_repo, "refs/heads/master",
+			&g_ids[i % 3], 1, "update"));
+		git_reference_free(ref);
+
+		p_snprintf(name, sizeof(name), "refs/tags/t%03d", i);
+		cl_git_pass(git_reference_create(&ref, g_repo, name, &g_ids[i % 3], 0, NULL));
+		git_reference_free(ref);
+	}
+
+	/* each table is more than twice the size of the ones after it */
+	cl_assert(count_tables() <= 12);
+
+	assert_target("refs/heads/master", &g_ids[199 % 3]);
+	assert_target("refs/tags/t150", &g_ids[0]);
+	assert_reflog("refs/heads/master", 200, "update");
+
+	cl_git_pass(git_repository_refdb(&refdb, g_repo));
+	cl_git_pass(git_refdb_compress(refdb));
+	git_refdb_free(refdb);
+
+	cl_assert_equal_sz(1, count_tables());
+	assert_target("refs/tags/t000", &g_ids[0]);
+	assert_target("refs/tags/t199", &g_ids[1]);
+	assert_reflog("refs/heads/master", 200, "update");
+	assert_reflog("HEAD", 200, "update");
+}
+
+void test_refs_reftable__sees_changes_from_others(void)
+{
+	git_repository *other;
+	git_reference *ref;
+
+	cl_git_pass(git_repository_open(&other, "testrepo"));
+	use_reftable(other);
+
+	cl_git_pass(git_reference_lookup(&ref, other, "refs/heads/master"));
+	cl_assert_equal_oid(&g_ids[0], git_reference_target(ref));
+	git_reference_free(ref);
+
+	cl_git_pass(git_reference_create(&ref, g_repo, "refs/heads/master", &g_ids[1], 1, NULL));
+	git_reference_free(ref);
+
+	cl_git_pass(git_reference_lookup(&ref, other, "refs/heads/master"));
+	cl_assert_equal_oid(&g_ids[1], git_reference_target(ref));
+	git_reference_free(ref);
+
+	/* and what is written on top of them */
+	cl_git_pass(git_reference_create(&ref, other, "refs/heads/master", &g_ids[2], 1, "other"));
+	git_reference_free(ref);
+
+	git_repository_free(other);
+
+	/* reopening reads the tables back */
+	g_repo = cl_git_sandbox_reopen();
+	use_reftable(g_repo);
+
+	assert_target("refs/heads/master", &g_ids[2]);
+	assert_reflog("refs/heads/master", 3, "other");
+}
+
+static void assert_log_at(git_reftable *table, const char *name, const char *expected, uint64_t update_index)
+{
+	git_reftable_cursor cursor = GIT_REFTABLE_CURSOR_INIT;
+	git_reftable_log *log;
+
+	cl_git_pass(git_reftable_seek_log(&cursor, table, name));
+
+	if (expected) {
+		cl_git_pass(git_reftable_next_log(&log, &cursor));
+		cl_assert_equal_s(expected, log->name);
+		cl_assert_equal_i(update_index, log->update_index);
+		cl_assert_equal_s("moved", log->message);
+	} else {
+		cl_git_fail_with(GIT_ITEROVER, git_reftable_next_log(&log, &cursor));
+	}
+
+	git_reftable_cursor_free(&cursor);
+}
+
+void test_refs_reftable__indexes_log_blocks(void)
+{
+	git_vector refs = GIT_VECTOR_INIT, logs = GIT_VECTOR_INIT;
+	git_reftable_log *entries, *log;
+	git_reftable_cursor cursor = GIT_REFTABLE_CURSOR_INIT;
+	git_reftable *table;
+	git_buf data = GIT_BUF_INIT;
+	git_stats before, after;
+	char (*names)[32];
+	size_t i, count = 0;
+
+	entries = git__calloc(500, sizeof(git_reftable_log));
+	names = git__calloc(50, sizeof(*names));
+	cl_assert(entries && names);
+
+	/* ten entries for each of fifty reflogs, in small blocks */
+	for (i = 0; i < 500; i++) {
+		log = &entries[i];
+
+		if (i % 10 == 0)
+			p_snprintf(names[i / 10], sizeof(names[i / 10]), "refs/heads/b%02d", (int)(i / 10));
+
+		log->name = names[i / 10];
+		log->update_index = 10 - i % 10;
+		log->type = GIT_REFTABLE_LOG_UPDATE;
+		git_oid_cpy(&log->old_id, &g_ids[i % 3]);
+		git_oid_cpy(&log->new_id, &g_ids[(i + 1) % 3]);
+		log->who_name = "Someone";
+		log->who_email = "someone@example.com";
+		log->when.time = 1234567890 + i;
+		log->message = "moved";
+
+		cl_git_pass(git_vector_insert(&logs, log));
+	}
+
+	cl_git_pass(git_reftable_write(&data, 256, 1, 10, &refs, &logs));
+	cl_git_pass(git_reftable_parse(&table, &data, "test.ref"));
+	cl_assert(table->log_index > table->log_start);
+
+	assert_log_at(table, "refs/heads/b00", "refs/heads/b00", 10);
+	assert_log_at(table, "refs/heads/b17", "refs/heads/b17", 10);
+	assert_log_at(table, "refs/heads/b49", "refs/heads/b49", 10);
+	assert_log_at(table, "refs/heads/a", "refs/heads/b00", 10);
+	assert_log_at(table, "refs/heads/b17x", "refs/heads/b18", 10);
+	assert_log_at(table, "refs/heads/c", NULL, 0);
+
+	/* looking up one reflog doesn't inflate the ones before it */
+	cl_git_pass(git_stats_init(&before, GIT_STATS_VERSION));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_STATS, &before));
+	cl_git_pass(git_reftable_seek_log(&cursor, table, "refs/heads/b49"));
+
+	while (git_reftable_next_log(&log, &cursor) == 0) {
+		cl_assert_equal_s("refs/heads/b49", log->name);
+		cl_assert_equal_i(10 - count++, log->update_index);
+	}
+	cl_assert_equal_sz(10, count);
+
+	cl_git_pass(git_stats_init(&after, GIT_STATS_VERSION));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_STATS, &after));
+	cl_assert(after.inflated_bytes - before.inflated_bytes < 2048);
+
+	git_reftable_cursor_free(&cursor);
+	git_reftable_free(table);
+	git_vector_free(&refs);
+	git_vector_free(&logs);
+	git__free(entries);
+	git__free(names);
+}
@@ -1,5 +1,7 @@
 #include "clar_libgit2.h"
 #include "git2/transaction.h"
+#include "git2/refdb.h"
+#include "fileops.h"
 
 static git_repository *g_repo;
 static git_transaction *g_tx;
@@ -13,6 +15,7 @@ void test_refs_transactions__initialize(void)
 void test_refs_transactions__cleanup(void)
 {
 	git_transaction_free(g_tx);
+	cl_git_pass(git_libgit2_opts(GIT_OPT_ENABLE_PACKED_REFS_MMAP, 0));
 	cl_git_sandbox_cleanup();
 }
 
@@ -108,3 +111,156 @@ void test_refs_transactions__unlocked_set(void)
 	cl_git_fail_with(GIT_ENOTFOUND, git_transaction_set_target(g_tx, "refs/heads/foo", &id, NULL, NULL));
 	cl_git_pass(git_transaction_commit(g_tx));
 }
+
+void test_refs_transactions__delete_many_packed(void)
+{
+	git_reference *ref;
+	git_refdb *refdb;
+	git_oid id;
+	char name[64];
+	int i;
+
+	git_oid_fromstr(&id, "a65fedf39aefe402d3bb6e24df4d4f5fe4547750");
+
+	for (i = 0; i < 50; i++) {
+		p_snprintf(name, sizeof(name), "refs/heads/batch-%02d", i);
+		cl_git_pass(git_reference_create(&ref, g_repo, name, &id, 0, NULL));
+		git_reference_free(ref);
+	}
+
+	cl_git_pass(git_repository_refdb(&refdb, g_repo));
+	cl_git_pass(git_refdb_compress(refdb));
+	git_refdb_free(refdb);
+
+	/* the order in which they're locked doesn't matter */
+	for (i = 49; i >= 0; i--) {
+		p_snprintf(name, sizeof(name), "refs/heads/batch-%02d", i);
+		cl_git_pass(git_transaction_lock_ref(g_tx, name));
+		cl_git_pass(git_transaction_remove(g_tx, name));
+	}
+
+	cl_git_pass(git_transaction_lock_ref(g_tx, "refs/heads/master"));
+	cl_git_pass(git_transaction_set_target(g_tx, "refs/heads/master", &id, NULL, NULL));
+	cl_git_pass(git_transaction_commit(g_tx));
+
+	for (i = 0; i < 50; i++) {
+		p_snprintf(name, sizeof(name), "refs/heads/batch-%02d", i);
+		cl_git_fail_with(GIT_ENOTFOUND, git_reference_lookup(&ref, g_repo, name));
+	}
+
+	cl_git_pass(git_reference_lookup(&ref, g_repo, "refs/heads/master"));
+	cl_assert(!git_oid_cmp(&id, git_reference_target(ref)));
+	git_reference_free(ref);
+
+	cl_git_pass(git_reference_lookup(&ref, g_repo, "refs/heads/packed"));
+	git_reference_free(ref);
+}
+
+void test_refs_transactions__failed_update_discards_later_ones(void)
+{
+	git_reference *ref;
+	git_oid id, other;
+
+	cl_git_pass(git_reference_name_to_id(&id, g_repo, "refs/heads/master"));
+	git_oid_fromstr(&other, "a65fedf39aefe402d3bb6e24df4d4f5fe4547750");
+
+	/* the missing reference comes first by name */
+	cl_git_pass(git_transaction_lock_ref(g_tx, "refs/heads/master"));
+	cl_git_pass(git_transaction_set_target(g_tx, "refs/heads/master", &other, NULL, NULL));
+	cl_git_pass(git_transaction_lock_ref(g_tx, "refs/heads/a-missing"));
+	cl_git_pass(git_transaction_remove(g_tx, "refs/heads/a-missing"));
+
+	cl_git_fail_with(GIT_ENOTFOUND, git_transaction_commit(g_tx));
+
+	cl_git_pass(git_reference_lookup(&ref, g_repo, "refs/heads/master"));
+	cl_assert(!git_oid_cmp(&id, git_reference_target(ref)));
+	git_reference_free(ref);
+
+	cl_assert(!git_path_exists("testrepo/.git/refs/heads/master.lock"));
+	cl_assert(!git_path_exists("testrepo/.git/refs/heads/a-missing.lock"));
+}
+
+static void packall(void)
+{
+	git_refdb *refdb;
+
+	cl_git_pass(git_repository_refdb(&refdb, g_repo));
+	cl_git_pass(git_refdb_compress(refdb));
+	git_refdb_free(refdb);
+}
+
+static void restart_transaction(void)
+{
+	git_transaction_free(g_tx);
+	cl_git_pass(git_transaction_new(&g_tx, g_repo));
+}
+
+static void assert_packed_paths_collide(void)
+{
+	git_reference *ref;
+	git_oid id, master;
+
+	git_oid_fromstr(&id, "a65fedf39aefe402d3bb6e24df4d4f5fe4547750");
+	cl_git_pass(git_reference_name_to_id(&master, g_repo, "refs/heads/master"));
+
+	/* the packed refs/heads/packed is where the directory would go */
+	cl_git_pass(git_transaction_lock_ref(g_tx, "refs/heads/packed/sub"));
+	cl_git_pass(git_transaction_set_target(g_tx, "refs/heads/packed/sub", &id, NULL, NULL));
+	cl_git_pass(git_transaction_lock_ref(g_tx, "refs/heads/master"));
+	cl_git_pass(git_transaction_set_target(g_tx, "refs/heads/master", &id, NULL, NULL));
+	cl_git_fail(git_transaction_commit(g_tx));
+
+	cl_git_fail_with(GIT_ENOTFOUND, git_reference_lookup(&ref, g_repo, "refs/heads/packed/sub"));
+
+	/* nothing is written when one of them collides */
+	cl_git_pass(git_reference_lookup(&ref, g_repo, "refs/heads/master"));
+	cl_assert(!git_oid_cmp(&master, git_reference_target(ref)));
+	git_reference_free(ref);
+
+	/* nor when the packed one is deleted along with it */
+	restart_transaction();
+	cl_git_pass(git_transaction_lock_ref(g_tx, "refs/heads/packed"));
+	cl_git_pass(git_transaction_remove(g_tx, "refs/heads/packed"));
+	cl_git_pass(git_transaction_lock_ref(g_tx, "refs/heads/packed/sub"));
+	cl_git_pass(git_transaction_set_target(g_tx, "refs/heads/packed/sub", &id, NULL, NULL));
+	cl_git_fail(git_transaction_commit(g_tx));
+
+	cl_git_pass(git_reference_lookup(&ref, g_repo, "refs/heads/packed"));
+	git_reference_free(ref);
+	cl_git_fail_with(GIT_ENOTFOUND, git_reference_lookup(&ref, g_repo, "refs/heads/packed/sub"));
+
+	/* and the other way around, with a packed reference beneath it */
+	cl_git_pass(git_reference_create(&ref, g_repo, "refs/heads/deep/sub", &id, 0, NULL));
+	git_reference_free(ref);
+	packall();
+
+	restart_transaction();
+	cl_git_pass(git_transaction_lock_ref(g_tx, "refs/heads/deep"));
+	cl_git_pass(git_transaction_set_target(g_tx, "refs/heads/deep", &id, NULL, NULL));
+	cl_git_fail(git_transaction_commit(g_tx));
+
+	cl_git_fail_with(GIT_ENOTFOUND, git_reference_lookup(&ref, g_repo, "refs/heads/deep"));
+
+	/* overwriting a packed reference is fine */
+	restart_transaction();
+	cl_git_pass(git_transaction_lock_ref(g_tx, "refs/heads/deep/sub"));
+	cl_git_pass(git_transaction_set_target(g_tx, "refs/heads/deep/sub", &master, NULL, NULL));
+	cl_git_pass(git_transaction_commit(g_tx));
+
+	cl_git_pass(git_reference_lookup(&ref, g_repo, "refs/heads/deep/sub"));
+	cl_assert(!git_oid_cmp(&master, git_reference_target(ref)));
+	git_reference_free(ref);
+}
+
+void test_refs_transactions__packed_paths_collide(void)
+{
+	assert_packed_paths_collide();
+}
+
+void test_refs_transactions__packed_paths_collide_in_snapshot(void)
+{
+	packall();
+	cl_git_pass(git_libgit2_opts(GIT_OPT_ENABLE_PACKED_REFS_MMAP, 1));
+
+	assert_packed_paths_collide();
+}
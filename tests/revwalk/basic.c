@@ -147,6 +147,43 @@ void test_revwalk_basic__sorting_modes(void)
 	cl_git_pass(test_walk(_walk, &id, GIT_SORT_TOPOLOGICAL | GIT_SORT_REVERSE, commit_sorting_topo_reverse, 2));
 }
 
+void test_revwalk_basic__sorting_modes_after_reset(void)
+{
+	git_oid id, oid;
+	int round;
+
+	revwalk_basic_setup_walk(NULL);
+
+	git_oid_fromstr(&id, commit_head);
+
+	/*
+	 * stop walks halfway, so that the reset has cells left in the
+	 * walker's lists to take back, and hand them out again
+	 */
+	for (round = 0; round < 3; round++) {
+		git_revwalk_sorting(_walk, GIT_SORT_TOPOLOGICAL | GIT_SORT_TIME);
+		cl_git_pass(git_revwalk_push(_walk, &id));
+		cl_git_pass(git_revwalk_next(&oid, _walk));
+		cl_git_pass(git_revwalk_next(&oid, _walk));
+		git_revwalk_reset(_walk);
+
+		cl_git_pass(test_walk(_walk, &id, GIT_SORT_TIME, commit_sorting_time, 1));
+		cl_git_pass(test_walk(_walk, &id, GIT_SORT_TOPOLOGICAL, commit_sorting_topo, 2));
+
+		git_revwalk_sorting(_walk, GIT_SORT_TIME | GIT_SORT_REVERSE);
+		cl_git_pass(git_revwalk_push(_walk, &id));
+		cl_git_pass(git_revwalk_next(&oid, _walk));
+		git_revwalk_reset(_walk);
+
+		cl_git_pass(test_walk(_walk, &id, GIT_SORT_TIME | GIT_SORT_REVERSE, commit_sorting_time_reverse, 1));
+		cl_git_pass(test_walk(_walk, &id, GIT_SORT_TOPOLOGICAL | GIT_SORT_REVERSE, commit_sorting_topo_reverse, 2));
+
+		git_revwalk_sorting(_walk, 0);
+		cl_git_pass(git_revwalk_push_range(_walk, "9fd738e~2..9fd738e"));
+		cl_git_pass(test_walk_only(_walk, commit_sorting_segment, 2));
+	}
+}
+
 void test_revwalk_basic__glob_heads(void)
 {
 	int i = 0;
@@ -0,0 +1,268 @@
+#include "clar_libgit2.h"
+#include "fileops.h"
+#include "index.h"
+#include "git2/sys/diff.h"
+#include "git2/sys/fsmonitor.h"
+
+static git_repository *g_repo;
+
+typedef struct {
+	git_fsmonitor parent;
+	int token;
+	int queries;
+	bool passthrough;
+	const char *changed[4];
+} fake_fsmonitor;
+
+static fake_fsmonitor *g_fsmonitor;
+
+static int fake_fsmonitor_query(
+	git_fsmonitor *fsmonitor,
+	git_buf *new_token,
+	const char *token,
+	git_fsmonitor_changed_cb changed,
+	void *payload)
+{
+	fake_fsmonitor *fake = (fake_fsmonitor *)fsmonitor;
+	size_t i;
+	int error;
+
+	fake->queries++;
+
+	if (token) {
+		for (i = 0; i < ARRAY_SIZE(fake->changed) && fake->changed[i]; i++)
+			if ((error = changed(fake->changed[i], payload)) < 0)
+				return error;
+	}
+
+	memset(fake->changed, 0, sizeof(fake->changed));
+
+	if (git_buf_printf(new_token, "token-%d", ++fake->token) < 0)
+		return -1;
+
+	return fake->passthrough ? GIT_PASSTHROUGH : 0;
+}
+
+static void fake_fsmonitor_free(git_fsmonitor *fsmonitor)
+{
+	git__free(fsmonitor);
+}
+
+/* Files modified in the second the index is written are racy */
+static void age_file(const char *path)
+{
+	struct p_timeval times[2];
+
+	times[0].tv_sec = times[1].tv_sec = time(NULL) - 60;
+	times[0].tv_usec = times[1].tv_usec = 0;
+
+	cl_must_pass(p_utimes(path, times));
+}
+
+void test_status_fsmonitor__initialize(void)
+{
+	git_index *index;
+
+	g_repo = cl_git_sandbox_init("empty_standard_repo");
+
+	cl_git_mkfile("empty_standard_repo/one.txt", "one\n");
+	cl_git_mkfile("empty_standard_repo/two.txt", "two\n");
+	cl_must_pass(p_mkdir("empty_standard_repo/dir", 0777));
+	cl_git_mkfile("empty_standard_repo/dir/three.txt", "three\n");
+	cl_git_mkfile("empty_standard_repo/dir/four.txt", "four\n");
+
+	age_file("empty_standard_repo/one.txt");
+	age_file("empty_standard_repo/two.txt");
+	age_file("empty_standard_repo/dir/three.txt");
+	age_file("empty_standard_repo/dir/four.txt");
+
+	cl_git_pass(git_repository_index(&index, g_repo));
+	cl_git_pass(git_index_add_bypath(index, "one.txt"));
+	cl_git_pass(git_index_add_bypath(index, "two.txt"));
+	cl_git_pass(git_index_add_bypath(index, "dir/three.txt"));
+	cl_git_pass(git_index_add_bypath(index, "dir/four.txt"));
+	cl_git_pass(git_index_write(index));
+	git_index_free(index);
+
+	g_fsmonitor = git__calloc(1, sizeof(fake_fsmonitor));
+	cl_assert(g_fsmonitor);
+	cl_git_pass(git_fsmonitor_init(&g_fsmonitor->parent, GIT_FSMONITOR_VERSION));
+	g_fsmonitor->parent.query = fake_fsmonitor_query;
+	g_fsmonitor->parent.free = fake_fsmonitor_free;
+
+	cl_git_pass(git_repository_set_fsmonitor(g_repo, &g_fsmonitor->parent));
+}
+
+void test_status_fsmonitor__cleanup(void)
+{
+	g_fsmonitor = NULL;
+	cl_git_sandbox_cleanup();
+}
+
+/* Run a status which updates the index, and return its number of stats */
+static size_t refresh(void)
+{
+	git_diff_options opts = GIT_DIFF_OPTIONS_INIT;
+	git_diff_perfdata perf = GIT_DIFF_PERFDATA_INIT;
+	git_diff *diff;
+	git_index *index;
+
+	opts.flags = GIT_DIFF_UPDATE_INDEX;
+
+	cl_git_pass(git_repository_index(&index, g_repo));
+	cl_git_pass(git_diff_index_to_workdir(&diff, g_repo, index, &opts));
+	cl_git_pass(git_diff_get_perfdata(&perf, diff));
+	git_diff_free(diff);
+	git_index_free(index);
+
+	return perf.stat_calls;
+}
+
+/* The working directory status; every file is new to the index */
+static unsigned int status_of(const char *path)
+{
+	unsigned int status;
+	cl_git_pass(git_status_file(&status, g_repo, path));
+	cl_assert(status & GIT_STATUS_INDEX_NEW);
+	return status & ~GIT_STATUS_INDEX_NEW;
+}
+
+static bool is_valid(git_index *index, const char *path)
+{
+	const git_index_entry *entry = git_index_get_bypath(index, path, 0);
+
+	cl_assert(entry);
+	return (entry->flags_extended & GIT_IDXENTRY_FSMONITOR_VALID) != 0;
+}
+
+void test_status_fsmonitor__writes_extension(void)
+{
+	git_index *index;
+
+	refresh();
+	cl_assert_equal_i(1, g_fsmonitor->queries);
+
+	cl_git_pass(git_index_open(&index, "empty_standard_repo/.git/index"));
+	cl_assert_equal_s("token-1", index->fsmonitor_token);
+	cl_assert(is_valid(index, "one.txt"));
+	cl_assert(is_valid(index, "two.txt"));
+	cl_assert(is_valid(index, "dir/three.txt"));
+	cl_assert(is_valid(index, "dir/four.txt"));
+	git_index_free(index);
+}
+
+void test_status_fsmonitor__extension_round_trips(void)
+{
+	git_index *index;
+
+	refresh();
+	g_fsmonitor->changed[0] = "two.txt";
+	refresh();
+
+	cl_git_pass(git_index_open(&index, "empty_standard_repo/.git/index"));
+	cl_assert_equal_s("token-2", index->fsmonitor_token);
+	cl_git_pass(git_index_write(index));
+	git_index_free(index);
+
+	cl_git_pass(git_index_open(&index, "empty_standard_repo/.git/index"));
+	cl_assert_equal_s("token-2", index->fsmonitor_token);
+	cl_assert(is_valid(index, "one.txt"));
+	cl_assert(is_valid(index, "two.txt"));
+	cl_assert(is_valid(index, "dir/three.txt"));
+	git_index_free(index);
+}
+
+void test_status_fsmonitor__new_token_alone_does_not_write_index(void)
+{
+	git_index *index;
+
+	refresh();
+	refresh();
+	cl_assert_equal_i(2, g_fsmonitor->queries);
+
+	cl_git_pass(git_index_open(&index, "empty_standard_repo/.git/index"));
+	cl_assert_equal_s("token-1", index->fsmonitor_token);
+	git_index_free(index);
+
+	g_fsmonitor->changed[0] = "one.txt";
+	refresh();
+
+	cl_git_pass(git_index_open(&index, "empty_standard_repo/.git/index"));
+	cl_assert_equal_s("token-3", index->fsmonitor_token);
+	cl_assert(is_valid(index, "one.txt"));
+	git_index_free(index);
+}
+
+void test_status_fsmonitor__skips_unchanged_files(void)
+{
+	size_t all_stats;
+
+	all_stats = refresh();
+	cl_assert_equal_sz(all_stats - 4, refresh());
+
+	g_fsmonitor->changed[0] = "one.txt";
+	cl_assert_equal_sz(all_stats - 3, refresh());
+}
+
+void test_status_fsmonitor__trusts_the_monitor(void)
+{
+	refresh();
+
+	/* a change which is not reported goes unnoticed... */
+	cl_git_rewritefile("empty_standard_repo/one.txt", "changed\n");
+	cl_assert_equal_i(GIT_STATUS_CURRENT, status_of("one.txt"));
+
+	/* ...until it is */
+	g_fsmonitor->changed[0] = "one.txt";
+	cl_assert_equal_i(GIT_STATUS_WT_MODIFIED, status_of("one.txt"));
+	cl_assert_equal_i(GIT_STATUS_WT_MODIFIED, status_of("one.txt"));
+}
+
+void test_status_fsmonitor__reports_directories(void)
+{
+	refresh();
+
+	cl_git_rewritefile("empty_standard_repo/dir/three.txt", "changed\n");
+	cl_must_pass(p_unlink("empty_standard_repo/dir/four.txt"));
+	cl_git_rewritefile("empty_standard_repo/two.txt", "changed\n");
+
+	g_fsmonitor->changed[0] = "dir/";
+	cl_assert_equal_i(GIT_STATUS_WT_MODIFIED, status_of("dir/three.txt"));
+	cl_assert_equal_i(GIT_STATUS_WT_DELETED, status_of("dir/four.txt"));
+	cl_assert_equal_i(GIT_STATUS_CURRENT, status_of("two.txt"));
+}
+
+void test_status_fsmonitor__passthrough_looks_at_everything(void)
+{
+	refresh();
+
+	cl_git_rewritefile("empty_standard_repo/one.txt", "changed\n");
+
+	g_fsmonitor->passthrough = true;
+	cl_assert_equal_i(GIT_STATUS_WT_MODIFIED, status_of("one.txt"));
+}
+
+void test_status_fsmonitor__new_entries_are_not_valid(void)
+{
+	git_index *index;
+
+	refresh();
+
+	cl_git_rewritefile("empty_standard_repo/one.txt", "changed\n");
+
+	cl_git_pass(git_repository_index(&index, g_repo));
+	cl_git_pass(git_index_add_bypath(index, "one.txt"));
+	cl_assert(!is_valid(index, "one.txt"));
+	cl_assert(is_valid(index, "two.txt"));
+	git_index_free(index);
+}
+
+void test_status_fsmonitor__can_be_removed(void)
+{
+	refresh();
+
+	cl_git_rewritefile("empty_standard_repo/one.txt", "changed\n");
+	cl_git_pass(git_repository_set_fsmonitor(g_repo, NULL));
+
+	cl_assert_equal_i(GIT_STATUS_WT_MODIFIED, status_of("one.txt"));
+}
@@ -0,0 +1,127 @@
+#include "clar_libgit2.h"
+#include "fileops.h"
+#include "git2/sys/diff.h"
+
+static git_repository *g_repo;
+static unsigned int g_threads;
+
+/* enough entries for the index to be looked up on several threads */
+#define DIRS 12
+#define FILES_PER_DIR 100
+
+void test_status_stat_threads__initialize(void)
+{
+	git_index *index;
+	git_buf path = GIT_BUF_INIT;
+	int i, j;
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_WORKDIR_STAT_THREADS, &g_threads));
+
+	g_repo = cl_git_sandbox_init("empty_standard_repo");
+	cl_git_pass(git_repository_index(&index, g_repo));
+
+	for (i = 0; i < DIRS; i++) {
+		git_buf_clear(&path);
+		cl_git_pass(git_buf_printf(&path, "empty_standard_repo/dir%02d", i));
+		cl_must_pass(p_mkdir(path.ptr, 0777));
+
+		for (j = 0; j < FILES_PER_DIR; j++) {
+			git_buf_clear(&path);
+			cl_git_pass(git_buf_printf(&path,
+				"empty_standard_repo/dir%02d/file%03d.txt", i, j));
+			cl_git_mkfile(path.ptr, path.ptr);
+			cl_git_pass(git_index_add_bypath(index,
+				path.ptr + strlen("empty_standard_repo/")));
+		}
+	}
+
+	cl_git_pass(git_index_write(index));
+	git_index_free(index);
+	git_buf_free(&path);
+}
+
+void test_status_stat_threads__cleanup(void)
+{
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_WORKDIR_STAT_THREADS, g_threads));
+	cl_git_sandbox_cleanup();
+}
+
+static int status_cb(const char *path, unsigned int flags, void *payload)
+{
+	return git_buf_printf((git_buf *)payload, "%s:%u\n", path, flags);
+}
+
+static void status_with_threads(git_buf *out, unsigned int threads)
+{
+	git_status_options opts = GIT_STATUS_OPTIONS_INIT;
+
+	opts.flags = GIT_STATUS_OPT_INCLUDE_UNTRACKED |
+		GIT_STATUS_OPT_RECURSE_UNTRACKED_DIRS |
+		GIT_STATUS_OPT_INCLUDE_UNMODIFIED;
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_WORKDIR_STAT_THREADS, threads));
+	cl_git_pass(git_status_foreach_ext(g_repo, &opts, status_cb, out));
+}
+
+void test_status_stat_threads__matches_serial_status(void)
+{
+	git_buf serial = GIT_BUF_INIT, threaded = GIT_BUF_INIT;
+
+#ifndef GIT_THREADS
+	clar__skip();
+#endif
+
+	cl_git_rewritefile("empty_standard_repo/dir00/file000.txt", "changed\n");
+	cl_git_rewritefile("empty_standard_repo/dir05/file050.txt", "changed\n");
+	cl_must_pass(p_unlink("empty_standard_repo/dir07/file001.txt"));
+	cl_must_pass(p_unlink("empty_standard_repo/dir11/file099.txt"));
+	cl_git_mkfile("empty_standard_repo/dir03/untracked.txt", "untracked\n");
+
+	/* a file of the index which is now a directory */
+	cl_must_pass(p_unlink("empty_standard_repo/dir09/file009.txt"));
+	cl_must_pass(p_mkdir("empty_standard_repo/dir09/file009.txt", 0777));
+	cl_git_mkfile("empty_standard_repo/dir09/file009.txt/inner", "inner\n");
+
+	status_with_threads(&serial, 1);
+	status_with_threads(&threaded, 4);
+	cl_assert_equal_s(serial.ptr, threaded.ptr);
+
+	git_buf_clear(&threaded);
+	status_with_threads(&threaded, 0);
+	cl_assert_equal_s(serial.ptr, threaded.ptr);
+
+	cl_assert(strstr(serial.ptr, "dir00/file000.txt:257\n") != NULL);
+	cl_assert(strstr(serial.ptr, "dir07/file001.txt:513\n") != NULL);
+	cl_assert(strstr(serial.ptr, "dir09/file009.txt/inner:128\n") != NULL);
+
+	git_buf_free(&serial);
+	git_buf_free(&threaded);
+}
+
+static size_t stat_calls_with_threads(unsigned int threads)
+{
+	git_diff_perfdata perf = GIT_DIFF_PERFDATA_INIT;
+	git_diff *diff;
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_WORKDIR_STAT_THREADS, threads));
+	cl_git_pass(git_diff_index_to_workdir(&diff, g_repo, NULL, NULL));
+	cl_git_pass(git_diff_get_perfdata(&perf, diff));
+	git_diff_free(diff);
+
+	return perf.stat_calls;
+}
+
+void test_status_stat_threads__stats_the_index_ahead(void)
+{
+#ifndef GIT_THREADS
+	clar__skip();
+#endif
+
+	cl_must_pass(p_unlink("empty_standard_repo/dir07/file001.txt"));
+
+	/* the threads look at every file of the index, including the one
+	 * which is gone, and nothing else stats the files again
+	 */
+	cl_assert_equal_sz(
+		stat_calls_with_threads(1) + 1, stat_calls_with_threads(2));
+}
@@ -0,0 +1,267 @@
+#include "clar_libgit2.h"
+#include "fileops.h"
+#include "index.h"
+#include "untracked-cache.h"
+
+static git_repository *g_repo;
+
+void test_status_untracked_cache__initialize(void)
+{
+	git_index *index;
+
+	g_repo = cl_git_sandbox_init("empty_standard_repo");
+	cl_repo_set_bool(g_repo, "core.untrackedCache", true);
+
+	cl_git_mkfile("empty_standard_repo/.gitignore", "*.log\n");
+	cl_git_mkfile("empty_standard_repo/tracked.txt", "tracked\n");
+	cl_git_mkfile("empty_standard_repo/untracked.txt", "untracked\n");
+	cl_git_mkfile("empty_standard_repo/ignored.log", "ignored\n");
+	cl_must_pass(p_mkdir("empty_standard_repo/dir", 0777));
+	cl_git_mkfile("empty_standard_repo/dir/tracked.txt", "tracked\n");
+	cl_git_mkfile("empty_standard_repo/dir/untracked.txt", "untracked\n");
+	cl_git_mkfile("empty_standard_repo/dir/ignored.log", "ignored\n");
+	cl_must_pass(p_mkdir("empty_standard_repo/newdir", 0777));
+	cl_git_mkfile("empty_standard_repo/newdir/file.txt", "new\n");
+
+	cl_git_pass(git_repository_index(&index, g_repo));
+	cl_git_pass(git_index_add_bypath(index, "tracked.txt"));
+	cl_git_pass(git_index_add_bypath(index, "dir/tracked.txt"));
+	cl_git_pass(git_index_write(index));
+	git_index_free(index);
+}
+
+void test_status_untracked_cache__cleanup(void)
+{
+	cl_git_sandbox_cleanup();
+}
+
+/* Directories modified in the second of the scan are not cached */
+static void age_dir(const char *path)
+{
+	struct p_timeval times[2];
+
+	times[0].tv_sec = times[1].tv_sec = time(NULL) - 60;
+	times[0].tv_usec = times[1].tv_usec = 0;
+
+	cl_must_pass(p_utimes(path, times));
+}
+
+static void age_dirs(void)
+{
+	age_dir("empty_standard_repo");
+	age_dir("empty_standard_repo/dir");
+	age_dir("empty_standard_repo/newdir");
+}
+
+static int status_cb(const char *path, unsigned int flags, void *payload)
+{
+	return git_buf_printf((git_buf *)payload, "%s:%u\n", path, flags);
+}
+
+static void assert_status(const char *expected)
+{
+	git_status_options opts = GIT_STATUS_OPTIONS_INIT;
+	git_buf actual = GIT_BUF_INIT;
+
+	opts.flags = GIT_STATUS_OPT_INCLUDE_UNTRACKED |
+		GIT_STATUS_OPT_RECURSE_UNTRACKED_DIRS |
+		GIT_STATUS_OPT_UPDATE_INDEX;
+
+	cl_git_pass(git_status_foreach_ext(g_repo, &opts, status_cb, &actual));
+	cl_assert_equal_s(expected, actual.ptr);
+
+	git_buf_free(&actual);
+}
+
+#define EXPECTED_STATUS \
+	".gitignore:128\n" \
+	"dir/tracked.txt:1\n" \
+	"dir/untracked.txt:128\n" \
+	"newdir/file.txt:128\n" \
+	"tracked.txt:1\n" \
+	"untracked.txt:128\n"
+
+static git_untracked_cache_dir *lookup_dir(git_index *index, const char *path)
+{
+	cl_assert(index->untracked);
+	return git_untracked_cache_dir_lookup(index->untracked, path, strlen(path));
+}
+
+void test_status_untracked_cache__writes_extension(void)
+{
+	git_index *index;
+	git_untracked_cache_dir *dir;
+	git_oid gitignore_id;
+
+	age_dirs();
+	assert_status(EXPECTED_STATUS);
+
+	cl_git_pass(git_odb_hash(&gitignore_id, "*.log\n", 6, GIT_OBJ_BLOB));
+
+	/* read it back */
+	cl_git_pass(git_index_open(&index, "empty_standard_repo/.git/index"));
+
+	dir = lookup_dir(index, "");
+	cl_assert(dir->valid);
+	cl_assert_equal_sz(3, dir->untracked.length);
+	cl_assert_equal_s(".gitignore", git_vector_get(&dir->untracked, 0));
+	cl_assert_equal_s("newdir/", git_vector_get(&dir->untracked, 1));
+	cl_assert_equal_s("untracked.txt", git_vector_get(&dir->untracked, 2));
+	cl_assert_equal_oid(&gitignore_id, &dir->exclude_id);
+
+	dir = lookup_dir(index, "dir/");
+	cl_assert(dir->valid);
+	cl_assert_equal_sz(1, dir->untracked.length);
+	cl_assert_equal_s("untracked.txt", git_vector_get(&dir->untracked, 0));
+
+	git_index_free(index);
+}
+
+void test_status_untracked_cache__does_not_cache_racy_directories(void)
+{
+	git_index *index;
+
+	assert_status(EXPECTED_STATUS);
+
+	cl_git_pass(git_repository_index(&index, g_repo));
+	cl_assert(!lookup_dir(index, "")->valid);
+	cl_assert(!lookup_dir(index, "dir/")->valid);
+	git_index_free(index);
+}
+
+void test_status_untracked_cache__uses_the_cache(void)
+{
+	git_index *index;
+	git_untracked_cache_dir *dir;
+
+	age_dirs();
+	assert_status(EXPECTED_STATUS);
+
+	/* pretend that the ignored file was untracked when we looked */
+	cl_git_pass(git_repository_index(&index, g_repo));
+	dir = lookup_dir(index, "dir/");
+	cl_assert(dir->valid);
+	cl_git_pass(git_vector_insert(&dir->untracked, git__strdup("ignored.log")));
+	git_index_free(index);
+
+	assert_status(
+		".gitignore:128\n"
+		"dir/ignored.log:128\n"
+		"dir/tracked.txt:1\n"
+		"dir/untracked.txt:128\n"
+		"newdir/file.txt:128\n"
+		"tracked.txt:1\n"
+		"untracked.txt:128\n");
+}
+
+void test_status_untracked_cache__is_not_used_with_custom_rules(void)
+{
+	git_index *index;
+	git_untracked_cache_dir *dir;
+
+	age_dirs();
+	assert_status(EXPECTED_STATUS);
+
+	cl_git_pass(git_repository_index(&index, g_repo));
+	dir = lookup_dir(index, "dir/");
+	cl_git_pass(git_vector_insert(&dir->untracked, git__strdup("ignored.log")));
+	git_index_free(index);
+
+	cl_git_pass(git_ignore_add_rule(g_repo, "newdir/\n"));
+
+	assert_status(
+		".gitignore:128\n"
+		"dir/tracked.txt:1\n"
+		"dir/untracked.txt:128\n"
+		"tracked.txt:1\n"
+		"untracked.txt:128\n");
+}
+
+void test_status_untracked_cache__changed_gitignore_invalidates(void)
+{
+	git_index *index;
+	git_untracked_cache_dir *dir;
+
+	age_dirs();
+	assert_status(EXPECTED_STATUS);
+
+	cl_git_pass(git_repository_index(&index, g_repo));
+	dir = lookup_dir(index, "dir/");
+	cl_git_pass(git_vector_insert(&dir->untracked, git__strdup("ignored.log")));
+	git_index_free(index);
+
+	cl_git_rewritefile("empty_standard_repo/.gitignore", "*.log\nuntracked.txt\n");
+	age_dirs();
+
+	assert_status(
+		".gitignore:128\n"
+		"dir/tracked.txt:1\n"
+		"newdir/file.txt:128\n"
+		"tracked.txt:1\n");
+}
+
+void test_status_untracked_cache__follows_changes(void)
+{
+	git_index *index;
+
+	age_dirs();
+	assert_status(EXPECTED_STATUS);
+	assert_status(EXPECTED_STATUS);
+
+	/* a new untracked file changes the directory's mtime */
+	cl_git_mkfile("empty_standard_repo/dir/another.txt", "another\n");
+	assert_status(
+		".gitignore:128\n"
+		"dir/another.txt:128\n"
+		"dir/tracked.txt:1\n"
+		"dir/untracked.txt:128\n"
+		"newdir/file.txt:128\n"
+		"tracked.txt:1\n"
+		"untracked.txt:128\n");
+
+	/* adding a file to the index does not */
+	age_dirs();
+	assert_status(
+		".gitignore:128\n"
+		"dir/another.txt:128\n"
+		"dir/tracked.txt:1\n"
+		"dir/untracked.txt:128\n"
+		"newdir/file.txt:128\n"
+		"tracked.txt:1\n"
+		"untracked.txt:128\n");
+
+	cl_git_pass(git_repository_index(&index, g_repo));
+	cl_git_pass(git_index_add_bypath(index, "newdir/file.txt"));
+	cl_git_pass(git_index_remove_bypath(index, "dir/tracked.txt"));
+	cl_git_pass(git_index_write(index));
+	git_index_free(index);
+
+	assert_status(
+		".gitignore:128\n"
+		"dir/another.txt:128\n"
+		"dir/tracked.txt:128\n"
+		"dir/untracked.txt:128\n"
+		"newdir/file.txt:1\n"
+		"tracked.txt:1\n"
+		"untracked.txt:128\n");
+}
+
+void test_status_untracked_cache__can_be_disabled(void)
+{
+	git_index *index;
+
+	age_dirs();
+	assert_status(EXPECTED_STATUS);
+
+	cl_repo_set_bool(g_repo, "core.untrackedCache", false);
+	assert_status(EXPECTED_STATUS);
+
+	cl_git_pass(git_repository_index(&index, g_repo));
+	cl_assert(index->untracked == NULL);
+	cl_git_pass(git_index_write(index));
+	git_index_free(index);
+
+	cl_git_pass(git_index_open(&index, "empty_standard_repo/.git/index"));
+	cl_assert(index->untracked == NULL);
+	git_index_free(index);
+}
@@ -71,6 +71,43 @@ void assert_show(
 	cl_assert_equal_i(0, counts.wrong_sorted_path);
 }
 
+void test_status_worktree__list_with_many_entries(void)
+{
+	git_repository *repo = cl_git_sandbox_init("empty_standard_repo");
+	git_status_options opts = GIT_STATUS_OPTIONS_INIT;
+	git_status_list *list;
+	const git_status_entry *entry;
+	git_buf path = GIT_BUF_INIT;
+	size_t i;
+
+	/* enough entries to fill several pages of the list's pool */
+	for (i = 0; i < 1000; i++) {
+		git_buf_clear(&path);
+		cl_git_pass(git_buf_printf(&path, "empty_standard_repo/file%04d", (int)i));
+		cl_git_mkfile(path.ptr, path.ptr);
+	}
+
+	opts.flags = GIT_STATUS_OPT_INCLUDE_UNTRACKED;
+	cl_git_pass(git_status_list_new(&list, repo, &opts));
+	cl_assert_equal_sz(1000, git_status_list_entrycount(list));
+
+	for (i = 0; i < 1000; i++) {
+		git_buf_clear(&path);
+		cl_git_pass(git_buf_printf(&path, "file%04d", (int)i));
+
+		entry = git_status_byindex(list, i);
+		cl_assert(entry);
+		cl_assert_equal_i(GIT_STATUS_WT_NEW, entry->status);
+		cl_assert_equal_p(NULL, entry->head_to_index);
+		cl_assert_equal_s(path.ptr, entry->index_to_workdir->new_file.path);
+	}
+
+	cl_assert_equal_p(NULL, git_status_byindex(list, 1000));
+
+	git_status_list_free(list);
+	git_buf_free(&path);
+}
+
 void test_status_worktree__show_index_and_workdir(void)
 {
 	assert_show(entry_count0, entry_paths0, entry_statuses0,
@@ -0,0 +1,79 @@
+#include "clar_libgit2.h"
+
+#include "thread_helpers.h"
+
+static size_t _window_size, _mapped_limit;
+static const char *_repo_path;
+
+void test_threads_packs__initialize(void)
+{
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_MWINDOW_SIZE, &_window_size));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_MWINDOW_MAPPED_LIMIT, &_mapped_limit));
+}
+
+void test_threads_packs__cleanup(void)
+{
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_MWINDOW_SIZE, _window_size));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_MWINDOW_MAPPED_LIMIT, _mapped_limit));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_ENABLE_CACHING, 1));
+}
+
+static int read_object(const git_oid *id, void *payload)
+{
+	git_odb_object *object;
+
+	cl_git_pass(git_odb_read(&object, payload, id));
+	git_odb_object_free(object);
+
+	return 0;
+}
+
+static void *read_all_objects(void *data)
+{
+	git_repository *repo;
+	git_odb *odb;
+	int i;
+
+	/* each thread has its own repository, but they share the packs */
+	cl_git_pass(git_repository_open(&repo, _repo_path));
+	cl_git_pass(git_repository_odb(&odb, repo));
+
+	for (i = 0; i < 10; i++)
+		cl_git_pass(git_odb_foreach(odb, read_object, odb));
+
+	git_odb_free(odb);
+	git_repository_free(repo);
+	return data;
+}
+
+static void get_stats(git_stats *stats)
+{
+	cl_git_pass(git_stats_init(stats, GIT_STATS_VERSION));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_STATS, stats));
+}
+
+void test_threads_packs__read_with_few_windows(void)
+{
+	git_stats before, after;
+	size_t alignment;
+
+	/*
+	 * With windows this small, the threads keep closing each other's
+	 * windows, in the same pack as well as in the others. Windows
+	 * start at a multiple of half their size, which mmap must allow.
+	 */
+	cl_git_pass(git__mmap_alignment(&alignment));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_MWINDOW_SIZE, 2 * alignment));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_MWINDOW_MAPPED_LIMIT, 4 * alignment));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_ENABLE_CACHING, 0));
+	get_stats(&before);
+
+	_repo_path = cl_fixture("testrepo.git");
+	run_in_parallel(1, 8, read_all_objects, NULL, NULL);
+
+	/* the windows are all gone along with the packs */
+	get_stats(&after);
+	cl_assert(after.mwindow_unmaps > before.mwindow_unmaps);
+	cl_assert_equal_sz(before.mwindow_open, after.mwindow_open);
+	cl_assert_equal_sz(before.mwindow_mapped, after.mwindow_mapped);
+}
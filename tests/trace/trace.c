@@ -104,3 +104,64 @@ void test_trace_trace__writes_lower_level(void)
 	cl_skip();
 #endif
 }
+
+static git_buf collected = GIT_BUF_INIT;
+
+static void collect_callback(git_trace_level_t level, const char *message)
+{
+	GIT_UNUSED(level);
+	cl_git_pass(git_buf_printf(&collected, "%s\n", message));
+}
+
+void test_trace_trace__appends_elapsed_time(void)
+{
+#ifdef GIT_TRACE
+	double start;
+
+	cl_git_pass(git_trace_set(GIT_TRACE_INFO, collect_callback));
+
+	start = git_trace_start(GIT_TRACE_DEBUG);
+	git_trace_timed(GIT_TRACE_DEBUG, start, "Hello %s!", "world");
+	cl_assert_equal_sz(0, collected.size);
+
+	start = git_trace_start(GIT_TRACE_INFO);
+	git_trace_timed(GIT_TRACE_INFO, start, "Hello %s!", "world");
+	cl_assert(!git__prefixcmp(collected.ptr, "Hello world! ("));
+	cl_assert(!git__suffixcmp(collected.ptr, " ms)\n"));
+
+	git_buf_free(&collected);
+#else
+	cl_skip();
+#endif
+}
+
+void test_trace_trace__traces_object_reads(void)
+{
+#ifdef GIT_TRACE
+	git_repository *repo;
+	git_odb *odb;
+	git_odb_object *obj;
+	git_oid id;
+
+	cl_git_pass(git_repository_open(&repo, cl_fixture("testrepo.git")));
+	cl_git_pass(git_repository_odb(&odb, repo));
+	cl_git_pass(git_trace_set(GIT_TRACE_TRACE, collect_callback));
+
+	/* a blob which is a delta in the pack */
+	cl_git_pass(git_oid_fromstr(&id, "8157f9e57bd9de5ab95b89fb9c7192a5668322f4"));
+	cl_git_pass(git_odb_read(&obj, odb, &id));
+	git_odb_object_free(obj);
+
+	cl_git_pass(git_trace_set(GIT_TRACE_NONE, NULL));
+
+	cl_assert(strstr(collected.ptr, "pack: unpacked blob at ") != NULL);
+	cl_assert(strstr(collected.ptr,
+		"odb: read 8157f9e57bd9de5ab95b89fb9c7192a5668322f4 from backend ") != NULL);
+
+	git_buf_free(&collected);
+	git_odb_free(odb);
+	git_repository_free(repo);
+#else
+	cl_skip();
+#endif
+}